@@ -19,6 +19,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "google/api/service.pb.h"
 #include "include/api_manager/env_interface.h"
@@ -29,11 +30,113 @@
 namespace google {
 namespace api_manager {
 
+// Statistics from the JWT authentication cache.
+struct JwtCacheStatistics {
+  // Number of cache lookups that found a token.
+  uint64_t hits;
+  // Number of cache lookups that missed.
+  uint64_t misses;
+  // Number of entries dropped by the LRU to stay within the byte budget.
+  uint64_t evictions;
+  // Estimated resident bytes of the cache.
+  uint64_t resident_bytes;
+
+  // Merge two statistics.
+  void Merge(const JwtCacheStatistics& v) {
+    hits += v.hits;
+    misses += v.misses;
+    evictions += v.evictions;
+    resident_bytes += v.resident_bytes;
+  }
+};
+
+// Statistics from the security rules authorization cache.
+struct AuthzCacheStatistics {
+  // Number of cache lookups that found an unexpired verdict.
+  uint64_t hits;
+  // Number of cache lookups that missed or found an expired verdict.
+  uint64_t misses;
+  // Number of entries dropped by the LRU to stay within the entry budget.
+  uint64_t evictions;
+  // Estimated resident bytes of the cache.
+  uint64_t resident_bytes;
+
+  // Merge two statistics.
+  void Merge(const AuthzCacheStatistics& v) {
+    hits += v.hits;
+    misses += v.misses;
+    evictions += v.evictions;
+    resident_bytes += v.resident_bytes;
+  }
+};
+
+// A latency histogram with power-of-two buckets: buckets[b] counts
+// samples with floor(log2(micros)) == b, with 0 landing in bucket 0 and
+// everything beyond the last bucket landing in it. Recording is a handful
+// of instructions, and the struct is plain data so it can be copied into
+// shared memory.
+struct LatencyHistogram {
+  // 2^25 microseconds is ~33s; slower samples go to the last bucket.
+  static const int kNumBuckets = 26;
+
+  // Number of recorded samples.
+  uint64_t count;
+  // Sum of all samples, in microseconds.
+  uint64_t total_micros;
+  uint64_t buckets[kNumBuckets];
+
+  void Record(uint64_t micros) {
+    int bucket = 0;
+    while ((micros >> (bucket + 1)) != 0 && bucket < kNumBuckets - 1) {
+      ++bucket;
+    }
+    ++buckets[bucket];
+    ++count;
+    total_micros += micros;
+  }
+
+  // Merge two histograms.
+  void Merge(const LatencyHistogram& v) {
+    count += v.count;
+    total_micros += v.total_micros;
+    for (int i = 0; i < kNumBuckets; ++i) {
+      buckets[i] += v.buckets[i];
+    }
+  }
+};
+
+// Per-phase latency of the check workflow, recorded when the
+// enable_check_latency_statistics experimental flag is set. Each phase
+// histogram covers one kind of check handler; total covers a request's
+// whole check, from the creation of its request context to check
+// completion.
+struct CheckLatencyStatistics {
+  LatencyHistogram fetch_token;
+  LatencyHistogram auth;
+  LatencyHistogram security_rules;
+  LatencyHistogram service_control;
+  LatencyHistogram quota;
+  LatencyHistogram total;
+
+  // Merge two statistics.
+  void Merge(const CheckLatencyStatistics& v) {
+    fetch_token.Merge(v.fetch_token);
+    auth.Merge(v.auth);
+    security_rules.Merge(v.security_rules);
+    service_control.Merge(v.service_control);
+    quota.Merge(v.quota);
+    total.Merge(v.total);
+  }
+};
+
 // Data to summarize the API Manager statistics.
 // Important note: please don't use std::string. These fields are directly
 // copied into a shared memory.
 struct ApiManagerStatistics {
   service_control::Statistics service_control_statistics;
+  JwtCacheStatistics jwt_cache_statistics;
+  AuthzCacheStatistics authz_cache_statistics;
+  CheckLatencyStatistics check_latency_statistics;
 };
 
 // Service config rollouts information for /endpoints_status
@@ -48,6 +151,18 @@ struct ServiceConfigRolloutsInfo {
   uint64_t remote_rollout_calls;
 };
 
+// Precompiled response values for answering CORS preflight requests directly
+// from the proxy. Built once from the server config cors_preset_config.
+struct CorsPreflightResponse {
+  // Origins allowed to make cross-origin requests; "*" allows any origin.
+  std::vector<std::string> allowed_origins;
+  // Precomputed values of the Access-Control-Allow-Methods,
+  // Access-Control-Allow-Headers and Access-Control-Max-Age response headers.
+  std::string allowed_methods;
+  std::string allowed_headers;
+  std::string max_age;
+};
+
 class ApiManager {
  public:
   virtual ~ApiManager() {}
@@ -113,9 +228,23 @@ class ApiManager {
   virtual utils::Status GetServiceConfigRollouts(
       ServiceConfigRolloutsInfo *rollouts) = 0;
 
+  // Applies the tunable-safe fields of a new server config (aggregation
+  // intervals, cache lifetimes, trace sampling) in place, keeping warm
+  // caches and long-lived streams. Accepts the same binary, JSON or text
+  // formats as the startup server config. Fields that require rebuilding
+  // long-lived state are ignored; a worker restart is still needed to
+  // change those.
+  virtual utils::Status ReloadServerConfig(
+      const std::string &server_config) = 0;
+
   virtual bool ReWriteURL(const char *uri, const size_t uri_len,
                           std::string *destination_url, bool debug_mode) = 0;
 
+  // Returns the precompiled CORS preflight response when the server config
+  // has a cors_preset_config, nullptr otherwise. The returned object lives
+  // as long as the ApiManager.
+  virtual const CorsPreflightResponse *cors_preflight_response() const = 0;
+
  protected:
   ApiManager() {}
 
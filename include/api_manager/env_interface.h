@@ -24,6 +24,8 @@
 #include "include/api_manager/grpc_request.h"
 #include "include/api_manager/http_request.h"
 #include "include/api_manager/periodic_timer.h"
+#include "include/api_manager/shared_check_cache.h"
+#include "include/api_manager/shared_token_cache.h"
 #include "include/api_manager/utils/status.h"
 
 namespace google {
@@ -33,15 +35,17 @@ class ApiManagerEnvInterface {
  public:
   virtual ~ApiManagerEnvInterface() {}
 
-  enum LogLevel { DEBUG, INFO, WARNING, ERROR };
+  enum LogLevel { DEBUG, INFO, NOTICE, WARNING, ERROR };
 
   void LogDebug(const std::string &str) { LogDebug(str.c_str()); }
   void LogInfo(const std::string &str) { LogInfo(str.c_str()); }
+  void LogNotice(const std::string &str) { LogNotice(str.c_str()); }
   void LogWarning(const std::string &str) { LogWarning(str.c_str()); }
   void LogError(const std::string &str) { LogError(str.c_str()); }
 
   void LogDebug(const char *message) { Log(DEBUG, message); }
   void LogInfo(const char *message) { Log(INFO, message); }
+  void LogNotice(const char *message) { Log(NOTICE, message); }
   void LogWarning(const char *message) { Log(WARNING, message); }
   void LogError(const char *message) { Log(ERROR, message); }
 
@@ -64,6 +68,22 @@ class ApiManagerEnvInterface {
   virtual void RunHTTPRequest(std::unique_ptr<HTTPRequest> request) = 0;
 
   virtual void RunGRPCRequest(std::unique_ptr<GRPCRequest> request) = 0;
+
+  // Hints that the host of the given URL will be called soon, so the
+  // environment may resolve it in the background and pin the result in
+  // its DNS cache before the first call needs it. The default
+  // implementation ignores the hint.
+  virtual void PreresolveUrl(const std::string &url) {}
+
+  // Returns the cache of Check responses shared between workers, or nullptr
+  // when the environment does not share check results across workers. The
+  // returned cache is owned by the environment.
+  virtual SharedCheckCache *shared_check_cache() { return nullptr; }
+
+  // Returns the cache of metadata server tokens shared between workers, or
+  // nullptr when the environment does not share tokens across workers. The
+  // returned cache is owned by the environment.
+  virtual SharedTokenCache *shared_token_cache() { return nullptr; }
 };
 
 }  // namespace api_manager
@@ -83,12 +83,28 @@ class GRPCRequest {
     return *this;
   }
 
+  // The bearer token sent as call credentials, or empty for none.
+  const std::string& auth_token() const { return auth_token_; }
+  GRPCRequest& set_auth_token(const std::string& value) {
+    auth_token_ = value;
+    return *this;
+  }
+
+  // The call deadline in milliseconds; <= 0 means no deadline.
+  int timeout_ms() const { return timeout_ms_; }
+  GRPCRequest& set_timeout_ms(int value) {
+    timeout_ms_ = value;
+    return *this;
+  }
+
  private:
   std::function<void(utils::Status, std::string&&)> callback_;
   std::string method_;
   std::string server_;
   std::string service_;
   std::string body_;
+  std::string auth_token_;
+  int timeout_ms_ = 0;
 };
 
 }  // namespace api_manager
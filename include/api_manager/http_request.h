@@ -16,7 +16,10 @@
 #define API_MANAGER_HTTP_REQUEST_H_
 
 #include <functional>
+#include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "include/api_manager/utils/status.h"
 
@@ -40,7 +43,40 @@ class HTTPRequest {
         requires_response_headers_(false),
         timeout_ms_(0),
         max_retries_(0),
-        timeout_backoff_factor_(2.0) {}
+        timeout_backoff_factor_(2.0) {
+    // Control-plane calls set at most a handful of headers; one
+    // allocation up front covers them all.
+    headers_.reserve(4);
+  }
+
+  // Pooled allocation: the environments construct and destroy one
+  // HTTPRequest per outbound call, at control-plane call rate, so the
+  // allocations are recycled through a small freelist instead of going
+  // back to the heap. The mutex is uncontended on the worker event loop;
+  // it only matters for multi-threaded tests.
+  static void* operator new(std::size_t size) {
+    if (size == sizeof(HTTPRequest)) {
+      std::lock_guard<std::mutex> lock(pool_mutex());
+      std::vector<void*>& pool = free_pool();
+      if (!pool.empty()) {
+        void* ptr = pool.back();
+        pool.pop_back();
+        return ptr;
+      }
+    }
+    return ::operator new(size);
+  }
+  static void operator delete(void* ptr, std::size_t size) {
+    if (size == sizeof(HTTPRequest)) {
+      std::lock_guard<std::mutex> lock(pool_mutex());
+      std::vector<void*>& pool = free_pool();
+      if (pool.size() < kPoolMaxSize) {
+        pool.push_back(ptr);
+        return;
+      }
+    }
+    ::operator delete(ptr);
+  }
 
   // A callback for the environment to invoke when the request is
   // complete.  This will be invoked by the environment exactly once,
@@ -92,6 +128,16 @@ class HTTPRequest {
     return *this;
   }
 
+  // Sets a precomputed "Bearer <token>" Authorization header value (see
+  // ServiceAccountToken::GetAuthHeader()), skipping the per-request
+  // concatenation of set_auth_token().
+  HTTPRequest& set_auth_header(const std::string& value) {
+    if (!value.empty()) {
+      set_header("Authorization", value);
+    }
+    return *this;
+  }
+
   int timeout_ms() const { return timeout_ms_; }
   HTTPRequest& set_timeout_ms(int value) {
     timeout_ms_ = value;
@@ -110,11 +156,18 @@ class HTTPRequest {
     return *this;
   }
 
-  const std::map<std::string, std::string>& request_headers() const {
+  const std::vector<std::pair<std::string, std::string>>& request_headers()
+      const {
     return headers_;
   }
   HTTPRequest& set_header(const std::string& name, const std::string& value) {
-    headers_[name] = value;
+    for (auto& header : headers_) {
+      if (header.first == name) {
+        header.second = value;
+        return *this;
+      }
+    }
+    headers_.emplace_back(name, value);
     return *this;
   }
 
@@ -128,10 +181,28 @@ class HTTPRequest {
   std::function<void(utils::Status, std::map<std::string, std::string>&&,
                      std::string&&)>
       callback_;
+  // Maximum number of recycled allocations kept in the freelist.
+  static const std::size_t kPoolMaxSize = 32;
+
+  // The freelist backing the pooled operator new/delete. Function-local
+  // statics keep this class header-only.
+  static std::vector<void*>& free_pool() {
+    static std::vector<void*> pool;
+    return pool;
+  }
+  static std::mutex& pool_mutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
   std::string method_;
   std::string url_;
   std::string body_;
-  std::map<std::string, std::string> headers_;
+
+  // Few headers per request and every call iterates them all, so flat
+  // storage beats a map: no per-header node allocations and the
+  // overwrite-on-set scan is a handful of string compares.
+  std::vector<std::pair<std::string, std::string>> headers_;
 
   // Indicates whether to extract headers from the response
   bool requires_response_headers_;
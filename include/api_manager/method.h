@@ -49,6 +49,26 @@ class MethodInfo {
   // Return if this method should skip service control.
   virtual bool skip_service_control() const = 0;
 
+  // Return if every check in the workflow would be a no-op for this
+  // method, so the whole check chain can be bypassed. Precomputed when
+  // the service config is loaded.
+  virtual bool skip_all_checks() const { return false; }
+
+  // Return if every check in the workflow would be a no-op for this
+  // method while service control stays on: nothing to authenticate or
+  // quota-charge, but each request is still reported. Such requests can
+  // bypass the check workflow and go straight to the proxy. Precomputed
+  // when the service config is loaded.
+  virtual bool report_only() const { return false; }
+
+  // Admission control. Attempts to admit one more concurrent request for
+  // this method; returns false when the method's concurrent request limit
+  // is reached. A successful acquire must be paired with a
+  // ReleaseConcurrency() call when the request goes away. The default
+  // implementation admits everything.
+  virtual bool TryAcquireConcurrency() const { return true; }
+  virtual void ReleaseConcurrency() const {}
+
   // Check an issuer is allowed.
   virtual bool isIssuerAllowed(const std::string &issuer) const = 0;
 
@@ -57,6 +77,26 @@ class MethodInfo {
       const std::string &issuer,
       const std::set<std::string> &jwt_audiences) const = 0;
 
+  // The combined issuer and audience verdict for one authenticated call.
+  enum IssuerAudienceResult {
+    ISSUER_NOT_ALLOWED,
+    AUDIENCE_NOT_ALLOWED,
+    ISSUER_AUDIENCE_ALLOWED,
+  };
+
+  // Answers both checks above for one call. The default implementation
+  // composes them; implementations with an issuer index can answer both
+  // from a single lookup.
+  virtual IssuerAudienceResult isIssuerAudienceAllowed(
+      const std::string &issuer,
+      const std::set<std::string> &jwt_audiences) const {
+    if (!isIssuerAllowed(issuer)) {
+      return ISSUER_NOT_ALLOWED;
+    }
+    return isAudienceAllowed(issuer, jwt_audiences) ? ISSUER_AUDIENCE_ALLOWED
+                                                    : AUDIENCE_NOT_ALLOWED;
+  }
+
   // Return authorization url for an issuer if specified.
   virtual const std::string &authorization_url_by_issuer(
       const std::string &issuer) const = 0;
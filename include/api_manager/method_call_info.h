@@ -16,13 +16,19 @@
 #define API_MANAGER_METHOD_CALL_INFO_H_
 
 #include <string>
-#include <vector>
 
+#include "absl/container/inlined_vector.h"
 #include "include/api_manager/method.h"
 
 namespace google {
 namespace api_manager {
 
+// A field path split into its field names, e.g. "shelf.theme" is
+// {"shelf", "theme"}. Field paths are rarely more than a few fields deep,
+// so that many names are stored inline and typical paths do not allocate
+// for the container.
+typedef absl::InlinedVector<std::string, 4> VariableFieldPath;
+
 // VariableBinding specifies a value for a single field in the request message.
 // When transcoding HTTP/REST/JSON to gRPC/proto the request message is
 // constructed using the HTTP body and the variable bindings (specified through
@@ -31,18 +37,22 @@ struct VariableBinding {
   // The location of the field in the protobuf message, where the value
   // needs to be inserted, e.g. "shelf.theme" would mean the "theme" field
   // of the nested "shelf" message of the request protobuf message.
-  std::vector<std::string> field_path;
+  VariableFieldPath field_path;
   // The value to be inserted.
   std::string value;
 };
 
+// The bindings of one call. Typical methods bind only one or two variables
+// per request, which are stored inline.
+typedef absl::InlinedVector<VariableBinding, 2> VariableBindings;
+
 // Information that we store per each call of a method. It includes information
 // about the method itself and variable bindings for the particular call.
 struct MethodCallInfo {
   // Method information
   const MethodInfo* method_info;
   // Variable bindings
-  std::vector<VariableBinding> variable_bindings;
+  VariableBindings variable_bindings;
   // Body prefix (the field of the message where the HTTP body should go)
   std::string body_field_path;
 };
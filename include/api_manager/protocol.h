@@ -22,18 +22,13 @@ namespace protocol {
 
 enum Protocol { UNKNOWN = 0, HTTP = 1, HTTPS = 2, GRPC = 3 };
 
+// Protocol names indexed by the enum value; out-of-range values map to
+// "unknown".
+constexpr const char *kProtocolNames[] = {"unknown", "http", "https", "grpc"};
+
 inline const char *ToString(Protocol p) {
-  switch (p) {
-    case HTTP:
-      return "http";
-    case HTTPS:
-      return "https";
-    case GRPC:
-      return "grpc";
-    case UNKNOWN:
-    default:
-      return "unknown";
-  }
+  return (p >= UNKNOWN && p <= GRPC) ? kProtocolNames[p]
+                                     : kProtocolNames[UNKNOWN];
 }
 
 }  // namespace protocol
@@ -71,6 +71,11 @@ class RequestHandlerInterface {
 
   // Try to add api-key from url query to header.
   virtual void TryAddApiKeyHeaderFromQuery() = 0;
+
+  // Get the per-phase latency breakdown for this request, rendered as a
+  // compact "key=microseconds" list. Empty unless the client opted in by
+  // sending the X-Endpoint-Latency request header.
+  virtual std::string GetLatencyAttribution() const = 0;
 };
 
 }  // namespace api_manager
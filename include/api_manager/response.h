@@ -44,6 +44,10 @@ class Response {
   // Gets the latency info.
   virtual utils::Status GetLatencyInfo(service_control::LatencyInfo *info) = 0;
 
+  // Returns the peak number of bytes the environment's allocation
+  // accounting attributed to this request, or -1 when not tracked.
+  virtual int64_t GetMemoryHighWaterMark() { return -1; }
+
   // Finds a HTTP header with a name. Returns true if found.
   // Don't support multiple headers with same name for now. In that case,
   // the first header will be returned.
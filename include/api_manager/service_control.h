@@ -46,6 +46,24 @@ struct Statistics {
   // Maximum report request size send to server.
   uint64_t max_report_size;
 
+  // Check denials served from the local negative cache.
+  uint64_t negative_check_cache_hits;
+  // Negative cache lookups that missed or had expired.
+  uint64_t negative_check_cache_misses;
+
+  // Positive check verdicts served from the local POD verdict cache.
+  uint64_t check_verdict_cache_hits;
+  // Verdict cache lookups that missed or had expired.
+  uint64_t check_verdict_cache_misses;
+
+  // Check responses served from the cache shared across workers.
+  uint64_t shared_check_cache_hits;
+  // Shared check cache lookups that missed or had expired.
+  uint64_t shared_check_cache_misses;
+
+  // Checks that shared an identical in-flight check's round trip.
+  uint64_t deduped_in_flight_checks;
+
   // Merge two statistics.
   void Merge(const Statistics& v) {
     total_called_checks += v.total_called_checks;
@@ -57,6 +75,13 @@ struct Statistics {
     if (v.max_report_size > max_report_size) {
       max_report_size = v.max_report_size;
     }
+    negative_check_cache_hits += v.negative_check_cache_hits;
+    negative_check_cache_misses += v.negative_check_cache_misses;
+    check_verdict_cache_hits += v.check_verdict_cache_hits;
+    check_verdict_cache_misses += v.check_verdict_cache_misses;
+    shared_check_cache_hits += v.shared_check_cache_hits;
+    shared_check_cache_misses += v.shared_check_cache_misses;
+    deduped_in_flight_checks += v.deduped_in_flight_checks;
   }
 };
 
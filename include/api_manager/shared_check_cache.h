@@ -0,0 +1,50 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SHARED_CHECK_CACHE_H_
+#define API_MANAGER_SHARED_CHECK_CACHE_H_
+
+#include <string>
+
+namespace google {
+namespace api_manager {
+
+// A cache of serialized service control CheckResponse messages shared
+// between all workers of the hosting environment (e.g. an nginx shared
+// memory zone). A check verdict obtained by one worker can be served from
+// the cache by every other worker, instead of each worker warming its
+// private aggregation cache with its own servicecontrol call.
+//
+// Implementations must be safe to call concurrently from multiple worker
+// processes. Callers treat the cache as best effort and fall back to a
+// servicecontrol call on a miss.
+class SharedCheckCache {
+ public:
+  virtual ~SharedCheckCache() {}
+
+  // Looks up the serialized CheckResponse stored under key. On a hit fills
+  // response and returns true. Expired entries are misses.
+  virtual bool Lookup(const std::string &key, std::string *response) = 0;
+
+  // Stores a serialized CheckResponse under key for expiration_ms. The
+  // cache may drop the entry, for example when the response does not fit
+  // in a fixed size slot.
+  virtual void Insert(const std::string &key, const std::string &response,
+                      int expiration_ms) = 0;
+};
+
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SHARED_CHECK_CACHE_H_
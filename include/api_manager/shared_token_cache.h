@@ -0,0 +1,57 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SHARED_TOKEN_CACHE_H_
+#define API_MANAGER_SHARED_TOKEN_CACHE_H_
+
+#include <time.h>
+
+#include <string>
+
+namespace google {
+namespace api_manager {
+
+// A cache of auth tokens fetched from the metadata server, shared between
+// all workers of the hosting environment (e.g. an nginx shared memory
+// zone). A token fetched by one worker can be reused by every other worker
+// - and, when the zone survives a configuration reload, by the next worker
+// generation - instead of each worker minting its own token.
+//
+// Expirations cross the interface as seconds relative to now; the cache is
+// responsible for keeping them accurate while an entry is stored.
+//
+// Implementations must be safe to call concurrently from multiple worker
+// processes. Callers treat the cache as best effort and fall back to a
+// metadata server fetch on a miss.
+class SharedTokenCache {
+ public:
+  virtual ~SharedTokenCache() {}
+
+  // Looks up the token stored under key. On a hit fills token and the
+  // number of seconds the token remains valid, and returns true. Expired
+  // entries are misses.
+  virtual bool Lookup(const std::string &key, std::string *token,
+                      time_t *expiration) = 0;
+
+  // Stores a token under key, valid for expiration seconds from now. The
+  // cache may drop the entry, for example when the token does not fit in a
+  // fixed size slot.
+  virtual void Insert(const std::string &key, const std::string &token,
+                      time_t expiration) = 0;
+};
+
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SHARED_TOKEN_CACHE_H_
@@ -50,6 +50,18 @@ class Status final {
   // is constructed. Error cause is optional and defaults to INTERNAL.
   Status(int code, const std::string& message);
   Status(int code, const std::string& message, ErrorCause error_cause);
+
+  // Overloads for string literals. When the message is one of the
+  // canonical ESP error messages (see kCanonicalMessages in status.cc),
+  // the status references the interned copy and owns no string at all.
+  Status(int code, const char* message);
+  Status(int code, const char* message, ErrorCause error_cause);
+
+  // Copying a status with an interned message copies a pointer, not the
+  // message.
+  Status(const Status& other);
+  Status& operator=(const Status& other);
+
   ~Status() {}
 
   bool operator==(const Status& x) const;
@@ -58,8 +70,14 @@ class Status final {
   // Get string representation of the error code
   static std::string CodeToString(int code);
 
-  // Get string representation of the error cause
-  static std::string ErrorCauseToString(ErrorCause error_cause);
+  // Same, but returns a static string from a lookup table and never
+  // allocates. Returns nullptr for codes without a name, which
+  // CodeToString formats into a generic message.
+  static const char* CodeToCString(int code);
+
+  // Get string representation of the error cause. Returns a static
+  // string; never allocates.
+  static const char* ErrorCauseToString(ErrorCause error_cause);
 
   // Constructs a Status object from a protobuf Status.
   static Status FromProto(const ::google::protobuf::util::Status& proto_status);
@@ -77,7 +95,13 @@ class Status final {
   int code() const { return code_; }
 
   // Returns the error message held by this status.
-  const std::string& message() const { return message_; }
+  const std::string& message() const { return *message_; }
+
+  // Returns true if the message references an interned canonical message.
+  // Canonical messages form a small fixed set and keep a stable address
+  // for the process lifetime, so (code, cause, &message) identifies the
+  // status; callers use this to cache derived representations.
+  bool has_canonical_message() const { return message_ != &owned_message_; }
 
   // Returns the error cause held by this status.
   ErrorCause error_cause() const { return error_cause_; }
@@ -110,8 +134,13 @@ class Status final {
   int code_;
 
   // The error message if this Status represents an error, otherwise an empty
-  // string if this is the OK status.
-  std::string message_;
+  // string if this is the OK status. Points either at an interned canonical
+  // message or at owned_message_.
+  const std::string* message_;
+
+  // Storage for messages that are not in the canonical table; empty
+  // otherwise.
+  std::string owned_message_;
 
   // Error cause indicating the origin of the error.
   ErrorCause error_cause_;
@@ -265,6 +265,19 @@ cc_library(
             actual = "@googletest_git//:googletest_prod",
         )
 
+def benchmark_repositories(bind = True):
+    git_repository(
+        name = "com_github_google_benchmark",
+        commit = "090faecb454fbd6e6e17a75ef8146acb037118d4",  # May 28, 2019 (v1.5.0)
+        remote = "https://github.com/google/benchmark.git",
+    )
+
+    if bind:
+        native.bind(
+            name = "benchmark",
+            actual = "@com_github_google_benchmark//:benchmark",
+        )
+
 def transcoding_repositories(bind = True):
     git_repository(
         name = "httpjson_transcoding",
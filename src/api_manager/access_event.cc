@@ -0,0 +1,70 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "src/api_manager/access_event.h"
+
+namespace google {
+namespace api_manager {
+
+namespace {
+
+// Default ring capacity when the server config does not set one. At
+// roughly 200 bytes per record this is under a megabyte per worker and
+// gives a drain agent polling once a second plenty of headroom at a few
+// thousand requests per second.
+const size_t kDefaultBufferRecords = 4096;
+
+}  // namespace
+
+void SetAccessEventField(char *dst, size_t size, const std::string &value) {
+  size_t len = value.size() < size ? value.size() : size;
+  memcpy(dst, value.data(), len);
+  memset(dst + len, 0, size - len);
+}
+
+AccessEventBuffer *AccessEventBuffer::Instance(size_t capacity_hint) {
+  // One buffer per worker process, alive until the worker exits.
+  static AccessEventBuffer *buffer = new AccessEventBuffer(
+      capacity_hint > 0 ? capacity_hint : kDefaultBufferRecords);
+  return buffer;
+}
+
+AccessEventBuffer::AccessEventBuffer(size_t capacity)
+    : records_(capacity), head_(0), size_(0), dropped_(0) {}
+
+void AccessEventBuffer::Append(const AccessEventRecord &record) {
+  records_[(head_ + size_) % records_.size()] = record;
+  if (size_ < records_.size()) {
+    ++size_;
+  } else {
+    // Full: the slot written above was the oldest unconsumed record.
+    head_ = (head_ + 1) % records_.size();
+    ++dropped_;
+  }
+}
+
+uint64_t AccessEventBuffer::Drain(std::vector<AccessEventRecord> *out) {
+  out->reserve(out->size() + size_);
+  for (size_t i = 0; i < size_; ++i) {
+    out->push_back(records_[(head_ + i) % records_.size()]);
+  }
+  head_ = (head_ + size_) % records_.size();
+  size_ = 0;
+  uint64_t dropped = dropped_;
+  dropped_ = 0;
+  return dropped;
+}
+
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,133 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_ACCESS_EVENT_H_
+#define API_MANAGER_ACCESS_EVENT_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace google {
+namespace api_manager {
+
+// Bump when the AccessEventRecord layout changes so external consumers
+// can reject records they do not understand.
+const uint32_t kAccessEventLayoutVersion = 1;
+
+// One fixed-layout binary access event, recorded per completed request
+// when the server config enables access events. The record is written
+// and drained as raw bytes, so the layout is the wire format: only
+// fixed-size fields, no pointers, strings truncated into char arrays
+// (NUL padded, not necessarily NUL terminated when full).
+struct AccessEventRecord {
+  // Wall clock completion time, microseconds since the epoch.
+  int64_t timestamp_us;
+
+  // Sizes of the full request and response, in bytes.
+  int64_t request_size;
+  int64_t response_size;
+
+  // Overall and backend latency, in milliseconds; -1 when unknown.
+  int64_t request_time_ms;
+  int64_t backend_time_ms;
+
+  // The HTTP response code and the canonical error code of the final
+  // status.
+  int32_t response_code;
+  int32_t status_code;
+
+  // protocol::Protocol values of the frontend and backend protocol.
+  int32_t frontend_protocol;
+  int32_t backend_protocol;
+
+  // The matched method selector (e.g. endpoints.examples.Echo.Echo), or
+  // empty when the request matched no method.
+  char api_method[96];
+
+  // The consumer API key, or empty.
+  char api_key[64];
+
+  // The HTTP verb.
+  char http_method[16];
+};
+
+// Identifies a drain response; the bytes "ESPA" read as a
+// little-endian uint32.
+const uint32_t kAccessEventMagic = 0x41505345;
+
+// The fixed header preceding the raw records in a drain response.
+struct AccessEventDrainHeader {
+  uint32_t magic;         // kAccessEventMagic
+  uint32_t version;       // kAccessEventLayoutVersion
+  uint32_t record_size;   // sizeof(AccessEventRecord)
+  uint32_t record_count;  // records following the header
+  // Records lost to ring overwriting since the previous drain.
+  uint64_t dropped;
+  // The pid of the worker that served the drain; each worker drains its
+  // own buffer.
+  int64_t pid;
+};
+
+// Copies a string into one of the fixed-size record fields, truncating
+// and NUL padding as needed.
+void SetAccessEventField(char *dst, size_t size, const std::string &value);
+
+// A per-worker ring buffer of access event records.
+//
+// Producers append one record per completed request; an external agent
+// periodically drains the buffer through the endpoints_access_events
+// location. When the agent falls behind, the ring overwrites the oldest
+// unconsumed records and counts them as dropped, so a stalled consumer
+// costs memory reuse rather than memory growth.
+//
+// Like the caches, the buffer is used only from the main nginx thread
+// of its worker process, so no synchronization is needed.
+class AccessEventBuffer {
+ public:
+  // Returns the per-worker instance, creating it on first use with the
+  // given capacity (records; 0 selects the default). The capacity hint
+  // of later calls is ignored.
+  static AccessEventBuffer *Instance(size_t capacity_hint);
+
+  // Appends a record, overwriting the oldest unconsumed one when the
+  // buffer is full.
+  void Append(const AccessEventRecord &record);
+
+  // Moves all unconsumed records, oldest first, into out (appended to
+  // its existing contents) and returns the number of records dropped to
+  // overwriting since the previous drain.
+  uint64_t Drain(std::vector<AccessEventRecord> *out);
+
+  // The number of unconsumed records.
+  size_t size() const { return size_; }
+
+ private:
+  AccessEventBuffer(size_t capacity);
+
+  std::vector<AccessEventRecord> records_;
+
+  // The index of the oldest unconsumed record, and the unconsumed count.
+  size_t head_;
+  size_t size_;
+
+  // Records overwritten since the last drain.
+  uint64_t dropped_;
+};
+
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_ACCESS_EVENT_H_
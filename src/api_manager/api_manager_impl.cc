@@ -16,11 +16,19 @@
 //
 #include "src/api_manager/api_manager_impl.h"
 #include "src/api_manager/check_workflow.h"
+#include "src/api_manager/fetch_metadata.h"
 #include "src/api_manager/request_handler.h"
+#include "src/api_manager/service_config_cache.h"
+#include "src/api_manager/service_control/url.h"
+#include "src/api_manager/warm_state.h"
 
+#include <algorithm>
 #include <fstream>
+#include <set>
 #include <sstream>
 
+#include "utils/md5.h"
+
 namespace google {
 namespace api_manager {
 
@@ -28,6 +36,15 @@ namespace {
 
 const std::string kConfigRolloutManaged("managed");
 
+// The default interval between warm state snapshots. Unit: seconds.
+const int kWarmStateSnapshotIntervalS = 60;
+
+// Shadow rollout defaults: the share of requests whose routing lookup is
+// replayed against the incoming configs, and the number of sampled
+// comparisons before the rollout is promoted.
+const uint32_t kShadowSamplePercent = 10;
+const uint64_t kShadowMinSamples = 1000;
+
 }  // namespace
 
 ApiManagerImpl::ApiManagerImpl(std::unique_ptr<ApiManagerEnvInterface> env,
@@ -66,6 +83,19 @@ ApiManagerImpl::ApiManagerImpl(std::unique_ptr<ApiManagerEnvInterface> env,
           new RewriteRule(parts[0], parts[1], global_context_->env())));
     }
   }
+
+  if (global_context_->server_config() &&
+      global_context_->server_config()->has_cors_preset_config()) {
+    const auto &cors = global_context_->server_config()->cors_preset_config();
+    cors_preflight_response_.reset(new CorsPreflightResponse);
+    cors_preflight_response_->allowed_origins.assign(
+        cors.allowed_origins().begin(), cors.allowed_origins().end());
+    cors_preflight_response_->allowed_methods = cors.allowed_methods();
+    cors_preflight_response_->allowed_headers = cors.allowed_headers();
+    if (cors.max_age_sec() > 0) {
+      cors_preflight_response_->max_age = std::to_string(cors.max_age_sec());
+    }
+  }
 }
 
 utils::Status ApiManagerImpl::LoadServiceRollouts() {
@@ -122,6 +152,13 @@ utils::Status ApiManagerImpl::AddAndDeployConfigs(
     std::vector<std::pair<std::string, int>> &&configs, bool initialize) {
   std::vector<std::pair<std::string, int>> list;
   for (auto item : configs) {
+    // A rollout entry for a config version already deployed carries the
+    // bare config_id (see ConfigManager::FetchConfigs); reuse the existing
+    // service context instead of re-parsing the whole service config.
+    if (service_context_map_.find(item.first) != service_context_map_.end()) {
+      list.push_back({item.first, round(item.second)});
+      continue;
+    }
     std::string config_id;
     if (AddConfig(item.first, initialize, &config_id).ok()) {
       list.push_back({config_id, round(item.second)});
@@ -146,11 +183,47 @@ utils::Status ApiManagerImpl::AddAndDeployConfigs(
 utils::Status ApiManagerImpl::AddConfig(const std::string &service_config,
                                         bool initialize,
                                         std::string *config_id) {
-  std::unique_ptr<Config> config =
-      Config::Create(global_context_->env(), service_config);
+  // Managed rollout polling re-fetches configs that are often identical
+  // to one already deployed, under the same or a new config_id. Compare
+  // digests of the raw config body first: on a match the whole rebuild
+  // (parse, matcher build, service control client creation) is skipped.
+  ::google::service_control_client::MD5 hasher;
+  hasher.Update(service_config);
+  const std::string digest = hasher.Digest();
+  const auto &digest_it = config_digests_.find(digest);
+  if (digest_it != config_digests_.end() &&
+      service_context_map_.find(digest_it->second) !=
+          service_context_map_.end()) {
+    *config_id = digest_it->second;
+    return utils::Status::OK;
+  }
+
+  std::string cache_dir;
+  if (global_context_->server_config()) {
+    cache_dir = global_context_->server_config()->service_config_cache_dir();
+  }
+
+  // A previous start may have left the parsed config in the on-disk
+  // cache; a binary proto parse is much cheaper than the JSON conversion.
+  std::unique_ptr<Config> config;
+  bool from_cache = false;
+  std::string cached_config;
+  if (LoadConfigFromCache(global_context_->env(), cache_dir, service_config,
+                          &cached_config)) {
+    config = Config::Create(global_context_->env(), cached_config);
+    from_cache = config != nullptr;
+  }
+  if (config == nullptr) {
+    config = Config::Create(global_context_->env(), service_config);
+  }
   if (config == nullptr) {
     return utils::Status(Code::INVALID_ARGUMENT, "Invalid service config");
   }
+  bool cached_on_disk = from_cache;
+  if (!from_cache) {
+    cached_on_disk = SaveConfigToCache(global_context_->env(), cache_dir,
+                                       service_config, config->service());
+  }
 
   std::string service_name = config->service().name();
   if (global_context_->service_name().empty()) {
@@ -168,15 +241,31 @@ utils::Status ApiManagerImpl::AddConfig(const std::string &service_config,
 
   // If the config_id is already created, not to over-write, just use it.
   if (service_context_map_.find(*config_id) != service_context_map_.end()) {
+    config_digests_[digest] = *config_id;
     return utils::Status::OK;
   }
 
+  Config *raw_config = config.get();
   auto context_service = std::make_shared<context::ServiceContext>(
       global_context_, std::move(config));
-  if (initialize == true && context_service->service_control()) {
-    context_service->service_control()->Init();
+  if (initialize == true) {
+    if (context_service->service_control()) {
+      context_service->service_control()->Init();
+    }
+    if (context_service->jwks_refresher()) {
+      context_service->jwks_refresher()->Init();
+    }
+  }
+  // With the serialized proto preserved in the on-disk cache, the
+  // in-memory copy can shed its build-time bulk; service() re-derives the
+  // full message from the cache entry for the consumers that need it.
+  if (cached_on_disk) {
+    trimmed_config_paths_[*config_id] =
+        ServiceConfigCachePath(cache_dir, service_config);
+    raw_config->TrimService();
   }
   service_context_map_[*config_id] = context_service;
+  config_digests_[digest] = *config_id;
 
   return utils::Status::OK;
 }
@@ -184,24 +273,207 @@ utils::Status ApiManagerImpl::AddConfig(const std::string &service_config,
 // Deploy these configs according to the traffic percentage.
 void ApiManagerImpl::DeployConfigs(
     std::vector<std::pair<std::string, int>> &&list) {
-  service_selector_.reset(new WeightedSelector(std::move(list)));
+  const auto *server_config = global_context_->server_config();
+  auto current = std::atomic_load(&deployment_);
+  if (current && server_config &&
+      server_config->shadow_rollout_config().enabled() &&
+      list != current->selector.list()) {
+    // Hold the incoming configs out of traffic: sampled live requests
+    // replay their routing lookup against them in ShadowCompareRouting,
+    // which promotes the rollout once enough have been compared.
+    std::vector<std::shared_ptr<context::ServiceContext>> contexts;
+    contexts.reserve(list.size());
+    for (const auto &item : list) {
+      const auto &it = service_context_map_.find(item.first);
+      contexts.push_back(it != service_context_map_.end() ? it->second
+                                                          : nullptr);
+    }
+    const auto &shadow_config = server_config->shadow_rollout_config();
+    auto shadow = std::make_shared<ShadowRollout>(
+        std::move(list), std::move(contexts),
+        shadow_config.sample_percent() > 0 ? shadow_config.sample_percent()
+                                           : kShadowSamplePercent,
+        shadow_config.min_samples() > 0
+            ? static_cast<uint64_t>(shadow_config.min_samples())
+            : kShadowMinSamples);
+    global_context_->env()->LogInfo(
+        "Shadow-verifying routing of incoming service configs before "
+        "rollout.");
+    std::atomic_store(&shadow_rollout_, std::move(shadow));
+    return;
+  }
+  // Any shadow rollout still in flight is superseded by this deployment.
+  std::atomic_store(&shadow_rollout_, std::shared_ptr<ShadowRollout>());
+  PublishDeployment(std::move(list));
+}
+
+void ApiManagerImpl::PublishDeployment(
+    std::vector<std::pair<std::string, int>> &&list) {
+  // Resolve the service contexts up front so selecting one later is a
+  // vector index instead of a map lookup by config_id.
+  std::vector<std::shared_ptr<context::ServiceContext>> contexts;
+  contexts.reserve(list.size());
+  for (const auto &item : list) {
+    const auto &it = service_context_map_.find(item.first);
+    contexts.push_back(it != service_context_map_.end() ? it->second : nullptr);
+  }
+  auto deployment = std::make_shared<DeploymentSnapshot>(std::move(list),
+                                                         std::move(contexts));
+  const auto *server_config = global_context_->server_config();
+  if (server_config &&
+      server_config->rollout_latency_feedback_config().enabled()) {
+    deployment->selector.EnableLatencyFeedback(
+        server_config->rollout_latency_feedback_config().min_share());
+  }
+  auto previous = std::atomic_load(&deployment_);
+  std::atomic_store(&deployment_, deployment);
+
+  // Epoch drain: contexts rolled out of traffic stop their own flush
+  // schedules and report through the new deployment while the in-flight
+  // streams holding them finish, so a rollout never runs two flush
+  // schedules side by side. A context re-entering traffic is revived
+  // first, in case an earlier rollout had drained it.
+  std::shared_ptr<context::ServiceContext> successor;
+  for (const auto &context : deployment->contexts) {
+    if (context) {
+      context->StopDraining();
+      if (!successor) {
+        successor = context;
+      }
+    }
+  }
+  if (previous == nullptr || successor == nullptr) {
+    return;
+  }
+  for (const auto &old_context : previous->contexts) {
+    if (old_context &&
+        std::find(deployment->contexts.begin(), deployment->contexts.end(),
+                  old_context) == deployment->contexts.end()) {
+      old_context->StartDraining(successor);
+    }
+  }
+}
+
+void ApiManagerImpl::ShadowCompareRouting(const std::string &http_method,
+                                          const std::string &path,
+                                          const MethodInfo *active_method) {
+  auto shadow = std::atomic_load(&shadow_rollout_);
+  if (shadow == nullptr) {
+    return;
+  }
+  if (shadow->tickets.fetch_add(1, std::memory_order_relaxed) % 100 >=
+      shadow->sample_percent) {
+    return;
+  }
+  // Replay the lookup against every incoming config version; any of them
+  // resolving the call differently than the active config counts as one
+  // divergence.
+  bool diverged = false;
+  for (const auto &context : shadow->contexts) {
+    if (context == nullptr || context->config() == nullptr) {
+      continue;
+    }
+    const MethodInfo *shadow_method =
+        context->config()->GetMethodInfo(http_method, path);
+    if ((shadow_method == nullptr) != (active_method == nullptr) ||
+        (shadow_method != nullptr && active_method != nullptr &&
+         shadow_method->selector() != active_method->selector())) {
+      diverged = true;
+      break;
+    }
+  }
+  if (diverged) {
+    shadow->divergences.fetch_add(1, std::memory_order_relaxed);
+    global_context_->env()->LogError(
+        "Shadow rollout divergence: " + http_method + " " + path +
+        " resolves differently under the incoming service config.");
+  }
+  const uint64_t samples =
+      shadow->samples.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (samples < shadow->min_samples) {
+    return;
+  }
+  // Enough live traffic compared; report the verdict and promote. The
+  // counters make a misrouting config visible before it takes traffic,
+  // but promotion is not blocked on them: rolling back a bad config
+  // stays the operator's call.
+  const uint64_t divergences =
+      shadow->divergences.load(std::memory_order_relaxed);
+  global_context_->env()->LogInfo(
+      "Shadow rollout verified on " + std::to_string(samples) +
+      " sampled requests with " + std::to_string(divergences) +
+      " routing divergences; promoting.");
+  if (std::atomic_exchange(&shadow_rollout_,
+                           std::shared_ptr<ShadowRollout>()) != nullptr) {
+    PublishDeployment(std::move(shadow->list));
+  }
+}
+
+void ApiManagerImpl::RecordRolloutLatency(const std::string &config_id,
+                                          int64_t latency_ms) {
+  auto deployment = std::atomic_load(&deployment_);
+  if (deployment) {
+    deployment->selector.RecordLatency(config_id, latency_ms);
+  }
 }
 
 utils::Status ApiManagerImpl::Init() {
+  // Stamp each initialization phase so a slow cold start can be attributed
+  // to the phase responsible for it.
+  const auto init_start = std::chrono::steady_clock::now();
+  auto phase_start = init_start;
+  auto stamp_phase = [&phase_start]() {
+    auto now = std::chrono::steady_clock::now();
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                      now - phase_start)
+                      .count();
+    phase_start = now;
+    return micros;
+  };
+
   if (global_context_->cloud_trace_aggregator()) {
     global_context_->cloud_trace_aggregator()->Init();
   }
+  auto trace_micros = stamp_phase();
 
   if (service_context_map_.empty()) {
     return utils::Status(Code::UNAVAILABLE,
                          "Service config loading was failed");
   }
 
+  // Restore warm state from a previous worker before the JWKS refreshers
+  // start, so their first tick sees the restored keys and keeps them
+  // fresh instead of every context re-fetching them.
+  const bool warm_state_enabled =
+      global_context_->server_config() &&
+      global_context_->server_config()->has_warm_state_config() &&
+      !global_context_->server_config()
+           ->warm_state_config()
+           .snapshot_file()
+           .empty();
+  if (warm_state_enabled) {
+    proto::WarmState state;
+    if (LoadWarmState(
+            global_context_->env(),
+            global_context_->server_config()->warm_state_config()
+                .snapshot_file(),
+            &state)) {
+      const auto now = std::chrono::system_clock::now();
+      for (auto it : service_context_map_) {
+        RestoreWarmState(state, now, &it.second->certs());
+      }
+    }
+  }
+
   for (auto it : service_context_map_) {
     if (it.second->service_control()) {
       it.second->service_control()->Init();
     }
+    if (it.second->jwks_refresher()) {
+      it.second->jwks_refresher()->Init();
+    }
   }
+  auto service_context_micros = stamp_phase();
 
   if (global_context_->rollout_strategy() == kConfigRolloutManaged) {
     config_manager_.reset(new ConfigManager(
@@ -212,7 +484,11 @@ utils::Status ApiManagerImpl::Init() {
             AddAndDeployConfigs(std::move(configs), true);
           }
         },
-        [this]() { DetectRolloutIDChange(); }));
+        [this]() { DetectRolloutIDChange(); },
+        [this](const std::string &config_id) {
+          return service_context_map_.find(config_id) !=
+                 service_context_map_.end();
+        }));
 
     if (global_context_->server_config()->has_service_config_rollout()) {
       config_manager_->set_current_rollout_id(global_context_->server_config()
@@ -220,10 +496,108 @@ utils::Status ApiManagerImpl::Init() {
                                                   .rollout_id());
     }
   }
+  auto config_manager_micros = stamp_phase();
+
+  // Resolve and pin the control-plane endpoints now, so the first request
+  // does not pay a DNS round trip on top of its own work. The environment
+  // logs per-host resolution latency and keeps pinned entries fresh with
+  // its refresh-ahead cache; environments without a resolver ignore the
+  // hints.
+  std::set<std::string> control_plane_urls;
+  for (const auto &it : service_context_map_) {
+    service_control::Url url(&it.second->service(),
+                             global_context_->server_config());
+    if (!url.service_control().empty()) {
+      control_plane_urls.insert(url.service_control());
+    }
+  }
+  if (!global_context_->metadata_server().empty()) {
+    control_plane_urls.insert(global_context_->metadata_server());
+  }
+  if (global_context_->cloud_trace_aggregator()) {
+    control_plane_urls.insert(
+        global_context_->cloud_trace_aggregator()->cloud_trace_address());
+  }
+  if (config_manager_) {
+    control_plane_urls.insert(config_manager_->service_management_host());
+  }
+  for (const auto &url : control_plane_urls) {
+    global_context_->env()->PreresolveUrl(url);
+  }
+
+  if (warm_state_enabled) {
+    int interval_s =
+        global_context_->server_config()->warm_state_config()
+            .snapshot_interval_s();
+    if (interval_s <= 0) {
+      interval_s = kWarmStateSnapshotIntervalS;
+    }
+    warm_state_timer_ = global_context_->env()->StartPeriodicTimer(
+        std::chrono::seconds(interval_s), [this]() { SnapshotWarmState(); });
+  }
+
+  CacheAccountant *accountant = global_context_->cache_accountant();
+  if (accountant && accountant->enabled()) {
+    cache_budget_timer_ = global_context_->env()->StartPeriodicTimer(
+        std::chrono::milliseconds(accountant->check_interval_ms()),
+        [accountant]() { accountant->EnforceBudget(); });
+  }
+
+  // Proactively refresh metadata server tokens so no request has to wait
+  // on a token fetch.
+  if (!global_context_->metadata_server().empty()) {
+    token_refresher_.reset(new TokenRefresher(global_context_));
+    token_refresher_->Init();
+
+    // The refresher only runs its first check after a full timer interval;
+    // mint the initial token now so the fetch overlaps the JWKS and service
+    // control warm-up instead of being paid by the first request.
+    if (!global_context_->service_account_token()->has_client_secret()) {
+      auto context = global_context_;
+      std::string audience;
+      GlobalFetchServiceAccountToken(
+          context, audience, nullptr,
+          [context, init_start](utils::Status status) {
+            auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::steady_clock::now() - init_start)
+                              .count();
+            context->env()->LogNotice(
+                "Initial service account token fetch finished " +
+                std::to_string(micros) + "us after Init: " + status.ToString());
+          });
+    }
+  }
+
+  global_context_->env()->LogNotice(
+      "ESP initialized in " +
+      std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - init_start)
+                         .count()) +
+      "us (cloud trace: " + std::to_string(trace_micros) +
+      "us, service contexts: " + std::to_string(service_context_micros) +
+      "us, config manager: " + std::to_string(config_manager_micros) + "us)");
 
   return utils::Status::OK;
 }
 
+void ApiManagerImpl::SnapshotWarmState() {
+  proto::WarmState state;
+  const auto now = std::chrono::system_clock::now();
+  for (const auto &it : service_context_map_) {
+    CollectWarmState(it.second->certs(), now, &state);
+  }
+  // Nothing fetched yet (or everything expired); keep whatever the last
+  // snapshot holds rather than rewriting the file every interval. Restore
+  // drops expired entries, so a stale file is harmless.
+  if (state.issuer_keys_size() == 0) {
+    return;
+  }
+  SaveWarmState(
+      global_context_->env(),
+      global_context_->server_config()->warm_state_config().snapshot_file(),
+      state);
+}
+
 void ApiManagerImpl::DetectRolloutIDChange() {
   if (!service_context_map_.empty()) {
     const auto &it = service_context_map_.begin();
@@ -261,6 +635,23 @@ const ::google::api::Service &ApiManagerImpl::service(
     const std::string &config_id) const {
   const auto &it = service_context_map_.find(config_id);
   if (it != service_context_map_.end()) {
+    const auto &path_it = trimmed_config_paths_.find(config_id);
+    if (path_it != trimmed_config_paths_.end()) {
+      // The in-memory proto was trimmed after the compiled config was
+      // built; re-derive the full message from the on-disk cache entry.
+      std::string cached_config;
+      std::unique_ptr<::google::api::Service> full(
+          new ::google::api::Service);
+      if (LoadConfigFromCacheFile(global_context_->env(), path_it->second,
+                                  &cached_config) &&
+          full->ParseFromString(cached_config)) {
+        rehydrated_service_ = std::move(full);
+        return *rehydrated_service_;
+      }
+      global_context_->env()->LogWarning(
+          "Could not re-derive the full service config from " +
+          path_it->second + "; returning the trimmed copy.");
+    }
     return it->second->service();
   }
   static ::google::api::Service empty;
@@ -268,20 +659,27 @@ const ::google::api::Service &ApiManagerImpl::service(
 }
 
 std::shared_ptr<context::ServiceContext> ApiManagerImpl::SelectService() {
-  if (service_context_map_.empty()) {
+  auto deployment = std::atomic_load(&deployment_);
+  if (!deployment || deployment->contexts.empty()) {
     return nullptr;
   }
-  const auto &it = service_context_map_.find(service_selector_->Select());
-  if (it != service_context_map_.end()) {
-    return it->second;
+  // Single-service deployments (and rollouts where one version holds all
+  // the traffic) resolved their context at deploy time; skip the
+  // selector draw.
+  if (deployment->sole_context) {
+    return deployment->sole_context;
   }
-  return nullptr;
+  return deployment->contexts[deployment->selector.SelectIndex()];
 }
 
 utils::Status ApiManagerImpl::GetStatistics(
     ApiManagerStatistics *statistics) const {
   memset(&statistics->service_control_statistics, 0,
          sizeof(service_control::Statistics));
+  memset(&statistics->jwt_cache_statistics, 0, sizeof(JwtCacheStatistics));
+  memset(&statistics->authz_cache_statistics, 0, sizeof(AuthzCacheStatistics));
+  memset(&statistics->check_latency_statistics, 0,
+         sizeof(CheckLatencyStatistics));
   for (const auto &it : service_context_map_) {
     if (it.second->service_control()) {
       service_control::Statistics stat;
@@ -290,6 +688,14 @@ utils::Status ApiManagerImpl::GetStatistics(
         statistics->service_control_statistics.Merge(stat);
       }
     }
+    JwtCacheStatistics jwt_stat;
+    it.second->jwt_cache().GetStatistics(&jwt_stat);
+    statistics->jwt_cache_statistics.Merge(jwt_stat);
+    AuthzCacheStatistics authz_stat;
+    it.second->authz_cache().GetStatistics(&authz_stat);
+    statistics->authz_cache_statistics.Merge(authz_stat);
+    statistics->check_latency_statistics.Merge(
+        *it.second->check_latency_statistics());
   }
   return utils::Status::OK;
 }
@@ -306,8 +712,11 @@ utils::Status ApiManagerImpl::GetServiceConfigRollouts(
                       .rollout_id()
                 : "";
 
-  for (auto item : service_selector_->list()) {
-    rollouts->percentages[item.first] = item.second;
+  auto deployment = std::atomic_load(&deployment_);
+  if (deployment) {
+    for (const auto &item : deployment->selector.list()) {
+      rollouts->percentages[item.first] = item.second;
+    }
   }
 
   if (config_manager_) {
@@ -320,6 +729,20 @@ utils::Status ApiManagerImpl::GetServiceConfigRollouts(
   return utils::Status::OK;
 }
 
+utils::Status ApiManagerImpl::ReloadServerConfig(
+    const std::string &server_config) {
+  std::shared_ptr<proto::ServerConfig> new_config =
+      Config::LoadServerConfig(global_context_->env(), server_config);
+  if (!new_config) {
+    return utils::Status(Code::INVALID_ARGUMENT,
+                         "Cannot parse the new server config.");
+  }
+  global_context_->ApplyTunableServerConfig(*new_config);
+  global_context_->env()->LogInfo(
+      "Applied tunable server config fields in place.");
+  return utils::Status::OK;
+}
+
 bool ApiManagerImpl::ReWriteURL(const char *uri, const size_t uri_len,
                                 std::string *destination_url, bool debug_mode) {
   auto server_config = global_context_->server_config();
@@ -337,7 +760,7 @@ bool ApiManagerImpl::ReWriteURL(const char *uri, const size_t uri_len,
 std::unique_ptr<RequestHandlerInterface> ApiManagerImpl::CreateRequestHandler(
     std::unique_ptr<Request> request_data) {
   return std::unique_ptr<RequestHandlerInterface>(new RequestHandler(
-      check_workflow_, SelectService(), std::move(request_data)));
+      this, check_workflow_, SelectService(), std::move(request_data)));
 }
 
 std::shared_ptr<ApiManager> ApiManagerFactory::CreateApiManager(
@@ -15,12 +15,15 @@
 #ifndef API_MANAGER_API_MANAGER_IMPL_H_
 #define API_MANAGER_API_MANAGER_IMPL_H_
 
+#include <atomic>
+
 #include "include/api_manager/api_manager.h"
 #include "src/api_manager/config_manager.h"
 #include "src/api_manager/context/global_context.h"
 #include "src/api_manager/context/service_context.h"
 #include "src/api_manager/rewrite_rule.h"
 #include "src/api_manager/service_control/interface.h"
+#include "src/api_manager/token_refresher.h"
 #include "src/api_manager/weighted_selector.h"
 
 namespace google {
@@ -69,6 +72,20 @@ class ApiManagerImpl : public ApiManager {
   // Return ServiceContext for selected by WeightedSelector
   std::shared_ptr<context::ServiceContext> SelectService();
 
+  // Feeds a request's final latency back to the rollout selector; no-op
+  // unless server_config.rollout_latency_feedback_config is enabled.
+  // config_id identifies the config version the request was routed to.
+  void RecordRolloutLatency(const std::string &config_id, int64_t latency_ms);
+
+  // Shadow-verifies routing for a rollout pending promotion: replays the
+  // method lookup of a sampled request against the incoming configs and
+  // counts every disagreement with the active config's result. Promotes
+  // the rollout once enough samples have been compared. Cheap no-op when
+  // no shadow rollout is in flight.
+  void ShadowCompareRouting(const std::string &http_method,
+                            const std::string &path,
+                            const MethodInfo *active_method);
+
   // Load service rollouts. This can be called only once, the data is from
   // server_config.
   utils::Status LoadServiceRollouts() override;
@@ -76,19 +93,101 @@ class ApiManagerImpl : public ApiManager {
   utils::Status GetServiceConfigRollouts(
       ServiceConfigRolloutsInfo *rollouts) override;
 
+  utils::Status ReloadServerConfig(const std::string &server_config) override;
+
   // Returns true if rewrite rule should be applied. Request uri should be
   // updated to destination_url. Otherwise returns false
   bool ReWriteURL(const char *uri, const size_t uri_len,
                   std::string *destination_url, bool debug_mode) override;
 
+  const CorsPreflightResponse *cors_preflight_response() const override {
+    return cors_preflight_response_.get();
+  }
+
   std::shared_ptr<context::GlobalContext> global_context() {
     return global_context_;
   }
 
  private:
-  // Use these configs according to the traffic percentage.
+  // A snapshot of a deployment: the weighted selector over the deployed
+  // config versions, and those versions' service contexts resolved at
+  // deploy time in selector order. DeployConfigs builds a fresh snapshot
+  // and publishes it with an atomic store, so the request path selects a
+  // service context with one atomic load and no locking or map lookup,
+  // even while a rollout is swapping configs. Only the selector's
+  // internal state (its random engine and, when enabled, its latency
+  // feedback) changes after publication; the member layout never does.
+  struct DeploymentSnapshot {
+    DeploymentSnapshot(
+        std::vector<std::pair<std::string, int>> &&list,
+        std::vector<std::shared_ptr<context::ServiceContext>> &&contexts)
+        : selector(std::move(list)), contexts(std::move(contexts)) {
+      // Resolved once at deploy time: when the deployment has a single
+      // config version - the overwhelmingly common case - every request
+      // selects the same context, so SelectService can return it
+      // directly without drawing from the selector. Also holds when a
+      // rollout leaves one version with all the traffic.
+      size_t weighted = 0;
+      size_t last = 0;
+      const auto &weights = selector.list();
+      for (size_t i = 0; i < weights.size(); ++i) {
+        if (weights[i].second > 0) {
+          ++weighted;
+          last = i;
+        }
+      }
+      if (this->contexts.size() == 1) {
+        sole_context = this->contexts[0];
+      } else if (weighted == 1 && last < this->contexts.size()) {
+        sole_context = this->contexts[last];
+      }
+    }
+
+    WeightedSelector selector;
+    const std::vector<std::shared_ptr<context::ServiceContext>> contexts;
+
+    // The only context receiving traffic, or null when the deployment
+    // actually splits traffic between versions.
+    std::shared_ptr<context::ServiceContext> sole_context;
+  };
+
+  // A rollout undergoing shadow verification: the incoming config
+  // versions are loaded but held out of traffic. Sampled live requests
+  // replay their routing lookup against these contexts; once min_samples
+  // comparisons are in, the divergence counters are logged and the
+  // pending list is promoted into a real deployment. Published and
+  // cleared with atomic stores, like the deployment snapshot.
+  struct ShadowRollout {
+    ShadowRollout(
+        std::vector<std::pair<std::string, int>> &&list,
+        std::vector<std::shared_ptr<context::ServiceContext>> &&contexts,
+        uint32_t sample_percent, uint64_t min_samples)
+        : list(std::move(list)),
+          contexts(std::move(contexts)),
+          sample_percent(sample_percent),
+          min_samples(min_samples),
+          tickets(0),
+          samples(0),
+          divergences(0) {}
+
+    // The pending deployment, handed to PublishDeployment on promotion.
+    std::vector<std::pair<std::string, int>> list;
+    const std::vector<std::shared_ptr<context::ServiceContext>> contexts;
+    const uint32_t sample_percent;
+    const uint64_t min_samples;
+
+    std::atomic<uint64_t> tickets;      // requests seen, for sampling
+    std::atomic<uint64_t> samples;      // comparisons made
+    std::atomic<uint64_t> divergences;  // comparisons that disagreed
+  };
+
+  // Use these configs according to the traffic percentage, or hold them
+  // in a shadow rollout when shadow verification applies.
   void DeployConfigs(std::vector<std::pair<std::string, int>> &&list);
 
+  // Builds and atomically publishes the deployment snapshot.
+  void PublishDeployment(std::vector<std::pair<std::string, int>> &&list);
+
   // Add and deploy service configs. Return utils::Status::OK when everything
   // is ok.
   utils::Status AddAndDeployConfigs(
@@ -97,6 +196,9 @@ class ApiManagerImpl : public ApiManager {
   // Send empty report to detect rollout ID change
   void DetectRolloutIDChange();
 
+  // Write the warm state snapshot; see warm_state.h.
+  void SnapshotWarmState();
+
   // The check work flow.
   std::shared_ptr<CheckWorkflow> check_workflow_;
 
@@ -110,14 +212,50 @@ class ApiManagerImpl : public ApiManager {
   std::map<std::string, std::shared_ptr<context::ServiceContext>>
       service_context_map_;
 
-  // A weighted service selector.
-  std::unique_ptr<WeightedSelector> service_selector_;
+  // Maps the MD5 digest of a raw service config body to the config_id it
+  // parsed to, so a re-fetch of an unchanged config resolves to the
+  // existing service context without being parsed again.
+  std::map<std::string, std::string> config_digests_;
+
+  // Maps config_id to the on-disk config cache entry the full Service
+  // proto can be re-derived from. Only populated for configs whose
+  // in-memory proto was trimmed; see Config::TrimService().
+  std::map<std::string, std::string> trimmed_config_paths_;
+
+  // Holds the most recently re-derived full Service proto so service() can
+  // return it by reference; consumers copy what they keep, so only one
+  // re-derived message is held at a time. Mutable because service() is a
+  // const accessor.
+  mutable std::unique_ptr<::google::api::Service> rehydrated_service_;
+
+  // The current deployment. Read with std::atomic_load and replaced with
+  // std::atomic_store; never mutated in place.
+  std::shared_ptr<DeploymentSnapshot> deployment_;
+
+  // The rollout being shadow-verified, nullptr when none is in flight.
+  // Same atomic publication discipline as deployment_.
+  std::shared_ptr<ShadowRollout> shadow_rollout_;
 
   // A config manager will be initialized when server_config.rollout_strategy is
   // set to "managed"
   std::unique_ptr<ConfigManager> config_manager_;
 
+  // Refreshes metadata server tokens ahead of their expiration.
+  std::unique_ptr<TokenRefresher> token_refresher_;
+
+  // Drives the global cache byte accountant; only started when the
+  // server config sets a cache budget.
+  std::unique_ptr<PeriodicTimer> cache_budget_timer_;
+
+  // Writes the warm state snapshot; only started when the server config
+  // sets a snapshot file.
+  std::unique_ptr<PeriodicTimer> warm_state_timer_;
+
   std::vector<std::unique_ptr<RewriteRule>> rewrite_rules_;
+
+  // Precompiled CORS preflight response; nullptr when the server config has
+  // no cors_preset_config.
+  std::unique_ptr<CorsPreflightResponse> cors_preflight_response_;
 };
 
 }  // namespace api_manager
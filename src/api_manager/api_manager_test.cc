@@ -94,6 +94,27 @@ const char kServerConfigWithManagedRolloutStrategy[] = R"(
 }
 )";
 
+const char kServerConfigWithShadowRollout[] = R"(
+{
+  "google_authentication_secret": "{}",
+  "metadata_server_config": {
+    "enabled": true,
+    "url": "http://localhost"
+  },
+  "service_config_rollout": {
+    traffic_percentages: {
+      "src/api_manager/testdata/bookstore_service_config_1.json": 100
+    }
+  },
+  "rollout_strategy": "managed",
+  "shadow_rollout_config": {
+    "enabled": true,
+    "sample_percent": 100,
+    "min_samples": 3
+  }
+}
+)";
+
 const char kServerConfigWithNoServiceConfig[] = R"(
 {
   "google_authentication_secret": "{}",
@@ -122,6 +143,17 @@ const char kServerConfigWithApiServiceConfigRewriteRule[] = R"(
 }
 )";
 
+const char kServerConfigWithCorsPreset[] = R"(
+{
+  "cors_preset_config": {
+    "allowed_origins": ["https://example.com", "https://other.example.com"],
+    "allowed_methods": "GET, POST, OPTIONS",
+    "allowed_headers": "Authorization, Content-Type",
+    "max_age_sec": 3600
+  }
+}
+)";
+
 const char kServiceConfig1[] = R"(
 {
   "name": "bookstore.test.appspot.com",
@@ -407,6 +439,49 @@ TEST_F(ApiManagerTest, ManagedRolloutStrategy) {
   EXPECT_EQ("2017-05-01r1", service->service().id());
 }
 
+TEST_F(ApiManagerTest, ShadowRolloutHoldsTrafficUntilVerified) {
+  std::unique_ptr<MockTimerApiManagerEnvironment> env(
+      new ::testing::NiceMock<MockTimerApiManagerEnvironment>());
+  MockTimerApiManagerEnvironment *raw_env = env.get();
+
+  EXPECT_CALL(*env.get(), DoRunHTTPRequest(_))
+      .WillOnce(Invoke([this](HTTPRequest *req) {
+        req->OnComplete(Status::OK, {}, kRolloutsResponse1);
+      }))
+      .WillOnce(Invoke([this](HTTPRequest *req) {
+        req->OnComplete(Status::OK, {}, kServiceConfig2);
+      }));
+
+  std::shared_ptr<ApiManagerImpl> api_manager(
+      std::dynamic_pointer_cast<ApiManagerImpl>(
+          MakeApiManager(std::move(env), kServerConfigWithShadowRollout)));
+  EXPECT_OK(api_manager->LoadServiceRollouts());
+  api_manager->Init();
+
+  // Fetch the new rollout. With shadow verification enabled the incoming
+  // config must not take traffic yet.
+  api_manager->global_context()->rollout_id_func()("2017-05-01r111");
+  raw_env->RunTimer();
+
+  auto service = api_manager->SelectService();
+  EXPECT_TRUE(service);
+  EXPECT_EQ("2017-05-01r0", service->service().id());
+
+  // Both configs route GET /echo the same way; after min_samples clean
+  // comparisons the rollout is promoted.
+  const MethodInfo *active = service->config()->GetMethodInfo("GET", "/echo");
+  EXPECT_TRUE(active != nullptr);
+  for (int i = 0; i < 3; ++i) {
+    service = api_manager->SelectService();
+    EXPECT_EQ("2017-05-01r0", service->service().id());
+    api_manager->ShadowCompareRouting("GET", "/echo", active);
+  }
+
+  service = api_manager->SelectService();
+  EXPECT_TRUE(service);
+  EXPECT_EQ("2017-05-01r1", service->service().id());
+}
+
 TEST_F(ApiManagerTest, ServerConfigWithPartialServiceConfig) {
   std::unique_ptr<MockApiManagerEnvironment> env(
       new ::testing::NiceMock<MockApiManagerEnvironment>());
@@ -506,6 +581,37 @@ TEST_F(ApiManagerTest, RewriteRuleTest) {
   EXPECT_FALSE(api_manager->Enabled());
 }
 
+TEST_F(ApiManagerTest, CorsPreflightResponseTest) {
+  std::unique_ptr<MockApiManagerEnvironment> env(
+      new ::testing::NiceMock<MockApiManagerEnvironment>());
+
+  std::shared_ptr<ApiManagerImpl> api_manager(
+      std::dynamic_pointer_cast<ApiManagerImpl>(
+          MakeApiManager(std::move(env), kServerConfigWithCorsPreset)));
+  EXPECT_TRUE(api_manager);
+
+  const CorsPreflightResponse *cors = api_manager->cors_preflight_response();
+  ASSERT_NE(nullptr, cors);
+  ASSERT_EQ(2, cors->allowed_origins.size());
+  EXPECT_EQ("https://example.com", cors->allowed_origins[0]);
+  EXPECT_EQ("https://other.example.com", cors->allowed_origins[1]);
+  EXPECT_EQ("GET, POST, OPTIONS", cors->allowed_methods);
+  EXPECT_EQ("Authorization, Content-Type", cors->allowed_headers);
+  EXPECT_EQ("3600", cors->max_age);
+}
+
+TEST_F(ApiManagerTest, CorsPreflightResponseNotConfiguredTest) {
+  std::unique_ptr<MockApiManagerEnvironment> env(
+      new ::testing::NiceMock<MockApiManagerEnvironment>());
+
+  std::shared_ptr<ApiManagerImpl> api_manager(
+      std::dynamic_pointer_cast<ApiManagerImpl>(MakeApiManager(
+          std::move(env), kServerConfigWithSingleServiceConfig)));
+  EXPECT_TRUE(api_manager);
+
+  EXPECT_EQ(nullptr, api_manager->cors_preflight_response());
+}
+
 }  // namespace
 
 }  // namespace api_manager
@@ -25,48 +25,150 @@ namespace {
 const int kAuthzCacheTimeout = 300;
 // The number of entries in authz cache.
 const int kAuthzCacheSize = 10000;
+// The number of cache shards. Must be a power of 2. The cache key is
+// already a hash of the request, so its first byte picks the shard and
+// concurrent lookups do not serialize on one mutex.
+const size_t kAuthzCacheShards = 8;
+
+// 64-bit FNV-1a parameters. The cache key does not need to be
+// cryptographic: the digest is never exposed and the inputs are not
+// attacker-chosen hash targets. It only needs to be wide enough that an
+// accidental collision cannot leak a verdict between callers, so two
+// differently seeded 64-bit passes produce the same 128-bit key width as
+// the MD5 digest they replace, at a fraction of the cost.
+const uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ull;
+const uint64_t kFnvPrime = 0x100000001b3ull;
+
+uint64_t FnvHash(uint64_t hash, const std::string& data) {
+  for (const char c : data) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= kFnvPrime;
+  }
+  return hash;
+}
+
+void AppendHash(uint64_t hash, std::string* key) {
+  for (int i = 0; i < 8; ++i) {
+    key->push_back(static_cast<char>(hash >> (i * 8)));
+  }
+}
 }  // namespace
 
-AuthzCache::AuthzCache() : cache_(kAuthzCacheSize) {}
+AuthzCache::AuthzCache()
+    : hits_(0), misses_(0), inserts_(0), removes_(0), shed_cursor_(0) {
+  shards_.reserve(kAuthzCacheShards);
+  for (size_t i = 0; i < kAuthzCacheShards; ++i) {
+    shards_.emplace_back(new CacheShard(kAuthzCacheSize / kAuthzCacheShards));
+  }
+}
+
+AuthzCache::~AuthzCache() {
+  for (auto& shard : shards_) {
+    shard->Clear();
+  }
+}
 
-AuthzCache::~AuthzCache() { cache_.Clear(); }
+AuthzCache::CacheShard& AuthzCache::shard(const std::string& cache_key) {
+  return *shards_[static_cast<unsigned char>(cache_key[0]) &
+                  (kAuthzCacheShards - 1)];
+}
 
 void AuthzCache::Add(const std::string& cache_key, const bool if_success,
-                     const std::chrono::system_clock::time_point& now) {
+                     const std::chrono::steady_clock::time_point& now) {
   AuthzValue* newval = new AuthzValue();
   newval->if_success = if_success;
   newval->exp = now + std::chrono::seconds(kAuthzCacheTimeout);
-  cache_.Insert(cache_key, newval, 1);
+  shard(cache_key).Insert(cache_key, newval, 1);
+  inserts_.fetch_add(1, std::memory_order_relaxed);
 }
 
 bool AuthzCache::Lookup(const std::string& cache_key,
-                        const std::chrono::system_clock::time_point& now,
+                        const std::chrono::steady_clock::time_point& now,
                         AuthzValue* value) {
-  ::google::service_control_client::SimpleLRUCache<
-      std::string, AuthzValue>::ScopedLookup lookup(&cache_, cache_key);
-  if (!lookup.Found()) {
-    return false;
+  CacheShard& cache = shard(cache_key);
+  // Counters are only summed for /endpoints_status, so relaxed adds are
+  // enough and keep the request path free of fences.
+  {
+    CacheShard::ScopedLookup lookup(&cache, cache_key);
+    if (lookup.Found() && now <= lookup.value()->exp) {
+      hits_.fetch_add(1, std::memory_order_relaxed);
+      *value = *lookup.value();
+      return true;
+    }
+    if (!lookup.Found()) {
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
   }
-  AuthzValue* val = lookup.value();
-  if (now > val->exp) {
-    cache_.Remove(cache_key);
-    return false;
+  // An expired entry counts as a miss; the caller re-runs authorization.
+  misses_.fetch_add(1, std::memory_order_relaxed);
+  if (cache.Remove(cache_key)) {
+    removes_.fetch_add(1, std::memory_order_relaxed);
   }
-  *value = *val;
-  return true;
+  return false;
 }
 
 std::string AuthzCache::ComposeAuthzCacheKey(
-    const std::string& auth_token, const std::string& request_path,
-    const std::string& request_HTTP_method) {
-  google::service_control_client::MD5 hasher;
-  hasher.Update(auth_token);
-  hasher.Update(request_path);
-  hasher.Update(request_HTTP_method);
-  return hasher.Digest();
+    const std::string& ruleset_id, const std::string& caller_id,
+    const std::string& request_path, const std::string& request_HTTP_method) {
+  uint64_t lo = kFnvOffsetBasis;
+  // Seed the second pass differently so the two halves are independent.
+  uint64_t hi = FnvHash(kFnvOffsetBasis, "authz");
+  for (const std::string* part :
+       {&ruleset_id, &caller_id, &request_path, &request_HTTP_method}) {
+    lo = FnvHash(lo, *part);
+    hi = FnvHash(hi, *part);
+  }
+  std::string key;
+  key.reserve(16);
+  AppendHash(lo, &key);
+  AppendHash(hi, &key);
+  return key;
+}
+
+void AuthzCache::GetStatistics(AuthzCacheStatistics* stat) {
+  stat->hits = hits_.load(std::memory_order_relaxed);
+  stat->misses = misses_.load(std::memory_order_relaxed);
+  uint64_t entries = 0;
+  for (auto& shard : shards_) {
+    entries += shard->Entries();
+  }
+  // Every insert is still resident, was removed on expiration, or was
+  // evicted (including replacement by a newer entry with the same key).
+  const uint64_t accounted = removes_.load(std::memory_order_relaxed) + entries;
+  const uint64_t inserts = inserts_.load(std::memory_order_relaxed);
+  stat->evictions = inserts > accounted ? inserts - accounted : 0;
+  stat->resident_bytes = EstimatedBytes();
+}
+
+int64_t AuthzCache::EstimatedBytes() {
+  // Entries have a fixed footprint: the 16-byte hash key plus the value.
+  int64_t entries = 0;
+  for (auto& shard : shards_) {
+    entries += shard->Entries();
+  }
+  return entries * static_cast<int64_t>(16 + sizeof(AuthzValue));
 }
 
-int AuthzCache::NumberOfEntries() { return cache_.Entries(); }
+void AuthzCache::ShedFraction(double fraction) {
+  size_t shards_to_clear =
+      static_cast<size_t>(fraction * kAuthzCacheShards + 1.0);
+  if (shards_to_clear > kAuthzCacheShards) {
+    shards_to_clear = kAuthzCacheShards;
+  }
+  for (size_t i = 0; i < shards_to_clear; ++i) {
+    shards_[shed_cursor_]->Clear();
+    shed_cursor_ = (shed_cursor_ + 1) & (kAuthzCacheShards - 1);
+  }
+}
+
+int AuthzCache::NumberOfEntries() {
+  int entries = 0;
+  for (auto& shard : shards_) {
+    entries += shard->Entries();
+  }
+  return entries;
+}
 
 }  // namespace auth
 }  // namespace api_manager
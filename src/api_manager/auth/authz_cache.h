@@ -15,9 +15,13 @@
 #ifndef API_MANAGER_AUTH_AUTHZ_CACHE_H_
 #define API_MANAGER_AUTH_AUTHZ_CACHE_H_
 
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <string>
-#include "utils/md5.h"
+#include <vector>
+
+#include "include/api_manager/api_manager.h"
 #include "utils/simple_lru_cache_inl.h"
 
 namespace google {
@@ -29,36 +33,70 @@ struct AuthzValue {
   // Authorization result.
   bool if_success;
   // Expiration time of the cache entry. This equals the time this cache entry
-  // is added + CacheEntryTTL.
-  std::chrono::system_clock::time_point exp;
+  // is added + CacheEntryTTL. Steady, so a wall clock step cannot
+  // mass-expire (or pin) cached verdicts.
+  std::chrono::steady_clock::time_point exp;
 };
 
 // A local cache to expedite the authorization process. The key of the cache is
-// the hash of the concatenation of JWT auth token, request path, and request
-// HTTP method. The value is of type AuthzValue.
+// a non-cryptographic hash of the concatenation of the Firebase ruleset name
+// the verdict was computed against, the caller identity (the verified JWT
+// claims, falling back to the raw auth token), request path, and request HTTP
+// method. The value is of type AuthzValue.
+//
+// The cache is split into shards selected by the key prefix so that
+// concurrent lookups do not contend on a single LRU mutex. Hit, miss and
+// eviction counters are exported through GetStatistics() for the
+// /endpoints_status handler.
 class AuthzCache {
  public:
   AuthzCache();
   ~AuthzCache();
   // This method is used to insert cache entry.
   void Add(const std::string& cache_key, const bool if_success,
-           const std::chrono::system_clock::time_point& now);
+           const std::chrono::steady_clock::time_point& now);
   // This method is used to do cache lookup.
   bool Lookup(const std::string& cache_key,
-              const std::chrono::system_clock::time_point& now,
+              const std::chrono::steady_clock::time_point& now,
               AuthzValue* value);
   // This method is used to generate cache key.
   static std::string ComposeAuthzCacheKey(
-      const std::string& auth_token, const std::string& request_path,
-      const std::string& request_HTTP_method);
+      const std::string& ruleset_id, const std::string& caller_id,
+      const std::string& request_path, const std::string& request_HTTP_method);
+  // Fills in the cache counters accumulated since construction.
+  void GetStatistics(AuthzCacheStatistics* stat);
+  // Estimated resident bytes: the fixed per-entry footprint times the
+  // number of resident entries. Used for global cache budget accounting.
+  int64_t EstimatedBytes();
+  // Drops roughly the given fraction (0, 1] of the cache by clearing
+  // whole shards, starting after the last shard shed so repeated calls
+  // rotate through the cache instead of always hitting the same keys.
+  void ShedFraction(double fraction);
   // This method returns number of entries stored in cache. Note that this
   // method is only used in testing.
   int NumberOfEntries();
 
  private:
-  // LRU cache.
-  ::google::service_control_client::SimpleLRUCache<std::string, AuthzValue>
-      cache_;
+  typedef ::google::service_control_client::SimpleLRUCache<std::string,
+                                                           AuthzValue>
+      CacheShard;
+
+  // Returns the shard owning cache_key.
+  CacheShard& shard(const std::string& cache_key);
+
+  // The shards. Each one has its own LRU list and mutex.
+  std::vector<std::unique_ptr<CacheShard>> shards_;
+
+  // Cache counters. Evictions are derived in GetStatistics() as
+  // inserts - removes - resident entries; every inserted entry is either
+  // still resident, removed on expiration, or evicted by its shard.
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+  std::atomic<uint64_t> inserts_;
+  std::atomic<uint64_t> removes_;
+
+  // The shard after the last one cleared by ShedFraction().
+  size_t shed_cursor_;
 };
 
 }  // namespace auth
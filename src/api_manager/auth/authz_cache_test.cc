@@ -25,6 +25,8 @@ namespace {
 const std::string kPath = "/path/to/resource";
 const std::string kPath1 = "path/to/resources";
 const std::string kHTTPMethod = "GET";
+const std::string kRulesetId =
+    "projects/myfirebaseapp/rulesets/99045fc0-a5e4-47e2-a665-f88593594b6b";
 const std::string kAuthToken =
     "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCJ9.eyJpc3MiOiI2Mjg2NDU3NDE4ODEtbm9hYml1M"
     "jNmNWE4bThvdmQ4dWN2Njk4bGo3OHZ2MGxAZGV2ZWxvcGVyLmdzZXJ2aWNlYWNjb3VudC5jb20"
@@ -40,29 +42,51 @@ const int kAuthzCacheTimeout = 300;
 class TestAuthzCache : public ::testing::Test {
  public:
   void SetUp() {
-    now_ = std::chrono::system_clock::now();
-    cache_key_ =
-        AuthzCache::ComposeAuthzCacheKey(kAuthToken, kPath, kHTTPMethod);
-    new_cache_key_ =
-        AuthzCache::ComposeAuthzCacheKey(kAuthToken, kPath1, kHTTPMethod);
+    now_ = std::chrono::steady_clock::now();
+    cache_key_ = AuthzCache::ComposeAuthzCacheKey(kRulesetId, kAuthToken, kPath,
+                                                  kHTTPMethod);
+    new_cache_key_ = AuthzCache::ComposeAuthzCacheKey(kRulesetId, kAuthToken,
+                                                      kPath1, kHTTPMethod);
   }
 
   AuthzCache cache_;
-  std::chrono::system_clock::time_point now_;
+  std::chrono::steady_clock::time_point now_;
   std::string cache_key_;
   std::string new_cache_key_;
 };
 
-// Key generated by MD5 hash algorihtm is of fixed length. Different
+// Key generated by the FNV-1a hash is of fixed length. Different
 // combinations of key components result in different keys.
 TEST_F(TestAuthzCache, KeyGeneration) {
   ASSERT_EQ(cache_key_.length(), 16);
-  ASSERT_EQ(cache_key_, " [\x9A\r\xC4\xE1I5\xA6\xDD\x92\xFD\x1A-\xCDT");
+  ASSERT_EQ(cache_key_,
+            "\xAC\xC9\xB4\xA7\x92\x3C\x7B\x71\x3A\x10\xA5\xD2\x44\x08\x6E"
+            "\x1D");
   ASSERT_EQ(new_cache_key_.length(), 16);
-  ASSERT_EQ(new_cache_key_, "\v\xD6\xC3\xD9\x84\"\xF1\x81\xC4\xC5=\x81T^\xDC?");
+  ASSERT_EQ(new_cache_key_,
+            "\x60\x78\x3D\xE6\x59\xF7\x93\x76\x56\xF2\xC4\x8B\x11\x72\xE1"
+            "\xD4");
   ASSERT_NE(cache_key_, new_cache_key_);
 }
 
+// Lookups and expirations are visible in the exported statistics.
+TEST_F(TestAuthzCache, Statistics) {
+  AuthzValue val;
+  ASSERT_FALSE(cache_.Lookup(cache_key_, now_, &val));
+  cache_.Add(cache_key_, true, now_);
+  ASSERT_TRUE(cache_.Lookup(cache_key_, now_, &val));
+  // An expired entry counts as a miss and is removed, not evicted.
+  cache_.Add(new_cache_key_, true,
+             now_ - std::chrono::seconds(2 * kAuthzCacheTimeout));
+  ASSERT_FALSE(cache_.Lookup(new_cache_key_, now_, &val));
+
+  AuthzCacheStatistics stat;
+  cache_.GetStatistics(&stat);
+  ASSERT_EQ(stat.hits, 1);
+  ASSERT_EQ(stat.misses, 2);
+  ASSERT_EQ(stat.evictions, 0);
+}
+
 // Lookup the cache entry that does not exist.
 TEST_F(TestAuthzCache, EntryNotExist) {
   AuthzValue val;
@@ -17,8 +17,11 @@
 
 #include <chrono>
 #include <map>
+#include <memory>
 #include <string>
 
+#include "src/api_manager/auth/lib/auth_jwt_validator.h"
+
 namespace google {
 namespace api_manager {
 namespace auth {
@@ -29,6 +32,10 @@ class Certs {
   void Update(const std::string& issuer, const std::string& cert,
               std::chrono::system_clock::time_point expiration) {
     issuer_cert_map_[issuer] = std::make_pair(cert, expiration);
+    // Parse the key document once per fetch so signature verification does
+    // not re-extract key material on every request.
+    issuer_pubkeys_map_[issuer] = JwtPublicKeys::Create(cert.c_str(),
+                                                        cert.size());
   }
 
   const std::pair<std::string, std::chrono::system_clock::time_point>* GetCert(
@@ -38,11 +45,30 @@ class Certs {
                : &(issuer_cert_map_[iss]);
   }
 
+  // Prepared asymmetric keys for the issuer. Returns nullptr when the cached
+  // document holds none (e.g. an HS shared secret); callers then verify
+  // against the raw document.
+  std::shared_ptr<JwtPublicKeys> GetPublicKeys(const std::string& iss) {
+    auto it = issuer_pubkeys_map_.find(iss);
+    return it == issuer_pubkeys_map_.end() ? nullptr : it->second;
+  }
+
+  // The full cache, for the background refresher to scan for expiring keys.
+  const std::map<std::string,
+                 std::pair<std::string, std::chrono::system_clock::time_point> >&
+  issuer_cert_map() const {
+    return issuer_cert_map_;
+  }
+
  private:
   // Map from issuer to a verification key and its absolute expiration time.
   std::map<std::string,
            std::pair<std::string, std::chrono::system_clock::time_point> >
       issuer_cert_map_;
+  // Map from issuer to its keys parsed ahead of time. Held by shared_ptr so
+  // a refresh on the event loop cannot pull the keys out from under a
+  // verification that is still using them.
+  std::map<std::string, std::shared_ptr<JwtPublicKeys> > issuer_pubkeys_map_;
 };
 
 }  // namespace auth
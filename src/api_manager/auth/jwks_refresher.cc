@@ -0,0 +1,107 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/auth/jwks_refresher.h"
+
+#include "include/api_manager/http_request.h"
+
+using std::chrono::system_clock;
+
+namespace google {
+namespace api_manager {
+namespace auth {
+
+namespace {
+// Lower bound for the refresh timer interval. Unit: seconds.
+const int kMinRefreshIntervalInS = 1;
+}  // namespace
+
+JwksRefresher::JwksRefresher(ApiManagerEnvInterface *env, Certs *certs,
+                             JwksUriResolver resolver, int cache_duration_in_s)
+    : env_(env),
+      certs_(certs),
+      resolver_(resolver),
+      cache_duration_in_s_(cache_duration_in_s),
+      refresh_ahead_(0) {}
+
+JwksRefresher::~JwksRefresher() {
+  if (timer_) {
+    timer_->Stop();
+  }
+}
+
+void JwksRefresher::Init() {
+  int interval_in_s = cache_duration_in_s_ / 4;
+  if (interval_in_s < kMinRefreshIntervalInS) {
+    interval_in_s = kMinRefreshIntervalInS;
+  }
+  // A key becomes due two ticks before it expires, so a single failed fetch
+  // still leaves a tick to retry before the key goes stale.
+  refresh_ahead_ = std::chrono::seconds(2 * interval_in_s);
+  timer_ = env_->StartPeriodicTimer(
+      std::chrono::milliseconds(interval_in_s * 1000),
+      [this]() { RefreshDueKeys(); });
+}
+
+void JwksRefresher::RefreshDueKeys() {
+  const system_clock::time_point now = system_clock::now();
+  for (const auto &it : certs_->issuer_cert_map()) {
+    const std::string &issuer = it.first;
+    if (it.second.second - now > refresh_ahead_) {
+      continue;
+    }
+    if (fetching_.find(issuer) != fetching_.end()) {
+      continue;
+    }
+    const std::string url = resolver_(issuer);
+    if (url.empty()) {
+      continue;
+    }
+    FetchKey(issuer, url);
+  }
+}
+
+void JwksRefresher::FetchKey(const std::string &issuer,
+                             const std::string &url) {
+  fetching_.insert(issuer);
+  env_->LogDebug(std::string("refreshing verification key for issuer: ") +
+                 issuer);
+  std::unique_ptr<HTTPRequest> request(new HTTPRequest(
+      [this, issuer](utils::Status status,
+                     std::map<std::string, std::string> &&,
+                     std::string &&body) {
+        fetching_.erase(issuer);
+        if (!status.ok() || body.empty()) {
+          // Keep serving the cached key; the next tick retries the fetch
+          // and the request path falls back to a synchronous fetch once
+          // the key is too stale.
+          env_->LogWarning(
+              std::string("Failed to refresh verification key for issuer: ") +
+              issuer + ": " + status.ToString());
+          return;
+        }
+        certs_->Update(
+            issuer, std::move(body),
+            system_clock::now() + std::chrono::seconds(cache_duration_in_s_));
+      }));
+
+  request->set_method("GET").set_url(url);
+  env_->RunHTTPRequest(std::move(request));
+}
+
+}  // namespace auth
+}  // namespace api_manager
+}  // namespace google
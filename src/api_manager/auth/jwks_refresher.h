@@ -0,0 +1,83 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_AUTH_JWKS_REFRESHER_H_
+#define API_MANAGER_AUTH_JWKS_REFRESHER_H_
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+
+#include "include/api_manager/env_interface.h"
+#include "include/api_manager/periodic_timer.h"
+#include "src/api_manager/auth/certs.h"
+
+namespace google {
+namespace api_manager {
+namespace auth {
+
+// Re-fetches JWKS public keys in the background before their cache entries
+// expire, so that no request has to wait on a synchronous key fetch after
+// the first one. Keys enter the cache through check_auth when a request
+// first sees an issuer; from then on the refresher keeps them fresh and
+// check_auth serves a slightly-stale key while a refresh is in flight.
+class JwksRefresher {
+ public:
+  // Resolves an issuer to its direct jwks_uri. Returns an empty string for
+  // issuers only reachable via OpenID discovery; those are refreshed on the
+  // request path as before.
+  typedef std::function<std::string(const std::string &issuer)>
+      JwksUriResolver;
+
+  JwksRefresher(ApiManagerEnvInterface *env, Certs *certs,
+                JwksUriResolver resolver, int cache_duration_in_s);
+  ~JwksRefresher();
+
+  // Starts the refresh timer. Called from ApiManager::Init(); a periodic
+  // timer cannot be started from a constructor (see
+  // service_control/aggregated.cc).
+  void Init();
+
+ private:
+  // Re-fetches every cached key that expires before the refresh horizon.
+  void RefreshDueKeys();
+  void FetchKey(const std::string &issuer, const std::string &url);
+
+  ApiManagerEnvInterface *env_;
+
+  // The cert cache to keep fresh. Owned by the service context that owns
+  // this refresher.
+  Certs *certs_;
+
+  JwksUriResolver resolver_;
+
+  // Lifetime of a refreshed cache entry. Unit: seconds.
+  int cache_duration_in_s_;
+
+  // Keys expiring within this duration are re-fetched on the next tick.
+  std::chrono::seconds refresh_ahead_;
+
+  // Issuers with a fetch in flight, to avoid duplicate requests.
+  std::set<std::string> fetching_;
+
+  std::unique_ptr<PeriodicTimer> timer_;
+};
+
+}  // namespace auth
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_AUTH_JWKS_REFRESHER_H_
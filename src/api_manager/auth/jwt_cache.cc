@@ -16,7 +16,6 @@
 //
 #include "src/api_manager/auth/jwt_cache.h"
 
-using ::google::service_control_client::SimpleLRUCache;
 using std::chrono::system_clock;
 
 namespace google {
@@ -27,23 +26,137 @@ namespace {
 // The maximum lifetime of a cache entry. Unit: seconds.
 // TODO: This value should be configurable via server config.
 const int kJwtCacheTimeout = 300;
-// The number of entries in JWT cache.
-// TODO: This value should be configurable via server config.
-const int kJwtCacheSize = 100;
+// The maximum lifetime of a deny-cache entry. Unit: seconds. Kept short
+// so a denial cannot long outlive a key rotation that would make the
+// token verify.
+const int kJwtDenyCacheTimeout = 60;
+// The default total size of the JWT cache. Unit: bytes. A typical entry
+// (token plus extracted user info) is around 1KB, so this holds a few
+// thousand distinct callers.
+const int64_t kJwtCacheSizeInBytes = 4 * 1024 * 1024;
+// The number of cache shards. Must be a power of 2. The shard is picked by
+// the hash of the JWT, so unrelated tokens do not serialize on one mutex.
+const size_t kJwtCacheShards = 8;
+
+// The accounted size of a cache entry: the key and the strings extracted
+// into the value, on top of the value struct itself.
+int64_t EntryUnits(const std::string& jwt, const UserInfo& user_info) {
+  int64_t units = jwt.size() + sizeof(JwtValue) + user_info.id.size() +
+                  user_info.email.size() + user_info.consumer_id.size() +
+                  user_info.issuer.size();
+  for (const auto& audience : user_info.audiences) {
+    units += audience.size();
+  }
+  return units;
+}
 }  // namespace
 
-JwtCache::JwtCache() : SimpleLRUCache<std::string, JwtValue>(kJwtCacheSize) {}
+JwtCache::JwtCache(int64_t jwt_cache_size_in_bytes)
+    : hits_(0),
+      misses_(0),
+      inserts_(0),
+      removes_(0),
+      inserted_units_(0),
+      shed_cursor_(0) {
+  if (jwt_cache_size_in_bytes <= 0) {
+    jwt_cache_size_in_bytes = kJwtCacheSizeInBytes;
+  }
+  shards_.reserve(kJwtCacheShards);
+  for (size_t i = 0; i < kJwtCacheShards; ++i) {
+    shards_.emplace_back(
+        new CacheShard(jwt_cache_size_in_bytes / kJwtCacheShards));
+  }
+}
+
+JwtCache::~JwtCache() {
+  for (auto& shard : shards_) {
+    shard->Clear();
+  }
+}
 
-JwtCache::~JwtCache() { Clear(); }
+JwtCache::CacheShard& JwtCache::shard(const std::string& jwt) {
+  return *shards_[hasher_(jwt) & (kJwtCacheShards - 1)];
+}
 
 void JwtCache::Insert(const std::string& jwt, const UserInfo& user_info,
                       const system_clock::time_point& token_exp,
-                      const system_clock::time_point& now) {
+                      const std::chrono::steady_clock::time_point& now) {
   JwtValue* newval = new JwtValue();
   newval->user_info = user_info;
-  newval->exp =
-      std::min(token_exp, now + std::chrono::seconds(kJwtCacheTimeout));
-  SimpleLRUCache::Insert(jwt, newval, 1);
+  newval->cache_exp = now + std::chrono::seconds(kJwtCacheTimeout);
+  newval->token_exp = token_exp;
+  const int64_t units = EntryUnits(jwt, user_info);
+  shard(jwt).Insert(jwt, newval, units);
+  inserts_.fetch_add(1, std::memory_order_relaxed);
+  inserted_units_.fetch_add(units, std::memory_order_relaxed);
+}
+
+void JwtCache::InsertDenial(const std::string& jwt, const std::string& error,
+                            const std::chrono::steady_clock::time_point& now) {
+  JwtValue* newval = new JwtValue();
+  newval->cache_exp = now + std::chrono::seconds(kJwtDenyCacheTimeout);
+  newval->token_exp = system_clock::time_point::max();
+  newval->denied = true;
+  newval->error = error;
+  const int64_t units = jwt.size() + sizeof(JwtValue) + error.size();
+  shard(jwt).Insert(jwt, newval, units);
+  inserts_.fetch_add(1, std::memory_order_relaxed);
+  inserted_units_.fetch_add(units, std::memory_order_relaxed);
+}
+
+void JwtCache::Remove(const std::string& jwt) {
+  if (shard(jwt).Remove(jwt)) {
+    removes_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void JwtCache::GetStatistics(JwtCacheStatistics* stat) {
+  stat->hits = hits_.load(std::memory_order_relaxed);
+  stat->misses = misses_.load(std::memory_order_relaxed);
+  uint64_t entries = 0;
+  for (auto& shard : shards_) {
+    entries += shard->Entries();
+  }
+  // Every insert is still resident, was removed explicitly, or was evicted
+  // (including replacement by a newer entry with the same key).
+  const uint64_t accounted = removes_.load(std::memory_order_relaxed) + entries;
+  const uint64_t inserts = inserts_.load(std::memory_order_relaxed);
+  stat->evictions = inserts > accounted ? inserts - accounted : 0;
+  stat->resident_bytes = EstimatedBytes();
+}
+
+int64_t JwtCache::EstimatedBytes() {
+  const uint64_t inserts = inserts_.load(std::memory_order_relaxed);
+  if (inserts == 0) {
+    return 0;
+  }
+  const uint64_t average =
+      inserted_units_.load(std::memory_order_relaxed) / inserts;
+  int64_t entries = 0;
+  for (auto& shard : shards_) {
+    entries += shard->Entries();
+  }
+  return entries * static_cast<int64_t>(average);
+}
+
+void JwtCache::ShedFraction(double fraction) {
+  size_t shards_to_clear =
+      static_cast<size_t>(fraction * kJwtCacheShards + 1.0);
+  if (shards_to_clear > kJwtCacheShards) {
+    shards_to_clear = kJwtCacheShards;
+  }
+  for (size_t i = 0; i < shards_to_clear; ++i) {
+    shards_[shed_cursor_]->Clear();
+    shed_cursor_ = (shed_cursor_ + 1) & (kJwtCacheShards - 1);
+  }
+}
+
+int JwtCache::NumberOfEntries() {
+  int entries = 0;
+  for (auto& shard : shards_) {
+    entries += shard->Entries();
+  }
+  return entries;
 }
 
 }  // namespace auth
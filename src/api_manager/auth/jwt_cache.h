@@ -15,9 +15,14 @@
 #ifndef API_MANAGER_AUTH_JWT_CACHE_H_
 #define API_MANAGER_AUTH_JWT_CACHE_H_
 
+#include <atomic>
 #include <chrono>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "include/api_manager/api_manager.h"
 #include "src/api_manager/auth.h"
 #include "utils/simple_lru_cache_inl.h"
 
@@ -30,23 +35,118 @@ struct JwtValue {
   // User info extracted from the JWT.
   UserInfo user_info;
 
-  // Expiration time of the cache entry. This is the minimum of "exp" field in
-  // the JWT and [the time this cache entry is added + kJwtCacheTimeout].
-  std::chrono::system_clock::time_point exp;
+  // Expiration time of the cache entry: the time it was added +
+  // kJwtCacheTimeout. Steady, so a wall clock step cannot mass-expire
+  // (or pin) cached tokens.
+  std::chrono::steady_clock::time_point cache_exp;
+
+  // The "exp" field of the JWT. Wall clock, like the claim itself.
+  std::chrono::system_clock::time_point token_exp;
+
+  // Set for a deny-cache entry: the token itself was rejected (bad
+  // structure, expired, failed signature verification) and repeated
+  // presentations are rejected from the cache. user_info is unused and
+  // token_exp is set far in the future; only cache_exp bounds the entry.
+  bool denied = false;
+
+  // The rejection message of a deny-cache entry, replayed verbatim.
+  std::string error;
 };
 
 // A local cache that resides in ESP. The key of the cache is a JWT,
 // and the value is of type JwtValue.
-class JwtCache
-    : public google::service_control_client::SimpleLRUCache<std::string,
-                                                            JwtValue> {
+//
+// The cache is split into shards selected by the hash of the JWT so that
+// concurrent requests with different tokens do not contend on a single LRU
+// mutex. Each shard is bounded by bytes (key plus extracted user info), not
+// by entry count, so many small tokens and few large ones consume the same
+// memory budget. Hit, miss and eviction counters are exported through
+// GetStatistics() for the /endpoints_status handler.
+class JwtCache {
  public:
-  JwtCache();
+  // Uses the default cache size if jwt_cache_size_in_bytes is 0.
+  explicit JwtCache(int64_t jwt_cache_size_in_bytes = 0);
   ~JwtCache();
 
+  // Scoped lookup that pins the entry in its shard for the lifetime of the
+  // lookup, mirroring SimpleLRUCache::ScopedLookup. Counts a hit or a miss.
+  class ScopedLookup {
+   public:
+    ScopedLookup(JwtCache* cache, const std::string& jwt)
+        : lookup_(&cache->shard(jwt), jwt) {
+      // Counters are only summed for /endpoints_status, so relaxed adds
+      // are enough and keep the request path free of fences.
+      if (lookup_.Found()) {
+        cache->hits_.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        cache->misses_.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+    bool Found() const { return lookup_.Found(); }
+    JwtValue* value() const { return lookup_.value(); }
+
+   private:
+    ::google::service_control_client::SimpleLRUCache<
+        std::string, JwtValue>::ScopedLookup lookup_;
+  };
+
   void Insert(const std::string& jwt, const UserInfo& user_info,
               const std::chrono::system_clock::time_point& token_exp,
-              const std::chrono::system_clock::time_point& now);
+              const std::chrono::steady_clock::time_point& now);
+
+  // Inserts a deny-cache entry for a rejected token. Denials live shorter
+  // than positive entries: a signature failure can heal when the issuer
+  // rotates keys.
+  void InsertDenial(const std::string& jwt, const std::string& error,
+                    const std::chrono::steady_clock::time_point& now);
+
+  // Removes an entry, typically after ScopedLookup found it expired.
+  void Remove(const std::string& jwt);
+
+  // Fills in the cache counters accumulated since construction.
+  void GetStatistics(JwtCacheStatistics* stat);
+
+  // Estimated resident bytes: the average accounted entry size times the
+  // number of resident entries. Used for global cache budget accounting.
+  int64_t EstimatedBytes();
+
+  // Drops roughly the given fraction (0, 1] of the cache by clearing
+  // whole shards, starting after the last shard shed so repeated calls
+  // rotate through the cache instead of always hitting the same tokens.
+  void ShedFraction(double fraction);
+
+  // This method returns number of entries stored in cache. Note that this
+  // method is only used in testing.
+  int NumberOfEntries();
+
+ private:
+  typedef ::google::service_control_client::SimpleLRUCache<std::string,
+                                                           JwtValue>
+      CacheShard;
+
+  // Returns the shard owning jwt.
+  CacheShard& shard(const std::string& jwt);
+
+  // The shards. Each one has its own LRU list and mutex.
+  std::vector<std::unique_ptr<CacheShard>> shards_;
+
+  std::hash<std::string> hasher_;
+
+  // Cache counters. Evictions are derived in GetStatistics() as
+  // inserts - removes - resident entries; every inserted entry is either
+  // still resident, explicitly removed, or evicted by its shard.
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+  std::atomic<uint64_t> inserts_;
+  std::atomic<uint64_t> removes_;
+
+  // Total accounted units ever inserted; divided by inserts_ for the
+  // average entry size behind EstimatedBytes().
+  std::atomic<uint64_t> inserted_units_;
+
+  // The shard after the last one cleared by ShedFraction().
+  size_t shed_cursor_;
 };
 
 }  // namespace auth
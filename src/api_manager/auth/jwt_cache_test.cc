@@ -18,6 +18,7 @@
 #include <memory>
 #include "gtest/gtest.h"
 
+using std::chrono::steady_clock;
 using std::chrono::system_clock;
 
 namespace google {
@@ -42,6 +43,17 @@ const char kJwt[] =
     "bUHfbHmhiIOOAeEKFuIVUAwM17j54M6VQ5jnAabY5O-ermLfwPiXvNt2L2SA==";
 const int kJwtCacheTimeout = 300;
 
+UserInfo CreateUserInfo() {
+  UserInfo user_info;
+  user_info.id = kId;
+  user_info.email = kEmail;
+  user_info.consumer_id = kConsumer;
+  user_info.issuer = kIssuer;
+  user_info.audiences.insert("aud1");
+  user_info.audiences.insert("aud2");
+  return user_info;
+}
+
 class TestJwtCache : public ::testing::Test {
  public:
   virtual void SetUp() { cache_.reset(new JwtCache()); }
@@ -51,40 +63,42 @@ class TestJwtCache : public ::testing::Test {
 
 // Test the Insert function in JwtCache class.
 void InsertAndLookupImpl(JwtCache *cache, bool token_exp_earlier) {
-  ASSERT_EQ(nullptr, cache->Lookup(kJwt));
+  {
+    JwtCache::ScopedLookup lookup(cache, kJwt);
+    ASSERT_FALSE(lookup.Found());
+  }
 
-  UserInfo user_info;
-  user_info.id = kId;
-  user_info.email = kEmail;
-  user_info.consumer_id = kConsumer;
-  user_info.issuer = kIssuer;
-  user_info.audiences.insert("aud1");
-  user_info.audiences.insert("aud2");
-  system_clock::time_point now = system_clock::now();
+  UserInfo user_info = CreateUserInfo();
+  steady_clock::time_point now = steady_clock::now();
+  system_clock::time_point wall_now = system_clock::now();
 
   system_clock::time_point token_exp;
   if (token_exp_earlier) {
-    token_exp = now + std::chrono::seconds(kJwtCacheTimeout - 1);
+    token_exp = wall_now + std::chrono::seconds(kJwtCacheTimeout - 1);
   } else {
-    token_exp = now + std::chrono::seconds(kJwtCacheTimeout + 1);
+    token_exp = wall_now + std::chrono::seconds(kJwtCacheTimeout + 1);
   }
   cache->Insert(kJwt, user_info, token_exp, now);
-  JwtValue *val = cache->Lookup(kJwt);
-  ASSERT_NE(nullptr, val);
-  ASSERT_EQ(val->user_info.id, kId);
-  ASSERT_EQ(val->user_info.email, kEmail);
-  ASSERT_EQ(val->user_info.consumer_id, kConsumer);
-  ASSERT_EQ(val->user_info.issuer, kIssuer);
-  ASSERT_EQ(val->user_info.AudiencesAsString(), "aud1,aud2");
-  if (token_exp_earlier) {
-    ASSERT_EQ(val->exp, token_exp);
-  } else {
-    ASSERT_EQ(val->exp, now + std::chrono::seconds(kJwtCacheTimeout));
+  {
+    JwtCache::ScopedLookup lookup(cache, kJwt);
+    ASSERT_TRUE(lookup.Found());
+    JwtValue *val = lookup.value();
+    ASSERT_EQ(val->user_info.id, kId);
+    ASSERT_EQ(val->user_info.email, kEmail);
+    ASSERT_EQ(val->user_info.consumer_id, kConsumer);
+    ASSERT_EQ(val->user_info.issuer, kIssuer);
+    ASSERT_EQ(val->user_info.AudiencesAsString(), "aud1,aud2");
+    // The entry TTL and the token's own expiration are kept separately:
+    // the TTL on the steady clock, the "exp" claim on the wall clock.
+    ASSERT_EQ(val->cache_exp, now + std::chrono::seconds(kJwtCacheTimeout));
+    ASSERT_EQ(val->token_exp, token_exp);
   }
 
-  cache->Release(kJwt, val);
   cache->Remove(kJwt);
-  ASSERT_EQ(nullptr, cache->Lookup(kJwt));
+  {
+    JwtCache::ScopedLookup lookup(cache, kJwt);
+    ASSERT_FALSE(lookup.Found());
+  }
 }
 
 TEST_F(TestJwtCache, InsertAndLookUp) {
@@ -95,6 +109,71 @@ TEST_F(TestJwtCache, InsertAndLookUp) {
   InsertAndLookupImpl(cache_.get(), false);
 }
 
+TEST_F(TestJwtCache, InsertDenialAndLookup) {
+  steady_clock::time_point now = steady_clock::now();
+  cache_->InsertDenial(kJwt, "TIME_CONSTRAINT_FAILURE", now);
+  {
+    JwtCache::ScopedLookup lookup(cache_.get(), kJwt);
+    ASSERT_TRUE(lookup.Found());
+    JwtValue *val = lookup.value();
+    ASSERT_TRUE(val->denied);
+    ASSERT_EQ(val->error, "TIME_CONSTRAINT_FAILURE");
+    // Denials expire sooner than positive entries and never on token_exp.
+    ASSERT_LT(val->cache_exp, now + std::chrono::seconds(kJwtCacheTimeout));
+    ASSERT_EQ(val->token_exp, system_clock::time_point::max());
+  }
+
+  // A positive insert for the same token replaces the denial.
+  cache_->Insert(kJwt, CreateUserInfo(),
+                 system_clock::now() + std::chrono::seconds(kJwtCacheTimeout),
+                 now);
+  {
+    JwtCache::ScopedLookup lookup(cache_.get(), kJwt);
+    ASSERT_TRUE(lookup.Found());
+    ASSERT_FALSE(lookup.value()->denied);
+  }
+}
+
+TEST_F(TestJwtCache, HitAndMissStatistics) {
+  steady_clock::time_point now = steady_clock::now();
+  cache_->Insert(kJwt, CreateUserInfo(),
+                 system_clock::now() + std::chrono::seconds(kJwtCacheTimeout),
+                 now);
+
+  { JwtCache::ScopedLookup lookup(cache_.get(), kJwt); }
+  { JwtCache::ScopedLookup lookup(cache_.get(), kJwt); }
+  { JwtCache::ScopedLookup lookup(cache_.get(), "no-such-token"); }
+
+  JwtCacheStatistics stat;
+  cache_->GetStatistics(&stat);
+  ASSERT_EQ(2, stat.hits);
+  ASSERT_EQ(1, stat.misses);
+  ASSERT_EQ(0, stat.evictions);
+}
+
+TEST_F(TestJwtCache, EvictionUnderByteBudget) {
+  // A small byte budget so inserting many ~1KB tokens must evict.
+  const int kCacheSizeInBytes = 16 * 1024;
+  const int kTokens = 100;
+  JwtCache cache(kCacheSizeInBytes);
+
+  UserInfo user_info = CreateUserInfo();
+  steady_clock::time_point now = steady_clock::now();
+  for (int i = 0; i < kTokens; ++i) {
+    std::string jwt =
+        std::string(800, static_cast<char>('a' + i % 26)) + std::to_string(i);
+    cache.Insert(jwt, user_info,
+                 system_clock::now() + std::chrono::seconds(kJwtCacheTimeout),
+                 now);
+  }
+
+  ASSERT_LT(cache.NumberOfEntries(), kTokens);
+
+  JwtCacheStatistics stat;
+  cache.GetStatistics(&stat);
+  ASSERT_EQ(kTokens - cache.NumberOfEntries(), stat.evictions);
+}
+
 }  // namespace
 
 }  // namespace auth
@@ -0,0 +1,116 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/auth/jwt_verify_pool.h"
+
+namespace google {
+namespace api_manager {
+namespace auth {
+
+namespace {
+// How often completed verifications are drained back onto the event loop.
+// Unlike report flushes, verification sits on the request path, so the
+// interval bounds the latency the offload adds to a request's auth.
+const int kDrainIntervalMs = 1;
+// The number of verification threads. Verification is pure CPU, so two
+// threads absorb bursts without oversubscribing a worker's core.
+const int kNumVerifyThreads = 2;
+}  // namespace
+
+JwtVerifyPool::JwtVerifyPool(ApiManagerEnvInterface* env)
+    : env_(env), shutdown_(false) {}
+
+JwtVerifyPool::~JwtVerifyPool() {
+  if (drain_timer_) {
+    drain_timer_->Stop();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  cond_.notify_all();
+  for (auto& thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+  // Complete whatever is still queued so no continuation is dropped at
+  // shutdown. The destructor runs on the worker thread, where completing
+  // them is safe; the pool threads are gone so the queues need no lock.
+  while (!pending_.empty()) {
+    Job job = std::move(pending_.front());
+    pending_.pop_front();
+    job.status = job.verify();
+    done_.push_back(std::move(job));
+  }
+  DrainCompletedJobs();
+}
+
+void JwtVerifyPool::Init() {
+  if (!threads_.empty()) {
+    return;
+  }
+  for (int i = 0; i < kNumVerifyThreads; ++i) {
+    threads_.emplace_back(&JwtVerifyPool::ThreadLoop, this);
+  }
+  drain_timer_ =
+      env_->StartPeriodicTimer(std::chrono::milliseconds(kDrainIntervalMs),
+                               [this]() { DrainCompletedJobs(); });
+}
+
+void JwtVerifyPool::Dispatch(std::function<utils::Status()> verify,
+                             std::function<void(utils::Status)> on_done) {
+  Job job;
+  job.verify = std::move(verify);
+  job.on_done = std::move(on_done);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(std::move(job));
+  }
+  cond_.notify_one();
+}
+
+void JwtVerifyPool::ThreadLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!shutdown_) {
+    if (pending_.empty()) {
+      cond_.wait(lock);
+      continue;
+    }
+    Job job = std::move(pending_.front());
+    pending_.pop_front();
+    lock.unlock();
+    job.status = job.verify();
+    lock.lock();
+    done_.push_back(std::move(job));
+  }
+}
+
+void JwtVerifyPool::DrainCompletedJobs() {
+  std::deque<Job> done;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done.swap(done_);
+  }
+  while (!done.empty()) {
+    done.front().on_done(done.front().status);
+    done.pop_front();
+  }
+}
+
+}  // namespace auth
+}  // namespace api_manager
+}  // namespace google
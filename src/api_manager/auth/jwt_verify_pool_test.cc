@@ -0,0 +1,66 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/auth/jwt_verify_pool.h"
+
+#include "gtest/gtest.h"
+#include "src/api_manager/mock_api_manager_environment.h"
+
+using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::Code;
+using ::testing::NiceMock;
+
+namespace google {
+namespace api_manager {
+namespace auth {
+namespace {
+
+// Every dispatched job is completed with its verification result, at the
+// latest when the pool is destroyed; the destructor joins the pool threads
+// and drains whatever is still queued.
+TEST(JwtVerifyPoolTest, CompletesDispatchedJobs) {
+  NiceMock<MockApiManagerEnvironment> env;
+
+  int done_calls = 0;
+  Status ok_status = Status::OK;
+  Status failed_status = Status::OK;
+  {
+    JwtVerifyPool pool(&env);
+    pool.Init();
+    // Init is idempotent; a second call must not spawn more threads.
+    pool.Init();
+    pool.Dispatch([]() { return Status::OK; },
+                  [&ok_status, &done_calls](Status status) {
+                    ok_status = status;
+                    ++done_calls;
+                  });
+    pool.Dispatch(
+        []() { return Status(Code::UNAUTHENTICATED, "Invalid signature"); },
+        [&failed_status, &done_calls](Status status) {
+          failed_status = status;
+          ++done_calls;
+        });
+  }
+
+  ASSERT_EQ(2, done_calls);
+  ASSERT_TRUE(ok_status.ok());
+  ASSERT_EQ(Code::UNAUTHENTICATED, failed_status.code());
+}
+
+}  // namespace
+}  // namespace auth
+}  // namespace api_manager
+}  // namespace google
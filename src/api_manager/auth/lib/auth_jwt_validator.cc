@@ -62,13 +62,17 @@ extern "C" {
 
 #include "grpc_internals.h"
 
+#include <openssl/curve25519.h>
 #include <openssl/ec.h>
 #include <openssl/hmac.h>
 #include <openssl/pem.h>
 #include <cstring>
+#include <mutex>
 #include <set>
 #include <string>
+#include <vector>
 
+#include "src/api_manager/auth/lib/claims_scanner.h"
 #include "src/api_manager/auth/lib/json_util.h"
 
 using ::google::protobuf::util::error::Code;
@@ -85,12 +89,69 @@ struct JoseHeader {
   const char *kid;
 };
 
+// The key type of a PreparedKey record.
+enum PreparedKeyType { kKeyTypeRSA, kKeyTypeEC, kKeyTypeOKP, kKeyTypeX509 };
+
+// One verification key, parsed into a compact binary record. Only the
+// raw material is extracted when the key document is parsed; the OpenSSL
+// key object is constructed the first time a token selects the kid and
+// cached. Token kids concentrate on the issuer's active key, so most
+// keys of a large JWKS document are never constructed at all.
+struct PreparedKey {
+  std::string kid;
+  PreparedKeyType type;
+  // Decoded binary key material: the modulus and public exponent for RSA
+  // keys, the curve point coordinates for EC P-256 keys, the raw public
+  // key for Ed25519 keys (material2 unused) and the PEM certificate for
+  // x509 keys (material2 unused).
+  std::string material;
+  std::string material2;
+  // Lazily constructed key objects, owned. Ed25519 signatures are
+  // verified against the raw material directly.
+  EVP_PKEY *pkey = nullptr;  // RSA and x509 keys.
+  EC_KEY *eck = nullptr;     // EC keys.
+  // Set when construction failed, so a bad key is not re-tried on every
+  // token that names it.
+  bool construction_failed = false;
+};
+
+// An implementation of JwtPublicKeys: the usable keys of one key document.
+// The key records are immutable after Create; the cached key objects are
+// filled in lazily under construction_mu_, since verification pool
+// threads can race on the same kid.
+class JwtPublicKeysImpl : public JwtPublicKeys {
+ public:
+  ~JwtPublicKeysImpl() {
+    for (const PreparedKey &key : keys_) {
+      if (key.pkey != nullptr) {
+        EVP_PKEY_free(key.pkey);
+      }
+      if (key.eck != nullptr) {
+        EC_KEY_free(key.eck);
+      }
+    }
+  }
+
+  // Return the cached EVP_PKEY (RSA and x509 keys) or EC_KEY (EC keys)
+  // for key, constructing it from the raw material on first use.
+  // Returns nullptr when the material does not yield a usable key. The
+  // returned object stays valid until the key set is destroyed.
+  EVP_PKEY *GetPkey(PreparedKey *key);
+  EC_KEY *GetEck(PreparedKey *key);
+
+  std::vector<PreparedKey> keys_;
+
+ private:
+  std::mutex construction_mu_;
+};
+
 // An implementation of JwtValidator, hold ALL allocated memory data.
 class JwtValidatorImpl : public JwtValidator {
  public:
   JwtValidatorImpl(const char *jwt, size_t jwt_len);
   Status Parse(UserInfo *user_info);
   Status VerifySignature(const char *pkey, size_t pkey_len);
+  Status VerifySignature(JwtPublicKeys &pkeys);
   system_clock::time_point &GetExpirationTime() { return exp_; }
   ~JwtValidatorImpl();
 
@@ -109,21 +170,24 @@ class JwtValidatorImpl : public JwtValidator {
   Status FindAndVerifySignature();
   // Extracts the public key from x509 string (key) and sets it to pkey_.
   Status ExtractPubkeyFromX509(const char *key);
-  // Extracts the public key from a jwk key (jkey) and sets it to pkey_.
+  // Extracts the public key from a jwk key (jkey) and sets it to the member
+  // matching the key type.
   Status ExtractPubkeyFromJwk(const grpc_json *jkey);
   Status ExtractPubkeyFromJwkRSA(const grpc_json *jkey);
   Status ExtractPubkeyFromJwkEC(const grpc_json *jkey);
+  Status ExtractPubkeyFromJwkOkp(const grpc_json *jkey);
   // Extracts the public key from jwk key set and verifies JWT signature with
   // it.
   Status ExtractAndVerifyJwkKeys(const grpc_json *jwt_keys);
   // Extracts the public key from pkey_json_ and verifies JWT signature with
   // it.
   Status ExtractAndVerifyX509Keys();
-  // Verifies signature with public key.
+  // Verifies signature with the extracted public key.
   Status VerifyPubkey(bool log_error);
-  Status VerifyPubkeyRSA(bool log_error);
-  Status VerifyPubkeyEC(bool log_error);
-  // Verifies asymmetric signature, including RS256/384/512 and ES256.
+  Status VerifyPubkeyRSA(EVP_PKEY *pkey, bool log_error);
+  Status VerifyPubkeyEC(EC_KEY *eck, bool log_error);
+  Status VerifyPubkeyEdDSA(const std::string &okp, bool log_error);
+  // Verifies asymmetric signature, including RS256/384/512, ES256 and EdDSA.
   Status VerifyAsymSignature(const char *pkey, size_t pkey_len);
   // Verifies HS (symmetric) signature.
   Status VerifyHsSignature(const char *pkey, size_t pkey_len);
@@ -139,18 +203,23 @@ class JwtValidatorImpl : public JwtValidator {
   grpc_slice sig_buffer_;
   grpc_slice signed_buffer_;
 
+  // Set when the claims were extracted by the single-pass scanner instead
+  // of the grpc_json tree parser; scanned_ then holds views into
+  // claims_buffer_ and claims_ stays nullptr.
+  bool claims_scanned_;
+  ScannedClaims scanned_;
+  grpc_slice claims_buffer_;
+
   std::set<std::string> audiences_;
   system_clock::time_point exp_;
 
   grpc_json *pkey_json_;
   grpc_slice pkey_buffer_;
-  BIO *bio_;
-  X509 *x509_;
-  RSA *rsa_;
   EVP_PKEY *pkey_;
   EVP_MD_CTX *md_ctx_;
   EC_KEY *eck_;
   ECDSA_SIG *ecdsa_sig_;
+  std::string okp_key_;
 };
 
 // Gets EVP_MD mapped from an alg (algorithm string).
@@ -165,9 +234,27 @@ Status DecodeBase64AndParseJson(const char *str, size_t len, grpc_slice *buffer,
                                 grpc_json **output_json);
 
 // Gets BIGNUM from b64 string, used for extracting pkey from jwk.
-// Result owned by rsa_.
+// Result owned by the caller.
 BIGNUM *BigNumFromBase64String(const char *b64);
 
+// Key extraction helpers, shared by the per-request validator and
+// JwtPublicKeys::Create. Each returns the extracted key, owned by the
+// caller, or nullptr (an empty string for OkpFromJwk) on failure.
+EVP_PKEY *PubkeyFromX509(const char *key);
+EVP_PKEY *PubkeyFromJwkRSA(const grpc_json *jkey);
+EC_KEY *EckFromJwkEC(const grpc_json *jkey);
+std::string OkpFromJwk(const grpc_json *jkey);
+
+// Decodes url-safe base64 into raw bytes. Returns an empty string on
+// failure.
+std::string DecodeBase64Bin(const char *b64);
+
+// Lazy construction counterparts, building key objects from the decoded
+// material of a PreparedKey. Results owned by the caller, nullptr on
+// failure.
+EVP_PKEY *PkeyFromRsaMaterial(const std::string &n, const std::string &e);
+EC_KEY *EckFromEcMaterial(const std::string &x, const std::string &y);
+
 // Two helper functions to generate Status
 Status ToStatus(const std::string &error_msg) {
   return Status(Code::UNAUTHENTICATED, error_msg);
@@ -185,6 +272,131 @@ std::unique_ptr<JwtValidator> JwtValidator::Create(const char *jwt,
   return std::unique_ptr<JwtValidator>(new JwtValidatorImpl(jwt, jwt_len));
 }
 
+std::shared_ptr<JwtPublicKeys> JwtPublicKeys::Create(const char *pkey,
+                                                     size_t pkey_len) {
+  if (pkey == nullptr || pkey_len == 0) {
+    return nullptr;
+  }
+  grpc_slice buffer = grpc_slice_from_copied_buffer(pkey, pkey_len);
+  if (GRPC_SLICE_IS_EMPTY(buffer)) {
+    return nullptr;
+  }
+  grpc_json *json = grpc_json_parse_string_with_len(
+      reinterpret_cast<char *>(GRPC_SLICE_START_PTR(buffer)),
+      GRPC_SLICE_LENGTH(buffer));
+  if (json == nullptr) {
+    grpc_slice_unref(buffer);
+    return nullptr;
+  }
+
+  std::shared_ptr<JwtPublicKeysImpl> keys(new JwtPublicKeysImpl);
+  const grpc_json *jwk_keys = GetProperty(json, "keys");
+  if (jwk_keys == nullptr) {
+    // x509 format: the property name is the kid, the value a PEM cert.
+    for (const grpc_json *cur = json->child; cur != nullptr; cur = cur->next) {
+      if (cur->type != GRPC_JSON_STRING || cur->key == nullptr ||
+          cur->value == nullptr) {
+        continue;
+      }
+      // The PEM certificate is kept as-is; parsing it is deferred to the
+      // first token that names the kid.
+      PreparedKey key;
+      key.kid = cur->key;
+      key.type = kKeyTypeX509;
+      key.material = cur->value;
+      keys->keys_.push_back(key);
+    }
+  } else if (jwk_keys->type == GRPC_JSON_ARRAY) {
+    // JWK format from https://tools.ietf.org/html/rfc7518#section-6.
+    for (const grpc_json *jkey = jwk_keys->child; jkey != nullptr;
+         jkey = jkey->next) {
+      if (jkey->type != GRPC_JSON_OBJECT) continue;
+      const char *kid = GetStringValue(jkey, "kid");
+      const char *kty = GetStringValue(jkey, "kty");
+      // JWK keys without a kid are never matched against a token, so there
+      // is no point in preparing them.
+      if (kid == nullptr || kty == nullptr) {
+        continue;
+      }
+      PreparedKey key;
+      key.kid = kid;
+      if (strncmp(kty, "RSA", 3) == 0) {
+        key.type = kKeyTypeRSA;
+        key.material = DecodeBase64Bin(GetStringValue(jkey, "n"));
+        key.material2 = DecodeBase64Bin(GetStringValue(jkey, "e"));
+        if (key.material.empty() || key.material2.empty()) continue;
+      } else if (strncmp(kty, "EC", 2) == 0) {
+        key.type = kKeyTypeEC;
+        key.material = DecodeBase64Bin(GetStringValue(jkey, "x"));
+        key.material2 = DecodeBase64Bin(GetStringValue(jkey, "y"));
+        if (key.material.empty() || key.material2.empty()) continue;
+      } else if (strncmp(kty, "OKP", 3) == 0) {
+        key.type = kKeyTypeOKP;
+        key.material = OkpFromJwk(jkey);
+        if (key.material.empty()) continue;
+      } else {
+        gpr_log(GPR_ERROR, "Unsupported key type %s.", kty);
+        continue;
+      }
+      keys->keys_.push_back(key);
+    }
+  }
+  grpc_json_destroy(json);
+  grpc_slice_unref(buffer);
+
+  if (keys->keys_.empty()) {
+    return nullptr;
+  }
+  return keys;
+}
+
+Status JwtPreCheck(const char *jwt, size_t jwt_len) {
+  if (jwt == nullptr || jwt_len == 0) {
+    return ToStatus("Bad JWT format: empty token");
+  }
+  const char *end = jwt + jwt_len;
+  const char *dot1 = static_cast<const char *>(memchr(jwt, '.', jwt_len));
+  if (dot1 == nullptr) {
+    return ToStatus("Bad JWT format: should have 2 dots");
+  }
+  const char *payload = dot1 + 1;
+  const char *dot2 =
+      static_cast<const char *>(memchr(payload, '.', end - payload));
+  if (dot2 == nullptr) {
+    return ToStatus("Bad JWT format: should have 2 dots");
+  }
+  if (dot1 == jwt || dot2 == payload || dot2 + 1 == end ||
+      memchr(dot2 + 1, '.', end - dot2 - 1) != nullptr) {
+    return ToStatus("Bad JWT format: empty or extra segments");
+  }
+
+  grpc_slice payload_buffer =
+      esp_base64url_decode_with_len(payload, dot2 - payload);
+  if (GRPC_SLICE_IS_EMPTY(payload_buffer)) {
+    return ToStatus("Bad JWT format: Invalid base64 in claims");
+  }
+  ScannedClaims claims;
+  absl::string_view payload_view(
+      reinterpret_cast<const char *>(GRPC_SLICE_START_PTR(payload_buffer)),
+      GRPC_SLICE_LENGTH(payload_buffer));
+  Status status = Status::OK;
+  if (ScanJwtClaims(payload_view, &claims)) {
+    // Same issuer and timestamp checks the full parser applies.
+    const int64_t now = gpr_now(GPR_CLOCK_REALTIME).tv_sec;
+    const int64_t skew = grpc_jwt_verifier_clock_skew.tv_sec;
+    if (claims.iss.data() == nullptr) {
+      status = ToStatus(
+          "Bad JWT format: invalid JWT claims; issuer is mssing but "
+          "required.");
+    } else if ((claims.has_nbf && now + skew < claims.nbf) ||
+               (claims.has_exp && now - skew > claims.exp)) {
+      status = ToStatus(GRPC_JWT_VERIFIER_TIME_CONSTRAINT_FAILURE);
+    }
+  }
+  grpc_slice_unref(payload_buffer);
+  return status;
+}
+
 namespace {
 JwtValidatorImpl::JwtValidatorImpl(const char *jwt, size_t jwt_len)
     : jwt(jwt),
@@ -192,10 +404,8 @@ JwtValidatorImpl::JwtValidatorImpl(const char *jwt, size_t jwt_len)
       header_(nullptr),
       header_json_(nullptr),
       claims_(nullptr),
+      claims_scanned_(false),
       pkey_json_(nullptr),
-      bio_(nullptr),
-      x509_(nullptr),
-      rsa_(nullptr),
       pkey_(nullptr),
       md_ctx_(nullptr),
       eck_(nullptr),
@@ -204,6 +414,7 @@ JwtValidatorImpl::JwtValidatorImpl(const char *jwt, size_t jwt_len)
   signed_buffer_ = grpc_empty_slice();
   sig_buffer_ = grpc_empty_slice();
   pkey_buffer_ = grpc_empty_slice();
+  claims_buffer_ = grpc_empty_slice();
 }
 
 // Makes sure all data are cleaned up, both success and failure case.
@@ -232,14 +443,8 @@ JwtValidatorImpl::~JwtValidatorImpl() {
   if (!GRPC_SLICE_IS_EMPTY(pkey_buffer_)) {
     grpc_slice_unref(pkey_buffer_);
   }
-  if (bio_ != nullptr) {
-    BIO_free(bio_);
-  }
-  if (x509_ != nullptr) {
-    X509_free(x509_);
-  }
-  if (rsa_ != nullptr) {
-    RSA_free(rsa_);
+  if (!GRPC_SLICE_IS_EMPTY(claims_buffer_)) {
+    grpc_slice_unref(claims_buffer_);
   }
   if (pkey_ != nullptr) {
     EVP_PKEY_free(pkey_);
@@ -339,46 +544,82 @@ Status JwtValidatorImpl::ParseImpl() {
     return ToStatus("Bad JWT format: should have 2 dots");
   }
 
-  // claim_buffer is the only exception that requires deallocation for failure
-  // case, and it is owned by claims_ for successful case.
-  grpc_slice claims_buffer = grpc_empty_slice();
-  grpc_json *claims_json;
-  status = DecodeBase64AndParseJson(cur, dot - cur, &claims_buffer, "claims",
-                                    &claims_json);
-  if (!status.ok()) {
-    if (!GRPC_SLICE_IS_EMPTY(claims_buffer)) {
+  grpc_slice claims_buffer = esp_base64url_decode_with_len(cur, dot - cur);
+  if (GRPC_SLICE_IS_EMPTY(claims_buffer)) {
+    gpr_log(GPR_ERROR, "Invalid base64.");
+    return ToStatus("Bad JWT format: Invalid base64 in claims");
+  }
+
+  // Fast path: pull only the claims ESP uses out of the decoded payload in
+  // a single pass, skipping the grpc_json tree build. The scanner bails
+  // out on JSON constructs it does not handle, in which case the payload
+  // goes through the tree parser as before.
+  absl::string_view payload(
+      reinterpret_cast<const char *>(GRPC_SLICE_START_PTR(claims_buffer)),
+      GRPC_SLICE_LENGTH(claims_buffer));
+  if (ScanJwtClaims(payload, &scanned_)) {
+    // The scanned views point into claims_buffer; keep it alive.
+    claims_scanned_ = true;
+    claims_buffer_ = claims_buffer;
+
+    // issuer is mandatory.
+    if (scanned_.iss.data() == nullptr) {
+      return ToStatus(
+          "Bad JWT format: invalid JWT claims; issuer is mssing but required.");
+    }
+    for (const absl::string_view aud : scanned_.aud) {
+      audiences_.insert(std::string(aud));
+    }
+
+    // Check timestamp, mirroring grpc_jwt_claims_check. The audience check
+    // is done by the caller.
+    const int64_t now = gpr_now(GPR_CLOCK_REALTIME).tv_sec;
+    const int64_t skew = grpc_jwt_verifier_clock_skew.tv_sec;
+    if ((scanned_.has_nbf && now + skew < scanned_.nbf) ||
+        (scanned_.has_exp && now - skew > scanned_.exp)) {
+      return ToStatus(GRPC_JWT_VERIFIER_TIME_CONSTRAINT_FAILURE);
+    }
+  } else {
+    // claims_buffer is the only exception that requires deallocation for
+    // failure case, and it is owned by claims_ for successful case.
+    grpc_json *claims_json = grpc_json_parse_string_with_len(
+        reinterpret_cast<char *>(GRPC_SLICE_START_PTR(claims_buffer)),
+        GRPC_SLICE_LENGTH(claims_buffer));
+    if (claims_json == nullptr) {
+      gpr_log(GPR_ERROR, "JSON parsing error.");
       grpc_slice_unref(claims_buffer);
+      return ToStatus("Bad JWT format: Invalid JSON in claims");
     }
-    return status;
-  }
 
-  UpdateAudience(claims_json);
+    UpdateAudience(claims_json);
 
-  // Takes ownershp of claims_json and claims_buffer.
-  claims_ = grpc_jwt_claims_from_json(claims_json, claims_buffer);
+    // Takes ownershp of claims_json and claims_buffer.
+    claims_ = grpc_jwt_claims_from_json(claims_json, claims_buffer);
 
-  if (claims_ == nullptr) {
-    gpr_log(GPR_ERROR,
-            "JWT claims could not be created."
-            " Incompatible value types for some claim(s)");
-    return ToStatus(
-        "Bad JWT format: invalid JWT claims; e.g. wrong data type, iss is not "
-        "a string.");
-  }
+    if (claims_ == nullptr) {
+      gpr_log(GPR_ERROR,
+              "JWT claims could not be created."
+              " Incompatible value types for some claim(s)");
+      return ToStatus(
+          "Bad JWT format: invalid JWT claims; e.g. wrong data type, iss is "
+          "not a string.");
+    }
 
-  // issuer is mandatory. grpc_jwt_claims_issuer checks if claims_ is nullptr.
-  if (grpc_jwt_claims_issuer(claims_) == nullptr) {
-    return ToStatus(
-        "Bad JWT format: invalid JWT claims; issuer is mssing but required.");
-  }
+    // issuer is mandatory. grpc_jwt_claims_issuer checks if claims_ is
+    // nullptr.
+    if (grpc_jwt_claims_issuer(claims_) == nullptr) {
+      return ToStatus(
+          "Bad JWT format: invalid JWT claims; issuer is mssing but required.");
+    }
 
-  // Check timestamp.
-  // Passing in its own audience to skip audience check.
-  // Audience check should be done by the caller.
-  grpc_jwt_verifier_status grpc_status =
-      grpc_jwt_claims_check(claims_, grpc_jwt_claims_audience(claims_));
-  if (grpc_status != GRPC_JWT_VERIFIER_OK) {
-    return ToStatus(grpc_status);
+    // Check timestamp.
+    // Passing in its own audience to skip audience check.
+    // Audience check should be done by the caller.
+    grpc_jwt_verifier_status grpc_status =
+        grpc_jwt_claims_check(claims_, grpc_jwt_claims_audience(claims_));
+    if (grpc_status != GRPC_JWT_VERIFIER_OK) {
+      return ToStatus(grpc_status);
+    }
   }
 
   // =============================
@@ -391,7 +632,7 @@ Status JwtValidatorImpl::ParseImpl() {
   }
   cur = dot + 1;
   sig_buffer_ =
-      grpc_base64_decode_with_len(cur, jwt_len - signed_jwt_len - 1, 1);
+      esp_base64url_decode_with_len(cur, jwt_len - signed_jwt_len - 1);
   if (GRPC_SLICE_IS_EMPTY(sig_buffer_)) {
     return ToStatus("Bad JWT format: invalid base64 for signature");
   }
@@ -402,6 +643,12 @@ Status JwtValidatorImpl::ParseImpl() {
     gpr_log(GPR_ERROR, "ES256 signature length is not correct.");
     return ToStatus("Bad JWT format: signature length is not correct");
   }
+  // An Ed25519 signature has a fixed length as well.
+  if (strcmp(header_->alg, "EdDSA") == 0 &&
+      GRPC_SLICE_LENGTH(sig_buffer_) != ED25519_SIGNATURE_LEN) {
+    gpr_log(GPR_ERROR, "EdDSA signature length is not correct.");
+    return ToStatus("Bad JWT format: signature length is not correct");
+  }
 
   return Status::OK;
 }
@@ -422,6 +669,7 @@ Status JwtValidatorImpl::VerifySignatureImpl(const char *pkey,
     return ToStatus("Bad JWT format: JWT signature is empty");
   }
   if (strncmp(header_->alg, "ES256", 5) == 0 ||
+      strcmp(header_->alg, "EdDSA") == 0 ||
       strncmp(header_->alg, "RS", 2) == 0) {  // Asymmetric keys.
     return VerifyAsymSignature(pkey, pkey_len);
   } else {  // Symmetric key.
@@ -429,13 +677,74 @@ Status JwtValidatorImpl::VerifySignatureImpl(const char *pkey,
   }
 }
 
+Status JwtValidatorImpl::VerifySignature(JwtPublicKeys &pkeys) {
+  if (jwt == nullptr || jwt_len <= 0) {
+    return ToStatus("Bad JWT format: JWT is empty");
+  }
+  if (GRPC_SLICE_IS_EMPTY(signed_buffer_) || GRPC_SLICE_IS_EMPTY(sig_buffer_)) {
+    return ToStatus("Bad JWT format: JWT signature is empty");
+  }
+  const bool is_rs = strncmp(header_->alg, "RS", 2) == 0;
+  const bool is_es = strncmp(header_->alg, "ES256", 5) == 0;
+  const bool is_ed = strcmp(header_->alg, "EdDSA") == 0;
+  if (!is_rs && !is_es && !is_ed) {
+    // Only asymmetric keys are prepared ahead of time; an HS token has to
+    // be checked against the raw shared secret.
+    return ToStatus(
+        "Invalid base64 encoded HS symmetric key. "
+        "Most likely JWT alg is HS, but public key is ES or RSA.");
+  }
+
+  JwtPublicKeysImpl &keys = static_cast<JwtPublicKeysImpl &>(pkeys);
+  for (PreparedKey &key : keys.keys_) {
+    if (header_->kid != nullptr && key.kid != header_->kid) {
+      continue;
+    }
+    Status status = Status::OK;
+    if (is_rs && (key.type == kKeyTypeRSA || key.type == kKeyTypeX509)) {
+      EVP_PKEY *pkey = keys.GetPkey(&key);
+      if (pkey == nullptr) continue;
+      status = VerifyPubkeyRSA(pkey, header_->kid != nullptr);
+    } else if (is_es && key.type == kKeyTypeEC) {
+      EC_KEY *eck = keys.GetEck(&key);
+      if (eck == nullptr) continue;
+      status = VerifyPubkeyEC(eck, header_->kid != nullptr);
+    } else if (is_ed && key.type == kKeyTypeOKP) {
+      status = VerifyPubkeyEdDSA(key.material, header_->kid != nullptr);
+    } else {
+      // The key does not match the token algorithm.
+      continue;
+    }
+    if (header_->kid != nullptr) {
+      return status;
+    }
+    // If kid is not specified in the header, try all keys. If the JWT can be
+    // validated with any of the keys, the request is successful.
+    if (status.ok()) {
+      return Status::OK;
+    }
+  }
+
+  if (header_->kid != nullptr) {
+    gpr_log(GPR_ERROR,
+            "Cannot find matching key in key set for kid=%s and alg=%s",
+            header_->kid, header_->alg);
+    return ToStatus(absl::StrCat("Cannot find matching key in key set for kid=",
+                                 header_->kid));
+  }
+  gpr_log(GPR_ERROR,
+          "The JWT cannot be validated with any of the public keys.");
+  return ToStatus("The JWT cannot be validated with any of the public keys.");
+}
+
 Status JwtValidatorImpl::CreateJoseHeader() {
   const char *alg = GetStringValue(header_json_, "alg");
   if (alg == nullptr) {
     gpr_log(GPR_ERROR, "Missing alg field.");
     return ToStatus("Missing alg field.");
   }
-  if (EvpMdFromAlg(alg) == nullptr && strncmp(alg, "ES256", 5) != 0) {
+  if (EvpMdFromAlg(alg) == nullptr && strncmp(alg, "ES256", 5) != 0 &&
+      strcmp(alg, "EdDSA") != 0) {
     gpr_log(GPR_ERROR, "Invalid alg field [%s].", alg);
     return ToStatus("Failed to allocate memory.");
   }
@@ -463,8 +772,9 @@ Status JwtValidatorImpl::FindAndVerifySignature() {
   // JWK set https://tools.ietf.org/html/rfc7517#section-5.
   const grpc_json *jwk_keys = GetProperty(pkey_json_, "keys");
   if (jwk_keys == nullptr) {
-    // Currently we only support JWK format for ES256.
-    if (strncmp(header_->alg, "ES256", 5) == 0) {
+    // Currently we only support JWK format for ES256 and EdDSA.
+    if (strncmp(header_->alg, "ES256", 5) == 0 ||
+        strcmp(header_->alg, "EdDSA") == 0) {
       return ToStatus("Invalid public key: keys field is missing.");
     }
     // Try x509 format.
@@ -521,33 +831,12 @@ Status JwtValidatorImpl::ExtractAndVerifyX509Keys() {
 }
 
 Status JwtValidatorImpl::ExtractPubkeyFromX509(const char *key) {
-  if (bio_ != nullptr) {
-    BIO_free(bio_);
-  }
-  bio_ = BIO_new(BIO_s_mem());
-  if (bio_ == nullptr) {
-    gpr_log(GPR_ERROR, "Unable to allocate a BIO object.");
-    return ToStatus("Unable to allocate a BIO object.");
-  }
-  if (BIO_write(bio_, key, strlen(key)) <= 0) {
-    gpr_log(GPR_ERROR, "BIO write error for key (%s).", key);
-    return ToStatus(absl::StrCat("BIO write error for key", key));
-  }
-  if (x509_ != nullptr) {
-    X509_free(x509_);
-  }
-  x509_ = PEM_read_bio_X509(bio_, nullptr, nullptr, nullptr);
-  if (x509_ == nullptr) {
-    gpr_log(GPR_ERROR, "Unable to parse x509 cert for key (%s).", key);
-    return ToStatus(absl::StrCat("Unable to parse x509 cert for key", key));
-  }
   if (pkey_ != nullptr) {
     EVP_PKEY_free(pkey_);
   }
-  pkey_ = X509_get_pubkey(x509_);
+  pkey_ = PubkeyFromX509(key);
   if (pkey_ == nullptr) {
-    gpr_log(GPR_ERROR, "X509_get_pubkey failed");
-    return ToStatus("X509_get_pubkey failed");
+    return ToStatus("Unable to extract public key from x509 cert.");
   }
   return Status::OK;
 }
@@ -579,7 +868,8 @@ Status JwtValidatorImpl::ExtractAndVerifyJwkKeys(const grpc_json *jwk_keys) {
     if (kty == nullptr ||
         (strncmp(header_->alg, "RS", 2) == 0 && strncmp(kty, "RSA", 3) != 0) ||
         (strncmp(header_->alg, "ES256", 5) == 0 &&
-         strncmp(kty, "EC", 2) != 0)) {
+         strncmp(kty, "EC", 2) != 0) ||
+        (strcmp(header_->alg, "EdDSA") == 0 && strncmp(kty, "OKP", 3) != 0)) {
       gpr_log(GPR_ERROR, "Missing or unsupported key type %s.", kty);
       continue;
     }
@@ -618,38 +908,20 @@ Status JwtValidatorImpl::ExtractPubkeyFromJwk(const grpc_json *jkey) {
     return ExtractPubkeyFromJwkRSA(jkey);
   } else if (strncmp(header_->alg, "ES256", 5) == 0) {
     return ExtractPubkeyFromJwkEC(jkey);
+  } else if (strcmp(header_->alg, "EdDSA") == 0) {
+    return ExtractPubkeyFromJwkOkp(jkey);
   } else {
     return ToStatus(absl::StrCat("Not supported alg ", header_->alg));
   }
 }
 
 Status JwtValidatorImpl::ExtractPubkeyFromJwkRSA(const grpc_json *jkey) {
-  if (rsa_ != nullptr) {
-    RSA_free(rsa_);
-  }
-  rsa_ = RSA_new();
-  if (rsa_ == nullptr) {
-    gpr_log(GPR_ERROR, "Could not create rsa key.");
-    return ToStatus("Could not create rsa key.");
-  }
-
-  const char *rsa_n = GetStringValue(jkey, "n");
-  rsa_->n = rsa_n == nullptr ? nullptr : BigNumFromBase64String(rsa_n);
-  const char *rsa_e = GetStringValue(jkey, "e");
-  rsa_->e = rsa_e == nullptr ? nullptr : BigNumFromBase64String(rsa_e);
-
-  if (rsa_->e == nullptr || rsa_->n == nullptr) {
-    gpr_log(GPR_ERROR, "Missing RSA public key field.");
-    return ToStatus("Missing RSA public key field.");
-  }
-
   if (pkey_ != nullptr) {
     EVP_PKEY_free(pkey_);
   }
-  pkey_ = EVP_PKEY_new();
-  if (EVP_PKEY_set1_RSA(pkey_, rsa_) == 0) {
-    gpr_log(GPR_ERROR, "EVP_PKEY_ste1_RSA failed");
-    return ToStatus("EVP_PKEY_ste1_RSA failed");
+  pkey_ = PubkeyFromJwkRSA(jkey);
+  if (pkey_ == nullptr) {
+    return ToStatus("Unable to extract RSA public key from jwk key.");
   }
   return Status::OK;
 }
@@ -658,32 +930,18 @@ Status JwtValidatorImpl::ExtractPubkeyFromJwkEC(const grpc_json *jkey) {
   if (eck_ != nullptr) {
     EC_KEY_free(eck_);
   }
-  eck_ = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+  eck_ = EckFromJwkEC(jkey);
   if (eck_ == nullptr) {
-    gpr_log(GPR_ERROR, "Could not create ec key.");
-    return ToStatus("Could not create ec key.");
-  }
-  const char *eck_x = GetStringValue(jkey, "x");
-  const char *eck_y = GetStringValue(jkey, "y");
-  if (eck_x == nullptr || eck_y == nullptr) {
-    gpr_log(GPR_ERROR, "Missing EC public key field.");
-    return ToStatus("Missing EC public key field.");
-  }
-  BIGNUM *bn_x = BigNumFromBase64String(eck_x);
-  BIGNUM *bn_y = BigNumFromBase64String(eck_y);
-  if (bn_x == nullptr || bn_y == nullptr) {
-    gpr_log(GPR_ERROR, "Could not generate BIGNUM-type x and y fields.");
-    return ToStatus("Could not generate BIGNUM-type x and y fields.");
+    return ToStatus("Unable to extract EC public key from jwk key.");
   }
+  return Status::OK;
+}
 
-  if (EC_KEY_set_public_key_affine_coordinates(eck_, bn_x, bn_y) == 0) {
-    BN_free(bn_x);
-    BN_free(bn_y);
-    gpr_log(GPR_ERROR, "Could not populate ec key coordinates.");
-    return ToStatus("Could not populate ec key coordinates.");
+Status JwtValidatorImpl::ExtractPubkeyFromJwkOkp(const grpc_json *jkey) {
+  okp_key_ = OkpFromJwk(jkey);
+  if (okp_key_.empty()) {
+    return ToStatus("Unable to extract Ed25519 public key from jwk key.");
   }
-  BN_free(bn_x);
-  BN_free(bn_y);
   return Status::OK;
 }
 
@@ -705,16 +963,18 @@ Status JwtValidatorImpl::VerifyAsymSignature(const char *pkey,
 
 Status JwtValidatorImpl::VerifyPubkey(bool log_error) {
   if (strncmp(header_->alg, "RS", 2) == 0) {
-    return VerifyPubkeyRSA(log_error);
+    return VerifyPubkeyRSA(pkey_, log_error);
   } else if (strncmp(header_->alg, "ES256", 5) == 0) {
-    return VerifyPubkeyEC(log_error);
+    return VerifyPubkeyEC(eck_, log_error);
+  } else if (strcmp(header_->alg, "EdDSA") == 0) {
+    return VerifyPubkeyEdDSA(okp_key_, log_error);
   } else {
     return ToStatus(absl::StrCat("Not supported alg ", header_->alg));
   }
 }
 
-Status JwtValidatorImpl::VerifyPubkeyEC(bool log_error) {
-  if (eck_ == nullptr) {
+Status JwtValidatorImpl::VerifyPubkeyEC(EC_KEY *eck, bool log_error) {
+  if (eck == nullptr) {
     gpr_log(GPR_ERROR, "Cannot find eck.");
     return ToStatus("Cannot find eck.");
   }
@@ -735,7 +995,7 @@ Status JwtValidatorImpl::VerifyPubkeyEC(bool log_error) {
 
   BN_bin2bn(GRPC_SLICE_START_PTR(sig_buffer_), 32, ecdsa_sig_->r);
   BN_bin2bn(GRPC_SLICE_START_PTR(sig_buffer_) + 32, 32, ecdsa_sig_->s);
-  if (ECDSA_do_verify(digest, SHA256_DIGEST_LENGTH, ecdsa_sig_, eck_) == 0) {
+  if (ECDSA_do_verify(digest, SHA256_DIGEST_LENGTH, ecdsa_sig_, eck) == 0) {
     if (log_error) {
       gpr_log(GPR_ERROR, "JWT signature verification failed.");
     }
@@ -745,8 +1005,28 @@ Status JwtValidatorImpl::VerifyPubkeyEC(bool log_error) {
   return Status::OK;
 }
 
-Status JwtValidatorImpl::VerifyPubkeyRSA(bool log_error) {
-  if (pkey_ == nullptr) {
+Status JwtValidatorImpl::VerifyPubkeyEdDSA(const std::string &okp,
+                                           bool log_error) {
+  if (okp.size() != ED25519_PUBLIC_KEY_LEN) {
+    gpr_log(GPR_ERROR, "Cannot find Ed25519 public key.");
+    return ToStatus("Cannot find Ed25519 public key.");
+  }
+  // Signature length was checked during Parse.
+  if (ED25519_verify(GRPC_SLICE_START_PTR(signed_buffer_),
+                     GRPC_SLICE_LENGTH(signed_buffer_),
+                     GRPC_SLICE_START_PTR(sig_buffer_),
+                     reinterpret_cast<const uint8_t *>(okp.data())) == 0) {
+    if (log_error) {
+      gpr_log(GPR_ERROR, "JWT signature verification failed.");
+    }
+    ERR_clear_error();
+    return ToStatus("JWT signature verification failed.");
+  }
+  return Status::OK;
+}
+
+Status JwtValidatorImpl::VerifyPubkeyRSA(EVP_PKEY *pkey, bool log_error) {
+  if (pkey == nullptr) {
     gpr_log(GPR_ERROR, "Cannot find public key.");
     return ToStatus("Cannot find public key.");
   }
@@ -761,7 +1041,7 @@ Status JwtValidatorImpl::VerifyPubkeyRSA(bool log_error) {
   const EVP_MD *md = EvpMdFromAlg(header_->alg);
   GPR_ASSERT(md != nullptr);  // Checked before.
 
-  if (EVP_DigestVerifyInit(md_ctx_, nullptr, md, nullptr, pkey_) != 1) {
+  if (EVP_DigestVerifyInit(md_ctx_, nullptr, md, nullptr, pkey) != 1) {
     gpr_log(GPR_ERROR, "EVP_DigestVerifyInit failed.");
     return ToStatus("EVP_DigestVerifyInit failed.");
   }
@@ -785,7 +1065,7 @@ Status JwtValidatorImpl::VerifyHsSignature(const char *pkey, size_t pkey_len) {
   const EVP_MD *md = EvpMdFromAlg(header_->alg);
   GPR_ASSERT(md != nullptr);  // Checked before.
 
-  pkey_buffer_ = grpc_base64_decode_with_len(pkey, pkey_len, 1);
+  pkey_buffer_ = esp_base64url_decode_with_len(pkey, pkey_len);
   if (GRPC_SLICE_IS_EMPTY(pkey_buffer_)) {
     gpr_log(GPR_ERROR, "Unable to decode base64 of secret");
     return ToStatus(
@@ -813,6 +1093,31 @@ Status JwtValidatorImpl::VerifyHsSignature(const char *pkey, size_t pkey_len) {
 }
 
 Status JwtValidatorImpl::FillUserInfoAndSetExp(UserInfo *user_info) {
+  if (claims_scanned_) {
+    // The issuer was checked during Parse.
+    if (audiences_.empty()) {
+      gpr_log(GPR_ERROR, "Missing audience field.");
+      return ToStatus("Bad JWT format: missing audience field.");
+    }
+    if (scanned_.sub.data() != nullptr) {
+      user_info->id = std::string(scanned_.sub);
+    }
+    user_info->issuer = std::string(scanned_.iss);
+    user_info->audiences = audiences_;
+    // The decoded payload is the claims JSON; no need to re-serialize it.
+    user_info->claims = std::string(
+        reinterpret_cast<const char *>(GRPC_SLICE_START_PTR(claims_buffer_)),
+        GRPC_SLICE_LENGTH(claims_buffer_));
+    user_info->email =
+        scanned_.email.data() == nullptr ? "" : std::string(scanned_.email);
+    user_info->authorized_party =
+        scanned_.azp.data() == nullptr ? "" : std::string(scanned_.azp);
+    exp_ = scanned_.has_exp
+               ? system_clock::from_time_t(static_cast<time_t>(scanned_.exp))
+               : system_clock::time_point::max();
+    return Status::OK;
+  }
+
   // Required fields.
   const char *issuer = grpc_jwt_claims_issuer(claims_);
   if (issuer == nullptr) {
@@ -881,7 +1186,7 @@ Status DecodeBase64AndParseJson(const char *str, size_t len, grpc_slice *buffer,
   grpc_json *json;
   *output_json = nullptr;
 
-  *buffer = grpc_base64_decode_with_len(str, len, 1);
+  *buffer = esp_base64url_decode_with_len(str, len);
   if (GRPC_SLICE_IS_EMPTY(*buffer)) {
     gpr_log(GPR_ERROR, "Invalid base64.");
     return ToStatus(
@@ -915,6 +1220,210 @@ BIGNUM *BigNumFromBase64String(const char *b64) {
   return result;
 }
 
+EVP_PKEY *PubkeyFromX509(const char *key) {
+  BIO *bio = BIO_new(BIO_s_mem());
+  if (bio == nullptr) {
+    gpr_log(GPR_ERROR, "Unable to allocate a BIO object.");
+    return nullptr;
+  }
+  if (BIO_write(bio, key, strlen(key)) <= 0) {
+    gpr_log(GPR_ERROR, "BIO write error for key (%s).", key);
+    BIO_free(bio);
+    return nullptr;
+  }
+  X509 *x509 = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
+  BIO_free(bio);
+  if (x509 == nullptr) {
+    gpr_log(GPR_ERROR, "Unable to parse x509 cert for key (%s).", key);
+    return nullptr;
+  }
+  EVP_PKEY *pkey = X509_get_pubkey(x509);
+  X509_free(x509);
+  if (pkey == nullptr) {
+    gpr_log(GPR_ERROR, "X509_get_pubkey failed");
+  }
+  return pkey;
+}
+
+EVP_PKEY *PubkeyFromJwkRSA(const grpc_json *jkey) {
+  RSA *rsa = RSA_new();
+  if (rsa == nullptr) {
+    gpr_log(GPR_ERROR, "Could not create rsa key.");
+    return nullptr;
+  }
+
+  const char *rsa_n = GetStringValue(jkey, "n");
+  rsa->n = rsa_n == nullptr ? nullptr : BigNumFromBase64String(rsa_n);
+  const char *rsa_e = GetStringValue(jkey, "e");
+  rsa->e = rsa_e == nullptr ? nullptr : BigNumFromBase64String(rsa_e);
+
+  if (rsa->e == nullptr || rsa->n == nullptr) {
+    gpr_log(GPR_ERROR, "Missing RSA public key field.");
+    RSA_free(rsa);
+    return nullptr;
+  }
+
+  EVP_PKEY *pkey = EVP_PKEY_new();
+  if (EVP_PKEY_set1_RSA(pkey, rsa) == 0) {
+    gpr_log(GPR_ERROR, "EVP_PKEY_ste1_RSA failed");
+    EVP_PKEY_free(pkey);
+    RSA_free(rsa);
+    return nullptr;
+  }
+  RSA_free(rsa);
+  return pkey;
+}
+
+EC_KEY *EckFromJwkEC(const grpc_json *jkey) {
+  EC_KEY *eck = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+  if (eck == nullptr) {
+    gpr_log(GPR_ERROR, "Could not create ec key.");
+    return nullptr;
+  }
+  const char *eck_x = GetStringValue(jkey, "x");
+  const char *eck_y = GetStringValue(jkey, "y");
+  if (eck_x == nullptr || eck_y == nullptr) {
+    gpr_log(GPR_ERROR, "Missing EC public key field.");
+    EC_KEY_free(eck);
+    return nullptr;
+  }
+  BIGNUM *bn_x = BigNumFromBase64String(eck_x);
+  BIGNUM *bn_y = BigNumFromBase64String(eck_y);
+  if (bn_x == nullptr || bn_y == nullptr) {
+    gpr_log(GPR_ERROR, "Could not generate BIGNUM-type x and y fields.");
+    if (bn_x != nullptr) BN_free(bn_x);
+    if (bn_y != nullptr) BN_free(bn_y);
+    EC_KEY_free(eck);
+    return nullptr;
+  }
+
+  if (EC_KEY_set_public_key_affine_coordinates(eck, bn_x, bn_y) == 0) {
+    BN_free(bn_x);
+    BN_free(bn_y);
+    gpr_log(GPR_ERROR, "Could not populate ec key coordinates.");
+    EC_KEY_free(eck);
+    return nullptr;
+  }
+  BN_free(bn_x);
+  BN_free(bn_y);
+  return eck;
+}
+
+std::string OkpFromJwk(const grpc_json *jkey) {
+  // Ed25519 is the only supported OKP curve.
+  const char *crv = GetStringValue(jkey, "crv");
+  if (crv == nullptr || strcmp(crv, "Ed25519") != 0) {
+    gpr_log(GPR_ERROR, "Missing or unsupported OKP curve %s.", crv);
+    return std::string();
+  }
+  const char *okp_x = GetStringValue(jkey, "x");
+  if (okp_x == nullptr) {
+    gpr_log(GPR_ERROR, "Missing OKP public key field.");
+    return std::string();
+  }
+  grpc_slice bin = grpc_base64_decode(okp_x, 1);
+  if (GRPC_SLICE_IS_EMPTY(bin)) {
+    gpr_log(GPR_ERROR, "Invalid base64 for OKP public key.");
+    return std::string();
+  }
+  std::string okp(reinterpret_cast<const char *>(GRPC_SLICE_START_PTR(bin)),
+                  GRPC_SLICE_LENGTH(bin));
+  grpc_slice_unref(bin);
+  if (okp.size() != ED25519_PUBLIC_KEY_LEN) {
+    gpr_log(GPR_ERROR, "Ed25519 public key length is not correct.");
+    return std::string();
+  }
+  return okp;
+}
+
+std::string DecodeBase64Bin(const char *b64) {
+  if (b64 == nullptr) return std::string();
+  grpc_slice bin = grpc_base64_decode(b64, 1);
+  if (GRPC_SLICE_IS_EMPTY(bin)) {
+    gpr_log(GPR_ERROR, "Invalid base64 in key material.");
+    return std::string();
+  }
+  std::string result(reinterpret_cast<const char *>(GRPC_SLICE_START_PTR(bin)),
+                     GRPC_SLICE_LENGTH(bin));
+  grpc_slice_unref(bin);
+  return result;
+}
+
+EVP_PKEY *PkeyFromRsaMaterial(const std::string &n, const std::string &e) {
+  RSA *rsa = RSA_new();
+  if (rsa == nullptr) {
+    gpr_log(GPR_ERROR, "Could not create rsa key.");
+    return nullptr;
+  }
+  rsa->n = BN_bin2bn(reinterpret_cast<const uint8_t *>(n.data()), n.size(),
+                     nullptr);
+  rsa->e = BN_bin2bn(reinterpret_cast<const uint8_t *>(e.data()), e.size(),
+                     nullptr);
+  if (rsa->n == nullptr || rsa->e == nullptr) {
+    gpr_log(GPR_ERROR, "Could not convert RSA public key material.");
+    RSA_free(rsa);
+    return nullptr;
+  }
+  EVP_PKEY *pkey = EVP_PKEY_new();
+  if (EVP_PKEY_set1_RSA(pkey, rsa) == 0) {
+    gpr_log(GPR_ERROR, "EVP_PKEY_set1_RSA failed");
+    EVP_PKEY_free(pkey);
+    RSA_free(rsa);
+    return nullptr;
+  }
+  RSA_free(rsa);
+  return pkey;
+}
+
+EC_KEY *EckFromEcMaterial(const std::string &x, const std::string &y) {
+  EC_KEY *eck = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+  if (eck == nullptr) {
+    gpr_log(GPR_ERROR, "Could not create ec key.");
+    return nullptr;
+  }
+  BIGNUM *bn_x = BN_bin2bn(reinterpret_cast<const uint8_t *>(x.data()),
+                           x.size(), nullptr);
+  BIGNUM *bn_y = BN_bin2bn(reinterpret_cast<const uint8_t *>(y.data()),
+                           y.size(), nullptr);
+  if (bn_x == nullptr || bn_y == nullptr) {
+    gpr_log(GPR_ERROR, "Could not convert EC public key material.");
+    if (bn_x != nullptr) BN_free(bn_x);
+    if (bn_y != nullptr) BN_free(bn_y);
+    EC_KEY_free(eck);
+    return nullptr;
+  }
+  if (EC_KEY_set_public_key_affine_coordinates(eck, bn_x, bn_y) == 0) {
+    BN_free(bn_x);
+    BN_free(bn_y);
+    gpr_log(GPR_ERROR, "Could not populate ec key coordinates.");
+    EC_KEY_free(eck);
+    return nullptr;
+  }
+  BN_free(bn_x);
+  BN_free(bn_y);
+  return eck;
+}
+
+EVP_PKEY *JwtPublicKeysImpl::GetPkey(PreparedKey *key) {
+  std::lock_guard<std::mutex> lock(construction_mu_);
+  if (key->pkey == nullptr && !key->construction_failed) {
+    key->pkey = key->type == kKeyTypeX509
+                    ? PubkeyFromX509(key->material.c_str())
+                    : PkeyFromRsaMaterial(key->material, key->material2);
+    key->construction_failed = key->pkey == nullptr;
+  }
+  return key->pkey;
+}
+
+EC_KEY *JwtPublicKeysImpl::GetEck(PreparedKey *key) {
+  std::lock_guard<std::mutex> lock(construction_mu_);
+  if (key->eck == nullptr && !key->construction_failed) {
+    key->eck = EckFromEcMaterial(key->material, key->material2);
+    key->construction_failed = key->eck == nullptr;
+  }
+  return key->eck;
+}
+
 }  // namespace
 }  // namespace auth
 }  // namespace api_manager
@@ -28,6 +28,35 @@ namespace google {
 namespace api_manager {
 namespace auth {
 
+// A set of issuer public keys parsed ahead of time from a JWK set or an
+// x509 key document. Extracting key material from the JSON document on
+// every request wastes CPU; a JwtPublicKeys instance is built once per key
+// fetch and is shared across requests and verification threads. Create
+// only decodes each key into a compact binary record; the OpenSSL key
+// object for a kid is constructed (under an internal lock) the first time
+// a token selects it and cached, so refreshing an issuer with a large
+// JWKS document does not rebuild keys no token uses.
+class JwtPublicKeys {
+ public:
+  // Parses a public key document of JWK or x509 format.
+  // Returns nullptr when the document is not JSON or holds no usable
+  // asymmetric key (e.g. an HS shared secret); callers then verify against
+  // the raw document instead.
+  static std::shared_ptr<JwtPublicKeys> Create(const char *pkey,
+                                               size_t pkey_len);
+
+  virtual ~JwtPublicKeys() {}
+};
+
+// Cheap pre-validation gate. Splits the token into its segments and scans
+// only the payload, rejecting tokens that cannot possibly verify - wrong
+// segment count, empty signature, an expired "exp" or future "nbf"
+// visible in the payload, missing issuer - without constructing a
+// validator or doing any signature work. Returns Status::OK for anything
+// else, including payloads the single-pass scanner cannot handle; those
+// fall through to the full parser.
+Status JwtPreCheck(const char *jwt, size_t jwt_len);
+
 class JwtValidator {
  public:
   // Create JwtValidator with JWT.
@@ -43,6 +72,10 @@ class JwtValidator {
   // Otherwise, produces a status error message.
   virtual Status VerifySignature(const char *pkey, size_t pkey_len) = 0;
 
+  // Verify signature against keys parsed ahead of time. Non-const since
+  // the first use of a kid constructs and caches its key object.
+  virtual Status VerifySignature(JwtPublicKeys &pkeys) = 0;
+
   // Returns the expiration time of the JWT.
   virtual std::chrono::system_clock::time_point &GetExpirationTime() = 0;
 
@@ -276,6 +276,36 @@ const char kTokenECNoKid[] =
     "ZfMAlKwYcTAEnn5FDTlEDj61U"
     "k07GKJHlCOac41oRgMQLGqbb7aNgEafbo_KzQJAxkwrl9A";
 
+// EdDSA (Ed25519) test data. The private key was generated by:
+// $ openssl genpkey -algorithm ed25519 -out private_key.pem
+// The JWK "x" field is the base64url encoding of the raw 32-byte public
+// key, and the tokens carry the same payload as kTokenEC, signed by:
+// $ openssl pkeyutl -sign -inkey private_key.pem -rawin -in signing_input
+const char kPublicKeyJwkEdDSA[] =
+    "{\"keys\": [{\"kty\": \"OKP\", \"alg\": \"EdDSA\", \"crv\": "
+    "\"Ed25519\", \"kid\": \"ed1\", \"use\": \"sig\", \"x\": "
+    "\"PMyfSqJpiZ6AP5VGmfgHNedpeUWnvWUFY-hkkp8WfOc\"}]}";
+
+const char kTokenEdDSA[] =
+    "eyJhbGciOiJFZERTQSIsInR5cCI6IkpXVCIsImtpZCI6ImVkMSJ9."
+    "eyJpc3MiOiI2Mjg2NDU3NDE4ODEtbm9hYml1MjNmNWE4bThvdmQ4dWN2Njk4bGo3OHZ2MGxAZ"
+    "GV2ZWxvcGVyLmdzZXJ2aWNlYWNjb3VudC5jb20iLCJzdWIiOiI2Mjg2NDU3NDE4ODEtbm9hYm"
+    "l1MjNmNWE4bThvdmQ4dWN2Njk4bGo3OHZ2MGxAZGV2ZWxvcGVyLmdzZXJ2aWNlYWNjb3VudC5"
+    "jb20iLCJhdWQiOiJodHRwOi8vbXlzZXJ2aWNlLmNvbS9teWFwaSJ9."
+    "9D0gi7P-0Z730RnxwC2Rh4Is03yoHqGPFqLgvMwnF-lYILt1ruT8-"
+    "CYaGZFMjTjKXHVlr0bNRN9Ecz5HmLpVCQ";
+
+// Same header and payload as kTokenEdDSA, but signed with a different
+// Ed25519 private key.
+const char kTokenEdDSAWrongKey[] =
+    "eyJhbGciOiJFZERTQSIsInR5cCI6IkpXVCIsImtpZCI6ImVkMSJ9."
+    "eyJpc3MiOiI2Mjg2NDU3NDE4ODEtbm9hYml1MjNmNWE4bThvdmQ4dWN2Njk4bGo3OHZ2MGxAZ"
+    "GV2ZWxvcGVyLmdzZXJ2aWNlYWNjb3VudC5jb20iLCJzdWIiOiI2Mjg2NDU3NDE4ODEtbm9hYm"
+    "l1MjNmNWE4bThvdmQ4dWN2Njk4bGo3OHZ2MGxAZGV2ZWxvcGVyLmdzZXJ2aWNlYWNjb3VudC5"
+    "jb20iLCJhdWQiOiJodHRwOi8vbXlzZXJ2aWNlLmNvbS9teWFwaSJ9."
+    "Aaf1RZOgTniVgTkBwGZPwiaN40__Y5qAvfwCVXM2qd8fpCSXGZoJTt60CBk9tZoBpaK9_"
+    "LWKtZwPCLcpa6HtDw";
+
 // Token generated with the following header and payload and kOkPrivateKey.
 // Header (kid is not specified):
 // {
@@ -315,6 +345,12 @@ const char kTokenNoSign[] =
     "GV2ZWxvcGVyLmdzZXJ2aWNlYWNjb3VudC5jb20iLCJhdWQiOiJodHRwOi8vbXlzZXJ2aWNlLmN"
     "vbS9teWFwaSJ9.";
 
+// Token whose payload carries an "exp" far in the past (dummy signature;
+// only the payload matters for the pre-check).
+const char kTokenExpired[] =
+    "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCJ9.eyJpc3MiOiJleHBpcmVkQGlzc3Vlci5jb20i"
+    "LCJhdWQiOiJodHRwOi8vbXlzZXJ2aWNlLmNvbS9teWFwaSIsImV4cCI6MTAwfQ.c2ln";
+
 // Token without "iss" in payload.
 const char kTokenNoIss[] =
     "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCJ9.eyJzdWIiOiI2Mjg2NDU3NDE4ODEtbm9hYml1"
@@ -631,6 +667,90 @@ TEST_F(JwtValidatorTest, WrongKeyEC) {
       << status.message();
 }
 
+TEST_F(JwtValidatorTest, OkTokenJwkEdDSA) {
+  TestTokenWithPubkey(const_cast<char *>(kTokenEdDSA), kPublicKeyJwkEdDSA);
+}
+
+TEST_F(JwtValidatorTest, WrongKeyEdDSA) {
+  UserInfo user_info;
+  std::unique_ptr<JwtValidator> validator =
+      JwtValidator::Create(kTokenEdDSAWrongKey, strlen(kTokenEdDSAWrongKey));
+  Status status = validator->Parse(&user_info);
+  EXPECT_OK(status);
+
+  status = validator->VerifySignature(kPublicKeyJwkEdDSA,
+                                      strlen(kPublicKeyJwkEdDSA));
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(status.message(), "JWT signature verification failed.")
+      << status.message();
+}
+
+// Verifies tokens of every supported asymmetric algorithm against keys
+// parsed ahead of time by JwtPublicKeys::Create.
+TEST_F(JwtValidatorTest, PreparedPublicKeys) {
+  struct {
+    const char *token;
+    const char *pkey;
+  } cases[] = {
+      {kTokenNoKid, kPublicKeyJwk},
+      {kTokenNoKid, kPublicKeyX509},
+      {kTokenEC, kPublicKeyJwkEC},
+      {kTokenECNoKid, kPublicKeyJwkEC},
+      {kTokenEdDSA, kPublicKeyJwkEdDSA},
+  };
+  for (const auto &test : cases) {
+    std::shared_ptr<JwtPublicKeys> pkeys =
+        JwtPublicKeys::Create(test.pkey, strlen(test.pkey));
+    ASSERT_TRUE(pkeys != nullptr);
+    UserInfo user_info;
+    std::unique_ptr<JwtValidator> validator =
+        JwtValidator::Create(test.token, strlen(test.token));
+    Status status = validator->Parse(&user_info);
+    EXPECT_OK(status);
+    status = validator->VerifySignature(*pkeys);
+    EXPECT_OK(status);
+    EXPECT_EQ(status.message(), "");
+  }
+
+  // A kid that is not in the prepared key set.
+  std::shared_ptr<JwtPublicKeys> pkeys =
+      JwtPublicKeys::Create(kPublicKeyJwkEC, strlen(kPublicKeyJwkEC));
+  ASSERT_TRUE(pkeys != nullptr);
+  UserInfo user_info;
+  std::unique_ptr<JwtValidator> validator =
+      JwtValidator::Create(kTokenECWrongKey, strlen(kTokenECWrongKey));
+  Status status = validator->Parse(&user_info);
+  EXPECT_OK(status);
+  status = validator->VerifySignature(*pkeys);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(status.message(), "Cannot find matching key in key set for kid=3c")
+      << status.message();
+
+  // Documents without usable asymmetric keys are not prepared.
+  EXPECT_TRUE(JwtPublicKeys::Create("not a key document", 18) == nullptr);
+  EXPECT_TRUE(JwtPublicKeys::Create("{\"keys\": []}", 12) == nullptr);
+}
+
+// The pre-validation gate rejects structurally hopeless tokens and passes
+// everything that needs real parsing or signature work.
+TEST_F(JwtValidatorTest, PreCheck) {
+  EXPECT_FALSE(JwtPreCheck(nullptr, 0).ok());
+  EXPECT_FALSE(JwtPreCheck("", 0).ok());
+  EXPECT_FALSE(JwtPreCheck(kTokenOneDot, strlen(kTokenOneDot)).ok());
+  EXPECT_FALSE(JwtPreCheck(kTokenNoSign, strlen(kTokenNoSign)).ok());
+  EXPECT_FALSE(JwtPreCheck(kTokenNoIss, strlen(kTokenNoIss)).ok());
+  EXPECT_FALSE(JwtPreCheck(kTokenExpired, strlen(kTokenExpired)).ok());
+
+  // A freshly generated token passes; so does one signed with the wrong
+  // key, since the gate never looks at the signature.
+  char *token = esp_get_auth_token(kOkPrivateKey, kAudience);
+  ASSERT_TRUE(token != nullptr);
+  EXPECT_OK(JwtPreCheck(token, strlen(token)));
+  char *wrong_key_token = esp_get_auth_token(kWrongPrivateKey, kAudience);
+  ASSERT_TRUE(wrong_key_token != nullptr);
+  EXPECT_OK(JwtPreCheck(wrong_key_token, strlen(wrong_key_token)));
+}
+
 }  // namespace
 
 }  // namespace auth
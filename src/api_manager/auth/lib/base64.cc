@@ -16,15 +16,109 @@
 //
 #include "src/api_manager/auth/lib/base64.h"
 
+#include <stdint.h>
 #include <cstring>
 #include <string>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#endif
+
+#include <grpc/support/log.h>
+
 #include "src/api_manager/auth/lib/grpc_internals.h"
 
 namespace google {
 namespace api_manager {
 namespace auth {
 
+namespace {
+
+// Decode table for the base64url alphabet ('-' and '_' for 62/63). 0xFF
+// marks invalid bytes; '=' is handled separately as trailing padding.
+const uint8_t kInvalidByte = 0xFF;
+
+struct Base64UrlTable {
+  Base64UrlTable() {
+    memset(values, kInvalidByte, sizeof(values));
+    const char *alphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    for (int i = 0; i < 64; ++i) {
+      values[static_cast<uint8_t>(alphabet[i])] = static_cast<uint8_t>(i);
+    }
+  }
+  uint8_t values[256];
+};
+
+const Base64UrlTable &GetBase64UrlTable() {
+  static const Base64UrlTable table;
+  return table;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+bool HasSsse3() {
+  static const bool supported = __builtin_cpu_supports("ssse3");
+  return supported;
+}
+
+// Decodes 16 base64url characters from |in| into 12 bytes at |out| using the
+// nibble-LUT technique (W. Mula, "Base64 decoding with SIMD instructions").
+// Returns false if any input byte is outside the base64url alphabet; the
+// caller then reports the error through the scalar path.
+// The target attribute lets this compile without -mssse3 on the whole build;
+// HasSsse3() gates every call.
+__attribute__((target("ssse3"))) bool DecodeBlockSsse3(const uint8_t *in,
+                                                       uint8_t *out) {
+  const __m128i input =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+  const __m128i higher_nibble =
+      _mm_and_si128(_mm_srli_epi32(input, 4), _mm_set1_epi8(0x0f));
+  // Valid input ranges per higher nibble: '-' (0x2d), '0'-'9', 'A'-'O',
+  // 'P'-'Z', 'a'-'o', 'p'-'z'. '_' (0x5f) does not fit a contiguous range
+  // and is matched separately.
+  const __m128i lower_bound_lut =
+      _mm_setr_epi8(1, 1, 0x2d, 0x30, 0x41, 0x50, 0x61, 0x70, 1, 1, 1, 1, 1,
+                    1, 1, 1);
+  const __m128i upper_bound_lut =
+      _mm_setr_epi8(0, 0, 0x2d, 0x39, 0x4f, 0x5a, 0x6f, 0x7a, 0, 0, 0, 0, 0,
+                    0, 0, 0);
+  const __m128i below =
+      _mm_cmplt_epi8(input, _mm_shuffle_epi8(lower_bound_lut, higher_nibble));
+  const __m128i above =
+      _mm_cmpgt_epi8(input, _mm_shuffle_epi8(upper_bound_lut, higher_nibble));
+  const __m128i eq_underscore =
+      _mm_cmpeq_epi8(input, _mm_set1_epi8(0x5f));
+  const __m128i outside =
+      _mm_andnot_si128(eq_underscore, _mm_or_si128(below, above));
+  if (_mm_movemask_epi8(outside) != 0) {
+    return false;
+  }
+  // Shift each character down to its 6-bit value ('A'-65 -> 0, etc.).
+  const __m128i shift_lut = _mm_setr_epi8(
+      0, 0, 17, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  __m128i shift = _mm_shuffle_epi8(shift_lut, higher_nibble);
+  shift = _mm_or_si128(_mm_andnot_si128(eq_underscore, shift),
+                       _mm_and_si128(eq_underscore, _mm_set1_epi8(-32)));
+  const __m128i values = _mm_add_epi8(input, shift);
+  // Pack four 6-bit values into three bytes per quad.
+  const __m128i merge_ab_and_bc =
+      _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  const __m128i merged =
+      _mm_madd_epi16(merge_ab_and_bc, _mm_set1_epi32(0x00011000));
+  const __m128i shuffled = _mm_shuffle_epi8(
+      merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1,
+                            -1, -1));
+  uint8_t block[16];
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(block), shuffled);
+  memcpy(out, block, 12);
+  return true;
+}
+
+#endif  // defined(__x86_64__) || defined(__i386__)
+
+}  // namespace
+
 char *esp_base64_encode(const void *data, size_t data_size, bool url_safe,
                         bool multiline, bool padding) {
   char *result =
@@ -43,6 +137,62 @@ char *esp_base64_encode(const void *data, size_t data_size, bool url_safe,
   return result;
 }
 
+grpc_slice esp_base64url_decode_with_len(const char *b64, size_t b64_len) {
+  // Trailing '=' padding is optional; strip it before decoding.
+  while (b64_len > 0 && b64[b64_len - 1] == '=') {
+    b64_len--;
+  }
+  if (b64_len % 4 == 1) {
+    // A valid base64 tail is 0, 2 or 3 characters.
+    return grpc_empty_slice();
+  }
+  const size_t decoded_len =
+      (b64_len / 4) * 3 + (b64_len % 4 == 0 ? 0 : b64_len % 4 - 1);
+  grpc_slice result = grpc_slice_malloc(decoded_len);
+  const uint8_t *in = reinterpret_cast<const uint8_t *>(b64);
+  uint8_t *out = GRPC_SLICE_START_PTR(result);
+  size_t i = 0;
+  size_t o = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+  if (HasSsse3()) {
+    // Leave at least one full quad to the scalar tail handling below.
+    while (b64_len - i >= 16 + 4 && DecodeBlockSsse3(in + i, out + o)) {
+      i += 16;
+      o += 12;
+    }
+  }
+#endif
+
+  const uint8_t *table = GetBase64UrlTable().values;
+  uint32_t quad = 0;
+  int quad_size = 0;
+  for (; i < b64_len; ++i) {
+    const uint8_t value = table[in[i]];
+    if (value == kInvalidByte) {
+      grpc_slice_unref(result);
+      return grpc_empty_slice();
+    }
+    quad = (quad << 6) | value;
+    if (++quad_size == 4) {
+      out[o++] = static_cast<uint8_t>(quad >> 16);
+      out[o++] = static_cast<uint8_t>(quad >> 8);
+      out[o++] = static_cast<uint8_t>(quad);
+      quad = 0;
+      quad_size = 0;
+    }
+  }
+  // Decode the 2- or 3-character tail of an unpadded input.
+  if (quad_size == 2) {
+    out[o++] = static_cast<uint8_t>(quad >> 4);
+  } else if (quad_size == 3) {
+    out[o++] = static_cast<uint8_t>(quad >> 10);
+    out[o++] = static_cast<uint8_t>(quad >> 2);
+  }
+  GPR_ASSERT(o == decoded_len);
+  return result;
+}
+
 }  // namespace auth
 }  // namespace api_manager
 }  // namespace google
@@ -17,6 +17,8 @@
 
 #include <string.h>
 
+#include <grpc/slice.h>
+
 namespace google {
 namespace api_manager {
 namespace auth {
@@ -26,6 +28,13 @@ namespace auth {
 char *esp_base64_encode(const void *data, size_t data_size, bool url_safe,
                         bool multiline, bool padding);
 
+// Decodes a base64url (RFC 4648 section 5) string of length b64_len, with or
+// without '=' padding. Returns an empty slice if the input is not valid
+// base64url. The decode is vectorized (SSSE3) on x86 when the CPU supports
+// it, with a table-driven scalar fallback; JWT segments dominate the calls
+// here and are worth the fast path.
+grpc_slice esp_base64url_decode_with_len(const char *b64, size_t b64_len);
+
 }  // namespace auth
 }  // namespace api_manager
 }  // namespace google
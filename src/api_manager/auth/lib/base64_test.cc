@@ -15,6 +15,9 @@
 ////////////////////////////////////////////////////////////////////////////////
 //
 #include "src/api_manager/auth/lib/base64.h"
+
+#include <string>
+
 #include "gtest/gtest.h"
 #include "src/api_manager/auth/lib/auth_token.h"
 
@@ -55,6 +58,48 @@ TEST(EspBase64Test, EncodeTest) {
   }
 }
 
+TEST(EspBase64Test, DecodeTest) {
+  for (const auto &t : test_vectors) {
+    for (const char *encoded : {t.encoded_padding, t.encoded_no_padding}) {
+      grpc_slice decoded =
+          esp_base64url_decode_with_len(encoded, strlen(encoded));
+      ASSERT_EQ(strlen(t.data), GRPC_SLICE_LENGTH(decoded));
+      ASSERT_EQ(0, memcmp(t.data, GRPC_SLICE_START_PTR(decoded),
+                          GRPC_SLICE_LENGTH(decoded)));
+      grpc_slice_unref(decoded);
+    }
+  }
+}
+
+TEST(EspBase64Test, DecodeLongInputTest) {
+  // Long enough to exercise the vectorized decode path.
+  std::string data;
+  for (int i = 0; i < 1000; ++i) {
+    data.push_back(static_cast<char>(i * 131 + 7));
+  }
+  char *encoded = esp_base64_encode(data.data(), data.size(), true, false,
+                                    false);
+  ASSERT_NE(nullptr, encoded);
+  grpc_slice decoded = esp_base64url_decode_with_len(encoded, strlen(encoded));
+  ASSERT_EQ(data.size(), GRPC_SLICE_LENGTH(decoded));
+  ASSERT_EQ(0, memcmp(data.data(), GRPC_SLICE_START_PTR(decoded),
+                      GRPC_SLICE_LENGTH(decoded)));
+  grpc_slice_unref(decoded);
+  esp_grpc_free(encoded);
+}
+
+TEST(EspBase64Test, DecodeInvalidInputTest) {
+  // Bad length, non-url-safe alphabet, bytes outside the alphabet, and
+  // padding in the middle.
+  for (const char *invalid : {"A", "ABCDE", "AB+D", "AB/D", "AB.D", "=AAA",
+                              "AAAAAAAAAAAAAAAAAAAA!AAA"}) {
+    grpc_slice decoded =
+        esp_base64url_decode_with_len(invalid, strlen(invalid));
+    EXPECT_TRUE(GRPC_SLICE_IS_EMPTY(decoded)) << invalid;
+    grpc_slice_unref(decoded);
+  }
+}
+
 }  // namespace auth
 }  // namespace api_manager
 }  // namespace google
@@ -0,0 +1,341 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/auth/lib/claims_scanner.h"
+
+namespace google {
+namespace api_manager {
+namespace auth {
+namespace {
+
+// Containers nested deeper than this make the scanner bail out to the
+// tree-based parser instead of recursing further.
+const int kMaxSkipDepth = 16;
+
+// A cursor over the payload. The Scan/Skip helpers advance pos on success
+// and return false on malformed or unsupported input.
+class Scanner {
+ public:
+  explicit Scanner(absl::string_view in) : in_(in), pos_(0) {}
+
+  bool Eof() const { return pos_ >= in_.size(); }
+  char Peek() const { return in_[pos_]; }
+  void Advance() { ++pos_; }
+
+  void SkipWhitespace() {
+    while (!Eof() && (in_[pos_] == ' ' || in_[pos_] == '\t' ||
+                      in_[pos_] == '\n' || in_[pos_] == '\r')) {
+      ++pos_;
+    }
+  }
+
+  // Scans a string literal into the raw bytes between its quotes.
+  // has_escape tells the caller whether the raw bytes still contain escape
+  // sequences and need the unescaping parser.
+  bool ScanString(absl::string_view *out, bool *has_escape) {
+    if (Eof() || in_[pos_] != '"') {
+      return false;
+    }
+    ++pos_;
+    const size_t start = pos_;
+    *has_escape = false;
+    while (!Eof()) {
+      const char c = in_[pos_];
+      if (c == '\\') {
+        *has_escape = true;
+        pos_ += 2;
+        continue;
+      }
+      if (c == '"') {
+        *out = in_.substr(start, pos_ - start);
+        ++pos_;
+        return true;
+      }
+      ++pos_;
+    }
+    return false;
+  }
+
+  // Scans a non-negative integer. Fails on fractions and exponents; the
+  // caller falls back to the tree-based parser for those.
+  bool ScanInt(int64_t *out) {
+    const size_t start = pos_;
+    int64_t value = 0;
+    while (!Eof() && in_[pos_] >= '0' && in_[pos_] <= '9') {
+      value = value * 10 + (in_[pos_] - '0');
+      if (value < 0) {  // Overflow.
+        return false;
+      }
+      ++pos_;
+    }
+    if (pos_ == start) {
+      return false;
+    }
+    if (!Eof() &&
+        (in_[pos_] == '.' || in_[pos_] == 'e' || in_[pos_] == 'E')) {
+      return false;
+    }
+    *out = value;
+    return true;
+  }
+
+  // Skips one value of any type, including nested containers.
+  bool SkipValue(int depth) {
+    SkipWhitespace();
+    if (Eof()) {
+      return false;
+    }
+    const char c = Peek();
+    if (c == '"') {
+      absl::string_view unused;
+      bool unused_escape;
+      return ScanString(&unused, &unused_escape);
+    }
+    if (c == '{' || c == '[') {
+      if (depth >= kMaxSkipDepth) {
+        return false;
+      }
+      return SkipContainer(c, depth);
+    }
+    if (c == 't') {
+      return SkipLiteral("true");
+    }
+    if (c == 'f') {
+      return SkipLiteral("false");
+    }
+    if (c == 'n') {
+      return SkipLiteral("null");
+    }
+    return SkipNumber();
+  }
+
+ private:
+  bool SkipLiteral(absl::string_view literal) {
+    if (in_.substr(pos_, literal.size()) != literal) {
+      return false;
+    }
+    pos_ += literal.size();
+    return true;
+  }
+
+  bool SkipNumber() {
+    const size_t start = pos_;
+    while (!Eof()) {
+      const char c = in_[pos_];
+      if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' ||
+          c == 'e' || c == 'E') {
+        ++pos_;
+      } else {
+        break;
+      }
+    }
+    return pos_ > start;
+  }
+
+  bool SkipContainer(char open, int depth) {
+    const char close = open == '{' ? '}' : ']';
+    ++pos_;
+    SkipWhitespace();
+    if (!Eof() && Peek() == close) {
+      ++pos_;
+      return true;
+    }
+    while (true) {
+      if (open == '{') {
+        SkipWhitespace();
+        absl::string_view unused;
+        bool unused_escape;
+        if (!ScanString(&unused, &unused_escape)) {
+          return false;
+        }
+        SkipWhitespace();
+        if (Eof() || Peek() != ':') {
+          return false;
+        }
+        ++pos_;
+      }
+      if (!SkipValue(depth + 1)) {
+        return false;
+      }
+      SkipWhitespace();
+      if (Eof()) {
+        return false;
+      }
+      if (Peek() == ',') {
+        ++pos_;
+        continue;
+      }
+      if (Peek() == close) {
+        ++pos_;
+        return true;
+      }
+      return false;
+    }
+  }
+
+  const absl::string_view in_;
+  size_t pos_;
+};
+
+// Scans the value of an "aud" claim: either a single string or an array of
+// strings.
+bool ScanAudiences(Scanner *s, std::vector<absl::string_view> *aud) {
+  bool has_escape;
+  if (!s->Eof() && s->Peek() == '"') {
+    absl::string_view value;
+    if (!s->ScanString(&value, &has_escape) || has_escape) {
+      return false;
+    }
+    aud->push_back(value);
+    return true;
+  }
+  if (s->Eof() || s->Peek() != '[') {
+    return false;
+  }
+  s->Advance();
+  s->SkipWhitespace();
+  if (!s->Eof() && s->Peek() == ']') {
+    s->Advance();
+    return true;
+  }
+  while (true) {
+    s->SkipWhitespace();
+    absl::string_view value;
+    if (!s->ScanString(&value, &has_escape) || has_escape) {
+      return false;
+    }
+    aud->push_back(value);
+    s->SkipWhitespace();
+    if (s->Eof()) {
+      return false;
+    }
+    if (s->Peek() == ',') {
+      s->Advance();
+      continue;
+    }
+    if (s->Peek() == ']') {
+      s->Advance();
+      return true;
+    }
+    return false;
+  }
+}
+
+}  // namespace
+
+bool ScanJwtClaims(absl::string_view payload, ScannedClaims *claims) {
+  Scanner s(payload);
+  s.SkipWhitespace();
+  if (s.Eof() || s.Peek() != '{') {
+    return false;
+  }
+  s.Advance();
+  s.SkipWhitespace();
+  bool saw_aud = false;
+  if (!s.Eof() && s.Peek() == '}') {
+    s.Advance();
+  } else {
+    while (true) {
+      s.SkipWhitespace();
+      absl::string_view key;
+      bool has_escape;
+      if (!s.ScanString(&key, &has_escape) || has_escape) {
+        return false;
+      }
+      s.SkipWhitespace();
+      if (s.Eof() || s.Peek() != ':') {
+        return false;
+      }
+      s.Advance();
+      s.SkipWhitespace();
+
+      // Extract the fields ESP uses; skip everything else. On duplicate
+      // keys the first occurrence wins, like the tree-based lookups.
+      if (key == "iss" || key == "sub" || key == "email" || key == "azp") {
+        absl::string_view value;
+        if (!s.ScanString(&value, &has_escape) || has_escape) {
+          return false;
+        }
+        absl::string_view *field =
+            key == "iss" ? &claims->iss
+                         : key == "sub" ? &claims->sub
+                                        : key == "email" ? &claims->email
+                                                         : &claims->azp;
+        if (field->data() == nullptr) {
+          *field = value;
+        }
+      } else if (key == "aud") {
+        std::vector<absl::string_view> aud;
+        if (!ScanAudiences(&s, &aud)) {
+          return false;
+        }
+        if (!saw_aud) {
+          claims->aud = aud;
+          saw_aud = true;
+        }
+      } else if (key == "exp" || key == "nbf") {
+        int64_t value;
+        if (!s.ScanInt(&value)) {
+          return false;
+        }
+        if (key == "exp") {
+          if (!claims->has_exp) {
+            claims->exp = value;
+            claims->has_exp = true;
+          }
+        } else if (!claims->has_nbf) {
+          claims->nbf = value;
+          claims->has_nbf = true;
+        }
+      } else if (key == "iat") {
+        // Not consumed by ESP, but the tree-based claims parser enforces
+        // its type; keep rejecting tokens where it is not a number.
+        int64_t unused;
+        if (!s.ScanInt(&unused)) {
+          return false;
+        }
+      } else if (key == "jti") {
+        // Same as iat: must be a string for the tree-based parser.
+        absl::string_view unused;
+        if (!s.ScanString(&unused, &has_escape)) {
+          return false;
+        }
+      } else if (!s.SkipValue(0)) {
+        return false;
+      }
+
+      s.SkipWhitespace();
+      if (s.Eof()) {
+        return false;
+      }
+      if (s.Peek() == ',') {
+        s.Advance();
+        continue;
+      }
+      if (s.Peek() == '}') {
+        s.Advance();
+        break;
+      }
+      return false;
+    }
+  }
+  s.SkipWhitespace();
+  return s.Eof();
+}
+
+}  // namespace auth
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,55 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_AUTH_LIB_CLAIMS_SCANNER_H_
+#define API_MANAGER_AUTH_LIB_CLAIMS_SCANNER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace google {
+namespace api_manager {
+namespace auth {
+
+// The JWT claims ESP consumes. The string fields are views into the
+// scanned payload and stay valid only as long as the payload buffer does.
+// A field that is absent from the payload keeps a default (null) view, or
+// its has_* flag unset.
+struct ScannedClaims {
+  absl::string_view iss;
+  absl::string_view sub;
+  absl::string_view email;
+  absl::string_view azp;
+  std::vector<absl::string_view> aud;
+  int64_t exp = 0;
+  int64_t nbf = 0;
+  bool has_exp = false;
+  bool has_nbf = false;
+};
+
+// Extracts the claims above from a decoded JWT payload in a single pass,
+// without building a JSON tree. Returns false when the payload uses JSON
+// constructs the scanner does not handle - an escape sequence in an
+// extracted field, a non-integer timestamp, a non-string audience entry -
+// in which case the caller is expected to fall back to the tree-based
+// parser.
+bool ScanJwtClaims(absl::string_view payload, ScannedClaims *claims);
+
+}  // namespace auth
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_AUTH_LIB_CLAIMS_SCANNER_H_
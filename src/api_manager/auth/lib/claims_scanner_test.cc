@@ -0,0 +1,109 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/auth/lib/claims_scanner.h"
+
+#include "gtest/gtest.h"
+
+namespace google {
+namespace api_manager {
+namespace auth {
+namespace {
+
+TEST(ClaimsScannerTest, ExtractsUsedClaims) {
+  ScannedClaims claims;
+  ASSERT_TRUE(ScanJwtClaims(
+      "{\"iss\":\"issuer@example.com\",\"sub\":\"subject\","
+      "\"aud\":\"http://myservice.com/myapi\",\"exp\":2462324020,"
+      "\"nbf\":1462324020,\"email\":\"user@example.com\","
+      "\"azp\":\"authorized@party.com\"}",
+      &claims));
+  EXPECT_EQ("issuer@example.com", claims.iss);
+  EXPECT_EQ("subject", claims.sub);
+  EXPECT_EQ("user@example.com", claims.email);
+  EXPECT_EQ("authorized@party.com", claims.azp);
+  ASSERT_EQ(1U, claims.aud.size());
+  EXPECT_EQ("http://myservice.com/myapi", claims.aud[0]);
+  EXPECT_TRUE(claims.has_exp);
+  EXPECT_EQ(2462324020, claims.exp);
+  EXPECT_TRUE(claims.has_nbf);
+  EXPECT_EQ(1462324020, claims.nbf);
+}
+
+TEST(ClaimsScannerTest, AudienceArrayAndAbsentFields) {
+  ScannedClaims claims;
+  ASSERT_TRUE(ScanJwtClaims(
+      "{\"iss\":\"issuer\",\"aud\":[\"aud1\",\"aud2\"]}", &claims));
+  ASSERT_EQ(2U, claims.aud.size());
+  EXPECT_EQ("aud1", claims.aud[0]);
+  EXPECT_EQ("aud2", claims.aud[1]);
+  EXPECT_TRUE(claims.sub.data() == nullptr);
+  EXPECT_TRUE(claims.email.data() == nullptr);
+  EXPECT_FALSE(claims.has_exp);
+  EXPECT_FALSE(claims.has_nbf);
+}
+
+TEST(ClaimsScannerTest, SkipsUnusedClaims) {
+  // Nested containers, literals and numbers in claims ESP does not use
+  // must be skipped without affecting extraction.
+  ScannedClaims claims;
+  ASSERT_TRUE(ScanJwtClaims(
+      "{\"custom\":{\"a\":[1,2,{\"b\":null}],\"c\":\"es\\\"caped\"},"
+      "\"flag\":true,\"ratio\":-1.5e3,\"iss\":\"issuer\","
+      "\"iat\":1462324020,\"jti\":\"id\"}",
+      &claims));
+  EXPECT_EQ("issuer", claims.iss);
+}
+
+TEST(ClaimsScannerTest, FirstOccurrenceWins) {
+  ScannedClaims claims;
+  ASSERT_TRUE(ScanJwtClaims(
+      "{\"iss\":\"first\",\"iss\":\"second\",\"exp\":1,\"exp\":2,"
+      "\"aud\":\"aud1\",\"aud\":\"aud2\"}",
+      &claims));
+  EXPECT_EQ("first", claims.iss);
+  EXPECT_EQ(1, claims.exp);
+  ASSERT_EQ(1U, claims.aud.size());
+  EXPECT_EQ("aud1", claims.aud[0]);
+}
+
+TEST(ClaimsScannerTest, BailsOutOnUnsupportedConstructs) {
+  // Each of these payloads must be handed to the tree-based parser.
+  const char *payloads[] = {
+      // Escape sequence in an extracted field.
+      "{\"iss\":\"is\\\"suer\"}",
+      // Non-integer timestamp.
+      "{\"exp\":2462324020.5}",
+      // Wrong types for extracted and type-checked claims.
+      "{\"iss\":1}",
+      "{\"aud\":[\"a\",1]}",
+      "{\"iat\":\"not a number\"}",
+      // Malformed JSON.
+      "{\"iss\":\"issuer\"",
+      "{\"iss\":\"issuer\"}trailing",
+      "[\"not an object\"]",
+      "",
+  };
+  for (const char *payload : payloads) {
+    ScannedClaims claims;
+    EXPECT_FALSE(ScanJwtClaims(payload, &claims)) << payload;
+  }
+}
+
+}  // namespace
+}  // namespace auth
+}  // namespace api_manager
+}  // namespace google
@@ -33,6 +33,34 @@ const char kJwtPayloadsDelimeter = '.';
 
 bool isNullOrEmpty(const char *str) { return str == nullptr || *str == '\0'; }
 
+// Resolves one pre-split payload path against a parsed DOM and converts
+// the primitive field it lands on.
+bool ResolvePrimitiveField(const grpc_json *json,
+                           const std::vector<std::string> &path_fields,
+                           std::string *payload_value) {
+  for (const auto &path_field : path_fields) {
+    json = GetProperty(json, path_field.c_str());
+  }
+  if (!json) {
+    return false;
+  }
+
+  switch (json->type) {
+    case GRPC_JSON_STRING:
+    case GRPC_JSON_NUMBER:
+      *payload_value = json->value;
+      return true;
+    case GRPC_JSON_TRUE:
+      *payload_value = "true";
+      return true;
+    case GRPC_JSON_FALSE:
+      *payload_value = "false";
+      return true;
+    default:
+      return false;
+  }
+}
+
 }  // namespace
 
 const grpc_json *GetProperty(const grpc_json *json, const char *key) {
@@ -71,33 +99,42 @@ bool GetPrimitiveFieldValue(const std::string &json_str,
     return false;
   }
 
-  const grpc_json *json = json_root;
   std::vector<std::string> path_fields;
   utils::Split(payload_path, kJwtPayloadsDelimeter, &path_fields);
-  for (const auto &path_field : path_fields) {
-    json = GetProperty(json, path_field.c_str());
+  bool found = ResolvePrimitiveField(json_root, path_fields, payload_value);
+  grpc_json_destroy(json_root);
+  gpr_free(json_copy);
+  return found;
+}
+
+FieldPathPlan CompileFieldPaths(const std::vector<std::string> &paths) {
+  FieldPathPlan plan;
+  plan.reserve(paths.size());
+  for (const auto &path : paths) {
+    std::vector<std::string> path_fields;
+    utils::Split(path, kJwtPayloadsDelimeter, &path_fields);
+    plan.push_back(std::move(path_fields));
   }
-  if (!json) {
-    grpc_json_destroy(json_root);
+  return plan;
+}
+
+bool GetPrimitiveFieldValues(const std::string &json_str,
+                             const FieldPathPlan &plan,
+                             std::vector<std::string> *values,
+                             std::vector<bool> *found) {
+  values->assign(plan.size(), std::string());
+  found->assign(plan.size(), false);
+
+  char *json_copy = strdup(json_str.c_str());
+  grpc_json *json_root =
+      grpc_json_parse_string_with_len(json_copy, strlen(json_copy));
+  if (!json_root) {
     gpr_free(json_copy);
     return false;
   }
 
-  switch (json->type) {
-    case GRPC_JSON_STRING:
-    case GRPC_JSON_NUMBER:
-      *payload_value = json->value;
-      break;
-    case GRPC_JSON_TRUE:
-      *payload_value = "true";
-      break;
-    case GRPC_JSON_FALSE:
-      *payload_value = "false";
-      break;
-    default:
-      grpc_json_destroy(json_root);
-      gpr_free(json_copy);
-      return false;
+  for (size_t i = 0; i < plan.size(); ++i) {
+    (*found)[i] = ResolvePrimitiveField(json_root, plan[i], &(*values)[i]);
   }
   grpc_json_destroy(json_root);
   gpr_free(json_copy);
@@ -20,6 +20,8 @@
 // A public header file should not include any grpc header files.
 
 #include <set>
+#include <string>
+#include <vector>
 #include "src/api_manager/auth/lib/grpc_internals.h"
 
 namespace google {
@@ -34,6 +36,25 @@ bool GetPrimitiveFieldValue(const std::string &json,
                             const std::string &payload_path,
                             std::string *payload_value);
 
+// A compiled field extraction plan: each entry is one payload path,
+// pre-split on "." into its segments. Callers that extract the same set
+// of fields repeatedly compile the plan once and use
+// GetPrimitiveFieldValues, which resolves every path against a single
+// parse of the json.
+typedef std::vector<std::vector<std::string>> FieldPathPlan;
+
+// Compiles "."-separated payload paths into a FieldPathPlan.
+FieldPathPlan CompileFieldPaths(const std::vector<std::string> &paths);
+
+// Gets the primitive values of all planned paths with one parse of the
+// json: (*values)[i] holds the value of plan[i] and (*found)[i] is set
+// iff that path resolved to a primitive field. Returns false when the
+// json cannot be parsed.
+bool GetPrimitiveFieldValues(const std::string &json,
+                             const FieldPathPlan &plan,
+                             std::vector<std::string> *values,
+                             std::vector<bool> *found);
+
 // Gets string value by key or nullptr if no such key or property is not string
 // type.
 const char *GetStringValue(const grpc_json *json, const char *key);
@@ -145,6 +145,26 @@ TEST(JsonUtil, GetPrimitiveFieldValue) {
   ASSERT_FALSE(GetPrimitiveFieldValue(json_input_2, "array", &value));
 }
 
+TEST(JsonUtil, GetPrimitiveFieldValues) {
+  FieldPathPlan plan = CompileFieldPaths(
+      {"string", "number", "object.sub_obj.obj_bool", "non_exist", "object"});
+  std::vector<std::string> values;
+  std::vector<bool> found;
+
+  ASSERT_TRUE(GetPrimitiveFieldValues(json_input_2, plan, &values, &found));
+  ASSERT_EQ(5u, values.size());
+  ASSERT_TRUE(found[0]);
+  ASSERT_EQ("string value", values[0]);
+  ASSERT_TRUE(found[1]);
+  ASSERT_EQ("12345", values[1]);
+  ASSERT_TRUE(found[2]);
+  ASSERT_EQ("false", values[2]);
+  ASSERT_FALSE(found[3]);
+  ASSERT_FALSE(found[4]);
+
+  ASSERT_FALSE(GetPrimitiveFieldValues("not json", plan, &values, &found));
+}
+
 }  // namespace
 }  // namespace auth
 }  // namespace api_manager
@@ -72,6 +72,25 @@ const std::string& ServiceAccountToken::GetAuthToken(JWT_TOKEN_TYPE type) {
 
 const std::string& ServiceAccountToken::GetAuthToken(
     JWT_TOKEN_TYPE type, const std::string& audience) {
+  TokenInfo* token_info = EnsureTokenValid(type, audience);
+  if (token_info == nullptr) {
+    static std::string empty;
+    return empty;
+  }
+  return token_info->token();
+}
+
+const std::string& ServiceAccountToken::GetAuthHeader(JWT_TOKEN_TYPE type) {
+  TokenInfo* token_info = EnsureTokenValid(type, jwt_tokens_[type].audience());
+  if (token_info == nullptr) {
+    static std::string empty;
+    return empty;
+  }
+  return token_info->bearer_header();
+}
+
+ServiceAccountToken::TokenInfo* ServiceAccountToken::EnsureTokenValid(
+    JWT_TOKEN_TYPE type, const std::string& audience) {
   // Uses authentication secret if available.
   if (!client_auth_secret_.empty()) {
     SetAudience(type, audience);
@@ -82,13 +101,12 @@ const std::string& ServiceAccountToken::GetAuthToken(
         if (env_) {
           env_->LogError("Failed to generate auth token.");
         }
-        static std::string empty;
-        return empty;
+        return nullptr;
       }
     }
-    return jwt_tokens_[type].token();
+    return &jwt_tokens_[type];
   }
-  return access_token_.token();
+  return &access_token_;
 }
 
 Status ServiceAccountToken::JwtTokenInfo::GenerateJwtToken(
@@ -17,6 +17,9 @@
 
 #include <time.h>
 
+#include <functional>
+#include <vector>
+
 #include "include/api_manager/env_interface.h"
 
 namespace google {
@@ -46,6 +49,21 @@ class ServiceAccountToken {
   // Get fetching state
   FetchState state() const { return state_; }
 
+  // Queues a callback to run when the in-flight fetch of this token
+  // completes. Callers that find the token in FETCHING state with no
+  // valid token to fall back on join the in-flight fetch this way
+  // instead of issuing their own metadata server request.
+  void AddPendingCallback(std::function<void(utils::Status)> callback) {
+    pending_callbacks_.push_back(std::move(callback));
+  }
+
+  // Takes the queued callbacks, leaving the queue empty.
+  std::vector<std::function<void(utils::Status)>> TakePendingCallbacks() {
+    std::vector<std::function<void(utils::Status)>> callbacks;
+    callbacks.swap(pending_callbacks_);
+    return callbacks;
+  }
+
   // Returns whether the client auth secret exists
   bool has_client_secret() const { return !client_auth_secret_.empty(); }
 
@@ -96,6 +114,14 @@ class ServiceAccountToken {
   // Gets the auth token from metadata server.
   const std::string& GetAuthToken() const { return access_token_.token(); }
 
+  // Gets the expiration time of the auth token from metadata server.
+  time_t access_token_expiration_time() const {
+    return access_token_.expiration_time();
+  }
+
+  // Gets the lifetime the auth token from metadata server was set with.
+  time_t access_token_lifetime() const { return access_token_.lifetime(); }
+
   // Gets the auth token to access Google services.
   // If client auth secret is specified, use it to calculate JWT token.
   // Otherwise, use the access token fetched from metadata server.
@@ -108,6 +134,11 @@ class ServiceAccountToken {
   const std::string& GetAuthToken(JWT_TOKEN_TYPE type,
                                   const std::string& audience);
 
+  // Gets the complete "Bearer <token>" Authorization header value for the
+  // same token GetAuthToken() returns. The value is precomputed when the
+  // token is (re)generated, so per-flush callers do no header assembly.
+  const std::string& GetAuthHeader(JWT_TOKEN_TYPE type);
+
  private:
   // Stores base token info. Used for both OAuth and JWT tokens.
   class TokenInfo {
@@ -121,19 +152,32 @@ class ServiceAccountToken {
     void set_token(const std::string& token, time_t expiration) {
       token_ = token;
       expiration_time_ = time(nullptr) + expiration;
+      lifetime_ = expiration;
+      bearer_header_ = token.empty() ? "" : "Bearer " + token;
     }
 
     // Get the token
     const std::string& token() const { return token_; }
 
+    // The "Bearer <token>" Authorization header value, built once per
+    // set_token() so flush paths do not concatenate it per request.
+    const std::string& bearer_header() const { return bearer_header_; }
+
     // Get expiration time in seconds
     time_t expiration_time() const { return expiration_time_; }
 
+    // Get the lifetime the token was set with, in seconds
+    time_t lifetime() const { return lifetime_; }
+
    private:
     // The auth token.
     std::string token_;
+    // The precomputed Authorization header value for the token.
+    std::string bearer_header_;
     // The token expiration time.
     time_t expiration_time_;
+    // The expiration duration the token was set with.
+    time_t lifetime_;
   };
 
   // Stores JWT token info
@@ -150,6 +194,10 @@ class ServiceAccountToken {
     std::string audience_;
   };
 
+  // Returns the token record serving `type`, regenerating an expired JWT
+  // first. nullptr when the JWT could not be generated.
+  TokenInfo* EnsureTokenValid(JWT_TOKEN_TYPE type, const std::string& audience);
+
   // environment interface.
   ApiManagerEnvInterface* env_;
 
@@ -165,6 +213,9 @@ class ServiceAccountToken {
   // Fetching state
   FetchState state_;
 
+  // Callbacks waiting on the in-flight fetch.
+  std::vector<std::function<void(utils::Status)>> pending_callbacks_;
+
   // The time of last failed fetch
   std::chrono::system_clock::time_point last_failed_fetch_time_;
 };
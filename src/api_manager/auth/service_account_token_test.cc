@@ -59,6 +59,17 @@ TEST_F(ServiceAccountTokenTest, TestAccessToken) {
                 ServiceAccountToken::JWT_TOKEN_FOR_SERVICE_CONTROL));
 }
 
+TEST_F(ServiceAccountTokenTest, TestAuthHeader) {
+  // No token yet: no header.
+  ASSERT_EQ("", sa_token_->GetAuthHeader(
+                    ServiceAccountToken::JWT_TOKEN_FOR_SERVICE_CONTROL));
+
+  sa_token_->set_access_token("Dummy Token", 1);
+  ASSERT_EQ("Bearer Dummy Token",
+            sa_token_->GetAuthHeader(
+                ServiceAccountToken::JWT_TOKEN_FOR_SERVICE_CONTROL));
+}
+
 TEST_F(ServiceAccountTokenTest, TestClientAuthSecret) {
   // Needed.
   ASSERT_FALSE(sa_token_->is_access_token_valid(0));
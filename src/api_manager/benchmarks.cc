@@ -0,0 +1,300 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Microbenchmarks for the per-request hot paths of the API manager: path
+// matching, report proto fill, JWT cache lookups, base64url decoding and
+// service config marshalling. Build and run with
+//
+//   bazel run -c opt //src/api_manager:benchmarks
+//
+// to compare the numbers between releases.
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "google/api/service.pb.h"
+#include "src/api_manager/auth/jwt_cache.h"
+#include "src/api_manager/auth/lib/auth_token.h"
+#include "src/api_manager/auth/lib/base64.h"
+#include "src/api_manager/path_matcher.h"
+#include "src/api_manager/service_control/proto.h"
+#include "src/api_manager/utils/marshalling.h"
+
+namespace gasv1 = ::google::api::servicecontrol::v1;
+
+namespace google {
+namespace api_manager {
+
+namespace {
+
+const char kTestdata[] = "src/api_manager/testdata/";
+
+std::string ReadTestdata(const char* file_name) {
+  std::string full_name = std::string(kTestdata) + file_name;
+  std::ifstream input_file(full_name,
+                           std::ifstream::in | std::ifstream::binary);
+  std::string contents((std::istreambuf_iterator<char>(input_file)),
+                       (std::istreambuf_iterator<char>()));
+  return contents;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Path matching
+////////////////////////////////////////////////////////////////////////////////
+
+// A minimal method type for the path matcher benchmarks; Lookup() only
+// consults the two accessors below.
+class BenchmarkMethod {
+ public:
+  const std::set<std::string>& system_query_parameter_names() const {
+    return system_query_parameter_names_;
+  }
+  bool keep_binding_escaped() const { return false; }
+
+ private:
+  std::set<std::string> system_query_parameter_names_;
+};
+
+// VariableBinding as expected by PathMatcher::Lookup.
+struct BenchmarkBinding {
+  std::vector<std::string> field_path;
+  std::string value;
+};
+
+// Builds a matcher with the requested number of templates, all with two
+// variables, spread over distinct APIs the way a multi-API config lays
+// them out.
+PathMatcherPtr<BenchmarkMethod*> BuildBenchmarkMatcher(
+    int templates, std::vector<BenchmarkMethod>* methods) {
+  PathMatcherBuilder<BenchmarkMethod*> builder;
+  methods->resize(templates);
+  for (int i = 0; i < templates; ++i) {
+    builder.Register("GET",
+                     "/v1/api" + std::to_string(i) +
+                         "/shelves/{shelf}/books/{book}",
+                     std::string(), &(*methods)[i]);
+  }
+  return builder.Build();
+}
+
+// Measures a successful lookup (with variable binding extraction) against
+// matchers of growing size.
+void BM_PathMatcherLookup(benchmark::State& state) {
+  std::vector<BenchmarkMethod> methods;
+  auto matcher = BuildBenchmarkMatcher(state.range(0), &methods);
+  const std::string http_method = "GET";
+  const std::string path = "/v1/api" + std::to_string(state.range(0) / 2) +
+                           "/shelves/88/books/99";
+  const std::string query_params;
+
+  for (auto _ : state) {
+    std::vector<BenchmarkBinding> bindings;
+    std::string body_field_path;
+    BenchmarkMethod* method = matcher->Lookup(
+        http_method, path, query_params, &bindings, &body_field_path);
+    benchmark::DoNotOptimize(method);
+  }
+}
+BENCHMARK(BM_PathMatcherLookup)->Arg(8)->Arg(64)->Arg(512);
+
+// Measures the cost of rejecting a path that matches no template.
+void BM_PathMatcherLookupMiss(benchmark::State& state) {
+  std::vector<BenchmarkMethod> methods;
+  auto matcher = BuildBenchmarkMatcher(state.range(0), &methods);
+  const std::string http_method = "GET";
+  const std::string path = "/v1/unknown/shelves/88/books/99";
+
+  for (auto _ : state) {
+    BenchmarkMethod* method = matcher->Lookup(http_method, path);
+    benchmark::DoNotOptimize(method);
+  }
+}
+BENCHMARK(BM_PathMatcherLookupMiss)->Arg(8)->Arg(512);
+
+////////////////////////////////////////////////////////////////////////////////
+// Report proto fill
+////////////////////////////////////////////////////////////////////////////////
+
+service_control::ReportRequestInfo MakeReportRequestInfo() {
+  service_control::ReportRequestInfo info;
+  info.operation_id = "operation_id";
+  info.operation_name = "operation_name";
+  info.api_key = "api_key_x";
+  info.producer_project_id = "project_id";
+  info.referer = "referer";
+  info.response_code = 200;
+  info.location = "us-central";
+  info.api_name = "api-name";
+  info.api_version = "api-version";
+  info.api_method = "api-method";
+  info.request_size = 100;
+  info.response_size = 1024 * 1024;
+  info.log_message = "test-method is called";
+  info.latency.request_time_ms = 123;
+  info.latency.backend_time_ms = 101;
+  info.latency.overhead_time_ms = 22;
+  info.frontend_protocol = protocol::HTTP;
+  info.compute_platform = ComputePlatform::kGke;
+  info.auth_issuer = "auth-issuer";
+  info.auth_audience = "auth-audience";
+  info.request_bytes = 100;
+  info.response_bytes = 1024 * 1024;
+  return info;
+}
+
+void BM_FillReportRequest(benchmark::State& state) {
+  service_control::Proto scp({"local_test_log"}, "test_service",
+                             "2019-11-09r0");
+  service_control::ReportRequestInfo info = MakeReportRequestInfo();
+
+  for (auto _ : state) {
+    gasv1::ReportRequest request;
+    scp.FillReportRequest(info, &request);
+    benchmark::DoNotOptimize(&request);
+  }
+}
+BENCHMARK(BM_FillReportRequest);
+
+////////////////////////////////////////////////////////////////////////////////
+// JWT cache
+////////////////////////////////////////////////////////////////////////////////
+
+const int kJwtCount = 128;
+
+std::vector<std::string> MakeJwts() {
+  std::vector<std::string> jwts;
+  for (int i = 0; i < kJwtCount; ++i) {
+    // The values stand in for real tokens; only the size and the
+    // distribution over cache shards matter here.
+    jwts.push_back("header.payload-" + std::to_string(i) + "." +
+                   std::string(256, 'x'));
+  }
+  return jwts;
+}
+
+UserInfo MakeUserInfo() {
+  UserInfo user_info;
+  user_info.id = "id";
+  user_info.email = "end-user@example.com";
+  user_info.consumer_id = "consumer-id";
+  user_info.issuer = "https://issuer.example.com";
+  user_info.audiences.insert("aud1");
+  user_info.audiences.insert("aud2");
+  return user_info;
+}
+
+void BM_JwtCacheHit(benchmark::State& state) {
+  auth::JwtCache cache;
+  UserInfo user_info = MakeUserInfo();
+  auto now = std::chrono::system_clock::now();
+  std::vector<std::string> jwts = MakeJwts();
+  for (const auto& jwt : jwts) {
+    cache.Insert(jwt, user_info, now + std::chrono::hours(1), now);
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    auth::JwtCache::ScopedLookup lookup(&cache, jwts[i++ % kJwtCount]);
+    benchmark::DoNotOptimize(lookup.Found());
+  }
+}
+BENCHMARK(BM_JwtCacheHit);
+
+void BM_JwtCacheMiss(benchmark::State& state) {
+  auth::JwtCache cache;
+  std::vector<std::string> jwts = MakeJwts();
+
+  size_t i = 0;
+  for (auto _ : state) {
+    auth::JwtCache::ScopedLookup lookup(&cache, jwts[i++ % kJwtCount]);
+    benchmark::DoNotOptimize(lookup.Found());
+  }
+}
+BENCHMARK(BM_JwtCacheMiss);
+
+////////////////////////////////////////////////////////////////////////////////
+// Base64url decode
+////////////////////////////////////////////////////////////////////////////////
+
+// Decodes base64url payloads of JWT-segment-like sizes.
+void BM_Base64UrlDecode(benchmark::State& state) {
+  std::string data(state.range(0), '\0');
+  std::mt19937 gen(42);
+  for (auto& c : data) {
+    c = static_cast<char>(gen());
+  }
+  char* encoded = auth::esp_base64_encode(data.data(), data.size(),
+                                          true /* url_safe */,
+                                          false /* multiline */,
+                                          false /* padding */);
+  size_t encoded_len = strlen(encoded);
+
+  for (auto _ : state) {
+    grpc_slice decoded =
+        auth::esp_base64url_decode_with_len(encoded, encoded_len);
+    benchmark::DoNotOptimize(GRPC_SLICE_START_PTR(decoded));
+    grpc_slice_unref(decoded);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          encoded_len);
+  auth::esp_grpc_free(encoded);
+}
+BENCHMARK(BM_Base64UrlDecode)->Arg(64)->Arg(1024)->Arg(8192);
+
+////////////////////////////////////////////////////////////////////////////////
+// Service config marshalling
+////////////////////////////////////////////////////////////////////////////////
+
+// Parses the bookstore service config from testdata into the Service proto,
+// the dominant cost of a config rollout.
+void BM_ServiceConfigJsonToProto(benchmark::State& state) {
+  std::string json = ReadTestdata("bookstore_service_config_1.json");
+
+  for (auto _ : state) {
+    ::google::api::Service service;
+    utils::Status status = utils::JsonToProto(json, &service);
+    benchmark::DoNotOptimize(&status);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          json.size());
+}
+BENCHMARK(BM_ServiceConfigJsonToProto);
+
+void BM_ServiceConfigProtoToJson(benchmark::State& state) {
+  std::string json = ReadTestdata("bookstore_service_config_1.json");
+  ::google::api::Service service;
+  utils::JsonToProto(json, &service);
+
+  for (auto _ : state) {
+    std::string output;
+    utils::Status status =
+        utils::ProtoToJson(service, &output, utils::JsonOptions::DEFAULT);
+    benchmark::DoNotOptimize(&status);
+  }
+}
+BENCHMARK(BM_ServiceConfigProtoToJson);
+
+}  // namespace
+}  // namespace api_manager
+}  // namespace google
+
+BENCHMARK_MAIN();
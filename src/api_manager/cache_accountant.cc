@@ -0,0 +1,83 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/cache_accountant.h"
+
+namespace google {
+namespace api_manager {
+
+namespace {
+
+// The default interval between budget checks.
+const int kDefaultCheckIntervalMs = 1000;
+
+}  // namespace
+
+CacheAccountant::CacheAccountant(int64_t budget_in_bytes,
+                                 int check_interval_ms)
+    : budget_in_bytes_(budget_in_bytes),
+      check_interval_ms_(check_interval_ms > 0 ? check_interval_ms
+                                               : kDefaultCheckIntervalMs),
+      next_id_(0) {}
+
+int CacheAccountant::Register(const std::string &name, UsageFunc usage,
+                              ShedFunc shed) {
+  if (!enabled()) {
+    return -1;
+  }
+  std::lock_guard<std::mutex> lock(mu_);
+  const int id = next_id_++;
+  entries_.push_back(Entry{id, name, std::move(usage), std::move(shed)});
+  return id;
+}
+
+void CacheAccountant::Unregister(int id) {
+  if (id < 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mu_);
+  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+    if (it->id == id) {
+      entries_.erase(it);
+      return;
+    }
+  }
+}
+
+void CacheAccountant::EnforceBudget() {
+  if (!enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mu_);
+  int64_t total = 0;
+  for (const auto &entry : entries_) {
+    total += entry.usage();
+  }
+  if (total <= budget_in_bytes_) {
+    return;
+  }
+  // Shed down to 90% of the budget rather than its edge, so the caches
+  // do not climb right back over it before the next check.
+  const int64_t target = budget_in_bytes_ / 10 * 9;
+  const double fraction =
+      1.0 - static_cast<double>(target) / static_cast<double>(total);
+  for (const auto &entry : entries_) {
+    entry.shed(fraction);
+  }
+}
+
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,81 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_CACHE_ACCOUNTANT_H_
+#define API_MANAGER_CACHE_ACCOUNTANT_H_
+
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace google {
+namespace api_manager {
+
+// A global byte budget across ESP's in-process caches. Each cache
+// registers a usage callback (a best-effort estimate of its resident
+// bytes) and a shed callback (drop roughly the given fraction of the
+// cache). EnforceBudget, driven by a periodic timer, sums the estimates
+// and, when the total exceeds the budget, asks every cache to shed the
+// same fraction; each cache thus gives up bytes proportional to its share
+// of the total, and independently-sized caches cannot sum past the
+// process memory limit during a traffic spike.
+class CacheAccountant {
+ public:
+  // Returns the cache's estimated resident bytes.
+  typedef std::function<int64_t()> UsageFunc;
+  // Drops roughly the given fraction (0, 1] of the cache.
+  typedef std::function<void(double fraction)> ShedFunc;
+
+  // A budget of 0 or less disables accounting; registration and
+  // EnforceBudget become no-ops and only the per-cache limits apply.
+  CacheAccountant(int64_t budget_in_bytes, int check_interval_ms);
+
+  // Registers a cache under a diagnostic name; returns an id for
+  // Unregister. The callbacks must stay valid until Unregister returns.
+  int Register(const std::string &name, UsageFunc usage, ShedFunc shed);
+  void Unregister(int id);
+
+  // Sums the registered usage estimates and triggers proportional
+  // shedding when the total exceeds the budget.
+  void EnforceBudget();
+
+  bool enabled() const { return budget_in_bytes_ > 0; }
+  int64_t budget_in_bytes() const { return budget_in_bytes_; }
+  int check_interval_ms() const { return check_interval_ms_; }
+
+ private:
+  struct Entry {
+    int id;
+    std::string name;
+    UsageFunc usage;
+    ShedFunc shed;
+  };
+
+  const int64_t budget_in_bytes_;
+  const int check_interval_ms_;
+
+  // Guards entries_. Registration happens on config deployment and
+  // enforcement on a timer, both on the main thread today; the mutex
+  // keeps the class safe if either ever moves off it.
+  std::mutex mu_;
+  int next_id_;
+  std::vector<Entry> entries_;
+};
+
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_CACHE_ACCOUNTANT_H_
@@ -0,0 +1,105 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/cache_accountant.h"
+#include "gtest/gtest.h"
+
+namespace google {
+namespace api_manager {
+namespace {
+
+// A fake cache whose usage drops by the requested fraction on shed.
+struct FakeCache {
+  int64_t bytes;
+  int sheds;
+
+  void Shed(double fraction) {
+    bytes -= static_cast<int64_t>(bytes * fraction);
+    ++sheds;
+  }
+};
+
+TEST(CacheAccountantTest, DisabledBudgetNeverSheds) {
+  CacheAccountant accountant(0, 0);
+  ASSERT_FALSE(accountant.enabled());
+
+  FakeCache cache{1 << 30, 0};
+  accountant.Register(
+      "cache", [&cache]() { return cache.bytes; },
+      [&cache](double fraction) { cache.Shed(fraction); });
+  accountant.EnforceBudget();
+  ASSERT_EQ(0, cache.sheds);
+}
+
+TEST(CacheAccountantTest, UnderBudgetDoesNotShed) {
+  CacheAccountant accountant(1000, 0);
+  ASSERT_TRUE(accountant.enabled());
+  ASSERT_EQ(1000, accountant.budget_in_bytes());
+
+  FakeCache cache{900, 0};
+  accountant.Register(
+      "cache", [&cache]() { return cache.bytes; },
+      [&cache](double fraction) { cache.Shed(fraction); });
+  accountant.EnforceBudget();
+  ASSERT_EQ(0, cache.sheds);
+}
+
+TEST(CacheAccountantTest, OverBudgetShedsProportionally) {
+  CacheAccountant accountant(1000, 0);
+
+  FakeCache big{1500, 0};
+  FakeCache small{500, 0};
+  accountant.Register(
+      "big", [&big]() { return big.bytes; },
+      [&big](double fraction) { big.Shed(fraction); });
+  accountant.Register(
+      "small", [&small]() { return small.bytes; },
+      [&small](double fraction) { small.Shed(fraction); });
+
+  accountant.EnforceBudget();
+  ASSERT_EQ(1, big.sheds);
+  ASSERT_EQ(1, small.sheds);
+  // Both caches shed the same fraction, down to 90% of the budget in
+  // total, so the 3:1 usage ratio is preserved.
+  ASSERT_LE(big.bytes + small.bytes, 900);
+  ASSERT_NEAR(3.0, static_cast<double>(big.bytes) / small.bytes, 0.05);
+
+  // Back under budget; the next check is a no-op.
+  accountant.EnforceBudget();
+  ASSERT_EQ(1, big.sheds);
+}
+
+TEST(CacheAccountantTest, UnregisteredCacheIsNotShed) {
+  CacheAccountant accountant(1000, 0);
+
+  FakeCache kept{2000, 0};
+  FakeCache gone{2000, 0};
+  accountant.Register(
+      "kept", [&kept]() { return kept.bytes; },
+      [&kept](double fraction) { kept.Shed(fraction); });
+  const int gone_id = accountant.Register(
+      "gone", [&gone]() { return gone.bytes; },
+      [&gone](double fraction) { gone.Shed(fraction); });
+  accountant.Unregister(gone_id);
+
+  accountant.EnforceBudget();
+  ASSERT_EQ(1, kept.sheds);
+  ASSERT_EQ(0, gone.sheds);
+}
+
+}  // namespace
+}  // namespace api_manager
+}  // namespace google
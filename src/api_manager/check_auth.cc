@@ -27,6 +27,7 @@
 #include "src/api_manager/auth/lib/json.h"
 #include "src/api_manager/auth/lib/json_util.h"
 #include "src/api_manager/cloud_trace/cloud_trace.h"
+#include "src/api_manager/utils/clock.h"
 #include "src/api_manager/utils/url_util.h"
 
 using ::google::api_manager::auth::Certs;
@@ -36,7 +37,6 @@ using ::google::api_manager::auth::JwtValidator;
 using ::google::api_manager::auth::JwtValue;
 using ::google::api_manager::utils::Status;
 using ::google::protobuf::util::error::Code;
-using std::chrono::system_clock;
 
 namespace google {
 namespace api_manager {
@@ -90,6 +90,10 @@ class AuthChecker : public std::enable_shared_from_this<AuthChecker> {
 
   void VerifySignature();
 
+  // Continuation of VerifySignature; runs on the event loop with the
+  // verification result.
+  void PostVerifySignature(Status status);
+
   void PassUserInfoOnSuccess();
 
   /*** Helper functions ***/
@@ -104,6 +108,13 @@ class AuthChecker : public std::enable_shared_from_this<AuthChecker> {
   // Authentication error
   void Unauthenticated(const std::string &error);
 
+  // Authentication error for a token-intrinsic verdict (bad structure,
+  // expired, failed signature): remembers the denial in the JWT cache so
+  // replays of the same token skip parsing and signature work. Method-
+  // dependent rejections (issuer/audience) and fetch failures must not
+  // go through here.
+  void DenyAndCache(const std::string &error);
+
   // Authorization error
   void Unauthorized(const std::string &error);
 
@@ -192,15 +203,27 @@ void AuthChecker::GetAuthToken() {
 void AuthChecker::LookupJwtCache() {
   bool remove = false;  // whether or not need to remove an expired entry.
   bool cache_hit = false;
+  bool denied = false;
+  std::string deny_error;
   JwtCache &jwt_cache = context_->service_context()->jwt_cache();
   {
     JwtCache::ScopedLookup lookup(&jwt_cache, auth_token_);
     if (lookup.Found()) {
       JwtValue *val = lookup.value();
-      if (system_clock::now() <= val->exp) {
+      // Cache expirations are second-granular; the coarse clocks are
+      // plenty and avoid a clock syscall per authenticated request. The
+      // entry TTL is on the steady clock; only the token's own "exp"
+      // claim is compared against wall time.
+      if (utils::CoarseSteadyNow() <= val->cache_exp &&
+          utils::CoarseNow() <= val->token_exp) {
         // Cache hit and cache entry is not expired.
-        user_info_ = val->user_info;
-        cache_hit = true;
+        if (val->denied) {
+          denied = true;
+          deny_error = val->error;
+        } else {
+          user_info_ = val->user_info;
+          cache_hit = true;
+        }
       } else {
         // Need to removes the expired cache entry.
         remove = true;
@@ -211,6 +234,12 @@ void AuthChecker::LookupJwtCache() {
     jwt_cache.Remove(auth_token_);
   }
 
+  if (denied) {
+    // The same token was already rejected for a token-intrinsic reason;
+    // replay the verdict without re-parsing or re-verifying.
+    Unauthenticated(deny_error);
+    return;
+  }
   if (cache_hit) {
     CheckAudience(true);
   } else {
@@ -219,6 +248,16 @@ void AuthChecker::LookupJwtCache() {
 }
 
 void AuthChecker::ParseJwt() {
+  // Cheap gate: reject tokens that cannot possibly verify (wrong segment
+  // count, expired "exp" visible in the payload) before any parsing or
+  // crypto work, and remember the verdict so replays of the same token
+  // are answered from the deny cache.
+  Status gate = auth::JwtPreCheck(auth_token_.c_str(), auth_token_.size());
+  if (!gate.ok()) {
+    DenyAndCache(gate.message());
+    return;
+  }
+
   if (validator_ == nullptr) {
     validator_ = JwtValidator::Create(auth_token_.c_str(), auth_token_.size());
     if (validator_ == nullptr) {
@@ -229,7 +268,7 @@ void AuthChecker::ParseJwt() {
 
   Status status = validator_->Parse(&user_info_);
   if (!status.ok()) {
-    Unauthenticated(status.message());
+    DenyAndCache(status.message());
     return;
   }
   CheckAudience(false);
@@ -247,10 +286,6 @@ void AuthChecker::CheckAudience(bool cache_hit) {
 
   // Remove http/s header and trailing '/' for issuer.
   std::string issuer = utils::GetUrlContent(user_info_.issuer);
-  if (!context_->method()->isIssuerAllowed(issuer)) {
-    Unauthenticated("Issuer not allowed");
-    return;
-  }
 
   // The audience from the JWT must
   //   - Equals to service_name or
@@ -262,10 +297,19 @@ void AuthChecker::CheckAudience(bool cache_hit) {
   for (auto &it : user_info_.audiences) {
     aud.insert(utils::GetUrlContent(it));
   }
-  if (aud.find(service_name) == aud.end() &&
-      !context_->method()->isAudienceAllowed(issuer, aud)) {
-    Unauthorized("Audience not allowed");
-    return;
+  // One lookup in the method's issuer index answers both checks.
+  switch (context_->method()->isIssuerAudienceAllowed(issuer, aud)) {
+    case MethodInfo::ISSUER_NOT_ALLOWED:
+      Unauthenticated("Issuer not allowed");
+      return;
+    case MethodInfo::AUDIENCE_NOT_ALLOWED:
+      if (aud.find(service_name) == aud.end()) {
+        Unauthorized("Audience not allowed");
+        return;
+      }
+      break;
+    case MethodInfo::ISSUER_AUDIENCE_ALLOWED:
+      break;
   }
   if (cache_hit) {
     PassUserInfoOnSuccess();
@@ -278,7 +322,14 @@ void AuthChecker::InitKey() {
   Certs &key_cache = context_->service_context()->certs();
   auto cert = key_cache.GetCert(user_info_.issuer);
 
-  if (cert == nullptr || system_clock::now() > cert->second) {
+  // Serve a slightly-stale key for up to one extra cache duration while the
+  // background refresher replaces it; only block this request on a fetch
+  // when the key is missing or too old.
+  const int cache_duration_in_s =
+      context_->service_context()->global_context()->jwks_cache_duration_in_s();
+  if (cert == nullptr ||
+      utils::CoarseNow() >
+          cert->second + std::chrono::seconds(cache_duration_in_s)) {
     // Key has not been fetched or has expired.
     std::string url;
     bool tryOpenId =
@@ -358,7 +409,7 @@ void AuthChecker::PostFetchPubKey(Status status, std::string &&body) {
       context_->service_context()->global_context()->jwks_cache_duration_in_s();
   key_cache.Update(
       user_info_.issuer, std::move(body),
-      system_clock::now() + std::chrono::seconds(cache_duration_in_s));
+      utils::CoarseNow() + std::chrono::seconds(cache_duration_in_s));
   VerifySignature();
 }
 
@@ -370,17 +421,56 @@ void AuthChecker::VerifySignature() {
     return;
   }
 
-  Status status =
-      validator_->VerifySignature(cert->first.c_str(), cert->first.size());
+  // Prefer keys parsed ahead of time; they are absent when the cached
+  // document is not a JWK or x509 key set (e.g. an HS shared secret).
+  std::shared_ptr<auth::JwtPublicKeys> pkeys =
+      key_cache.GetPublicKeys(user_info_.issuer);
+
+  auth::JwtVerifyPool *pool =
+      context_->service_context()->global_context()->jwt_verify_pool();
+  if (pool == nullptr) {
+    PostVerifySignature(
+        pkeys != nullptr
+            ? validator_->VerifySignature(*pkeys)
+            : validator_->VerifySignature(cert->first.c_str(),
+                                          cert->first.size()));
+    return;
+  }
+
+  // RSA verification is a few hundred microseconds of pure CPU, so hand it
+  // to the verification pool instead of running it inline on the event
+  // loop. The shared_ptr (or the copied key) keeps the key material alive
+  // even if the cert cache is refreshed on the event loop while a pool
+  // thread reads it.
+  pool->Init();
+  auto pChecker = GetPtr();
+  if (pkeys != nullptr) {
+    pool->Dispatch(
+        [pChecker, pkeys]() {
+          return pChecker->validator_->VerifySignature(*pkeys);
+        },
+        [pChecker](Status status) { pChecker->PostVerifySignature(status); });
+    return;
+  }
+  std::string pkey = cert->first;
+  pool->Dispatch(
+      [pChecker, pkey]() {
+        return pChecker->validator_->VerifySignature(pkey.c_str(),
+                                                     pkey.size());
+      },
+      [pChecker](Status status) { pChecker->PostVerifySignature(status); });
+}
+
+void AuthChecker::PostVerifySignature(Status status) {
   if (!status.ok()) {
-    Unauthenticated(status.message());
+    DenyAndCache(status.message());
     return;
   }
 
   // Inserts the entry to JwtCache.
   JwtCache &cache = context_->service_context()->jwt_cache();
   cache.Insert(auth_token_, user_info_, validator_->GetExpirationTime(),
-               system_clock::now());
+               utils::CoarseSteadyNow());
 
   PassUserInfoOnSuccess();
 }
@@ -410,6 +500,12 @@ void AuthChecker::Unauthenticated(const std::string &error) {
                   Status::AUTH));
 }
 
+void AuthChecker::DenyAndCache(const std::string &error) {
+  context_->service_context()->jwt_cache().InsertDenial(
+      auth_token_, error, utils::CoarseSteadyNow());
+  Unauthenticated(error);
+}
+
 void AuthChecker::Unauthorized(const std::string &error) {
   TRACE(trace_span_) << "Authorization failed: " << error;
   trace_span_.reset();
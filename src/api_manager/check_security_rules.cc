@@ -19,6 +19,7 @@
 #include <sstream>
 #include "src/api_manager/auth/lib/json_util.h"
 #include "src/api_manager/firebase_rules/firebase_request.h"
+#include "src/api_manager/utils/clock.h"
 #include "src/api_manager/utils/marshalling.h"
 
 using ::google::api_manager::auth::AuthzCache;
@@ -47,6 +48,11 @@ const std::string kRulesetName = "rulesetName";
 const std::string kContentType = "Content-Type";
 const std::string kApplication = "application/json";
 
+// How long a fetched ruleset name is reused before the release is fetched
+// again. Kept short so rules deployments take effect quickly; cached
+// verdicts are keyed by ruleset name, so a new ruleset invalidates them.
+const int kRulesetCacheTimeout = 60;
+
 std::string GetReleaseName(const context::RequestContext &context) {
   return context.service_context()->service_name() + ":" +
          context.service_context()->service().apis(0).version();
@@ -85,6 +91,13 @@ class AuthzChecker : public std::enable_shared_from_this<AuthzChecker> {
   void InsertCache(std::shared_ptr<context::RequestContext> context,
                    int status_code);
 
+  // Compose the verdict cache key for this request against ruleset_id_.
+  std::string ComposeCacheKey(context::RequestContext &context);
+
+  // Start the TestRuleset exchange against ruleset_id_.
+  void CallTestRuleset(std::shared_ptr<context::RequestContext> context,
+                       std::function<void(Status status)> continuation);
+
   // Parse the response for GET RELEASE API call
   Status ParseReleaseResponse(const std::string &json_str,
                               std::string *ruleset_id);
@@ -100,6 +113,9 @@ class AuthzChecker : public std::enable_shared_from_this<AuthzChecker> {
 
   ApiManagerEnvInterface *env_;
   auth::ServiceAccountToken *sa_token_;
+  // The ruleset the verdict is computed against, from the per-service
+  // release cache or a release fetch.
+  std::string ruleset_id_;
   std::unique_ptr<FirebaseRequest> request_handler_;
 };
 
@@ -107,14 +123,26 @@ AuthzChecker::AuthzChecker(ApiManagerEnvInterface *env,
                            auth::ServiceAccountToken *sa_token)
     : env_(env), sa_token_(sa_token) {}
 
+std::string AuthzChecker::ComposeCacheKey(context::RequestContext &context) {
+  // Identify the caller by their verified auth claims when present, so a
+  // re-issued token for the same user still hits; fall back to the raw
+  // token otherwise.
+  const std::string &caller_id = context.auth_claims().empty()
+                                     ? context.AuthToken()
+                                     : context.auth_claims();
+  return AuthzCache::ComposeAuthzCacheKey(
+      ruleset_id_, caller_id, context.request()->GetRequestPath(),
+      context.request()->GetRequestHTTPMethod());
+}
+
 bool AuthzChecker::CheckCache(
     std::shared_ptr<context::RequestContext> context,
     std::function<void(Status status)> final_continuation) {
   AuthzValue val;
-  std::string cache_key = AuthzCache::ComposeAuthzCacheKey(
-      context->AuthToken(), context->request()->GetRequestPath(),
-      context->request()->GetRequestHTTPMethod());
-  system_clock::time_point now = system_clock::now();
+  std::string cache_key = ComposeCacheKey(*context);
+  // Verdict TTLs are pure durations, so they live on the coarse steady
+  // clock and survive wall clock adjustments.
+  std::chrono::steady_clock::time_point now = utils::CoarseSteadyNow();
 
   if (context->service_context()->authz_cache().Lookup(cache_key, now, &val)) {
     if (val.if_success) {
@@ -143,52 +171,73 @@ void AuthzChecker::Check(
     return;
   }
 
-  if (!CheckCache(context, final_continuation)) {
-    auto checker = GetPtr();
-    // Fetch the Release attributes and get ruleset name.
-    HttpFetch(GetReleaseUrl(*context), kHttpGetMethod, "",
-              auth::ServiceAccountToken::JWT_TOKEN_FOR_FIREBASE,
-              context->service_context()->config()->GetFirebaseAudience(),
-              [context, final_continuation, checker](Status status,
-                                                     std::string &&body) {
-                std::string ruleset_id;
-                if (status.ok()) {
-                  checker->env_->LogDebug(
-                      std::string("GetReleasName succeeded with ") + body);
-                  status = checker->ParseReleaseResponse(body, &ruleset_id);
-                } else {
-                  checker->env_->LogError(std::string("GetReleaseName for ") +
-                                          GetReleaseUrl(*context.get()) +
-                                          " with status " + status.ToString());
-                  status = Status(Code::INTERNAL, kFailedFirebaseReleaseFetch);
-                }
+  // The verdict cache is keyed by ruleset name; with a cached ruleset a
+  // repeat caller skips the Firebase round trips entirely.
+  ruleset_id_ =
+      context->service_context()->firebase_ruleset_id(system_clock::now());
+  if (!ruleset_id_.empty()) {
+    if (!CheckCache(context, final_continuation)) {
+      CallTestRuleset(context, final_continuation);
+    }
+    return;
+  }
 
-                // If the parsing of the release body is successful, then call
-                // the
-                // Test Api for firebase rules service.
-                if (status.ok()) {
-                  checker->request_handler_ = std::unique_ptr<FirebaseRequest>(
-                      new FirebaseRequest(ruleset_id, checker->env_, context));
-                  checker->CallNextRequest(context, final_continuation);
-                } else {
-                  final_continuation(status);
+  auto checker = GetPtr();
+  // Fetch the Release attributes and get ruleset name.
+  HttpFetch(GetReleaseUrl(*context), kHttpGetMethod, "",
+            auth::ServiceAccountToken::JWT_TOKEN_FOR_FIREBASE,
+            context->service_context()->config()->GetFirebaseAudience(),
+            [context, final_continuation, checker](Status status,
+                                                   std::string &&body) {
+              std::string ruleset_id;
+              if (status.ok()) {
+                checker->env_->LogDebug(
+                    std::string("GetReleasName succeeded with ") + body);
+                status = checker->ParseReleaseResponse(body, &ruleset_id);
+              } else {
+                checker->env_->LogError(std::string("GetReleaseName for ") +
+                                        GetReleaseUrl(*context.get()) +
+                                        " with status " + status.ToString());
+                status = Status(Code::INTERNAL, kFailedFirebaseReleaseFetch);
+              }
+
+              // If the parsing of the release body is successful, then call
+              // the
+              // Test Api for firebase rules service.
+              if (status.ok()) {
+                checker->ruleset_id_ = ruleset_id;
+                context->service_context()->set_firebase_ruleset_id(
+                    ruleset_id,
+                    system_clock::now() +
+                        std::chrono::seconds(kRulesetCacheTimeout));
+                // Verdicts computed against this ruleset may still be
+                // cached from before the release cache entry expired.
+                if (!checker->CheckCache(context, final_continuation)) {
+                  checker->CallTestRuleset(context, final_continuation);
                 }
-              });
-  }
+              } else {
+                final_continuation(status);
+              }
+            });
 }
 
 void AuthzChecker::InsertCache(std::shared_ptr<context::RequestContext> context,
                                int status_code) {
   if (status_code == Code::OK || status_code == Code::PERMISSION_DENIED) {
     bool res = (status_code == Code::OK) ? true : false;
-    std::string cache_key = AuthzCache::ComposeAuthzCacheKey(
-        context->AuthToken(), context->request()->GetRequestPath(),
-        context->request()->GetRequestHTTPMethod());
-    context->service_context()->authz_cache().Add(cache_key, res,
-                                                  system_clock::now());
+    context->service_context()->authz_cache().Add(
+        ComposeCacheKey(*context), res, utils::CoarseSteadyNow());
   }
 }
 
+void AuthzChecker::CallTestRuleset(
+    std::shared_ptr<context::RequestContext> context,
+    std::function<void(Status status)> continuation) {
+  request_handler_ = std::unique_ptr<FirebaseRequest>(
+      new FirebaseRequest(ruleset_id_, env_, context));
+  CallNextRequest(context, continuation);
+}
+
 void AuthzChecker::CallNextRequest(
     std::shared_ptr<context::RequestContext> context,
     std::function<void(Status status)> continuation) {
@@ -199,23 +248,47 @@ void AuthzChecker::CallNextRequest(
     return;
   }
   auto checker = GetPtr();
-  firebase_rules::HttpRequest http_request = request_handler_->GetHttpRequest();
-  HttpFetch(
-      http_request.url, http_request.method, http_request.body,
-      http_request.token_type, http_request.audience,
-      [context, continuation, checker](Status status, std::string &&body) {
-        checker->env_->LogInfo(std::string("Response Body = ") + body);
-        if (status.ok() && !body.empty() && body != "{}") {
-          checker->request_handler_->UpdateResponse(body);
-          checker->CallNextRequest(context, continuation);
-        } else {
-          checker->env_->LogError(
-              std::string("Test API failed with ") +
-              (status.ok() ? "Empty Response" : status.ToString()));
-          status = Status(Code::INTERNAL, kFailedFirebaseTest);
-          continuation(status);
-        }
-      });
+  std::vector<firebase_rules::HttpRequest> http_requests =
+      request_handler_->GetHttpRequests();
+  if (http_requests.empty()) {
+    continuation(request_handler_->RequestStatus());
+    return;
+  }
+
+  // The requests in a batch are independent function call fetches; issue
+  // them all concurrently and hand the responses back to the request
+  // handler once the last one arrives.
+  auto responses =
+      std::make_shared<std::vector<std::string>>(http_requests.size());
+  auto pending = std::make_shared<size_t>(http_requests.size());
+  auto failed = std::make_shared<bool>(false);
+  for (size_t i = 0; i < http_requests.size(); i++) {
+    const firebase_rules::HttpRequest &http_request = http_requests[i];
+    HttpFetch(http_request.url, http_request.method, http_request.body,
+              http_request.token_type, http_request.audience,
+              [context, continuation, checker, responses, pending, failed, i](
+                  Status status, std::string &&body) {
+                checker->env_->LogInfo(std::string("Response Body = ") + body);
+                if (status.ok() && !body.empty() && body != "{}") {
+                  (*responses)[i] = std::move(body);
+                } else {
+                  checker->env_->LogError(
+                      std::string("Test API failed with ") +
+                      (status.ok() ? "Empty Response" : status.ToString()));
+                  *failed = true;
+                }
+
+                if (--(*pending) > 0) {
+                  return;
+                }
+                if (*failed) {
+                  continuation(Status(Code::INTERNAL, kFailedFirebaseTest));
+                  return;
+                }
+                checker->request_handler_->UpdateResponses(*responses);
+                checker->CallNextRequest(context, continuation);
+              });
+  }
 }
 
 Status AuthzChecker::ParseReleaseResponse(const std::string &json_str,
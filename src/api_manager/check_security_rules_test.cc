@@ -469,7 +469,8 @@ TEST_F(CheckSecurityRulesTest, NoCachingOnBadStatus) {
   ExpectCall(ruleset_test_url_, "POST", kFirstRequest,
              BuildTestRulesetResponse(false),
              Status(Code::INTERNAL, "Cannot talk to server"));
-  ExpectCall(release_url_, "GET", "", kRelease);
+  // No verdict was cached, but the ruleset name was; the retry skips the
+  // release fetch and goes straight to TestRuleset.
   ExpectCall(ruleset_test_url_, "POST", kFirstRequest,
              BuildTestRulesetResponse(false));
 
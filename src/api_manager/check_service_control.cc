@@ -87,6 +87,10 @@ void CheckServiceControl(std::shared_ptr<context::RequestContext> context,
         if (!info.consumer_project_id.empty()) {
           context->request()->AddHeaderToBackend(kConsumerProjecId,
                                                  info.consumer_project_id);
+          // Remember the mapping so report fill can recover the consumer
+          // project of later requests whose Check does not resolve it.
+          context->service_context()->consumer_project_cache().Insert(
+              context->api_key(), info.consumer_project_id);
         }
 
         continuation(status);
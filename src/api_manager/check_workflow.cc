@@ -22,31 +22,99 @@
 #include "src/api_manager/quota_control.h"
 
 using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::Code;
 
 namespace google {
 namespace api_manager {
 
+namespace {
+
+// Matches the re-fetch window of the token fetch handler in
+// fetch_metadata.cc: a token lasting at least this much longer (in
+// seconds) does not trigger a fetch.
+const time_t kTokenRefetchWindow = 60;
+
+// True when FetchServiceAccountToken would complete without fetching:
+// no metadata server configured, a client auth secret, or a token that
+// is still fresh. The report-only fast path requires this, so bypassing
+// the fetch step cannot starve the report flush of its token.
+bool ServiceAccountTokenIsFresh(context::ServiceContext* service_context) {
+  auth::ServiceAccountToken* token = service_context->service_account_token();
+  if (service_context->metadata_server().empty() ||
+      token->has_client_secret()) {
+    return true;
+  }
+  return token->state() == auth::ServiceAccountToken::FETCHED &&
+         token->is_access_token_valid(kTokenRefetchWindow);
+}
+
+// The rejection status for requests over their method's concurrent
+// request limit, built once; maps to HTTP 429.
+const Status& TooManyRequestsStatus() {
+  static const Status status(Code::RESOURCE_EXHAUSTED,
+                             "Method concurrent request limit exceeded");
+  return status;
+}
+
+}  // namespace
+
 void CheckWorkflow::RegisterAll() {
   // Fetches service account token.
-  Register(FetchServiceAccountToken);
+  Register(FetchServiceAccountToken, &CheckLatencyStatistics::fetch_token,
+           &context::PhaseLatency::fetch_token);
   // Fetches instance identity token.
-  Register(FetchInstanceIdentityToken);
+  Register(FetchInstanceIdentityToken, &CheckLatencyStatistics::fetch_token,
+           &context::PhaseLatency::fetch_token);
   // Authentication checks.
-  Register(CheckAuth);
+  Register(CheckAuth, &CheckLatencyStatistics::auth,
+           &context::PhaseLatency::auth);
   // Check Security Rules.
-  Register(CheckSecurityRules);
+  Register(CheckSecurityRules, &CheckLatencyStatistics::security_rules,
+           &context::PhaseLatency::security_rules);
   // Checks service control.
-  Register(CheckServiceControl);
+  Register(CheckServiceControl, &CheckLatencyStatistics::service_control,
+           &context::PhaseLatency::service_control);
   // Quota control
-  Register(QuotaControl);
+  Register(QuotaControl, &CheckLatencyStatistics::quota,
+           &context::PhaseLatency::quota);
 }
 
-void CheckWorkflow::Register(CheckHandler handler) {
-  handlers_.push_back(handler);
+void CheckWorkflow::Register(
+    CheckHandler handler, LatencyHistogram CheckLatencyStatistics::*histogram,
+    uint64_t context::PhaseLatency::*phase) {
+  handlers_.push_back({handler, histogram, phase});
 }
 
 void CheckWorkflow::Run(std::shared_ptr<context::RequestContext> context) {
+  // Admission control: a single atomic acquire against the method's
+  // concurrent request limit. The token is released when the context is
+  // destroyed, after the whole request including the backend call.
+  if (!context->AcquireMethodConcurrency()) {
+    context->CompleteCheck(TooManyRequestsStatus());
+    return;
+  }
+  // Fast path: when every handler would be a no-op for the resolved
+  // method, complete right away instead of walking the handler chain and
+  // allocating its continuations.
+  if (context->method() != nullptr && context->method()->skip_all_checks()) {
+    context->CompleteCheck(Status::OK);
+    return;
+  }
+  // Report-only fast path: the method needs no auth, no Check call and
+  // no quota, so the request goes straight to the proxy; only its report
+  // is sent, queued fire-and-forget through the report aggregation
+  // cache. The freshness guard keeps the bypassed fetch step from
+  // starving that report flush of its service account token.
+  if (context->method() != nullptr && context->method()->report_only() &&
+      ServiceAccountTokenIsFresh(context->service_context())) {
+    context->CompleteCheck(Status::OK);
+    return;
+  }
   if (!handlers_.empty()) {
+    // The workflow position and a self reference are stored in the
+    // context so each step's continuation only needs the raw context
+    // pointer; see RunOneHandler.
+    context->BeginCheckWorkflow(this, context);
     RunOneHandler(context, 0);
   } else {
     // Empty check handler list means: not need to check.
@@ -56,14 +124,52 @@ void CheckWorkflow::Run(std::shared_ptr<context::RequestContext> context) {
 
 void CheckWorkflow::RunOneHandler(
     std::shared_ptr<context::RequestContext> context, size_t index) {
-  handlers_[index](context, [context, index, this](Status status) {
-    if (status.ok() && index + 1 < handlers_.size()) {
-      RunOneHandler(context, index + 1);
-    } else {
-      context->CompleteCheck(status);
-    }
+  // The continuation captures a single raw pointer, so it fits in
+  // std::function's small object buffer and running a handler does not
+  // heap-allocate. The context is kept alive by the self reference taken
+  // in Run() until the workflow completes.
+  context::RequestContext *ctx = context.get();
+  if (ctx->service_context()->check_latency_statistics_enabled() ||
+      ctx->latency_attribution_requested()) {
+    ctx->set_check_phase_start_time(std::chrono::steady_clock::now());
+  }
+  handlers_[index].handler(context, [ctx](Status status) {
+    ctx->check_workflow()->Continue(ctx, status);
   });
 }
 
+void CheckWorkflow::Continue(context::RequestContext *ctx, Status status) {
+  context::ServiceContext *service_context = ctx->service_context();
+  const bool statistics_enabled =
+      service_context->check_latency_statistics_enabled();
+  const bool attribution_requested = ctx->latency_attribution_requested();
+  if (statistics_enabled || attribution_requested) {
+    uint64_t elapsed_micros =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - ctx->check_phase_start_time())
+            .count();
+    if (statistics_enabled) {
+      (service_context->check_latency_statistics()->*
+       handlers_[ctx->check_workflow_index()].histogram)
+          .Record(elapsed_micros);
+    }
+    if (attribution_requested) {
+      ctx->phase_latency()->*handlers_[ctx->check_workflow_index()].phase +=
+          elapsed_micros;
+    }
+  }
+  size_t next_index = ctx->check_workflow_index() + 1;
+  if (status.ok() && next_index < handlers_.size()) {
+    ctx->set_check_workflow_index(next_index);
+    RunOneHandler(ctx->check_workflow_self(), next_index);
+  } else {
+    // Drop the self reference first so the context can go away once the
+    // final check continuation has run.
+    std::shared_ptr<context::RequestContext> context =
+        ctx->ReleaseCheckWorkflowSelf();
+    context->CompleteCheck(status);
+  }
+}
+
 }  // namespace api_manager
 }  // namespace google
@@ -15,16 +15,18 @@
 #ifndef API_MANAGER_CHECK_WORKFLOW_H_
 #define API_MANAGER_CHECK_WORKFLOW_H_
 
+#include "include/api_manager/api_manager.h"
 #include "include/api_manager/utils/status.h"
 #include "src/api_manager/context/request_context.h"
 
 namespace google {
 namespace api_manager {
 
-// The prototype for CheckHandler
-typedef std::function<void(std::shared_ptr<context::RequestContext>,
-                           std::function<void(utils::Status)>)>
-    CheckHandler;
+// The prototype for CheckHandler. All handlers are free functions, so a
+// plain function pointer is enough; it keeps the handler table free of
+// std::function wrappers.
+typedef void (*CheckHandler)(std::shared_ptr<context::RequestContext>,
+                             std::function<void(utils::Status)>);
 
 // A workflow to run all CheckHandlers
 class CheckWorkflow {
@@ -37,17 +39,35 @@ class CheckWorkflow {
   // Runs the workflow to call each check handler sequentially.
   void Run(std::shared_ptr<context::RequestContext> context);
 
+  // Continues the workflow after the current handler completed with
+  // status. Called by the per-step continuation, which only carries the
+  // raw context pointer; the workflow position and the reference keeping
+  // the context alive live in the context itself.
+  void Continue(context::RequestContext *ctx, utils::Status status);
+
  private:
+  // A registered check handler plus the histogram its latency is
+  // recorded into when per-phase latency statistics are enabled, and
+  // the per-request accumulator it adds to when the client opted into
+  // latency attribution.
+  struct HandlerEntry {
+    CheckHandler handler;
+    LatencyHistogram CheckLatencyStatistics::*histogram;
+    uint64_t context::PhaseLatency::*phase;
+  };
+
   // Registers a check handler. The order is important.
   // They will be executed in the order they are registered.
-  void Register(CheckHandler handler);
+  void Register(CheckHandler handler,
+                LatencyHistogram CheckLatencyStatistics::*histogram,
+                uint64_t context::PhaseLatency::*phase);
 
   // Runs one check handler with index.
   void RunOneHandler(std::shared_ptr<context::RequestContext> context,
                      size_t index);
 
   // A vector to store all check handlers.
-  std::vector<CheckHandler> handlers_;
+  std::vector<HandlerEntry> handlers_;
 };
 
 }  // namespace api_manager
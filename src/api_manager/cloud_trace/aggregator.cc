@@ -16,6 +16,8 @@
 //
 #include "src/api_manager/cloud_trace/aggregator.h"
 
+#include <vector>
+
 #include "src/api_manager/utils/marshalling.h"
 
 using google::api_manager::utils::Status;
@@ -29,6 +31,16 @@ namespace {
 
 const char kCloudTraceService[] = "/google.devtools.cloudtrace.v1.TraceService";
 
+// The byte budget of one PatchTraces request, measured on the binary proto
+// size of the traces (the JSON body is roughly proportional). A flush with
+// a larger backlog is split into multiple requests.
+const size_t kMaxFlushChunkBytes = 1024 * 1024;
+
+// The maximum number of requests one flush may send. When the backlog
+// exceeds kMaxFlushChunks * kMaxFlushChunkBytes, the oldest traces are
+// dropped and counted.
+const size_t kMaxFlushChunks = 8;
+
 }  // namespace
 
 Aggregator::Aggregator(auth::ServiceAccountToken *sa_token,
@@ -41,6 +53,8 @@ Aggregator::Aggregator(auth::ServiceAccountToken *sa_token,
       cache_max_size_(cache_max_size),
       traces_(new Traces),
       env_(env),
+      dropped_traces_(0),
+      upload_budget_(nullptr),
       sampler_(minimum_qps) {
   sa_token_->SetAudience(auth::ServiceAccountToken::JWT_TOKEN_FOR_CLOUD_TRACING,
                          cloud_trace_address_ + kCloudTraceService);
@@ -50,6 +64,8 @@ void Aggregator::Init() {
   if (aggregate_time_millisec_ == 0) {
     return;
   }
+  flush_thread_.reset(new service_control::ReportFlushThread(env_));
+  flush_thread_->Init();
   timer_ = env_->StartPeriodicTimer(
       std::chrono::milliseconds(aggregate_time_millisec_),
       [this]() { SendAndClearTraces(); });
@@ -70,11 +86,65 @@ void Aggregator::SendAndClearTraces() {
     return;
   }
 
-  // Add project id into each trace object.
-  for (int i = 0; i < traces_->traces_size(); ++i) {
-    traces_->mutable_traces(i)->set_project_id(project_id_);
+  // Take the cached traces; traces appended from now on go to a new list.
+  std::unique_ptr<Traces> pending(traces_.release());
+  traces_.reset(new Traces);
+
+  // Split the backlog into byte-bounded chunks, newest first, so one
+  // PatchTraces body never grows unbounded under sampling bursts. When the
+  // backlog exceeds what one flush may upload, the oldest traces are
+  // dropped and counted.
+  std::vector<std::unique_ptr<Traces>> chunks;
+  std::unique_ptr<Traces> chunk(new Traces);
+  size_t chunk_bytes = 0;
+  while (pending->traces_size() > 0) {
+    std::unique_ptr<Trace> trace(pending->mutable_traces()->ReleaseLast());
+    size_t trace_bytes = trace->ByteSizeLong();
+    if (chunk->traces_size() > 0 &&
+        chunk_bytes + trace_bytes > kMaxFlushChunkBytes) {
+      chunks.push_back(std::move(chunk));
+      if (chunks.size() >= kMaxFlushChunks) {
+        uint64_t dropped = pending->traces_size() + 1;
+        dropped_traces_ += dropped;
+        env_->LogWarning("Dropped " + std::to_string(dropped) +
+                         " oldest traces over the flush upload budget, " +
+                         std::to_string(dropped_traces_) +
+                         " dropped in total.");
+        pending->clear_traces();
+        break;
+      }
+      chunk.reset(new Traces);
+      chunk_bytes = 0;
+    }
+    trace->set_project_id(project_id_);
+    chunk->mutable_traces()->AddAllocated(trace.release());
+    chunk_bytes += trace_bytes;
+  }
+  if (chunk->traces_size() > 0) {
+    chunks.push_back(std::move(chunk));
+  }
+
+  // Chunks hold the newest traces first, so when the upload budget runs
+  // out the remaining (oldest) batches are dropped and counted, in line
+  // with the chunk-count bound above.
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    if (upload_budget_ &&
+        !upload_budget_->Acquire(std::chrono::system_clock::now())) {
+      uint64_t dropped = 0;
+      for (size_t j = i; j < chunks.size(); ++j) {
+        dropped += chunks[j]->traces_size();
+      }
+      dropped_traces_ += dropped;
+      env_->LogWarning("Dropped " + std::to_string(dropped) +
+                       " oldest traces over the outbound upload budget, " +
+                       std::to_string(dropped_traces_) + " dropped in total.");
+      break;
+    }
+    SendTraces(std::move(chunks[i]));
   }
+}
 
+void Aggregator::SendTraces(std::unique_ptr<Traces> traces) {
   std::unique_ptr<HTTPRequest> http_request(new HTTPRequest(
       [this](Status status, std::map<std::string, std::string> &&,
              std::string &&body) {
@@ -88,20 +158,30 @@ void Aggregator::SendAndClearTraces() {
   std::string url =
       cloud_trace_address_ + "/v1/projects/" + project_id_ + "/traces";
 
-  std::string request_body;
-
-  ProtoToJson(*traces_, &request_body, utils::DEFAULT);
-  traces_->clear_traces();
-  env_->LogDebug("Sending request to Cloud Trace.");
-  env_->LogDebug(request_body);
-
   http_request->set_url(url)
       .set_method("PATCH")
       .set_auth_token(sa_token_->GetAuthToken(
           auth::ServiceAccountToken::JWT_TOKEN_FOR_CLOUD_TRACING))
-      .set_header("Content-Type", "application/json")
-      .set_body(request_body);
+      .set_header("Content-Type", "application/json");
 
+  env_->LogDebug("Sending request to Cloud Trace.");
+
+  // Serialize the body on the flush thread; the event loop only hands the
+  // batch over. shared_ptr because std::function must be copyable.
+  if (flush_thread_) {
+    std::shared_ptr<Traces> shared_traces(traces.release());
+    flush_thread_->Dispatch(std::move(http_request), [shared_traces]() {
+      std::string request_body;
+      ProtoToJson(*shared_traces, &request_body, utils::DEFAULT);
+      return request_body;
+    });
+    return;
+  }
+
+  std::string request_body;
+  ProtoToJson(*traces, &request_body, utils::DEFAULT);
+  env_->LogDebug(request_body);
+  http_request->set_body(request_body);
   env_->RunHTTPRequest(std::move(http_request));
 }
 
@@ -21,6 +21,8 @@
 #include "include/api_manager/periodic_timer.h"
 #include "src/api_manager/auth/service_account_token.h"
 #include "src/api_manager/cloud_trace/sampler.h"
+#include "src/api_manager/service_control/report_flush_thread.h"
+#include "src/api_manager/utils/token_bucket.h"
 
 namespace google {
 namespace api_manager {
@@ -56,7 +58,24 @@ class Aggregator final {
   // Get the sampler.
   Sampler &sampler() { return sampler_; }
 
+  // Address for Cloud Trace API.
+  const std::string &cloud_trace_address() const {
+    return cloud_trace_address_;
+  }
+
+  // Sets the outbound upload budget. Batches over the budget are dropped
+  // and counted. Not owned; nullptr (the default) means unbudgeted.
+  void set_upload_budget(utils::TokenBucket *budget) {
+    upload_budget_ = budget;
+  }
+
  private:
+  // Send one bounded batch of traces to Cloud Trace API. Serialization of
+  // the body runs on the flush thread when one is running, so the event
+  // loop only hands the batch over.
+  void SendTraces(
+      std::unique_ptr<google::devtools::cloudtrace::v1::Traces> traces);
+
   // ServiceAccountToken object to get auth tokens for Cloud Trace API.
   auth::ServiceAccountToken *sa_token_;
 
@@ -81,6 +100,19 @@ class Aggregator final {
   // Timer to trigger flush trace.
   std::unique_ptr<google::api_manager::PeriodicTimer> timer_;
 
+  // Background thread serializing PatchTraces bodies, reusing the report
+  // flush thread infrastructure. nullptr until Init(); without it bodies
+  // are serialized inline.
+  std::unique_ptr<service_control::ReportFlushThread> flush_thread_;
+
+  // Total number of traces dropped because the backlog exceeded the
+  // upload budget of one flush.
+  uint64_t dropped_traces_;
+
+  // Token bucket budgeting the batch uploads, not owned. nullptr when
+  // uploads are not budgeted.
+  utils::TokenBucket *upload_budget_;
+
   // Sampler object to help determine if trace should be enabled for a request.
   Sampler sampler_;
 };
@@ -18,7 +18,9 @@
 
 #include <cctype>
 #include <chrono>
+#include <cstdio>
 #include <iomanip>
+#include <mutex>
 #include <random>
 #include <sstream>
 #include <string>
@@ -27,6 +29,7 @@
 #include "google/protobuf/timestamp.pb.h"
 #include "include/api_manager/utils/status.h"
 #include "include/api_manager/utils/version.h"
+#include "src/api_manager/utils/format_util.h"
 
 using google::devtools::cloudtrace::v1::Trace;
 using google::devtools::cloudtrace::v1::TraceSpan;
@@ -38,6 +41,12 @@ namespace api_manager {
 namespace cloud_trace {
 namespace {
 
+// Maximum number of recycled CloudTraceSpan allocations kept in the
+// freelist backing the pooled operator new/delete.
+const size_t kSpanPoolMaxSize = 128;
+std::mutex span_pool_mutex;
+std::vector<void *> span_pool;
+
 // Cloud Trace agent label key
 const char kCloudTraceAgentKey[] = "trace.cloud.google.com/agent";
 // Cloud Trace agent label value
@@ -51,9 +60,24 @@ constexpr size_t kSpanIdFieldIdPos = kTraceIdFieldIdPos + 16 + 1;
 constexpr size_t kTraceOptionsFieldIdPos = kSpanIdFieldIdPos + 8 + 1;
 constexpr size_t kGrpcTraceBinLen = 29;
 
+// W3C traceparent constants. The header has the fixed-length form
+// "00-<32 hex trace-id>-<16 hex span-id>-<2 hex flags>".
+constexpr size_t kTraceParentTraceIdPos = 3;
+constexpr size_t kTraceParentSpanIdPos = kTraceParentTraceIdPos + 32 + 1;
+constexpr size_t kTraceParentFlagsPos = kTraceParentSpanIdPos + 16 + 1;
+constexpr size_t kTraceParentLen = kTraceParentFlagsPos + 2;
+
 // Generate a random unsigned 64-bit integer.
 uint64_t RandomUInt64();
 
+// The agent label value, "<agent>/<version>". The version is set once at
+// startup, so the concatenation is cached instead of rebuilt per span.
+const std::string &ServiceAgent() {
+  static const std::string *const service_agent = new std::string(
+      kServiceAgentPrefix + utils::Version::instance().get());
+  return *service_agent;
+}
+
 // Get a random string of 128 bit hex number
 std::string RandomUInt128HexString();
 
@@ -87,6 +111,14 @@ void GetTraceFromCloudTraceContextHeader(const std::string &trace_context,
 void GetTraceFromGRpcTraceContextHeader(const std::string &raw_trace_context,
                                         const std::string &root_span_name,
                                         Trace **trace, std::string *options);
+
+// Parse the W3C traceparent header. The header is fixed length, so parsing
+// is a fixed-offset hex decode with no allocation until trace is enabled.
+// Assigns Trace object to the trace pointer if context is parsed correctly
+// and trace is sampled. Otherwise the pointer is not modified.
+void GetTraceFromW3CTraceParentHeader(const std::string &trace_context,
+                                      const std::string &root_span_name,
+                                      Trace **trace, std::string *options);
 }  // namespace
 
 CloudTrace::CloudTrace(Trace *trace, const std::string &options,
@@ -104,10 +136,14 @@ void CloudTrace::EndRootSpan() { GetNow(root_span_->mutable_end_time()); }
 
 std::string CloudTrace::ToTraceContextHeader(uint64_t span_id) const {
   if (header_type_ == HeaderType::CLOUD_TRACE_CONTEXT) {
-    std::ostringstream trace_context_stream;
-    trace_context_stream << trace_->trace_id() << "/" << span_id << ";"
-                         << options_;
-    return trace_context_stream.str();
+    return trace_->trace_id() + "/" + utils::Uint64ToString(span_id) + ";" +
+           options_;
+  } else if (header_type_ == HeaderType::W3C_TRACEPARENT) {
+    char span_hex[16];
+    utils::FormatHex64(span_id, span_hex);
+    return "00-" + trace_->trace_id() + "-" +
+           std::string(span_hex, sizeof(span_hex)) +
+           (options_ == kDefaultTraceOptions ? "-01" : "-00");
   } else {
     char tc[kGrpcTraceBinLen];
     // Version
@@ -157,9 +193,7 @@ void CloudTraceSpan::InitWithParentSpanId(const std::string &span_name,
   trace_span_->set_parent_span_id(parent_span_id);
   trace_span_->set_name(span_name);
   // Agent label is defined as "<agent>/<version>".
-  trace_span_->mutable_labels()->insert(
-      {kCloudTraceAgentKey,
-       kServiceAgentPrefix + utils::Version::instance().get()});
+  trace_span_->mutable_labels()->insert({kCloudTraceAgentKey, ServiceAgent()});
   GetNow(trace_span_->mutable_start_time());
 }
 
@@ -169,12 +203,40 @@ CloudTraceSpan::~CloudTraceSpan() {
     return;
   }
   GetNow(trace_span_->mutable_end_time());
+  char sequence[20];
   for (unsigned int i = 0; i < messages_.size(); ++i) {
-    std::stringstream stream;
-    stream << std::setfill('0') << std::setw(3) << i;
-    std::string sequence = stream.str();
-    trace_span_->mutable_labels()->insert({sequence, messages_[i]});
+    size_t len = 3;
+    if (i < 1000) {
+      utils::FormatUint64Fixed(i, 3, sequence);
+    } else {
+      len = utils::FormatUint64(i, sequence);
+    }
+    trace_span_->mutable_labels()->insert(
+        {std::string(sequence, len), messages_[i]});
+  }
+}
+
+void *CloudTraceSpan::operator new(std::size_t size) {
+  if (size == sizeof(CloudTraceSpan)) {
+    std::lock_guard<std::mutex> lock(span_pool_mutex);
+    if (!span_pool.empty()) {
+      void *ptr = span_pool.back();
+      span_pool.pop_back();
+      return ptr;
+    }
+  }
+  return ::operator new(size);
+}
+
+void CloudTraceSpan::operator delete(void *ptr, std::size_t size) {
+  if (size == sizeof(CloudTraceSpan)) {
+    std::lock_guard<std::mutex> lock(span_pool_mutex);
+    if (span_pool.size() < kSpanPoolMaxSize) {
+      span_pool.push_back(ptr);
+      return;
+    }
   }
+  ::operator delete(ptr);
 }
 
 void CloudTraceSpan::Write(const std::string &msg) {
@@ -187,7 +249,8 @@ void CloudTraceSpan::Write(const std::string &msg) {
 
 CloudTrace *CreateCloudTrace(const std::string &trace_context,
                              const std::string &root_span_name,
-                             HeaderType header_type, Sampler *sampler) {
+                             HeaderType header_type, Sampler *sampler,
+                             const std::string &method_selector) {
   Trace *trace = nullptr;
   std::string options;
   switch (header_type) {
@@ -199,6 +262,10 @@ CloudTrace *CreateCloudTrace(const std::string &trace_context,
       GetTraceFromGRpcTraceContextHeader(trace_context, root_span_name, &trace,
                                          &options);
       break;
+    case HeaderType::W3C_TRACEPARENT:
+      GetTraceFromW3CTraceParentHeader(trace_context, root_span_name, &trace,
+                                       &options);
+      break;
   }
   if (trace) {
     // When trace is triggered by the context header, refresh the previous
@@ -207,7 +274,7 @@ CloudTrace *CreateCloudTrace(const std::string &trace_context,
       sampler->Refresh();
     }
     return new CloudTrace(trace, options, header_type);
-  } else if (sampler && sampler->On()) {
+  } else if (sampler && sampler->On(method_selector)) {
     // Trace is turned on by sampler.
     GetNewTrace(RandomUInt128HexString(), root_span_name, &trace);
     return new CloudTrace(trace, kDefaultTraceOptions, header_type);
@@ -247,14 +314,10 @@ uint64_t RandomUInt64() {
 }
 
 std::string HexUInt128(uint64_t hi, uint64_t lo) {
-  std::stringstream stream;
-
-  stream << std::setfill('0') << std::setw(sizeof(uint64_t) * 2) << std::hex
-         << hi;
-  stream << std::setfill('0') << std::setw(sizeof(uint64_t) * 2) << std::hex
-         << lo;
-
-  return stream.str();
+  char buf[32];
+  utils::FormatHex64(hi, buf);
+  utils::FormatHex64(lo, buf + 16);
+  return std::string(buf, sizeof(buf));
 }
 
 std::string RandomUInt128HexString() {
@@ -279,9 +342,7 @@ void GetNewTrace(std::string trace_id_str, const std::string &root_span_name,
   root_span->set_span_id(RandomUInt64());
   root_span->set_name(root_span_name);
   // Agent label is defined as "<agent>/<version>".
-  root_span->mutable_labels()->insert(
-      {kCloudTraceAgentKey,
-       kServiceAgentPrefix + utils::Version::instance().get()});
+  root_span->mutable_labels()->insert({kCloudTraceAgentKey, ServiceAgent()});
   GetNow(root_span->mutable_start_time());
 }
 
@@ -341,6 +402,77 @@ void GetTraceFromGRpcTraceContextHeader(const std::string &raw_trace_context,
   }
 }
 
+// Decode one hex digit, or -1 for a non-hex character.
+int HexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+void GetTraceFromW3CTraceParentHeader(const std::string &trace_context,
+                                      const std::string &root_span_name,
+                                      Trace **trace, std::string *options) {
+  if (trace_context.size() != kTraceParentLen) {
+    return;
+  }
+  const char *data = trace_context.data();
+  // Only version 00 is understood; fields are at fixed offsets.
+  if (data[0] != '0' || data[1] != '0' || data[2] != '-' ||
+      data[kTraceParentSpanIdPos - 1] != '-' ||
+      data[kTraceParentFlagsPos - 1] != '-') {
+    return;
+  }
+
+  // Trace is propagated only when the sampled flag bit is set.
+  int flags_hi = HexDigit(data[kTraceParentFlagsPos]);
+  int flags_lo = HexDigit(data[kTraceParentFlagsPos + 1]);
+  if (flags_hi < 0 || flags_lo < 0 || !(flags_lo & 1)) {
+    return;
+  }
+
+  // Check for a valid trace id: all hex, not all zero.
+  bool valid_trace_id = false;
+  for (size_t i = 0; i < 32; ++i) {
+    int digit = HexDigit(data[kTraceParentTraceIdPos + i]);
+    if (digit < 0) {
+      return;
+    }
+    if (digit != 0) {
+      valid_trace_id = true;
+    }
+  }
+  if (!valid_trace_id) {
+    return;
+  }
+
+  uint64_t span_id = 0;
+  for (size_t i = 0; i < 16; ++i) {
+    int digit = HexDigit(data[kTraceParentSpanIdPos + i]);
+    if (digit < 0) {
+      return;
+    }
+    span_id = (span_id << 4) | static_cast<uint64_t>(digit);
+  }
+
+  *options = kDefaultTraceOptions;
+
+  // At this point, trace is enabled and trace id is successfully parsed.
+  GetNewTrace(trace_context.substr(kTraceParentTraceIdPos, 32), root_span_name,
+              trace);
+  TraceSpan *root_span = (*trace)->mutable_spans(0);
+  // Set parent of root span to the given one if provided.
+  if (span_id != 0) {
+    root_span->set_parent_span_id(span_id);
+  }
+}
+
 void GetTraceFromCloudTraceContextHeader(const std::string &trace_context,
                                          const std::string &root_span_name,
                                          Trace **trace, std::string *options) {
@@ -31,6 +31,7 @@ namespace cloud_trace {
 enum HeaderType {
   CLOUD_TRACE_CONTEXT = 1,
   GRPC_TRACE_CONTEXT = 2,
+  W3C_TRACEPARENT = 3,
 };
 
 // Stores traces and metadata for one request. The instance of this class is
@@ -99,6 +100,12 @@ class CloudTraceSpan {
 
   ~CloudTraceSpan();
 
+  // Pooled allocation: sampling bursts create and destroy several spans
+  // per request, so the allocations are recycled through a freelist
+  // instead of going back to the heap (same pattern as RequestContext).
+  static void *operator new(std::size_t size);
+  static void operator delete(void *ptr, std::size_t size);
+
   const google::devtools::cloudtrace::v1::TraceSpan *trace_span() const {
     return trace_span_;
   }
@@ -117,10 +124,12 @@ class CloudTraceSpan {
 // be produced for the request. If so, creates an initialized CloudTrace object.
 // Otherwise return nullptr.
 // For trace_context, pass the value of "X-Cloud-Trace-Context" HTTP header.
+// The method selector, when known, lets the sampler apply per-method
+// sampling rate overrides.
 CloudTrace *CreateCloudTrace(const std::string &trace_context,
                              const std::string &root_span_name,
-                             HeaderType header_type,
-                             Sampler *sampler = nullptr);
+                             HeaderType header_type, Sampler *sampler = nullptr,
+                             const std::string &method_selector = "");
 
 // Creates trace span if trace is enabled.
 // Returns nullptr when cloud_trace is nullptr.
@@ -446,6 +446,63 @@ TEST_F(CloudTraceTest, TestFormatGrpcTraceContextHeader) {
                 absl::string_view(expected_header2, sizeof(expected_header2))));
 }
 
+TEST_F(CloudTraceTest, TestParseW3CTraceParentHeader) {
+  // Disabled if empty.
+  ASSERT_EQ(nullptr, CreateCloudTrace("", "", HeaderType::W3C_TRACEPARENT));
+  // Disabled for a wrong length.
+  ASSERT_EQ(nullptr, CreateCloudTrace(
+                         "00-e133eacd437d8a12068fd902af3962d8-0000000000003039",
+                         "", HeaderType::W3C_TRACEPARENT));
+  // Disabled for an unknown version.
+  ASSERT_EQ(nullptr,
+            CreateCloudTrace(
+                "01-e133eacd437d8a12068fd902af3962d8-0000000000003039-01", "",
+                HeaderType::W3C_TRACEPARENT));
+  // Disabled when the sampled flag is not set.
+  ASSERT_EQ(nullptr,
+            CreateCloudTrace(
+                "00-e133eacd437d8a12068fd902af3962d8-0000000000003039-00", "",
+                HeaderType::W3C_TRACEPARENT));
+  // Disabled for a non-hex trace id.
+  ASSERT_EQ(nullptr,
+            CreateCloudTrace(
+                "00-g133eacd437d8a12068fd902af3962d8-0000000000003039-01", "",
+                HeaderType::W3C_TRACEPARENT));
+  // Disabled for an all-zero trace id.
+  ASSERT_EQ(nullptr,
+            CreateCloudTrace(
+                "00-00000000000000000000000000000000-0000000000003039-01", "",
+                HeaderType::W3C_TRACEPARENT));
+
+  std::unique_ptr<CloudTrace> cloud_trace(CreateCloudTrace(
+      "00-e133eacd437d8a12068fd902af3962d8-0000000000003039-01", "root-span",
+      HeaderType::W3C_TRACEPARENT));
+  ASSERT_TRUE(cloud_trace);
+  ASSERT_EQ(cloud_trace->trace()->trace_id(),
+            "e133eacd437d8a12068fd902af3962d8");
+  ASSERT_EQ(cloud_trace->trace()->spans_size(), 1);
+  ASSERT_EQ(cloud_trace->trace()->spans(0).parent_span_id(), 12345);
+  ASSERT_EQ("o=1", cloud_trace->options());
+
+  // A zero parent span id leaves the root span without a parent.
+  cloud_trace.reset(CreateCloudTrace(
+      "00-e133eacd437d8a12068fd902af3962d8-0000000000000000-01", "root-span",
+      HeaderType::W3C_TRACEPARENT));
+  ASSERT_TRUE(cloud_trace);
+  ASSERT_EQ(cloud_trace->trace()->spans(0).parent_span_id(), 0);
+}
+
+TEST_F(CloudTraceTest, TestFormatW3CTraceParentHeader) {
+  std::unique_ptr<CloudTrace> cloud_trace(CreateCloudTrace(
+      "00-e133eacd437d8a12068fd902af3962d8-0000000000003039-01", "",
+      HeaderType::W3C_TRACEPARENT));
+  ASSERT_TRUE(cloud_trace);
+  ASSERT_EQ(cloud_trace->ToTraceContextHeader(12345),
+            "00-e133eacd437d8a12068fd902af3962d8-0000000000003039-01");
+  ASSERT_EQ(cloud_trace->ToTraceContextHeader(0x3031323334353637),
+            "00-e133eacd437d8a12068fd902af3962d8-3031323334353637-01");
+}
+
 }  // namespace
 }  // namespace cloud_trace
 }  // namespace api_manager
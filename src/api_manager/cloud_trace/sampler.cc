@@ -16,11 +16,15 @@
 //
 #include "src/api_manager/cloud_trace/sampler.h"
 
+#include <algorithm>
+
+#include "src/api_manager/utils/clock.h"
+
 namespace google {
 namespace api_manager {
 namespace cloud_trace {
 
-Sampler::Sampler(double qps) {
+Sampler::Sampler(double qps) : traces_per_minute_(0.0), tokens_(0.0) {
   if (qps == 0.0) {
     is_disabled_ = true;
   } else {
@@ -33,7 +37,22 @@ bool Sampler::On() {
   if (is_disabled_) {
     return false;
   }
-  auto now = std::chrono::system_clock::now();
+  // Sampling windows span seconds; coarse time is sufficient and keeps
+  // the per-request sampling decision free of clock syscalls.
+  auto now = utils::CoarseNow();
+  if (traces_per_minute_ > 0.0) {
+    // Refill the bucket for the time elapsed, capped at one minute of
+    // budget, then try to take one token.
+    std::chrono::duration<double> elapsed = now - last_refill_;
+    tokens_ = std::min(traces_per_minute_,
+                       tokens_ + elapsed.count() * traces_per_minute_ / 60.0);
+    last_refill_ = now;
+    if (tokens_ >= 1.0) {
+      tokens_ -= 1.0;
+      return true;
+    }
+    return false;
+  }
   std::chrono::duration<double> diff = now - previous_;
   if (diff.count() > duration_) {
     previous_ = now;
@@ -43,11 +62,42 @@ bool Sampler::On() {
   }
 };
 
+bool Sampler::On(const std::string &method_selector) {
+  if (!method_selector.empty()) {
+    auto it = method_samplers_.find(method_selector);
+    if (it != method_samplers_.end()) {
+      return it->second->On();
+    }
+  }
+  return On();
+}
+
 void Sampler::Refresh() {
   if (is_disabled_) {
     return;
   }
-  previous_ = std::chrono::system_clock::now();
+  if (traces_per_minute_ > 0.0) {
+    // A trace was produced for the request anyway; charge it against the
+    // budget.
+    tokens_ = std::max(0.0, tokens_ - 1.0);
+    return;
+  }
+  previous_ = utils::CoarseNow();
+}
+
+void Sampler::set_traces_per_minute(double traces_per_minute) {
+  traces_per_minute_ = traces_per_minute;
+  if (traces_per_minute_ > 0.0) {
+    is_disabled_ = false;
+    // Start with a full bucket so a fresh worker can trace immediately.
+    tokens_ = traces_per_minute_;
+    last_refill_ = utils::CoarseNow();
+  }
+}
+
+void Sampler::set_method_qps_override(const std::string &method_selector,
+                                      double qps) {
+  method_samplers_[method_selector].reset(new Sampler(qps));
 }
 
 }  // namespace cloud_trace
@@ -17,6 +17,9 @@
 #define API_MANAGER_CLOUD_TRACE_SAMPLER_H_
 
 #include <chrono>
+#include <map>
+#include <memory>
+#include <string>
 
 namespace google {
 namespace api_manager {
@@ -27,6 +30,11 @@ namespace cloud_trace {
 // Trace is triggered if the time interval between the request time and the
 // previous trace enabled request is bigger than a threshold.
 // The threshold is calculated from the qps.
+//
+// When a traces-per-minute budget is set, the qps gate is replaced by a
+// token bucket targeting that budget; bursts of up to one minute of
+// budget are allowed. Individual methods can carry their own qps gate via
+// overrides, so low-traffic methods still get traced.
 class Sampler {
  public:
   Sampler(double qps);
@@ -34,13 +42,32 @@ class Sampler {
   // Returns whether trace should be turned on for this request.
   bool On();
 
+  // Same as above, but a method with a sampling rate override is gated by
+  // its own rate. The selector comes from MethodInfo::selector().
+  bool On(const std::string &method_selector);
+
   // Refresh the previous timestamp to the current time.
   void Refresh();
 
+  // Switch to a token bucket targeting the given traces-per-minute budget.
+  void set_traces_per_minute(double traces_per_minute);
+
+  // Set a sampling rate override for one method.
+  void set_method_qps_override(const std::string &method_selector, double qps);
+
  private:
   bool is_disabled_;
   std::chrono::time_point<std::chrono::system_clock> previous_;
   double duration_;
+
+  // Token bucket state for the traces-per-minute mode. Unused while
+  // traces_per_minute_ is 0.
+  double traces_per_minute_;
+  double tokens_;
+  std::chrono::time_point<std::chrono::system_clock> last_refill_;
+
+  // Samplers gating overridden methods, keyed by method selector.
+  std::map<std::string, std::unique_ptr<Sampler>> method_samplers_;
 };
 
 }  // namespace cloud_trace
@@ -57,6 +57,29 @@ TEST_F(SamplerTest, TestRefresh) {
   ASSERT_FALSE(sampler.On());
 }
 
+TEST_F(SamplerTest, TestTracesPerMinuteBudget) {
+  Sampler sampler(0.0);
+  sampler.set_traces_per_minute(120.0);
+
+  // The bucket starts with a full minute of budget available as burst.
+  for (int i = 0; i < 120; ++i) {
+    ASSERT_TRUE(sampler.On());
+  }
+  ASSERT_FALSE(sampler.On());
+}
+
+TEST_F(SamplerTest, TestMethodQpsOverride) {
+  Sampler sampler(0.0);
+  sampler.set_method_qps_override("endpoints.Admin.Status", 0.1);
+
+  // The overridden method is gated by its own rate even though the global
+  // sampler is disabled.
+  ASSERT_TRUE(sampler.On("endpoints.Admin.Status"));
+  ASSERT_FALSE(sampler.On("endpoints.Admin.Status"));
+  ASSERT_FALSE(sampler.On("endpoints.Books.List"));
+  ASSERT_FALSE(sampler.On());
+}
+
 TEST_F(SamplerTest, TestDisabled) {
   Sampler sampler(0.0);
   ASSERT_FALSE(sampler.On());
@@ -81,7 +81,8 @@ bool ReadConfigFromString(const std::string &service_config,
 
 }  // namespace
 
-Config::Config() {}
+Config::Config()
+    : has_auth_(false), service_trimmed_(false), client_ip_position_(0) {}
 
 MethodInfoImpl *Config::GetOrCreateMethodInfoImpl(const string &name,
                                                   const string &api_name,
@@ -436,6 +437,7 @@ bool Config::LoadService(ApiManagerEnvInterface *env,
       env->LogError("Service name not specified in the API configuration.");
       return false;
     }
+    has_auth_ = service_.has_authentication();
 
     string tf;
     ::google::protobuf::TextFormat::PrintToString(service_, &tf);
@@ -501,29 +503,110 @@ std::unique_ptr<Config> Config::Create(ApiManagerEnvInterface *env,
   }
 
   config->LoadTypes(env);
+
+  // All rules affecting a method are applied at this point; precompute the
+  // per-method check bypass flags.
+  for (auto &method : config->method_map_) {
+    method.second->ComputeSkipAllChecks();
+  }
   return config;
 }
 
+void Config::TrimService() {
+  // Everything the request path needs was compiled into the path matcher,
+  // the method map and the issuer and JSON-name maps while this Config was
+  // built. The sections dropped here — chiefly the type and enum universe
+  // and the per-selector rule lists — are read again only when the full
+  // message is re-derived from the on-disk config cache (see
+  // ApiManagerImpl::service()). The proto object itself stays put, so
+  // references taken to it remain valid and keep seeing the retained
+  // fields: name, id, producer_project_id, control and the api names and
+  // versions.
+  service_.clear_types();
+  service_.clear_enums();
+  service_.clear_documentation();
+  service_.clear_backend();
+  service_.clear_http();
+  service_.clear_quota();
+  service_.clear_authentication();
+  service_.clear_context();
+  service_.clear_usage();
+  service_.clear_custom_error();
+  service_.clear_endpoints();
+  service_.clear_logs();
+  service_.clear_metrics();
+  service_.clear_monitored_resources();
+  service_.clear_billing();
+  service_.clear_logging();
+  service_.clear_monitoring();
+  service_.clear_system_parameters();
+  service_.clear_source_info();
+  for (auto &api : *service_.mutable_apis()) {
+    api.clear_methods();
+    api.clear_options();
+    api.clear_mixins();
+  }
+  service_trimmed_ = true;
+}
+
+void Config::ApplyConcurrencyLimits() {
+  const auto &limits = server_config_->concurrency_limit_config();
+  for (auto &method : method_map_) {
+    int32_t limit = limits.default_limit();
+    const auto override_it =
+        limits.method_limits().find(method.second->selector());
+    if (override_it != limits.method_limits().end()) {
+      limit = override_it->second;
+    }
+    method.second->set_concurrency_limit(limit);
+  }
+}
+
 const MethodInfo *Config::GetMethodInfo(const string &http_method,
                                         const string &url) const {
   return path_matcher_ == nullptr ? nullptr
                                   : path_matcher_->Lookup(http_method, url);
 }
 
-MethodCallInfo Config::GetMethodCallInfo(
-    const std::string &http_method, const std::string &url,
-    const std::string &query_params) const {
+MethodCallInfo Config::GetMethodCallInfo(const std::string &http_method,
+                                         const std::string &url) const {
   MethodCallInfo call_info;
   if (path_matcher_ == nullptr) {
     call_info.method_info = nullptr;
-  } else {
+    return call_info;
+  }
+  if (!method_call_cache_.Lookup(http_method, url, &call_info)) {
+    // Full trie walk. Only the bindings extracted from the path are cached
+    // so the entry stays valid for any query string.
     call_info.method_info = path_matcher_->Lookup(
-        http_method, url, query_params, &call_info.variable_bindings,
+        http_method, url, std::string(), &call_info.variable_bindings,
         &call_info.body_field_path);
+    method_call_cache_.Insert(http_method, url, call_info);
   }
   return call_info;
 }
 
+MethodCallInfo Config::GetMethodCallInfo(
+    const std::string &http_method, const std::string &url,
+    const std::string &query_params) const {
+  MethodCallInfo call_info = GetMethodCallInfo(http_method, url);
+  AppendQueryParameterBindings(query_params, &call_info);
+  return call_info;
+}
+
+void Config::AppendQueryParameterBindings(const std::string &query_params,
+                                          MethodCallInfo *call_info) const {
+  // Tokenizing the query string is pure overhead for passthrough methods, so
+  // callers defer this step until the bindings are actually consumed.
+  if (call_info->method_info == nullptr || query_params.empty()) {
+    return;
+  }
+  ExtractBindingsFromQueryParameters(
+      query_params, call_info->method_info->system_query_parameter_names(),
+      &call_info->variable_bindings,
+      call_info->method_info->keep_binding_escaped());
+}
+
 bool Config::GetJwksUri(const string &issuer, string *url) const {
   std::string iss = utils::GetUrlContent(issuer);
   auto it = issuer_jwks_uri_map_.find(iss);
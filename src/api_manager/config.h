@@ -24,6 +24,7 @@
 #include "google/api/service.pb.h"
 #include "include/api_manager/env_interface.h"
 #include "include/api_manager/method_call_info.h"
+#include "src/api_manager/method_call_cache.h"
 #include "src/api_manager/method_impl.h"
 #include "src/api_manager/path_matcher.h"
 #include "src/api_manager/proto/server_config.pb.h"
@@ -52,7 +53,24 @@ class Config {
 
   void set_server_config(std::shared_ptr<proto::ServerConfig> server_config) {
     server_config_ = server_config;
+    if (server_config_ && server_config_->has_client_ip_extraction_config()) {
+      client_ip_header_ =
+          server_config_->client_ip_extraction_config().client_ip_header();
+      client_ip_position_ =
+          server_config_->client_ip_extraction_config().client_ip_position();
+    }
+    if (server_config_ && server_config_->has_concurrency_limit_config()) {
+      ApplyConcurrencyLimits();
+    }
   }
+
+  // The precompiled client IP extraction plan from
+  // server_config.client_ip_extraction_config: the header carrying the
+  // client IP and the comma separated position inside it (negative
+  // counts from the end). client_ip_header() is empty when extraction is
+  // not configured.
+  const std::string &client_ip_header() const { return client_ip_header_; }
+  int client_ip_position() const { return client_ip_position_; }
   // Returns server_config.  nullptr if no server_config.
   const proto::ServerConfig *server_config() const {
     return server_config_.get();
@@ -62,20 +80,49 @@ class Config {
   const MethodInfo *GetMethodInfo(const std::string &http_method,
                                   const std::string &url) const;
 
-  // Same as above but also returns the variable bindings extracted from the url
-  // according to the configured http rule (see
+  // All registered methods keyed by selector. Used by offline tooling
+  // (src/tools/esp_config_stats.cc) to report per-method settings.
+  const std::map<std::string, MethodInfoImplPtr> &method_map() const {
+    return method_map_;
+  }
+
+  // Same as above but also returns the variable bindings extracted from the
+  // url path according to the configured http rule (see
   // https://github.com/googleapis/googleapis/blob/master/google/api/http.proto
-  // for more details).
+  // for more details). Bindings from query parameters are not extracted;
+  // callers append them lazily with AppendQueryParameterBindings() when the
+  // bindings are actually consumed.
+  MethodCallInfo GetMethodCallInfo(const std::string &http_method,
+                                   const std::string &url) const;
+
+  // Same as above but also eagerly extracts the variable bindings from the
+  // query parameters.
   MethodCallInfo GetMethodCallInfo(const std::string &http_method,
                                    const std::string &url,
                                    const std::string &query_params) const;
 
+  // Appends the variable bindings from |query_params| to |call_info|. No-op
+  // for unmatched methods or an empty query string.
+  void AppendQueryParameterBindings(const std::string &query_params,
+                                    MethodCallInfo *call_info) const;
+
   const ::google::api::Service &service() const { return service_; }
 
   // TODO: Remove in favor of service().
   const std::string &service_name() const { return service_.name(); }
 
-  bool HasAuth() const { return service_.has_authentication(); }
+  bool HasAuth() const { return has_auth_; }
+
+  // Drops the parts of the Service proto that are only walked while this
+  // Config is built, keeping the few fields the request path still reads
+  // (name, id, producer_project_id, control, the api names and versions).
+  // Only call this when the serialized proto is preserved elsewhere — the
+  // on-disk config cache — so consumers of the full message, such as the
+  // transcoder factory, can re-derive it.
+  void TrimService();
+
+  // True once TrimService() has dropped the build-time parts of service().
+  bool service_trimmed() const { return service_trimmed_; }
 
   // Returns true if the caller should try openId discovery to fetch jwksUri.
   // url is set to the openId discovery link in this case. Returns false
@@ -147,9 +194,25 @@ class Config {
   // Load types from service config.
   void LoadTypes(ApiManagerEnvInterface *env);
 
+  // Applies the per-method concurrency limits from the server config to
+  // the loaded methods. Called from set_server_config(), after every
+  // method has been created.
+  void ApplyConcurrencyLimits();
+
   ::google::api::Service service_;
+  // Cached from service_.has_authentication() so it survives TrimService().
+  bool has_auth_;
+  // See TrimService().
+  bool service_trimmed_;
   std::shared_ptr<proto::ServerConfig> server_config_;
+  // The precompiled client IP extraction plan; see client_ip_header().
+  std::string client_ip_header_;
+  int client_ip_position_;
   PathMatcherPtr<MethodInfo *> path_matcher_;
+  // Caches resolved (http_method, path) lookups in front of path_matcher_.
+  // This Config object is replaced wholesale on config rollout, which is
+  // what invalidates the cache.
+  mutable MethodCallCache method_call_cache_;
   std::map<std::string, MethodInfoImplPtr> method_map_;
   // Maps issuer to {jwksUri, openIdValid} pair.
   // jwksUri is populated either from service config, or by openId discovery.
@@ -33,11 +33,13 @@ const int kDetectRolloutChangeIntervalInS = 60;
 ConfigManager::ConfigManager(
     std::shared_ptr<context::GlobalContext> global_context,
     RolloutApplyFunction rollout_apply_function,
-    std::function<void()> detect_rollout_func)
+    std::function<void()> detect_rollout_func,
+    ConfigDeployedFunction config_deployed_func)
     : global_context_(global_context),
       rollout_apply_function_(rollout_apply_function),
       fetch_throttle_window_in_s_(kFetchThrottleWindowInS),
-      detect_rollout_func_(detect_rollout_func) {
+      detect_rollout_func_(detect_rollout_func),
+      config_deployed_func_(config_deployed_func) {
   int detect_rollout_interval_s = kDetectRolloutChangeIntervalInS;
   if (global_context_->server_config() &&
       global_context_->server_config()->has_service_management_config()) {
@@ -79,7 +81,7 @@ ConfigManager::~ConfigManager() {
 void ConfigManager::SetLatestRolloutId(
     const std::string& latest_rollout_id,
     std::chrono::time_point<std::chrono::system_clock> now) {
-  if (latest_rollout_id == current_rollout_id_) {
+  if (latest_rollout_id == current_rollout_id()) {
     return;
   }
 
@@ -159,7 +161,7 @@ void ConfigManager::OnRolloutResponse(const utils::Status& status,
     return;
   }
 
-  if (current_rollout_id_ == response.rollouts(0).rollout_id()) {
+  if (current_rollout_id() == response.rollouts(0).rollout_id()) {
     return;
   }
 
@@ -185,9 +187,28 @@ void ConfigManager::OnRolloutResponse(const utils::Status& status,
 // Fetch configs from rollouts. fetch_info has rollouts and fetched configs
 void ConfigManager::FetchConfigs(
     std::shared_ptr<ConfigsFetchInfo> config_fetch_info) {
+  // Config versions already deployed need no download; they are passed on
+  // as bare config_ids and the ApiManager reuses their service contexts.
+  // This keeps the rollout cost proportional to the set of new config
+  // versions, not the size of the rollout.
+  for (auto rollout : config_fetch_info->rollouts) {
+    if (config_deployed_func_ && config_deployed_func_(rollout.first)) {
+      config_fetch_info->configs.push_back({rollout.first, rollout.second});
+      config_fetch_info->finished++;
+    }
+  }
+
+  if (config_fetch_info->IsCompleted()) {
+    ApplyConfigs(config_fetch_info);
+    return;
+  }
+
   for (auto rollout : config_fetch_info->rollouts) {
     std::string config_id = rollout.first;
     int percentage = rollout.second;
+    if (config_deployed_func_ && config_deployed_func_(config_id)) {
+      continue;
+    }
     service_management_fetch_->GetConfig(config_id, [this, config_id,
                                                      percentage,
                                                      config_fetch_info](
@@ -205,23 +226,27 @@ void ConfigManager::FetchConfigs(
       config_fetch_info->finished++;
 
       if (config_fetch_info->IsCompleted()) {
-        if (config_fetch_info->IsRolloutsEmpty() ||
-            config_fetch_info->IsConfigsEmpty() ||
-            config_fetch_info->rollouts.size() !=
-                config_fetch_info->configs.size()) {
-          global_context_->env()->LogError(
-              "Failed to download the service config");
-          return;
-        }
-
-        // Update ApiManager
-        rollout_apply_function_(utils::Status::OK,
-                                std::move(config_fetch_info->configs));
-        current_rollout_id_ = config_fetch_info->rollout_id;
+        ApplyConfigs(config_fetch_info);
       }
     });
   }
 }
 
+void ConfigManager::ApplyConfigs(
+    std::shared_ptr<ConfigsFetchInfo> config_fetch_info) {
+  if (config_fetch_info->IsRolloutsEmpty() ||
+      config_fetch_info->IsConfigsEmpty() ||
+      config_fetch_info->rollouts.size() !=
+          config_fetch_info->configs.size()) {
+    global_context_->env()->LogError("Failed to download the service config");
+    return;
+  }
+
+  // Update ApiManager
+  rollout_apply_function_(utils::Status::OK,
+                          std::move(config_fetch_info->configs));
+  set_current_rollout_id(config_fetch_info->rollout_id);
+}
+
 }  // namespace api_manager
 }  // namespace google
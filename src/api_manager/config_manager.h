@@ -15,7 +15,9 @@
 #ifndef API_MANAGER_CONFIG_MANAGER_H_
 #define API_MANAGER_CONFIG_MANAGER_H_
 
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <random>
 
 #include "src/api_manager/context/global_context.h"
@@ -34,11 +36,19 @@ namespace {
 //  - Code::UNAVAILABLE Not initialized yet. The default value.
 //  - Code::OK          Successfully initialized
 //  - Code::ABORTED     Initialization was failed
-// configs - pairs of ServiceConfig in text and rollout percentage
+// configs - pairs of ServiceConfig in text and rollout percentage.
+// For a config version the ApiManager already runs, the pair carries the
+// bare config_id instead of the full ServiceConfig text; such versions are
+// neither downloaded nor re-parsed on a rollout.
 typedef std::function<void(const utils::Status& status,
                            std::vector<std::pair<std::string, int>>&& configs)>
     RolloutApplyFunction;
 
+// ConfigDeployedFunction returns whether the config version with the given
+// config_id is already deployed in the ApiManager.
+typedef std::function<bool(const std::string& config_id)>
+    ConfigDeployedFunction;
+
 // Data structure to fetch configs from rollouts
 struct ConfigsFetchInfo {
   ConfigsFetchInfo() : finished(0) {}
@@ -73,7 +83,8 @@ class ConfigManager {
   // rollout
   ConfigManager(std::shared_ptr<context::GlobalContext> global_context,
                 RolloutApplyFunction rollout_apply_function,
-                std::function<void()> detect_rollout_func);
+                std::function<void()> detect_rollout_func,
+                ConfigDeployedFunction config_deployed_func = nullptr);
   virtual ~ConfigManager();
 
  public:
@@ -83,20 +94,38 @@ class ConfigManager {
       const std::string& latest_rollout_id,
       std::chrono::time_point<std::chrono::system_clock> now);
 
-  // Getter and setter of current_rollout_id_
-  const std::string current_rollout_id() { return current_rollout_id_; }
+  // Getter and setter of current_rollout_id_. The id is published as an
+  // atomic shared_ptr snapshot - the same discipline deployments use in
+  // ApiManagerImpl - so readers off the event loop (the status handler,
+  // background upload threads) never take a lock and never observe a
+  // partially written id while every Check/Report response carries a new
+  // rollout id during a transition.
+  const std::string current_rollout_id() {
+    std::shared_ptr<const std::string> id =
+        std::atomic_load(&current_rollout_id_);
+    return id ? *id : std::string();
+  }
   void set_current_rollout_id(const std::string rollout_id) {
-    current_rollout_id_ = rollout_id;
+    std::atomic_store(&current_rollout_id_,
+                      std::shared_ptr<const std::string>(
+                          new std::string(rollout_id)));
   }
 
   uint64_t get_remote_rollout_calls() const { return remote_rollout_calls_; }
 
+  // ServiceManagement API host url used for rollout and config fetches.
+  const std::string& service_management_host() const {
+    return service_management_fetch_->host();
+  }
+
  private:
   // Fetch the latest rollouts
   void FetchRollouts();
   // Fetch ServiceConfig details from the latest successful rollouts
   // https://goo.gl/I2nD4M
   void FetchConfigs(std::shared_ptr<ConfigsFetchInfo> config_fetch_info);
+  // Applies a fully fetched rollout through the rollout_apply_function
+  void ApplyConfigs(std::shared_ptr<ConfigsFetchInfo> config_fetch_info);
   // Periodical timer to detect rollout changes
   void OnDetectRolloutChangeTimer();
   // One time timer to throttle service fetching time.
@@ -117,8 +146,9 @@ class ConfigManager {
 
   // The next timer can be fired in the next throttle window.
   std::chrono::time_point<std::chrono::system_clock> next_window_time_;
-  // Previous rollouts id
-  std::string current_rollout_id_;
+  // Previous rollouts id; read with std::atomic_load, replaced with
+  // std::atomic_store (see current_rollout_id()).
+  std::shared_ptr<const std::string> current_rollout_id_;
   // number of remote calls to check the rollout_id
   uint64_t remote_rollout_calls_{};
 
@@ -128,6 +158,8 @@ class ConfigManager {
 
   // the callback function to detect rollout change.
   std::function<void()> detect_rollout_func_;
+  // the callback function to check whether a config version is deployed.
+  ConfigDeployedFunction config_deployed_func_;
   // Periodic timer to send empty report to detect latest rollout change.
   std::unique_ptr<PeriodicTimer> detect_rollout_change_timer_;
 };
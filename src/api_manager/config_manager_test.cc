@@ -190,6 +190,29 @@ class MockTimerApiManagerEnvironment : public MockApiManagerEnvironmentWithLog {
   MockPeriodicTimer* mock_periodic_timer_{};
 };
 
+// Queues HTTP requests instead of completing them inline so tests can
+// observe how many fetches are in flight at once.
+class DeferredRequestApiManagerEnvironment
+    : public MockTimerApiManagerEnvironment {
+ public:
+  virtual void RunHTTPRequest(std::unique_ptr<HTTPRequest> req) {
+    pending_.push_back(std::move(req));
+  }
+
+  size_t pending_count() const { return pending_.size(); }
+
+  // Removes the oldest queued request and hands it to the caller for
+  // completion.
+  std::unique_ptr<HTTPRequest> PopOldestPending() {
+    std::unique_ptr<HTTPRequest> req = std::move(pending_.front());
+    pending_.erase(pending_.begin());
+    return req;
+  }
+
+ private:
+  std::vector<std::unique_ptr<HTTPRequest>> pending_;
+};
+
 // Both service_name, config_id in server config
 class ConfigManagerServiceNameConfigIdTest : public ::testing::Test {
  public:
@@ -432,6 +455,111 @@ TEST_F(ConfigManagerServiceNameConfigIdTest, RolloutMultipleServiceConfig) {
   EXPECT_EQ(1, sequence);
 }
 
+TEST(ConfigManagerConcurrentFetchTest, ConfigFetchesAreIssuedConcurrently) {
+  std::unique_ptr<DeferredRequestApiManagerEnvironment> env(
+      new ::testing::NiceMock<DeferredRequestApiManagerEnvironment>());
+  DeferredRequestApiManagerEnvironment* raw_env = env.get();
+
+  std::shared_ptr<context::GlobalContext> global_context =
+      std::make_shared<context::GlobalContext>(std::move(env),
+                                               kServerConfigWithServiceName);
+  global_context->set_service_name("service_name_from_metadata");
+
+  int sequence = 0;
+
+  std::shared_ptr<ConfigManager> config_manager(new ConfigManager(
+      global_context,
+      [&sequence](const utils::Status& status,
+                  std::vector<std::pair<std::string, int>> list) {
+        std::sort(list.begin(), list.end());
+
+        EXPECT_EQ(2, list.size());
+        EXPECT_EQ(kServiceConfig1, list[0].first);
+        EXPECT_EQ(80, list[0].second);
+        EXPECT_EQ(kServiceConfig2, list[1].first);
+        EXPECT_EQ(20, list[1].second);
+        sequence++;
+      },
+      nullptr));
+
+  config_manager->SetLatestRolloutId("2017-05-01r0",
+                                     std::chrono::system_clock::now());
+  raw_env->RunTimer();
+
+  // The rollouts fetch goes out first; the per-config fetches depend on
+  // its response.
+  ASSERT_EQ(1, raw_env->pending_count());
+  raw_env->PopOldestPending()->OnComplete(
+      Status::OK, {}, kRolloutsResponseMultipleServiceConfig);
+
+  // Both config fetches are in flight before either response arrives.
+  ASSERT_EQ(2, raw_env->pending_count());
+  EXPECT_EQ(0, sequence);
+
+  std::map<std::string, std::string> data = {
+      {"https://servicemanagement.googleapis.com/v1/services/"
+       "service_name_from_metadata/configs/2017-05-01r0",
+       kServiceConfig1},
+      {"https://servicemanagement.googleapis.com/v1/services/"
+       "service_name_from_metadata/configs/2017-05-01r1",
+       kServiceConfig2}};
+
+  std::unique_ptr<HTTPRequest> req = raw_env->PopOldestPending();
+  req->OnComplete(Status::OK, {}, std::move(data[req->url()]));
+  // The rollout is applied only once the last fetch completes.
+  EXPECT_EQ(0, sequence);
+
+  req = raw_env->PopOldestPending();
+  req->OnComplete(Status::OK, {}, std::move(data[req->url()]));
+  EXPECT_EQ(1, sequence);
+}
+
+TEST_F(ConfigManagerServiceNameConfigIdTest, RolloutSkipsDeployedConfig) {
+  // 2017-05-01r0 is already deployed; only 2017-05-01r1 is downloaded.
+  EXPECT_CALL(*raw_env_, DoRunHTTPRequest(_))
+      .WillOnce(Invoke([this](HTTPRequest* req) {
+        EXPECT_EQ(
+            "https://servicemanagement.googleapis.com/v1/services/"
+            "service_name_from_metadata/rollouts?filter=status=SUCCESS",
+            req->url());
+        req->OnComplete(Status::OK, {}, kRolloutsResponseMultipleServiceConfig);
+      }))
+      .WillOnce(Invoke([this](HTTPRequest* req) {
+        EXPECT_EQ(
+            "https://servicemanagement.googleapis.com/v1/services/"
+            "service_name_from_metadata/configs/2017-05-01r1",
+            req->url());
+        req->OnComplete(Status::OK, {}, kServiceConfig2);
+      }));
+
+  int sequence = 0;
+
+  std::shared_ptr<ConfigManager> config_manager(new ConfigManager(
+      global_context_,
+      [this, &sequence](const utils::Status& status,
+                        std::vector<std::pair<std::string, int>> list) {
+        EXPECT_EQ(2, list.size());
+        // The deployed config version is passed as its bare config_id.
+        EXPECT_EQ("2017-05-01r0", list[0].first);
+        EXPECT_EQ(80, list[0].second);
+        EXPECT_EQ(kServiceConfig2, list[1].first);
+        EXPECT_EQ(20, list[1].second);
+        sequence++;
+      },
+      nullptr,
+      [](const std::string& config_id) {
+        return config_id == "2017-05-01r0";
+      }));
+
+  config_manager->SetLatestRolloutId("2017-05-01r0",
+                                     std::chrono::system_clock::now());
+  EXPECT_EQ(0, sequence);
+
+  EXPECT_EQ(raw_env_->timer_count(), 1);
+  raw_env_->RunTimer();
+  EXPECT_EQ(1, sequence);
+}
+
 TEST_F(ConfigManagerServiceNameConfigIdTest,
        RolloutMultipleServiceConfigPartiallyFailedThenSucceededNextTimerEvent) {
   std::function<void(HTTPRequest * req)> first_handler =
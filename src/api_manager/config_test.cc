@@ -234,6 +234,11 @@ static const char usage_config[] =
     "    allow_unregistered_calls: false\n"
     "    skip_service_control: false\n"
     "  }\n"
+    "  rules {\n"
+    "    selector: \"Xyz.Method3\"\n"
+    "    allow_unregistered_calls: true\n"
+    "    skip_service_control: false\n"
+    "  }\n"
     "}\n"
     "http {\n"
     "  rules {\n"
@@ -244,6 +249,10 @@ static const char usage_config[] =
     "    selector: \"Xyz.Method2\"\n"
     "    get: \"/xyz/method2/*\"\n"
     "  }\n"
+    "  rules {\n"
+    "    selector: \"Xyz.Method3\"\n"
+    "    get: \"/xyz/method3/*\"\n"
+    "  }\n"
     "}\n";
 
 TEST(Config, TestLoadUsage) {
@@ -256,11 +265,25 @@ TEST(Config, TestLoadUsage) {
   ASSERT_EQ("Xyz.Method1", method1->name());
   ASSERT_TRUE(method1->allow_unregistered_calls());
   ASSERT_TRUE(method1->skip_service_control());
+  // No auth, no quota and service control skipped: the whole check
+  // workflow can be bypassed.
+  ASSERT_TRUE(method1->skip_all_checks());
+  // Nothing is reported, so the method is not report-only.
+  ASSERT_FALSE(method1->report_only());
 
   const MethodInfo *method2 = config->GetMethodInfo("GET", "/xyz/method2/abc");
   ASSERT_EQ("Xyz.Method2", method2->name());
   ASSERT_FALSE(method2->allow_unregistered_calls());
   ASSERT_FALSE(method2->skip_service_control());
+  ASSERT_FALSE(method2->skip_all_checks());
+  ASSERT_FALSE(method2->report_only());
+
+  // No auth, no quota, unregistered callers allowed but service control
+  // on: the check workflow can be bypassed with only the report sent.
+  const MethodInfo *method3 = config->GetMethodInfo("GET", "/xyz/method3/abc");
+  ASSERT_EQ("Xyz.Method3", method3->name());
+  ASSERT_FALSE(method3->skip_all_checks());
+  ASSERT_TRUE(method3->report_only());
 }
 
 static const char custom_method_config[] =
@@ -585,6 +608,70 @@ TEST(Config, LoadTypes) {
   ASSERT_EQ("DST", json_name);
 }
 
+TEST(Config, TrimServiceKeepsRequestPathData) {
+  MockApiManagerEnvironmentWithLog env;
+
+  const char config_text[] = R"(
+    name: "trim-test"
+    id: "2017-05-01r0"
+    producer_project_id: "trim-project"
+    apis {
+      name: "Bookstore"
+      version: "v1"
+      methods {
+        name: "ListShelves"
+      }
+    }
+    types {
+      fields {
+        name: "d_s_t"
+        json_name: "DST"
+      }
+    }
+    http {
+      rules {
+        selector: "Bookstore.ListShelves"
+        get: "/shelves"
+      }
+    }
+    authentication {
+      providers {
+        id: "issuer1"
+        issuer: "https://issuer1.com"
+        jwks_uri: "https://issuer1.com/jwks"
+      }
+    }
+  )";
+
+  std::unique_ptr<Config> config = Config::Create(&env, config_text, "");
+  ASSERT_TRUE(config);
+
+  config->TrimService();
+  ASSERT_TRUE(config->service_trimmed());
+
+  // The build-time sections are gone.
+  EXPECT_EQ(0, config->service().types_size());
+  EXPECT_EQ(0, config->service().http().rules_size());
+  EXPECT_FALSE(config->service().has_authentication());
+
+  // The fields the request path reads survive.
+  EXPECT_EQ("trim-test", config->service().name());
+  EXPECT_EQ("2017-05-01r0", config->service().id());
+  EXPECT_EQ("trim-project", config->service().producer_project_id());
+  ASSERT_EQ(1, config->service().apis_size());
+  EXPECT_EQ("v1", config->service().apis(0).version());
+
+  // And so does everything compiled while the Config was built.
+  EXPECT_TRUE(config->HasAuth());
+  ASSERT_NE(nullptr, config->GetMethodInfo("GET", "/shelves"));
+  std::string json_name;
+  ASSERT_TRUE(config->GetJsonName("d_s_t", &json_name));
+  ASSERT_EQ("DST", json_name);
+  std::string url;
+  config->GetJwksUri("https://issuer1.com", &url);
+  ASSERT_EQ("https://issuer1.com/jwks", url);
+}
+
 TEST(Config, RpcMethodsWithHttpRules) {
   MockApiManagerEnvironmentWithLog env;
 
@@ -740,7 +827,7 @@ TEST(Config, RpcMethodsWithHttpRulesAndVariableBindings) {
   EXPECT_EQ(false, list_books.method_info->response_streaming());
   EXPECT_EQ("", list_books.body_field_path);
   ASSERT_EQ(1, list_books.variable_bindings.size());
-  EXPECT_EQ(std::vector<std::string>(1, "shelf"),
+  EXPECT_EQ(VariableFieldPath(1, "shelf"),
             list_books.variable_bindings[0].field_path);
   EXPECT_EQ("88", list_books.variable_bindings[0].value);
 
@@ -758,7 +845,7 @@ TEST(Config, RpcMethodsWithHttpRulesAndVariableBindings) {
   EXPECT_EQ(false, create_book.method_info->response_streaming());
   EXPECT_EQ("book", create_book.body_field_path);
   ASSERT_EQ(1, create_book.variable_bindings.size());
-  EXPECT_EQ(std::vector<std::string>(1, "shelf"),
+  EXPECT_EQ(VariableFieldPath(1, "shelf"),
             create_book.variable_bindings[0].field_path);
   EXPECT_EQ("99", create_book.variable_bindings[0].value);
 
@@ -777,15 +864,15 @@ TEST(Config, RpcMethodsWithHttpRulesAndVariableBindings) {
   EXPECT_EQ("book.title", create_book_1.body_field_path);
   ASSERT_EQ(3, create_book_1.variable_bindings.size());
 
-  EXPECT_EQ(std::vector<std::string>(1, "shelf"),
+  EXPECT_EQ(VariableFieldPath(1, "shelf"),
             create_book_1.variable_bindings[0].field_path);
   EXPECT_EQ("77", create_book_1.variable_bindings[0].value);
 
-  EXPECT_EQ((std::vector<std::string>{"book", "id"}),
+  EXPECT_EQ((VariableFieldPath{"book", "id"}),
             create_book_1.variable_bindings[1].field_path);
   EXPECT_EQ("88", create_book_1.variable_bindings[1].value);
 
-  EXPECT_EQ((std::vector<std::string>{"book", "author"}),
+  EXPECT_EQ((VariableFieldPath{"book", "author"}),
             create_book_1.variable_bindings[2].field_path);
   EXPECT_EQ("auth", create_book_1.variable_bindings[2].value);
 
@@ -803,10 +890,10 @@ TEST(Config, RpcMethodsWithHttpRulesAndVariableBindings) {
   EXPECT_EQ(false, create_book_2.method_info->response_streaming());
   EXPECT_EQ("book", create_book_2.body_field_path);
   ASSERT_EQ(2, create_book_2.variable_bindings.size());
-  EXPECT_EQ(std::vector<std::string>(1, "shelf"),
+  EXPECT_EQ(VariableFieldPath(1, "shelf"),
             create_book_2.variable_bindings[0].field_path);
   EXPECT_EQ("55", create_book_2.variable_bindings[0].value);
-  EXPECT_EQ((std::vector<std::string>{"book", "title"}),
+  EXPECT_EQ((VariableFieldPath{"book", "title"}),
             create_book_2.variable_bindings[1].field_path);
   EXPECT_EQ("Readme", create_book_2.variable_bindings[1].value);
 
@@ -825,10 +912,10 @@ TEST(Config, RpcMethodsWithHttpRulesAndVariableBindings) {
   EXPECT_EQ(false, create_book_3.method_info->response_streaming());
   EXPECT_EQ("book", create_book_3.body_field_path);
   ASSERT_EQ(2, create_book_3.variable_bindings.size());
-  EXPECT_EQ(std::vector<std::string>(1, "shelf"),
+  EXPECT_EQ(VariableFieldPath(1, "shelf"),
             create_book_3.variable_bindings[0].field_path);
   EXPECT_EQ("321", create_book_3.variable_bindings[0].value);
-  EXPECT_EQ((std::vector<std::string>{"book", "id"}),
+  EXPECT_EQ((VariableFieldPath{"book", "id"}),
             create_book_3.variable_bindings[1].field_path);
   EXPECT_EQ("123", create_book_3.variable_bindings[1].value);
 }
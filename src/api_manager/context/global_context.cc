@@ -44,6 +44,28 @@ const int kIntermediateReportInterval = 10;
 // The lifetime of a public key cache entry. Unit: seconds.
 const int kPubKeyCacheDurationInSecond = 300;
 
+// Default burst tolerated by the outbound call budgets, in seconds of
+// the configured rate.
+const double kDefaultOutboundBurstSeconds = 2.0;
+
+// Creates a token bucket for an outbound budget, or nullptr when the
+// destination is not budgeted (rate is 0).
+std::unique_ptr<utils::TokenBucket> CreateOutboundBudget(
+    double rate_per_second, double burst_seconds) {
+  if (rate_per_second <= 0) {
+    return std::unique_ptr<utils::TokenBucket>();
+  }
+  if (burst_seconds <= 0) {
+    burst_seconds = kDefaultOutboundBurstSeconds;
+  }
+  double capacity = rate_per_second * burst_seconds;
+  if (capacity < 1.0) {
+    capacity = 1.0;
+  }
+  return std::unique_ptr<utils::TokenBucket>(new utils::TokenBucket(
+      rate_per_second, capacity, std::chrono::system_clock::now()));
+}
+
 }  // namespace
 
 GlobalContext::GlobalContext(std::unique_ptr<ApiManagerEnvInterface> env,
@@ -54,6 +76,7 @@ GlobalContext::GlobalContext(std::unique_ptr<ApiManagerEnvInterface> env,
       disable_log_status_(false),
       always_print_primitive_fields_(false),
       preserve_proto_field_names_(false),
+      check_latency_statistics_enabled_(false),
       intermediate_report_interval_(kIntermediateReportInterval),
       platform_(ComputePlatform::kUnknown),
       jwks_cache_duration_in_s_(kPubKeyCacheDurationInSecond) {
@@ -79,6 +102,9 @@ GlobalContext::GlobalContext(std::unique_ptr<ApiManagerEnvInterface> env,
       if (auth_config.jwks_cache_duration_in_s() > 0) {
         jwks_cache_duration_in_s_ = auth_config.jwks_cache_duration_in_s();
       }
+      if (auth_config.async_signature_verification()) {
+        jwt_verify_pool_.reset(new auth::JwtVerifyPool(env_.get()));
+      }
     }
 
     // Check server_config override.
@@ -113,12 +139,33 @@ GlobalContext::GlobalContext(std::unique_ptr<ApiManagerEnvInterface> env,
       platform_ = server_config_->compute_platform_override();
     }
 
+    if (server_config_->has_cache_budget_config()) {
+      const auto& budget = server_config_->cache_budget_config();
+      cache_accountant_.reset(new CacheAccountant(
+          budget.memory_budget_in_bytes(), budget.check_interval_ms()));
+    }
+
+    if (server_config_->has_outbound_budget_config()) {
+      const auto& budget = server_config_->outbound_budget_config();
+      check_call_budget_ = CreateOutboundBudget(
+          budget.check_calls_per_second(), budget.burst_seconds());
+      report_flush_budget_ = CreateOutboundBudget(
+          budget.report_flushes_per_second(), budget.burst_seconds());
+      trace_upload_budget_ = CreateOutboundBudget(
+          budget.trace_uploads_per_second(), budget.burst_seconds());
+      if (cloud_trace_aggregator_) {
+        cloud_trace_aggregator_->set_upload_budget(trace_upload_budget_.get());
+      }
+    }
+
     if (server_config_->has_experimental()) {
       const auto& experimental = server_config_->experimental();
       disable_log_status_ = experimental.disable_log_status();
       always_print_primitive_fields_ =
           experimental.always_print_primitive_fields();
       preserve_proto_field_names_ = experimental.preserve_proto_field_names();
+      check_latency_statistics_enabled_ =
+          experimental.enable_check_latency_statistics();
     }
   }
 }
@@ -157,9 +204,62 @@ GlobalContext::CreateCloudTraceAggregator() {
     }
   }
 
-  return std::unique_ptr<cloud_trace::Aggregator>(new cloud_trace::Aggregator(
+  std::unique_ptr<cloud_trace::Aggregator> aggregator(new cloud_trace::Aggregator(
       &service_account_token_, url, aggregate_time_millisec, cache_max_size,
       minimum_qps, env_.get()));
+
+  if (server_config_ && server_config_->has_cloud_tracing_config() &&
+      server_config_->cloud_tracing_config().has_samling_config()) {
+    const auto& sampling_config =
+        server_config_->cloud_tracing_config().samling_config();
+    if (sampling_config.traces_per_minute() > 0) {
+      aggregator->sampler().set_traces_per_minute(
+          sampling_config.traces_per_minute());
+    }
+    for (const auto& override : sampling_config.method_qps_overrides()) {
+      aggregator->sampler().set_method_qps_override(override.first,
+                                                    override.second);
+    }
+  }
+
+  return aggregator;
+}
+
+void GlobalContext::ApplyTunableServerConfig(
+    const proto::ServerConfig& new_config) {
+  // Aggregation interval for gRPC streaming intermediate reports.
+  if (new_config.has_service_control_config() &&
+      new_config.service_control_config().intermediate_report_min_interval()) {
+    intermediate_report_interval_ =
+        new_config.service_control_config().intermediate_report_min_interval();
+  }
+
+  // JWKS cache lifetime; entries inserted after the change pick it up.
+  if (new_config.has_api_authentication_config() &&
+      new_config.api_authentication_config().jwks_cache_duration_in_s() > 0) {
+    jwks_cache_duration_in_s_ =
+        new_config.api_authentication_config().jwks_cache_duration_in_s();
+  }
+
+  if (new_config.has_experimental()) {
+    disable_log_status_ = new_config.experimental().disable_log_status();
+  }
+
+  // Trace sampling. The aggregator itself (upload URL, cache sizing) is
+  // built once at startup; only its sampler is re-tuned.
+  if (cloud_trace_aggregator_ && new_config.has_cloud_tracing_config() &&
+      new_config.cloud_tracing_config().has_samling_config()) {
+    const auto& sampling_config =
+        new_config.cloud_tracing_config().samling_config();
+    if (sampling_config.traces_per_minute() > 0) {
+      cloud_trace_aggregator_->sampler().set_traces_per_minute(
+          sampling_config.traces_per_minute());
+    }
+    for (const auto& override : sampling_config.method_qps_overrides()) {
+      cloud_trace_aggregator_->sampler().set_method_qps_override(
+          override.first, override.second);
+    }
+  }
 }
 
 auth::ServiceAccountToken* GlobalContext::GetInstanceIdentityToken(
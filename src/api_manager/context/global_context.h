@@ -18,10 +18,13 @@
 #include "src/api_manager/auth/authz_cache.h"
 #include "src/api_manager/auth/certs.h"
 #include "src/api_manager/auth/jwt_cache.h"
+#include "src/api_manager/auth/jwt_verify_pool.h"
 #include "src/api_manager/auth/service_account_token.h"
+#include "src/api_manager/cache_accountant.h"
 #include "src/api_manager/cloud_trace/cloud_trace.h"
 #include "src/api_manager/compute_platform.h"
 #include "src/api_manager/proto/server_config.pb.h"
+#include "src/api_manager/utils/token_bucket.h"
 
 namespace google {
 namespace api_manager {
@@ -57,6 +60,13 @@ class GlobalContext {
   auth::ServiceAccountToken *GetInstanceIdentityToken(
       const std::string &audience);
 
+  // The instance identity tokens fetched so far, keyed by audience. Used
+  // by the token refresher to keep them fresh.
+  const std::map<std::string, std::unique_ptr<auth::ServiceAccountToken>>
+      &instance_identity_token_map() const {
+    return instance_identity_token_map_;
+  }
+
   const std::string &metadata_server() const { return metadata_server_; }
 
   // cloud_trace
@@ -68,6 +78,13 @@ class GlobalContext {
     return server_config_;
   }
 
+  // Applies the tunable-safe fields of new_config in place: aggregation
+  // intervals, cache lifetimes, trace sampling and status logging. Fields
+  // that would require rebuilding long-lived state (credentials, cache
+  // sizes, metadata configuration, backends) are left untouched, so the
+  // proxy can be re-tuned under load without a worker restart.
+  void ApplyTunableServerConfig(const proto::ServerConfig &new_config);
+
   bool DisableLogStatus() const { return disable_log_status_; }
   bool always_print_primitive_fields() const {
     return always_print_primitive_fields_;
@@ -75,6 +92,10 @@ class GlobalContext {
   bool preserve_proto_field_names() const {
     return preserve_proto_field_names_;
   }
+  // Whether per-phase check latency histograms are recorded.
+  bool check_latency_statistics_enabled() const {
+    return check_latency_statistics_enabled_;
+  }
 
   // report interval can be override by server_config.
   int64_t intermediate_report_interval() const {
@@ -99,6 +120,24 @@ class GlobalContext {
 
   int jwks_cache_duration_in_s() const { return jwks_cache_duration_in_s_; }
 
+  // The JWT signature verification pool, or nullptr when verification
+  // runs inline on the event loop.
+  auth::JwtVerifyPool *jwt_verify_pool() { return jwt_verify_pool_.get(); }
+
+  // The global cache byte accountant, or nullptr when the server config
+  // has no cache_budget_config.
+  CacheAccountant *cache_accountant() { return cache_accountant_.get(); }
+
+  // Outbound call budgets from outbound_budget_config; nullptr means the
+  // destination is not budgeted.
+  utils::TokenBucket *check_call_budget() { return check_call_budget_.get(); }
+  utils::TokenBucket *report_flush_budget() {
+    return report_flush_budget_.get();
+  }
+  utils::TokenBucket *trace_upload_budget() {
+    return trace_upload_budget_.get();
+  }
+
   void set_rollout_id_func(SetRolloutIdFunc rollout_id_func) {
     rollout_id_func_ = rollout_id_func;
   }
@@ -139,6 +178,8 @@ class GlobalContext {
   // For gRPC transcoding
   bool always_print_primitive_fields_;
   bool preserve_proto_field_names_;
+  // Record per-phase check latency histograms
+  bool check_latency_statistics_enabled_;
 
   // The time interval for grpc intermediate report.
   int64_t intermediate_report_interval_;
@@ -152,6 +193,17 @@ class GlobalContext {
   // The jwks public key cache duration.
   int jwks_cache_duration_in_s_;
 
+  // Only created when async_signature_verification is set.
+  std::unique_ptr<auth::JwtVerifyPool> jwt_verify_pool_;
+
+  // Only created when cache_budget_config is set.
+  std::unique_ptr<CacheAccountant> cache_accountant_;
+
+  // Only created for the destinations outbound_budget_config budgets.
+  std::unique_ptr<utils::TokenBucket> check_call_budget_;
+  std::unique_ptr<utils::TokenBucket> report_flush_budget_;
+  std::unique_ptr<utils::TokenBucket> trace_upload_budget_;
+
   // The function to set rollout id fetched from Check and Report response.
   SetRolloutIdFunc rollout_id_func_;
 };
@@ -136,6 +136,42 @@ metadata_attributes {
   EXPECT_EQ(non_exist_token->GetAuthToken(), "");
 }
 
+TEST(GlobalContextTest, TestApplyTunableServerConfig) {
+  const char kServerConfig[] = R"(
+service_control_config {
+  intermediate_report_min_interval: 30
+}
+api_authentication_config {
+  jwks_cache_duration_in_s: 100
+}
+)";
+
+  std::unique_ptr<ApiManagerEnvInterface> env(
+      new testing::NiceMock<MockApiManagerEnvironment>());
+  GlobalContext ctx(std::move(env), kServerConfig);
+  EXPECT_EQ(ctx.intermediate_report_interval(), 30);
+  EXPECT_EQ(ctx.jwks_cache_duration_in_s(), 100);
+  EXPECT_FALSE(ctx.DisableLogStatus());
+
+  proto::ServerConfig new_config;
+  new_config.mutable_service_control_config()
+      ->set_intermediate_report_min_interval(5);
+  new_config.mutable_api_authentication_config()->set_jwks_cache_duration_in_s(
+      600);
+  new_config.mutable_experimental()->set_disable_log_status(true);
+  ctx.ApplyTunableServerConfig(new_config);
+
+  EXPECT_EQ(ctx.intermediate_report_interval(), 5);
+  EXPECT_EQ(ctx.jwks_cache_duration_in_s(), 600);
+  EXPECT_TRUE(ctx.DisableLogStatus());
+
+  // Unset fields leave the current values untouched.
+  proto::ServerConfig empty_config;
+  ctx.ApplyTunableServerConfig(empty_config);
+  EXPECT_EQ(ctx.intermediate_report_interval(), 5);
+  EXPECT_EQ(ctx.jwks_cache_duration_in_s(), 600);
+}
+
 }  // namespace context
 }  // namespace api_manager
 }  // namespace google
@@ -17,15 +17,21 @@
 
 #include "src/api_manager/context/request_context.h"
 #include "google/api/backend.pb.h"
+#include "src/api_manager/access_event.h"
 #include "src/api_manager/auth/lib/json_util.h"
+#include "src/api_manager/utils/clock.h"
+#include "src/api_manager/utils/format_util.h"
+#include "src/api_manager/utils/operation_id.h"
 #include "src/api_manager/utils/str_util.h"
+#include "src/api_manager/utils/trace_probes.h"
 
-#include <uuid/uuid.h>
+#include <strings.h>
+#include <mutex>
 #include <numeric>
 #include <sstream>
 #include <vector>
 
-using ::google::api_manager::auth::GetPrimitiveFieldValue;
+using ::google::api_manager::auth::GetPrimitiveFieldValues;
 using ::google::api_manager::cloud_trace::HeaderType;
 using ::google::api_manager::utils::Status;
 
@@ -40,6 +46,9 @@ const char kCloudTraceContextHeader[] = "X-Cloud-Trace-Context";
 // gRPC Trace Context Header
 const char kGRpcTraceContextHeader[] = "grpc-trace-bin";
 
+// W3C trace context header.
+const char kW3CTraceParentHeader[] = "traceparent";
+
 // Authorization Header
 const char kAuthorizationHeader[] = "Authorization";
 const char kXForwardedAuthorizationHeader[] = "X-Forwarded-Authorization";
@@ -49,6 +58,10 @@ const char kBearerPrefix[] = "Bearer ";
 // HTTP Method Override Header
 const char kHttpMethodOverrideHeader[] = "X-HTTP-Method-Override";
 
+// Request header the client sends (with any value) to opt into the
+// per-request latency attribution response header of the same name.
+const char kLatencyAttributionHeader[] = "X-Endpoint-Latency";
+
 // Log message prefix for a success method.
 const char kMessage[] = "Method: ";
 // Log message prefix for an ignored method.
@@ -61,9 +74,6 @@ const char kUnknownHttpVerb[] = "<Unknown HTTP Verb>";
 // operation name so we use this value until fix is available.
 const char kUnrecognizedOperation[] = "<Unknown Operation Name>";
 
-// Maximum 36 byte string for UUID
-const int kMaxUUIDBufSize = 40;
-
 // Default api key names
 const char kDefaultApiKeyQueryName1[] = "key";
 const char kDefaultApiKeyQueryName2[] = "api_key";
@@ -72,6 +82,49 @@ const char kDefaultApiKeyHeaderName[] = "x-api-key";
 // Delimiter of the IP addresses in the XFF header
 const char kClientIPHeaderDelimeter = ',';
 
+// Locates the |position|-th delimiter separated segment of |header|
+// without tokenizing the whole chain: a forward scan for non-negative
+// positions, a reverse scan from the end for negative ones (-1 is the
+// last segment). On success sets [begin, end) to the untrimmed segment
+// and returns true; returns false when the position is out of range.
+bool FindClientIPHeaderSegment(const std::string &header, int position,
+                               const char **begin, const char **end) {
+  const char *data = header.data();
+  const char *data_end = data + header.size();
+  if (position >= 0) {
+    const char *seg = data;
+    for (; position > 0; --position) {
+      const void *comma =
+          memchr(seg, kClientIPHeaderDelimeter, data_end - seg);
+      if (comma == nullptr) {
+        return false;
+      }
+      seg = static_cast<const char *>(comma) + 1;
+    }
+    const void *comma = memchr(seg, kClientIPHeaderDelimeter, data_end - seg);
+    *begin = seg;
+    *end = comma == nullptr ? data_end : static_cast<const char *>(comma);
+    return true;
+  }
+  const char *seg_end = data_end;
+  for (;;) {
+    const char *comma = seg_end;
+    while (comma != data && *(comma - 1) != kClientIPHeaderDelimeter) {
+      --comma;
+    }
+    if (++position == 0) {
+      *begin = comma;
+      *end = seg_end;
+      return true;
+    }
+    if (comma == data) {
+      // Fewer segments than the (negative) position reaches back.
+      return false;
+    }
+    seg_end = comma - 1;
+  }
+}
+
 // Header for android package name, used for api key restriction check.
 const char kXAndroidPackage[] = "x-android-package";
 
@@ -82,46 +135,114 @@ const char kXAndroidCert[] = "x-android-cert";
 // Header for IOS bundle identifier, used for api key restriction check.
 const char kXIosBundleId[] = "x-ios-bundle-identifier";
 
-// Genereates a UUID string
-std::string GenerateUUID() {
-  char uuid_buf[kMaxUUIDBufSize];
-  uuid_t uuid;
-  uuid_generate(uuid);
-  uuid_unparse(uuid, uuid_buf);
-  return uuid_buf;
+// Resolves a prioritized list of api-key query parameter names in a single
+// pass over the query string instead of rescanning it once per name.
+// Matches the semantics of Request::FindQuery() (ngx_http_arg): parameter
+// names compare case-insensitively, only the first occurrence of a name
+// counts, and a present-but-empty value counts as absent.
+bool FindFirstQueryMatch(const std::string &query_params,
+                         const std::vector<std::string> &names,
+                         std::string *value) {
+  // Offset and length of the first occurrence of each name's value;
+  // npos offset means the name was not seen.
+  std::vector<std::pair<size_t, size_t>> values(
+      names.size(), std::make_pair(std::string::npos, 0));
+  const size_t size = query_params.size();
+  size_t pos = 0;
+  while (pos < size) {
+    size_t amp = query_params.find('&', pos);
+    if (amp == std::string::npos) {
+      amp = size;
+    }
+    const size_t eq = query_params.find('=', pos);
+    if (eq != std::string::npos && eq < amp) {
+      const size_t name_len = eq - pos;
+      for (size_t i = 0; i < names.size(); ++i) {
+        if (values[i].first == std::string::npos &&
+            names[i].size() == name_len &&
+            strncasecmp(names[i].data(), query_params.data() + pos,
+                        name_len) == 0) {
+          values[i] = std::make_pair(eq + 1, amp - eq - 1);
+          break;
+        }
+      }
+    }
+    pos = amp + 1;
+  }
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (values[i].first != std::string::npos && values[i].second > 0) {
+      value->assign(query_params, values[i].first, values[i].second);
+      return true;
+    }
+  }
+  return false;
 }
 
+// Freelist backing RequestContext::operator new/delete. Contexts are
+// allocated and freed at a one-per-request rate, always on the worker
+// event loop; the mutex is only there for multi-threaded tests and is
+// uncontended in production.
+const size_t kContextPoolMaxSize = 64;
+std::mutex context_pool_mutex;
+std::vector<void *> context_pool;
+
 }  // namespace
 
 using context::ServiceContext;
 
+void *RequestContext::operator new(std::size_t size) {
+  if (size == sizeof(RequestContext)) {
+    std::lock_guard<std::mutex> lock(context_pool_mutex);
+    if (!context_pool.empty()) {
+      void *ptr = context_pool.back();
+      context_pool.pop_back();
+      return ptr;
+    }
+  }
+  return ::operator new(size);
+}
+
+void RequestContext::operator delete(void *ptr, std::size_t size) {
+  if (size == sizeof(RequestContext)) {
+    std::lock_guard<std::mutex> lock(context_pool_mutex);
+    if (context_pool.size() < kContextPoolMaxSize) {
+      context_pool.push_back(ptr);
+      return;
+    }
+  }
+  ::operator delete(ptr);
+}
+
 RequestContext::RequestContext(std::shared_ptr<ServiceContext> service_context,
                                std::unique_ptr<Request> request)
     : service_context_(service_context),
       request_(std::move(request)),
+      check_workflow_(nullptr),
+      check_workflow_index_(0),
+      query_bindings_extracted_(false),
       is_first_report_(true),
+      api_key_from_query_(false),
+      method_concurrency_acquired_(false),
+      latency_attribution_requested_(false),
       last_request_bytes_(0),
-      last_response_bytes_(0),
-      api_key_from_query_(false) {
-  start_time_ = std::chrono::system_clock::now();
+      last_response_bytes_(0) {
+  // Coarse is fine here: start_time_ only timestamps the report and
+  // feeds the streaming duration below, both millisecond-granular.
+  start_time_ = utils::CoarseNow();
   last_report_time_ = std::chrono::steady_clock::now();
-  operation_id_ = GenerateUUID();
+  check_start_time_ = last_report_time_;
+  operation_id_ = utils::GenerateOperationId();
   const std::string &method = GetRequestHTTPMethodWithOverride();
   const std::string &path = request_->GetUnparsedRequestPath();
-  std::string query_params = request_->GetQueryParameters();
+  query_params_ = request_->GetQueryParameters();
 
   // In addition to matching the method, service_context_->GetMethodCallInfo()
-  // will extract the variable bindings from the url. We need variable bindings
-  // only when we need to do transcoding. If this turns out to be a performance
-  // problem for non-transcoded calls, we have a couple of options:
-  // 1) Do not extract variable bindings here, and do the method matching again
-  //    with extracting variable bindings when transcoding is needed.
-  // 2) Store all the pieces needed for extracting variable bindings (such as
-  //    http template variables, url path parts) in MethodCallInfo and extract
-  //    variables lazily when needed.
-
-  method_call_ =
-      service_context_->GetMethodCallInfo(method, path, query_params);
+  // extracts the variable bindings from the url path. Bindings from the
+  // query string are only needed for transcoding and constant-address
+  // backend routing, so those are extracted lazily in
+  // ExtractQueryParameterBindings() when first consumed.
+
+  method_call_ = service_context_->GetMethodCallInfo(method, path);
 
   if (method_call_.method_info &&
       !method_call_.method_info->allow_unregistered_calls()) {
@@ -129,6 +250,10 @@ RequestContext::RequestContext(std::shared_ptr<ServiceContext> service_context,
   }
   request_->FindHeader("referer", &http_referer_);
 
+  std::string latency_opt_in;
+  latency_attribution_requested_ =
+      request_->FindHeader(kLatencyAttributionHeader, &latency_opt_in);
+
   // Enable trace if tracing is not force disabled and the triggering header is
   // set.
   if (service_context_->cloud_trace_aggregator()) {
@@ -139,20 +264,43 @@ RequestContext::RequestContext(std::shared_ptr<ServiceContext> service_context,
       // gRPC trace header found, the type of the header should be
       // GRPC_TRACE_CONTEXT
       header_type = HeaderType::GRPC_TRACE_CONTEXT;
+    } else if (request_->FindHeader(kW3CTraceParentHeader,
+                                    &trace_context_header)) {
+      header_type = HeaderType::W3C_TRACEPARENT;
     } else {
       request_->FindHeader(kCloudTraceContextHeader, &trace_context_header);
     }
 
+    std::string method_selector;
     std::string method_name = kUnrecognizedOperation;
     if (method_call_.method_info) {
-      method_name = method_call_.method_info->selector();
+      method_selector = method_call_.method_info->selector();
+      method_name = method_selector;
     }
     // qualify with the service name
     method_name = service_context_->service_name() + "/" + method_name;
     cloud_trace_.reset(cloud_trace::CreateCloudTrace(
         trace_context_header, method_name, header_type,
-        &service_context_->cloud_trace_aggregator()->sampler()));
+        &service_context_->cloud_trace_aggregator()->sampler(),
+        method_selector));
+  }
+}
+
+RequestContext::~RequestContext() {
+  if (method_concurrency_acquired_) {
+    method_call_.method_info->ReleaseConcurrency();
+  }
+}
+
+bool RequestContext::AcquireMethodConcurrency() {
+  if (method_concurrency_acquired_ || method_call_.method_info == nullptr) {
+    return true;
+  }
+  if (!method_call_.method_info->TryAcquireConcurrency()) {
+    return false;
   }
+  method_concurrency_acquired_ = true;
+  return true;
 }
 
 std::string RequestContext::GetRequestHTTPMethodWithOverride() {
@@ -169,40 +317,34 @@ std::string RequestContext::GetRequestHTTPMethodWithOverride() {
 }
 
 void RequestContext::ExtractApiKey() {
-  bool api_key_defined = false;
-  auto url_queries = method()->api_key_url_query_parameters();
-  if (url_queries) {
-    api_key_defined = true;
-    for (const auto &url_query : *url_queries) {
-      if (request_->FindQuery(url_query, &api_key_)) {
-        api_key_from_query_ = true;
-        return;
-      }
-    }
+  // If api_key locations are not specified for a method, check "key" first,
+  // if not, check "api_key" in query parameter.
+  static const std::vector<std::string> kDefaultApiKeyQueryNames{
+      kDefaultApiKeyQueryName1, kDefaultApiKeyQueryName2};
+
+  const std::vector<std::string> *url_queries =
+      method()->api_key_url_query_parameters();
+  const std::vector<std::string> *headers = method()->api_key_http_headers();
+  const bool api_key_defined = url_queries != nullptr || headers != nullptr;
+  if (!api_key_defined) {
+    url_queries = &kDefaultApiKeyQueryNames;
+  }
+
+  // All candidate query parameter names are resolved in one pass over the
+  // query string already captured in query_params_.
+  if (url_queries && FindFirstQueryMatch(query_params_, *url_queries,
+                                         &api_key_)) {
+    api_key_from_query_ = true;
+    return;
   }
 
-  auto headers = method()->api_key_http_headers();
   if (headers) {
-    api_key_defined = true;
     for (const auto &header : *headers) {
       if (request_->FindHeader(header, &api_key_)) {
         return;
       }
     }
-  }
-
-  if (!api_key_defined) {
-    // If api_key is not specified for a method,
-    // check "key" first, if not, check "api_key" in query parameter.
-    if (request_->FindQuery(kDefaultApiKeyQueryName1, &api_key_)) {
-      api_key_from_query_ = true;
-      return;
-    }
-
-    if (request_->FindQuery(kDefaultApiKeyQueryName2, &api_key_)) {
-      api_key_from_query_ = true;
-      return;
-    }
+  } else if (!api_key_defined) {
     request_->FindHeader(kDefaultApiKeyHeaderName, &api_key_);
   }
 }
@@ -219,13 +361,25 @@ void RequestContext::CompleteCheck(Status status) {
   auto temp_continuation = check_continuation_;
   check_continuation_ = nullptr;
 
+  if (service_context_->check_latency_statistics_enabled()) {
+    service_context_->check_latency_statistics()->total.Record(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - check_start_time_)
+            .count());
+  }
+
+  ESP_TRACE_PROBE(check_complete, method() ? method()->selector().c_str()
+                                           : kUnrecognizedOperation);
+
   temp_continuation(status);
 }
 
 void RequestContext::FillOperationInfo(service_control::OperationInfo *info) {
-  if (method()) {
-    info->operation_name = method()->selector();
-  } else {
+  // The method-stable strings (selector, api name and version) are read
+  // through method_info at fill time, so matched requests copy nothing
+  // here.
+  info->method_info = method();
+  if (!method()) {
     info->operation_name = kUnrecognizedOperation;
   }
   info->operation_id = operation_id_;
@@ -250,10 +404,19 @@ void RequestContext::FillComputePlatform(
 }
 
 void RequestContext::FillLogMessage(service_control::ReportRequestInfo *info) {
+  // The api fields the metrics and the other log fields depend on are
+  // read through info->method_info (set in FillOperationInfo), so there
+  // is nothing to copy here.
+
+  // In access event mode the readable message is replaced by the binary
+  // record the caller appends instead; its formatting is the cost the
+  // mode removes.
+  if (service_context_->config()->server_config()->access_event_config()
+          .enabled()) {
+    return;
+  }
+
   if (method()) {
-    info->api_method = method()->selector();
-    info->api_name = method()->api_name();
-    info->api_version = method()->api_version();
     info->log_message = std::string(kMessage) + method()->selector();
     if (info->response_code >= 400) {
       info->log_message += std::string(" failed: ") + info->status.ToString();
@@ -268,6 +431,31 @@ void RequestContext::FillLogMessage(service_control::ReportRequestInfo *info) {
   }
 }
 
+void RequestContext::AppendAccessEvent(
+    const service_control::ReportRequestInfo &info) {
+  AccessEventRecord record;
+  record.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                            utils::CoarseNow().time_since_epoch())
+                            .count();
+  record.request_size = info.request_size;
+  record.response_size = info.response_size;
+  record.request_time_ms = info.latency.request_time_ms;
+  record.backend_time_ms = info.latency.backend_time_ms;
+  record.response_code = info.response_code;
+  record.status_code = info.status.code();
+  record.frontend_protocol = static_cast<int32_t>(info.frontend_protocol);
+  record.backend_protocol = static_cast<int32_t>(info.backend_protocol);
+  SetAccessEventField(record.api_method, sizeof(record.api_method),
+                      info.canonical_api_method());
+  SetAccessEventField(record.api_key, sizeof(record.api_key), info.api_key);
+  SetAccessEventField(record.http_method, sizeof(record.http_method),
+                      info.method);
+
+  const auto &config =
+      service_context_->config()->server_config()->access_event_config();
+  AccessEventBuffer::Instance(config.buffer_records())->Append(record);
+}
+
 void RequestContext::FillHttpHeaders(const Response *response,
                                      service_control::ReportRequestInfo *info) {
   auto serverConfig = service_context_->config()->server_config();
@@ -295,20 +483,48 @@ void RequestContext::FillHttpHeaders(const Response *response,
 }
 
 void RequestContext::FillJwtPayloads(service_control::ReportRequestInfo *info) {
-  auto serverConfig = service_context_->config()->server_config();
-  if (serverConfig->has_service_control_config() &&
-      serverConfig->service_control_config().log_jwt_payload().size() != 0) {
-    for (const auto &payload_path :
-         serverConfig->service_control_config().log_jwt_payload()) {
-      std::string payload_value;
-      if (GetPrimitiveFieldValue(auth_claims_, payload_path, &payload_value)) {
-        info->jwt_payloads =
-            info->jwt_payloads + payload_path + "=" + payload_value + ";";
-      }
+  // The payload paths were compiled once per service; one parse of the
+  // claims covers all of them.
+  const auto &plan = service_context_->log_jwt_payload_plan();
+  if (plan.empty()) {
+    return;
+  }
+  std::vector<std::string> payload_values;
+  std::vector<bool> found;
+  if (!GetPrimitiveFieldValues(auth_claims_, plan, &payload_values, &found)) {
+    return;
+  }
+  const auto &payload_paths = service_context_->config()
+                                  ->server_config()
+                                  ->service_control_config()
+                                  .log_jwt_payload();
+  for (int i = 0; i < payload_paths.size(); ++i) {
+    if (found[i]) {
+      info->jwt_payloads = info->jwt_payloads + payload_paths.Get(i) + "=" +
+                           payload_values[i] + ";";
     }
   }
 }
 
+std::string RequestContext::FormatLatencyAttribution() const {
+  if (!latency_attribution_requested_) {
+    return "";
+  }
+  std::string out;
+  out.reserve(64);
+  out += "fetch=";
+  out += utils::Uint64ToString(phase_latency_.fetch_token);
+  out += ";auth=";
+  out += utils::Uint64ToString(phase_latency_.auth);
+  out += ";rules=";
+  out += utils::Uint64ToString(phase_latency_.security_rules);
+  out += ";check=";
+  out += utils::Uint64ToString(phase_latency_.service_control);
+  out += ";quota=";
+  out += utils::Uint64ToString(phase_latency_.quota);
+  return out;
+}
+
 void RequestContext::FillCheckRequestInfo(
     service_control::CheckRequestInfo *info) {
   FillOperationInfo(info);
@@ -329,19 +545,46 @@ void RequestContext::FillAllocateQuotaRequestInfo(
 
 void RequestContext::FillReportRequestInfo(
     Response *response, service_control::ReportRequestInfo *info) {
-  FillOperationInfo(info);
-  FillLocation(info);
-  FillComputePlatform(info);
-
-  info->url = request_->GetUnparsedRequestPath();
-  info->method = GetRequestHTTPMethodWithOverride();
+  if (info->is_final_report || intermediate_report_skeleton_ == nullptr) {
+    FillOperationInfo(info);
+    FillLocation(info);
+    FillComputePlatform(info);
+
+    info->url = request_->GetUnparsedRequestPath();
+    info->method = GetRequestHTTPMethodWithOverride();
+
+    info->frontend_protocol = request_->GetFrontendProtocol();
+    info->backend_protocol = request_->GetBackendProtocol();
+    info->check_response_info = check_response_info_;
+
+    // When the Check of this request did not resolve the consumer
+    // project (e.g. Check was skipped), recover it from the cache filled
+    // by earlier Check responses, so report fill never recomputes the
+    // mapping.
+    if (info->check_response_info.consumer_project_id.empty() &&
+        !api_key_.empty()) {
+      service_context_->consumer_project_cache().Lookup(
+          api_key_, &info->check_response_info.consumer_project_id);
+    }
 
-  info->frontend_protocol = request_->GetFrontendProtocol();
-  info->backend_protocol = request_->GetBackendProtocol();
-  info->check_response_info = check_response_info_;
+    info->auth_issuer = auth_issuer_;
+    info->auth_audience = auth_audience_;
 
-  info->auth_issuer = auth_issuer_;
-  info->auth_audience = auth_audience_;
+    if (!info->is_final_report) {
+      // None of the fields above change for the lifetime of the stream.
+      // Cache them now - before the per-report byte deltas go in - so later
+      // intermediate reports skip the fill path entirely.
+      intermediate_report_skeleton_.reset(
+          new service_control::ReportRequestInfo(*info));
+    }
+  } else {
+    // Intermediate report with a cached skeleton: reuse the static fields
+    // and only compute what changes between reports.
+    const bool is_first_report = info->is_first_report;
+    *info = *intermediate_report_skeleton_;
+    info->is_first_report = is_first_report;
+    info->is_final_report = false;
+  }
 
   if (!info->is_final_report) {
     // Make sure we send delta metrics for intermediate reports.
@@ -353,6 +596,7 @@ void RequestContext::FillReportRequestInfo(
   } else {
     info->request_size = response->GetRequestSize();
     info->response_size = response->GetResponseSize();
+    info->memory_high_water = response->GetMemoryHighWaterMark();
     info->request_bytes = info->request_size - last_request_bytes_;
     if (info->request_bytes < 0) {
       info->request_bytes = 0;
@@ -369,7 +613,7 @@ void RequestContext::FillReportRequestInfo(
 
     info->streaming_durations =
         std::chrono::duration_cast<std::chrono::microseconds>(
-            std::chrono::system_clock::now() - start_time_)
+            utils::CoarseNow() - start_time_)
             .count();
 
     info->status = response->GetResponseStatus();
@@ -380,6 +624,7 @@ void RequestContext::FillReportRequestInfo(
 
     FillHttpHeaders(response, info);
     FillJwtPayloads(info);
+    info->latency_attribution = FormatLatencyAttribution();
     bool is_streaming = false;
     if (method() &&
         (method()->request_streaming() || method()->response_streaming())) {
@@ -388,32 +633,34 @@ void RequestContext::FillReportRequestInfo(
     if (!is_streaming) {
       response->GetLatencyInfo(&info->latency);
     }
+
+    // After the latency fill so the record carries it.
+    if (service_context_->config()->server_config()->access_event_config()
+            .enabled()) {
+      AppendAccessEvent(*info);
+    }
   }
 }
 
 const std::string RequestContext::FindClientIPAddress() {
-  auto serverConfig = service_context_->config()->server_config();
+  const Config *config = service_context_->config();
   std::string client_ip_header;
 
-  if (serverConfig->has_client_ip_extraction_config() &&
-      serverConfig->client_ip_extraction_config().client_ip_header().length() >
-          0 &&
-      request_->FindHeader(
-          serverConfig->client_ip_extraction_config().client_ip_header(),
-          &client_ip_header)) {
-    // split headers
-    std::vector<std::string> secments;
-    utils::Split(client_ip_header, kClientIPHeaderDelimeter, &secments);
-    int client_ip_header_position =
-        serverConfig->client_ip_extraction_config().client_ip_position();
-
-    if (client_ip_header_position < 0) {
-      client_ip_header_position = secments.size() + client_ip_header_position;
-    }
-
-    if (client_ip_header_position >= 0 &&
-        client_ip_header_position < (int)secments.size()) {
-      return utils::Trim(secments[client_ip_header_position]);
+  if (!config->client_ip_header().empty() &&
+      request_->FindHeader(config->client_ip_header(), &client_ip_header)) {
+    const char *begin;
+    const char *end;
+    if (FindClientIPHeaderSegment(client_ip_header,
+                                  config->client_ip_position(), &begin,
+                                  &end)) {
+      // Trim the surrounding spaces of the segment in place.
+      while (begin != end && *begin == ' ') {
+        ++begin;
+      }
+      while (end != begin && *(end - 1) == ' ') {
+        --end;
+      }
+      return std::string(begin, end);
     }
   }
 
@@ -429,18 +676,39 @@ void RequestContext::StartBackendSpanAndSetTraceContext() {
   std::string trace_context_header = cloud_trace()->ToTraceContextHeader(
       backend_span_->trace_span()->span_id());
 
-  // Set trace context header to backend.
-  Status status = request()->AddHeaderToBackend(
-      cloud_trace()->header_type() == HeaderType::CLOUD_TRACE_CONTEXT
-          ? kCloudTraceContextHeader
-          : kGRpcTraceContextHeader,
-      trace_context_header);
+  // Set trace context header to backend, in the same format it came in.
+  const char *header_name;
+  switch (cloud_trace()->header_type()) {
+    case HeaderType::GRPC_TRACE_CONTEXT:
+      header_name = kGRpcTraceContextHeader;
+      break;
+    case HeaderType::W3C_TRACEPARENT:
+      header_name = kW3CTraceParentHeader;
+      break;
+    default:
+      header_name = kCloudTraceContextHeader;
+      break;
+  }
+  Status status =
+      request()->AddHeaderToBackend(header_name, trace_context_header);
   if (!status.ok()) {
     service_context()->env()->LogError(
         "Failed to set trace context header to backend.");
   }
 }
 
+void RequestContext::ExtractQueryParameterBindings() const {
+  if (query_bindings_extracted_) {
+    return;
+  }
+  query_bindings_extracted_ = true;
+  if (method_call_.method_info != nullptr &&
+      service_context_->config() != nullptr) {
+    service_context_->config()->AppendQueryParameterBindings(query_params_,
+                                                             &method_call_);
+  }
+}
+
 std::string RequestContext::GetAuthorizationUrl() const {
   if (method_call_.method_info == nullptr) {
     return "";
@@ -468,6 +736,7 @@ std::string RequestContext::GetBackendPath() const {
     }
   } else if (method_call_.method_info->backend_path_translation() ==
              ::google::api::BackendRule_PathTranslation_CONSTANT_ADDRESS) {
+    ExtractQueryParameterBindings();
     std::string parameters;
     for (std::size_t i = 0; i != method_call_.variable_bindings.size(); i++) {
       auto &variable_binding = method_call_.variable_bindings[i];
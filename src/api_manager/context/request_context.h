@@ -28,14 +28,40 @@
 
 namespace google {
 namespace api_manager {
+
+class CheckWorkflow;
+
 namespace context {
 
+// Per-phase check latency for one request, in microseconds. Only
+// accumulated when the client opted into latency attribution; see
+// RequestContext::latency_attribution_requested(). The fields mirror
+// the CheckLatencyStatistics histograms so the check workflow can
+// address both through member pointers in its handler table.
+struct PhaseLatency {
+  uint64_t fetch_token = 0;
+  uint64_t auth = 0;
+  uint64_t security_rules = 0;
+  uint64_t service_control = 0;
+  uint64_t quota = 0;
+};
+
 // Stores request related data to be used by CheckHandler.
 class RequestContext {
  public:
   RequestContext(std::shared_ptr<context::ServiceContext> service_context,
                  std::unique_ptr<Request> request);
 
+  // Releases the method concurrency token, if one was acquired.
+  ~RequestContext();
+
+  // One context is allocated and freed per request; both come from a
+  // small per-process freelist so the hot path skips the general-purpose
+  // allocator (the same reasoning as the protobuf pools in
+  // service_control/aggregated.h).
+  static void *operator new(std::size_t size);
+  static void operator delete(void *ptr, std::size_t size);
+
   // Get the ApiManagerImpl object.
   context::ServiceContext *service_context() const {
     return service_context_.get();
@@ -47,8 +73,13 @@ class RequestContext {
   // Get the method info.
   const MethodInfo *method() const { return method_call_.method_info; }
 
-  // Get the method info.
-  const MethodCallInfo *method_call() const { return &method_call_; }
+  // Get the method call info. The variable bindings from the query string
+  // are extracted lazily on the first call; passthrough requests that never
+  // consume the bindings skip that work entirely.
+  const MethodCallInfo *method_call() const {
+    ExtractQueryParameterBindings();
+    return &method_call_;
+  }
 
   // Get the api key.
   const std::string &api_key() const { return api_key_; }
@@ -78,6 +109,60 @@ class RequestContext {
   // Complete check.
   void CompleteCheck(utils::Status status);
 
+  // Admission control. Acquires a concurrency token for the resolved
+  // method; returns false when the method is at its concurrent request
+  // limit. The token is held until the context is destroyed, so it
+  // covers the whole lifetime of the request including the backend call.
+  // Idempotent; methods without a limit (and unresolved methods) always
+  // admit.
+  bool AcquireMethodConcurrency();
+
+  // Check workflow progress for this request. The workflow keeps its
+  // position here so each step's continuation only captures the raw
+  // context pointer; the self reference keeps the context alive until the
+  // workflow completes.
+  void BeginCheckWorkflow(CheckWorkflow *workflow,
+                          std::shared_ptr<RequestContext> self) {
+    check_workflow_ = workflow;
+    check_workflow_index_ = 0;
+    check_workflow_self_ = std::move(self);
+  }
+  CheckWorkflow *check_workflow() const { return check_workflow_; }
+  size_t check_workflow_index() const { return check_workflow_index_; }
+  void set_check_workflow_index(size_t index) {
+    check_workflow_index_ = index;
+  }
+  const std::shared_ptr<RequestContext> &check_workflow_self() const {
+    return check_workflow_self_;
+  }
+  std::shared_ptr<RequestContext> ReleaseCheckWorkflowSelf() {
+    return std::move(check_workflow_self_);
+  }
+
+  // Start time of the current check workflow phase; maintained by the
+  // check workflow when per-phase latency statistics are enabled.
+  std::chrono::steady_clock::time_point check_phase_start_time() const {
+    return check_phase_start_time_;
+  }
+  void set_check_phase_start_time(std::chrono::steady_clock::time_point tp) {
+    check_phase_start_time_ = tp;
+  }
+
+  // Whether the client opted into per-request latency attribution by
+  // sending the X-Endpoint-Latency request header.
+  bool latency_attribution_requested() const {
+    return latency_attribution_requested_;
+  }
+
+  // Per-phase check latency accumulated for this request; written by the
+  // check workflow only when latency attribution was requested.
+  PhaseLatency *phase_latency() { return &phase_latency_; }
+
+  // Renders the accumulated phase latencies as the compact
+  // "fetch=N;auth=N;rules=N;check=N;quota=N" breakdown, values in
+  // microseconds. Empty when the client did not opt in.
+  std::string FormatLatencyAttribution() const;
+
   // Sets auth issuer to request context.
   void set_auth_issuer(const std::string &issuer) { auth_issuer_ = issuer; }
 
@@ -121,6 +206,15 @@ class RequestContext {
     last_report_time_ = tp;
   }
 
+  // Returns true if any stream bytes moved since the last intermediate
+  // report was sent. Used to elide intermediate reports for idle
+  // long-lived streams, whose counters would otherwise be re-reported
+  // unchanged every interval.
+  bool HasStreamActivitySinceLastReport() const {
+    return request_->GetGrpcRequestBytes() != last_request_bytes_ ||
+           request_->GetGrpcResponseBytes() != last_response_bytes_;
+  }
+
   // Get the HTTP method to be used for the request. This method understands the
   // X-Http-Method-Override header and if present, returns the
   // X-Http-Method-Override method. Otherwise, the actual HTTP method is
@@ -169,6 +263,11 @@ class RequestContext {
   // Fill log message.
   void FillLogMessage(service_control::ReportRequestInfo *info);
 
+  // Appends a binary access event record for the completed request to
+  // the per-worker ring buffer. Used in place of the log message when
+  // the server config enables access events.
+  void AppendAccessEvent(const service_control::ReportRequestInfo &info);
+
   // Fill HTTP headers.
   void FillHttpHeaders(const Response *response,
                        service_control::ReportRequestInfo *info);
@@ -183,21 +282,62 @@ class RequestContext {
   // doesn't match, returns request_->GetClientIP()
   const std::string FindClientIPAddress();
 
+  // Appends the variable bindings from the query string to method_call_ the
+  // first time the bindings are consumed. No-op afterwards.
+  void ExtractQueryParameterBindings() const;
+
+  // Member order is deliberate: the fields the check workflow touches on
+  // every step - the method call info, api key, per-request flags and the
+  // workflow cursor - sit together at the front of the object so the
+  // check-phase working set spans a cache line or two, while the fields
+  // below the marker are written once and read only when the report is
+  // filled (or not at all on the common path).
+
   // The ApiManagerImpl object.
   std::shared_ptr<context::ServiceContext> service_context_;
 
   // request object to encapsulate request data.
   std::unique_ptr<Request> request_;
 
-  // The final check continuation
-  std::function<void(utils::Status status)> check_continuation_;
+  // The check workflow driving this request and its current handler
+  // index; see BeginCheckWorkflow().
+  CheckWorkflow *check_workflow_;
+  size_t check_workflow_index_;
 
-  // The method info from service config.
-  MethodCallInfo method_call_;
+  // Whether the query parameter bindings were appended to method_call_.
+  mutable bool query_bindings_extracted_;
 
-  // Randomly generated UUID for each request, passed to service control
-  // Check and Report calls.
-  std::string operation_id_;
+  // Flag to indicate the first report.
+  bool is_first_report_;
+
+  // Whether the api key appears in the url query.
+  bool api_key_from_query_;
+
+  // Whether a method concurrency token is held; see
+  // AcquireMethodConcurrency().
+  bool method_concurrency_acquired_;
+
+  // Whether the client opted into latency attribution; checked by the
+  // check workflow on every step.
+  bool latency_attribution_requested_;
+
+  // Steady-clock counterpart of start_time_ below, used as the base of
+  // the total check latency histogram.
+  std::chrono::steady_clock::time_point check_start_time_;
+
+  // Start time of the current check workflow phase; see
+  // check_phase_start_time().
+  std::chrono::steady_clock::time_point check_phase_start_time_;
+
+  // Per-phase latencies for this request; see phase_latency().
+  PhaseLatency phase_latency_;
+
+  // Keeps the context alive between check workflow steps.
+  std::shared_ptr<RequestContext> check_workflow_self_;
+
+  // The method info from service config. Mutable so the query parameter
+  // bindings can be appended lazily from const accessors.
+  mutable MethodCallInfo method_call_;
 
   // api key.
   std::string api_key_;
@@ -205,6 +345,20 @@ class RequestContext {
   // Pass check response data to Report call.
   service_control::CheckResponseInfo check_response_info_;
 
+  // ---- Report- and trace-only state below; cold during the check phase.
+
+  // The final check continuation, consumed once when the check workflow
+  // completes.
+  std::function<void(utils::Status status)> check_continuation_;
+
+  // The raw query string of the request, kept for the lazy binding
+  // extraction above.
+  std::string query_params_;
+
+  // Randomly generated UUID for each request, passed to service control
+  // Check and Report calls.
+  std::string operation_id_;
+
   // Needed by both Check() and Report, extract it once and store it here.
   std::string http_referer_;
 
@@ -230,9 +384,6 @@ class RequestContext {
   // Start time of the request_context instantiation.
   std::chrono::system_clock::time_point start_time_;
 
-  // Flag to indicate the first report.
-  bool is_first_report_;
-
   // The time point of last intermediate report
   std::chrono::steady_clock::time_point last_report_time_;
 
@@ -240,11 +391,14 @@ class RequestContext {
   int64_t last_request_bytes_;
   int64_t last_response_bytes_;
 
+  // The static part of the report info, cached after the first intermediate
+  // fill. Later intermediate reports for the same stream only update the
+  // byte deltas instead of re-running the whole fill path.
+  std::unique_ptr<service_control::ReportRequestInfo>
+      intermediate_report_skeleton_;
+
   // JWT auth token.
   std::string auth_token_;
-
-  // Whether the api key appears in the url query.
-  bool api_key_from_query_;
 };
 
 }  // namespace context
@@ -15,7 +15,9 @@
 ////////////////////////////////////////////////////////////////////////////////
 //
 #include "src/api_manager/context/service_context.h"
+#include "src/api_manager/auth/lib/json_util.h"
 #include "src/api_manager/service_control/aggregated.h"
+#include "src/api_manager/utils/trace_probes.h"
 
 namespace google {
 namespace api_manager {
@@ -25,14 +27,67 @@ namespace {
 
 const char kHTTPHeadMethod[] = "HEAD";
 const char kHTTPGetMethod[] = "GET";
+
+// The consumer project cache size and TTL. The api_key -> consumer
+// project mapping is nearly immutable, so the TTL is much longer than
+// the check cache TTLs.
+const int kConsumerProjectCacheEntries = 10000;
+const int kConsumerProjectCacheExpirationMs = 3600 * 1000;  // 1 hour.
+
+// Returns the configured JWT cache size, or 0 to use the default.
+int64_t JwtCacheSizeInBytes(
+    const std::shared_ptr<GlobalContext>& global_context) {
+  if (global_context->server_config() &&
+      global_context->server_config()->has_api_authentication_config()) {
+    return global_context->server_config()
+        ->api_authentication_config()
+        .jwt_cache_size_in_bytes();
+  }
+  return 0;
+}
 }  // namespace
 
 ServiceContext::ServiceContext(std::shared_ptr<GlobalContext> global_context,
                                std::unique_ptr<Config> config)
     : global_context_(global_context),
       config_(std::move(config)),
-      service_control_(CreateInterface()) {
+      jwt_cache_(JwtCacheSizeInBytes(global_context)),
+      consumer_project_cache_(kConsumerProjectCacheEntries,
+                              kConsumerProjectCacheExpirationMs),
+      check_latency_statistics_(),
+      service_control_(CreateInterface()),
+      jwt_cache_budget_id_(-1),
+      authz_cache_budget_id_(-1) {
   config_->set_server_config(global_context_->server_config());
+  if (global_context_->server_config() &&
+      global_context_->server_config()->has_service_control_config()) {
+    const auto& log_jwt_payload = global_context_->server_config()
+                                      ->service_control_config()
+                                      .log_jwt_payload();
+    log_jwt_payload_plan_ = auth::CompileFieldPaths(std::vector<std::string>(
+        log_jwt_payload.begin(), log_jwt_payload.end()));
+  }
+  if (global_context_->cache_accountant()) {
+    auto* accountant = global_context_->cache_accountant();
+    jwt_cache_budget_id_ = accountant->Register(
+        "jwt_cache", [this]() { return jwt_cache_.EstimatedBytes(); },
+        [this](double fraction) { jwt_cache_.ShedFraction(fraction); });
+    authz_cache_budget_id_ = accountant->Register(
+        "authz_cache", [this]() { return authz_cache_.EstimatedBytes(); },
+        [this](double fraction) { authz_cache_.ShedFraction(fraction); });
+  }
+  if (RequireAuth()) {
+    jwks_refresher_.reset(new auth::JwksRefresher(
+        env(), &certs_,
+        [this](const std::string& issuer) -> std::string {
+          std::string url;
+          const bool try_openid = config_->GetJwksUri(issuer, &url);
+          // Only keys with a known jwks_uri are refreshed in the
+          // background; OpenID discovery stays on the request path.
+          return try_openid ? std::string() : url;
+        },
+        global_context_->jwks_cache_duration_in_s()));
+  }
 }
 
 ServiceContext::ServiceContext(std::unique_ptr<ApiManagerEnvInterface> env,
@@ -42,20 +97,52 @@ ServiceContext::ServiceContext(std::unique_ptr<ApiManagerEnvInterface> env,
           std::make_shared<GlobalContext>(std::move(env), server_config),
           std::move(config)) {}
 
+ServiceContext::~ServiceContext() {
+  // The accountant's callbacks reference the caches; drop them before the
+  // caches are destroyed.
+  if (global_context_->cache_accountant()) {
+    global_context_->cache_accountant()->Unregister(jwt_cache_budget_id_);
+    global_context_->cache_accountant()->Unregister(authz_cache_budget_id_);
+  }
+}
+
+void ServiceContext::StartDraining(
+    std::shared_ptr<ServiceContext> successor) {
+  if (drain_successor_ || !successor || successor.get() == this) {
+    return;
+  }
+  drain_successor_ = successor;
+  if (service_control_ && successor->service_control()) {
+    service_control_->StartDraining(successor->service_control());
+  }
+}
+
+void ServiceContext::StopDraining() {
+  if (!drain_successor_) {
+    return;
+  }
+  drain_successor_.reset();
+  if (service_control_) {
+    service_control_->StopDraining();
+  }
+}
+
 MethodCallInfo ServiceContext::GetMethodCallInfo(
-    const std::string& http_method, const std::string& url,
-    const std::string& query_params) const {
+    const std::string& http_method, const std::string& url) const {
   if (config_ == nullptr) {
     return MethodCallInfo();
   }
   MethodCallInfo method_call_info =
-      config_->GetMethodCallInfo(http_method, url, query_params);
+      config_->GetMethodCallInfo(http_method, url);
   // HEAD should be treated as GET unless it is specified from service_config.
   if (method_call_info.method_info == nullptr &&
       http_method == kHTTPHeadMethod) {
-    method_call_info =
-        config_->GetMethodCallInfo(kHTTPGetMethod, url, query_params);
+    method_call_info = config_->GetMethodCallInfo(kHTTPGetMethod, url);
   }
+  ESP_TRACE_PROBE(method_lookup_done,
+                  method_call_info.method_info
+                      ? method_call_info.method_info->selector().c_str()
+                      : "");
   return method_call_info;
 }
 
@@ -72,7 +159,9 @@ std::unique_ptr<service_control::Interface> ServiceContext::CreateInterface() {
       service_control::Aggregated::Create(
           config_->service(), global_context_->server_config().get(), env(),
           global_context_->service_account_token(),
-          global_context_->rollout_id_func()));
+          global_context_->rollout_id_func(),
+          global_context_->check_call_budget(),
+          global_context_->report_flush_budget()));
 }
 
 }  // namespace context
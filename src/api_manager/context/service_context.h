@@ -15,9 +15,16 @@
 #ifndef API_MANAGER_CONTEXT_SERVICE_CONTEXT_H_
 #define API_MANAGER_CONTEXT_SERVICE_CONTEXT_H_
 
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "include/api_manager/api_manager.h"
 #include "include/api_manager/method.h"
+#include "src/api_manager/auth/jwks_refresher.h"
 #include "src/api_manager/config.h"
 #include "src/api_manager/context/global_context.h"
+#include "src/api_manager/service_control/consumer_project_cache.h"
 #include "src/api_manager/service_control/interface.h"
 
 namespace google {
@@ -36,6 +43,8 @@ class ServiceContext {
                  const std::string &server_config,
                  std::unique_ptr<Config> config);
 
+  ~ServiceContext();
+
   bool Enabled() const { return RequireAuth() || service_control_; }
 
   const std::string &service_name() const { return config_->service_name(); }
@@ -50,14 +59,24 @@ class ServiceContext {
 
   ApiManagerEnvInterface *env() { return global_context_->env(); }
 
+  // Resolves the method for (http_method, url). Variable bindings from query
+  // parameters are not extracted; RequestContext appends them lazily when
+  // they are first consumed.
   MethodCallInfo GetMethodCallInfo(const std::string &http_method,
-                                   const std::string &url,
-                                   const std::string &query_params) const;
+                                   const std::string &url) const;
 
   service_control::Interface *service_control() const {
     return service_control_.get();
   }
 
+  // Epoch drain on rollout: stops this context's own service control
+  // flush schedule and forwards residual reporting to |successor| while
+  // in-flight streams - which keep this context alive via shared_ptr -
+  // finish. StopDraining revives the context when its config re-enters
+  // traffic. Both are called from ApiManagerImpl::PublishDeployment.
+  void StartDraining(std::shared_ptr<ServiceContext> successor);
+  void StopDraining();
+
   bool RequireAuth() const {
     return !global_context_->is_auth_force_disabled() && config_->HasAuth();
   }
@@ -70,8 +89,54 @@ class ServiceContext {
   auth::Certs &certs() { return certs_; }
   auth::JwtCache &jwt_cache() { return jwt_cache_; }
 
+  // The background JWKS refresher. nullptr when auth is not required.
+  auth::JwksRefresher *jwks_refresher() { return jwks_refresher_.get(); }
+
   auth::AuthzCache &authz_cache() { return authz_cache_; }
 
+  // The api_key -> consumer project cache, filled from Check responses
+  // and consulted by report fill.
+  service_control::ConsumerProjectCache &consumer_project_cache() {
+    return consumer_project_cache_;
+  }
+
+  // The ruleset name of this service's Firebase release, cached after a
+  // successful release fetch so repeat requests skip that round trip.
+  // Returns an empty string when nothing is cached or the entry expired.
+  const std::string &firebase_ruleset_id(
+      const std::chrono::system_clock::time_point &now) {
+    if (now > firebase_ruleset_id_exp_) {
+      firebase_ruleset_id_.clear();
+    }
+    return firebase_ruleset_id_;
+  }
+
+  void set_firebase_ruleset_id(
+      const std::string &ruleset_id,
+      const std::chrono::system_clock::time_point &exp) {
+    firebase_ruleset_id_ = ruleset_id;
+    firebase_ruleset_id_exp_ = exp;
+  }
+
+  // The log_jwt_payload paths from the server config, each pre-split on
+  // "." at construction. Report fill hands this plan to
+  // auth::GetPrimitiveFieldValues so every logged payload is extracted
+  // from a single parse of the auth claims.
+  const std::vector<std::vector<std::string>> &log_jwt_payload_plan() const {
+    return log_jwt_payload_plan_;
+  }
+
+  // Whether per-phase check latency histograms are recorded.
+  bool check_latency_statistics_enabled() const {
+    return global_context_->check_latency_statistics_enabled();
+  }
+
+  // The per-phase check latency histograms for this service, written by
+  // the check workflow when check_latency_statistics_enabled().
+  CheckLatencyStatistics *check_latency_statistics() {
+    return &check_latency_statistics_;
+  }
+
   bool GetJwksUri(const std::string &issuer, std::string *url) {
     return config_->GetJwksUri(issuer, url);
   }
@@ -107,10 +172,37 @@ class ServiceContext {
   auth::Certs certs_;
   auth::JwtCache jwt_cache_;
 
+  // Keeps cached JWKS keys fresh ahead of their expiration.
+  std::unique_ptr<auth::JwksRefresher> jwks_refresher_;
+
   auth::AuthzCache authz_cache_;
 
+  // The api_key -> consumer project cache; see consumer_project_cache().
+  service_control::ConsumerProjectCache consumer_project_cache_;
+
+  // The cached ruleset name of this service's Firebase release and when
+  // it stops being reused; see firebase_ruleset_id().
+  std::string firebase_ruleset_id_;
+  std::chrono::system_clock::time_point firebase_ruleset_id_exp_;
+
+  // The compiled log_jwt_payload paths; see log_jwt_payload_plan().
+  std::vector<std::vector<std::string>> log_jwt_payload_plan_;
+
+  // Per-phase check latency histograms; see check_latency_statistics().
+  CheckLatencyStatistics check_latency_statistics_;
+
   // The service control object.
   std::unique_ptr<service_control::Interface> service_control_;
+
+  // The context that replaced this one in traffic, held while draining
+  // so the interface its reports are forwarded to stays alive; see
+  // StartDraining().
+  std::shared_ptr<ServiceContext> drain_successor_;
+
+  // Registration ids of jwt_cache_ and authz_cache_ with the global
+  // cache accountant; -1 when no budget is configured.
+  int jwt_cache_budget_id_;
+  int authz_cache_budget_id_;
 };
 
 }  // namespace context
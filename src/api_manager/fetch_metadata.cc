@@ -120,7 +120,13 @@ void GlobalFetchServiceAccountToken(
         continuation(Status::OK);
         return;
       }
-      break;
+      // No token to fall back on. Join the in-flight fetch instead of
+      // issuing another request; the fetch completion runs the queued
+      // callbacks. Without this, every request that arrives while the
+      // first fetch for an audience is outstanding would stampede the
+      // metadata server.
+      token->AddPendingCallback(continuation);
+      return;
     case auth::ServiceAccountToken::FAILED:
       // If the current time doesn't get out of the time window of failure
       // status, it will return kFailedTokenFetch directly.
@@ -135,34 +141,76 @@ void GlobalFetchServiceAccountToken(
       env->LogDebug("Need to fetch service account token");
   }
 
+  // Another worker - or, across a reload, a worker of the previous nginx
+  // generation - may already have fetched this token; serve it from the
+  // shared token cache instead of going to the metadata server. The cache
+  // returns the remaining validity in seconds.
+  SharedTokenCache *shared_cache = env->shared_token_cache();
+  if (shared_cache != nullptr) {
+    std::string cached_token;
+    time_t expiration = 0;
+    // Only accept a cached token that outlives the one already held;
+    // otherwise a refresh-ahead fetch would be satisfied by the very
+    // token it is trying to replace.
+    time_t remaining = token->is_access_token_valid(0)
+                           ? token->access_token_expiration_time() -
+                                 time(nullptr)
+                           : 0;
+    if (shared_cache->Lookup(path, &cached_token, &expiration) &&
+        expiration > kTokenRefetchWindow && expiration > remaining) {
+      token->set_access_token(cached_token, expiration);
+      token->set_state(auth::ServiceAccountToken::FETCHED);
+      continuation(Status::OK);
+      return;
+    }
+  }
+
   std::shared_ptr<cloud_trace::CloudTraceSpan> trace_span(
       CreateSpan(cloud_trace, trace_name));
   token->set_state(auth::ServiceAccountToken::FETCHING);
   FetchMetadata(
       context.get(), path, kMetadataTokenFetchRetries,
-      [env, token, continuation, audience, trace_span](
+      [env, token, continuation, audience, trace_span, shared_cache, path](
           Status status, std::map<std::string, std::string> &&,
           std::string &&body) {
         TRACE(trace_span) << "Returned with status " << status.ToString();
+        // Completes the initiating caller and every caller that joined
+        // the in-flight fetch while it was outstanding.
+        const auto finish = [token, continuation](Status status) {
+          continuation(status);
+          for (const auto &callback : token->TakePendingCallbacks()) {
+            callback(status);
+          }
+        };
         // fetch failed
         if (!status.ok()) {
           env->LogError("Failed to fetch service account token");
           token->set_last_failed_fetch_time(system_clock::now());
           token->set_state(auth::ServiceAccountToken::FAILED);
-          continuation(Status(Code::INTERNAL, kFailedTokenFetch));
+          finish(Status(Code::INTERNAL, kFailedTokenFetch));
           return;
         }
         if (audience.empty()) {
           if (!token->SetTokenJsonResponse(body)) {
             env->LogError("Failed to parse token response body");
-            continuation(Status(Code::INTERNAL, kFailedTokenParse));
+            finish(Status(Code::INTERNAL, kFailedTokenParse));
             return;
           }
         } else {
           // TODO: parse JWT to get expiration time.
           token->set_access_token(body, kInstanceIdentityTokenExpiration);
+          token->set_state(auth::ServiceAccountToken::FETCHED);
         }
-        continuation(Status::OK);
+        // Publish the fresh token so the other workers skip their own
+        // fetch. The cache stores how long the token remains valid, not
+        // the raw response body, because expires_in in the response is
+        // relative to the time of the fetch.
+        if (shared_cache != nullptr) {
+          shared_cache->Insert(
+              path, token->GetAuthToken(),
+              token->access_token_expiration_time() - time(nullptr));
+        }
+        finish(Status::OK);
       });
 }
 
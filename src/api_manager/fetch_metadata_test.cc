@@ -130,6 +130,136 @@ TEST_F(FetchMetadataTest, FetchTokenWithStatusINTERNAL) {
   });
 }
 
+TEST_F(FetchMetadataTest, ConcurrentFetchesForAudienceAreCoalesced) {
+  // The second fetch arrives while the first one is outstanding: it
+  // must join the in-flight request, not issue its own.
+  int second_fetch_done = 0;
+  EXPECT_CALL(*raw_env_, DoRunHTTPRequest(_))
+      .WillOnce(Invoke([this, &second_fetch_done](HTTPRequest *req) {
+        GlobalFetchServiceAccountToken(
+            global_context_, "https://backend.example.com", nullptr,
+            [&second_fetch_done](Status status) {
+              ASSERT_TRUE(status.ok());
+              second_fetch_done++;
+            });
+        std::map<std::string, std::string> empty;
+        std::string body("IDENTITY_TOKEN");
+        req->OnComplete(Status::OK, std::move(empty), std::move(body));
+      }));
+
+  int first_fetch_done = 0;
+  GlobalFetchServiceAccountToken(global_context_,
+                                 "https://backend.example.com", nullptr,
+                                 [&first_fetch_done](Status status) {
+                                   ASSERT_TRUE(status.ok());
+                                   first_fetch_done++;
+                                 });
+
+  ASSERT_EQ(first_fetch_done, 1);
+  ASSERT_EQ(second_fetch_done, 1);
+  auto *token =
+      global_context_->GetInstanceIdentityToken("https://backend.example.com");
+  ASSERT_EQ(token->state(), auth::ServiceAccountToken::FETCHED);
+  ASSERT_EQ(token->GetAuthToken(), "IDENTITY_TOKEN");
+}
+
+// An in-process SharedTokenCache standing in for the shared memory zone of
+// the hosting environment.
+class FakeSharedTokenCache : public SharedTokenCache {
+ public:
+  bool Lookup(const std::string& key, std::string* token,
+              time_t* expiration) {
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      return false;
+    }
+    *token = it->second.first;
+    *expiration = it->second.second;
+    return true;
+  }
+
+  void Insert(const std::string& key, const std::string& token,
+              time_t expiration) {
+    entries_[key] = {token, expiration};
+  }
+
+  std::map<std::string, std::pair<std::string, time_t>> entries_;
+};
+
+class TokenCacheMockEnvironment : public MockApiManagerEnvironment {
+ public:
+  TokenCacheMockEnvironment(SharedTokenCache* cache) : cache_(cache) {}
+  virtual SharedTokenCache* shared_token_cache() { return cache_; }
+
+ private:
+  SharedTokenCache* cache_;
+};
+
+class FetchMetadataSharedTokenCacheTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    std::unique_ptr<TokenCacheMockEnvironment> env(
+        new ::testing::NiceMock<TokenCacheMockEnvironment>(&cache_));
+    // save the raw pointer of env before calling std::move(env).
+    raw_env_ = env.get();
+
+    std::unique_ptr<Config> config = Config::Create(raw_env_, kServiceConfig);
+    ASSERT_NE(config.get(), nullptr);
+
+    global_context_ =
+        std::make_shared<context::GlobalContext>(std::move(env), kServerConfig);
+    service_context_ = std::make_shared<context::ServiceContext>(
+        global_context_, std::move(config));
+
+    std::unique_ptr<MockRequest> request(
+        new ::testing::NiceMock<MockRequest>());
+
+    context_ = std::make_shared<context::RequestContext>(service_context_,
+                                                         std::move(request));
+  }
+
+  FakeSharedTokenCache cache_;
+  TokenCacheMockEnvironment *raw_env_;
+  std::shared_ptr<context::GlobalContext> global_context_;
+  std::shared_ptr<context::ServiceContext> service_context_;
+  std::shared_ptr<context::RequestContext> context_;
+};
+
+TEST_F(FetchMetadataSharedTokenCacheTest, FetchPublishesToSharedTokenCache) {
+  EXPECT_CALL(*raw_env_, DoRunHTTPRequest(_))
+      .WillOnce(Invoke([](HTTPRequest *req) {
+        std::map<std::string, std::string> empty;
+        std::string body(kToken);
+        req->OnComplete(Status::OK, std::move(empty), std::move(body));
+      }));
+
+  FetchServiceAccountToken(context_,
+                           [](Status status) { ASSERT_TRUE(status.ok()); });
+
+  // The fetched token was stored with its remaining validity.
+  ASSERT_EQ(cache_.entries_.size(), 1);
+  ASSERT_EQ(cache_.entries_.begin()->second.first, "TOKEN");
+  ASSERT_LE(cache_.entries_.begin()->second.second, 100);
+}
+
+TEST_F(FetchMetadataSharedTokenCacheTest, WarmCacheServesTokenWithoutFetch) {
+  // A token fetched by another worker is served from the cache without a
+  // metadata server request.
+  cache_.Insert("/computeMetadata/v1/instance/service-accounts/default/token",
+                "CACHED_TOKEN", 3600);
+  EXPECT_CALL(*raw_env_, DoRunHTTPRequest(_)).Times(0);
+
+  FetchServiceAccountToken(context_, [this](Status status) {
+    ASSERT_TRUE(status.ok());
+    auto *token = context_->service_context()
+                      ->global_context()
+                      ->service_account_token();
+    ASSERT_EQ(token->state(), auth::ServiceAccountToken::FETCHED);
+    ASSERT_EQ(token->GetAuthToken(), "CACHED_TOKEN");
+  });
+}
+
+
 }  // namespace
 
 }  // namespace api_manager
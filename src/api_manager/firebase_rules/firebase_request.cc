@@ -97,9 +97,6 @@ FirebaseRequest::FirebaseRequest(
   firebase_http_request_.audience =
       context->service_context()->config()->GetFirebaseAudience();
 
-  external_http_request_.token_type =
-      auth::ServiceAccountToken::JWT_TOKEN_FOR_AUTHORIZATION_SERVICE;
-
   // Update the first request to be sent which is the TestRulesetRequest
   // request.
   SetStatus(UpdateRulesetRequestBody(RepeatedPtrField<FunctionCall>()));
@@ -112,31 +109,35 @@ FirebaseRequest::FirebaseRequest(
 
 bool FirebaseRequest::is_done() { return is_done_; }
 
-HttpRequest FirebaseRequest::GetHttpRequest() {
+std::vector<HttpRequest> FirebaseRequest::GetHttpRequests() {
   if (is_done()) {
-    return HttpRequest();
+    return std::vector<HttpRequest>();
+  }
+
+  if (!pending_requests_.empty()) {
+    return pending_requests_;
   }
 
   if (next_request_ == nullptr) {
     SetStatus(Status(Code::INTERNAL, "Internal state in error"));
-    return HttpRequest();
+    return std::vector<HttpRequest>();
   }
 
-  return *next_request_;
+  return std::vector<HttpRequest>(1, *next_request_);
 }
 
 Status FirebaseRequest::RequestStatus() { return current_status_; }
 
-void FirebaseRequest::UpdateResponse(const std::string &body) {
+void FirebaseRequest::UpdateResponses(const std::vector<std::string> &bodies) {
   GOOGLE_DCHECK(!is_done())
       << "Receive a response body when no HTTP request is outstanding";
 
-  GOOGLE_DCHECK(next_request_)
+  GOOGLE_DCHECK(next_request_ || !pending_requests_.empty())
       << "Received a response when there is no request set"
          "and when is_done is false."
          " Looks like a code bug...";
 
-  if (is_done() || next_request_ == nullptr) {
+  if (is_done() || (next_request_ == nullptr && pending_requests_.empty())) {
     SetStatus(Status(Code::INTERNAL,
                      "Internal state error while processing Http request"));
     return;
@@ -145,11 +146,14 @@ void FirebaseRequest::UpdateResponse(const std::string &body) {
   Status status = Status::OK;
 
   // If the previous request was firebase request, then process its response.
-  // Otherwise, it is the response for external HTTP request.
+  // Otherwise, these are the responses for the external HTTP requests.
   if (next_request_ == &firebase_http_request_) {
-    status = ProcessTestRulesetResponse(body);
+    status = bodies.size() == 1
+                 ? ProcessTestRulesetResponse(bodies[0])
+                 : Status(Code::INTERNAL,
+                          "Expecting a single TestRuleset response");
   } else {
-    status = ProcessFunctionCallResponse(body);
+    status = ProcessFunctionCallResponses(bodies);
   }
 
   if (status.ok()) {
@@ -266,7 +270,6 @@ Status FirebaseRequest::ProcessTestRulesetResponse(const std::string &body) {
     return Status(Code::PERMISSION_DENIED, message);
   }
 
-  func_call_iter_ = response_.test_results(0).function_calls().begin();
   return Status::OK;
 }
 
@@ -279,57 +282,72 @@ FirebaseRequest::Find(const FunctionCall &func_call) {
                       });
 }
 
-Status FirebaseRequest::ProcessFunctionCallResponse(const std::string &body) {
-  if (is_done() || AllFunctionCallsProcessed()) {
+Status FirebaseRequest::ProcessFunctionCallResponses(
+    const std::vector<std::string> &bodies) {
+  if (is_done() || pending_calls_.empty() ||
+      bodies.size() != pending_calls_.size()) {
     return Status(Code::INTERNAL,
                   "No external function calls present."
                   " But received a response. Possible code bug");
   }
 
-  funcs_with_result_.emplace_back(*func_call_iter_, body);
-  func_call_iter_++;
+  for (size_t i = 0; i < bodies.size(); i++) {
+    funcs_with_result_.emplace_back(pending_calls_[i], bodies[i]);
+  }
+
+  pending_calls_.clear();
+  pending_requests_.clear();
   return Status::OK;
 }
 
-// Sets the next HTTP request that should be issued.
+// Sets the next HTTP requests that should be issued.
 Status FirebaseRequest::SetNextRequest() {
   if (is_done()) {
     next_request_ = nullptr;
     return current_status_;
   }
 
-  Status status = Status::OK;
+  // Gather every function call without a buffered response. The fetches are
+  // independent of each other, so they are all exposed at once and issued
+  // concurrently, joining before the next TestRuleset round.
+  pending_calls_.clear();
+  pending_requests_.clear();
+  for (const auto &call : response_.test_results(0).function_calls()) {
+    if (Find(call) != funcs_with_result_.end() || IsPending(call)) {
+      continue;
+    }
 
-  // While there are more functions that should be processed, check if the HTTP
-  // response for the function is already buffered. Set the next HTTP request if
-  // we find a new function and break.
-  while (!AllFunctionCallsProcessed()) {
-    if (Find(*func_call_iter_) == funcs_with_result_.end()) {
-      auto call = *func_call_iter_;
-      external_http_request_.url = call.args(0).string_value();
-      external_http_request_.method = call.args(1).string_value();
-      external_http_request_.audience =
-          call.args(call.args_size() - 1).string_value();
-      std::string body;
-      status =
-          utils::ProtoToJson(call.args(2), &body, utils::JsonOptions::DEFAULT);
-      if (status.ok()) {
-        external_http_request_.body = body;
-        next_request_ = &external_http_request_;
-      }
-      break;
+    HttpRequest request;
+    request.url = call.args(0).string_value();
+    request.method = call.args(1).string_value();
+    request.token_type =
+        auth::ServiceAccountToken::JWT_TOKEN_FOR_AUTHORIZATION_SERVICE;
+    request.audience = call.args(call.args_size() - 1).string_value();
+    Status status = utils::ProtoToJson(call.args(2), &request.body,
+                                       utils::JsonOptions::DEFAULT);
+    if (!status.ok()) {
+      return status;
     }
 
-    func_call_iter_++;
+    pending_calls_.push_back(call);
+    pending_requests_.push_back(std::move(request));
   }
 
-  // If All functions are processed, then issue a TestRulesetRequest.
-  if (AllFunctionCallsProcessed()) {
-    next_request_ = &firebase_http_request_;
-    return UpdateRulesetRequestBody(response_.test_results(0).function_calls());
+  if (!pending_requests_.empty()) {
+    next_request_ = nullptr;
+    return Status::OK;
   }
 
-  return status;
+  // If All functions are processed, then issue a TestRulesetRequest.
+  next_request_ = &firebase_http_request_;
+  return UpdateRulesetRequestBody(response_.test_results(0).function_calls());
+}
+
+bool FirebaseRequest::IsPending(const FunctionCall &func_call) {
+  return std::find_if(pending_calls_.begin(), pending_calls_.end(),
+                      [&func_call](const FunctionCall &item) {
+                        return MessageDifferencer::Equals(item, func_call);
+                      }) != pending_calls_.end();
 }
 
 Status FirebaseRequest::CheckFuncCallArgs(const FunctionCall &func) {
@@ -376,10 +394,6 @@ Status FirebaseRequest::CheckFuncCallArgs(const FunctionCall &func) {
   return Status::OK;
 }
 
-bool FirebaseRequest::AllFunctionCallsProcessed() {
-  return func_call_iter_ == response_.test_results(0).function_calls().end();
-}
-
 Status FirebaseRequest::AddFunctionMock(proto::TestRulesetRequest *request,
                                         const FunctionCall &func_call) {
   if (Find(func_call) == funcs_with_result_.end()) {
@@ -55,7 +55,8 @@
 //  Otherwise, ESP does Step 5.
 //
 // 5) ESP invokes rules defined HTTP requests that are not yet seen.
-// ESP invokes these requests sequentially. Once all HTTP requests are invoked,
+// These requests are independent of each other, so ESP issues them
+// concurrently and joins the responses. Once all HTTP requests are resolved,
 // then ESP builds a TestRulesetRequest which contains the following in addition
 // to the JWT claims and HTTP method and HTTP path.
 // -- For each HTTP request, ESP converts the JSON object into a protobuf::Value
@@ -82,15 +83,12 @@ struct HttpRequest {
 // Here is the intended use of this code:
 // FirebaseRequest request(...);
 // while(!request.is_done()) {
-//  std::string url, method, body;
-//
 //  /* The following is not a valid C++ statement. But written so the reader can
 //  get a general idea ... */
 //
-//  (url, method, body, token_type) = request.GetHttpRequest();
-//  std::string body = InvokeHttpRequest(url, method, body,
-//                                       GetToken(token_type));
-//  updateResponse(body);
+//  requests = request.GetHttpRequests();
+//  bodies = InvokeHttpRequestsConcurrentlyAndJoin(requests);
+//  request.UpdateResponses(bodies);
 // }
 //
 // if (request.RequestStatus.ok()) {
@@ -111,18 +109,23 @@ class FirebaseRequest {
   // true.
   utils::Status RequestStatus();
 
-  // This call should be invoked to get the next http request to execute.
-  HttpRequest GetHttpRequest();
+  // This call should be invoked to get the next http requests to execute:
+  // either the single TestRuleset request, or one request per unresolved
+  // user defined function call. The latter are independent of each other
+  // and may be issued concurrently; the responses, in request order,
+  // should be passed to UpdateResponses once all of them have arrived.
+  std::vector<HttpRequest> GetHttpRequests();
 
-  // The response for previous HttpRequest.
-  void UpdateResponse(const std::string &body);
+  // The responses for the previous batch of HttpRequests.
+  void UpdateResponses(const std::vector<std::string> &bodies);
 
  private:
   utils::Status UpdateRulesetRequestBody(
       const ::google::protobuf::RepeatedPtrField<
           proto::TestRulesetResponse::TestResult::FunctionCall> &func_calls);
   utils::Status ProcessTestRulesetResponse(const std::string &body);
-  utils::Status ProcessFunctionCallResponse(const std::string &body);
+  utils::Status ProcessFunctionCallResponses(
+      const std::vector<std::string> &bodies);
   utils::Status CheckFuncCallArgs(
       const proto::TestRulesetResponse::TestResult::FunctionCall &func);
   utils::Status AddFunctionMock(
@@ -130,7 +133,8 @@ class FirebaseRequest {
       const proto::TestRulesetResponse::TestResult::FunctionCall &func_call);
   void SetStatus(const utils::Status &status);
   utils::Status SetNextRequest();
-  bool AllFunctionCallsProcessed();
+  bool IsPending(
+      const proto::TestRulesetResponse::TestResult::FunctionCall &func_call);
   std::vector<std::pair<proto::TestRulesetResponse::TestResult::FunctionCall,
                         std::string>>::const_iterator
   Find(const proto::TestRulesetResponse::TestResult::FunctionCall &func_call);
@@ -161,34 +165,28 @@ class FirebaseRequest {
                         std::string>>
       funcs_with_result_;
 
-  // The iterator iterates over the FunctionCalls the user wishes to invoke. So
-  // long as this iterator is valid, the state machine issues HTTP requests to
-  // the user defined HTTP endpoints. Once the iterator is equl to
-  // func_call_iter.end(), then the TestRuleset is issued which includes the
-  // function calls along with their responses.
-  ::google::protobuf::RepeatedPtrField<
-      proto::TestRulesetResponse::TestResult::FunctionCall>::const_iterator
-      func_call_iter_;
+  // The FunctionCalls the state machine is currently waiting on, and the
+  // HTTP requests resolving them, in the same order. The requests are
+  // independent of each other, so the caller issues them concurrently;
+  // once all of them are resolved, the TestRuleset is issued which
+  // includes the function calls along with their responses.
+  std::vector<proto::TestRulesetResponse::TestResult::FunctionCall>
+      pending_calls_;
+  std::vector<HttpRequest> pending_requests_;
 
   // The Test ruleset response currently being processed.
   proto::TestRulesetResponse response_;
 
-  // This variable points to either firebase_http_request_ or
-  // external_http_request_. This will allow the UpdateResponse method to
-  // understand if the response received is for TestRuleset or user
-  // defined HTTP endpoint. If next_request points to firebase_http_request_,
-  // upon receiving a response, UpdateResponse will convert the response to
-  // TestRulesetResponse and process the response. If next_request_ points
-  // to external_http_request_, then the response provided via UpdateResponse
-  // is converted into a protobuf::Value. This value is initialized to nullptr
-  // and will be nullptr once is_done_ is set to true.
+  // Points to firebase_http_request_ when the state machine is waiting on
+  // a TestRuleset response, and is nullptr while user defined HTTP
+  // endpoint fetches are outstanding (pending_requests_ is non-empty
+  // instead) or once is_done_ is set to true. This lets UpdateResponses
+  // tell whether the bodies it receives are a TestRulesetResponse or the
+  // function call results.
   HttpRequest *next_request_;
 
   // The HTTP request to be sent to firebase TestRuleset API
   HttpRequest firebase_http_request_;
-
-  // The HTTP request invoked for user provided HTTP endpoint.
-  HttpRequest external_http_request_;
 };
 
 }  // namespace firebase_rules
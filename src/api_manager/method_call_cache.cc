@@ -0,0 +1,65 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/method_call_cache.h"
+
+#include <functional>
+
+namespace google {
+namespace api_manager {
+
+MethodCallCache::MethodCallCache() : entries_(kCacheSize) {}
+
+size_t MethodCallCache::Slot(const std::string& http_method,
+                             const std::string& path) const {
+  std::hash<std::string> hasher;
+  // Standard hash combine of the two key strings.
+  size_t hash = hasher(http_method);
+  hash ^= hasher(path) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+  return hash & (kCacheSize - 1);
+}
+
+bool MethodCallCache::Lookup(const std::string& http_method,
+                             const std::string& path,
+                             MethodCallInfo* call_info) const {
+  if (path.size() > kMaxCachedPathSize) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Entry& entry = entries_[Slot(http_method, path)];
+  if (!entry.valid || entry.http_method != http_method || entry.path != path) {
+    return false;
+  }
+  *call_info = entry.call_info;
+  return true;
+}
+
+void MethodCallCache::Insert(const std::string& http_method,
+                             const std::string& path,
+                             const MethodCallInfo& call_info) {
+  if (path.size() > kMaxCachedPathSize) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entry& entry = entries_[Slot(http_method, path)];
+  entry.valid = true;
+  entry.http_method = http_method;
+  entry.path = path;
+  entry.call_info = call_info;
+}
+
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,82 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_METHOD_CALL_CACHE_H_
+#define API_MANAGER_METHOD_CALL_CACHE_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "include/api_manager/method_call_info.h"
+
+namespace google {
+namespace api_manager {
+
+// A small, fixed-size, direct-mapped cache in front of the PathMatcher.
+//
+// Real traffic is heavily skewed towards a handful of literal paths, so most
+// requests can skip the trie walk and path variable extraction entirely. The
+// cache maps the exact (http_method, path) pair to the resolved
+// MethodCallInfo with the bindings extracted from the path; query parameter
+// bindings vary per request and must be appended by the caller after a hit.
+//
+// Entries never expire: the cache is owned by a Config object, which is
+// immutable and replaced wholesale on config rollout, so a new (empty) cache
+// takes over whenever the routing data can change. Colliding entries simply
+// overwrite each other.
+//
+// Thread safe.
+class MethodCallCache {
+ public:
+  MethodCallCache();
+
+  // Looks up the cached MethodCallInfo for (http_method, path). On a hit,
+  // copies the entry (including negative entries, where method_info is
+  // nullptr) to |call_info| and returns true.
+  bool Lookup(const std::string& http_method, const std::string& path,
+              MethodCallInfo* call_info) const;
+
+  // Caches |call_info| for (http_method, path), overwriting whatever entry
+  // occupies the slot. |call_info| must only carry bindings extracted from
+  // the path, never from query parameters.
+  void Insert(const std::string& http_method, const std::string& path,
+              const MethodCallInfo& call_info);
+
+ private:
+  // Number of slots; must be a power of two. At ~100 bytes per typical
+  // entry this bounds the cache to a few tens of KB per worker.
+  static const size_t kCacheSize = 256;
+  // Paths longer than this are not cached to bound per-entry memory.
+  static const size_t kMaxCachedPathSize = 1024;
+
+  struct Entry {
+    Entry() : valid(false) {}
+    bool valid;
+    std::string http_method;
+    std::string path;
+    MethodCallInfo call_info;
+  };
+
+  // Returns the slot index for (http_method, path).
+  size_t Slot(const std::string& http_method, const std::string& path) const;
+
+  mutable std::mutex mutex_;
+  std::vector<Entry> entries_;
+};
+
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_METHOD_CALL_CACHE_H_
@@ -38,6 +38,10 @@ MethodInfoImpl::MethodInfoImpl(const string &name, const string &api_name,
       auth_(false),
       allow_unregistered_calls_(false),
       skip_service_control_(false),
+      skip_all_checks_(false),
+      report_only_(false),
+      concurrency_limit_(0),
+      concurrent_requests_(0),
       api_key_http_headers_(nullptr),
       api_key_url_query_parameters_(nullptr),
       backend_path_translation_(
@@ -69,6 +73,9 @@ void MethodInfoImpl::addAuthProvider(const std::string &issuer,
     }
   }
   provider.authorization_url = authorization_url;
+  if (first_authorization_url_.empty()) {
+    first_authorization_url_ = authorization_url;
+  }
 }
 
 bool MethodInfoImpl::isIssuerAllowed(const std::string &issuer) const {
@@ -78,16 +85,25 @@ bool MethodInfoImpl::isIssuerAllowed(const std::string &issuer) const {
 
 bool MethodInfoImpl::isAudienceAllowed(
     const string &issuer, const std::set<string> &jwt_audiences) const {
-  if (issuer.empty() || jwt_audiences.empty() || !isIssuerAllowed(issuer)) {
-    return false;
+  return isIssuerAudienceAllowed(issuer, jwt_audiences) ==
+         ISSUER_AUDIENCE_ALLOWED;
+}
+
+MethodInfo::IssuerAudienceResult MethodInfoImpl::isIssuerAudienceAllowed(
+    const string &issuer, const std::set<string> &jwt_audiences) const {
+  if (issuer.empty()) {
+    return ISSUER_NOT_ALLOWED;
+  }
+  const auto it = issuer_provider_map_.find(issuer);
+  if (it == issuer_provider_map_.end()) {
+    return ISSUER_NOT_ALLOWED;
   }
-  const AuthProvider &provider = issuer_provider_map_.at(issuer);
-  for (const auto &it : jwt_audiences) {
-    if (provider.audiences.find(it) != provider.audiences.end()) {
-      return true;
+  for (const auto &aud : jwt_audiences) {
+    if (it->second.audiences.find(aud) != it->second.audiences.end()) {
+      return ISSUER_AUDIENCE_ALLOWED;
     }
   }
-  return false;
+  return AUDIENCE_NOT_ALLOWED;
 }
 
 const std::string &MethodInfoImpl::authorization_url_by_issuer(
@@ -102,13 +118,7 @@ const std::string &MethodInfoImpl::authorization_url_by_issuer(
 }
 
 const std::string &MethodInfoImpl::first_authorization_url() const {
-  for (const auto &it : issuer_provider_map_) {
-    if (!it.second.authorization_url.empty()) {
-      return it.second.authorization_url;
-    }
-  }
-  static std::string empty;
-  return empty;
+  return first_authorization_url_;
 }
 
 void MethodInfoImpl::process_backend_rule(
@@ -163,5 +173,46 @@ void MethodInfoImpl::ProcessSystemQueryParameterNames() {
   }
 }
 
+void MethodInfoImpl::ComputeSkipAllChecks() {
+  // Every check handler is a no-op when the method requires no auth (which
+  // also disables security rules), skips service control (which also
+  // disables reports), charges no quota and needs no instance identity
+  // token for its backend. Streaming methods are excluded because they
+  // send intermediate reports.
+  skip_all_checks_ = !auth_ && skip_service_control_ &&
+                     metric_cost_vector_.empty() &&
+                     backend_jwt_audience_.empty() && !request_streaming_ &&
+                     !response_streaming_;
+  // Report-only: the same no-op checks, but service control stays on so
+  // each request is still reported. Unregistered callers must be allowed
+  // because nothing validates an api key on this path (the api key is
+  // not even extracted for such methods).
+  report_only_ = !auth_ && !skip_service_control_ &&
+                 allow_unregistered_calls_ && metric_cost_vector_.empty() &&
+                 backend_jwt_audience_.empty();
+}
+
+bool MethodInfoImpl::TryAcquireConcurrency() const {
+  if (concurrency_limit_ <= 0) {
+    return true;
+  }
+  // One relaxed add on admit; the brief overshoot before the correcting
+  // sub can reject at most a handful of racing requests, which is fine
+  // for an admission limit.
+  if (concurrent_requests_.fetch_add(1, std::memory_order_relaxed) >=
+      concurrency_limit_) {
+    concurrent_requests_.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+void MethodInfoImpl::ReleaseConcurrency() const {
+  if (concurrency_limit_ <= 0) {
+    return;
+  }
+  concurrent_requests_.fetch_sub(1, std::memory_order_relaxed);
+}
+
 }  // namespace api_manager
 }  // namespace google
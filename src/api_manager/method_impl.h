@@ -15,9 +15,12 @@
 #ifndef API_MANAGER_METHOD_IMPL_H_
 #define API_MANAGER_METHOD_IMPL_H_
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "google/api/backend.pb.h"
@@ -40,12 +43,27 @@ class MethodInfoImpl : public MethodInfo {
   bool auth() const { return auth_; }
   bool allow_unregistered_calls() const { return allow_unregistered_calls_; }
   bool skip_service_control() const { return skip_service_control_; }
+  bool skip_all_checks() const override { return skip_all_checks_; }
+  bool report_only() const override { return report_only_; }
+
+  bool TryAcquireConcurrency() const override;
+  void ReleaseConcurrency() const override;
+
+  // Sets the limit on concurrently admitted requests. 0 (the default)
+  // means unlimited.
+  void set_concurrency_limit(int32_t limit) { concurrency_limit_ = limit; }
+  int32_t concurrency_limit() const { return concurrency_limit_; }
 
   bool isIssuerAllowed(const std::string &issuer) const;
 
   bool isAudienceAllowed(const std::string &issuer,
                          const std::set<std::string> &jwt_audiences) const;
 
+  // Answers both checks with a single lookup in the issuer index.
+  IssuerAudienceResult isIssuerAudienceAllowed(
+      const std::string &issuer,
+      const std::set<std::string> &jwt_audiences) const override;
+
   const std::string &authorization_url_by_issuer(
       const std::string &issuer) const;
 
@@ -154,6 +172,11 @@ class MethodInfoImpl : public MethodInfo {
 
   void ProcessSystemQueryParameterNames();
 
+  // Precomputes skip_all_checks() and report_only() from the loaded
+  // method attributes. Called once all config rules for the method have
+  // been applied.
+  void ComputeSkipAllChecks();
+
   bool keep_binding_escaped() const override {
     // Variable bindings normally are used for grpc transcoding.
     // Their values should be un-escaped.
@@ -166,7 +189,8 @@ class MethodInfoImpl : public MethodInfo {
 
  private:
   struct AuthProvider {
-    std::set<std::string> audiences;
+    // Allowed audiences, pre-normalized by addAuthProvider.
+    std::unordered_set<std::string> audiences;
     std::string authorization_url;
   };
   // Method name
@@ -182,8 +206,23 @@ class MethodInfoImpl : public MethodInfo {
   bool allow_unregistered_calls_;
   // Should the method skip service control.
   bool skip_service_control_;
-  // Issuers to auth provider map.
-  std::map<std::string, AuthProvider> issuer_provider_map_;
+  // Whether the whole check workflow is a no-op for this method.
+  bool skip_all_checks_;
+  // Whether the check workflow is a no-op but requests are still
+  // reported.
+  bool report_only_;
+  // The limit on concurrently admitted requests; 0 means unlimited.
+  int32_t concurrency_limit_;
+  // The number of currently admitted requests. Mutable so admission can
+  // run through the const MethodInfo the request context holds.
+  mutable std::atomic<int32_t> concurrent_requests_;
+  // Issuers to auth provider index, with pre-normalized issuer keys.
+  // Authenticated calls hit it on every request.
+  std::unordered_map<std::string, AuthProvider> issuer_provider_map_;
+
+  // The authorization url of the first added provider that has one.
+  // Kept separately because the index above has no insertion order.
+  std::string first_authorization_url_;
 
   // system parameter map of parameter name to http_header name.
   std::map<std::string, std::vector<std::string>> http_header_parameters_;
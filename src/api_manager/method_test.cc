@@ -86,6 +86,18 @@ TEST(MethodInfo, IssueAndAudiences) {
   ASSERT_FALSE(method_info->isAudienceAllowed("", {"aud1"}));
   ASSERT_FALSE(method_info->isAudienceAllowed(kIssuer1, {""}));
   ASSERT_FALSE(method_info->isAudienceAllowed(kIssuer1, {}));
+
+  // The combined check distinguishes the two rejection cases.
+  ASSERT_EQ(MethodInfo::ISSUER_AUDIENCE_ALLOWED,
+            method_info->isIssuerAudienceAllowed(kIssuer1, {"aud1"}));
+  ASSERT_EQ(MethodInfo::AUDIENCE_NOT_ALLOWED,
+            method_info->isIssuerAudienceAllowed(kIssuer1, {"aud6"}));
+  ASSERT_EQ(MethodInfo::AUDIENCE_NOT_ALLOWED,
+            method_info->isIssuerAudienceAllowed(kIssuer1, {}));
+  ASSERT_EQ(MethodInfo::ISSUER_NOT_ALLOWED,
+            method_info->isIssuerAudienceAllowed(kIssuer4, {"aud1"}));
+  ASSERT_EQ(MethodInfo::ISSUER_NOT_ALLOWED,
+            method_info->isIssuerAudienceAllowed("", {"aud1"}));
 }
 
 TEST(MethodInfo, IssueAndAuthorizationUrl) {
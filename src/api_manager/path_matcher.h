@@ -15,15 +15,20 @@
 #ifndef API_MANAGER_PATH_MATCHER_H_
 #define API_MANAGER_PATH_MATCHER_H_
 
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <memory>
 #include <set>
 #include <sstream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "absl/strings/string_view.h"
 #include "include/api_manager/utils/status.h"
 #include "src/api_manager/http_template.h"
+#include "src/api_manager/path_matcher_flat_trie.h"
 #include "src/api_manager/path_matcher_node.h"
 
 namespace google {
@@ -54,11 +59,16 @@ class PathMatcher {
  public:
   ~PathMatcher(){};
 
-  // TODO: Do not template VariableBinding
-  template <class VariableBinding>
+  // TODO: Do not template the binding container type
+  //
+  // BindingVector is any sequence of VariableBinding-shaped values (a
+  // field_path container plus a value string) with vector semantics;
+  // callers pass small-size-optimized containers to avoid allocating for
+  // the typical one or two bindings of a request.
+  template <class BindingVector>
   Method Lookup(const std::string& http_method, const std::string& path,
                 const std::string& query_params,
-                std::vector<VariableBinding>* variable_bindings,
+                BindingVector* variable_bindings,
                 std::string* body_field_path) const;
 
   Method Lookup(const std::string& http_method, const std::string& path) const;
@@ -70,8 +80,13 @@ class PathMatcher {
   // A root node shared by all services, i.e. paths of all services will be
   // registered to this node.
   std::unique_ptr<PathMatcherNode> root_ptr_;
-  // Holds the set of custom verbs found in configured templates.
-  std::set<std::string> custom_verbs_;
+  // The flattened, cache friendly representation of the trie rooted at
+  // root_ptr_, compiled once at Build() time and used for all lookups.
+  std::unique_ptr<PathMatcherFlatTrie> flat_trie_;
+  // The custom verbs found in configured templates, resolved into a sorted
+  // flat array at Build() time so the per-request probe is a binary search
+  // on a string_view with no temporary allocation.
+  std::vector<std::string> custom_verbs_;
   // Data we store per each registered method
   struct MethodData {
     Method method;
@@ -128,8 +143,8 @@ class PathMatcherBuilder {
 
 namespace {
 
-std::vector<std::string>& split(const std::string& s, char delim,
-                                std::vector<std::string>& elems) {
+template <class Container>
+Container& split(const std::string& s, char delim, Container& elems) {
   std::stringstream ss(s);
   std::string item;
   while (std::getline(ss, item, delim)) {
@@ -191,7 +206,7 @@ inline int hex_digit_to_int(char c) {
 //
 // If the next three characters are an escaped character then this function will
 // also return what character is escaped.
-bool GetEscapedChar(const std::string& src, size_t i,
+bool GetEscapedChar(absl::string_view src, size_t i,
                     bool unescape_reserved_chars, char* out) {
   if (i + 2 < src.size() && src[i] == '%') {
     if (ascii_isxdigit(src[i + 1]) && ascii_isxdigit(src[i + 2])) {
@@ -210,35 +225,50 @@ bool GetEscapedChar(const std::string& src, size_t i,
 // Unescapes string 'part' and returns the unescaped string. Reserved characters
 // (as specified in RFC 6570) are not escaped if unescape_reserved_chars is
 // false.
-std::string UrlUnescapeString(const std::string& part,
+std::string UrlUnescapeString(absl::string_view part,
                               bool unescape_reserved_chars) {
-  std::string unescaped;
-  // Check whether we need to escape at all.
-  bool needs_unescaping = false;
+  // Find the first escape sequence that actually needs unescaping. Only '%'
+  // can start one, and memchr compiles to the platform's vectorized scanner,
+  // so the common escape-free URL costs one scan and one bulk copy instead
+  // of a byte-wise walk.
   char ch = '\0';
-  for (size_t i = 0; i < part.size(); ++i) {
-    if (GetEscapedChar(part, i, unescape_reserved_chars, &ch)) {
-      needs_unescaping = true;
+  size_t first = 0;
+  for (;;) {
+    const void* percent =
+        memchr(part.data() + first, '%', part.size() - first);
+    if (percent == nullptr) {
+      return std::string(part.data(), part.size());
+    }
+    first = static_cast<const char*>(percent) - part.data();
+    if (GetEscapedChar(part, first, unescape_reserved_chars, &ch)) {
       break;
     }
-  }
-  if (!needs_unescaping) {
-    unescaped = part;
-    return unescaped;
+    // A '%' that is not unescaped here (invalid or reserved); scan on.
+    ++first;
   }
 
+  std::string unescaped;
   unescaped.resize(part.size());
 
   char* begin = &(unescaped)[0];
-  char* p = begin;
+  memcpy(begin, part.data(), first);
+  char* p = begin + first;
 
-  for (size_t i = 0; i < part.size();) {
+  for (size_t i = first; i < part.size();) {
     if (GetEscapedChar(part, i, unescape_reserved_chars, &ch)) {
       *p++ = ch;
       i += 3;
     } else {
-      *p++ = part[i];
-      i += 1;
+      // Bulk-copy the literal run up to the next '%'.
+      const void* percent =
+          memchr(part.data() + i + 1, '%', part.size() - i - 1);
+      const size_t next = percent == nullptr
+                              ? part.size()
+                              : static_cast<const char*>(percent) -
+                                    part.data();
+      memcpy(p, part.data() + i, next - i);
+      p += next - i;
+      i = next;
     }
   }
 
@@ -246,11 +276,12 @@ std::string UrlUnescapeString(const std::string& part,
   return unescaped;
 }
 
-template <class VariableBinding>
+template <class BindingVector>
 void ExtractBindingsFromPath(const std::vector<HttpTemplate::Variable>& vars,
-                             const std::vector<std::string>& parts,
-                             std::vector<VariableBinding>* bindings,
+                             const PathMatcherFlatTrie::RequestPathSegments& parts,
+                             BindingVector* bindings,
                              bool keep_binding_escaped) {
+  typedef typename BindingVector::value_type VariableBinding;
   for (const auto& var : vars) {
     // Determine the subpath bound to the variable based on the
     // [start_segment, end_segment) segment range of the variable.
@@ -258,7 +289,7 @@ void ExtractBindingsFromPath(const std::vector<HttpTemplate::Variable>& vars,
     // In case of matching "**" - end_segment is negative and is relative to
     // the end such that end_segment = -1 will match all subsequent segments.
     VariableBinding binding;
-    binding.field_path = var.field_path;
+    binding.field_path.assign(var.field_path.begin(), var.field_path.end());
     // Calculate the absolute index of the ending segment in case it's negative.
     size_t end_segment = (var.end_segment >= 0)
                              ? var.end_segment
@@ -271,7 +302,7 @@ void ExtractBindingsFromPath(const std::vector<HttpTemplate::Variable>& vars,
     // Joins parts with "/"  to form a path string.
     for (size_t i = var.start_segment; i < end_segment; ++i) {
       if (keep_binding_escaped) {
-        binding.value += parts[i];
+        binding.value.append(parts[i].data(), parts[i].size());
       } else {
         // For multipart matches only unescape non-reserved characters.
         binding.value += UrlUnescapeString(parts[i], !is_multipart);
@@ -284,10 +315,11 @@ void ExtractBindingsFromPath(const std::vector<HttpTemplate::Variable>& vars,
   }
 }
 
-template <class VariableBinding>
+template <class BindingVector>
 void ExtractBindingsFromQueryParameters(
     const std::string& query_params, const std::set<std::string>& system_params,
-    std::vector<VariableBinding>* bindings, bool keep_binding_escaped) {
+    BindingVector* bindings, bool keep_binding_escaped) {
+  typedef typename BindingVector::value_type VariableBinding;
   // The bindings in URL the query parameters have the following form:
   //      <field_path1>=value1&<field_path2>=value2&...&<field_pathN>=valueN
   // Query parameters may also contain system parameters such as `api_key`.
@@ -323,33 +355,54 @@ void ExtractBindingsFromQueryParameters(
 // path and then splits the path into slash separated parts. Returns an empty
 // vector if the sanitized path is "/".
 //
-// custom_verbs is a set of configured custom verbs that are used to match
-// against any custom verbs in request path. If the request_path contains a
-// custom verb not found in custom_verbs, it is treated as a part of the path.
+// The returned parts are views into |path|; no per-segment copy is made, so
+// they are only valid while |path| is alive.
+//
+// custom_verbs is a sorted array of configured custom verbs that are used to
+// match against any custom verbs in request path. If the request_path
+// contains a custom verb not found in custom_verbs, it is treated as a part
+// of the path.
 //
 // - Strips off query string: "/a?foo=bar" --> "/a"
 // - Collapses extra slashes: "///" --> "/"
-std::vector<std::string> ExtractRequestParts(
-    std::string path, const std::set<std::string>& custom_verbs) {
+PathMatcherFlatTrie::RequestPathSegments ExtractRequestParts(
+    const std::string& path, const std::vector<std::string>& custom_verbs) {
   // Remove query parameters.
-  path = path.substr(0, path.find_first_of('?'));
+  absl::string_view stripped(path);
+  stripped = stripped.substr(0, stripped.find_first_of('?'));
 
-  // Replace last ':' with '/' to handle custom verb.
+  // Treat the last ':' as a segment separator to handle custom verb.
   // But not for /foo:bar/const.
-  std::size_t last_colon_pos = path.find_last_of(':');
-  std::size_t last_slash_pos = path.find_last_of('/');
-  if (last_colon_pos != std::string::npos && last_colon_pos > last_slash_pos) {
-    std::string verb = path.substr(last_colon_pos + 1);
-    // only verb in the configured custom verbs, treat it as verb
-    // replace ":" with / as a separate segment.
-    if (custom_verbs.find(verb) != custom_verbs.end()) {
-      path[last_colon_pos] = '/';
+  std::size_t verb_pos = absl::string_view::npos;
+  if (!custom_verbs.empty()) {
+    std::size_t last_colon_pos = stripped.find_last_of(':');
+    std::size_t last_slash_pos = stripped.find_last_of('/');
+    if (last_colon_pos != absl::string_view::npos &&
+        (last_slash_pos == absl::string_view::npos ||
+         last_colon_pos > last_slash_pos)) {
+      absl::string_view verb = stripped.substr(last_colon_pos + 1);
+      // only verb in the configured custom verbs, treat it as verb
+      // and split it off as a separate segment.
+      if (std::binary_search(custom_verbs.begin(), custom_verbs.end(), verb,
+                             [](absl::string_view a, absl::string_view b) {
+                               return a < b;
+                             })) {
+        verb_pos = last_colon_pos;
+      }
     }
   }
 
-  std::vector<std::string> result;
-  if (path.size() > 0) {
-    split(path.substr(1), '/', result);
+  PathMatcherFlatTrie::RequestPathSegments result;
+  if (stripped.size() > 0) {
+    // Split on '/' (and on the custom verb ':', if any) without copying the
+    // segments.
+    std::size_t segment_begin = 1;
+    for (std::size_t i = 1; i <= stripped.size(); ++i) {
+      if (i == stripped.size() || stripped[i] == '/' || i == verb_pos) {
+        result.push_back(stripped.substr(segment_begin, i - segment_begin));
+        segment_begin = i + 1;
+      }
+    }
   }
   // Removes all trailing empty parts caused by extra "/".
   while (!result.empty() && (*(--result.end())).empty()) {
@@ -358,12 +411,13 @@ std::vector<std::string> ExtractRequestParts(
   return result;
 }
 
-// Looks up on a PathMatcherNode.
-PathMatcherLookupResult LookupInPathMatcherNode(
-    const PathMatcherNode& root, const std::vector<std::string>& parts,
+// Looks up on a compiled PathMatcherFlatTrie.
+PathMatcherLookupResult LookupInPathMatcherTrie(
+    const PathMatcherFlatTrie& trie,
+    const PathMatcherFlatTrie::RequestPathSegments& parts,
     const HttpMethod& http_method) {
   PathMatcherLookupResult result;
-  root.LookupPath(parts.begin(), parts.end(), http_method, &result);
+  trie.LookupPath(parts.begin(), parts.end(), http_method, &result);
   return result;
 }
 
@@ -385,8 +439,14 @@ PathMatcherNode::PathInfo TransformHttpTemplate(const HttpTemplate& ht) {
 template <class Method>
 PathMatcher<Method>::PathMatcher(PathMatcherBuilder<Method>&& builder)
     : root_ptr_(std::move(builder.root_ptr_)),
-      custom_verbs_(std::move(builder.custom_verbs_)),
-      methods_(std::move(builder.methods_)) {}
+      custom_verbs_(builder.custom_verbs_.begin(), builder.custom_verbs_.end()),
+      methods_(std::move(builder.methods_)) {
+  // A std::set iterates in sorted order, so custom_verbs_ is ready for
+  // binary search.
+  if (root_ptr_ != nullptr) {
+    flat_trie_.reset(new PathMatcherFlatTrie(*root_ptr_));
+  }
+}
 
 // Lookup is a wrapper method for the recursive node Lookup. First, the wrapper
 // splits the request path into slash-separated path parts. Next, the method
@@ -397,23 +457,23 @@ PathMatcher<Method>::PathMatcher(PathMatcherBuilder<Method>&& builder)
 // TODO: cache results by adding get/put methods here (if profiling reveals
 // benefit)
 template <class Method>
-template <class VariableBinding>
+template <class BindingVector>
 Method PathMatcher<Method>::Lookup(
     const std::string& http_method, const std::string& path,
     const std::string& query_params,
-    std::vector<VariableBinding>* variable_bindings,
+    BindingVector* variable_bindings,
     std::string* body_field_path) const {
-  const std::vector<std::string> parts =
+  const PathMatcherFlatTrie::RequestPathSegments parts =
       ExtractRequestParts(path, custom_verbs_);
 
   // If service_name has not been registered to ESP and strict_service_matching_
   // is set to false, tries to lookup the method in all registered services.
-  if (root_ptr_ == nullptr) {
+  if (flat_trie_ == nullptr) {
     return nullptr;
   }
 
   PathMatcherLookupResult lookup_result =
-      LookupInPathMatcherNode(*root_ptr_, parts, http_method);
+      LookupInPathMatcherTrie(*flat_trie_, parts, http_method);
   // Return nullptr if nothing is found.
   // Not need to check duplication. Only first item is stored for duplicated
   if (lookup_result.data == nullptr) {
@@ -439,17 +499,17 @@ Method PathMatcher<Method>::Lookup(
 template <class Method>
 Method PathMatcher<Method>::Lookup(const std::string& http_method,
                                    const std::string& path) const {
-  const std::vector<std::string> parts =
+  const PathMatcherFlatTrie::RequestPathSegments parts =
       ExtractRequestParts(path, custom_verbs_);
 
   // If service_name has not been registered to ESP and strict_service_matching_
   // is set to false, tries to lookup the method in all registered services.
-  if (root_ptr_ == nullptr) {
+  if (flat_trie_ == nullptr) {
     return nullptr;
   }
 
   PathMatcherLookupResult lookup_result =
-      LookupInPathMatcherNode(*root_ptr_, parts, http_method);
+      LookupInPathMatcherTrie(*flat_trie_, parts, http_method);
   // Return nullptr if nothing is found.
   // Not need to check duplication. Only first item is stored for duplicated
   if (lookup_result.data == nullptr) {
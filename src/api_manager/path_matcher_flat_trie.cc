@@ -0,0 +1,214 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/path_matcher_flat_trie.h"
+
+#include <algorithm>
+
+#include "src/api_manager/http_template.h"
+
+namespace google {
+namespace api_manager {
+
+namespace {
+
+// Matches HttpMethod_WILD_CARD in path_matcher_node.cc.
+const char kHttpMethodWildCard[] = "*";
+
+}  // namespace
+
+PathMatcherFlatTrie::PathMatcherFlatTrie(const PathMatcherNode& root) {
+  // |interned| maps the structural key of a compiled subtree to its node
+  // index, so structurally identical subtrees are compiled exactly once.
+  std::unordered_map<std::string, uint32_t> interned;
+  root_index_ = CompileNode(root, &interned);
+}
+
+uint32_t PathMatcherFlatTrie::CompileNode(
+    const PathMatcherNode& source,
+    std::unordered_map<std::string, uint32_t>* interned) {
+  // Post-order: the children are compiled (and possibly shared) first, so
+  // this node's identity can be expressed through its child node indices.
+  // Sort the unordered children by key so the lookup can binary search the
+  // contiguous range.
+  std::vector<const std::string*> keys;
+  keys.reserve(source.children().size());
+  for (const auto& entry : source.children()) {
+    keys.push_back(&entry.first);
+  }
+  std::sort(keys.begin(), keys.end(),
+            [](const std::string* a, const std::string* b) { return *a < *b; });
+
+  std::vector<uint32_t> child_indices;
+  child_indices.reserve(keys.size());
+  for (const std::string* key : keys) {
+    child_indices.push_back(
+        CompileNode(*source.children().find(*key)->second, interned));
+  }
+
+  // The structural key describes the compiled node byte for byte: the
+  // wildcard flag, the per-method results and the child links. Two nodes
+  // with equal keys match exactly the same request suffixes to the same
+  // methods, so they are interchangeable.
+  std::string structural_key;
+  structural_key.push_back(source.wildcard() ? 'W' : 'w');
+  for (const auto& entry : source.result_map()) {
+    structural_key.append(entry.first);
+    structural_key.push_back('\0');
+    const void* data = entry.second.data;
+    structural_key.append(reinterpret_cast<const char*>(&data), sizeof(data));
+    structural_key.push_back(entry.second.is_multiple ? 'M' : 'm');
+  }
+  for (size_t i = 0; i < keys.size(); ++i) {
+    structural_key.append(*keys[i]);
+    structural_key.push_back('\0');
+    structural_key.append(reinterpret_cast<const char*>(&child_indices[i]),
+                          sizeof(child_indices[i]));
+  }
+  auto found = interned->find(structural_key);
+  if (found != interned->end()) {
+    return found->second;
+  }
+
+  FlatNode node;
+  node.single_param_child = kNoNode;
+  node.wildcard_part_child = kNoNode;
+  node.wildcard_path_child = kNoNode;
+  node.wildcard = source.wildcard();
+
+  // result_map_ is a std::map, so the entries are appended already sorted
+  // by HTTP method.
+  node.results_begin = static_cast<uint32_t>(results_.size());
+  for (const auto& entry : source.result_map()) {
+    ResultEntry result_entry = {entry.first, entry.second};
+    results_.push_back(result_entry);
+  }
+  node.results_end = static_cast<uint32_t>(results_.size());
+
+  node.children_begin = static_cast<uint32_t>(children_.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    ChildEntry child_entry;
+    child_entry.key = *keys[i];
+    child_entry.node = child_indices[i];
+    children_.push_back(std::move(child_entry));
+    if (*keys[i] == HttpTemplate::kSingleParameterKey) {
+      node.single_param_child = child_indices[i];
+    } else if (*keys[i] == HttpTemplate::kWildCardPathPartKey) {
+      node.wildcard_part_child = child_indices[i];
+    } else if (*keys[i] == HttpTemplate::kWildCardPathKey) {
+      node.wildcard_path_child = child_indices[i];
+    }
+  }
+  node.children_end = static_cast<uint32_t>(children_.size());
+
+  const uint32_t index = static_cast<uint32_t>(nodes_.size());
+  nodes_.push_back(node);
+  interned->emplace(std::move(structural_key), index);
+  return index;
+}
+
+void PathMatcherFlatTrie::LookupPath(
+    RequestPathSegments::const_iterator current,
+    RequestPathSegments::const_iterator end,
+    const HttpMethod& http_method, PathMatcherLookupResult* result) const {
+  LookupInNode(root_index_, current, end, http_method, result);
+}
+
+// Mirrors the DFS in PathMatcherNode::LookupPath, operating on array indices
+// instead of heap-allocated nodes. See the comments there for the matching
+// precedence rules.
+void PathMatcherFlatTrie::LookupInNode(
+    uint32_t node_index,
+    RequestPathSegments::const_iterator current,
+    RequestPathSegments::const_iterator end,
+    const HttpMethod& http_method, PathMatcherLookupResult* result) const {
+  const FlatNode& node = nodes_[node_index];
+  // base case
+  if (current == end) {
+    if (!GetResultForHttpMethod(node, http_method, result) &&
+        node.wildcard_path_child != kNoNode) {
+      // Match the root with wildcard (**) templates.
+      GetResultForHttpMethod(nodes_[node.wildcard_path_child], http_method,
+                             result);
+    }
+    return;
+  }
+  const uint32_t literal_child = FindChild(node, *current);
+  if (literal_child != kNoNode) {
+    LookupInNode(literal_child, current + 1, end, http_method, result);
+    if (result != nullptr && result->data != nullptr) {
+      return;
+    }
+  }
+  // For wild card node, keeps searching for next path segment until either
+  // 1) reaching the end (/foo/** case), or 2) all remaining segments match
+  // one of child branches (/foo/**/bar/xyz case).
+  if (node.wildcard) {
+    LookupInNode(node_index, current + 1, end, http_method, result);
+    // Since only constant segments are allowed after wild card, no need to
+    // search another wild card nodes from children, so bail out here.
+    return;
+  }
+  for (const uint32_t child : {node.single_param_child,
+                               node.wildcard_part_child,
+                               node.wildcard_path_child}) {
+    if (child == kNoNode) {
+      continue;
+    }
+    LookupInNode(child, current + 1, end, http_method, result);
+    if (result != nullptr && result->data != nullptr) {
+      return;
+    }
+  }
+}
+
+uint32_t PathMatcherFlatTrie::FindChild(const FlatNode& node,
+                                        absl::string_view part) const {
+  const ChildEntry* begin = children_.data() + node.children_begin;
+  const ChildEntry* end = children_.data() + node.children_end;
+  const ChildEntry* it = std::lower_bound(
+      begin, end, part,
+      [](const ChildEntry& entry, absl::string_view key) {
+        return absl::string_view(entry.key) < key;
+      });
+  if (it != end && absl::string_view(it->key) == part) {
+    return it->node;
+  }
+  return kNoNode;
+}
+
+bool PathMatcherFlatTrie::GetResultForHttpMethod(
+    const FlatNode& node, const HttpMethod& http_method,
+    PathMatcherLookupResult* result) const {
+  const ResultEntry* begin = results_.data() + node.results_begin;
+  const ResultEntry* end = results_.data() + node.results_end;
+  for (const ResultEntry* it = begin; it != end; ++it) {
+    if (it->http_method == http_method) {
+      *result = it->result;
+      return true;
+    }
+  }
+  for (const ResultEntry* it = begin; it != end; ++it) {
+    if (it->http_method == kHttpMethodWildCard) {
+      *result = it->result;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace api_manager
+}  // namespace google
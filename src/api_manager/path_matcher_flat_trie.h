@@ -0,0 +1,135 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_PATH_MATCHER_FLAT_TRIE_H_
+#define API_MANAGER_PATH_MATCHER_FLAT_TRIE_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "src/api_manager/path_matcher_node.h"
+
+namespace google {
+namespace api_manager {
+
+// An immutable, flattened representation of a PathMatcherNode trie.
+//
+// The mutable PathMatcherNode trie keeps its children in one
+// std::unordered_map per node, so every segment of every lookup pays a string
+// hash plus a pointer chase to a separately allocated node. This class
+// compiles the finished trie into three contiguous arrays (nodes, child
+// entries and per-method results) once at PathMatcherBuilder::Build() time.
+// Lookups then walk array indices; the only per-node work is a binary search
+// over that node's contiguous, sorted child entries.
+//
+// Compilation hash-conses the trie: structurally identical subtrees (the
+// same wildcard flag, results and children, with the children linking to
+// the same compiled nodes) are compiled once and shared by index. When
+// several services with overlapping API surfaces are registered into one
+// builder, the common subtrees are stored once instead of once per
+// service, which also keeps more of the trie in cache during lookup.
+//
+// The matching semantics (literal first, then '**' self-recursion, then the
+// single-parameter, '*' and '**' children) are exactly those of
+// PathMatcherNode::LookupPath.
+//
+// Thread safe after construction.
+class PathMatcherFlatTrie {
+ public:
+  // The request path split into slash separated segments. The segments are
+  // views into the request path string, so no per-segment copy is made; they
+  // are only valid while that string is alive.
+  typedef std::vector<absl::string_view> RequestPathSegments;
+
+  // Compiles the trie rooted at |root|. The resulting object does not
+  // reference |root| after construction.
+  explicit PathMatcherFlatTrie(const PathMatcherNode& root);
+
+  // Equivalent of PathMatcherNode::LookupPath on the root node.
+  void LookupPath(RequestPathSegments::const_iterator current,
+                  RequestPathSegments::const_iterator end,
+                  const HttpMethod& http_method,
+                  PathMatcherLookupResult* result) const;
+
+ private:
+  // Index value used for absent child links.
+  static const uint32_t kNoNode = 0xFFFFFFFFu;
+
+  // A compiled trie node. Literal and special children alike live in the
+  // [children_begin, children_end) range of |children_|, sorted by key;
+  // the three special children are additionally cached by index so the
+  // fallback probes do not need a search.
+  struct FlatNode {
+    uint32_t children_begin;
+    uint32_t children_end;
+    uint32_t results_begin;
+    uint32_t results_end;
+    uint32_t single_param_child;
+    uint32_t wildcard_part_child;
+    uint32_t wildcard_path_child;
+    // True if this node itself was inserted for a '**' template segment.
+    bool wildcard;
+  };
+
+  // A (path part, child node) link, sorted by |key| within its node's range.
+  struct ChildEntry {
+    std::string key;
+    uint32_t node;
+  };
+
+  // A per-HTTP-method result, sorted by |http_method| within its node's
+  // range.
+  struct ResultEntry {
+    HttpMethod http_method;
+    PathMatcherLookupResult result;
+  };
+
+  // Recursive post-order compiler for the constructor. Compiles the
+  // children of |source| first, then either reuses a structurally
+  // identical compiled node from |interned| or appends a new one.
+  // Returns the index of the compiled node.
+  uint32_t CompileNode(const PathMatcherNode& source,
+                       std::unordered_map<std::string, uint32_t>* interned);
+
+  // Recursive worker of LookupPath operating on node indices.
+  void LookupInNode(uint32_t node_index,
+                    RequestPathSegments::const_iterator current,
+                    RequestPathSegments::const_iterator end,
+                    const HttpMethod& http_method,
+                    PathMatcherLookupResult* result) const;
+
+  // Binary-searches the child entries of |node| for |part|. Returns the
+  // child node index, or kNoNode.
+  uint32_t FindChild(const FlatNode& node, absl::string_view part) const;
+
+  // Flat trie equivalent of PathMatcherNode::GetResultForHttpMethod.
+  bool GetResultForHttpMethod(const FlatNode& node,
+                              const HttpMethod& http_method,
+                              PathMatcherLookupResult* result) const;
+
+  std::vector<FlatNode> nodes_;
+  std::vector<ChildEntry> children_;
+  std::vector<ResultEntry> results_;
+  // The index of the compiled root node. With post-order compilation the
+  // root is appended last, not first.
+  uint32_t root_index_;
+};
+
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_PATH_MATCHER_FLAT_TRIE_H_
@@ -139,6 +139,17 @@ class PathMatcherNode {
 
   void set_wildcard(bool wildcard) { wildcard_ = wildcard; }
 
+  // Read-only accessors used by PathMatcherFlatTrie to compile the finished
+  // trie into its flattened representation.
+  const std::map<HttpMethod, PathMatcherLookupResult>& result_map() const {
+    return result_map_;
+  }
+  const std::unordered_map<std::string, std::unique_ptr<PathMatcherNode>>&
+  children() const {
+    return children_;
+  }
+  bool wildcard() const { return wildcard_; }
+
  private:
   // This method inserts a path of nodes into this subtrie (described by the
   // vector<Info>, starting from the |current| position in the iterator of path
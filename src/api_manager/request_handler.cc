@@ -31,12 +31,22 @@ namespace google {
 namespace api_manager {
 
 RequestHandler::RequestHandler(
+    ApiManagerImpl *api_manager,
     std::shared_ptr<CheckWorkflow> check_workflow,
     std::shared_ptr<context::ServiceContext> service_context,
     std::unique_ptr<Request> request_data)
     : context_(new context::RequestContext(service_context,
                                            std::move(request_data))),
+      api_manager_(api_manager),
       check_workflow_(check_workflow) {
+  // Shadow-verify routing against a rollout pending promotion. Cheap
+  // no-op unless server_config.shadow_rollout_config held one back.
+  if (api_manager_) {
+    api_manager_->ShadowCompareRouting(
+        context_->GetRequestHTTPMethodWithOverride(),
+        context_->request()->GetUnparsedRequestPath(), context_->method());
+  }
+
   // Remove x-endponts-api-userinfo from downstream client.
   // It should be set by the last Endpoint proxy to prevent users spoofing.
   std::string buffer;
@@ -84,6 +94,15 @@ void RequestHandler::AttemptIntermediateReport() {
       context_->service_context()->intermediate_report_interval()) {
     return;
   }
+  // Idle streams would otherwise re-report unchanged counters every
+  // interval; skip this one when no bytes moved since the last report.
+  // The first report is never elided since its request_count marks the
+  // start of the stream.
+  if (!context_->is_first_report() &&
+      !context_->HasStreamActivitySinceLastReport()) {
+    context_->set_last_report_time(std::chrono::steady_clock::now());
+    return;
+  }
   service_control::ReportRequestInfo info;
   info.is_first_report = context_->is_first_report();
   info.is_final_report = false;
@@ -103,6 +122,18 @@ void RequestHandler::AttemptIntermediateReport() {
 // Sends a report.
 void RequestHandler::Report(std::unique_ptr<Response> response,
                             std::function<void(void)> continuation) {
+  // Feed the final request latency back to the rollout selector. Cheap
+  // no-op unless server_config.rollout_latency_feedback_config is
+  // enabled.
+  if (api_manager_) {
+    service_control::LatencyInfo latency;
+    if (response->GetLatencyInfo(&latency).ok() &&
+        latency.request_time_ms >= 0) {
+      api_manager_->RecordRolloutLatency(GetServiceConfigId(),
+                                         latency.request_time_ms);
+    }
+  }
+
   if (context_->method() && context_->method()->skip_service_control()) {
     continuation();
     return;
@@ -26,7 +26,8 @@ namespace api_manager {
 // Implements RequestHandlerInterface.
 class RequestHandler : public RequestHandlerInterface {
  public:
-  RequestHandler(std::shared_ptr<CheckWorkflow> check_workflow,
+  RequestHandler(ApiManagerImpl *api_manager,
+                 std::shared_ptr<CheckWorkflow> check_workflow,
                  std::shared_ptr<context::ServiceContext> service_context,
                  std::unique_ptr<Request> request_data);
 
@@ -64,6 +65,10 @@ class RequestHandler : public RequestHandlerInterface {
 
   virtual std::string GetAuthorizationUrl() const;
 
+  virtual std::string GetLatencyAttribution() const {
+    return context_->FormatLatencyAttribution();
+  }
+
  private:
   // The context object needs to pass to the continuation function the check
   // handler as a lambda capture so it can be passed to the next check handler.
@@ -71,6 +76,11 @@ class RequestHandler : public RequestHandlerInterface {
   // This object holds a ref_count, the continuation will hold another one.
   std::shared_ptr<context::RequestContext> context_;
 
+  // The ApiManagerImpl that created this handler. It owns the deployed
+  // configs and outlives every per-request handler; used to feed the
+  // final request latency back to the rollout selector.
+  ApiManagerImpl *api_manager_;
+
   std::shared_ptr<CheckWorkflow> check_workflow_;
 };
 
@@ -33,6 +33,27 @@ void *esp_regex_malloc(size_t size) { return malloc(size); }
 // Internal memory free function
 void esp_regex_free(void *p) { free(p); }
 
+// Extracts the literal characters a pattern anchored with '^' requires at
+// the start of the subject. Stops at the first metacharacter, and excludes
+// a literal that a following quantifier makes optional or repeated.
+std::string ExtractLiteralPrefix(const std::string &pattern) {
+  std::string prefix;
+  if (pattern.empty() || pattern[0] != '^') {
+    return prefix;
+  }
+  for (size_t i = 1; i < pattern.size(); ++i) {
+    char c = pattern[i];
+    if (strchr("\\.[](){}|^$*+?", c) != NULL) {
+      break;
+    }
+    if (i + 1 < pattern.size() && strchr("*+?{", pattern[i + 1]) != NULL) {
+      break;
+    }
+    prefix.push_back(c);
+  }
+  return prefix;
+}
+
 // Backup and override pcre_malloc function pointer which was overridden by
 // nginx. Since nginx is single thread model, it is safe to override and restore
 class PcreMemoryFunctionOverride {
@@ -139,7 +160,12 @@ RewriteRule::RewriteRule(std::string regex, std::string replacement,
     return;
   }
 
+#ifdef PCRE_STUDY_JIT_COMPILE
+  regex_extra_ =
+      pcre_study(regex_compiled_, PCRE_STUDY_JIT_COMPILE, &pcre_error_str);
+#else
   regex_extra_ = pcre_study(regex_compiled_, 0, &pcre_error_str);
+#endif
   if (pcre_error_str != NULL) {
     env_->LogError("Invalid rewrite rule: \"" + regex_pattern_ +
                    "\", error: " + std::string(pcre_error_str));
@@ -148,6 +174,8 @@ RewriteRule::RewriteRule(std::string regex, std::string replacement,
     return;
   }
 
+  literal_prefix_ = ExtractLiteralPrefix(regex_pattern_);
+
   std::string segment;
   ReplacementPartType status = ReplacementPartType::TEXT;
 
@@ -228,6 +256,22 @@ bool RewriteRule::Check(const char *uri, size_t uri_len,
     return false;
   }
 
+  // Reject uris missing the required literal prefix without running the
+  // regex engine.
+  if (!literal_prefix_.empty() &&
+      (uri_len < literal_prefix_.size() ||
+       memcmp(uri, literal_prefix_.data(), literal_prefix_.size()) != 0)) {
+    if (debug_mode) {
+      std::stringstream rewrite_log;
+      rewrite_log << kEspRewriteTitle << ": matching rule: " << regex_pattern_
+                  << ", request uri: " << std::string(uri, uri_len)
+                  << ", error: String did not match the literal prefix"
+                  << std::endl;
+      env_->LogInfo(rewrite_log.str());
+    }
+    return false;
+  }
+
   PcreMemoryFunctionOverride scoped_override;
 
   std::stringstream rewrite_log;
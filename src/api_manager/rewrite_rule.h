@@ -75,6 +75,12 @@ class RewriteRule {
   // original pcre regular expression pattern
   std::string regex_pattern_;
 
+  // The literal characters an anchored pattern requires at the start of
+  // the uri, extracted at compile time. Non-matching uris are rejected
+  // with a single memcmp before the regex engine runs. Empty for
+  // unanchored patterns.
+  std::string literal_prefix_;
+
   // pcre compiled and studied pointers
   pcre *regex_compiled_;
   pcre_extra *regex_extra_;
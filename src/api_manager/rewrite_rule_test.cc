@@ -206,6 +206,28 @@ TEST_F(RewriteRuleTest, CheckWithDebugInformation) {
   EXPECT_EQ(env.getLogMessage()[0], kExpectedRewriteLog);
 }
 
+TEST_F(RewriteRuleTest, AnchoredPatternPrefixPreFilter) {
+  MockTimerApiManagerEnvironment env;
+
+  RewriteRule rr("^/api/(.*)$", "/$1", &env);
+
+  std::string destination;
+  // A uri without the required "/api/" prefix is rejected before the regex
+  // engine runs.
+  EXPECT_FALSE(rr.Check("/foo/api/shelves", strlen("/foo/api/shelves"),
+                        &destination, true));
+  EXPECT_EQ(env.getLogMessage().size(), 1);
+  EXPECT_EQ(env.getLogMessage()[0],
+            "INFO esp_rewrite: matching rule: ^/api/(.*)$, request uri: "
+            "/foo/api/shelves, error: String did not match the literal "
+            "prefix\n");
+
+  // Matching uris still rewrite as before.
+  EXPECT_TRUE(
+      rr.Check("/api/shelves", strlen("/api/shelves"), &destination, false));
+  EXPECT_EQ("/shelves", destination);
+}
+
 }  // namespace
 
 }  // namespace api_manager
@@ -0,0 +1,158 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "src/api_manager/service_config_cache.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+
+#include "utils/md5.h"
+
+namespace google {
+namespace api_manager {
+
+namespace {
+
+// Magic and format version at the start of every cache entry. Bump the
+// version digit when the entry layout changes; entries with another magic
+// are ignored and rewritten.
+const char kCacheMagic[] = "ESPCFG1\n";
+const size_t kCacheMagicSize = sizeof(kCacheMagic) - 1;
+
+// Hex-encoded MD5 of the original config text, stored after the magic and
+// also used as the file name.
+const size_t kDigestHexSize = 32;
+
+std::string DigestHex(const std::string &config) {
+  ::google::service_control_client::MD5 hasher;
+  hasher.Update(config);
+  const std::string digest = hasher.Digest();
+  std::string hex;
+  hex.reserve(digest.size() * 2);
+  for (unsigned char c : digest) {
+    char buf[3];
+    snprintf(buf, sizeof(buf), "%02x", c);
+    hex.append(buf, 2);
+  }
+  return hex;
+}
+
+std::string CacheEntryPath(const std::string &cache_dir,
+                           const std::string &digest_hex) {
+  return cache_dir + "/" + digest_hex + ".pb";
+}
+
+}  // namespace
+
+std::string ServiceConfigCachePath(const std::string &cache_dir,
+                                   const std::string &service_config) {
+  if (cache_dir.empty()) {
+    return std::string();
+  }
+  return CacheEntryPath(cache_dir, DigestHex(service_config));
+}
+
+bool LoadConfigFromCache(ApiManagerEnvInterface *env,
+                         const std::string &cache_dir,
+                         const std::string &service_config,
+                         std::string *cached_config) {
+  return LoadConfigFromCacheFile(
+      env, ServiceConfigCachePath(cache_dir, service_config), cached_config);
+}
+
+bool LoadConfigFromCacheFile(ApiManagerEnvInterface *env,
+                             const std::string &path,
+                             std::string *cached_config) {
+  if (path.empty()) {
+    return false;
+  }
+
+  // The file name is the hex digest of the config text the entry was
+  // written for; validating the stored digest against it catches renamed
+  // or truncated entries without needing the original text.
+  const std::string file_name = path.substr(path.rfind('/') + 1);
+  if (file_name.size() != kDigestHexSize + 3) {
+    return false;
+  }
+  const std::string digest_hex = file_name.substr(0, kDigestHexSize);
+
+  std::ifstream file(path, std::ios::in | std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  const std::string entry = contents.str();
+
+  // Reject entries of another format version or with a digest that does
+  // not match the config text; both fall back to the JSON parse.
+  if (entry.size() <= kCacheMagicSize + kDigestHexSize ||
+      entry.compare(0, kCacheMagicSize, kCacheMagic) != 0 ||
+      entry.compare(kCacheMagicSize, kDigestHexSize, digest_hex) != 0) {
+    env->LogWarning("Ignoring invalid service config cache entry: " + path);
+    return false;
+  }
+
+  *cached_config = entry.substr(kCacheMagicSize + kDigestHexSize);
+  env->LogInfo("Loaded service config from cache: " + path);
+  return true;
+}
+
+bool SaveConfigToCache(ApiManagerEnvInterface *env,
+                       const std::string &cache_dir,
+                       const std::string &service_config,
+                       const ::google::protobuf::Message &service) {
+  if (cache_dir.empty()) {
+    return false;
+  }
+
+  const std::string digest_hex = DigestHex(service_config);
+  const std::string path = CacheEntryPath(cache_dir, digest_hex);
+  // Per-worker temporary name so parallel workers do not clobber each
+  // other's half-written entries; the rename into place is atomic.
+  const std::string tmp_path =
+      path + ".tmp." + std::to_string(static_cast<long long>(getpid()));
+
+  std::string serialized;
+  if (!service.SerializeToString(&serialized)) {
+    env->LogWarning("Failed to serialize service config for the cache");
+    return false;
+  }
+
+  std::ofstream file(tmp_path,
+                     std::ios::out | std::ios::trunc | std::ios::binary);
+  if (!file) {
+    env->LogWarning("Failed to write service config cache entry: " + path);
+    return false;
+  }
+  file.write(kCacheMagic, kCacheMagicSize);
+  file.write(digest_hex.data(), digest_hex.size());
+  file.write(serialized.data(), serialized.size());
+  file.close();
+
+  if (!file || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    env->LogWarning("Failed to write service config cache entry: " + path);
+    remove(tmp_path.c_str());
+    return false;
+  }
+  env->LogInfo("Wrote service config cache entry: " + path);
+  return true;
+}
+
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,69 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SERVICE_CONFIG_CACHE_H_
+#define API_MANAGER_SERVICE_CONFIG_CACHE_H_
+
+#include <string>
+
+#include "google/protobuf/message.h"
+#include "include/api_manager/env_interface.h"
+
+namespace google {
+namespace api_manager {
+
+// An on-disk cache of parsed service configs. Service configs arrive as
+// JSON and the JSON-to-proto conversion dominates cold start time for
+// large configs; after the first parse the serialized google.api.Service
+// proto is written to the cache directory, keyed by a digest of the
+// original config text, and later starts load it with a plain binary
+// proto parse. The cache is best effort: a missing, stale or corrupt
+// entry just means the JSON is parsed again.
+
+// Returns the path of the cache entry for service_config in cache_dir,
+// whether or not the entry exists. An empty cache_dir disables the cache
+// and yields an empty path.
+std::string ServiceConfigCachePath(const std::string &cache_dir,
+                                   const std::string &service_config);
+
+// Looks up the cache entry for service_config in cache_dir. On a hit
+// fills cached_config with the serialized Service proto and returns true.
+// An empty cache_dir disables the cache.
+bool LoadConfigFromCache(ApiManagerEnvInterface *env,
+                         const std::string &cache_dir,
+                         const std::string &service_config,
+                         std::string *cached_config);
+
+// Loads the cache entry at path, a value previously obtained from
+// ServiceConfigCachePath(). The entry is validated against the digest
+// encoded in its file name, so a path can be kept across the lifetime of
+// a config without also keeping the original config text it was derived
+// from.
+bool LoadConfigFromCacheFile(ApiManagerEnvInterface *env,
+                             const std::string &path,
+                             std::string *cached_config);
+
+// Writes the parsed service proto for service_config to the cache. The
+// entry is written to a temporary file and renamed into place, so workers
+// racing on the same entry see either the old or the new version. Returns
+// true once the entry is in place.
+bool SaveConfigToCache(ApiManagerEnvInterface *env,
+                       const std::string &cache_dir,
+                       const std::string &service_config,
+                       const ::google::protobuf::Message &service);
+
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SERVICE_CONFIG_CACHE_H_
@@ -0,0 +1,117 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/service_config_cache.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "google/api/service.pb.h"
+#include "src/api_manager/mock_api_manager_environment.h"
+
+namespace google {
+namespace api_manager {
+
+namespace {
+
+const char kServiceConfigJson[] = R"(
+{
+  "name": "bookstore.test.appspot.com",
+  "id": "2017-05-01r0"
+})";
+
+class ServiceConfigCacheTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    env_.reset(new ::testing::NiceMock<MockApiManagerEnvironment>());
+    const char* tmp = getenv("TEST_TMPDIR");
+    cache_dir_ = std::string(tmp ? tmp : "/tmp") + "/config_cache";
+    // The cache directory is expected to exist.
+    mkdir(cache_dir_.c_str(), 0755);
+  }
+
+  std::unique_ptr<MockApiManagerEnvironment> env_;
+  std::string cache_dir_;
+};
+
+TEST_F(ServiceConfigCacheTest, SaveThenLoadRoundTrip) {
+  ::google::api::Service service;
+  service.set_name("bookstore.test.appspot.com");
+  service.set_id("2017-05-01r0");
+
+  SaveConfigToCache(env_.get(), cache_dir_, kServiceConfigJson, service);
+
+  std::string cached;
+  ASSERT_TRUE(
+      LoadConfigFromCache(env_.get(), cache_dir_, kServiceConfigJson, &cached));
+
+  ::google::api::Service loaded;
+  ASSERT_TRUE(loaded.ParseFromString(cached));
+  ASSERT_EQ("bookstore.test.appspot.com", loaded.name());
+  ASSERT_EQ("2017-05-01r0", loaded.id());
+}
+
+TEST_F(ServiceConfigCacheTest, ChangedConfigMisses) {
+  ::google::api::Service service;
+  service.set_name("bookstore.test.appspot.com");
+
+  SaveConfigToCache(env_.get(), cache_dir_, kServiceConfigJson, service);
+
+  // A different config text hashes to a different entry.
+  std::string cached;
+  ASSERT_FALSE(LoadConfigFromCache(env_.get(), cache_dir_,
+                                   "{\"name\": \"other\"}", &cached));
+}
+
+TEST_F(ServiceConfigCacheTest, LoadByPathWithoutOriginalText) {
+  ::google::api::Service service;
+  service.set_name("bookstore.test.appspot.com");
+  service.set_id("2017-05-01r0");
+
+  ASSERT_TRUE(
+      SaveConfigToCache(env_.get(), cache_dir_, kServiceConfigJson, service));
+
+  // The path alone is enough to load the entry later, after the original
+  // config text has been dropped.
+  const std::string path =
+      ServiceConfigCachePath(cache_dir_, kServiceConfigJson);
+  ASSERT_FALSE(path.empty());
+
+  std::string cached;
+  ASSERT_TRUE(LoadConfigFromCacheFile(env_.get(), path, &cached));
+
+  ::google::api::Service loaded;
+  ASSERT_TRUE(loaded.ParseFromString(cached));
+  ASSERT_EQ("2017-05-01r0", loaded.id());
+
+  ASSERT_FALSE(
+      LoadConfigFromCacheFile(env_.get(), cache_dir_ + "/gone.pb", &cached));
+}
+
+TEST_F(ServiceConfigCacheTest, EmptyCacheDirDisablesCache) {
+  ::google::api::Service service;
+  service.set_name("bookstore.test.appspot.com");
+
+  SaveConfigToCache(env_.get(), "", kServiceConfigJson, service);
+
+  std::string cached;
+  ASSERT_FALSE(LoadConfigFromCache(env_.get(), "", kServiceConfigJson, &cached));
+}
+
+}  // namespace
+
+}  // namespace api_manager
+}  // namespace google
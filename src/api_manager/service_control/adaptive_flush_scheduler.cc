@@ -0,0 +1,110 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "src/api_manager/service_control/adaptive_flush_scheduler.h"
+
+#include <algorithm>
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+namespace {
+
+// The volume caps the scheduler starts from and grows back to while
+// flushes stay cheap.
+const int kDefaultMaxOperations = 1000;
+const uint64_t kDefaultMaxBytes = 1024 * 1024;
+
+// The floors the volume caps shrink to while flushes are slow.
+const int kMinOperations = 100;
+const uint64_t kMinBytes = 64 * 1024;
+
+// The flush interval assumed until the client states its own.
+const int kDefaultBaseIntervalMs = 1000;
+
+// A flush duration average above the slow bound halves the volume caps;
+// one below the fast bound doubles them back toward the defaults and
+// shortens the interval. In between, the thresholds are left alone.
+const double kSlowFlushMs = 50.0;
+const double kFastFlushMs = 10.0;
+
+// The weight of the latest flush duration in the moving average.
+const double kEmaAlpha = 0.2;
+
+}  // namespace
+
+const int AdaptiveFlushScheduler::kTickIntervalMs;
+
+AdaptiveFlushScheduler::AdaptiveFlushScheduler()
+    : base_interval_ms_(kDefaultBaseIntervalMs),
+      interval_ms_(kDefaultBaseIntervalMs),
+      max_operations_(kDefaultMaxOperations),
+      max_bytes_(kDefaultMaxBytes),
+      pending_operations_(0),
+      pending_bytes_(0),
+      flush_duration_ema_ms_(-1.0) {}
+
+void AdaptiveFlushScheduler::set_base_interval_ms(int base_interval_ms) {
+  if (base_interval_ms <= 0) {
+    return;
+  }
+  base_interval_ms_ = base_interval_ms;
+  interval_ms_ = base_interval_ms;
+}
+
+bool AdaptiveFlushScheduler::OnReport(int operations, uint64_t bytes) {
+  pending_operations_ += operations;
+  pending_bytes_ += bytes;
+  return pending_operations_ >= max_operations_ || pending_bytes_ >= max_bytes_;
+}
+
+bool AdaptiveFlushScheduler::OnTick(std::chrono::steady_clock::time_point now) {
+  return now - last_flush_ >= std::chrono::milliseconds(interval_ms_);
+}
+
+void AdaptiveFlushScheduler::OnFlushDone(
+    std::chrono::steady_clock::time_point now,
+    std::chrono::milliseconds duration) {
+  pending_operations_ = 0;
+  pending_bytes_ = 0;
+  last_flush_ = now;
+
+  double duration_ms = static_cast<double>(duration.count());
+  if (flush_duration_ema_ms_ < 0.0) {
+    flush_duration_ema_ms_ = duration_ms;
+  } else {
+    flush_duration_ema_ms_ = (1.0 - kEmaAlpha) * flush_duration_ema_ms_ +
+                             kEmaAlpha * duration_ms;
+  }
+
+  if (flush_duration_ema_ms_ > kSlowFlushMs) {
+    // Flushes are expensive: cap batches harder so each flush serializes
+    // less, and do not flush on the timer more often than the client asked
+    // for.
+    max_operations_ = std::max(kMinOperations, max_operations_ / 2);
+    max_bytes_ = std::max(kMinBytes, max_bytes_ / 2);
+    interval_ms_ = std::min(base_interval_ms_, interval_ms_ * 2);
+  } else if (flush_duration_ema_ms_ < kFastFlushMs) {
+    // Flushes are cheap: flush eagerly so data is not held longer than
+    // necessary, and let batches grow back toward the defaults.
+    max_operations_ = std::min(kDefaultMaxOperations, max_operations_ * 2);
+    max_bytes_ = std::min(kDefaultMaxBytes, max_bytes_ * 2);
+    interval_ms_ = std::max(kTickIntervalMs, interval_ms_ / 2);
+  }
+}
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,91 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SERVICE_CONTROL_ADAPTIVE_FLUSH_SCHEDULER_H_
+#define API_MANAGER_SERVICE_CONTROL_ADAPTIVE_FLUSH_SCHEDULER_H_
+
+#include <chrono>
+#include <cstdint>
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+// Decides when the service control client flush callback runs. Instead of
+// a fixed flush period, a flush is triggered by whichever comes first of
+// the tuned interval elapsing, the accumulated operation count, or the
+// accumulated estimated serialized bytes. The thresholds tune themselves
+// from recent flush durations: when flushes are cheap the interval shrinks
+// so data is not held longer than necessary, and when flushes are slow the
+// volume caps shrink so a single flush never serializes a huge batch in
+// one burst.
+//
+// The scheduler is driven from the worker event loop only and is not
+// thread safe. Time is passed in explicitly so tests can control it.
+class AdaptiveFlushScheduler {
+ public:
+  AdaptiveFlushScheduler();
+
+  // The fixed tick of the driving timer. Also the lower bound the tuned
+  // interval can shrink to.
+  static const int kTickIntervalMs = 500;
+
+  // The flush interval the service control client asked for; the upper
+  // bound of the tuned interval. Values <= 0 are ignored.
+  void set_base_interval_ms(int base_interval_ms);
+
+  // Records operations merged into the aggregation cache by one report.
+  // Returns true when the accumulated volume warrants an immediate flush.
+  bool OnReport(int operations, uint64_t bytes);
+
+  // Called on every timer tick. Returns true when the tuned interval has
+  // elapsed since the last flush.
+  bool OnTick(std::chrono::steady_clock::time_point now);
+
+  // Records a completed flush and how long it took, resets the volume
+  // counters and tunes the thresholds.
+  void OnFlushDone(std::chrono::steady_clock::time_point now,
+                   std::chrono::milliseconds duration);
+
+  // Current tuned thresholds, exposed for tests.
+  int interval_ms() const { return interval_ms_; }
+  int max_operations() const { return max_operations_; }
+  uint64_t max_bytes() const { return max_bytes_; }
+
+ private:
+  // The upper bound of the tuned interval.
+  int base_interval_ms_;
+  // The tuned flush interval.
+  int interval_ms_;
+  // The tuned volume caps triggering a flush ahead of the interval.
+  int max_operations_;
+  uint64_t max_bytes_;
+
+  // Volume accumulated since the last flush.
+  int pending_operations_;
+  uint64_t pending_bytes_;
+
+  // When the last flush ran.
+  std::chrono::steady_clock::time_point last_flush_;
+
+  // Exponential moving average of the flush duration, in milliseconds.
+  // Negative until the first flush completes.
+  double flush_duration_ema_ms_;
+};
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SERVICE_CONTROL_ADAPTIVE_FLUSH_SCHEDULER_H_
@@ -0,0 +1,102 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/service_control/adaptive_flush_scheduler.h"
+
+#include "gtest/gtest.h"
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+namespace {
+
+class AdaptiveFlushSchedulerTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    scheduler_.set_base_interval_ms(1000);
+    start_ = steady_clock::now();
+    // Establish a flush baseline at start_.
+    scheduler_.OnFlushDone(start_, milliseconds(20));
+  }
+
+  AdaptiveFlushScheduler scheduler_;
+  steady_clock::time_point start_;
+};
+
+TEST_F(AdaptiveFlushSchedulerTest, FlushesWhenTheIntervalElapses) {
+  EXPECT_FALSE(scheduler_.OnTick(start_ + milliseconds(500)));
+  EXPECT_TRUE(scheduler_.OnTick(start_ + milliseconds(1000)));
+}
+
+TEST_F(AdaptiveFlushSchedulerTest, FlushesOnAccumulatedOperations) {
+  bool triggered = false;
+  for (int i = 0; i < scheduler_.max_operations() && !triggered; ++i) {
+    triggered = scheduler_.OnReport(1, 100);
+  }
+  EXPECT_TRUE(triggered);
+
+  // A flush resets the accumulated volume.
+  scheduler_.OnFlushDone(start_ + milliseconds(100), milliseconds(20));
+  EXPECT_FALSE(scheduler_.OnReport(1, 100));
+}
+
+TEST_F(AdaptiveFlushSchedulerTest, FlushesOnAccumulatedBytes) {
+  EXPECT_FALSE(scheduler_.OnReport(1, scheduler_.max_bytes() - 1));
+  EXPECT_TRUE(scheduler_.OnReport(1, 1));
+}
+
+TEST_F(AdaptiveFlushSchedulerTest, SlowFlushesShrinkTheVolumeCaps) {
+  int operations_before = scheduler_.max_operations();
+  uint64_t bytes_before = scheduler_.max_bytes();
+
+  auto now = start_;
+  for (int i = 0; i < 10; ++i) {
+    now += milliseconds(1000);
+    scheduler_.OnFlushDone(now, milliseconds(200));
+  }
+
+  EXPECT_LT(scheduler_.max_operations(), operations_before);
+  EXPECT_LT(scheduler_.max_bytes(), bytes_before);
+  // The interval never exceeds what the client asked for.
+  EXPECT_LE(scheduler_.interval_ms(), 1000);
+}
+
+TEST_F(AdaptiveFlushSchedulerTest, FastFlushesShortenTheInterval) {
+  auto now = start_;
+  for (int i = 0; i < 10; ++i) {
+    now += milliseconds(1000);
+    scheduler_.OnFlushDone(now, milliseconds(0));
+  }
+
+  EXPECT_EQ(AdaptiveFlushScheduler::kTickIntervalMs, scheduler_.interval_ms());
+
+  // Slow flushes drift the interval back toward the base.
+  for (int i = 0; i < 10; ++i) {
+    now += milliseconds(1000);
+    scheduler_.OnFlushDone(now, milliseconds(200));
+  }
+  EXPECT_EQ(1000, scheduler_.interval_ms());
+}
+
+}  // namespace
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
@@ -19,6 +19,8 @@
 #include <sstream>
 #include <typeinfo>
 #include "src/api_manager/service_control/logs_metrics_loader.h"
+#include "src/api_manager/utils/gzip.h"
+#include "src/api_manager/utils/trace_probes.h"
 
 using ::google::api::servicecontrol::v1::AllocateQuotaRequest;
 using ::google::api::servicecontrol::v1::AllocateQuotaResponse;
@@ -58,6 +60,16 @@ const int kCheckAggregationExpirationMs = 300000;
 const int kReportAggregationEntries = 10000;
 const int kReportAggregationFlushIntervalMs = 1000;
 
+// Default expiration for cached negative check verdicts. Kept short so a
+// producer fixing their configuration is not locked out for long.
+const int kNegativeCheckCacheExpirationMs = 1000;
+
+// The maximum number of distinct Checks dispatched to the service control
+// client at once. Further checks wait in arrival order, so an
+// api-key-diverse burst of cache misses cannot fan out as an unbounded
+// number of concurrent upstream calls.
+const size_t kMaxConcurrentCheckCalls = 100;
+
 // The default connection timeout for check requests.
 // 1.5s Check timeout is based on SYN resend timeout is 1s.
 const int kCheckDefaultTimeoutInMs = 1500;
@@ -77,11 +89,53 @@ const int kReportDefaultNumberOfRetries = 5;
 // Allocate quota has fail_open policy, retry once is enough.
 const int kAllocateQuotaDefaultNumberOfRetries = 1;
 
+// The hedge delay used until enough call latencies have been observed to
+// derive one.
+const int kDefaultHedgeDelayMs = 1000;
+// The number of observed call latencies needed before the hedge delay is
+// derived from them instead of using the default.
+const uint64_t kHedgeDelayMinSamples = 100;
+
 // The maximum protobuf pool size. All usages of pool alloc() and free() are
 // within a function frame. If no con-current usage, pool size of 1 is enough.
 // This number should correspond to maximum of concurrent calls.
 const int kProtoPoolMaxSize = 100;
 
+// Resets the report arena after this much of it is in use. Unit: bytes.
+// Large enough to serve many reports between resets, small enough that dead
+// report trees do not pin much memory.
+const int kReportArenaResetSizeInBytes = 64 * 1024;
+
+// Gzips a report request body and marks the content encoding. Leaves the
+// request untouched when compression fails; the server accepts identity
+// bodies either way.
+void CompressReportBody(HTTPRequest* request, ApiManagerEnvInterface* env) {
+  std::string compressed;
+  Status status = utils::GzipCompress(request->body(), &compressed);
+  if (!status.ok()) {
+    if (env) {
+      env->LogWarning(std::string("Failed to compress report body: ") +
+                      status.ToString());
+    }
+    return;
+  }
+  request->set_header("Content-Encoding", "gzip")
+      .set_body(std::move(compressed));
+}
+
+// Returns the report log entry field whitelist from the server config,
+// or an empty set (all supported fields) when none is configured.
+std::set<std::string> LogEntryFieldWhitelist(const ServerConfig* server_config) {
+  std::set<std::string> fields;
+  if (server_config && server_config->has_service_control_config()) {
+    for (const auto& field :
+         server_config->service_control_config().log_entry_field()) {
+      fields.insert(field);
+    }
+  }
+  return fields;
+}
+
 // Defines protobuf content type.
 const char application_proto[] = "application/x-protobuf";
 
@@ -162,7 +216,9 @@ std::unique_ptr<Type> Aggregated::ProtoPool<Type>::Alloc() {
   if (!pool_.empty()) {
     auto item = std::move(pool_.front());
     pool_.pop_front();
-    item->Clear();
+    if (clear_on_alloc_) {
+      item->Clear();
+    }
     return item;
   } else {
     return std::unique_ptr<Type>(new Type);
@@ -187,11 +243,13 @@ Aggregated::Aggregated(
       env_(env),
       sa_token_(sa_token),
       service_control_proto_(logs, metrics, labels, service.name(),
-                             service.id()),
+                             service.id(),
+                             LogEntryFieldWhitelist(server_config)),
       url_(service_, server_config),
       mismatched_check_config_id_(service.id()),
       mismatched_report_config_id_(service.id()),
       max_report_size_(0),
+      compress_reports_(false),
       set_rollout_id_func_(set_rollout_id_func) {
   if (sa_token_) {
     sa_token_->SetAudience(
@@ -213,7 +271,8 @@ Aggregated::Aggregated(const std::set<std::string>& logs,
       service_control_proto_(logs, "", ""),
       url_(service_, server_config_),
       client_(std::move(client)),
-      max_report_size_(0) {}
+      max_report_size_(0),
+      compress_reports_(false) {}
 
 Aggregated::~Aggregated() {}
 
@@ -259,6 +318,93 @@ Status Aggregated::Init() {
 
   InitHttpRequestTimeoutRetries();
 
+  compress_reports_ =
+      server_config_ != nullptr &&
+      server_config_->service_control_config().compress_reports();
+
+  grpc_transport_enabled_ =
+      server_config_ != nullptr &&
+      server_config_->service_control_config().grpc_transport_enabled();
+
+  hedged_calls_enabled_ =
+      server_config_ != nullptr &&
+      server_config_->service_control_config().hedged_calls_enabled();
+  hedge_delay_ms_ =
+      server_config_ != nullptr
+          ? server_config_->service_control_config().hedge_delay_ms()
+          : 0;
+
+  if (!report_flush_thread_ && server_config_ != nullptr &&
+      server_config_->service_control_config().report_flush_thread_enabled()) {
+    report_flush_thread_.reset(new ReportFlushThread(env_));
+    if (compress_reports_) {
+      ApiManagerEnvInterface* env = env_;
+      report_flush_thread_->set_request_transform(
+          [env](HTTPRequest* request) { CompressReportBody(request, env); });
+    }
+    report_flush_thread_->Init();
+  }
+
+  if (!quota_prefetch_ && server_config_ != nullptr &&
+      server_config_->service_control_config().quota_prefetch_enabled()) {
+    quota_prefetch_.reset(new QuotaPrefetch(
+        [this](const QuotaRequestInfo& info, int tokens,
+               std::function<void(Status)> on_done) {
+          PrefetchQuota(info, tokens, on_done);
+        }));
+  }
+
+  if (!check_negative_cache_ && server_config_ != nullptr &&
+      server_config_->service_control_config().has_negative_check_cache_config()) {
+    const auto& cache_config =
+        server_config_->service_control_config().negative_check_cache_config();
+    if (cache_config.cache_entries() > 0) {
+      int expiration_ms = cache_config.expiration_ms() > 0
+                              ? cache_config.expiration_ms()
+                              : kNegativeCheckCacheExpirationMs;
+      check_negative_cache_.reset(
+          new CheckVerdictCache(cache_config.cache_entries(), expiration_ms));
+    }
+  }
+
+  if (!check_verdict_cache_) {
+    const CheckAggregationOptions check_options =
+        GetCheckAggregationOptions(server_config_);
+    if (check_options.num_entries > 0 &&
+        check_options.flush_interval_ms > 0) {
+      check_verdict_cache_.reset(new CheckVerdictCache(
+          check_options.num_entries, check_options.flush_interval_ms));
+    }
+  }
+
+  if (!shared_check_cache_ && server_config_ != nullptr &&
+      server_config_->service_control_config().has_shared_check_cache_config()) {
+    shared_check_cache_ = env_->shared_check_cache();
+    if (shared_check_cache_) {
+      const auto& cache_config =
+          server_config_->service_control_config().shared_check_cache_config();
+      shared_check_cache_expiration_ms_ = cache_config.expiration_ms() > 0
+                                              ? cache_config.expiration_ms()
+                                              : kCheckAggregationExpirationMs;
+    } else {
+      env_->LogWarning(
+          "The shared check cache is enabled in the server config, but the "
+          "environment does not provide one; check results will not be "
+          "shared across workers.");
+    }
+  }
+
+  if (!report_accumulator_ && server_config_ != nullptr &&
+      server_config_->service_control_config()
+          .columnar_report_aggregation_enabled()) {
+    report_accumulator_.reset(new ReportAccumulator);
+  }
+
+  if (!flush_scheduler_ && server_config_ != nullptr &&
+      server_config_->service_control_config().adaptive_flush_enabled()) {
+    flush_scheduler_.reset(new AdaptiveFlushScheduler);
+  }
+
   // It is too early to create client_ at constructor.
   // Client creation is calling env->StartPeriodicTimer.
   // env->StartPeriodicTimer doens't work at constructor.
@@ -298,21 +444,131 @@ Status Aggregated::Init() {
   options.periodic_timer = [this](int interval_ms,
                                   std::function<void()> callback)
       -> std::unique_ptr<::google::service_control_client::PeriodicTimer> {
+    if (flush_scheduler_ && !client_flush_callback_) {
+      // The client's flush timer. Instead of running the callback at the
+      // fixed interval the client asked for, drive it from a short tick
+      // and let the scheduler decide when the flush actually runs.
+      client_flush_callback_ = callback;
+      flush_scheduler_->set_base_interval_ms(interval_ms);
+      return std::unique_ptr<::google::service_control_client::PeriodicTimer>(
+          new ApiManagerPeriodicTimer(env_->StartPeriodicTimer(
+              std::chrono::milliseconds(
+                  AdaptiveFlushScheduler::kTickIntervalMs),
+              [this]() {
+                if (flush_scheduler_->OnTick(
+                        std::chrono::steady_clock::now())) {
+                  RunClientFlush();
+                }
+              })));
+    }
+    if (report_flush_budget_ && !client_flush_callback_) {
+      // The client's flush timer without adaptive flushing. Gate each
+      // tick on the outbound flush budget; a skipped flush leaves the
+      // reports aggregated for the next tick.
+      client_flush_callback_ = callback;
+      callback = [this]() {
+        if (report_flush_budget_ &&
+            !report_flush_budget_->Acquire(std::chrono::system_clock::now())) {
+          return;
+        }
+        if (client_flush_callback_) {
+          client_flush_callback_();
+        }
+      };
+    }
     return std::unique_ptr<::google::service_control_client::PeriodicTimer>(
         new ApiManagerPeriodicTimer(env_->StartPeriodicTimer(
             std::chrono::milliseconds(interval_ms), callback)));
   };
   client_ = ::google::service_control_client::CreateServiceControlClient(
       service_->name(), service_->id(), options);
+
+  if (report_accumulator_ && !accumulator_flush_timer_) {
+    // Materialized operations join the client's aggregation cache here
+    // and leave with its next flush, so the worst case adds one report
+    // flush interval of delay.
+    accumulator_flush_timer_ = env_->StartPeriodicTimer(
+        std::chrono::milliseconds(options.report_options.flush_interval_ms),
+        [this]() { DrainReportAccumulator(); });
+  }
   return Status::OK;
 }
 
 Status Aggregated::Close() {
+  if (accumulator_flush_timer_) {
+    accumulator_flush_timer_->Stop();
+    accumulator_flush_timer_.reset();
+  }
+  // Materialize what the accumulator still holds while the client can
+  // take it; the client flushes its cache on destruction below.
+  DrainReportAccumulator();
   // Just destroy the client to flush all its cache.
   client_.reset();
+  // The callback captured client internals; it must not run anymore.
+  client_flush_callback_ = nullptr;
   return Status::OK;
 }
 
+void Aggregated::StartDraining(Interface* successor) {
+  if (drain_successor_ || successor == this) {
+    return;
+  }
+  drain_successor_ = successor;
+  // Flush everything this epoch still aggregates and stop its flush
+  // schedule; from here on the draining streams report through the
+  // successor (see Report below).
+  Close();
+}
+
+void Aggregated::StopDraining() {
+  if (!drain_successor_) {
+    return;
+  }
+  drain_successor_ = nullptr;
+  // Close() destroyed the client; rebuild it so this config can serve
+  // traffic again.
+  Init();
+}
+
+void Aggregated::RunClientFlush() {
+  if (!client_ || !client_flush_callback_) {
+    return;
+  }
+  // When the outbound flush budget is empty the flush waits for a later
+  // tick; the reports stay aggregated and go out in a larger batch.
+  if (report_flush_budget_ &&
+      !report_flush_budget_->Acquire(std::chrono::system_clock::now())) {
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  client_flush_callback_();
+  auto now = std::chrono::steady_clock::now();
+  flush_scheduler_->OnFlushDone(
+      now, std::chrono::duration_cast<std::chrono::milliseconds>(now - start));
+}
+
+void Aggregated::DrainReportAccumulator() {
+  if (!report_accumulator_ || report_accumulator_->empty() || !client_) {
+    return;
+  }
+  ReportRequest request;
+  request.set_service_name(service_control_proto_.service_name());
+  request.set_service_config_id(service_control_proto_.service_config_id());
+  if (!report_accumulator_->Drain(&request)) {
+    return;
+  }
+  ReportResponse* response = new ReportResponse;
+  client_->Report(
+      request, response,
+      [this, response](const ::google::protobuf::util::Status& status) {
+        if (!status.ok() && env_) {
+          env_->LogError(std::string("Service control report failed. " +
+                                     status.ToString()));
+        }
+        delete response;
+      });
+}
+
 void Aggregated::SendEmptyReport() {
   ReportRequest request;
   ReportResponse* response = new ReportResponse;
@@ -324,29 +580,57 @@ void Aggregated::SendEmptyReport() {
 }
 
 Status Aggregated::Report(const ReportRequestInfo& info) {
+  if (drain_successor_) {
+    // This epoch drained on rollout; streams that still hold it report
+    // through the live deployment's aggregator.
+    return drain_successor_->Report(info);
+  }
   if (!client_) {
     return Status(Code::INTERNAL, "Missing service control client");
   }
-  auto request = report_pool_.Alloc();
-  Status status = service_control_proto_.FillReportRequest(info, request.get());
-  if (!status.ok()) {
-    report_pool_.Free(std::move(request));
-    return status;
+  ESP_TRACE_PROBE(report_enqueue, info.canonical_operation_name().c_str());
+  std::lock_guard<std::mutex> lock(report_arena_mutex_);
+  ReportRequest* request =
+      ::google::protobuf::Arena::CreateMessage<ReportRequest>(&report_arena_);
+  report_distribution_samples_.clear();
+  Status status = service_control_proto_.FillReportRequest(
+      info, request, &report_distribution_samples_);
+  if (status.ok() && report_accumulator_ && request->operations_size() == 1 &&
+      report_accumulator_->Add(request->operations(0),
+                               report_distribution_samples_)) {
+    // Merged into the columnar accumulator as array adds; the operation
+    // reaches the client as a materialized proto on the next drain.
+  } else if (status.ok()) {
+    // The proto path still needs the distribution metrics the fill
+    // recorded as raw samples.
+    status = Proto::AppendDistributionSamples(report_distribution_samples_,
+                                              request->mutable_operations(0));
+    if (!status.ok()) {
+      return status;
+    }
+    ReportResponse* response = new ReportResponse;
+    client_->Report(
+        *request, response,
+        [this, response](const ::google::protobuf::util::Status& status) {
+          if (!status.ok() && env_) {
+            env_->LogError(std::string("Service control report failed. " +
+                                       status.ToString()));
+          }
+          delete response;
+        });
+    if (flush_scheduler_ &&
+        flush_scheduler_->OnReport(request->operations_size(),
+                                   request->ByteSize())) {
+      RunClientFlush();
+    }
   }
-  ReportResponse* response = new ReportResponse;
-  client_->Report(
-      *request, response,
-      [this, response](const ::google::protobuf::util::Status& status) {
-        if (!status.ok() && env_) {
-          env_->LogError(std::string("Service control report failed. " +
-                                     status.ToString()));
-        }
-        delete response;
-      });
-  // There is no reference to request anymore at this point and it is safe to
-  // free request now.
-  report_pool_.Free(std::move(request));
-  return Status::OK;
+  // The client has merged the request into its aggregation cache and keeps
+  // no reference to it. Reclaim the arena once enough garbage accumulated;
+  // resetting on every report would throw away the blocks being reused.
+  if (report_arena_.SpaceUsed() >= kReportArenaResetSizeInBytes) {
+    report_arena_.Reset();
+  }
+  return status;
 }
 
 void Aggregated::Check(
@@ -360,6 +644,73 @@ void Aggregated::Check(
             dummy_response_info);
     return;
   }
+
+  if (check_verdict_cache_) {
+    Status cached_status = Status::OK;
+    CheckResponseInfo cached_response_info;
+    if (check_verdict_cache_->Lookup(info, &cached_status,
+                                     &cached_response_info)) {
+      TRACE(trace_span) << "Check served from the local verdict cache";
+      on_done(cached_status, cached_response_info);
+      return;
+    }
+  }
+
+  if (check_negative_cache_) {
+    Status cached_status = Status::OK;
+    CheckResponseInfo cached_response_info;
+    if (check_negative_cache_->Lookup(info, &cached_status,
+                                      &cached_response_info)) {
+      TRACE(trace_span) << "Check denial served from the negative cache";
+      on_done(cached_status, cached_response_info);
+      return;
+    }
+  }
+
+  std::string shared_cache_key;
+  if (shared_check_cache_) {
+    shared_cache_key = CheckVerdictCache::ComposeCacheKey(info);
+    std::string cached_response;
+    CheckResponse parsed_response;
+    if (shared_check_cache_->Lookup(shared_cache_key, &cached_response) &&
+        parsed_response.ParseFromString(cached_response)) {
+      shared_check_cache_hits_.fetch_add(1, std::memory_order_relaxed);
+      TRACE(trace_span) << "Check served from the shared check cache";
+      CheckResponseInfo response_info;
+      Status status = Proto::ConvertCheckResponse(
+          parsed_response, service_control_proto_.service_name(),
+          &response_info);
+      // Later identical checks copy the flat verdict without the parse
+      // and conversion above.
+      if (status.ok() && check_verdict_cache_) {
+        check_verdict_cache_->Insert(info, status, response_info);
+      }
+      on_done(status, response_info);
+      return;
+    }
+    shared_check_cache_misses_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Concurrent requests with the same check signature share one upstream
+  // round trip: the first becomes the leader and later arrivals wait for
+  // its verdict. Distinct signatures beyond the dispatch cap wait in
+  // arrival order and re-run the cache and in-flight lookups when a slot
+  // frees, since the leader's verdict usually lands in a cache first.
+  const std::string dedup_key =
+      shared_check_cache_ ? shared_cache_key
+                          : CheckVerdictCache::ComposeCacheKey(info);
+  auto inflight = inflight_checks_.find(dedup_key);
+  if (inflight != inflight_checks_.end()) {
+    TRACE(trace_span) << "Check joined an identical in-flight check";
+    deduped_in_flight_checks_.fetch_add(1, std::memory_order_relaxed);
+    inflight->second.push_back(on_done);
+    return;
+  }
+  if (inflight_checks_.size() >= kMaxConcurrentCheckCalls) {
+    pending_checks_.push_back(PendingCheck{info, on_done});
+    return;
+  }
+
   auto request = check_pool_.Alloc();
   Status status = service_control_proto_.FillCheckRequest(info, request.get());
   if (!status.ok()) {
@@ -367,17 +718,51 @@ void Aggregated::Check(
     check_pool_.Free(std::move(request));
     return;
   }
+  inflight_checks_[dedup_key];
 
   CheckResponse* response = new CheckResponse;
 
-  auto check_on_done = [this, response, on_done, trace_span](
+  // Delivers the verdict to the leader and every waiter that joined this
+  // in-flight check, then hands the freed dispatch slot to queued checks.
+  auto deliver = [this, on_done, dedup_key](
+                     Status status, const CheckResponseInfo& response_info) {
+    auto it = inflight_checks_.find(dedup_key);
+    if (it == inflight_checks_.end()) {
+      on_done(status, response_info);
+      return;
+    }
+    std::vector<CheckDoneFunc> waiters = std::move(it->second);
+    inflight_checks_.erase(it);
+    on_done(status, response_info);
+    for (const auto& waiter : waiters) {
+      waiter(status, response_info);
+    }
+    DrainPendingChecks();
+  };
+
+  auto check_on_done = [this, info, response, deliver, trace_span,
+                        shared_cache_key](
                            const ::google::protobuf::util::Status& status) {
     TRACE(trace_span) << "Check returned with status: " << status.ToString();
     CheckResponseInfo response_info;
     if (status.ok()) {
       Status status = Proto::ConvertCheckResponse(
           *response, service_control_proto_.service_name(), &response_info);
-      on_done(status, response_info);
+      // Only server verdicts are cached; transport failures below are not.
+      if (!status.ok() && check_negative_cache_) {
+        check_negative_cache_->Insert(info, status, response_info);
+      }
+      if (status.ok() && check_verdict_cache_) {
+        check_verdict_cache_->Insert(info, status, response_info);
+      }
+      if (shared_check_cache_) {
+        std::string serialized;
+        if (response->SerializeToString(&serialized)) {
+          shared_check_cache_->Insert(shared_cache_key, serialized,
+                                      shared_check_cache_expiration_ms_);
+        }
+      }
+      deliver(status, response_info);
     } else {
       // All 5xx Http status codes are treated as network failure.
       // If network_fail_open is true, it is OK to proceed with these errors.
@@ -386,7 +771,7 @@ void Aggregated::Check(
             std::string("With network fail open policy, the request is allowed "
                         "even the service control check failed with: " +
                         status.ToString()));
-        on_done(Status::OK, response_info);
+        deliver(Status::OK, response_info);
       } else {
         // Preserve ServiceControl 5xx Http response code, especially 500 and
         // 503. Convert non-5xx Http resonse code to 500 since they are most
@@ -399,7 +784,7 @@ void Aggregated::Check(
           error_code = Code::INTERNAL;
         }
 
-        on_done(
+        deliver(
             Status(error_code, status.error_message(), Status::SERVICE_CONTROL),
             response_info);
       }
@@ -418,6 +803,25 @@ void Aggregated::Check(
   check_pool_.Free(std::move(request));
 }
 
+void Aggregated::DrainPendingChecks() {
+  // Completions delivered from inside the re-entered Check run this again;
+  // the flag leaves the dispatching to the outermost loop.
+  if (draining_checks_) {
+    return;
+  }
+  draining_checks_ = true;
+  while (!pending_checks_.empty() &&
+         inflight_checks_.size() < kMaxConcurrentCheckCalls) {
+    PendingCheck pending = std::move(pending_checks_.front());
+    pending_checks_.pop_front();
+    // Re-enters Check: the leader's verdict may have landed in a cache
+    // while this one waited, and an identical check may still be in
+    // flight to join.
+    Check(pending.info, nullptr, pending.on_done);
+  }
+  draining_checks_ = false;
+}
+
 void Aggregated::Quota(const QuotaRequestInfo& info,
                        cloud_trace::CloudTraceSpan* parent_span,
                        std::function<void(utils::Status)> on_done) {
@@ -429,6 +833,11 @@ void Aggregated::Quota(const QuotaRequestInfo& info,
     return;
   }
 
+  if (quota_prefetch_ && quota_prefetch_->Check(info, on_done)) {
+    TRACE(trace_span) << "Quota charged against the local prefetch bucket";
+    return;
+  }
+
   auto request = quota_pool_.Alloc();
 
   Status status =
@@ -469,6 +878,51 @@ void Aggregated::Quota(const QuotaRequestInfo& info,
   quota_pool_.Free(std::move(request));
 }
 
+void Aggregated::PrefetchQuota(const QuotaRequestInfo& info, int tokens,
+                               std::function<void(utils::Status)> on_done) {
+  // Charge the whole token batch in one AllocateQuota by scaling every
+  // metric cost.
+  std::vector<std::pair<std::string, int>> scaled_costs;
+  if (info.metric_cost_vector != nullptr) {
+    scaled_costs.reserve(info.metric_cost_vector->size());
+    for (const auto& cost : *info.metric_cost_vector) {
+      scaled_costs.emplace_back(cost.first, cost.second * tokens);
+    }
+  }
+  QuotaRequestInfo batch_info = info;
+  batch_info.metric_cost_vector = &scaled_costs;
+
+  auto request = quota_pool_.Alloc();
+
+  Status status =
+      service_control_proto_.FillAllocateQuotaRequest(batch_info, request.get());
+  if (!status.ok()) {
+    on_done(status);
+    quota_pool_.Free(std::move(request));
+    return;
+  }
+
+  AllocateQuotaResponse* response = new AllocateQuotaResponse();
+
+  Call(*request, response,
+       [this, response, on_done](
+           const ::google::protobuf::util::Status& status) {
+         if (status.ok()) {
+           on_done(Proto::ConvertAllocateQuotaResponse(
+               *response, service_control_proto_.service_name()));
+         } else {
+           on_done(Status(status.error_code(), status.error_message(),
+                          Status::SERVICE_CONTROL));
+         }
+         delete response;
+       },
+       nullptr);
+
+  // Call() serializes the request synchronously, so it is safe to free it
+  // now.
+  quota_pool_.Free(std::move(request));
+}
+
 Status Aggregated::GetStatistics(Statistics* esp_stat) const {
   if (!client_) {
     return Status(Code::INTERNAL, "Missing service control client");
@@ -489,6 +943,17 @@ Status Aggregated::GetStatistics(Statistics* esp_stat) const {
   esp_stat->send_reports_in_flight = client_stat.send_reports_in_flight;
   esp_stat->send_report_operations = client_stat.send_report_operations;
   esp_stat->max_report_size = max_report_size_;
+  esp_stat->negative_check_cache_hits =
+      check_negative_cache_ ? check_negative_cache_->hits() : 0;
+  esp_stat->negative_check_cache_misses =
+      check_negative_cache_ ? check_negative_cache_->misses() : 0;
+  esp_stat->check_verdict_cache_hits =
+      check_verdict_cache_ ? check_verdict_cache_->hits() : 0;
+  esp_stat->check_verdict_cache_misses =
+      check_verdict_cache_ ? check_verdict_cache_->misses() : 0;
+  esp_stat->shared_check_cache_hits = shared_check_cache_hits_;
+  esp_stat->shared_check_cache_misses = shared_check_cache_misses_;
+  esp_stat->deduped_in_flight_checks = deduped_in_flight_checks_;
 
   return Status::OK;
 }
@@ -560,6 +1025,60 @@ const std::string& Aggregated::GetAuthToken<AllocateQuotaRequest>() {
   }
 }
 
+template <>
+const std::string& Aggregated::GetAuthHeader<CheckRequest>() {
+  if (sa_token_) {
+    return sa_token_->GetAuthHeader(
+        auth::ServiceAccountToken::JWT_TOKEN_FOR_SERVICE_CONTROL);
+  } else {
+    return GetEmptyString();
+  }
+}
+template <>
+const std::string& Aggregated::GetAuthHeader<ReportRequest>() {
+  if (sa_token_) {
+    return sa_token_->GetAuthHeader(
+        auth::ServiceAccountToken::JWT_TOKEN_FOR_SERVICE_CONTROL);
+  } else {
+    return GetEmptyString();
+  }
+}
+template <>
+const std::string& Aggregated::GetAuthHeader<AllocateQuotaRequest>() {
+  if (sa_token_) {
+    return sa_token_->GetAuthHeader(
+        auth::ServiceAccountToken::JWT_TOKEN_FOR_QUOTA_CONTROL);
+  } else {
+    return GetEmptyString();
+  }
+}
+
+template <>
+const char* Aggregated::GetGrpcService<CheckRequest>() {
+  return "google.api.servicecontrol.v1.ServiceController";
+}
+template <>
+const char* Aggregated::GetGrpcService<ReportRequest>() {
+  return "google.api.servicecontrol.v1.ServiceController";
+}
+template <>
+const char* Aggregated::GetGrpcService<AllocateQuotaRequest>() {
+  return "google.api.servicecontrol.v1.QuotaController";
+}
+
+template <>
+const char* Aggregated::GetGrpcMethod<CheckRequest>() {
+  return "Check";
+}
+template <>
+const char* Aggregated::GetGrpcMethod<ReportRequest>() {
+  return "Report";
+}
+template <>
+const char* Aggregated::GetGrpcMethod<AllocateQuotaRequest>() {
+  return "AllocateQuota";
+}
+
 template <>
 void Aggregated::HandleResponse(const CheckResponse& response) {
   if (set_rollout_id_func_ && !response.service_rollout_id().empty()) {
@@ -601,6 +1120,29 @@ void Aggregated::HandleResponse(const ReportResponse& response) {
 template <>
 void Aggregated::HandleResponse(const AllocateQuotaResponse& response) {}
 
+int Aggregated::HedgeDelayMs() const {
+  if (hedge_delay_ms_ > 0) {
+    return hedge_delay_ms_;
+  }
+  const LatencyHistogram& histogram = hedge_latency_histogram_;
+  if (histogram.count < kHedgeDelayMinSamples) {
+    return kDefaultHedgeDelayMs;
+  }
+  // The derived delay is the upper edge of the histogram bucket holding
+  // the 99th percentile sample.
+  uint64_t rank = histogram.count - histogram.count / 100;
+  uint64_t seen = 0;
+  for (int bucket = 0; bucket < LatencyHistogram::kNumBuckets; ++bucket) {
+    seen += histogram.buckets[bucket];
+    if (seen >= rank) {
+      uint64_t upper_micros = static_cast<uint64_t>(2) << bucket;
+      int delay_ms = static_cast<int>(upper_micros / 1000);
+      return delay_ms > 0 ? delay_ms : 1;
+    }
+  }
+  return kDefaultHedgeDelayMs;
+}
+
 template <class RequestType, class ResponseType>
 void Aggregated::Call(const RequestType& request, ResponseType* response,
                       TransportDoneFunc on_done,
@@ -608,22 +1150,141 @@ void Aggregated::Call(const RequestType& request, ResponseType* response,
   std::shared_ptr<cloud_trace::CloudTraceSpan> trace_span(
       CreateChildSpan(parent_span, "Call ServiceControl server"));
 
+  // Only cache misses reach the transport, so when the outbound check
+  // budget is empty the call fails here without a round trip and the
+  // caller falls back on the network fail policy. Reports are paced at
+  // the flush instead: dropping them here would lose their data.
+  if (check_call_budget_ && typeid(RequestType) != typeid(ReportRequest) &&
+      !check_call_budget_->Acquire(std::chrono::system_clock::now())) {
+    TRACE(trace_span) << "Call is over the outbound check call budget";
+    on_done(Status(Code::UNAVAILABLE, "Over the outbound check call budget")
+                .ToProto());
+    return;
+  }
+
+  std::string request_body;
+  request.SerializeToString(&request_body);
+
+  // Collect statistics on the maximum report body size.
+  if ((typeid(RequestType) == typeid(ReportRequest)) &&
+      (request_body.size() > max_report_size_)) {
+    max_report_size_ = request_body.size();
+  }
+
+  // Parses the winning response and completes the call.
+  auto handle_result = [response, on_done, this](Status status,
+                                                 std::string&& body) {
+    if (status.ok()) {
+      // Handle 200 response
+      if (!response->ParseFromString(body)) {
+        status =
+            Status(Code::INVALID_ARGUMENT, std::string("Invalid response"));
+      }
+      HandleResponse(*response);
+    }
+    on_done(status.ToProto());
+  };
+
+  // Check and AllocateQuota calls are idempotent; when hedging is
+  // enabled, a second copy goes out if the first has not answered within
+  // the hedge delay, and the first response wins. Reports are dispatched
+  // once: they are not idempotent, and their latency is off the request
+  // path anyway.
+  if (hedged_calls_enabled_ && typeid(RequestType) != typeid(ReportRequest)) {
+    auto call = std::make_shared<HedgedCall>();
+    call->request_body = std::move(request_body);
+    call->start_time = std::chrono::steady_clock::now();
+
+    // Both copies complete here; only the first to arrive touches the
+    // response and on_done. The timer must not be destroyed from its own
+    // callback, so it is released here, on a transport callback.
+    auto deliver = [call, handle_result, this](Status status,
+                                               std::string&& body) {
+      if (call->responded) {
+        return;
+      }
+      call->responded = true;
+      hedge_latency_histogram_.Record(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - call->start_time)
+              .count());
+      if (call->hedge_timer) {
+        call->hedge_timer->Stop();
+        call->hedge_timer.reset();
+      }
+      handle_result(status, std::move(body));
+    };
+
+    DispatchTransport<RequestType>(call->request_body, deliver, trace_span);
+
+    // The transport can fail a call synchronously; only arm the hedge
+    // timer for calls still in flight.
+    if (!call->responded) {
+      call->hedge_timer = env_->StartPeriodicTimer(
+          std::chrono::milliseconds(HedgeDelayMs()),
+          [call, deliver, trace_span, this]() {
+            if (call->responded || call->hedged) {
+              return;
+            }
+            call->hedged = true;
+            if (call->hedge_timer) {
+              call->hedge_timer->Stop();
+            }
+            DispatchTransport<RequestType>(call->request_body, deliver,
+                                           trace_span);
+          });
+    }
+    return;
+  }
+
+  DispatchTransport<RequestType>(request_body, handle_result, trace_span);
+}
+
+template <class RequestType>
+void Aggregated::DispatchTransport(
+    const std::string& request_body,
+    std::function<void(Status, std::string&&)> on_result,
+    std::shared_ptr<cloud_trace::CloudTraceSpan> trace_span) {
+  if (grpc_transport_enabled_) {
+    std::string method_path = std::string("/") + GetGrpcService<RequestType>() +
+                              "/" + GetGrpcMethod<RequestType>();
+    TRACE(trace_span) << "GRPC request method: " << method_path;
+
+    std::unique_ptr<GRPCRequest> grpc_request(new GRPCRequest(
+        [method_path, on_result, trace_span, this](Status status,
+                                                   std::string&& body) {
+          TRACE(trace_span) << "GRPC response status: " << status.ToString();
+          if (!status.ok()) {
+            env_->LogError(std::string("Failed to call ") + method_path +
+                           ", Error: " + status.ToString());
+            // Handle transport error as opposed to pass-through error code
+            if (status.code() < 0) {
+              status = Status(Code::UNAVAILABLE,
+                              "Failed to connect to service control");
+            }
+          }
+          on_result(status, std::move(body));
+        }));
+
+    grpc_request->set_server(url_.service_control())
+        .set_service(GetGrpcService<RequestType>())
+        .set_method(GetGrpcMethod<RequestType>())
+        .set_auth_token(GetAuthToken<RequestType>())
+        .set_timeout_ms(GetHttpRequestTimeout<RequestType>())
+        .set_body(request_body);
+    env_->RunGRPCRequest(std::move(grpc_request));
+    return;
+  }
+
   const std::string& url = GetApiRequestUrl<RequestType>();
   TRACE(trace_span) << "Http request URL: " << url;
 
   std::unique_ptr<HTTPRequest> http_request(
-      new HTTPRequest([url, response, on_done, trace_span, this](
+      new HTTPRequest([url, on_result, trace_span, this](
                           Status status, std::map<std::string, std::string>&&,
                           std::string&& body) {
         TRACE(trace_span) << "HTTP response status: " << status.ToString();
-        if (status.ok()) {
-          // Handle 200 response
-          if (!response->ParseFromString(body)) {
-            status =
-                Status(Code::INVALID_ARGUMENT, std::string("Invalid response"));
-          }
-          HandleResponse(*response);
-        } else {
+        if (!status.ok()) {
           env_->LogError(std::string("Failed to call ") + url + ", Error: " +
                          status.ToString() + ", Response body: " + body);
 
@@ -644,27 +1305,30 @@ void Aggregated::Call(const RequestType& request, ResponseType* response,
             status = Status(status.code(), error_msg);
           }
         }
-        on_done(status.ToProto());
+        on_result(status, std::move(body));
       }));
 
-  std::string request_body;
-  request.SerializeToString(&request_body);
-
-  // Collect statistics on the maximum report body size.
-  if ((typeid(RequestType) == typeid(ReportRequest)) &&
-      (request_body.size() > max_report_size_)) {
-    max_report_size_ = request_body.size();
-  }
-
   http_request->set_url(url)
       .set_method("POST")
-      .set_auth_token(GetAuthToken<RequestType>())
+      .set_auth_header(GetAuthHeader<RequestType>())
       .set_header("Content-Type", application_proto)
       .set_body(request_body);
 
   http_request->set_timeout_ms(GetHttpRequestTimeout<RequestType>());
   http_request->set_max_retries(GetHttpRequestRetries<RequestType>());
 
+  // Hand flushed reports to the background thread when one is configured;
+  // checks and quota calls stay on the event loop where latency matters.
+  if (typeid(RequestType) == typeid(ReportRequest)) {
+    if (report_flush_thread_) {
+      // The thread applies the compression transform before dispatch.
+      report_flush_thread_->Dispatch(std::move(http_request));
+      return;
+    }
+    if (compress_reports_) {
+      CompressReportBody(http_request.get(), env_);
+    }
+  }
   env_->RunHTTPRequest(std::move(http_request));
 }
 
@@ -672,7 +1336,9 @@ Interface* Aggregated::Create(const ::google::api::Service& service,
                               const ServerConfig* server_config,
                               ApiManagerEnvInterface* env,
                               auth::ServiceAccountToken* sa_token,
-                              SetRolloutIdFunc set_rollout_id_func) {
+                              SetRolloutIdFunc set_rollout_id_func,
+                              utils::TokenBucket* check_call_budget,
+                              utils::TokenBucket* report_flush_budget) {
   if (server_config &&
       server_config->service_control_config().force_disable()) {
     env->LogError("Service control is disabled.");
@@ -686,8 +1352,12 @@ Interface* Aggregated::Create(const ::google::api::Service& service,
   }
   std::set<std::string> logs, metrics, labels;
   Status s = LogsMetricsLoader::Load(service, &logs, &metrics, &labels);
-  return new Aggregated(service, server_config, env, sa_token, logs, metrics,
-                        labels, set_rollout_id_func);
+  Aggregated* aggregated =
+      new Aggregated(service, server_config, env, sa_token, logs, metrics,
+                     labels, set_rollout_id_func);
+  aggregated->check_call_budget_ = check_call_budget;
+  aggregated->report_flush_budget_ = report_flush_budget;
+  return aggregated;
 }
 
 }  // namespace service_control
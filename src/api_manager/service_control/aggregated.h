@@ -17,17 +17,29 @@
 
 #include "google/api/service.pb.h"
 #include "google/api/servicecontrol/v1/quota_controller.pb.h"
+#include "google/protobuf/arena.h"
 #include "google/api/servicecontrol/v1/service_controller.pb.h"
+#include "include/api_manager/api_manager.h"
 #include "include/api_manager/env_interface.h"
 #include "include/service_control_client.h"
 #include "src/api_manager/auth/service_account_token.h"
 #include "src/api_manager/cloud_trace/cloud_trace.h"
 #include "src/api_manager/proto/server_config.pb.h"
+#include "src/api_manager/service_control/adaptive_flush_scheduler.h"
+#include "src/api_manager/service_control/check_negative_cache.h"
 #include "src/api_manager/service_control/interface.h"
 #include "src/api_manager/service_control/proto.h"
+#include "src/api_manager/service_control/quota_prefetch.h"
+#include "src/api_manager/service_control/report_accumulator.h"
+#include "src/api_manager/service_control/report_flush_thread.h"
 #include "src/api_manager/service_control/url.h"
+#include "src/api_manager/utils/token_bucket.h"
 
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <list>
+#include <map>
 #include <mutex>
 
 namespace google {
@@ -41,11 +53,15 @@ typedef std::function<void(const std::string& rollout_id)> SetRolloutIdFunc;
 // This implementation uses service-control-client-cxx module.
 class Aggregated : public Interface {
  public:
+  // The budgets bound ESP's own outbound call rate and are not owned;
+  // nullptr (the default) means the destination is not budgeted.
   static Interface* Create(const ::google::api::Service& service,
                            const proto::ServerConfig* server_config,
                            ApiManagerEnvInterface* env,
                            auth::ServiceAccountToken* sa_token,
-                           SetRolloutIdFunc set_rollout_id_func);
+                           SetRolloutIdFunc set_rollout_id_func,
+                           utils::TokenBucket* check_call_budget = nullptr,
+                           utils::TokenBucket* report_flush_budget = nullptr);
 
   virtual ~Aggregated();
 
@@ -64,6 +80,13 @@ class Aggregated : public Interface {
   virtual utils::Status Init();
   virtual utils::Status Close();
 
+  // Epoch drain on rollout: Close() flushes the residual aggregation and
+  // stops the flush timers, and later reports from draining streams are
+  // forwarded to the successor. StopDraining re-runs Init() when this
+  // config re-enters traffic.
+  void StartDraining(Interface* successor) override;
+  void StopDraining() override;
+
   virtual utils::Status GetStatistics(Statistics* stat) const;
 
  private:
@@ -89,6 +112,13 @@ class Aggregated : public Interface {
   template <class Type>
   class ProtoPool {
    public:
+    // When clear_on_alloc is false, a recycled protobuf keeps its previous
+    // contents so its map nodes, submessages and string storage stay
+    // allocated across reuses. Only safe when the fill function overwrites
+    // or erases every field it owns (see Proto::FillCheckRequest).
+    explicit ProtoPool(bool clear_on_alloc = true)
+        : clear_on_alloc_(clear_on_alloc) {}
+
     // Allocates a protobuf. If there is one in the pool, uses it, otherwise
     // creates a new one.
     std::unique_ptr<Type> Alloc();
@@ -97,12 +127,30 @@ class Aggregated : public Interface {
     void Free(std::unique_ptr<Type> item);
 
    private:
+    // Whether Alloc clears a recycled protobuf before handing it out.
+    const bool clear_on_alloc_;
     // Protobuf pool to store used protobufs.
     std::list<std::unique_ptr<Type>> pool_;
     // Mutex to protect the protobuf pool.
     std::mutex mutex_;
   };
 
+  // The in-flight state of one hedged Check or AllocateQuota call.
+  struct HedgedCall {
+    // The serialized request, kept alive so the hedge can resend it.
+    std::string request_body;
+    // Set when the first response has been delivered; later responses
+    // and timer ticks are dropped.
+    bool responded = false;
+    // Set when the second copy has been sent.
+    bool hedged = false;
+    // Fires once to send the second copy. Reset from a transport
+    // callback, never from its own callback.
+    std::unique_ptr<PeriodicTimer> hedge_timer;
+    // When the call started, for the latency histogram.
+    std::chrono::steady_clock::time_point start_time;
+  };
+
   friend class AggregatedTestWithMockedClient;
   // Constructor for unit-test only.
   Aggregated(
@@ -121,12 +169,43 @@ class Aggregated : public Interface {
   // Initialize HttpRequest used timeout and retry values.
   void InitHttpRequestTimeoutRetries();
 
+  // Issues a background AllocateQuota charging tokens times every metric
+  // cost, to refill a local prefetch bucket.
+  void PrefetchQuota(const QuotaRequestInfo& info, int tokens,
+                     std::function<void(utils::Status)> on_done);
+
+  // Runs the flush callback the service control client registered and
+  // feeds the measured flush duration back to the scheduler.
+  void RunClientFlush();
+
+  // Re-enters Check() for queued checks while dispatch slots are free.
+  void DrainPendingChecks();
+
+  // Materializes the columnar report accumulator and hands the result to
+  // the service control client.
+  void DrainReportAccumulator();
+
   // Calls to service control server.
   template <class RequestType, class ResponseType>
   void Call(const RequestType& request, ResponseType* response,
             ::google::service_control_client::TransportDoneFunc on_done,
             cloud_trace::CloudTraceSpan* parent_span);
 
+  // Sends one copy of a serialized request over the configured transport.
+  // on_result receives the transport-mapped status and the raw response
+  // body; it may be called more than once per logical call when the call
+  // is hedged, so it must guard against late duplicates itself.
+  template <class RequestType>
+  void DispatchTransport(
+      const std::string& request_body,
+      std::function<void(utils::Status, std::string&&)> on_result,
+      std::shared_ptr<cloud_trace::CloudTraceSpan> trace_span);
+
+  // Returns the delay before a hedged call sends its second copy: the
+  // configured value, or one derived from the observed 99th percentile
+  // call latency when none is configured.
+  int HedgeDelayMs() const;
+
   // Returns API request url based on RequestType
   template <class RequestType>
   const std::string& GetApiRequestUrl();
@@ -143,6 +222,19 @@ class Aggregated : public Interface {
   template <class RequestType>
   const std::string& GetAuthToken();
 
+  // Returns the precomputed Authorization header value based on
+  // RequestType; rebuilt only when the token rotates.
+  template <class RequestType>
+  const std::string& GetAuthHeader();
+
+  // Returns the gRPC service name based on RequestType
+  template <class RequestType>
+  const char* GetGrpcService();
+
+  // Returns the gRPC method name based on RequestType
+  template <class RequestType>
+  const char* GetGrpcMethod();
+
   template <class ResponseType>
   void HandleResponse(const ResponseType& response);
 
@@ -163,6 +255,93 @@ class Aggregated : public Interface {
   // Stores service control urls.
   Url url_;
 
+  // Local token buckets replenished by batched AllocateQuota calls.
+  // nullptr unless enabled in server config.
+  std::unique_ptr<QuotaPrefetch> quota_prefetch_;
+
+  // Short-TTL cache for failed Check verdicts. nullptr unless enabled in
+  // server config.
+  std::unique_ptr<CheckVerdictCache> check_negative_cache_;
+
+  // POD cache of positive Check verdicts in front of the check
+  // aggregator: a hit copies the flat CheckResponseInfo instead of
+  // converting the aggregator's cached CheckResponse proto per call.
+  // Entries live one check flush interval, so the aggregator still sees
+  // one check per signature per interval and keeps its refresh cadence.
+  std::unique_ptr<CheckVerdictCache> check_verdict_cache_;
+
+  // Cache of serialized Check responses shared across workers, owned by
+  // the environment. nullptr unless enabled in server config and provided
+  // by the environment.
+  SharedCheckCache* shared_check_cache_{};
+
+  // How long shared check cache entries stay valid.
+  int shared_check_cache_expiration_ms_{};
+
+  // Shared check cache lookup counters, exposed via /endpoints_status.
+  std::atomic<uint64_t> shared_check_cache_hits_{};
+  std::atomic<uint64_t> shared_check_cache_misses_{};
+
+  // The result callback of one Check() call.
+  typedef std::function<void(utils::Status, const CheckResponseInfo&)>
+      CheckDoneFunc;
+
+  // A Check waiting for a dispatch slot; re-enters Check() when one frees.
+  struct PendingCheck {
+    CheckRequestInfo info;
+    CheckDoneFunc on_done;
+  };
+
+  // Checks dispatched to the client and not yet answered, keyed by their
+  // cache signature. Later arrivals with the same signature wait in the
+  // leader's list and share its verdict instead of making their own round
+  // trip. Only touched on the event loop.
+  std::map<std::string, std::vector<CheckDoneFunc>> inflight_checks_;
+
+  // Checks waiting for a dispatch slot, in arrival order.
+  std::deque<PendingCheck> pending_checks_;
+
+  // Set while DrainPendingChecks runs so completions delivered from
+  // inside it do not recurse.
+  bool draining_checks_{false};
+
+  // The interface of the deployment that replaced this config, set by
+  // StartDraining. While set, Report calls are forwarded there instead
+  // of aggregating locally. The owning ServiceContext keeps the
+  // successor alive (see ServiceContext::StartDraining).
+  Interface* drain_successor_{nullptr};
+
+  // Checks that joined an identical in-flight check, exposed via
+  // /endpoints_status.
+  std::atomic<uint64_t> deduped_in_flight_checks_{};
+
+  // Prepares and paces flushed report uploads off the event loop. Declared
+  // before client_ so it outlives the reports client_ flushes on
+  // destruction. nullptr unless enabled in server config.
+  std::unique_ptr<ReportFlushThread> report_flush_thread_;
+
+  // Columnar accumulator for report operations without log entries;
+  // merged per request as array arithmetic and materialized into protos
+  // on its flush timer. nullptr unless enabled in server config.
+  std::unique_ptr<ReportAccumulator> report_accumulator_;
+
+  // Scratch vector for the raw distribution samples of the report being
+  // filled, reused across requests; guarded by report_arena_mutex_.
+  std::vector<DistributionSample> report_distribution_samples_;
+
+  // Drains report_accumulator_ into the client at the report aggregation
+  // flush interval.
+  std::unique_ptr<PeriodicTimer> accumulator_flush_timer_;
+
+  // Decides when the client flush callback runs. nullptr unless adaptive
+  // flushing is enabled in server config.
+  std::unique_ptr<AdaptiveFlushScheduler> flush_scheduler_;
+
+  // The flush callback the service control client registered through the
+  // periodic timer hook. Only set when adaptive flushing is enabled;
+  // cleared when the client is destroyed.
+  std::function<void()> client_flush_callback_;
+
   // The service control client instance.
   std::unique_ptr<::google::service_control_client::ServiceControlClient>
       client_;
@@ -171,10 +350,20 @@ class Aggregated : public Interface {
   ProtoPool<::google::api::servicecontrol::v1::AllocateQuotaRequest>
       quota_pool_;
 
-  // The protobuf pool to reuse CheckRequest protobuf.
-  ProtoPool<::google::api::servicecontrol::v1::CheckRequest> check_pool_;
-  // The protobuf pool to reuse ReportRequest protobuf.
-  ProtoPool<::google::api::servicecontrol::v1::ReportRequest> report_pool_;
+  // The protobuf pool to reuse CheckRequest protobuf. Recycled requests
+  // are not cleared: FillCheckRequest overwrites every field it owns, so
+  // the label map nodes and operation submessages live for the lifetime
+  // of the pooled message instead of being reallocated per check.
+  ProtoPool<::google::api::servicecontrol::v1::CheckRequest> check_pool_{
+      false};
+
+  // The arena backing per-request ReportRequest trees. A report carries
+  // dozens of sub-messages; building them on the arena replaces their
+  // individual heap allocations with a few large block allocations.
+  ::google::protobuf::Arena report_arena_;
+  // Protects report_arena_. The arena must not be reset while another
+  // report is being built on it.
+  std::mutex report_arena_mutex_;
 
   // Mismatched config ID received for a check request
   std::string mismatched_check_config_id_;
@@ -185,6 +374,26 @@ class Aggregated : public Interface {
   // Maximum report size send to server.
   uint64_t max_report_size_;
 
+  // Whether report request bodies are gzip-compressed before upload.
+  bool compress_reports_;
+
+  // Whether calls go over the environment's gRPC transport (one
+  // persistent HTTP/2 connection multiplexing the concurrent calls)
+  // instead of one-shot HTTP requests.
+  bool grpc_transport_enabled_{};
+
+  // Whether Check/AllocateQuota calls send a second copy when the first
+  // has not answered within the hedge delay, first response winning.
+  bool hedged_calls_enabled_{};
+
+  // The configured hedge delay; if not positive the delay is derived
+  // from hedge_latency_histogram_.
+  int hedge_delay_ms_{};
+
+  // Latencies of Check and AllocateQuota calls, feeding the derived
+  // hedge delay.
+  LatencyHistogram hedge_latency_histogram_{};
+
   // the configurable timeouts
   int check_timeout_ms_;
   int report_timeout_ms_;
@@ -198,6 +407,16 @@ class Aggregated : public Interface {
   // network fail policy, default to false
   bool network_fail_open_{};
 
+  // Outbound budget for check and quota calls, not owned. When empty,
+  // calls that miss every cache answer UNAVAILABLE without a round trip
+  // and ride the network fail policy above. nullptr when not budgeted.
+  utils::TokenBucket* check_call_budget_{};
+
+  // Outbound budget for report flushes, not owned. When empty, a flush
+  // is skipped and the reports stay aggregated in the client for a later,
+  // larger flush. nullptr when not budgeted.
+  utils::TokenBucket* report_flush_budget_{};
+
   // The callback function to set the latest rollout id
   // from Check and Report response
   SetRolloutIdFunc set_rollout_id_func_;
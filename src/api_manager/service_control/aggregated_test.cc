@@ -203,6 +203,36 @@ TEST_F(AggregatedTestWithMockedClient, FailedCheckTest) {
                  });
 }
 
+TEST_F(AggregatedTestWithMockedClient, ConcurrentIdenticalChecksShareOneCall) {
+  ServiceControlClient::DoneCallback stored_on_done;
+  EXPECT_CALL(*mock_client_, Check(_, _, _, _))
+      .WillOnce(Invoke([&stored_on_done](
+                           const CheckRequest&, CheckResponse*,
+                           ServiceControlClient::DoneCallback on_done,
+                           TransportCheckFunc) { stored_on_done = on_done; }));
+
+  CheckRequestInfo info;
+  FillOperationInfo(&info);
+  int done_calls = 0;
+  auto on_done = [&done_calls](Status status, const CheckResponseInfo& info) {
+    ++done_calls;
+    ASSERT_TRUE(status.ok());
+  };
+  sc_lib_->Check(info, nullptr, on_done);
+  // An identical check while the first is in flight joins it instead of
+  // reaching the client a second time.
+  sc_lib_->Check(info, nullptr, on_done);
+  ASSERT_EQ(0, done_calls);
+
+  // One completion answers both.
+  stored_on_done(::google::protobuf::util::Status::OK);
+  EXPECT_EQ(2, done_calls);
+
+  Statistics stat;
+  ASSERT_TRUE(sc_lib_->GetStatistics(&stat).ok());
+  EXPECT_EQ(1, stat.deduped_in_flight_checks);
+}
+
 class AggregatedTestWithRealClient : public ::testing::Test {
  public:
   void SetUp() {
@@ -253,6 +283,176 @@ TEST_F(AggregatedTestWithRealClient, CheckOKTest) {
   EXPECT_EQ(stat.send_report_operations, 0);
 }
 
+namespace {
+
+// An in-process SharedCheckCache standing in for the shared memory zone of
+// the hosting environment.
+class FakeSharedCheckCache : public SharedCheckCache {
+ public:
+  bool Lookup(const std::string& key, std::string* response) {
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      return false;
+    }
+    *response = it->second;
+    return true;
+  }
+
+  void Insert(const std::string& key, const std::string& response,
+              int expiration_ms) {
+    entries_[key] = response;
+  }
+
+ private:
+  std::map<std::string, std::string> entries_;
+};
+
+class SharedCacheMockEnvironment : public MockApiManagerEnvironment {
+ public:
+  SharedCacheMockEnvironment(SharedCheckCache* cache) : cache_(cache) {}
+  virtual SharedCheckCache* shared_check_cache() { return cache_; }
+
+ private:
+  SharedCheckCache* cache_;
+};
+
+}  // namespace
+
+class AggregatedTestWithSharedCheckCache : public ::testing::Test {
+ public:
+  void SetUp() {
+    service_.set_name("test_service");
+    service_.mutable_control()->set_environment(
+        "servicecontrol.googleapis.com");
+    server_config_.mutable_service_control_config()
+        ->mutable_shared_check_cache_config();
+    // Two Aggregated instances sharing one cache, as two workers would.
+    sc_lib_.reset(CreateWorker(&env_));
+    other_sc_lib_.reset(CreateWorker(&other_env_));
+  }
+
+  Interface* CreateWorker(
+      std::unique_ptr<::testing::NiceMock<SharedCacheMockEnvironment>>* env) {
+    env->reset(new ::testing::NiceMock<SharedCacheMockEnvironment>(&cache_));
+    Interface* sc_lib = Aggregated::Create(service_, &server_config_,
+                                           env->get(), nullptr,
+                                           [](const std::string& id) {});
+    EXPECT_TRUE(sc_lib != nullptr);
+    sc_lib->Init();
+    return sc_lib;
+  }
+
+  void DoRunHTTPRequest(HTTPRequest* request) {
+    std::map<std::string, std::string> headers;
+    CheckResponse response;
+    response.set_operation_id("operation_id");
+    std::string body = response.SerializeAsString();
+    request->OnComplete(Status::OK, std::move(headers), std::move(body));
+  }
+
+  ::google::api::Service service_;
+  proto::ServerConfig server_config_;
+  FakeSharedCheckCache cache_;
+  std::unique_ptr<::testing::NiceMock<SharedCacheMockEnvironment>> env_;
+  std::unique_ptr<::testing::NiceMock<SharedCacheMockEnvironment>> other_env_;
+  std::unique_ptr<Interface> sc_lib_;
+  std::unique_ptr<Interface> other_sc_lib_;
+};
+
+TEST_F(AggregatedTestWithSharedCheckCache, SecondWorkerServedFromSharedCache) {
+  // The first worker's check goes to the server.
+  EXPECT_CALL(*env_, DoRunHTTPRequest(_))
+      .WillOnce(
+          Invoke(this, &AggregatedTestWithSharedCheckCache::DoRunHTTPRequest));
+  CheckRequestInfo info;
+  FillOperationInfo(&info);
+  sc_lib_->Check(info, nullptr,
+                 [](Status status, const CheckResponseInfo& info) {
+                   ASSERT_TRUE(status.ok());
+                 });
+
+  // The second worker is served the stored response without a server call.
+  EXPECT_CALL(*other_env_, DoRunHTTPRequest(_)).Times(0);
+  other_sc_lib_->Check(info, nullptr,
+                       [](Status status, const CheckResponseInfo& info) {
+                         ASSERT_TRUE(status.ok());
+                       });
+
+  Statistics stat;
+  ASSERT_TRUE(other_sc_lib_->GetStatistics(&stat).ok());
+  EXPECT_EQ(stat.shared_check_cache_hits, 1);
+  EXPECT_EQ(stat.shared_check_cache_misses, 0);
+
+  ASSERT_TRUE(sc_lib_->GetStatistics(&stat).ok());
+  EXPECT_EQ(stat.shared_check_cache_hits, 0);
+  EXPECT_EQ(stat.shared_check_cache_misses, 1);
+}
+
+class AggregatedTestWithHedging : public ::testing::Test {
+ public:
+  void SetUp() {
+    service_.set_name("test_service");
+    service_.mutable_control()->set_environment(
+        "servicecontrol.googleapis.com");
+    auto* config = server_config_.mutable_service_control_config();
+    config->set_hedged_calls_enabled(true);
+    config->set_hedge_delay_ms(1);
+    env_.reset(new ::testing::NiceMock<MockApiManagerEnvironment>);
+    sc_lib_.reset(Aggregated::Create(service_, &server_config_, env_.get(),
+                                     nullptr, [](const std::string& id) {}));
+    ASSERT_TRUE((bool)(sc_lib_));
+    sc_lib_->Init();
+  }
+
+  ::google::api::Service service_;
+  proto::ServerConfig server_config_;
+  std::unique_ptr<MockApiManagerEnvironment> env_;
+  std::unique_ptr<Interface> sc_lib_;
+};
+
+TEST_F(AggregatedTestWithHedging, SecondCheckSentAfterHedgeDelay) {
+  // Capture the hedge timer so the test can fire it.
+  std::function<void()> hedge_callback;
+  EXPECT_CALL(*env_, StartPeriodicTimer(_, _))
+      .WillOnce(Invoke([&hedge_callback](std::chrono::milliseconds,
+                                         std::function<void()> callback) {
+        hedge_callback = callback;
+        return std::unique_ptr<PeriodicTimer>(new MockPeriodicTimer(callback));
+      }));
+
+  // The first copy never answers, standing in for a hung connection; the
+  // second copy answers with an OK response.
+  int http_calls = 0;
+  EXPECT_CALL(*env_, DoRunHTTPRequest(_))
+      .Times(2)
+      .WillRepeatedly(Invoke([&http_calls](HTTPRequest* request) {
+        if (++http_calls == 1) {
+          return;
+        }
+        std::map<std::string, std::string> headers;
+        CheckResponse response;
+        std::string body = response.SerializeAsString();
+        request->OnComplete(Status::OK, std::move(headers), std::move(body));
+      }));
+
+  int done_calls = 0;
+  CheckRequestInfo info;
+  FillOperationInfo(&info);
+  sc_lib_->Check(info, nullptr,
+                 [&done_calls](Status status, const CheckResponseInfo& info) {
+                   ++done_calls;
+                   ASSERT_TRUE(status.ok());
+                 });
+
+  // The first copy is in flight; firing the hedge timer sends the second,
+  // whose response completes the check exactly once.
+  ASSERT_EQ(1, http_calls);
+  ASSERT_TRUE((bool)hedge_callback);
+  hedge_callback();
+  EXPECT_EQ(2, http_calls);
+  EXPECT_EQ(1, done_calls);
+}
+
 class QuotaAllocationTestWithRealClient : public ::testing::Test {
  public:
   void SetUp() {
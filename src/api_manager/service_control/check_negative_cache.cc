@@ -0,0 +1,85 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/service_control/check_negative_cache.h"
+
+#include "src/api_manager/utils/clock.h"
+#include "utils/md5.h"
+
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+CheckVerdictCache::CheckVerdictCache(int num_entries, int expiration_ms)
+    : cache_(num_entries), expiration_(expiration_ms), hits_(0), misses_(0) {}
+
+CheckVerdictCache::~CheckVerdictCache() { cache_.Clear(); }
+
+bool CheckVerdictCache::Lookup(const CheckRequestInfo& info,
+                                utils::Status* status,
+                                CheckResponseInfo* response_info) {
+  const std::string cache_key = ComposeCacheKey(info);
+  ::google::service_control_client::SimpleLRUCache<
+      std::string, CacheValue>::ScopedLookup lookup(&cache_, cache_key);
+  if (!lookup.Found()) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  CacheValue* val = lookup.value();
+  // Expirations here are in whole seconds; the coarse clock avoids a
+  // clock syscall on every cache lookup.
+  if (utils::CoarseNow() > val->exp) {
+    cache_.Remove(cache_key);
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  *status = val->status;
+  *response_info = val->response_info;
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void CheckVerdictCache::Insert(const CheckRequestInfo& info,
+                                const utils::Status& status,
+                                const CheckResponseInfo& response_info) {
+  CacheValue* newval = new CacheValue();
+  newval->status = status;
+  newval->response_info = response_info;
+  newval->exp = utils::CoarseNow() + expiration_;
+  cache_.Insert(ComposeCacheKey(info), newval, 1);
+}
+
+std::string CheckVerdictCache::ComposeCacheKey(const CheckRequestInfo& info) {
+  google::service_control_client::MD5 hasher;
+  hasher.Update(info.canonical_operation_name());
+  hasher.Update(info.api_key);
+  hasher.Update(info.android_package_name);
+  hasher.Update(info.android_cert_fingerprint);
+  hasher.Update(info.ios_bundle_id);
+  // The caller ip and referer go to Service Control as operation labels
+  // and api key restrictions are enforced on them, so a verdict for one
+  // caller must not be replayed to another.
+  hasher.Update(info.client_ip);
+  hasher.Update(info.referer);
+  return hasher.Digest();
+}
+
+int CheckVerdictCache::NumberOfEntries() { return cache_.Entries(); }
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
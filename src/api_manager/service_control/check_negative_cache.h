@@ -0,0 +1,92 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SERVICE_CONTROL_CHECK_NEGATIVE_CACHE_H_
+#define API_MANAGER_SERVICE_CONTROL_CHECK_NEGATIVE_CACHE_H_
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "include/api_manager/utils/status.h"
+#include "src/api_manager/service_control/info.h"
+#include "utils/simple_lru_cache_inl.h"
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+// A local POD cache for Check verdicts. Aggregated keeps two instances:
+// a short-TTL cache of failed verdicts (invalid api key, project
+// blocked), which the check aggregator never caches, so a client
+// retrying with a bad key would otherwise cost one servicecontrol round
+// trip per request - and a positive verdict cache in front of the
+// aggregator, whose hits copy this flat struct instead of converting
+// the aggregator's cached CheckResponse proto on every call. The key
+// covers the same request fields the check aggregator signatures over.
+// Transport failures are never cached.
+class CheckVerdictCache {
+ public:
+  // The cache holds at most num_entries verdicts; each expires
+  // expiration_ms after it was inserted.
+  CheckVerdictCache(int num_entries, int expiration_ms);
+  ~CheckVerdictCache();
+
+  // Looks up a cached verdict. On a hit, fills status and response_info
+  // and returns true. Expired entries are removed and count as a miss.
+  bool Lookup(const CheckRequestInfo& info, utils::Status* status,
+              CheckResponseInfo* response_info);
+
+  // Caches a verdict together with the response info that produced it.
+  void Insert(const CheckRequestInfo& info, const utils::Status& status,
+              const CheckResponseInfo& response_info);
+
+  // Cache counters, exposed via /endpoints_status.
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+
+  // This method returns number of entries stored in cache. Note that this
+  // method is only used in testing.
+  int NumberOfEntries();
+
+  // Builds the cache key from the request fields that determine the
+  // Check verdict. The shared check cache keys over the same fields, so
+  // it reuses this composer.
+  static std::string ComposeCacheKey(const CheckRequestInfo& info);
+
+ private:
+  // A cached verdict and its expiration time.
+  struct CacheValue {
+    utils::Status status = utils::Status::OK;
+    CheckResponseInfo response_info;
+    std::chrono::system_clock::time_point exp;
+  };
+
+  // LRU cache.
+  ::google::service_control_client::SimpleLRUCache<std::string, CacheValue>
+      cache_;
+
+  // How long a cached verdict stays valid.
+  std::chrono::milliseconds expiration_;
+
+  // Lookup counters.
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+};
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SERVICE_CONTROL_CHECK_NEGATIVE_CACHE_H_
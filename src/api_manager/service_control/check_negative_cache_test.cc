@@ -0,0 +1,118 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/service_control/check_negative_cache.h"
+
+#include <thread>
+
+#include "gtest/gtest.h"
+
+using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::Code;
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+namespace {
+
+const int kCacheEntries = 100;
+const int kExpirationMs = 50;
+
+class CheckVerdictCacheTest : public ::testing::Test {
+ protected:
+  CheckVerdictCacheTest()
+      : cache_(kCacheEntries, kExpirationMs),
+        denial_(Code::INVALID_ARGUMENT, "API key not valid",
+                Status::SERVICE_CONTROL) {
+    info_.operation_name = "ListShelves";
+    info_.api_key = "bad-api-key";
+    denied_info_.is_api_key_valid = false;
+  }
+
+  CheckVerdictCache cache_;
+  CheckRequestInfo info_;
+  Status denial_;
+  CheckResponseInfo denied_info_;
+};
+
+TEST_F(CheckVerdictCacheTest, LookupAfterInsert) {
+  Status status = Status::OK;
+  CheckResponseInfo response_info;
+  EXPECT_FALSE(cache_.Lookup(info_, &status, &response_info));
+
+  cache_.Insert(info_, denial_, denied_info_);
+
+  ASSERT_TRUE(cache_.Lookup(info_, &status, &response_info));
+  EXPECT_EQ(denial_.code(), status.code());
+  EXPECT_EQ(denial_.message(), status.message());
+  EXPECT_FALSE(response_info.is_api_key_valid);
+  EXPECT_EQ(1, cache_.NumberOfEntries());
+}
+
+TEST_F(CheckVerdictCacheTest, DifferentApiKeysDoNotCollide) {
+  cache_.Insert(info_, denial_, denied_info_);
+
+  CheckRequestInfo other = info_;
+  other.api_key = "another-api-key";
+  Status status = Status::OK;
+  CheckResponseInfo response_info;
+  EXPECT_FALSE(cache_.Lookup(other, &status, &response_info));
+}
+
+TEST_F(CheckVerdictCacheTest, DifferentCallersDoNotCollide) {
+  // Api key restrictions are enforced on the caller ip and referer
+  // labels, so a verdict for one caller must not serve another.
+  cache_.Insert(info_, denial_, denied_info_);
+
+  CheckRequestInfo other_ip = info_;
+  other_ip.client_ip = "10.0.0.2";
+  Status status = Status::OK;
+  CheckResponseInfo response_info;
+  EXPECT_FALSE(cache_.Lookup(other_ip, &status, &response_info));
+
+  CheckRequestInfo other_referer = info_;
+  other_referer.referer = "https://example.com/";
+  EXPECT_FALSE(cache_.Lookup(other_referer, &status, &response_info));
+}
+
+TEST_F(CheckVerdictCacheTest, EntryExpires) {
+  cache_.Insert(info_, denial_, denied_info_);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(2 * kExpirationMs));
+
+  Status status = Status::OK;
+  CheckResponseInfo response_info;
+  EXPECT_FALSE(cache_.Lookup(info_, &status, &response_info));
+  EXPECT_EQ(0, cache_.NumberOfEntries());
+}
+
+TEST_F(CheckVerdictCacheTest, CountsHitsAndMisses) {
+  Status status = Status::OK;
+  CheckResponseInfo response_info;
+  EXPECT_FALSE(cache_.Lookup(info_, &status, &response_info));
+
+  cache_.Insert(info_, denial_, denied_info_);
+  EXPECT_TRUE(cache_.Lookup(info_, &status, &response_info));
+  EXPECT_TRUE(cache_.Lookup(info_, &status, &response_info));
+
+  EXPECT_EQ(2, cache_.hits());
+  EXPECT_EQ(1, cache_.misses());
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,66 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/service_control/consumer_project_cache.h"
+
+#include "src/api_manager/utils/clock.h"
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+ConsumerProjectCache::ConsumerProjectCache(int num_entries, int expiration_ms)
+    : cache_(num_entries), expiration_(expiration_ms), hits_(0), misses_(0) {}
+
+ConsumerProjectCache::~ConsumerProjectCache() { cache_.Clear(); }
+
+bool ConsumerProjectCache::Lookup(const std::string& api_key,
+                                  std::string* consumer_project_id) {
+  ::google::service_control_client::SimpleLRUCache<
+      std::string, CacheValue>::ScopedLookup lookup(&cache_, api_key);
+  if (!lookup.Found()) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  CacheValue* val = lookup.value();
+  // The TTL is hours; the coarse clock avoids a clock syscall on every
+  // cache lookup.
+  if (utils::CoarseNow() > val->exp) {
+    cache_.Remove(api_key);
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  *consumer_project_id = val->consumer_project_id;
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void ConsumerProjectCache::Insert(const std::string& api_key,
+                                  const std::string& consumer_project_id) {
+  if (api_key.empty() || consumer_project_id.empty()) {
+    return;
+  }
+  CacheValue* newval = new CacheValue();
+  newval->consumer_project_id = consumer_project_id;
+  newval->exp = utils::CoarseNow() + expiration_;
+  cache_.Insert(api_key, newval, 1);
+}
+
+int ConsumerProjectCache::NumberOfEntries() { return cache_.Entries(); }
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
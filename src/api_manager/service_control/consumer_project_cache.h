@@ -0,0 +1,82 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SERVICE_CONTROL_CONSUMER_PROJECT_CACHE_H_
+#define API_MANAGER_SERVICE_CONTROL_CONSUMER_PROJECT_CACHE_H_
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "utils/simple_lru_cache_inl.h"
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+// A local cache of the api_key -> consumer project mapping learned from
+// Check responses. An api key is bound to one consumer project for its
+// lifetime, so the mapping is nearly immutable and a much longer TTL than
+// the check caches is safe. Report fill consults it when the Check of a
+// request produced no consumer project (e.g. Check was skipped), instead
+// of re-deriving the mapping.
+class ConsumerProjectCache {
+ public:
+  // The cache holds at most num_entries mappings; each expires
+  // expiration_ms after it was inserted.
+  ConsumerProjectCache(int num_entries, int expiration_ms);
+  ~ConsumerProjectCache();
+
+  // Looks up the consumer project of api_key. On a hit, fills
+  // consumer_project_id and returns true. Expired entries are removed
+  // and count as a miss.
+  bool Lookup(const std::string& api_key, std::string* consumer_project_id);
+
+  // Caches the consumer project of api_key. A no-op when either string
+  // is empty.
+  void Insert(const std::string& api_key,
+              const std::string& consumer_project_id);
+
+  // Cache counters.
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+
+  // This method returns number of entries stored in cache. Note that this
+  // method is only used in testing.
+  int NumberOfEntries();
+
+ private:
+  // A cached mapping and its expiration time.
+  struct CacheValue {
+    std::string consumer_project_id;
+    std::chrono::system_clock::time_point exp;
+  };
+
+  // LRU cache keyed by api key.
+  ::google::service_control_client::SimpleLRUCache<std::string, CacheValue>
+      cache_;
+
+  // How long a cached mapping stays valid.
+  std::chrono::milliseconds expiration_;
+
+  // Lookup counters.
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+};
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SERVICE_CONTROL_CONSUMER_PROJECT_CACHE_H_
@@ -0,0 +1,84 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/service_control/consumer_project_cache.h"
+
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+namespace {
+
+const int kCacheEntries = 100;
+const int kExpirationMs = 50;
+
+const char kApiKey[] = "an-api-key";
+const char kProjectId[] = "12345";
+
+class ConsumerProjectCacheTest : public ::testing::Test {
+ protected:
+  ConsumerProjectCacheTest() : cache_(kCacheEntries, kExpirationMs) {}
+
+  ConsumerProjectCache cache_;
+};
+
+TEST_F(ConsumerProjectCacheTest, LookupAfterInsert) {
+  std::string project_id;
+  EXPECT_FALSE(cache_.Lookup(kApiKey, &project_id));
+
+  cache_.Insert(kApiKey, kProjectId);
+
+  ASSERT_TRUE(cache_.Lookup(kApiKey, &project_id));
+  EXPECT_EQ(kProjectId, project_id);
+  EXPECT_EQ(1, cache_.NumberOfEntries());
+}
+
+TEST_F(ConsumerProjectCacheTest, EmptyKeyOrProjectIsNotCached) {
+  cache_.Insert("", kProjectId);
+  cache_.Insert(kApiKey, "");
+
+  EXPECT_EQ(0, cache_.NumberOfEntries());
+}
+
+TEST_F(ConsumerProjectCacheTest, EntryExpires) {
+  cache_.Insert(kApiKey, kProjectId);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(2 * kExpirationMs));
+
+  std::string project_id;
+  EXPECT_FALSE(cache_.Lookup(kApiKey, &project_id));
+  EXPECT_EQ(0, cache_.NumberOfEntries());
+}
+
+TEST_F(ConsumerProjectCacheTest, CountsHitsAndMisses) {
+  std::string project_id;
+  EXPECT_FALSE(cache_.Lookup(kApiKey, &project_id));
+
+  cache_.Insert(kApiKey, kProjectId);
+  EXPECT_TRUE(cache_.Lookup(kApiKey, &project_id));
+  EXPECT_TRUE(cache_.Lookup(kApiKey, &project_id));
+
+  EXPECT_EQ(2, cache_.hits());
+  EXPECT_EQ(1, cache_.misses());
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
@@ -22,6 +22,7 @@
 #include <memory>
 #include <string>
 
+#include "include/api_manager/method.h"
 #include "include/api_manager/protocol.h"
 #include "include/api_manager/service_control.h"
 #include "include/api_manager/utils/status.h"
@@ -42,9 +43,26 @@ struct OperationInfo {
   // the two calls should carry the same operation id.
   std::string operation_id;
 
-  // Fully qualified name of the operation.
+  // Fully qualified name of the operation. A per-request override; when
+  // empty the name comes from the resolved method below.
   std::string operation_name;
 
+  // The method the request resolved to, nullptr when it did not match a
+  // configured one. MethodInfo is built once with the config and owns the
+  // canonical selector, api name and version strings, so the fill
+  // functions read them through this pointer at serialization time
+  // instead of every request copying them into the info.
+  const MethodInfo* method_info;
+
+  // The effective operation name: the per-request override when set,
+  // otherwise the interned selector of the resolved method.
+  const std::string& canonical_operation_name() const {
+    if (!operation_name.empty() || method_info == nullptr) {
+      return operation_name;
+    }
+    return method_info->selector();
+  }
+
   // The producer project id.
   std::string producer_project_id;
 
@@ -65,7 +83,7 @@ struct OperationInfo {
   // The client host name.
   std::string client_host;
 
-  OperationInfo() {}
+  OperationInfo() : method_info(nullptr) {}
 };
 
 // Information to fill Check request protobuf.
@@ -109,17 +127,43 @@ struct ReportRequestInfo : public OperationInfo {
 
   // location of the service, such as us-central.
   std::string location;
-  // API name and version.
+  // API name and version. Per-request overrides; when empty they come
+  // from method_info, like operation_name.
   std::string api_name;
   std::string api_version;
   std::string api_method;
 
+  // The effective api method, name and version; see
+  // canonical_operation_name().
+  const std::string& canonical_api_method() const {
+    if (!api_method.empty() || method_info == nullptr) {
+      return api_method;
+    }
+    return method_info->selector();
+  }
+  const std::string& canonical_api_name() const {
+    if (!api_name.empty() || method_info == nullptr) {
+      return api_name;
+    }
+    return method_info->api_name();
+  }
+  const std::string& canonical_api_version() const {
+    if (!api_version.empty() || method_info == nullptr) {
+      return api_version;
+    }
+    return method_info->api_version();
+  }
+
   // The request size in bytes. -1 if not available.
   int64_t request_size;
 
   // The response size in bytes. -1 if not available.
   int64_t response_size;
 
+  // Peak memory in bytes attributed to the request by the environment's
+  // allocation accounting. -1 if not available.
+  int64_t memory_high_water;
+
   // per request latency.
   LatencyInfo latency;
 
@@ -132,6 +176,11 @@ struct ReportRequestInfo : public OperationInfo {
 
   std::string jwt_payloads;
 
+  // The per-phase latency breakdown, only filled when the client opted
+  // into latency attribution; see RequestContext::
+  // FormatLatencyAttribution().
+  std::string latency_attribution;
+
   // Protocol used to issue the request.
   protocol::Protocol frontend_protocol;
   protocol::Protocol backend_protocol;
@@ -177,6 +226,7 @@ struct ReportRequestInfo : public OperationInfo {
         status(utils::Status::OK),
         request_size(-1),
         response_size(-1),
+        memory_high_water(-1),
         frontend_protocol(protocol::UNKNOWN),
         backend_protocol(protocol::UNKNOWN),
         compute_platform(ComputePlatform::kUnknown),
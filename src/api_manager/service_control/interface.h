@@ -48,6 +48,18 @@ class Interface {
   // This method can be called repeatedly.
   virtual utils::Status Close() = 0;
 
+  // Hands the remaining reporting duties to |successor| when the service
+  // config this instance serves is rolled out of traffic. The
+  // implementation flushes its residual aggregation, stops its own flush
+  // schedule and forwards later Report calls - from in-flight streams
+  // that still hold the old epoch - to the successor, so a rollout never
+  // runs two flush schedules. The caller must keep |successor| alive
+  // until this instance is destroyed.
+  virtual void StartDraining(Interface* successor) {}
+
+  // Revives a draining instance when its config re-enters traffic.
+  virtual void StopDraining() {}
+
   // Sends a ServiceControl Report.
   // Report calls are always aggregated and cached.
   // Return utils::Status usually is OK unless some caching error.
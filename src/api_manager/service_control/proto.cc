@@ -18,6 +18,7 @@
 
 #include <functional>
 
+#include <string.h>
 #include <time.h>
 #include <uuid/uuid.h>
 #include <chrono>
@@ -28,6 +29,8 @@
 #include "include/api_manager/utils/version.h"
 #include "src/api_manager/auth/lib/auth_token.h"
 #include "src/api_manager/auth/lib/base64.h"
+#include "src/api_manager/utils/clock.h"
+#include "src/api_manager/utils/format_util.h"
 #include "utils/distribution_helper.h"
 
 using ::google::api::servicecontrol::v1::CheckError;
@@ -58,6 +61,8 @@ const char kQuotaName[] = "/quota_name";
 // Default location
 const char kDefaultLocation[] = "global";
 
+typedef std::vector<DistributionSample> DistributionSamples;
+
 struct SupportedMetric {
   const char* name;
   ::google::api::MetricDescriptor_MetricKind metric_kind;
@@ -67,8 +72,11 @@ struct SupportedMetric {
   enum Tag { START = 0, INTERMEDIATE = 1, FINAL = 2 };
   Tag tag;
   Mark mark;
+  // When |samples| is non-null, distribution metrics are recorded there
+  // as raw samples instead of into |operation|; see
+  // Proto::FillReportRequest.
   Status (*set)(const SupportedMetric& m, const ReportRequestInfo& info,
-                Operation* operation);
+                Operation* operation, DistributionSamples* samples);
 };
 
 struct SupportedLabel {
@@ -84,6 +92,14 @@ struct SupportedLabel {
   bool by_consumer_only;
 };
 
+struct SupportedLogField {
+  const char* name;
+
+  void (*set)(const SupportedLogField& f, const ReportRequestInfo& info,
+              const std::string& config_id, const Timestamp& current_time,
+              Map<std::string, ::google::protobuf::Value>* fields);
+};
+
 namespace {
 
 // Metric Helpers
@@ -113,7 +129,20 @@ const double kMsToSecs = 1e-3;
 
 Status AddDistributionMetric(const DistributionHelperOptions& options,
                              const char* metric_name, double value,
-                             Operation* operation) {
+                             Operation* operation,
+                             DistributionSamples* samples) {
+  if (samples != nullptr) {
+    // Raw sample for the columnar accumulator; folding it in there is one
+    // bucket increment instead of the proto churn below.
+    DistributionSample sample;
+    sample.metric_name = metric_name;
+    sample.value = value;
+    sample.options.num_finite_buckets = options.buckets;
+    sample.options.growth_factor = options.growth;
+    sample.options.scale = options.scale;
+    samples->push_back(sample);
+    return Status::OK;
+  }
   MetricValue* metric_value = AddMetricValue(metric_name, operation);
   Distribution distribution;
   ::google::protobuf::util::Status proto_status =
@@ -130,14 +159,15 @@ Status AddDistributionMetric(const DistributionHelperOptions& options,
 
 Status set_int64_metric_to_constant_1(const SupportedMetric& m,
                                       const ReportRequestInfo& info,
-                                      Operation* operation) {
+                                      Operation* operation,
+                                      DistributionSamples* samples) {
   AddInt64Metric(m.name, 1l, operation);
   return Status::OK;
 }
 
 Status set_int64_metric_to_constant_1_if_http_error(
     const SupportedMetric& m, const ReportRequestInfo& info,
-    Operation* operation) {
+    Operation* operation, DistributionSamples* samples) {
   // Use status code >= 400 to determine request failed.
   if (info.response_code >= 400) {
     AddInt64Metric(m.name, 1l, operation);
@@ -147,20 +177,22 @@ Status set_int64_metric_to_constant_1_if_http_error(
 
 Status set_distribution_metric_to_request_size(const SupportedMetric& m,
                                                const ReportRequestInfo& info,
-                                               Operation* operation) {
+                                               Operation* operation,
+                                               DistributionSamples* samples) {
   if (info.request_size >= 0) {
     return AddDistributionMetric(size_distribution, m.name, info.request_size,
-                                 operation);
+                                 operation, samples);
   }
   return Status::OK;
 }
 
 Status set_distribution_metric_to_response_size(const SupportedMetric& m,
                                                 const ReportRequestInfo& info,
-                                                Operation* operation) {
+                                                Operation* operation,
+                                                DistributionSamples* samples) {
   if (info.response_size >= 0) {
     return AddDistributionMetric(size_distribution, m.name, info.response_size,
-                                 operation);
+                                 operation, samples);
   }
   return Status::OK;
 }
@@ -168,40 +200,44 @@ Status set_distribution_metric_to_response_size(const SupportedMetric& m,
 // TODO: Consider refactoring following 3 functions to avoid duplicate code
 Status set_distribution_metric_to_request_time(const SupportedMetric& m,
                                                const ReportRequestInfo& info,
-                                               Operation* operation) {
+                                               Operation* operation,
+                                               DistributionSamples* samples) {
   if (info.latency.request_time_ms >= 0) {
     double request_time_secs = info.latency.request_time_ms * kMsToSecs;
     return AddDistributionMetric(time_distribution, m.name, request_time_secs,
-                                 operation);
+                                 operation, samples);
   }
   return Status::OK;
 }
 
 Status set_distribution_metric_to_backend_time(const SupportedMetric& m,
                                                const ReportRequestInfo& info,
-                                               Operation* operation) {
+                                               Operation* operation,
+                                               DistributionSamples* samples) {
   if (info.latency.backend_time_ms >= 0) {
     double backend_time_secs = info.latency.backend_time_ms * kMsToSecs;
     return AddDistributionMetric(time_distribution, m.name, backend_time_secs,
-                                 operation);
+                                 operation, samples);
   }
   return Status::OK;
 }
 
 Status set_distribution_metric_to_overhead_time(const SupportedMetric& m,
                                                 const ReportRequestInfo& info,
-                                                Operation* operation) {
+                                                Operation* operation,
+                                                DistributionSamples* samples) {
   if (info.latency.overhead_time_ms >= 0) {
     double overhead_time_secs = info.latency.overhead_time_ms * kMsToSecs;
     return AddDistributionMetric(time_distribution, m.name, overhead_time_secs,
-                                 operation);
+                                 operation, samples);
   }
   return Status::OK;
 }
 
 Status set_int64_metric_to_request_bytes(const SupportedMetric& m,
                                          const ReportRequestInfo& info,
-                                         Operation* operation) {
+                                         Operation* operation,
+                                         DistributionSamples* samples) {
   if (info.request_bytes > 0) {
     AddInt64Metric(m.name, info.request_bytes, operation);
   }
@@ -210,7 +246,8 @@ Status set_int64_metric_to_request_bytes(const SupportedMetric& m,
 
 Status set_int64_metric_to_response_bytes(const SupportedMetric& m,
                                           const ReportRequestInfo& info,
-                                          Operation* operation) {
+                                          Operation* operation,
+                                          DistributionSamples* samples) {
   if (info.response_bytes > 0) {
     AddInt64Metric(m.name, info.response_bytes, operation);
   }
@@ -219,29 +256,31 @@ Status set_int64_metric_to_response_bytes(const SupportedMetric& m,
 
 Status set_distribution_metric_to_streaming_request_message_counts(
     const SupportedMetric& m, const ReportRequestInfo& info,
-    Operation* operation) {
+    Operation* operation, DistributionSamples* samples) {
   if (info.streaming_request_message_counts > 0) {
     AddDistributionMetric(size_distribution, m.name,
-                          info.streaming_request_message_counts, operation);
+                          info.streaming_request_message_counts, operation,
+                          samples);
   }
   return Status::OK;
 }
 Status set_distribution_metric_to_streaming_response_message_counts(
     const SupportedMetric& m, const ReportRequestInfo& info,
-    Operation* operation) {
+    Operation* operation, DistributionSamples* samples) {
   if (info.streaming_response_message_counts > 0) {
     AddDistributionMetric(size_distribution, m.name,
-                          info.streaming_response_message_counts, operation);
+                          info.streaming_response_message_counts, operation,
+                          samples);
   }
   return Status::OK;
 }
 
 Status set_distribution_metric_to_streaming_durations(
     const SupportedMetric& m, const ReportRequestInfo& info,
-    Operation* operation) {
+    Operation* operation, DistributionSamples* samples) {
   if (info.streaming_durations > 0) {
     AddDistributionMetric(time_distribution, m.name, info.streaming_durations,
-                          operation);
+                          operation, samples);
   }
   return Status::OK;
 }
@@ -635,10 +674,7 @@ Status set_referer(const SupportedLabel& l, const ReportRequestInfo& info,
 Status set_response_code(const SupportedLabel& l, const ReportRequestInfo& info,
                          Map<std::string, std::string>* labels) {
   if (!info.is_final_report) return Status::OK;
-  char response_code_buf[20];
-  snprintf(response_code_buf, sizeof(response_code_buf), "%d",
-           info.response_code);
-  (*labels)[l.name] = response_code_buf;
+  (*labels)[l.name] = utils::Int64ToString(info.response_code);
   return Status::OK;
 }
 
@@ -655,10 +691,7 @@ Status set_response_code_class(const SupportedLabel& l,
 Status set_status_code(const SupportedLabel& l, const ReportRequestInfo& info,
                        Map<std::string, std::string>* labels) {
   if (!info.is_final_report) return Status::OK;
-  char status_code_buf[20];
-  snprintf(status_code_buf, sizeof(status_code_buf), "%d",
-           info.status.CanonicalCode());
-  (*labels)[l.name] = status_code_buf;
+  (*labels)[l.name] = utils::Int64ToString(info.status.CanonicalCode());
   return Status::OK;
 }
 
@@ -676,8 +709,8 @@ Status set_location(const SupportedLabel& l, const ReportRequestInfo& info,
 // serviceruntime.googleapis.com/api_method
 Status set_api_method(const SupportedLabel& l, const ReportRequestInfo& info,
                       Map<std::string, std::string>* labels) {
-  if (!info.api_method.empty()) {
-    (*labels)[l.name] = info.api_method;
+  if (!info.canonical_api_method().empty()) {
+    (*labels)[l.name] = info.canonical_api_method();
   }
   return Status::OK;
 }
@@ -685,8 +718,8 @@ Status set_api_method(const SupportedLabel& l, const ReportRequestInfo& info,
 // serviceruntime.googleapis.com/api_version
 Status set_api_version(const SupportedLabel& l, const ReportRequestInfo& info,
                        Map<std::string, std::string>* labels) {
-  if (!info.api_version.empty()) {
-    (*labels)[l.name] = info.api_version;
+  if (!info.canonical_api_version().empty()) {
+    (*labels)[l.name] = info.canonical_api_version();
   }
   return Status::OK;
 }
@@ -957,7 +990,9 @@ const char kLogFieldNameRequestSize[] = "request_size_in_bytes";
 const char kLogFieldNameRequestHeaders[] = "request_headers";
 const char kLogFieldNameResponseHeaders[] = "response_headers";
 const char kLogFieldNameJwtPayloads[] = "jwt_payloads";
+const char kLogFieldNameLatencyAttribution[] = "latency_attribution";
 const char kLogFieldNameResponseSize[] = "response_size_in_bytes";
+const char kLogFieldNameMemoryHighWater[] = "memory_high_water_mark_in_bytes";
 const char kLogFieldNameHttpMethod[] = "http_method";
 const char kLogFieldNameHttpResponseCode[] = "http_response_code";
 const char kLogFieldNameLogMessage[] = "log_message";
@@ -979,7 +1014,9 @@ Timestamp CreateTimestamp(std::chrono::system_clock::time_point tp) {
 }
 
 Timestamp GetCurrentTimestamp() {
-  return CreateTimestamp(std::chrono::system_clock::now());
+  // Operation timestamps do not need sub-millisecond precision; the
+  // coarse clock avoids a clock syscall on every check/report built.
+  return CreateTimestamp(utils::CoarseNow());
 }
 
 Status VerifyRequiredCheckFields(const OperationInfo& info) {
@@ -987,7 +1024,7 @@ Status VerifyRequiredCheckFields(const OperationInfo& info) {
     return Status(Code::INVALID_ARGUMENT, "operation_id is required.",
                   Status::SERVICE_CONTROL);
   }
-  if (info.operation_name.empty()) {
+  if (info.canonical_operation_name().empty()) {
     return Status(Code::INVALID_ARGUMENT, "operation_name is required.",
                   Status::SERVICE_CONTROL);
   }
@@ -1003,8 +1040,8 @@ void SetOperationCommonFields(const OperationInfo& info,
   if (!info.operation_id.empty()) {
     op->set_operation_id(info.operation_id);
   }
-  if (!info.operation_name.empty()) {
-    op->set_operation_name(info.operation_name);
+  if (!info.canonical_operation_name().empty()) {
+    op->set_operation_name(info.canonical_operation_name());
   }
   if (!info.api_key.empty()) {
     op->set_consumer_id(std::string(kConsumerIdApiKey) +
@@ -1014,85 +1051,306 @@ void SetOperationCommonFields(const OperationInfo& info,
   *op->mutable_end_time() = current_time;
 }
 
-void FillLogEntry(const ReportRequestInfo& info, const std::string& name,
-                  const std::string& config_id, const Timestamp& current_time,
-                  LogEntry* log_entry) {
-  log_entry->set_name(name);
-  *log_entry->mutable_timestamp() = current_time;
-  auto severity = (info.response_code >= 400) ? google::logging::type::ERROR
-                                              : google::logging::type::INFO;
-  log_entry->set_severity(severity);
+// Log entry field helpers. Each writes one struct payload field; the
+// constructors compile the supported fields, minus the ones the server
+// config whitelist excludes, into the log field plan.
 
-  auto* fields = log_entry->mutable_struct_payload()->mutable_fields();
-  (*fields)[kLogFieldNameTimestamp].set_number_value(
+typedef Map<std::string, ::google::protobuf::Value> LogEntryFields;
+
+// timestamp
+void set_log_timestamp(const SupportedLogField& f,
+                       const ReportRequestInfo& info,
+                       const std::string& config_id,
+                       const Timestamp& current_time, LogEntryFields* fields) {
+  (*fields)[f.name].set_number_value(
       (double)current_time.seconds() +
       (double)current_time.nanos() / (double)1000000000.0);
-  (*fields)[kLogFieldNameConfigId].set_string_value(config_id);
-  (*fields)[kLogFieldNameServiceAgent].set_string_value(
-      kServiceAgentPrefix + utils::Version::instance().get());
+}
+
+// service_config_id
+void set_log_config_id(const SupportedLogField& f,
+                       const ReportRequestInfo& info,
+                       const std::string& config_id,
+                       const Timestamp& current_time, LogEntryFields* fields) {
+  (*fields)[f.name].set_string_value(config_id);
+}
+
+// service_agent
+void set_log_service_agent(const SupportedLogField& f,
+                           const ReportRequestInfo& info,
+                           const std::string& config_id,
+                           const Timestamp& current_time,
+                           LogEntryFields* fields) {
+  (*fields)[f.name].set_string_value(kServiceAgentPrefix +
+                                     utils::Version::instance().get());
+}
+
+// producer_project_id
+void set_log_producer_project_id(const SupportedLogField& f,
+                                 const ReportRequestInfo& info,
+                                 const std::string& config_id,
+                                 const Timestamp& current_time,
+                                 LogEntryFields* fields) {
   if (!info.producer_project_id.empty()) {
-    (*fields)[kLogFieldNameProducerProjectId].set_string_value(
-        info.producer_project_id);
+    (*fields)[f.name].set_string_value(info.producer_project_id);
   }
+}
+
+// api_key
+void set_log_api_key(const SupportedLogField& f, const ReportRequestInfo& info,
+                     const std::string& config_id,
+                     const Timestamp& current_time, LogEntryFields* fields) {
   if (!info.api_key.empty()) {
-    (*fields)[kLogFieldNameApiKey].set_string_value(info.api_key);
+    (*fields)[f.name].set_string_value(info.api_key);
   }
+}
+
+// referer
+void set_log_referer(const SupportedLogField& f, const ReportRequestInfo& info,
+                     const std::string& config_id,
+                     const Timestamp& current_time, LogEntryFields* fields) {
   if (!info.referer.empty()) {
-    (*fields)[kLogFieldNameReferer].set_string_value(info.referer);
+    (*fields)[f.name].set_string_value(info.referer);
   }
-  if (!info.api_name.empty()) {
-    (*fields)[kLogFieldNameApiName].set_string_value(info.api_name);
+}
+
+// api_name
+void set_log_api_name(const SupportedLogField& f, const ReportRequestInfo& info,
+                      const std::string& config_id,
+                      const Timestamp& current_time, LogEntryFields* fields) {
+  if (!info.canonical_api_name().empty()) {
+    (*fields)[f.name].set_string_value(info.canonical_api_name());
   }
-  if (!info.api_version.empty()) {
-    (*fields)[kLogFieldNameApiVersion].set_string_value(info.api_version);
+}
+
+// api_version
+void set_log_api_version(const SupportedLogField& f,
+                         const ReportRequestInfo& info,
+                         const std::string& config_id,
+                         const Timestamp& current_time,
+                         LogEntryFields* fields) {
+  if (!info.canonical_api_version().empty()) {
+    (*fields)[f.name].set_string_value(info.canonical_api_version());
   }
+}
+
+// url
+void set_log_url(const SupportedLogField& f, const ReportRequestInfo& info,
+                 const std::string& config_id, const Timestamp& current_time,
+                 LogEntryFields* fields) {
   if (!info.url.empty()) {
-    (*fields)[kLogFieldNameUrl].set_string_value(info.url);
+    (*fields)[f.name].set_string_value(info.url);
   }
-  if (!info.api_method.empty()) {
-    (*fields)[kLogFieldNameApiMethod].set_string_value(info.api_method);
+}
+
+// api_method
+void set_log_api_method(const SupportedLogField& f,
+                        const ReportRequestInfo& info,
+                        const std::string& config_id,
+                        const Timestamp& current_time, LogEntryFields* fields) {
+  if (!info.canonical_api_method().empty()) {
+    (*fields)[f.name].set_string_value(info.canonical_api_method());
   }
+}
+
+// location
+void set_log_location(const SupportedLogField& f, const ReportRequestInfo& info,
+                      const std::string& config_id,
+                      const Timestamp& current_time, LogEntryFields* fields) {
   if (!info.location.empty()) {
-    (*fields)[kLogFieldNameLocation].set_string_value(info.location);
+    (*fields)[f.name].set_string_value(info.location);
   }
+}
+
+// log_message
+void set_log_log_message(const SupportedLogField& f,
+                         const ReportRequestInfo& info,
+                         const std::string& config_id,
+                         const Timestamp& current_time,
+                         LogEntryFields* fields) {
   if (!info.log_message.empty()) {
-    (*fields)[kLogFieldNameLogMessage].set_string_value(info.log_message);
+    (*fields)[f.name].set_string_value(info.log_message);
   }
+}
+
+// jwt_payloads
+void set_log_jwt_payloads(const SupportedLogField& f,
+                          const ReportRequestInfo& info,
+                          const std::string& config_id,
+                          const Timestamp& current_time,
+                          LogEntryFields* fields) {
   if (!info.jwt_payloads.empty()) {
-    (*fields)[kLogFieldNameJwtPayloads].set_string_value(info.jwt_payloads);
+    (*fields)[f.name].set_string_value(info.jwt_payloads);
   }
-  (*fields)[kLogFieldNameHttpResponseCode].set_number_value(info.response_code);
+}
 
+// latency_attribution
+void set_log_latency_attribution(const SupportedLogField& f,
+                                 const ReportRequestInfo& info,
+                                 const std::string& config_id,
+                                 const Timestamp& current_time,
+                                 LogEntryFields* fields) {
+  if (!info.latency_attribution.empty()) {
+    (*fields)[f.name].set_string_value(info.latency_attribution);
+  }
+}
+
+// http_response_code
+void set_log_http_response_code(const SupportedLogField& f,
+                                const ReportRequestInfo& info,
+                                const std::string& config_id,
+                                const Timestamp& current_time,
+                                LogEntryFields* fields) {
+  (*fields)[f.name].set_number_value(info.response_code);
+}
+
+// request_size_in_bytes
+void set_log_request_size(const SupportedLogField& f,
+                          const ReportRequestInfo& info,
+                          const std::string& config_id,
+                          const Timestamp& current_time,
+                          LogEntryFields* fields) {
   if (info.request_size >= 0) {
-    (*fields)[kLogFieldNameRequestSize].set_number_value(info.request_size);
+    (*fields)[f.name].set_number_value(info.request_size);
   }
+}
+
+// request_headers
+void set_log_request_headers(const SupportedLogField& f,
+                             const ReportRequestInfo& info,
+                             const std::string& config_id,
+                             const Timestamp& current_time,
+                             LogEntryFields* fields) {
   if (!info.request_headers.empty()) {
-    (*fields)[kLogFieldNameRequestHeaders].set_string_value(
-        info.request_headers);
+    (*fields)[f.name].set_string_value(info.request_headers);
   }
+}
+
+// response_size_in_bytes
+void set_log_response_size(const SupportedLogField& f,
+                           const ReportRequestInfo& info,
+                           const std::string& config_id,
+                           const Timestamp& current_time,
+                           LogEntryFields* fields) {
   if (info.response_size >= 0) {
-    (*fields)[kLogFieldNameResponseSize].set_number_value(info.response_size);
+    (*fields)[f.name].set_number_value(info.response_size);
   }
+}
+
+// memory_high_water_mark_in_bytes
+void set_log_memory_high_water(const SupportedLogField& f,
+                               const ReportRequestInfo& info,
+                               const std::string& config_id,
+                               const Timestamp& current_time,
+                               LogEntryFields* fields) {
+  if (info.memory_high_water >= 0) {
+    (*fields)[f.name].set_number_value(info.memory_high_water);
+  }
+}
+
+// response_headers
+void set_log_response_headers(const SupportedLogField& f,
+                              const ReportRequestInfo& info,
+                              const std::string& config_id,
+                              const Timestamp& current_time,
+                              LogEntryFields* fields) {
   if (!info.response_headers.empty()) {
-    (*fields)[kLogFieldNameResponseHeaders].set_string_value(
-        info.response_headers);
+    (*fields)[f.name].set_string_value(info.response_headers);
   }
+}
+
+// request_latency_in_ms
+void set_log_request_latency(const SupportedLogField& f,
+                             const ReportRequestInfo& info,
+                             const std::string& config_id,
+                             const Timestamp& current_time,
+                             LogEntryFields* fields) {
   if (info.latency.request_time_ms >= 0) {
-    (*fields)[kLogFieldNameRequestLatency].set_number_value(
-        info.latency.request_time_ms);
+    (*fields)[f.name].set_number_value(info.latency.request_time_ms);
   }
+}
+
+// http_method
+void set_log_http_method(const SupportedLogField& f,
+                         const ReportRequestInfo& info,
+                         const std::string& config_id,
+                         const Timestamp& current_time,
+                         LogEntryFields* fields) {
   if (!info.method.empty()) {
-    (*fields)[kLogFieldNameHttpMethod].set_string_value(info.method);
+    (*fields)[f.name].set_string_value(info.method);
   }
+}
+
+// client_ip
+void set_log_client_ip(const SupportedLogField& f,
+                       const ReportRequestInfo& info,
+                       const std::string& config_id,
+                       const Timestamp& current_time, LogEntryFields* fields) {
   if (!info.client_ip.empty()) {
-    (*fields)[kLogFieldNameClientIp].set_string_value(info.client_ip);
+    (*fields)[f.name].set_string_value(info.client_ip);
   }
+}
+
+// error_cause
+void set_log_error_cause(const SupportedLogField& f,
+                         const ReportRequestInfo& info,
+                         const std::string& config_id,
+                         const Timestamp& current_time,
+                         LogEntryFields* fields) {
   if (info.response_code >= 400) {
-    (*fields)[kLogFieldNameErrorCause].set_string_value(
+    (*fields)[f.name].set_string_value(
         Status::ErrorCauseToString(info.status.error_cause()));
   }
 }
 
+const SupportedLogField supported_log_fields[] = {
+    {kLogFieldNameTimestamp, set_log_timestamp},
+    {kLogFieldNameConfigId, set_log_config_id},
+    {kLogFieldNameServiceAgent, set_log_service_agent},
+    {kLogFieldNameProducerProjectId, set_log_producer_project_id},
+    {kLogFieldNameApiKey, set_log_api_key},
+    {kLogFieldNameReferer, set_log_referer},
+    {kLogFieldNameApiName, set_log_api_name},
+    {kLogFieldNameApiVersion, set_log_api_version},
+    {kLogFieldNameUrl, set_log_url},
+    {kLogFieldNameApiMethod, set_log_api_method},
+    {kLogFieldNameLocation, set_log_location},
+    {kLogFieldNameLogMessage, set_log_log_message},
+    {kLogFieldNameJwtPayloads, set_log_jwt_payloads},
+    {kLogFieldNameLatencyAttribution, set_log_latency_attribution},
+    {kLogFieldNameHttpResponseCode, set_log_http_response_code},
+    {kLogFieldNameRequestSize, set_log_request_size},
+    {kLogFieldNameRequestHeaders, set_log_request_headers},
+    {kLogFieldNameResponseSize, set_log_response_size},
+    {kLogFieldNameMemoryHighWater, set_log_memory_high_water},
+    {kLogFieldNameResponseHeaders, set_log_response_headers},
+    {kLogFieldNameRequestLatency, set_log_request_latency},
+    {kLogFieldNameHttpMethod, set_log_http_method},
+    {kLogFieldNameClientIp, set_log_client_ip},
+    {kLogFieldNameErrorCause, set_log_error_cause},
+};
+
+const int supported_log_fields_count =
+    sizeof(supported_log_fields) / sizeof(supported_log_fields[0]);
+
+void FillLogEntry(const ReportRequestInfo& info, const std::string& config_id,
+                  const Timestamp& current_time,
+                  const std::vector<const SupportedLogField*>& log_field_plan,
+                  const LogEntry& skeleton, LogEntry* log_entry) {
+  // Start from the skeleton, which already carries the entry name and
+  // the payload fields that are constant for the deployment.
+  *log_entry = skeleton;
+  *log_entry->mutable_timestamp() = current_time;
+  auto severity = (info.response_code >= 400) ? google::logging::type::ERROR
+                                              : google::logging::type::INFO;
+  log_entry->set_severity(severity);
+
+  auto* fields = log_entry->mutable_struct_payload()->mutable_fields();
+  for (const SupportedLogField* f : log_field_plan) {
+    (f->set)(*f, info, config_id, current_time, fields);
+  }
+}
+
 template <class Element>
 std::vector<const Element*> FilterPointers(
     const Element* first, const Element* last,
@@ -1109,8 +1367,25 @@ std::vector<const Element*> FilterPointers(
 
 }  // namespace
 
+namespace {
+
+// Builds the log field plan: all supported fields when the whitelist is
+// empty, the listed fields otherwise.
+std::vector<const SupportedLogField*> BuildLogFieldPlan(
+    const std::set<std::string>& log_entry_fields) {
+  return FilterPointers<SupportedLogField>(
+      supported_log_fields, supported_log_fields + supported_log_fields_count,
+      [&log_entry_fields](const struct SupportedLogField* f) {
+        return log_entry_fields.empty() ||
+               log_entry_fields.find(f->name) != log_entry_fields.end();
+      });
+}
+
+}  // namespace
+
 Proto::Proto(const std::set<std::string>& logs, const std::string& service_name,
-             const std::string& service_config_id)
+             const std::string& service_config_id,
+             const std::set<std::string>& log_entry_fields)
     : logs_(logs.begin(), logs.end()),
       metrics_(FilterPointers<SupportedMetric>(
           supported_metrics, supported_metrics + supported_metrics_count,
@@ -1118,14 +1393,19 @@ Proto::Proto(const std::set<std::string>& logs, const std::string& service_name,
       labels_(FilterPointers<SupportedLabel>(
           supported_labels, supported_labels + supported_labels_count,
           [](const struct SupportedLabel* l) { return l->set != nullptr; })),
+      log_field_plan_(BuildLogFieldPlan(log_entry_fields)),
       service_name_(service_name),
-      service_config_id_(service_config_id) {}
+      service_config_id_(service_config_id) {
+  BuildReportFillPlans();
+  BuildLogEntrySkeletons();
+}
 
 Proto::Proto(const std::set<std::string>& logs,
              const std::set<std::string>& metrics,
              const std::set<std::string>& labels,
              const std::string& service_name,
-             const std::string& service_config_id)
+             const std::string& service_config_id,
+             const std::set<std::string>& log_entry_fields)
     : logs_(logs.begin(), logs.end()),
       metrics_(FilterPointers<SupportedMetric>(
           supported_metrics, supported_metrics + supported_metrics_count,
@@ -1138,8 +1418,72 @@ Proto::Proto(const std::set<std::string>& logs,
             return l->set && (l->kind == SupportedLabel::SYSTEM ||
                               labels.find(l->name) != labels.end());
           })),
+      log_field_plan_(BuildLogFieldPlan(log_entry_fields)),
       service_name_(service_name),
-      service_config_id_(service_config_id) {}
+      service_config_id_(service_config_id) {
+  BuildReportFillPlans();
+  BuildLogEntrySkeletons();
+}
+
+void Proto::BuildReportFillPlans() {
+  for (const SupportedLabel* l : labels_) {
+    if (!l->by_consumer_only) {
+      operation_label_plan_.push_back(l);
+    }
+  }
+
+  for (int is_first = 0; is_first < 2; ++is_first) {
+    for (int is_final = 0; is_final < 2; ++is_final) {
+      for (const SupportedMetric* m : metrics_) {
+        // The same tag selection FillReportRequest used to apply per
+        // request.
+        bool tag_matches =
+            (is_first && m->tag == SupportedMetric::START) ||
+            (is_final && (m->tag == SupportedMetric::FINAL ||
+                          m->tag == SupportedMetric::INTERMEDIATE)) ||
+            (!is_final && m->tag == SupportedMetric::INTERMEDIATE);
+        if (!tag_matches) {
+          continue;
+        }
+        if (m->mark == SupportedMetric::PRODUCER_BY_CONSUMER) {
+          by_consumer_metric_plans_[is_first][is_final].push_back(m);
+          continue;
+        }
+        // Consumer metrics are only sent when the request carries an api
+        // key; producer metrics are always sent.
+        report_metric_plans_[is_first][is_final][1].push_back(m);
+        if (m->mark != SupportedMetric::CONSUMER) {
+          report_metric_plans_[is_first][is_final][0].push_back(m);
+        }
+      }
+    }
+  }
+}
+
+void Proto::BuildLogEntrySkeletons() {
+  // The entry name, service_config_id and service_agent fields are
+  // constant for the deployment; render them once here and drop them
+  // from the per-request plan, so FillReportRequest only appends the
+  // variable fields to a copy of the skeleton.
+  LogEntry base;
+  auto* fields = base.mutable_struct_payload()->mutable_fields();
+  for (const SupportedLogField* f : log_field_plan_) {
+    if (strcmp(f->name, kLogFieldNameConfigId) == 0) {
+      (*fields)[f->name].set_string_value(service_config_id_);
+    } else if (strcmp(f->name, kLogFieldNameServiceAgent) == 0) {
+      (*fields)[f->name].set_string_value(kServiceAgentPrefix +
+                                          utils::Version::instance().get());
+    } else {
+      variable_log_field_plan_.push_back(f);
+    }
+  }
+
+  log_entry_skeletons_.reserve(logs_.size());
+  for (const std::string& log : logs_) {
+    log_entry_skeletons_.push_back(base);
+    log_entry_skeletons_.back().set_name(log);
+  }
+}
 
 utils::Status Proto::FillAllocateQuotaRequest(
     const QuotaRequestInfo& info,
@@ -1200,46 +1544,67 @@ utils::Status Proto::FillAllocateQuotaRequest(
   return Status::OK;
 }
 
+namespace {
+
+// Writes the label when value is set and removes the stale copy a
+// recycled request may still carry when it is not.
+void SetOrEraseLabel(const char* name, const std::string& value,
+                     Map<std::string, std::string>* labels) {
+  if (!value.empty()) {
+    (*labels)[name] = value;
+  } else {
+    labels->erase(name);
+  }
+}
+
+}  // namespace
+
 Status Proto::FillCheckRequest(const CheckRequestInfo& info,
                                CheckRequest* request) {
   Status status = VerifyRequiredCheckFields(info);
   if (!status.ok()) {
     return status;
   }
+  // The request may come from the proto pool with the previous check's
+  // contents still in place (see Aggregated::ProtoPool): overwriting a set
+  // field reuses its allocated storage, which keeps the hot path free of
+  // map node and string allocations. Every field is therefore either
+  // assigned unconditionally or erased when this check does not carry it.
   request->set_service_name(service_name_);
   request->set_service_config_id(service_config_id_);
 
   Timestamp current_time = GetCurrentTimestamp();
   Operation* op = request->mutable_operation();
-  SetOperationCommonFields(info, current_time, op);
+  op->set_operation_id(info.operation_id);
+  op->set_operation_name(info.canonical_operation_name());
+  if (!info.api_key.empty()) {
+    std::string* consumer_id = op->mutable_consumer_id();
+    consumer_id->assign(kConsumerIdApiKey);
+    consumer_id->append(info.api_key);
+  } else {
+    op->clear_consumer_id();
+  }
+  *op->mutable_start_time() = current_time;
+  *op->mutable_end_time() = current_time;
 
   auto* labels = op->mutable_labels();
-  if (!info.client_ip.empty()) {
-    (*labels)[kServiceControlCallerIp] = info.client_ip;
-  }
-  if (!info.referer.empty()) {
-    (*labels)[kServiceControlReferer] = info.referer;
-  }
   (*labels)[kServiceControlUserAgent] = kUserAgent;
   (*labels)[kServiceControlServiceAgent] =
       kServiceAgentPrefix + utils::Version::instance().get();
-
-  if (!info.android_package_name.empty()) {
-    (*labels)[kServiceControlAndroidPackageName] = info.android_package_name;
-  }
-  if (!info.android_cert_fingerprint.empty()) {
-    (*labels)[kServiceControlAndroidCertFingerprint] =
-        info.android_cert_fingerprint;
-  }
-  if (!info.ios_bundle_id.empty()) {
-    (*labels)[kServiceControlIosBundleId] = info.ios_bundle_id;
-  }
+  SetOrEraseLabel(kServiceControlCallerIp, info.client_ip, labels);
+  SetOrEraseLabel(kServiceControlReferer, info.referer, labels);
+  SetOrEraseLabel(kServiceControlAndroidPackageName, info.android_package_name,
+                  labels);
+  SetOrEraseLabel(kServiceControlAndroidCertFingerprint,
+                  info.android_cert_fingerprint, labels);
+  SetOrEraseLabel(kServiceControlIosBundleId, info.ios_bundle_id, labels);
 
   return Status::OK;
 }
 
-Status Proto::FillReportRequest(const ReportRequestInfo& info,
-                                ReportRequest* request) {
+Status Proto::FillReportRequest(
+    const ReportRequestInfo& info, ReportRequest* request,
+    std::vector<DistributionSample>* distribution_samples) {
   Status status = VerifyRequiredReportFields(info);
   if (!status.ok()) {
     return status;
@@ -1252,15 +1617,12 @@ Status Proto::FillReportRequest(const ReportRequestInfo& info,
   SetOperationCommonFields(info, current_time, op);
 
   // Only populate metrics if we can associate them with a method/operation.
-  if (!info.operation_id.empty() && !info.operation_name.empty()) {
+  if (!info.operation_id.empty() && !info.canonical_operation_name().empty()) {
     Map<std::string, std::string>* labels = op->mutable_labels();
     // Set all labels with by_consumer_only is false
-    for (auto it = labels_.begin(), end = labels_.end(); it != end; it++) {
-      const SupportedLabel* l = *it;
-      if (l->set && !l->by_consumer_only) {
-        status = (l->set)(*l, info, labels);
-        if (!status.ok()) return status;
-      }
+    for (const SupportedLabel* l : operation_label_plan_) {
+      status = (l->set)(*l, info, labels);
+      if (!status.ok()) return status;
     }
 
     // Not to send consumer metrics if api_key is empty.
@@ -1270,29 +1632,22 @@ Status Proto::FillReportRequest(const ReportRequestInfo& info,
     // 3) the service is not activated for the consumer project.
     bool send_consumer_metric = !info.api_key.empty();
 
-    // Populate all metrics.
-    for (auto it = metrics_.begin(), end = metrics_.end(); it != end; it++) {
-      const SupportedMetric* m = *it;
-      if (send_consumer_metric || m->mark != SupportedMetric::CONSUMER) {
-        if (m->set && m->mark != SupportedMetric::PRODUCER_BY_CONSUMER) {
-          if ((info.is_first_report && m->tag == SupportedMetric::START) ||
-              (info.is_final_report &&
-               (m->tag == SupportedMetric::FINAL ||
-                m->tag == SupportedMetric::INTERMEDIATE)) ||
-              (!info.is_final_report &&
-               m->tag == SupportedMetric::INTERMEDIATE)) {
-            status = (m->set)(*m, info, op);
-            if (!status.ok()) return status;
-          }
-        }
-      }
+    // Populate all metrics from the plan precomputed for this report
+    // shape.
+    const auto& plan =
+        report_metric_plans_[info.is_first_report][info.is_final_report]
+                            [send_consumer_metric];
+    for (const SupportedMetric* m : plan) {
+      status = (m->set)(*m, info, op, distribution_samples);
+      if (!status.ok()) return status;
     }
   }
 
   // Fill log entries.
   if (info.is_final_report) {
-    for (auto it = logs_.begin(), end = logs_.end(); it != end; it++) {
-      FillLogEntry(info, *it, service_config_id_, current_time,
+    for (size_t i = 0; i < log_entry_skeletons_.size(); ++i) {
+      FillLogEntry(info, service_config_id_, current_time,
+                   variable_log_field_plan_, log_entry_skeletons_[i],
                    op->add_log_entries());
     }
   }
@@ -1314,37 +1669,44 @@ utils::Status Proto::AppendByConsumerOperations(
   op->set_operation_id(op->operation_id() + "1");
 
   // Only populate metrics if we can associate them with a method/operation.
-  if (!info.operation_id.empty() && !info.operation_name.empty()) {
+  if (!info.operation_id.empty() && !info.canonical_operation_name().empty()) {
     Map<std::string, std::string>* labels = op->mutable_labels();
-    // Set all labels.
-    for (auto it = labels_.begin(), end = labels_.end(); it != end; it++) {
-      const SupportedLabel* l = *it;
-      if (l->set) {
-        Status status = (l->set)(*l, info, labels);
-        if (!status.ok()) return status;
-      }
+    // Set all labels. The constructors only keep labels with a set
+    // function.
+    for (const SupportedLabel* l : labels_) {
+      Status status = (l->set)(*l, info, labels);
+      if (!status.ok()) return status;
     }
 
-    // Populate all metrics.
-    for (auto it = metrics_.begin(), end = metrics_.end(); it != end; it++) {
-      const SupportedMetric* m = *it;
-      if (m->set && m->mark == SupportedMetric::PRODUCER_BY_CONSUMER) {
-        if ((info.is_first_report && m->tag == SupportedMetric::START) ||
-            (info.is_final_report &&
-             (m->tag == SupportedMetric::FINAL ||
-              m->tag == SupportedMetric::INTERMEDIATE)) ||
-            (!info.is_final_report &&
-             m->tag == SupportedMetric::INTERMEDIATE)) {
-          Status status = (m->set)(*m, info, op);
-          if (!status.ok()) return status;
-        }
-      }
+    // Populate all PRODUCER_BY_CONSUMER metrics from the plan precomputed
+    // for this report shape.
+    const auto& plan =
+        by_consumer_metric_plans_[info.is_first_report][info.is_final_report];
+    for (const SupportedMetric* m : plan) {
+      // By-consumer operations never reach the columnar accumulator, so
+      // their distribution metrics always render into the proto.
+      Status status = (m->set)(*m, info, op, nullptr);
+      if (!status.ok()) return status;
     }
   }
 
   return Status::OK;
 }
 
+Status Proto::AppendDistributionSamples(
+    const std::vector<DistributionSample>& samples, Operation* operation) {
+  for (const auto& sample : samples) {
+    DistributionHelperOptions options;
+    options.buckets = sample.options.num_finite_buckets;
+    options.growth = sample.options.growth_factor;
+    options.scale = sample.options.scale;
+    Status status = AddDistributionMetric(options, sample.metric_name,
+                                          sample.value, operation, nullptr);
+    if (!status.ok()) return status;
+  }
+  return Status::OK;
+}
+
 Status Proto::ConvertAllocateQuotaResponse(
     const ::google::api::servicecontrol::v1::AllocateQuotaResponse& response,
     const std::string& service_name) {
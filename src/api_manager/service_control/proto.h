@@ -22,6 +22,7 @@
 #include "google/protobuf/timestamp.pb.h"
 #include "include/api_manager/utils/status.h"
 #include "src/api_manager/service_control/info.h"
+#include "src/api_manager/service_control/report_accumulator.h"
 
 namespace google {
 namespace api_manager {
@@ -30,14 +31,19 @@ namespace service_control {
 class Proto final {
  public:
   // Initializes Proto with all supported metrics and labels.
+  // log_entry_fields, when non-empty, whitelists the struct payload
+  // fields written to report log entries; fields not listed are left out
+  // of the log field plan and never formatted.
   Proto(const std::set<std::string>& logs, const std::string& service_name,
-        const std::string& service_config_id);
+        const std::string& service_config_id,
+        const std::set<std::string>& log_entry_fields = std::set<std::string>());
 
   // Initializes Proto with specified (and supported) metrics and
   // labels.
   Proto(const std::set<std::string>& logs, const std::set<std::string>& metrics,
         const std::set<std::string>& labels, const std::string& service_name,
-        const std::string& service_config_id);
+        const std::string& service_config_id,
+        const std::set<std::string>& log_entry_fields = std::set<std::string>());
 
   // Fills the CheckRequest protobuf from info.
   // There are some logic inside the Fill functions beside just filling
@@ -57,9 +63,22 @@ class Proto final {
   // Fills the CheckRequest protobuf from info.
   // FillReportRequest function should copy the strings pointed by info.
   // These buffers may be freed after the FillReportRequest call.
+  //
+  // When |distribution_samples| is given, distribution metrics of the
+  // first operation are appended to it as raw samples instead of being
+  // rendered into Distribution protos, so the columnar accumulator can
+  // fold them in with plain bucket increments. A caller that ends up on
+  // the proto path must materialize them with AppendDistributionSamples.
   utils::Status FillReportRequest(
       const ReportRequestInfo& info,
-      ::google::api::servicecontrol::v1::ReportRequest* request);
+      ::google::api::servicecontrol::v1::ReportRequest* request,
+      std::vector<DistributionSample>* distribution_samples = nullptr);
+
+  // Renders raw distribution samples recorded by FillReportRequest into
+  // metric value sets of |operation|.
+  static utils::Status AppendDistributionSamples(
+      const std::vector<DistributionSample>& samples,
+      ::google::api::servicecontrol::v1::Operation* operation);
 
   // Append a new consumer project Operations to the ReportRequest, if customer
   // project id from the CheckResponse is not empty
@@ -87,11 +106,46 @@ class Proto final {
   const std::string& service_config_id() const { return service_config_id_; }
 
  private:
+  // Compiles metrics_ and labels_ into the flat report fill plans below.
+  // Called from the constructors.
+  void BuildReportFillPlans();
+
+  // Pre-renders the per-deployment constant log fields into the log
+  // entry skeletons and compiles the variable log field plan. Called
+  // from the constructors.
+  void BuildLogEntrySkeletons();
+
   const std::vector<std::string> logs_;
   const std::vector<const struct SupportedMetric*> metrics_;
   const std::vector<const struct SupportedLabel*> labels_;
+  // The struct payload fields each report log entry carries, in fill
+  // order; built from the supported fields minus the ones the server
+  // config whitelist excludes.
+  const std::vector<const struct SupportedLogField*> log_field_plan_;
   const std::string service_name_;
   const std::string service_config_id_;
+
+  // Report fill plans precomputed from metrics_ and labels_ at
+  // construction: for each report shape, exactly the metrics to fill, so
+  // FillReportRequest loops over a flat array instead of re-testing each
+  // metric's tag and mark on every request.
+  // Indexed by [is_first_report][is_final_report][send consumer metrics].
+  std::vector<const struct SupportedMetric*> report_metric_plans_[2][2][2];
+  // Same, for the by-consumer operation ([is_first_report]
+  // [is_final_report]; it only carries PRODUCER_BY_CONSUMER metrics).
+  std::vector<const struct SupportedMetric*> by_consumer_metric_plans_[2][2];
+  // The labels of the main operation (by_consumer_only labels excluded).
+  std::vector<const struct SupportedLabel*> operation_label_plan_;
+
+  // The subset of log_field_plan_ that depends on the request; the rest
+  // is pre-rendered into the skeletons below.
+  std::vector<const struct SupportedLogField*> variable_log_field_plan_;
+  // One pre-built log entry per configured log (in logs_ order), holding
+  // the entry name and the payload fields that are constant for the
+  // deployment. FillReportRequest starts each entry from a copy of its
+  // skeleton and appends only the variable fields.
+  std::vector<::google::api::servicecontrol::v1::LogEntry>
+      log_entry_skeletons_;
 };
 
 }  // namespace service_control
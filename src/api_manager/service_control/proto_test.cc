@@ -25,6 +25,7 @@
 #include "google/protobuf/text_format.h"
 #include "include/api_manager/utils/version.h"
 #include "src/api_manager/compute_platform.h"
+#include "src/api_manager/mock_method_info.h"
 
 namespace gasv1 = ::google::api::servicecontrol::v1;
 using ::google::api_manager::utils::Status;
@@ -161,6 +162,34 @@ TEST(Proto, TestProtobufStruct) {
   ASSERT_FALSE(fields->empty());
 }
 
+TEST(Proto, CanonicalFieldsReadThroughMethodInfoTest) {
+  std::string selector = "EchoGetMessage";
+  std::string api_name = "echo-api";
+  std::string api_version = "v1";
+  ::testing::NiceMock<MockMethodInfo> method;
+  ON_CALL(method, selector()).WillByDefault(::testing::ReturnRef(selector));
+  ON_CALL(method, api_name()).WillByDefault(::testing::ReturnRef(api_name));
+  ON_CALL(method, api_version())
+      .WillByDefault(::testing::ReturnRef(api_version));
+
+  // With a resolved method the interned strings are read through it.
+  ReportRequestInfo info;
+  info.method_info = &method;
+  ASSERT_EQ(selector, info.canonical_operation_name());
+  ASSERT_EQ(selector, info.canonical_api_method());
+  ASSERT_EQ(api_name, info.canonical_api_name());
+  ASSERT_EQ(api_version, info.canonical_api_version());
+
+  // Per-request overrides win over the method strings.
+  info.operation_name = "UnrecognizedOperation";
+  ASSERT_EQ("UnrecognizedOperation", info.canonical_operation_name());
+
+  // Without a method only the overrides remain.
+  ReportRequestInfo plain;
+  ASSERT_EQ("", plain.canonical_operation_name());
+  ASSERT_EQ("", plain.canonical_api_method());
+}
+
 TEST_F(ProtoTest, FillGoodCheckRequestTest) {
   CheckRequestInfo info;
   FillOperationInfo(&info);
@@ -245,6 +274,30 @@ TEST_F(ProtoTest, FillNoApiKeyCheckRequestTest) {
   ASSERT_EQ(expected_text, text);
 }
 
+TEST_F(ProtoTest, RefilledCheckRequestDropsStaleFieldsTest) {
+  CheckRequestInfo full_info;
+  FillOperationInfo(&full_info);
+  FillCheckRequestInfo(&full_info);
+  full_info.android_package_name = "com.google.cloud";
+
+  // Fill the same message twice, as the proto pool hands it out without
+  // clearing; fields the second check does not carry must not leak in
+  // from the first.
+  gasv1::CheckRequest request;
+  ASSERT_TRUE(scp_.FillCheckRequest(full_info, &request).ok());
+
+  CheckRequestInfo info;
+  info.operation_id = "operation_id";
+  info.operation_name = "operation_name";
+  info.producer_project_id = "project_id";
+  ASSERT_TRUE(scp_.FillCheckRequest(info, &request).ok());
+
+  std::string text = CheckRequestToString(&request);
+  std::string expected_text =
+      ReadTestBaseline("check_request_no_api_key.golden");
+  ASSERT_EQ(expected_text, text);
+}
+
 TEST_F(ProtoTest, CheckRequestMissingOperationNameTest) {
   CheckRequestInfo info;
   info.operation_id = "operation_id";
@@ -308,6 +361,25 @@ TEST_F(ProtoTest, FillStartReportRequestTest) {
   ASSERT_EQ(expected_text, text);
 }
 
+TEST_F(ProtoTest, FillReportRequestLogEntryFieldWhitelistTest) {
+  Proto scp({"local_test_log"}, "test_service", "2016-09-19r0",
+            {"api_method", "http_response_code"});
+
+  ReportRequestInfo info;
+  FillOperationInfo(&info);
+  FillReportRequestInfo(&info);
+
+  gasv1::ReportRequest request;
+  ASSERT_TRUE(scp.FillReportRequest(info, &request).ok());
+
+  ASSERT_EQ(1, request.operations(0).log_entries_size());
+  const auto& fields =
+      request.operations(0).log_entries(0).struct_payload().fields();
+  ASSERT_EQ(2u, fields.size());
+  ASSERT_NE(fields.end(), fields.find("api_method"));
+  ASSERT_NE(fields.end(), fields.find("http_response_code"));
+}
+
 TEST_F(ProtoTest, FillIntermediateReportRequestTest) {
   ReportRequestInfo info;
   info.is_first_report = false;
@@ -0,0 +1,127 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/service_control/quota_prefetch.h"
+
+#include <algorithm>
+
+using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::Code;
+using std::chrono::system_clock;
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+namespace {
+// The smallest and largest batch of tokens fetched by one AllocateQuota.
+const int64_t kMinPrefetchTokens = 10;
+const int64_t kMaxPrefetchTokens = 10000;
+
+// After the server denies an allocation, serve the denial locally for this
+// long before probing the server again. Unit: milliseconds.
+const int kDenyIntervalMs = 1000;
+
+// A refill is triggered once the bucket drops below half the next batch
+// size, so it completes before the bucket runs dry at a steady rate.
+// To bound memory, all buckets are dropped when their count exceeds this.
+const size_t kMaxBuckets = 10000;
+}  // namespace
+
+QuotaPrefetch::QuotaPrefetch(AllocateFunc allocate) : allocate_(allocate) {}
+
+int64_t QuotaPrefetch::RefillSize(const Bucket& bucket) const {
+  int64_t size = std::max(bucket.observed, bucket.last_window);
+  size = std::max(size, kMinPrefetchTokens);
+  return std::min(size, kMaxPrefetchTokens);
+}
+
+bool QuotaPrefetch::Check(const QuotaRequestInfo& info,
+                          std::function<void(utils::Status)> on_done) {
+  const std::string key =
+      info.method_name + ":" +
+      (info.api_key.empty() ? info.producer_project_id : info.api_key);
+
+  bool handled = false;
+  Status result = Status::OK;
+  int64_t refill_tokens = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buckets_.size() > kMaxBuckets) {
+      buckets_.clear();
+    }
+    Bucket& bucket = buckets_[key];
+    bucket.observed++;
+
+    const system_clock::time_point now = system_clock::now();
+    if (!bucket.deny_status.ok() && now < bucket.deny_until) {
+      // Serve the cached denial without probing the server again until
+      // deny_until has passed.
+      handled = true;
+      result = bucket.deny_status;
+    } else {
+      if (bucket.tokens > 0) {
+        bucket.tokens--;
+        handled = true;
+      }
+      if (!bucket.refill_in_flight && bucket.tokens * 2 <= RefillSize(bucket)) {
+        bucket.refill_in_flight = true;
+        refill_tokens = RefillSize(bucket);
+      }
+    }
+  }
+
+  if (refill_tokens > 0) {
+    Refill(key, info, refill_tokens);
+  }
+  if (handled) {
+    on_done(result);
+  }
+  return handled;
+}
+
+void QuotaPrefetch::Refill(const std::string& key,
+                           const QuotaRequestInfo& info, int64_t tokens) {
+  allocate_(info, tokens, [this, key, tokens](Status status) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = buckets_.find(key);
+    if (it == buckets_.end()) {
+      return;
+    }
+    Bucket& bucket = it->second;
+    bucket.refill_in_flight = false;
+    bucket.last_window = bucket.observed;
+    bucket.observed = 0;
+    if (status.ok()) {
+      bucket.tokens += tokens;
+      bucket.deny_status = Status::OK;
+    } else if (status.code() == Code::RESOURCE_EXHAUSTED ||
+               status.code() == Code::PERMISSION_DENIED ||
+               status.code() == Code::INVALID_ARGUMENT) {
+      // A real server verdict: serve it locally for a short interval.
+      bucket.tokens = 0;
+      bucket.deny_status = status;
+      bucket.deny_until = system_clock::now() +
+                          std::chrono::milliseconds(kDenyIntervalMs);
+    }
+    // On transport errors keep the bucket as is; requests fall back to the
+    // regular AllocateQuota path, which fails open on UNAVAILABLE.
+  });
+}
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,90 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SERVICE_CONTROL_QUOTA_PREFETCH_H_
+#define API_MANAGER_SERVICE_CONTROL_QUOTA_PREFETCH_H_
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "include/api_manager/utils/status.h"
+#include "src/api_manager/service_control/info.h"
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+// Maintains a local token bucket per (method, consumer), replenished by
+// background batched AllocateQuota calls sized from the observed request
+// rate. On the hot path quota is charged by decrementing the local budget;
+// a request only falls back to the blocking AllocateQuota path when the
+// bucket is empty and no verdict from the server is cached.
+class QuotaPrefetch {
+ public:
+  // Issues a batched AllocateQuota for the given request info with every
+  // metric cost multiplied by tokens, calling on_done with the converted
+  // server verdict.
+  typedef std::function<void(const QuotaRequestInfo& info, int tokens,
+                             std::function<void(utils::Status)> on_done)>
+      AllocateFunc;
+
+  explicit QuotaPrefetch(AllocateFunc allocate);
+
+  // Tries to charge the request against the local bucket. Returns true and
+  // calls on_done with the verdict when handled locally; returns false,
+  // without calling on_done, when the caller should take the regular
+  // AllocateQuota path. May trigger a background refill either way.
+  bool Check(const QuotaRequestInfo& info,
+             std::function<void(utils::Status)> on_done);
+
+ private:
+  struct Bucket {
+    Bucket()
+        : tokens(0), observed(0), last_window(0), refill_in_flight(false) {}
+
+    // Locally available tokens.
+    int64_t tokens;
+    // Requests seen since the last completed refill; sizes the next one.
+    int64_t observed;
+    // Demand observed over the previous refill cycle.
+    int64_t last_window;
+    // Whether a refill AllocateQuota is outstanding.
+    bool refill_in_flight;
+    // Last denial from the server; served locally until deny_until.
+    utils::Status deny_status = utils::Status::OK;
+    std::chrono::system_clock::time_point deny_until;
+  };
+
+  // The number of tokens the next refill should request for this bucket.
+  int64_t RefillSize(const Bucket& bucket) const;
+
+  // Issues the background refill for key. Called without mutex_ held.
+  void Refill(const std::string& key, const QuotaRequestInfo& info,
+              int64_t tokens);
+
+  AllocateFunc allocate_;
+
+  // Protects buckets_.
+  std::mutex mutex_;
+  std::unordered_map<std::string, Bucket> buckets_;
+};
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SERVICE_CONTROL_QUOTA_PREFETCH_H_
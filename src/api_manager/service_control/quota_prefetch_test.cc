@@ -0,0 +1,137 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/service_control/quota_prefetch.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::Code;
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+namespace {
+
+class QuotaPrefetchTest : public ::testing::Test {
+ protected:
+  QuotaPrefetchTest()
+      : allocate_calls_(0),
+        last_tokens_(0),
+        allocate_status_(Status::OK),
+        last_status_(Status::OK) {
+    info_.method_name = "ListShelves";
+    info_.api_key = "api-key-1";
+    info_.metric_cost_vector = &metric_costs_;
+    prefetch_.reset(new QuotaPrefetch(
+        [this](const QuotaRequestInfo&, int tokens,
+               std::function<void(Status)> on_done) {
+          allocate_calls_++;
+          last_tokens_ = tokens;
+          on_done(allocate_status_);
+        }));
+  }
+
+  // Runs one Check and returns whether it was handled locally; records the
+  // verdict in last_status_ when it was.
+  bool Check() {
+    return prefetch_->Check(
+        info_, [this](Status status) { last_status_ = status; });
+  }
+
+  QuotaRequestInfo info_;
+  std::vector<std::pair<std::string, int>> metric_costs_;
+  std::unique_ptr<QuotaPrefetch> prefetch_;
+  int allocate_calls_;
+  int last_tokens_;
+  Status allocate_status_;
+  Status last_status_;
+};
+
+TEST_F(QuotaPrefetchTest, FirstRequestFallsBackAndTriggersRefill) {
+  // An empty bucket cannot serve the request, but it kicks off a refill.
+  EXPECT_FALSE(Check());
+  EXPECT_EQ(1, allocate_calls_);
+
+  // The (synchronous) refill has filled the bucket: subsequent requests
+  // are served locally without further allocations.
+  EXPECT_TRUE(Check());
+  EXPECT_TRUE(last_status_.ok());
+  EXPECT_EQ(1, allocate_calls_);
+}
+
+TEST_F(QuotaPrefetchTest, RefillsBeforeBucketRunsDry) {
+  EXPECT_FALSE(Check());
+  int first_batch = last_tokens_;
+  EXPECT_GT(first_batch, 0);
+
+  // Drain the bucket; a refill must be issued before it empties, so every
+  // request keeps being served locally.
+  for (int i = 0; i < 3 * first_batch; ++i) {
+    EXPECT_TRUE(Check());
+    EXPECT_TRUE(last_status_.ok());
+  }
+  EXPECT_GT(allocate_calls_, 1);
+}
+
+TEST_F(QuotaPrefetchTest, AllocationsAreAmortizedOverRequests) {
+  EXPECT_FALSE(Check());
+  for (int i = 0; i < 500; ++i) {
+    EXPECT_TRUE(Check());
+  }
+  // Batched refills keep the AllocateQuota rate well below the request
+  // rate.
+  EXPECT_LT(allocate_calls_, 150);
+}
+
+TEST_F(QuotaPrefetchTest, ServerDenialIsServedLocally) {
+  allocate_status_ =
+      Status(Code::RESOURCE_EXHAUSTED, "Quota exceeded", Status::SERVICE_CONTROL);
+  EXPECT_FALSE(Check());
+  EXPECT_EQ(1, allocate_calls_);
+
+  // The cached denial is served locally without new allocations.
+  EXPECT_TRUE(Check());
+  EXPECT_EQ(Code::RESOURCE_EXHAUSTED, last_status_.code());
+  EXPECT_TRUE(Check());
+  EXPECT_EQ(Code::RESOURCE_EXHAUSTED, last_status_.code());
+  EXPECT_EQ(1, allocate_calls_);
+}
+
+TEST_F(QuotaPrefetchTest, TransportErrorFallsBack) {
+  allocate_status_ = Status(Code::UNAVAILABLE, "Cannot connect");
+  EXPECT_FALSE(Check());
+  // The bucket stays empty; requests keep taking the regular path, which
+  // applies the network fail policy.
+  EXPECT_FALSE(Check());
+}
+
+TEST_F(QuotaPrefetchTest, BucketsAreKeyedByConsumer) {
+  EXPECT_FALSE(Check());
+  EXPECT_TRUE(Check());
+
+  // A different api key starts with its own empty bucket.
+  info_.api_key = "api-key-2";
+  EXPECT_FALSE(Check());
+  EXPECT_EQ(2, allocate_calls_);
+}
+
+}  // namespace
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
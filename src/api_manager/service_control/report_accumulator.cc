@@ -0,0 +1,343 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/service_control/report_accumulator.h"
+
+#include <algorithm>
+#include <cmath>
+
+using ::google::api::servicecontrol::v1::Distribution;
+using ::google::api::servicecontrol::v1::MetricValue;
+using ::google::api::servicecontrol::v1::MetricValueSet;
+using ::google::api::servicecontrol::v1::Operation;
+using ::google::api::servicecontrol::v1::ReportRequest;
+using ::google::protobuf::Timestamp;
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+namespace {
+
+bool TimestampLess(const Timestamp& a, const Timestamp& b) {
+  return a.seconds() < b.seconds() ||
+         (a.seconds() == b.seconds() && a.nanos() < b.nanos());
+}
+
+// Builds the signature of an operation: everything the merge must keep
+// distinct. Metric values merge, so they are not part of it.
+std::string ComposeSignature(
+    const Operation& operation,
+    std::vector<std::pair<std::string, std::string>>* labels) {
+  labels->reserve(operation.labels().size());
+  for (const auto& label : operation.labels()) {
+    labels->emplace_back(label.first, label.second);
+  }
+  // The label map has no deterministic order; sort so identical label
+  // sets compose identical signatures.
+  std::sort(labels->begin(), labels->end());
+
+  std::string signature;
+  signature.reserve(64);
+  signature += operation.operation_name();
+  signature += '\0';
+  signature += operation.consumer_id();
+  for (const auto& label : *labels) {
+    signature += '\0';
+    signature += label.first;
+    signature += '\0';
+    signature += label.second;
+  }
+  return signature;
+}
+
+// Returns the single mergeable value of a metric value set, or nullptr
+// when the set does not have exactly one plain value.
+const MetricValue* GetMergeableValue(const MetricValueSet& value_set) {
+  if (value_set.metric_values_size() != 1) {
+    return nullptr;
+  }
+  const MetricValue& value = value_set.metric_values(0);
+  // Per-value labels and timestamps would be lost by a columnar merge.
+  if (!value.labels().empty() || value.has_start_time() ||
+      value.has_end_time()) {
+    return nullptr;
+  }
+  return &value;
+}
+
+// The histogram bucket of |value| under an exponential layout: bucket 0
+// is the underflow bucket below |scale|, buckets 1..num_finite cover
+// [scale * growth^(i-1), scale * growth^i) and the last bucket overflows.
+// Same layout the service control client's DistributionHelper computes.
+size_t BucketIndex(const DistributionOptions& options, double value) {
+  if (!(value >= options.scale)) {
+    return 0;
+  }
+  const double position =
+      std::log(value / options.scale) / std::log(options.growth_factor);
+  const size_t overflow = options.num_finite_buckets + 1;
+  const size_t bucket = 1 + static_cast<size_t>(position);
+  return bucket < overflow ? bucket : overflow;
+}
+
+}  // namespace
+
+bool ReportAccumulator::CanMerge(const Operation& operation,
+                                 const std::vector<DistributionSample>& samples,
+                                 const Entry* entry) const {
+  for (const auto& value_set : operation.metric_value_sets()) {
+    const MetricValue* value = GetMergeableValue(value_set);
+    if (value == nullptr) {
+      return false;
+    }
+    bool is_distribution;
+    switch (value->value_case()) {
+      case MetricValue::kInt64Value:
+        is_distribution = false;
+        break;
+      case MetricValue::kDistributionValue:
+        // Only exponential buckets appear here and their options are
+        // fixed per metric name, so columns can add bucket arrays.
+        if (!value->distribution_value().has_exponential_buckets()) {
+          return false;
+        }
+        is_distribution = true;
+        break;
+      default:
+        return false;
+    }
+    if (entry == nullptr) {
+      continue;
+    }
+    for (const auto& column : entry->metrics) {
+      if (column.name != value_set.metric_name()) {
+        continue;
+      }
+      if (column.is_distribution != is_distribution) {
+        return false;
+      }
+      if (is_distribution &&
+          column.bucket_counts.size() !=
+              static_cast<size_t>(
+                  value->distribution_value().bucket_counts_size())) {
+        return false;
+      }
+      break;
+    }
+  }
+  if (entry != nullptr) {
+    for (const auto& sample : samples) {
+      for (const auto& column : entry->metrics) {
+        if (column.name != sample.metric_name) {
+          continue;
+        }
+        if (!column.is_distribution ||
+            column.bucket_counts.size() !=
+                static_cast<size_t>(sample.options.num_finite_buckets) + 2) {
+          return false;
+        }
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+bool ReportAccumulator::Add(const Operation& operation,
+                            const std::vector<DistributionSample>& samples) {
+  // Log entries and quota properties are per-request payloads, and high
+  // importance operations must not be delayed by aggregation.
+  if (operation.importance() != Operation::LOW ||
+      operation.log_entries_size() > 0 || operation.has_quota_properties()) {
+    return false;
+  }
+
+  std::vector<std::pair<std::string, std::string>> labels;
+  const std::string signature = ComposeSignature(operation, &labels);
+  auto it = entries_.find(signature);
+  Entry* entry = it != entries_.end() ? &it->second : nullptr;
+  if (!CanMerge(operation, samples, entry)) {
+    return false;
+  }
+
+  if (entry == nullptr) {
+    entry = &entries_[signature];
+    entry->operation_id = operation.operation_id();
+    entry->operation_name = operation.operation_name();
+    entry->consumer_id = operation.consumer_id();
+    entry->start_time = operation.start_time();
+    entry->end_time = operation.end_time();
+    entry->labels = std::move(labels);
+  } else {
+    if (TimestampLess(operation.start_time(), entry->start_time)) {
+      entry->start_time = operation.start_time();
+    }
+    if (TimestampLess(entry->end_time, operation.end_time())) {
+      entry->end_time = operation.end_time();
+    }
+  }
+
+  for (const auto& value_set : operation.metric_value_sets()) {
+    const MetricValue& value = *GetMergeableValue(value_set);
+    // Not every request carries every metric (error counts only appear
+    // on errors), so missing columns are appended.
+    MetricColumn* column = nullptr;
+    for (auto& existing : entry->metrics) {
+      if (existing.name == value_set.metric_name()) {
+        column = &existing;
+        break;
+      }
+    }
+    if (value.value_case() == MetricValue::kInt64Value) {
+      if (column == nullptr) {
+        entry->metrics.emplace_back();
+        column = &entry->metrics.back();
+        column->name = value_set.metric_name();
+        column->is_distribution = false;
+        column->sum = 0;
+      }
+      column->sum += value.int64_value();
+      continue;
+    }
+    const Distribution& distribution = value.distribution_value();
+    if (column == nullptr) {
+      entry->metrics.emplace_back();
+      column = &entry->metrics.back();
+      column->name = value_set.metric_name();
+      column->is_distribution = true;
+      column->count = 0;
+      column->mean = 0;
+      column->sum_of_squared_deviation = 0;
+      column->minimum = 0;
+      column->maximum = 0;
+      column->num_finite_buckets =
+          distribution.exponential_buckets().num_finite_buckets();
+      column->growth_factor =
+          distribution.exponential_buckets().growth_factor();
+      column->scale = distribution.exponential_buckets().scale();
+      column->bucket_counts.assign(distribution.bucket_counts_size(), 0);
+    }
+    if (distribution.count() > 0) {
+      // Parallel merge of the moments; the column holds the combined
+      // count, mean and squared deviation of both sides.
+      double merged = column->count + distribution.count();
+      double delta = distribution.mean() - column->mean;
+      column->sum_of_squared_deviation +=
+          distribution.sum_of_squared_deviation() +
+          delta * delta * column->count * distribution.count() / merged;
+      column->mean += delta * (distribution.count() / merged);
+      if (column->count == 0 || distribution.minimum() < column->minimum) {
+        column->minimum = distribution.minimum();
+      }
+      if (column->count == 0 || distribution.maximum() > column->maximum) {
+        column->maximum = distribution.maximum();
+      }
+      column->count += distribution.count();
+      for (int i = 0; i < distribution.bucket_counts_size(); ++i) {
+        column->bucket_counts[i] += distribution.bucket_counts(i);
+      }
+    }
+  }
+
+  // Raw samples fold straight into the native histograms: a Welford
+  // update of the moments and one bucket increment, no Distribution
+  // proto on the per-request path.
+  for (const auto& sample : samples) {
+    MetricColumn* column = nullptr;
+    for (auto& existing : entry->metrics) {
+      if (existing.name == sample.metric_name) {
+        column = &existing;
+        break;
+      }
+    }
+    if (column == nullptr) {
+      entry->metrics.emplace_back();
+      column = &entry->metrics.back();
+      column->name = sample.metric_name;
+      column->is_distribution = true;
+      column->count = 0;
+      column->mean = 0;
+      column->sum_of_squared_deviation = 0;
+      column->minimum = 0;
+      column->maximum = 0;
+      column->num_finite_buckets = sample.options.num_finite_buckets;
+      column->growth_factor = sample.options.growth_factor;
+      column->scale = sample.options.scale;
+      column->bucket_counts.assign(sample.options.num_finite_buckets + 2, 0);
+    }
+    ++column->count;
+    const double delta = sample.value - column->mean;
+    column->mean += delta / column->count;
+    column->sum_of_squared_deviation += delta * (sample.value - column->mean);
+    if (column->count == 1 || sample.value < column->minimum) {
+      column->minimum = sample.value;
+    }
+    if (column->count == 1 || sample.value > column->maximum) {
+      column->maximum = sample.value;
+    }
+    ++column->bucket_counts[BucketIndex(sample.options, sample.value)];
+  }
+  return true;
+}
+
+bool ReportAccumulator::Drain(ReportRequest* request) {
+  if (entries_.empty()) {
+    return false;
+  }
+  for (const auto& keyed_entry : entries_) {
+    const Entry& entry = keyed_entry.second;
+    Operation* operation = request->add_operations();
+    operation->set_operation_id(entry.operation_id);
+    operation->set_operation_name(entry.operation_name);
+    operation->set_consumer_id(entry.consumer_id);
+    *operation->mutable_start_time() = entry.start_time;
+    *operation->mutable_end_time() = entry.end_time;
+    for (const auto& label : entry.labels) {
+      (*operation->mutable_labels())[label.first] = label.second;
+    }
+    for (const auto& column : entry.metrics) {
+      MetricValueSet* value_set = operation->add_metric_value_sets();
+      value_set->set_metric_name(column.name);
+      MetricValue* value = value_set->add_metric_values();
+      if (!column.is_distribution) {
+        value->set_int64_value(column.sum);
+        continue;
+      }
+      Distribution* distribution = value->mutable_distribution_value();
+      distribution->set_count(column.count);
+      distribution->set_mean(column.mean);
+      distribution->set_sum_of_squared_deviation(
+          column.sum_of_squared_deviation);
+      distribution->set_minimum(column.minimum);
+      distribution->set_maximum(column.maximum);
+      distribution->mutable_exponential_buckets()->set_num_finite_buckets(
+          column.num_finite_buckets);
+      distribution->mutable_exponential_buckets()->set_growth_factor(
+          column.growth_factor);
+      distribution->mutable_exponential_buckets()->set_scale(column.scale);
+      for (const auto count : column.bucket_counts) {
+        distribution->add_bucket_counts(count);
+      }
+    }
+  }
+  entries_.clear();
+  return true;
+}
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
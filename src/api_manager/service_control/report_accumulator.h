@@ -0,0 +1,133 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SERVICE_CONTROL_REPORT_ACCUMULATOR_H_
+#define API_MANAGER_SERVICE_CONTROL_REPORT_ACCUMULATOR_H_
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "google/api/servicecontrol/v1/distribution.pb.h"
+#include "google/api/servicecontrol/v1/operation.pb.h"
+#include "google/api/servicecontrol/v1/service_controller.pb.h"
+#include "google/protobuf/timestamp.pb.h"
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+// The fixed exponential bucket layout of a distribution metric; mirrors
+// Distribution.exponential_buckets.
+struct DistributionOptions {
+  int32_t num_finite_buckets;
+  double growth_factor;
+  double scale;
+};
+
+// One raw distribution sample recorded next to an operation instead of
+// inside it. The proto fill path records these rather than building a
+// Distribution proto per sample; the accumulator folds them into its
+// native histograms with one bucket increment each. |metric_name| points
+// at the static metric table in proto.cc and needs no copy.
+struct DistributionSample {
+  const char* metric_name;
+  double value;
+  DistributionOptions options;
+};
+
+// Columnar accumulator for report operations. Operations with the same
+// signature (operation name, consumer id and labels) are merged into one
+// entry whose metrics live in flat columns: counter metrics as a running
+// sum, distribution metrics as merged distribution state with the bucket
+// counts in a contiguous array. The per-request merge is plain array
+// arithmetic; protos are materialized only when the accumulator drains.
+//
+// Operations carrying log entries or quota properties are per-request
+// payloads that cannot be merged this way; Add() rejects them and the
+// caller keeps sending them through the proto path. Only used on the
+// event loop, so no locking.
+class ReportAccumulator {
+ public:
+  ReportAccumulator() {}
+
+  // Tries to merge |operation| and its raw distribution samples into the
+  // columnar state. Returns false without merging anything when the
+  // operation is not eligible; the caller sends such operations through
+  // the proto path instead (materializing the samples first, see
+  // Proto::AppendDistributionSamples).
+  bool Add(const ::google::api::servicecontrol::v1::Operation& operation,
+           const std::vector<DistributionSample>& samples =
+               std::vector<DistributionSample>());
+
+  // Materializes every accumulated entry into |request| as one operation
+  // per signature and clears the state. Returns false when nothing was
+  // accumulated.
+  bool Drain(::google::api::servicecontrol::v1::ReportRequest* request);
+
+  bool empty() const { return entries_.empty(); }
+
+ private:
+  // One merged metric of an entry.
+  struct MetricColumn {
+    std::string name;
+    bool is_distribution;
+
+    // Running sum of a counter metric.
+    int64_t sum;
+
+    // Merged state of a distribution metric. The exponential bucket
+    // options are fixed per metric, so merging adds the parallel
+    // bucket_counts arrays and combines the moments.
+    int64_t count;
+    double mean;
+    double sum_of_squared_deviation;
+    double minimum;
+    double maximum;
+    int32_t num_finite_buckets;
+    double growth_factor;
+    double scale;
+    std::vector<int64_t> bucket_counts;
+  };
+
+  // All operations merged under one signature.
+  struct Entry {
+    // The id of the first merged operation; entries are dropped on
+    // drain, so each materialized operation carries a fresh id.
+    std::string operation_id;
+    std::string operation_name;
+    std::string consumer_id;
+    ::google::protobuf::Timestamp start_time;
+    ::google::protobuf::Timestamp end_time;
+    std::vector<std::pair<std::string, std::string>> labels;
+    std::vector<MetricColumn> metrics;
+  };
+
+  // Returns whether every metric value of |operation| and every raw
+  // sample can be merged into the columns of |entry| (nullptr when the
+  // signature is new).
+  bool CanMerge(const ::google::api::servicecontrol::v1::Operation& operation,
+                const std::vector<DistributionSample>& samples,
+                const Entry* entry) const;
+
+  // Merged entries keyed by the operation signature.
+  std::unordered_map<std::string, Entry> entries_;
+};
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SERVICE_CONTROL_REPORT_ACCUMULATOR_H_
@@ -0,0 +1,247 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/service_control/report_accumulator.h"
+
+#include "gtest/gtest.h"
+
+using ::google::api::servicecontrol::v1::Distribution;
+using ::google::api::servicecontrol::v1::MetricValue;
+using ::google::api::servicecontrol::v1::Operation;
+using ::google::api::servicecontrol::v1::ReportRequest;
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+namespace {
+
+Operation MakeOperation(const std::string& id, const std::string& name,
+                        int64_t start_seconds, int64_t end_seconds) {
+  Operation operation;
+  operation.set_operation_id(id);
+  operation.set_operation_name(name);
+  operation.set_consumer_id("project:test");
+  operation.mutable_start_time()->set_seconds(start_seconds);
+  operation.mutable_end_time()->set_seconds(end_seconds);
+  (*operation.mutable_labels())["servicecontrol.googleapis.com/protocol"] =
+      "http";
+  return operation;
+}
+
+void AddInt64Metric(Operation* operation, const std::string& name,
+                    int64_t value) {
+  auto* value_set = operation->add_metric_value_sets();
+  value_set->set_metric_name(name);
+  value_set->add_metric_values()->set_int64_value(value);
+}
+
+void AddDistributionMetric(Operation* operation, const std::string& name,
+                           double value) {
+  auto* value_set = operation->add_metric_value_sets();
+  value_set->set_metric_name(name);
+  Distribution* distribution =
+      value_set->add_metric_values()->mutable_distribution_value();
+  distribution->set_count(1);
+  distribution->set_mean(value);
+  distribution->set_minimum(value);
+  distribution->set_maximum(value);
+  distribution->mutable_exponential_buckets()->set_num_finite_buckets(2);
+  distribution->mutable_exponential_buckets()->set_growth_factor(10.0);
+  distribution->mutable_exponential_buckets()->set_scale(1.0);
+  // 4 buckets: underflow, [1, 10), [10, 100), overflow.
+  for (int i = 0; i < 4; ++i) {
+    distribution->add_bucket_counts(i == (value < 10 ? 1 : 2) ? 1 : 0);
+  }
+}
+
+TEST(ReportAccumulator, MergesCountersBySignature) {
+  ReportAccumulator accumulator;
+  for (int i = 0; i < 3; ++i) {
+    Operation operation =
+        MakeOperation("id" + std::to_string(i), "ListShelves", 100 + i,
+                      101 + i);
+    AddInt64Metric(&operation, "request_count", 1);
+    ASSERT_TRUE(accumulator.Add(operation));
+  }
+
+  ReportRequest request;
+  ASSERT_TRUE(accumulator.Drain(&request));
+  ASSERT_TRUE(accumulator.empty());
+  ASSERT_EQ(1, request.operations_size());
+  const Operation& merged = request.operations(0);
+  ASSERT_EQ("id0", merged.operation_id());
+  ASSERT_EQ("ListShelves", merged.operation_name());
+  ASSERT_EQ(100, merged.start_time().seconds());
+  ASSERT_EQ(103, merged.end_time().seconds());
+  ASSERT_EQ(1, merged.metric_value_sets_size());
+  ASSERT_EQ(3, merged.metric_value_sets(0).metric_values(0).int64_value());
+}
+
+TEST(ReportAccumulator, KeepsDistinctSignaturesApart) {
+  ReportAccumulator accumulator;
+  Operation first = MakeOperation("id1", "ListShelves", 100, 101);
+  AddInt64Metric(&first, "request_count", 1);
+  Operation second = MakeOperation("id2", "CreateShelf", 100, 101);
+  AddInt64Metric(&second, "request_count", 1);
+  Operation third = MakeOperation("id3", "ListShelves", 100, 101);
+  (*third.mutable_labels())["response_code"] = "500";
+  AddInt64Metric(&third, "request_count", 1);
+  ASSERT_TRUE(accumulator.Add(first));
+  ASSERT_TRUE(accumulator.Add(second));
+  ASSERT_TRUE(accumulator.Add(third));
+
+  ReportRequest request;
+  ASSERT_TRUE(accumulator.Drain(&request));
+  ASSERT_EQ(3, request.operations_size());
+}
+
+TEST(ReportAccumulator, MergesDistributions) {
+  ReportAccumulator accumulator;
+  Operation first = MakeOperation("id1", "ListShelves", 100, 101);
+  AddDistributionMetric(&first, "request_sizes", 4.0);
+  Operation second = MakeOperation("id2", "ListShelves", 102, 103);
+  AddDistributionMetric(&second, "request_sizes", 12.0);
+  ASSERT_TRUE(accumulator.Add(first));
+  ASSERT_TRUE(accumulator.Add(second));
+
+  ReportRequest request;
+  ASSERT_TRUE(accumulator.Drain(&request));
+  ASSERT_EQ(1, request.operations_size());
+  const Distribution& merged = request.operations(0)
+                                   .metric_value_sets(0)
+                                   .metric_values(0)
+                                   .distribution_value();
+  ASSERT_EQ(2, merged.count());
+  ASSERT_DOUBLE_EQ(8.0, merged.mean());
+  ASSERT_DOUBLE_EQ(4.0, merged.minimum());
+  ASSERT_DOUBLE_EQ(12.0, merged.maximum());
+  ASSERT_EQ(4, merged.bucket_counts_size());
+  ASSERT_EQ(1, merged.bucket_counts(1));
+  ASSERT_EQ(1, merged.bucket_counts(2));
+}
+
+TEST(ReportAccumulator, MergesRawDistributionSamples) {
+  ReportAccumulator accumulator;
+  DistributionSample sample;
+  sample.metric_name = "request_sizes";
+  sample.options.num_finite_buckets = 2;
+  sample.options.growth_factor = 10.0;
+  sample.options.scale = 1.0;
+
+  sample.value = 4.0;
+  ASSERT_TRUE(accumulator.Add(MakeOperation("id1", "ListShelves", 100, 101),
+                              {sample}));
+  sample.value = 12.0;
+  ASSERT_TRUE(accumulator.Add(MakeOperation("id2", "ListShelves", 102, 103),
+                              {sample}));
+  // Below the scale: lands in the underflow bucket.
+  sample.value = 0.5;
+  ASSERT_TRUE(accumulator.Add(MakeOperation("id3", "ListShelves", 104, 105),
+                              {sample}));
+
+  ReportRequest request;
+  ASSERT_TRUE(accumulator.Drain(&request));
+  ASSERT_EQ(1, request.operations_size());
+  const Distribution& merged = request.operations(0)
+                                   .metric_value_sets(0)
+                                   .metric_values(0)
+                                   .distribution_value();
+  ASSERT_EQ(3, merged.count());
+  ASSERT_DOUBLE_EQ(5.5, merged.mean());
+  ASSERT_DOUBLE_EQ(0.5, merged.minimum());
+  ASSERT_DOUBLE_EQ(12.0, merged.maximum());
+  ASSERT_EQ(2, merged.exponential_buckets().num_finite_buckets());
+  ASSERT_DOUBLE_EQ(10.0, merged.exponential_buckets().growth_factor());
+  ASSERT_EQ(4, merged.bucket_counts_size());
+  ASSERT_EQ(1, merged.bucket_counts(0));
+  ASSERT_EQ(1, merged.bucket_counts(1));
+  ASSERT_EQ(1, merged.bucket_counts(2));
+  ASSERT_EQ(0, merged.bucket_counts(3));
+}
+
+TEST(ReportAccumulator, MergesRawSamplesIntoProtoDistributionColumns) {
+  ReportAccumulator accumulator;
+  Operation first = MakeOperation("id1", "ListShelves", 100, 101);
+  AddDistributionMetric(&first, "request_sizes", 4.0);
+  ASSERT_TRUE(accumulator.Add(first));
+
+  DistributionSample sample;
+  sample.metric_name = "request_sizes";
+  sample.options.num_finite_buckets = 2;
+  sample.options.growth_factor = 10.0;
+  sample.options.scale = 1.0;
+  sample.value = 12.0;
+  ASSERT_TRUE(accumulator.Add(MakeOperation("id2", "ListShelves", 102, 103),
+                              {sample}));
+
+  ReportRequest request;
+  ASSERT_TRUE(accumulator.Drain(&request));
+  const Distribution& merged = request.operations(0)
+                                   .metric_value_sets(0)
+                                   .metric_values(0)
+                                   .distribution_value();
+  ASSERT_EQ(2, merged.count());
+  ASSERT_DOUBLE_EQ(8.0, merged.mean());
+  ASSERT_EQ(1, merged.bucket_counts(1));
+  ASSERT_EQ(1, merged.bucket_counts(2));
+}
+
+TEST(ReportAccumulator, AppendsMetricsMissingFromEarlierRequests) {
+  ReportAccumulator accumulator;
+  Operation first = MakeOperation("id1", "ListShelves", 100, 101);
+  AddInt64Metric(&first, "request_count", 1);
+  Operation second = MakeOperation("id2", "ListShelves", 102, 103);
+  AddInt64Metric(&second, "request_count", 1);
+  AddInt64Metric(&second, "error_count", 1);
+  ASSERT_TRUE(accumulator.Add(first));
+  ASSERT_TRUE(accumulator.Add(second));
+
+  ReportRequest request;
+  ASSERT_TRUE(accumulator.Drain(&request));
+  ASSERT_EQ(1, request.operations_size());
+  ASSERT_EQ(2, request.operations(0).metric_value_sets_size());
+}
+
+TEST(ReportAccumulator, RejectsIneligibleOperations) {
+  ReportAccumulator accumulator;
+
+  Operation with_log = MakeOperation("id1", "ListShelves", 100, 101);
+  with_log.add_log_entries()->set_name("endpoints_log");
+  ASSERT_FALSE(accumulator.Add(with_log));
+
+  Operation high = MakeOperation("id2", "ListShelves", 100, 101);
+  high.set_importance(Operation::HIGH);
+  ASSERT_FALSE(accumulator.Add(high));
+
+  Operation labeled_value = MakeOperation("id3", "ListShelves", 100, 101);
+  auto* value_set = labeled_value.add_metric_value_sets();
+  value_set->set_metric_name("request_count");
+  MetricValue* value = value_set->add_metric_values();
+  value->set_int64_value(1);
+  (*value->mutable_labels())["per_value"] = "label";
+  ASSERT_FALSE(accumulator.Add(labeled_value));
+
+  ASSERT_TRUE(accumulator.empty());
+  ReportRequest request;
+  ASSERT_FALSE(accumulator.Drain(&request));
+}
+
+}  // namespace
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,119 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/service_control/report_flush_thread.h"
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+namespace {
+// How often prepared requests are dispatched from the event loop. Reports
+// are fire-and-forget, so a small added delay is harmless.
+const int kDrainIntervalMs = 20;
+}  // namespace
+
+ReportFlushThread::ReportFlushThread(ApiManagerEnvInterface* env)
+    : env_(env), shutdown_(false) {}
+
+ReportFlushThread::~ReportFlushThread() {
+  if (drain_timer_) {
+    drain_timer_->Stop();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  cond_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  // Flush whatever is still queued so reports generated at shutdown are not
+  // lost. The destructor runs on the worker thread, where HTTP dispatch is
+  // safe; the thread is gone so the queues need no lock. Deferred bodies
+  // still have to be built; the transform stays skipped, as before.
+  while (!pending_.empty()) {
+    PendingRequest item = std::move(pending_.front());
+    pending_.pop_front();
+    if (item.build_body) {
+      item.request->set_body(item.build_body());
+    }
+    ready_.push_back(std::move(item.request));
+  }
+  DrainReadyRequests();
+}
+
+void ReportFlushThread::Init() {
+  if (thread_.joinable()) {
+    return;
+  }
+  thread_ = std::thread(&ReportFlushThread::ThreadLoop, this);
+  drain_timer_ =
+      env_->StartPeriodicTimer(std::chrono::milliseconds(kDrainIntervalMs),
+                               [this]() { DrainReadyRequests(); });
+}
+
+void ReportFlushThread::Dispatch(std::unique_ptr<HTTPRequest> request) {
+  Dispatch(std::move(request), BodyBuilder());
+}
+
+void ReportFlushThread::Dispatch(std::unique_ptr<HTTPRequest> request,
+                                 BodyBuilder build_body) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(PendingRequest());
+    pending_.back().request = std::move(request);
+    pending_.back().build_body = std::move(build_body);
+  }
+  cond_.notify_one();
+}
+
+void ReportFlushThread::ThreadLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!shutdown_) {
+    if (pending_.empty()) {
+      cond_.wait(lock);
+      continue;
+    }
+    PendingRequest item = std::move(pending_.front());
+    pending_.pop_front();
+    lock.unlock();
+    if (item.build_body) {
+      item.request->set_body(item.build_body());
+    }
+    if (request_transform_) {
+      request_transform_(item.request.get());
+    }
+    lock.lock();
+    ready_.push_back(std::move(item.request));
+  }
+}
+
+void ReportFlushThread::DrainReadyRequests() {
+  std::deque<std::unique_ptr<HTTPRequest>> ready;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ready.swap(ready_);
+  }
+  while (!ready.empty()) {
+    env_->RunHTTPRequest(std::move(ready.front()));
+    ready.pop_front();
+  }
+}
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,106 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SERVICE_CONTROL_REPORT_FLUSH_THREAD_H_
+#define API_MANAGER_SERVICE_CONTROL_REPORT_FLUSH_THREAD_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "include/api_manager/env_interface.h"
+#include "include/api_manager/http_request.h"
+#include "include/api_manager/periodic_timer.h"
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+// Takes flushed control-plane uploads off the nginx worker event loop.
+// The worker path only links an HTTP request into the pending queue; a
+// background thread prepares the body (serialization via the optional
+// per-request builder, then e.g. compression via the configurable
+// transform) and a short-interval timer dispatches the prepared requests
+// from the event loop, since nginx HTTP requests must be issued there.
+// This keeps flush bursts of large batched ReportRequests - and the
+// trace uploads that reuse this thread - from stalling request
+// processing.
+class ReportFlushThread {
+ public:
+  explicit ReportFlushThread(ApiManagerEnvInterface* env);
+  ~ReportFlushThread();
+
+  // Transform applied to each request on the background thread, e.g. body
+  // compression. Must be set before Init().
+  typedef std::function<void(HTTPRequest*)> RequestTransform;
+  void set_request_transform(RequestTransform transform) {
+    request_transform_ = transform;
+  }
+
+  // Starts the thread and the drain timer. Called from Aggregated::Init();
+  // a periodic timer cannot be started from a constructor.
+  void Init();
+
+  // Hands a report HTTP request over to the thread. Called on the worker
+  // thread.
+  void Dispatch(std::unique_ptr<HTTPRequest> request);
+
+  // Same, for a request whose body is not built yet: the builder runs on
+  // the background thread and its result becomes the request body. Used
+  // by callers whose body serialization is itself expensive (e.g. trace
+  // uploads).
+  typedef std::function<std::string()> BodyBuilder;
+  void Dispatch(std::unique_ptr<HTTPRequest> request, BodyBuilder build_body);
+
+ private:
+  // A queued request together with its deferred body builder, which is
+  // empty for requests dispatched with their body already built.
+  struct PendingRequest {
+    std::unique_ptr<HTTPRequest> request;
+    BodyBuilder build_body;
+  };
+
+  // The background thread body: moves requests from pending to ready,
+  // applying the request transform in between.
+  void ThreadLoop();
+
+  // Runs on the worker thread via the drain timer.
+  void DrainReadyRequests();
+
+  ApiManagerEnvInterface* env_;
+
+  RequestTransform request_transform_;
+
+  // Protects the two queues and shutdown_.
+  std::mutex mutex_;
+  std::condition_variable cond_;
+
+  // Requests waiting for the background thread.
+  std::deque<PendingRequest> pending_;
+  // Prepared requests waiting for the drain timer.
+  std::deque<std::unique_ptr<HTTPRequest>> ready_;
+
+  bool shutdown_;
+  std::thread thread_;
+  std::unique_ptr<PeriodicTimer> drain_timer_;
+};
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SERVICE_CONTROL_REPORT_FLUSH_THREAD_H_
@@ -46,6 +46,9 @@ class ServiceManagementFetch {
   // Fetches ServiceConfig from the ServiceManagement service
   void GetConfig(const std::string& config_id, HttpCallbackFunction callback);
 
+  // ServiceManagement API host url
+  const std::string& host() const { return host_; }
+
  private:
   // Make a http GET request
   void Call(const std::string& url, HttpCallbackFunction on_done);
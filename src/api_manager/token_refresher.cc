@@ -0,0 +1,97 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "src/api_manager/token_refresher.h"
+
+#include "src/api_manager/fetch_metadata.h"
+
+namespace google {
+namespace api_manager {
+
+namespace {
+
+// The refresh timer interval. Unit: seconds.
+const int kTokenRefreshCheckIntervalInS = 10;
+// The maximum jitter subtracted from a token's refresh point. Unit: seconds.
+const int kTokenRefreshJitterInS = 30;
+// Default fraction of a token's lifetime after which it is re-fetched.
+const double kDefaultTokenRefreshFraction = 0.8;
+
+}  // namespace
+
+TokenRefresher::TokenRefresher(
+    std::shared_ptr<context::GlobalContext> global_context)
+    : global_context_(global_context),
+      refresh_fraction_(kDefaultTokenRefreshFraction) {
+  const auto &config = global_context_->server_config();
+  if (config && config->has_metadata_server_config()) {
+    double fraction = config->metadata_server_config().token_refresh_fraction();
+    if (fraction > 0.0 && fraction < 1.0) {
+      refresh_fraction_ = fraction;
+    }
+  }
+
+  static std::random_device random_device;
+  random_generator_.seed(random_device());
+  jitter_dist_.reset(
+      new std::uniform_int_distribution<int>(0, kTokenRefreshJitterInS));
+}
+
+TokenRefresher::~TokenRefresher() {
+  if (timer_) {
+    timer_->Stop();
+  }
+}
+
+void TokenRefresher::Init() {
+  timer_ = global_context_->env()->StartPeriodicTimer(
+      std::chrono::milliseconds(kTokenRefreshCheckIntervalInS * 1000),
+      [this]() { RefreshDueTokens(); });
+}
+
+void TokenRefresher::RefreshDueTokens() {
+  RefreshIfDue(std::string(), global_context_->service_account_token());
+  for (const auto &it : global_context_->instance_identity_token_map()) {
+    RefreshIfDue(it.first, it.second.get());
+  }
+}
+
+void TokenRefresher::RefreshIfDue(const std::string &audience,
+                                  auth::ServiceAccountToken *token) {
+  if (token->has_client_secret() ||
+      token->state() == auth::ServiceAccountToken::FETCHING) {
+    return;
+  }
+  if (token->state() == auth::ServiceAccountToken::FETCHED) {
+    // Refresh once the configured fraction of the lifetime has elapsed.
+    // The jitter pulls the refresh point forward by a random amount each
+    // tick, so the workers spread their fetches over the refresh window.
+    time_t refresh_ahead = static_cast<time_t>(
+        (1.0 - refresh_fraction_) * token->access_token_lifetime());
+    time_t remaining = token->access_token_expiration_time() - time(nullptr);
+    if (remaining > refresh_ahead + (*jitter_dist_)(random_generator_)) {
+      return;
+    }
+    token->set_state(auth::ServiceAccountToken::NONE);
+  }
+  // NONE and FAILED fall through; GlobalFetchServiceAccountToken applies
+  // the back-off window after a failed fetch itself.
+  GlobalFetchServiceAccountToken(global_context_, audience, nullptr,
+                                 [](utils::Status) {});
+}
+
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,67 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_TOKEN_REFRESHER_H_
+#define API_MANAGER_TOKEN_REFRESHER_H_
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "include/api_manager/periodic_timer.h"
+#include "src/api_manager/context/global_context.h"
+
+namespace google {
+namespace api_manager {
+
+// Re-fetches metadata server tokens in the background once a configurable
+// fraction of their lifetime has elapsed, so that a valid token is always
+// at hand and no request has to wait on a token fetch. The refresh moment
+// is jittered so the workers spread their fetches instead of hitting the
+// metadata server in lockstep; a worker that refreshes first publishes the
+// fresh token through the shared token cache for the others.
+class TokenRefresher {
+ public:
+  explicit TokenRefresher(
+      std::shared_ptr<context::GlobalContext> global_context);
+  ~TokenRefresher();
+
+  // Starts the refresh timer. Called from ApiManager::Init(); a periodic
+  // timer cannot be started from a constructor (see
+  // service_control/aggregated.cc).
+  void Init();
+
+ private:
+  // Re-fetches every token past its jittered refresh point.
+  void RefreshDueTokens();
+  void RefreshIfDue(const std::string &audience,
+                    auth::ServiceAccountToken *token);
+
+  std::shared_ptr<context::GlobalContext> global_context_;
+
+  // Fraction of a token's lifetime after which it is re-fetched.
+  double refresh_fraction_;
+
+  // The random objects for the refresh jitter.
+  std::default_random_engine random_generator_;
+  std::unique_ptr<std::uniform_int_distribution<int>> jitter_dist_;
+
+  std::unique_ptr<PeriodicTimer> timer_;
+};
+
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_TOKEN_REFRESHER_H_
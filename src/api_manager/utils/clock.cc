@@ -0,0 +1,53 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "src/api_manager/utils/clock.h"
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+namespace {
+
+CoarseTimeFunc coarse_time_source = nullptr;
+
+CoarseSteadyTimeFunc coarse_steady_time_source = nullptr;
+
+}  // namespace
+
+void SetCoarseTimeSource(CoarseTimeFunc source) {
+  coarse_time_source = source;
+}
+
+std::chrono::system_clock::time_point CoarseNow() {
+  if (coarse_time_source != nullptr) {
+    return coarse_time_source();
+  }
+  return std::chrono::system_clock::now();
+}
+
+void SetCoarseSteadyTimeSource(CoarseSteadyTimeFunc source) {
+  coarse_steady_time_source = source;
+}
+
+std::chrono::steady_clock::time_point CoarseSteadyNow() {
+  if (coarse_steady_time_source != nullptr) {
+    return coarse_steady_time_source();
+  }
+  return std::chrono::steady_clock::now();
+}
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
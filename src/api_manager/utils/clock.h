@@ -0,0 +1,66 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_UTILS_CLOCK_H_
+#define API_MANAGER_UTILS_CLOCK_H_
+
+#include <chrono>
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+// A coarse, cheap wall clock for the request path.
+//
+// The request path reads the wall clock in several places where
+// millisecond resolution is plenty: cache expirations, report
+// timestamps, sampling windows. Each std::chrono::system_clock::now()
+// call is a clock syscall (or at best a vDSO call); the embedder usually
+// already maintains a cached time that the event loop refreshes, and
+// CoarseNow() reads that instead. Callers that measure short durations
+// (e.g. backend latencies) should keep using the precise clocks.
+
+// The source of coarse time installed by the embedder. It must be
+// callable from any thread that uses the api_manager library.
+typedef std::chrono::system_clock::time_point (*CoarseTimeFunc)();
+
+// Installs the coarse time source. Call once at startup, before serving;
+// installation is not synchronized with readers.
+void SetCoarseTimeSource(CoarseTimeFunc source);
+
+// Returns the current wall time from the installed coarse source. Until
+// a source is installed (e.g. in tests and tools), falls back to the
+// precise clock.
+std::chrono::system_clock::time_point CoarseNow();
+
+// The steady counterpart. Pure durations (cache entry TTLs, rate
+// windows) should use it instead of CoarseNow() so a wall clock step
+// (NTP correction, manual adjustment) cannot mass-expire or pin cache
+// entries. Absolute deadlines carried in external data (e.g. a JWT "exp"
+// claim) still belong on the wall clock.
+typedef std::chrono::steady_clock::time_point (*CoarseSteadyTimeFunc)();
+
+// Installs the coarse steady time source; same contract as
+// SetCoarseTimeSource().
+void SetCoarseSteadyTimeSource(CoarseSteadyTimeFunc source);
+
+// Returns the current steady time from the installed coarse source, or
+// the precise steady clock until a source is installed.
+std::chrono::steady_clock::time_point CoarseSteadyNow();
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_UTILS_CLOCK_H_
@@ -0,0 +1,107 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "src/api_manager/utils/format_util.h"
+
+#include <string.h>
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+namespace {
+
+// The decimal digit pairs 00..99, so each table lookup emits two
+// characters.
+const char kTwoDigitTable[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+const char kHexTable[] = "0123456789abcdef";
+
+}  // namespace
+
+size_t FormatUint64(uint64_t value, char *buf) {
+  // Digits are produced low-order first into the end of a scratch
+  // buffer, two per table lookup.
+  char tmp[20];
+  char *p = tmp + sizeof(tmp);
+  while (value >= 100) {
+    const unsigned index = static_cast<unsigned>(value % 100) * 2;
+    value /= 100;
+    *--p = kTwoDigitTable[index + 1];
+    *--p = kTwoDigitTable[index];
+  }
+  if (value >= 10) {
+    const unsigned index = static_cast<unsigned>(value) * 2;
+    *--p = kTwoDigitTable[index + 1];
+    *--p = kTwoDigitTable[index];
+  } else {
+    *--p = static_cast<char>('0' + value);
+  }
+  const size_t len = tmp + sizeof(tmp) - p;
+  memcpy(buf, p, len);
+  return len;
+}
+
+size_t FormatInt64(int64_t value, char *buf) {
+  if (value >= 0) {
+    return FormatUint64(static_cast<uint64_t>(value), buf);
+  }
+  // Negating in unsigned space keeps INT64_MIN well defined.
+  *buf = '-';
+  return 1 + FormatUint64(~static_cast<uint64_t>(value) + 1, buf + 1);
+}
+
+void FormatUint64Fixed(uint64_t value, int width, char *buf) {
+  int i = width;
+  while (i >= 2) {
+    const unsigned index = static_cast<unsigned>(value % 100) * 2;
+    value /= 100;
+    buf[--i] = kTwoDigitTable[index + 1];
+    buf[--i] = kTwoDigitTable[index];
+  }
+  if (i == 1) {
+    buf[0] = static_cast<char>('0' + value % 10);
+  }
+}
+
+void FormatHex64(uint64_t value, char *buf) {
+  for (int i = 15; i >= 0; --i) {
+    buf[i] = kHexTable[value & 0xF];
+    value >>= 4;
+  }
+}
+
+std::string Uint64ToString(uint64_t value) {
+  char buf[20];
+  return std::string(buf, FormatUint64(value, buf));
+}
+
+std::string Int64ToString(int64_t value) {
+  char buf[21];
+  return std::string(buf, FormatInt64(value, buf));
+}
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
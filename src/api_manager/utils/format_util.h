@@ -0,0 +1,55 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_UTILS_FORMAT_UTIL_H_
+#define API_MANAGER_UTILS_FORMAT_UTIL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+// Integer-to-text conversion for the report and trace hot paths.
+// snprintf re-parses its format string and emits one digit at a time;
+// these writers emit two decimal digits per table lookup and hex
+// through a nibble table.
+
+// Writes |value| in decimal into |buf| and returns the number of
+// characters written. |buf| must hold at least 20 characters; no
+// terminator is written.
+size_t FormatUint64(uint64_t value, char *buf);
+
+// As above for signed values; |buf| must hold at least 21 characters.
+size_t FormatInt64(int64_t value, char *buf);
+
+// Writes |value| as exactly |width| zero-padded decimal digits - the
+// low-order digits when the value does not fit. |width| must be <= 20.
+void FormatUint64Fixed(uint64_t value, int width, char *buf);
+
+// Writes |value| as 16 lowercase hex characters, most significant
+// nibble first.
+void FormatHex64(uint64_t value, char *buf);
+
+// Convenience wrappers returning the formatted value as a string.
+std::string Uint64ToString(uint64_t value);
+std::string Int64ToString(int64_t value);
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_UTILS_FORMAT_UTIL_H_
@@ -0,0 +1,90 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/utils/format_util.h"
+
+#include <limits>
+
+#include "gtest/gtest.h"
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+TEST(FormatUtil, FormatUint64) {
+  char buf[20];
+  ASSERT_EQ("0", std::string(buf, FormatUint64(0, buf)));
+  ASSERT_EQ("7", std::string(buf, FormatUint64(7, buf)));
+  ASSERT_EQ("42", std::string(buf, FormatUint64(42, buf)));
+  ASSERT_EQ("100", std::string(buf, FormatUint64(100, buf)));
+  ASSERT_EQ("1234567890", std::string(buf, FormatUint64(1234567890, buf)));
+  ASSERT_EQ("18446744073709551615",
+            std::string(buf, FormatUint64(
+                                 std::numeric_limits<uint64_t>::max(), buf)));
+}
+
+TEST(FormatUtil, FormatInt64) {
+  char buf[21];
+  ASSERT_EQ("0", std::string(buf, FormatInt64(0, buf)));
+  ASSERT_EQ("200", std::string(buf, FormatInt64(200, buf)));
+  ASSERT_EQ("-1", std::string(buf, FormatInt64(-1, buf)));
+  ASSERT_EQ("-404", std::string(buf, FormatInt64(-404, buf)));
+  ASSERT_EQ("9223372036854775807",
+            std::string(buf, FormatInt64(
+                                 std::numeric_limits<int64_t>::max(), buf)));
+  ASSERT_EQ("-9223372036854775808",
+            std::string(buf, FormatInt64(
+                                 std::numeric_limits<int64_t>::min(), buf)));
+}
+
+TEST(FormatUtil, FormatUint64Fixed) {
+  char buf[20];
+  FormatUint64Fixed(7, 3, buf);
+  ASSERT_EQ("007", std::string(buf, 3));
+  FormatUint64Fixed(42, 3, buf);
+  ASSERT_EQ("042", std::string(buf, 3));
+  FormatUint64Fixed(999, 3, buf);
+  ASSERT_EQ("999", std::string(buf, 3));
+  FormatUint64Fixed(0, 4, buf);
+  ASSERT_EQ("0000", std::string(buf, 4));
+  // Values wider than the field keep only the low-order digits.
+  FormatUint64Fixed(123456, 4, buf);
+  ASSERT_EQ("3456", std::string(buf, 4));
+}
+
+TEST(FormatUtil, FormatHex64) {
+  char buf[16];
+  FormatHex64(0, buf);
+  ASSERT_EQ("0000000000000000", std::string(buf, 16));
+  FormatHex64(0xdeadbeefull, buf);
+  ASSERT_EQ("00000000deadbeef", std::string(buf, 16));
+  FormatHex64(0x0123456789abcdefull, buf);
+  ASSERT_EQ("0123456789abcdef", std::string(buf, 16));
+  FormatHex64(std::numeric_limits<uint64_t>::max(), buf);
+  ASSERT_EQ("ffffffffffffffff", std::string(buf, 16));
+}
+
+TEST(FormatUtil, ToString) {
+  ASSERT_EQ("0", Uint64ToString(0));
+  ASSERT_EQ("18446744073709551615",
+            Uint64ToString(std::numeric_limits<uint64_t>::max()));
+  ASSERT_EQ("200", Int64ToString(200));
+  ASSERT_EQ("-503", Int64ToString(-503));
+}
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,64 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/utils/gzip.h"
+
+#include <zlib.h>
+
+using ::google::protobuf::util::error::Code;
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+namespace {
+// windowBits offset that makes zlib emit gzip framing instead of a raw
+// zlib stream.
+const int kGzipWindowBitsOffset = 16;
+// Default memLevel, per the zlib manual.
+const int kGzipMemLevel = 8;
+}  // namespace
+
+Status GzipCompress(const std::string& input, std::string* output) {
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                   MAX_WBITS + kGzipWindowBitsOffset, kGzipMemLevel,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return Status(Code::INTERNAL, "Failed to initialize gzip compression");
+  }
+
+  output->resize(deflateBound(&stream, input.size()));
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  stream.avail_in = input.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&(*output)[0]);
+  stream.avail_out = output->size();
+
+  const int result = deflate(&stream, Z_FINISH);
+  deflateEnd(&stream);
+  if (result != Z_STREAM_END) {
+    return Status(Code::INTERNAL, "Failed to gzip-compress data");
+  }
+  output->resize(stream.total_out);
+  return Status::OK;
+}
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,68 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/utils/gzip.h"
+
+#include <string.h>
+#include <zlib.h>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace google {
+namespace api_manager {
+namespace utils {
+namespace {
+
+// Decompresses a gzip stream with plain zlib, to validate GzipCompress
+// output framing independently.
+std::string Gunzip(const std::string& input) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  EXPECT_EQ(Z_OK, inflateInit2(&stream, MAX_WBITS + 16));
+  std::string output(1 << 20, '\0');
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  stream.avail_in = input.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+  stream.avail_out = output.size();
+  EXPECT_EQ(Z_STREAM_END, inflate(&stream, Z_FINISH));
+  output.resize(stream.total_out);
+  inflateEnd(&stream);
+  return output;
+}
+
+TEST(GzipTest, RoundTrip) {
+  std::string data;
+  for (int i = 0; i < 100000; ++i) {
+    data.push_back(static_cast<char>(i % 251));
+  }
+  std::string compressed;
+  ASSERT_TRUE(GzipCompress(data, &compressed).ok());
+  ASSERT_LT(compressed.size(), data.size());
+  ASSERT_EQ(data, Gunzip(compressed));
+}
+
+TEST(GzipTest, EmptyInput) {
+  std::string compressed;
+  ASSERT_TRUE(GzipCompress(std::string(), &compressed).ok());
+  ASSERT_EQ(std::string(), Gunzip(compressed));
+}
+
+}  // namespace
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
@@ -91,6 +91,10 @@ Status JsonToProto(const std::string& json, Message* message) {
   ::google::protobuf::util::JsonParseOptions options;
   options.ignore_unknown_fields = true;
   std::string binary;
+  // The binary form is smaller than the JSON it came from; reserving up
+  // front avoids repeated reallocation-and-copy of the intermediate buffer
+  // on multi-megabyte payloads such as service configs.
+  binary.reserve(json.size() / 2);
   ::google::protobuf::util::Status status =
       ::google::protobuf::util::JsonToBinaryString(
           GetTypeResolver(), GetTypeUrl(*message), json, &binary, options);
@@ -0,0 +1,55 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "src/api_manager/utils/operation_id.h"
+
+#include <string.h>
+#include <uuid/uuid.h>
+#include <atomic>
+
+#include "src/api_manager/utils/format_util.h"
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+namespace {
+
+// Draws the worker prefix from the entropy pool. Runs once per worker:
+// function-local statics initialize on first use, which happens after
+// nginx forked the workers, so each worker gets its own prefix.
+uint64_t GeneratePrefix() {
+  uuid_t uuid;
+  uuid_generate(uuid);
+  uint64_t prefix;
+  memcpy(&prefix, uuid, sizeof(prefix));
+  return prefix;
+}
+
+}  // namespace
+
+std::string GenerateOperationId() {
+  static const uint64_t prefix = GeneratePrefix();
+  static std::atomic<uint64_t> counter(0);
+
+  char buf[33];
+  FormatHex64(prefix, buf);
+  buf[16] = '-';
+  FormatHex64(counter.fetch_add(1, std::memory_order_relaxed), buf + 17);
+  return std::string(buf, sizeof(buf));
+}
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,38 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_UTILS_OPERATION_ID_H_
+#define API_MANAGER_UTILS_OPERATION_ID_H_
+
+#include <string>
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+// Returns a unique operation id for a service control operation.
+//
+// One id is generated per request, so the generator must not cost
+// randomness: ids are a random 64-bit worker prefix (drawn from the
+// entropy pool once, on the worker's first request) followed by a
+// monotonically increasing counter, both formatted as fixed-width hex.
+// That makes ids unique across workers and restarts without touching
+// the entropy pool or formatting a UUID per request.
+std::string GenerateOperationId();
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_UTILS_OPERATION_ID_H_
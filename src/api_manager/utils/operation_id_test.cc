@@ -0,0 +1,61 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/api_manager/utils/operation_id.h"
+
+#include <set>
+
+#include "gtest/gtest.h"
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+namespace {
+
+bool IsHex(const std::string &s) {
+  for (char c : s) {
+    if (!isxdigit(c)) return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST(OperationId, Format) {
+  std::string id = GenerateOperationId();
+  ASSERT_EQ(33u, id.size());
+  EXPECT_EQ('-', id[16]);
+  EXPECT_TRUE(IsHex(id.substr(0, 16)));
+  EXPECT_TRUE(IsHex(id.substr(17)));
+}
+
+TEST(OperationId, SharedPrefix) {
+  std::string first = GenerateOperationId();
+  std::string second = GenerateOperationId();
+  EXPECT_EQ(first.substr(0, 16), second.substr(0, 16));
+}
+
+TEST(OperationId, Unique) {
+  std::set<std::string> ids;
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_TRUE(ids.insert(GenerateOperationId()).second);
+  }
+}
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
@@ -26,92 +26,201 @@ namespace google {
 namespace api_manager {
 namespace utils {
 
+namespace {
+
+// The canonical ESP error messages. A status constructed from one of
+// these references the interned copy below instead of holding its own
+// std::string, so building and copying it never allocates. Statuses are
+// constructed and copied on every request, mostly with these messages;
+// only truly dynamic messages (those with request data interpolated)
+// pay for a string. The empty message must stay first - it is the
+// common case (Status::OK and the control statuses) and the lookup
+// short-circuits on it.
+constexpr const char* kCanonicalMessages[] = {
+    "",
+    "OK",
+    "Out of memory",
+    "Internal error",
+    "Internal state in error",
+    "Not Found",
+    "Calling check",
+    "Cannot connect",
+    "Cannot parse URL",
+    "Cannot talk to server",
+    "Invalid URL scheme",
+    "Invalid service config",
+    "Invalid signature",
+    "Endpoints not configured.",
+    "Missing esp request context.",
+    "Missing service control client",
+    "Method does not exist.",
+    "Method is not configured in the service config",
+    "Method doesn't allow unregistered callers (callers without "
+    "established identity). Please use API Key or other form of "
+    "API consumer identity to call this API.",
+    "The service does not allow CORS traffic.",
+    "Service control check is not needed",
+    "Project has been deleted.",
+    "Quota check failed.",
+    "Quota exceeded",
+    "Requested entity was not found",
+    "operation_id is required.",
+    "operation_name is required.",
+    "No GRPC backend address specified",
+    "GRPC support is not initialized",
+    "GRPC call could not be started",
+    "Failed to read GRPC response",
+    "Failed to initialize gzip compression",
+    "Failed to gzip-compress data",
+    // Pass-through upstream errors carry the code name from CodeToString()
+    // as their message; the common ones are canonical so brownout-sized
+    // bursts of identical errors stay allocation-free.
+    "BAD_REQUEST",
+    "UNAUTHORIZED",
+    "FORBIDDEN",
+    "NOT_FOUND",
+    "TOO_MANY_REQUESTS",
+    "CLIENT_CLOSED_REQUEST",
+    "INTERNAL_SERVER_ERROR",
+    "NOT_IMPLEMENTED",
+    "BAD_GATEWAY",
+    "SERVICE_UNAVAILABLE",
+    "GATEWAY_TIMEOUT",
+};
+
+constexpr int kNumCanonicalMessages =
+    sizeof(kCanonicalMessages) / sizeof(kCanonicalMessages[0]);
+
+const std::string* NewInternedMessages() {
+  std::string* messages = new std::string[kNumCanonicalMessages];
+  for (int i = 0; i < kNumCanonicalMessages; ++i) {
+    messages[i] = kCanonicalMessages[i];
+  }
+  return messages;
+}
+
+// Returns the interned copy of message, or nullptr if it is not one of
+// the canonical messages. The scan only runs when an error status is
+// built from a literal; copies never re-run it.
+const std::string* FindInternedMessage(const char* message) {
+  static const std::string* interned = NewInternedMessages();
+  if (*message == '\0') {
+    return &interned[0];
+  }
+  for (int i = 1; i < kNumCanonicalMessages; ++i) {
+    if (interned[i].compare(message) == 0) {
+      return &interned[i];
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+Status::Status(int code, const char* message, ErrorCause error_cause)
+    : code_(code == 200 ? Code::OK : code), error_cause_(error_cause) {
+  const std::string* interned = FindInternedMessage(message);
+  if (interned != nullptr) {
+    message_ = interned;
+  } else {
+    owned_message_ = message;
+    message_ = &owned_message_;
+  }
+}
+
+Status::Status(int code, const char* message)
+    : Status(code, message, Status::INTERNAL) {}
+
 Status::Status(int code, const std::string& message, ErrorCause error_cause)
-    : code_(code == 200 ? Code::OK : code),
-      message_(message),
-      error_cause_(error_cause) {}
+    : code_(code == 200 ? Code::OK : code), error_cause_(error_cause) {
+  const std::string* interned = FindInternedMessage(message.c_str());
+  if (interned != nullptr) {
+    message_ = interned;
+  } else {
+    owned_message_ = message;
+    message_ = &owned_message_;
+  }
+}
 
 Status::Status(int code, const std::string& message)
     : Status(code, message, Status::INTERNAL) {}
 
 Status::Status() : Status(Code::OK, "", Status::INTERNAL) {}
 
+Status::Status(const Status& other)
+    : code_(other.code_), error_cause_(other.error_cause_) {
+  if (other.message_ == &other.owned_message_) {
+    owned_message_ = other.owned_message_;
+    message_ = &owned_message_;
+  } else {
+    message_ = other.message_;
+  }
+}
+
+Status& Status::operator=(const Status& other) {
+  code_ = other.code_;
+  error_cause_ = other.error_cause_;
+  if (other.message_ == &other.owned_message_) {
+    owned_message_ = other.owned_message_;
+    message_ = &owned_message_;
+  } else {
+    owned_message_.clear();
+    message_ = other.message_;
+  }
+  return *this;
+}
+
 bool Status::operator==(const Status& x) const {
-  if (code_ != x.code_ || message_ != x.message_ ||
+  if (code_ != x.code_ || *message_ != *x.message_ ||
       error_cause_ != x.error_cause_) {
     return false;
   }
   return true;
 }
 
-/* static */ std::string Status::CodeToString(int code) {
+/* static */ const char* Status::CodeToCString(int code) {
   // NGX error codes are negative. These are generally control codes.
+  // Indexed by -code - 1.
+  static constexpr const char* kNgxCodeNames[] = {
+      "ERROR", "AGAIN", "BUSY", "DONE", "DECLINED", "ABORT",
+  };
   if (code < 0) {
-    switch (code) {
-      case -1:
-        return "ERROR";
-      case -2:
-        return "AGAIN";
-      case -3:
-        return "BUSY";
-      case -4:
-        return "DONE";
-      case -5:
-        return "DECLINED";
-      case -6:
-        return "ABORT";
-      default: {
-        std::ostringstream ngx_out;
-        ngx_out << "UNKNOWN(" << code << ")";
-        return ngx_out.str();
-      }
+    const int index = -code - 1;
+    if (index < static_cast<int>(sizeof(kNgxCodeNames) /
+                                 sizeof(kNgxCodeNames[0]))) {
+      return kNgxCodeNames[index];
     }
+    return nullptr;
   }
 
   // Codes from 0 to 99 are in the protobuf canonical space, so we map those to
-  // their enum names.
+  // their enum names. The canonical codes are contiguous from OK to
+  // UNAUTHENTICATED, so the table is indexed by the code directly.
+  static constexpr const char* kCanonicalCodeNames[] = {
+      "OK",                   // Code::OK = 0
+      "CANCELLED",            // Code::CANCELLED = 1
+      "UNKNOWN",              // Code::UNKNOWN = 2
+      "INVALID_ARGUMENT",     // Code::INVALID_ARGUMENT = 3
+      "DEADLINE_EXCEEDED",    // Code::DEADLINE_EXCEEDED = 4
+      "NOT_FOUND",            // Code::NOT_FOUND = 5
+      "ALREADY_EXISTS",       // Code::ALREADY_EXISTS = 6
+      "PERMISSION_DENIED",    // Code::PERMISSION_DENIED = 7
+      "RESOURCE_EXHAUSTED",   // Code::RESOURCE_EXHAUSTED = 8
+      "FAILED_PRECONDITION",  // Code::FAILED_PRECONDITION = 9
+      "ABORTED",              // Code::ABORTED = 10
+      "OUT_OF_RANGE",         // Code::OUT_OF_RANGE = 11
+      "UNIMPLEMENTED",        // Code::UNIMPLEMENTED = 12
+      "INTERNAL",             // Code::INTERNAL = 13
+      "UNAVAILABLE",          // Code::UNAVAILABLE = 14
+      "DATA_LOSS",            // Code::DATA_LOSS = 15
+      "UNAUTHENTICATED",      // Code::UNAUTHENTICATED = 16
+  };
   if (code < 100) {
-    switch (code) {
-      case Code::OK:
-        return "OK";
-      case Code::CANCELLED:
-        return "CANCELLED";
-      case Code::UNKNOWN:
-        return "UNKNOWN";
-      case Code::INVALID_ARGUMENT:
-        return "INVALID_ARGUMENT";
-      case Code::DEADLINE_EXCEEDED:
-        return "DEADLINE_EXCEEDED";
-      case Code::NOT_FOUND:
-        return "NOT_FOUND";
-      case Code::ALREADY_EXISTS:
-        return "ALREADY_EXISTS";
-      case Code::PERMISSION_DENIED:
-        return "PERMISSION_DENIED";
-      case Code::UNAUTHENTICATED:
-        return "UNAUTHENTICATED";
-      case Code::RESOURCE_EXHAUSTED:
-        return "RESOURCE_EXHAUSTED";
-      case Code::FAILED_PRECONDITION:
-        return "FAILED_PRECONDITION";
-      case Code::ABORTED:
-        return "ABORTED";
-      case Code::OUT_OF_RANGE:
-        return "OUT_OF_RANGE";
-      case Code::UNIMPLEMENTED:
-        return "UNIMPLEMENTED";
-      case Code::INTERNAL:
-        return "INTERNAL";
-      case Code::UNAVAILABLE:
-        return "UNAVAILABLE";
-      case Code::DATA_LOSS:
-        return "DATA_LOSS";
-      default: {
-        std::ostringstream canonical_out;
-        canonical_out << "UNKNOWN(" << code << ")";
-        return canonical_out.str();
-      }
+    if (code < static_cast<int>(sizeof(kCanonicalCodeNames) /
+                                sizeof(kCanonicalCodeNames[0]))) {
+      return kCanonicalCodeNames[code];
     }
+    return nullptr;
   }
 
   // Codes >= 100 are in the HTTP space, so we map to the HTTP meaning. We don't
@@ -200,23 +309,31 @@ bool Status::operator==(const Status& x) const {
       return "SERVICE_UNAVAILABLE";
     case 504:
       return "GATEWAY_TIMEOUT";
-    default: {
-      std::ostringstream http_out;
-      if (code >= 200 && code < 300)
-        http_out << "OK(";
-      else if (code >= 400 && code < 500)
-        http_out << "INVALID_REQUEST(";
-      else if (code >= 500 && code < 600)
-        http_out << "SERVER_ERROR(";
-      else
-        http_out << "UNKNOWN(";
-      http_out << code << ")";
-      return http_out.str();
-    }
+    default:
+      return nullptr;
+  }
+}
+
+/* static */ std::string Status::CodeToString(int code) {
+  const char* name = CodeToCString(code);
+  if (name != nullptr) {
+    return name;
   }
+  // A code without a name; format a generic one with the code attached.
+  std::ostringstream out;
+  if (code >= 200 && code < 300)
+    out << "OK(";
+  else if (code >= 400 && code < 500)
+    out << "INVALID_REQUEST(";
+  else if (code >= 500 && code < 600)
+    out << "SERVER_ERROR(";
+  else
+    out << "UNKNOWN(";
+  out << code << ")";
+  return out.str();
 }
 
-/* static */ std::string Status::ErrorCauseToString(ErrorCause error_cause) {
+/* static */ const char* Status::ErrorCauseToString(ErrorCause error_cause) {
   switch (error_cause) {
     default:
     case INTERNAL:
@@ -240,7 +357,7 @@ bool Status::operator==(const Status& x) const {
 }
 
 ::google::protobuf::util::Status Status::ToProto() const {
-  ::google::protobuf::util::Status result(CanonicalCode(), message_);
+  ::google::protobuf::util::Status result(CanonicalCode(), message());
   return result;
 }
 
@@ -396,7 +513,7 @@ Code Status::CanonicalCode() const {
 ::google::rpc::Status Status::ToCanonicalProto() const {
   ::google::rpc::Status status;
   status.set_code(CanonicalCode());
-  status.set_message(message_);
+  status.set_message(message());
 
   ::google::rpc::DebugInfo info;
   info.set_detail(Status::ErrorCauseToString(error_cause_));
@@ -429,10 +546,10 @@ std::string Status::ToString() const {
   if (code_ == Code::OK) {
     return "OK";
   } else {
-    if (message_.empty()) {
+    if (message().empty()) {
       return Status::CodeToString(code_);
     } else {
-      return Status::CodeToString(code_) + ": " + message_;
+      return Status::CodeToString(code_) + ": " + message();
     }
   }
 }
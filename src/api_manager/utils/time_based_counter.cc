@@ -24,45 +24,45 @@ namespace utils {
 
 TimeBasedCounter::TimeBasedCounter(int window_size, milliseconds duration,
                                    Tick t)
-    : slots_(window_size),
+    : slots_(new Slot[window_size]),
+      window_size_(window_size),
       slot_duration_(duration / window_size),
-      count_(0),
-      tail_(0),
-      last_time_(t) {}
+      origin_time_(t) {}
 
-void TimeBasedCounter::Clear(Tick t) {
-  last_time_ = t;
-  for (size_t i = 0; i < slots_.size(); i++) {
-    slots_[i] = 0;
-  }
-  tail_ = count_ = 0;
+int64_t TimeBasedCounter::SlotId(Tick t) const {
+  return duration_cast<milliseconds>(t - origin_time_).count() /
+         slot_duration_.count();
 }
 
-void TimeBasedCounter::Roll(Tick t) {
-  auto d = duration_cast<milliseconds>(t - last_time_);
-  uint32_t n = uint32_t(d.count() / slot_duration_.count());
-  if (n >= slots_.size()) {
-    Clear(t);
-    return;
-  }
+void TimeBasedCounter::Inc(int n, Tick t) {
+  int64_t id = SlotId(t);
+  Slot& slot = slots_[id % window_size_];
 
-  for (uint32_t i = 0; i < n; i++) {
-    tail_ = (tail_ + 1) % slots_.size();
-    count_ -= slots_[tail_];
-    slots_[tail_] = 0;
-    last_time_ += slot_duration_;
+  int64_t slot_id = slot.id.load(std::memory_order_acquire);
+  if (slot_id != id) {
+    // The ring has wrapped; the first incrementer landing in an expired
+    // slot retags it and drops its stale count. Losers of the race just
+    // add to the already retagged slot.
+    if (slot.id.compare_exchange_strong(slot_id, id,
+                                        std::memory_order_acq_rel)) {
+      slot.count.store(0, std::memory_order_relaxed);
+    }
   }
-}
-
-void TimeBasedCounter::Inc(int n, Tick t) {
-  Roll(t);
-  slots_[tail_] += n;
-  count_ += n;
+  slot.count.fetch_add(n, std::memory_order_relaxed);
 }
 
 int TimeBasedCounter::Count(Tick t) {
-  Roll(t);
-  return count_;
+  int64_t id = SlotId(t);
+  int count = 0;
+  for (int i = 0; i < window_size_; i++) {
+    // Only slots tagged inside the window contribute; expired slots not
+    // yet retagged by an Inc are skipped.
+    int64_t slot_id = slots_[i].id.load(std::memory_order_acquire);
+    if (slot_id > id - window_size_ && slot_id <= id) {
+      count += slots_[i].count.load(std::memory_order_relaxed);
+    }
+  }
+  return count;
 }
 
 }  // namespace utils
@@ -15,8 +15,9 @@
 #ifndef API_MANAGER_UTILS_TIME_BASED_COUNTER_H_
 #define API_MANAGER_UTILS_TIME_BASED_COUNTER_H_
 
+#include <atomic>
 #include <chrono>
-#include <vector>
+#include <memory>
 
 namespace google {
 namespace api_manager {
@@ -25,6 +26,11 @@ namespace utils {
 // Define a counter for the count in a time based window.
 // Each count is associated with a time stamp. The count outside
 // of the window will not be counted.
+//
+// The counter is lock-free: each slot is an atomic counter tagged with
+// the global slot number it belongs to, so concurrent Inc calls never
+// contend on a lock. A slot is reset lazily by the first Inc that lands
+// in it after it expires; Count only sums slots tagged inside the window.
 class TimeBasedCounter {
  public:
   // Define a time stamp type.
@@ -42,16 +48,22 @@ class TimeBasedCounter {
   int Count(Tick t);
 
  private:
-  // Clear the whole window
-  void Clear(Tick t);
-  // Roll the window
-  void Roll(Tick t);
+  // A ring slot: the counts of one slot duration, tagged with the global
+  // slot number they were collected in.
+  struct Slot {
+    std::atomic<int64_t> id;
+    std::atomic<int> count;
 
-  std::vector<int> slots_;
+    Slot() : id(-1), count(0) {}
+  };
+
+  // The global slot number for a time stamp.
+  int64_t SlotId(Tick t) const;
+
+  std::unique_ptr<Slot[]> slots_;
+  int window_size_;
   std::chrono::milliseconds slot_duration_;
-  int count_;
-  int tail_;
-  Tick last_time_;
+  Tick origin_time_;
 };
 
 }  // namespace utils
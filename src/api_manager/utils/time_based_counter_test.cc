@@ -17,6 +17,8 @@
 #include "src/api_manager/utils/time_based_counter.h"
 #include "gtest/gtest.h"
 
+#include <thread>
+
 namespace google {
 namespace api_manager {
 namespace utils {
@@ -36,6 +38,27 @@ TEST(TimeBasedCounterTest, Test1) {
   ASSERT_EQ(c.Count(FakeTime(8)), 1);
 }
 
+TEST(TimeBasedCounterTest, ConcurrentInc) {
+  TimeBasedCounter c(3, std::chrono::milliseconds(3), FakeTime(0));
+
+  // Concurrent increments into the same window must not lose counts.
+  const int kThreads = 4;
+  const int kIncsPerThread = 10000;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; i++) {
+    threads.push_back(std::thread([&c]() {
+      for (int j = 0; j < kIncsPerThread; j++) {
+        c.Inc(1, FakeTime(1));
+      }
+    }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  ASSERT_EQ(c.Count(FakeTime(1)), kThreads * kIncsPerThread);
+}
+
 }  // namespace utils
 }  // namespace api_manager
 }  // namespace google
@@ -0,0 +1,49 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "src/api_manager/utils/token_bucket.h"
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+TokenBucket::TokenBucket(double tokens_per_second, double capacity, Tick t)
+    : rate_(tokens_per_second),
+      capacity_(capacity),
+      tokens_(capacity),
+      last_refill_(t) {}
+
+bool TokenBucket::Acquire(Tick t) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  double elapsed_s =
+      std::chrono::duration_cast<std::chrono::microseconds>(t - last_refill_)
+          .count() /
+      1000000.0;
+  if (elapsed_s > 0) {
+    tokens_ += elapsed_s * rate_;
+    if (tokens_ > capacity_) {
+      tokens_ = capacity_;
+    }
+    last_refill_ = t;
+  }
+  if (tokens_ < 1.0) {
+    return false;
+  }
+  tokens_ -= 1.0;
+  return true;
+}
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,60 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_UTILS_TOKEN_BUCKET_H_
+#define API_MANAGER_UTILS_TOKEN_BUCKET_H_
+
+#include <chrono>
+#include <mutex>
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+// A token bucket: tokens refill continuously at a fixed rate up to the
+// bucket capacity, and each admitted event takes one. Used to budget
+// ESP's own outbound control-plane calls, so their rate flattens at the
+// budget instead of spiking in lockstep with incoming load.
+//
+// Guarded by a mutex: acquisitions are no more frequent than the
+// outbound calls they budget, so contention is negligible.
+class TokenBucket {
+ public:
+  // Define a time stamp type.
+  // Ideally, Now() timestamp should be used inside the functions.
+  // But for easy unit_test, pass the time in.
+  // The input time should be always increasing.
+  typedef std::chrono::time_point<std::chrono::system_clock> Tick;
+
+  // tokens_per_second is the refill rate; capacity the maximum number of
+  // tokens held (the tolerated burst). The bucket starts full.
+  TokenBucket(double tokens_per_second, double capacity, Tick t);
+
+  // Takes one token if available and returns true; returns false when
+  // the bucket is empty.
+  bool Acquire(Tick t);
+
+ private:
+  std::mutex mutex_;
+  const double rate_;
+  const double capacity_;
+  double tokens_;
+  Tick last_refill_;
+};
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_UTILS_TOKEN_BUCKET_H_
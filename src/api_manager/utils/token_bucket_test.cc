@@ -0,0 +1,56 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "src/api_manager/utils/token_bucket.h"
+#include "gtest/gtest.h"
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+std::chrono::time_point<std::chrono::system_clock> FakeTime(int t) {
+  return std::chrono::time_point<std::chrono::system_clock>(
+      std::chrono::milliseconds(t));
+}
+
+TEST(TokenBucketTest, StartsFullAndDrains) {
+  // 1 token/s, capacity 2, so exactly two immediate acquisitions pass.
+  TokenBucket b(1, 2, FakeTime(0));
+  ASSERT_TRUE(b.Acquire(FakeTime(0)));
+  ASSERT_TRUE(b.Acquire(FakeTime(0)));
+  ASSERT_FALSE(b.Acquire(FakeTime(0)));
+}
+
+TEST(TokenBucketTest, RefillsAtRate) {
+  TokenBucket b(10, 1, FakeTime(0));
+  ASSERT_TRUE(b.Acquire(FakeTime(0)));
+  // 10 tokens/s refills one token every 100ms.
+  ASSERT_FALSE(b.Acquire(FakeTime(50)));
+  ASSERT_TRUE(b.Acquire(FakeTime(100)));
+  ASSERT_FALSE(b.Acquire(FakeTime(150)));
+}
+
+TEST(TokenBucketTest, RefillCapsAtCapacity) {
+  TokenBucket b(100, 2, FakeTime(0));
+  // A long idle period must not accumulate more than the capacity.
+  ASSERT_TRUE(b.Acquire(FakeTime(10000)));
+  ASSERT_TRUE(b.Acquire(FakeTime(10000)));
+  ASSERT_FALSE(b.Acquire(FakeTime(10000)));
+}
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
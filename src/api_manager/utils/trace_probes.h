@@ -0,0 +1,45 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_UTILS_TRACE_PROBES_H_
+#define API_MANAGER_UTILS_TRACE_PROBES_H_
+
+// Static tracepoints on ESP hot paths, for request-level profiling in
+// production with perf/bpftrace/systemtap.
+//
+// When the SystemTap SDT header is available at build time, each probe
+// compiles to a USDT probe under the "esp" provider: a single nop until a
+// tracer arms it, so the probes are safe to leave in release builds. The
+// probe argument is the method selector (a NUL-terminated string), so
+// samples can be grouped per API method, e.g.:
+//
+//   bpftrace -e 'usdt:*:esp:check_complete { @[str(arg0)] = count(); }'
+//
+// Without <sys/sdt.h> the macro compiles to nothing.
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define ESP_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef ESP_HAVE_SDT
+#include <sys/sdt.h>
+// Fires probe esp:name carrying the method selector as a C string.
+#define ESP_TRACE_PROBE(name, selector) DTRACE_PROBE1(esp, name, selector)
+#else
+#define ESP_TRACE_PROBE(name, selector)
+#endif
+
+#endif  // API_MANAGER_UTILS_TRACE_PROBES_H_
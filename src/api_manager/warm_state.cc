@@ -0,0 +1,134 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "src/api_manager/warm_state.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+
+namespace google {
+namespace api_manager {
+
+namespace {
+
+// Magic and format version at the start of the snapshot file. Bump the
+// version digit when the snapshot layout changes; files with another
+// magic are ignored and overwritten.
+const char kSnapshotMagic[] = "ESPWARM1\n";
+const size_t kSnapshotMagicSize = sizeof(kSnapshotMagic) - 1;
+
+}  // namespace
+
+bool LoadWarmState(ApiManagerEnvInterface *env,
+                   const std::string &snapshot_file, proto::WarmState *state) {
+  std::ifstream file(snapshot_file, std::ios::in | std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  const std::string entry = contents.str();
+
+  if (entry.size() < kSnapshotMagicSize ||
+      entry.compare(0, kSnapshotMagicSize, kSnapshotMagic) != 0 ||
+      !state->ParseFromArray(
+          entry.data() + kSnapshotMagicSize,
+          static_cast<int>(entry.size() - kSnapshotMagicSize))) {
+    env->LogWarning("Ignoring invalid warm state snapshot: " + snapshot_file);
+    return false;
+  }
+
+  env->LogInfo("Loaded warm state snapshot: " + snapshot_file);
+  return true;
+}
+
+void SaveWarmState(ApiManagerEnvInterface *env,
+                   const std::string &snapshot_file,
+                   const proto::WarmState &state) {
+  // Per-worker temporary name so parallel workers do not clobber each
+  // other's half-written snapshots; the rename into place is atomic.
+  const std::string tmp_path = snapshot_file + ".tmp." +
+                               std::to_string(static_cast<long long>(getpid()));
+
+  std::string serialized;
+  if (!state.SerializeToString(&serialized)) {
+    env->LogWarning("Failed to serialize the warm state snapshot");
+    return;
+  }
+
+  std::ofstream file(tmp_path,
+                     std::ios::out | std::ios::trunc | std::ios::binary);
+  if (!file) {
+    env->LogWarning("Failed to write warm state snapshot: " + snapshot_file);
+    return;
+  }
+  file.write(kSnapshotMagic, kSnapshotMagicSize);
+  file.write(serialized.data(), serialized.size());
+  file.close();
+
+  if (!file || rename(tmp_path.c_str(), snapshot_file.c_str()) != 0) {
+    env->LogWarning("Failed to write warm state snapshot: " + snapshot_file);
+    remove(tmp_path.c_str());
+    return;
+  }
+}
+
+void CollectWarmState(const auth::Certs &certs,
+                      const std::chrono::system_clock::time_point &now,
+                      proto::WarmState *state) {
+  for (const auto &it : certs.issuer_cert_map()) {
+    if (it.second.second <= now) {
+      continue;
+    }
+    const int64_t expiration = static_cast<int64_t>(
+        std::chrono::system_clock::to_time_t(it.second.second));
+
+    // Config versions share issuers; keep the key that expires last.
+    proto::IssuerKeys *keys = nullptr;
+    for (auto &existing : *state->mutable_issuer_keys()) {
+      if (existing.issuer() == it.first) {
+        keys = &existing;
+        break;
+      }
+    }
+    if (keys == nullptr) {
+      keys = state->add_issuer_keys();
+      keys->set_issuer(it.first);
+    } else if (keys->expiration_timestamp() >= expiration) {
+      continue;
+    }
+    keys->set_keys(it.second.first);
+    keys->set_expiration_timestamp(expiration);
+  }
+}
+
+void RestoreWarmState(const proto::WarmState &state,
+                      const std::chrono::system_clock::time_point &now,
+                      auth::Certs *certs) {
+  for (const auto &keys : state.issuer_keys()) {
+    const auto expiration = std::chrono::system_clock::from_time_t(
+        static_cast<time_t>(keys.expiration_timestamp()));
+    if (expiration <= now) {
+      continue;
+    }
+    certs->Update(keys.issuer(), keys.keys(), expiration);
+  }
+}
+
+}  // namespace api_manager
+}  // namespace google
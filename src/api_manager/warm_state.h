@@ -0,0 +1,61 @@
+/* Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_WARM_STATE_H_
+#define API_MANAGER_WARM_STATE_H_
+
+#include <chrono>
+#include <string>
+
+#include "include/api_manager/env_interface.h"
+#include "src/api_manager/auth/certs.h"
+#include "src/api_manager/proto/warm_state.pb.h"
+
+namespace google {
+namespace api_manager {
+
+// Persists warm in-process state across worker restarts. A replacement
+// worker starts with cold caches and pays an elevated-latency window
+// while it re-fetches every issuer's JWKS keys; when a snapshot file is
+// configured, the keys still within their cache lifetime are restored at
+// Init and the window disappears. The snapshot is best effort: a
+// missing, stale or corrupt file just means a cold start.
+
+// Reads the snapshot file into state. Returns false when the file is
+// absent or of another format version; both mean a cold start.
+bool LoadWarmState(ApiManagerEnvInterface *env,
+                   const std::string &snapshot_file, proto::WarmState *state);
+
+// Writes state to the snapshot file. The file is written to a temporary
+// name and renamed into place, so workers racing on the same file see
+// either the old or the new snapshot.
+void SaveWarmState(ApiManagerEnvInterface *env,
+                   const std::string &snapshot_file,
+                   const proto::WarmState &state);
+
+// Merges every key in certs that expires after now into state. A key for
+// an issuer already in state replaces it when it expires later.
+void CollectWarmState(const auth::Certs &certs,
+                      const std::chrono::system_clock::time_point &now,
+                      proto::WarmState *state);
+
+// Installs every key in state that expires after now into certs.
+void RestoreWarmState(const proto::WarmState &state,
+                      const std::chrono::system_clock::time_point &now,
+                      auth::Certs *certs);
+
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_WARM_STATE_H_
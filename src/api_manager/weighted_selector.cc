@@ -16,18 +16,143 @@
 // includes should be ordered. This seems like a bug in clang-format?
 #include "src/api_manager/weighted_selector.h"
 
+#include <algorithm>
+
 namespace google {
 namespace api_manager {
 
+namespace {
+
+// Smoothing factor of the per-entry latency EWMA. Small enough to ride
+// out individual slow requests, large enough to notice a degraded
+// rollout within a few hundred requests.
+const double kLatencyEwmaAlpha = 0.05;
+
+// Rebuild the biased alias table once per this many recorded latencies,
+// so the O(n) rebuild stays off the per-request path.
+const size_t kFeedbackRebuildInterval = 64;
+
+}  // namespace
+
 WeightedSelector::WeightedSelector(
-    std::vector<std::pair<std::string, int>>&& list) {
+    std::vector<std::pair<std::string, int>>&& list)
+    : latency_feedback_(false), min_share_(0.0), records_since_rebuild_(0) {
   list_.swap(list);
-  counts_.resize(list_.size());
-  std::fill(counts_.begin(), counts_.end(), 0);
+  if (list_.size() <= 1) {
+    return;
+  }
+
+  static std::random_device random_device;
+  random_generator_.seed(random_device());
+  random_dist_.reset(new std::uniform_real_distribution<double>(
+      0.0, static_cast<double>(list_.size())));
+
+  std::vector<double> weights(list_.size());
+  for (size_t i = 0; i < list_.size(); ++i) {
+    weights[i] = list_[i].second;
+  }
+  BuildAliasTable(weights);
+}
+
+void WeightedSelector::BuildAliasTable(const std::vector<double>& weights) {
+  double total = 0;
+  for (const auto& weight : weights) {
+    total += weight;
+  }
+
+  // Build the alias table (Vose's method): scale each weight to an average
+  // of 1, then pair each underfull column with an overfull entry as its
+  // alias until every column sums to exactly 1.
+  const size_t size = list_.size();
+  prob_.resize(size);
+  alias_.resize(size);
+  std::vector<double> scaled(size);
+  std::vector<size_t> small, large;
+  for (size_t i = 0; i < size; ++i) {
+    // With no weight at all, fall back to the uniform distribution.
+    scaled[i] = total > 0 ? weights[i] * size / total : 1.0;
+    alias_[i] = i;
+    (scaled[i] < 1.0 ? small : large).push_back(i);
+  }
+  while (!small.empty() && !large.empty()) {
+    size_t s = small.back();
+    small.pop_back();
+    size_t l = large.back();
+    large.pop_back();
+    prob_[s] = scaled[s];
+    alias_[s] = l;
+    scaled[l] -= 1.0 - scaled[s];
+    (scaled[l] < 1.0 ? small : large).push_back(l);
+  }
+  // Entries left over carry no deficit beyond rounding; their columns keep
+  // themselves.
+  while (!large.empty()) {
+    prob_[large.back()] = 1.0;
+    large.pop_back();
+  }
+  while (!small.empty()) {
+    prob_[small.back()] = 1.0;
+    small.pop_back();
+  }
+}
+
+void WeightedSelector::EnableLatencyFeedback(double min_share) {
+  if (list_.size() <= 1) {
+    return;
+  }
+  latency_feedback_ = true;
+  min_share_ = std::min(std::max(min_share, 0.0), 1.0);
+  ewma_ms_.assign(list_.size(), 0.0);
+  records_since_rebuild_ = 0;
+}
+
+void WeightedSelector::RecordLatency(size_t index, int64_t latency_ms) {
+  if (!latency_feedback_ || index >= list_.size() || latency_ms < 0) {
+    return;
+  }
+  double& ewma = ewma_ms_[index];
+  if (ewma == 0.0) {
+    // First sample seeds the average directly.
+    ewma = static_cast<double>(latency_ms);
+  } else {
+    ewma += kLatencyEwmaAlpha * (static_cast<double>(latency_ms) - ewma);
+  }
+  if (++records_since_rebuild_ >= kFeedbackRebuildInterval) {
+    records_since_rebuild_ = 0;
+    RebuildBiasedTable();
+  }
+}
+
+void WeightedSelector::RecordLatency(const std::string& name,
+                                     int64_t latency_ms) {
+  for (size_t i = 0; i < list_.size(); ++i) {
+    if (list_[i].first == name) {
+      RecordLatency(i, latency_ms);
+      return;
+    }
+  }
 }
 
-float WeightedSelector::score(int index) {
-  return float(counts_[index]) / list_[index].second;
+void WeightedSelector::RebuildBiasedTable() {
+  // The fastest entry with samples sets the baseline; every other entry
+  // is scaled down by how much slower it is, but never below min_share_
+  // of its configured weight. Entries without samples yet keep their
+  // configured weight.
+  double best = 0.0;
+  for (const auto& ewma : ewma_ms_) {
+    if (ewma > 0.0 && (best == 0.0 || ewma < best)) {
+      best = ewma;
+    }
+  }
+  std::vector<double> weights(list_.size());
+  for (size_t i = 0; i < list_.size(); ++i) {
+    double bias = 1.0;
+    if (best > 0.0 && ewma_ms_[i] > 0.0) {
+      bias = std::max(best / ewma_ms_[i], min_share_);
+    }
+    weights[i] = list_[i].second * bias;
+  }
+  BuildAliasTable(weights);
 }
 
 const std::string& WeightedSelector::Select() {
@@ -35,24 +160,22 @@ const std::string& WeightedSelector::Select() {
     static std::string empty;
     return empty;
   }
+  return list_[SelectIndex()].first;
+}
 
-  // An optimization for size=1, the most popular case.
-  if (list_.size() == 1) {
-    return list_[0].first;
+size_t WeightedSelector::SelectIndex() {
+  // An optimization for size<=1, the most popular case.
+  if (list_.size() <= 1) {
+    return 0;
   }
 
-  auto min_score = score(0);
-  int min_idx = 0;
-  for (unsigned int i = 1; i < list_.size(); ++i) {
-    auto s = score(i);
-    if (s < min_score) {
-      min_score = s;
-      min_idx = i;
-    }
+  double draw = (*random_dist_)(random_generator_);
+  size_t column = static_cast<size_t>(draw);
+  if (column >= list_.size()) {
+    // Guard the floating point edge case of draw == size.
+    column = list_.size() - 1;
   }
-
-  counts_[min_idx] += 1;
-  return list_[min_idx].first;
+  return draw - column < prob_[column] ? column : alias_[column];
 }
 
 }  // namespace api_manager
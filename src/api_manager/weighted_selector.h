@@ -15,6 +15,9 @@
 #ifndef API_MANAGER_WEIGHTED_SELECTOR_H_
 #define API_MANAGER_WEIGHTED_SELECTOR_H_
 
+#include <cstdint>
+#include <memory>
+#include <random>
 #include <string>
 #include <utility>
 #include <vector>
@@ -24,7 +27,9 @@ namespace api_manager {
 
 // A class to select one entry from a list.
 // Each element in the list is a pair of (name, weight).
-// The selection is based on the weight.
+// The selection is random in proportion to the weights, using an alias
+// table (Vose's method) built once at construction so each selection is
+// O(1) with a single random draw.
 class WeightedSelector {
  public:
   // Input is a list of <name, weight>.
@@ -33,17 +38,52 @@ class WeightedSelector {
   // Make a selection.
   const std::string& Select();
 
+  // Make a selection, returning the index of the selected entry.
+  size_t SelectIndex();
+
+  // Enables latency feedback: RecordLatency() tracks a per-entry EWMA of
+  // request latency and the selection is periodically rebiased away from
+  // entries slower than the fastest one. An entry never drops below
+  // min_share (clamped to [0, 1]) of its configured weight, so a
+  // degraded entry keeps receiving some traffic and can recover.
+  void EnableLatencyFeedback(double min_share);
+
+  // Records one request latency for the entry at |index|. No-op unless
+  // latency feedback is enabled.
+  void RecordLatency(size_t index, int64_t latency_ms);
+
+  // Same, resolving the entry by name. No-op for unknown names.
+  void RecordLatency(const std::string& name, int64_t latency_ms);
+
   const std::vector<std::pair<std::string, int>>& list() { return list_; }
 
  private:
-  // Calculates score = "count / weight" for an element.
-  float score(int index);
+  // Rebuilds prob_/alias_ from the given per-entry weights.
+  void BuildAliasTable(const std::vector<double>& weights);
+
+  // Applies the latency bias to the configured weights and rebuilds the
+  // alias table.
+  void RebuildBiasedTable();
 
   // The list of <name, weight>
   std::vector<std::pair<std::string, int>> list_;
 
-  // The used counts.
-  std::vector<uint64_t> counts_;
+  // The alias table: each column keeps its own entry with probability
+  // prob_[i] and falls through to entry alias_[i] otherwise.
+  std::vector<double> prob_;
+  std::vector<size_t> alias_;
+
+  std::default_random_engine random_generator_;
+
+  // A single draw in [0, size); the integer part picks the column and the
+  // fraction decides between the column and its alias.
+  std::unique_ptr<std::uniform_real_distribution<double>> random_dist_;
+
+  // Latency feedback state; see EnableLatencyFeedback().
+  bool latency_feedback_;
+  double min_share_;
+  std::vector<double> ewma_ms_;
+  size_t records_since_rebuild_;
 };
 
 }  // namespace api_manager
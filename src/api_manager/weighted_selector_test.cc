@@ -31,14 +31,77 @@ TEST(TestWeightedSelector, Single) {
 TEST(TestWeightedSelector, Multiple) {
   WeightedSelector s({{"name1", 20}, {"name2", 30}, {"name3", 50}});
 
+  // Selection is a random draw from the alias table; check the counts
+  // converge to the weights. With 100000 draws, 1% of the total is more
+  // than 7 standard deviations.
+  const int kDraws = 100000;
   std::map<std::string, int> rets;
-  for (int i = 0; i < 100; i++) {
+  for (int i = 0; i < kDraws; i++) {
+    ++rets[s.Select()];
+  }
+
+  ASSERT_NEAR(rets["name1"], kDraws * 0.2, kDraws * 0.01);
+  ASSERT_NEAR(rets["name2"], kDraws * 0.3, kDraws * 0.01);
+  ASSERT_NEAR(rets["name3"], kDraws * 0.5, kDraws * 0.01);
+}
+
+TEST(TestWeightedSelector, LatencyFeedbackBiasesAwayFromSlowEntry) {
+  WeightedSelector s({{"fast", 50}, {"slow", 50}});
+  s.EnableLatencyFeedback(0.1);
+
+  // Feed enough samples to cross several rebuild intervals: the fast
+  // entry is 10x faster, so the slow entry should be pushed down to its
+  // min_share floor of 10% of its configured weight.
+  for (int i = 0; i < 1000; i++) {
+    s.RecordLatency("fast", 10);
+    s.RecordLatency("slow", 100);
+  }
+
+  const int kDraws = 100000;
+  std::map<std::string, int> rets;
+  for (int i = 0; i < kDraws; i++) {
+    ++rets[s.Select()];
+  }
+
+  // Biased weights are 50 and 50 * 0.1 = 5, i.e. a ~9% share for the
+  // slow entry.
+  ASSERT_NEAR(rets["slow"], kDraws * 5.0 / 55.0, kDraws * 0.01);
+  ASSERT_GT(rets["slow"], 0);
+}
+
+TEST(TestWeightedSelector, LatencyFeedbackRecovery) {
+  WeightedSelector s({{"fast", 50}, {"slow", 50}});
+  s.EnableLatencyFeedback(0.0);
+
+  for (int i = 0; i < 1000; i++) {
+    s.RecordLatency("fast", 10);
+    s.RecordLatency("slow", 100);
+  }
+  // The slow entry recovers; its EWMA converges back and the split
+  // should return to the configured 50/50.
+  for (int i = 0; i < 1000; i++) {
+    s.RecordLatency("fast", 10);
+    s.RecordLatency("slow", 10);
+  }
+
+  const int kDraws = 100000;
+  std::map<std::string, int> rets;
+  for (int i = 0; i < kDraws; i++) {
+    ++rets[s.Select()];
+  }
+
+  ASSERT_NEAR(rets["slow"], kDraws * 0.5, kDraws * 0.02);
+}
+
+TEST(TestWeightedSelector, ZeroWeightNeverSelected) {
+  WeightedSelector s({{"name1", 50}, {"name2", 0}, {"name3", 50}});
+
+  std::map<std::string, int> rets;
+  for (int i = 0; i < 1000; i++) {
     ++rets[s.Select()];
   }
 
-  ASSERT_EQ(rets["name1"], 20);
-  ASSERT_EQ(rets["name2"], 30);
-  ASSERT_EQ(rets["name3"], 50);
+  ASSERT_EQ(rets["name2"], 0);
 }
 
 }  // namespace
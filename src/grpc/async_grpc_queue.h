@@ -26,11 +26,78 @@
 #ifndef GRPC_ASYNC_GRPC_QUEUE_H_
 #define GRPC_ASYNC_GRPC_QUEUE_H_
 
+#include <new>
+#include <type_traits>
+#include <utility>
+
 #include <grpc++/grpc++.h>
 
 namespace google {
 namespace api_manager {
 
+// A move-only callable with the completion-queue callback signature
+// void(bool ok).  Unlike std::function, the closure is stored inline, so
+// queueing a continuation costs only the single tag allocation made by
+// MakeTag() instead of an additional closure allocation per completion
+// queue event.  The inline buffer is sized for the library's
+// continuations, which capture a few shared_ptrs and a small value or
+// two; larger closures fail to compile.
+class TagFunction {
+ public:
+  TagFunction(TagFunction &&other)
+      : invoke_(other.invoke_),
+        relocate_(other.relocate_),
+        destroy_(other.destroy_) {
+    if (invoke_ != nullptr) {
+      relocate_(&other.storage_, &storage_);
+      other.invoke_ = nullptr;
+    }
+  }
+
+  template <typename F,
+            typename = typename std::enable_if<!std::is_same<
+                typename std::decay<F>::type, TagFunction>::value>::type>
+  TagFunction(F callback)
+      : invoke_(&Ops<F>::Invoke),
+        relocate_(&Ops<F>::Relocate),
+        destroy_(&Ops<F>::Destroy) {
+    static_assert(sizeof(F) <= sizeof(storage_),
+                  "closure too large for TagFunction's inline storage");
+    new (&storage_) F(std::move(callback));
+  }
+
+  ~TagFunction() {
+    if (invoke_ != nullptr) {
+      destroy_(&storage_);
+    }
+  }
+
+  void operator()(bool ok) { invoke_(&storage_, ok); }
+
+ private:
+  TagFunction(const TagFunction &) = delete;
+  TagFunction &operator=(const TagFunction &) = delete;
+
+  // The manual vtable over the type-erased closure held in storage_.
+  template <typename F>
+  struct Ops {
+    static void Invoke(void *storage, bool ok) {
+      (*static_cast<F *>(storage))(ok);
+    }
+    static void Relocate(void *from, void *to) {
+      F *callback = static_cast<F *>(from);
+      new (to) F(std::move(*callback));
+      callback->~F();
+    }
+    static void Destroy(void *storage) { static_cast<F *>(storage)->~F(); }
+  };
+
+  void (*invoke_)(void *, bool);
+  void (*relocate_)(void *, void *);
+  void (*destroy_)(void *);
+  typename std::aligned_storage<96, alignof(void *)>::type storage_;
+};
+
 // An interface to an asynchronous GRPC queue, wrapping tag-creation
 // functionality with a GRPC queue backed by an executor that will run
 // the callbacks used to create the tags.
@@ -42,7 +109,7 @@ class AsyncGrpcQueue {
   // operation invoked using the GRPC completion queue returned by
   // GetQueue().  Each tag is valid for exactly one asynchronous call,
   // and must be used for a call (or the tag's memory will be leaked).
-  virtual void *MakeTag(std::function<void(bool)> callback) = 0;
+  virtual void *MakeTag(TagFunction callback) = 0;
 
   // This method returns a GRPC completion queue.  All tags queued to
   // the completion queue must be created by calling MakeTag().
@@ -26,19 +26,62 @@
 //
 #include "src/grpc/message_serializer.h"
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <utility>
+
 #include "grpc++/support/byte_buffer.h"
 
 namespace google {
 namespace api_manager {
 namespace grpc {
 
+namespace {
+
+// The default spill threshold. Large enough that only pathological
+// messages (bulk exports and the like) pay the disk round trip; regular
+// streaming traffic stays on the in-memory path.
+const size_t kDefaultSpillThreshold = 16 * 1024 * 1024;
+
+// The size of the chunks a spilled payload is read back in. Bounds the
+// resident memory of a spilled message to one chunk.
+const size_t kSpillChunkSize = 64 * 1024;
+
+// Writes count bytes to fd, retrying short writes and EINTR.
+bool WriteFully(int fd, const unsigned char* data, size_t count) {
+  while (count > 0) {
+    ssize_t written = ::write(fd, data, count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    count -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+}  // namespace
+
 GrpcMessageSerializer::GrpcMessageSerializer()
-    : delimiter_consumed_(false), current_slice_no_(0), byte_count_(0) {}
+    : delimiter_consumed_(false),
+      current_slice_no_(0),
+      byte_count_(0),
+      spill_threshold_(kDefaultSpillThreshold),
+      coalesce_capacity_(0) {}
 
 GrpcMessageSerializer::~GrpcMessageSerializer() {
   while (!messages_.empty()) {
-    if (messages_.front().second) {
-      grpc_byte_buffer_destroy(messages_.front().first);
+    PendingMessage& m = messages_.front();
+    if (m.spill_fd >= 0) {
+      ::close(m.spill_fd);
+    } else if (m.owned) {
+      grpc_byte_buffer_destroy(m.message);
     }
     messages_.pop_front();
   }
@@ -46,10 +89,58 @@ GrpcMessageSerializer::~GrpcMessageSerializer() {
 
 void GrpcMessageSerializer::AddMessage(grpc_byte_buffer* message,
                                        bool take_ownership) {
-  messages_.emplace_back(message, take_ownership);
+  PendingMessage m;
+  m.message = message;
+  m.owned = take_ownership;
+  m.compressed = (message->data.raw.compression != GRPC_COMPRESS_NONE);
+  m.length = grpc_byte_buffer_length(message);
+  m.spill_fd = -1;
+  m.spill_offset = 0;
 
   // Adding the message size + 5 bytes for the delimiter.
-  byte_count_ += grpc_byte_buffer_length(message) + kMessageDelimiterSize;
+  byte_count_ += m.length + kMessageDelimiterSize;
+
+  if (spill_threshold_ > 0 && m.length >= spill_threshold_) {
+    int fd = SpillToTempFile(message);
+    if (fd >= 0) {
+      // The payload now lives in the spill file; the byte buffer (and
+      // its memory) can go away immediately.
+      m.spill_fd = fd;
+      m.message = nullptr;
+      if (take_ownership) {
+        grpc_byte_buffer_destroy(message);
+      }
+      m.owned = false;
+    }
+    // If the spill failed the message simply stays in memory.
+  }
+
+  messages_.push_back(std::move(m));
+}
+
+int GrpcMessageSerializer::SpillToTempFile(grpc_byte_buffer* message) {
+  char path[] = "/tmp/esp_grpc_spill_XXXXXX";
+  int fd = ::mkstemp(path);
+  if (fd < 0) {
+    return -1;
+  }
+  // Unlink immediately: the kernel reclaims the space when the descriptor
+  // is closed, even if the worker dies with spills outstanding.
+  ::unlink(path);
+
+  grpc_slice_buffer* slice_buffer = &message->data.raw.slice_buffer;
+  for (size_t i = 0; i < slice_buffer->count; ++i) {
+    if (!WriteFully(fd, GRPC_SLICE_START_PTR(slice_buffer->slices[i]),
+                    GRPC_SLICE_LENGTH(slice_buffer->slices[i]))) {
+      ::close(fd);
+      return -1;
+    }
+  }
+  if (::lseek(fd, 0, SEEK_SET) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
 }
 
 bool GrpcMessageSerializer::Next(const unsigned char** data, size_t* size) {
@@ -68,25 +159,35 @@ bool GrpcMessageSerializer::NextInternal(const unsigned char** data,
     return false;
   }
 
-  // Check that if we have exhausted the current buffer.
-  if (delimiter_consumed_ &&
-      current_slice_no_ >=
-          messages_.front().first->data.raw.slice_buffer.count) {
-    // The current buffer has been consumed, destroy it if needed
-    if (messages_.front().second) {
+  // Check that if we have exhausted the current message.
+  PendingMessage* front = &messages_.front();
+  bool exhausted;
+  if (front->spill_fd >= 0) {
+    exhausted = delimiter_consumed_ && front->spill_offset >= front->length;
+  } else {
+    exhausted =
+        delimiter_consumed_ &&
+        current_slice_no_ >= front->message->data.raw.slice_buffer.count;
+  }
+  if (exhausted) {
+    // The current message has been consumed; release it.
+    if (front->spill_fd >= 0) {
+      ::close(front->spill_fd);
+    } else if (front->owned) {
       // Destroy it if the ownership was transferred to GrpcMessageSerializer
-      grpc_byte_buffer_destroy(messages_.front().first);
+      grpc_byte_buffer_destroy(front->message);
     }
     messages_.pop_front();
 
-    // Reset the state for processing the next buffer
+    // Reset the state for processing the next message
     delimiter_consumed_ = false;
     current_slice_no_ = 0;
-  }
 
-  // If there are no more buffers, return false
-  if (messages_.empty()) {
-    return false;
+    // If there are no more messages, return false
+    if (messages_.empty()) {
+      return false;
+    }
+    front = &messages_.front();
   }
 
   if (!delimiter_consumed_) {
@@ -96,12 +197,8 @@ bool GrpcMessageSerializer::NextInternal(const unsigned char** data,
     // is:
     // * A one-byte compressed-flag
     // * A four-byte message length
-    unsigned int msglen = static_cast<unsigned int>(
-        grpc_byte_buffer_length(messages_.front().first));
-    delimiter_[0] =
-        (messages_.front().first->data.raw.compression == GRPC_COMPRESS_NONE
-             ? 0
-             : 1);
+    unsigned int msglen = static_cast<unsigned int>(front->length);
+    delimiter_[0] = front->compressed ? 1 : 0;
     delimiter_[4] = msglen & 0xFF;
     msglen >>= 8;
     delimiter_[3] = msglen & 0xFF;
@@ -119,9 +216,58 @@ bool GrpcMessageSerializer::NextInternal(const unsigned char** data,
     return true;
   }
 
+  if (front->spill_fd >= 0) {
+    // Stream the spilled payload back one chunk at a time. The chunk
+    // buffer is only valid until the next call, which matches the
+    // ZeroCopyInputStream contract.
+    if (!spill_chunk_) {
+      spill_chunk_.reset(new unsigned char[kSpillChunkSize]);
+    }
+    size_t want =
+        std::min(kSpillChunkSize, front->length - front->spill_offset);
+    ssize_t got;
+    do {
+      got = ::read(front->spill_fd, spill_chunk_.get(), want);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) {
+      // Reads from the unlinked spill file should not fail: the space was
+      // committed when the message was written. If one does, end the
+      // stream rather than serve a corrupt message.
+      byte_count_ -= front->length - front->spill_offset;
+      front->spill_offset = front->length;
+      return false;
+    }
+    front->spill_offset += static_cast<size_t>(got);
+    byte_count_ -= static_cast<size_t>(got);
+    *data = spill_chunk_.get();
+    *size = static_cast<size_t>(got);
+    return true;
+  }
+
   // At this point we know that the delimiter has been consumed and we must
   // have a regular slice to return.
-  auto slice_buffer = &messages_.front().first->data.raw.slice_buffer;
+  auto slice_buffer = &front->message->data.raw.slice_buffer;
+  if (current_slice_no_ == 0 && slice_buffer->count > 1) {
+    // The payload spans slices. Coalesce it once into the reused
+    // contiguous buffer (its size is known from the message header), so
+    // the parser downstream always sees a linear message and never has
+    // to push bytes back across a slice boundary.
+    if (coalesce_capacity_ < front->length) {
+      coalesce_buffer_.reset(new unsigned char[front->length]);
+      coalesce_capacity_ = front->length;
+    }
+    unsigned char* out = coalesce_buffer_.get();
+    for (size_t i = 0; i < slice_buffer->count; ++i) {
+      memcpy(out, GRPC_SLICE_START_PTR(slice_buffer->slices[i]),
+             GRPC_SLICE_LENGTH(slice_buffer->slices[i]));
+      out += GRPC_SLICE_LENGTH(slice_buffer->slices[i]);
+    }
+    current_slice_no_ = slice_buffer->count;
+    byte_count_ -= front->length;
+    *data = coalesce_buffer_.get();
+    *size = front->length;
+    return true;
+  }
   *data = GRPC_SLICE_START_PTR(slice_buffer->slices[current_slice_no_]);
   *size = static_cast<int>(
       GRPC_SLICE_LENGTH(slice_buffer->slices[current_slice_no_]));
@@ -27,6 +27,7 @@
 #define GRPC_MESSAGE_SERIALIZER_H_
 
 #include <deque>
+#include <memory>
 
 #include "grpc++/support/byte_buffer.h"
 
@@ -53,26 +54,50 @@ class GrpcMessageSerializer {
   void AddMessage(grpc_byte_buffer* message, bool take_ownership);
 
   // Returns the next non-empty buffer of the serialized gRPC messages.
+  // A payload spanning multiple slices is coalesced once into a reused
+  // contiguous buffer and returned whole, so the callers downstream
+  // always parse linear messages and never push bytes back across a
+  // slice boundary.
   bool Next(const unsigned char** data, size_t* size);
 
   // Returns the total number of bytes available for Next() to return until all
   // the messages added via AddMessage() are exhausted.
   size_t ByteCount() const { return byte_count_; }
 
+  // Messages whose payload is at least this many bytes are spilled to an
+  // unlinked temporary file when added and streamed back out in fixed-size
+  // chunks, so one oversized message does not hold its full payload in
+  // memory while it drains. 0 disables spilling.
+  void set_spill_threshold(size_t bytes) { spill_threshold_ = bytes; }
+
  private:
+  // A queued message: either a gRPC byte buffer held in memory or an
+  // unlinked temporary file the payload was spilled into.
+  struct PendingMessage {
+    grpc_byte_buffer* message;  // null if the payload was spilled
+    bool owned;                 // whether message is owned by the serializer
+    bool compressed;            // the delimiter compressed-flag
+    size_t length;              // the payload length in bytes
+    int spill_fd;               // -1 if the payload is in memory
+    size_t spill_offset;        // payload bytes already returned
+  };
+
   // Returns the next buffer of the serialized gRPC messages. Unlike the public
   // Next() function this might return empty buffer (i.e. *size == 0).
   bool NextInternal(const unsigned char** data, size_t* size);
 
+  // Writes the message payload to a new unlinked temporary file and returns
+  // its descriptor, or -1 if the file could not be written (the message then
+  // stays in memory).
+  static int SpillToTempFile(grpc_byte_buffer* message);
+
   static const size_t kMessageDelimiterSize = 5;
 
   // Memory for message delimiters.
   unsigned char delimiter_[kMessageDelimiterSize];
 
-  // The queue of the messages to be serialized. With each message we keep a
-  // boolean flag that indicates whether the ownership is with
-  // GrpcMessageSerializer or not.
-  std::deque<std::pair<grpc_byte_buffer*, bool>> messages_;
+  // The queue of the messages to be serialized.
+  std::deque<PendingMessage> messages_;
 
   // Whether the delimiter of the current message was consumed or not
   bool delimiter_consumed_;
@@ -82,6 +107,19 @@ class GrpcMessageSerializer {
 
   // The number of unprocessed bytes
   size_t byte_count_;
+
+  // The spill threshold; see set_spill_threshold().
+  size_t spill_threshold_;
+
+  // Scratch buffer the spilled payload chunks are read back into.
+  // Allocated on first use.
+  std::unique_ptr<unsigned char[]> spill_chunk_;
+
+  // Scratch buffer multi-slice payloads are coalesced into, reused across
+  // messages and grown to the largest coalesced payload. Like spill_chunk_
+  // its contents are only valid until the next Next() call.
+  std::unique_ptr<unsigned char[]> coalesce_buffer_;
+  size_t coalesce_capacity_;
 };
 
 }  // namespace grpc
@@ -29,9 +29,11 @@
 #include "grpc/grpc.h"
 #include "grpc/support/alloc.h"
 #include "include/api_manager/utils/status.h"
+#include "src/api_manager/utils/trace_probes.h"
 #include "src/core/lib/slice/b64.h"
 
 using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::DEADLINE_EXCEEDED;
 using ::google::protobuf::util::error::UNAVAILABLE;
 using ::google::protobuf::util::error::UNKNOWN;
 using std::chrono::system_clock;
@@ -114,7 +116,7 @@ namespace grpc {
 //  +-+                 +-----------------+---------+           |
 //  +-+                 |                           |           |
 //                      v                           v           |
-//                UpstreamFinish         DownstreamWriteMessage |
+//                UpstreamFinish         DownstreamWriteBatch   |
 //                      +                           |           |
 //                      |                           +-----------+
 //                      v
@@ -122,9 +124,30 @@ namespace grpc {
 //
 // All transitions labeled [success] also define an implicit
 // transition to "DownstreamFinish" in case of error.
+//
+// Methods known to be non-streaming on both sides skip the state machine
+// above entirely and run a short unary sequence instead:
+//
+//   UnaryRequestRead -> UnaryCall -> DownstreamUnaryResponse
+//                                          +
+//                                          v
+//                                   DownstreamFinish
+//
+// The single request message is buffered, sent as one unary upstream
+// call (a single completion-queue event covers the whole upstream
+// exchange), and the response is delivered in one coalesced downstream
+// write together with the trailers.
 
 namespace {
 
+// Message budget for the upstream->downstream write queue. Up to this many
+// messages (and write_queue_max_bytes_ payload bytes) are drained from the
+// upstream while a downstream write is in flight, then submitted as one
+// coalesced write; beyond them upstream reads are paused for flow control.
+// High-rate streams of small messages thus pay one downstream write (and
+// one completion-queue wakeup) per batch rather than per message.
+const size_t kMaxWriteQueueMessages = 64;
+
 const std::unordered_set<std::string> kHeadersToSkip = {
     // gRPC requests (HTTP2) with a host header will lead some gRPC servers to
     // reject it, so the host header is skipped here.
@@ -140,6 +163,12 @@ const std::unordered_set<std::string> kHeadersToSkip = {
     // GRPC lib will add following headers, so removing them.
     "grpc-encoding",
     "grpc-accept-encoding",
+
+    // Regenerated by the GRPC lib from the upstream context deadline, which
+    // is the client's original budget minus the time ESP has already spent
+    // on the call; forwarding the client's raw value would grant the
+    // backend time that has already elapsed.
+    "grpc-timeout",
 };
 
 // The headers to prefix with "x-forwarded-"
@@ -149,37 +178,41 @@ const std::unordered_set<std::string> kHeadersToAddPrefix = {
     "user-agent",
 };
 
-Status ProcessDownstreamHeaders(
-    const std::multimap<std::string, std::string> &headers,
-    ::grpc::ClientContext *context) {
-  for (const auto &it : headers) {
-    if (kHeadersToSkip.find(it.first) != kHeadersToSkip.end()) {
-      continue;
+Status ProcessDownstreamHeaders(ServerCall *server_call,
+                                ::grpc::ClientContext *context) {
+  // The headers are visited in place on the downstream call; only the
+  // headers actually passed upstream are copied, into the client context.
+  server_call->ForEachHeader([context](const ::grpc::string_ref &key_ref,
+                                       const ::grpc::string_ref &value_ref) {
+    std::string key(key_ref.data(), key_ref.size());
+    if (kHeadersToSkip.find(key) != kHeadersToSkip.end()) {
+      return;
     }
     // GRPC runtime libraries use "-bin" suffix to detect binary headers and
     // properly apply base64 encoding & decoding as headers are sent and
     // received. So we decode here before passing it to GRPC runtime.
-    if (grpc_is_binary_header(::grpc::SliceReferencingString(it.first))) {
+    if (grpc_is_binary_header(::grpc::SliceReferencingString(key))) {
       // Workaround for https://github.com/grpc/grpc/issues/8624
-      if (it.second.length() == 0) {
-        continue;
+      if (value_ref.size() == 0) {
+        return;
       }
       ::grpc::Slice value_slice(
-          grpc_base64_decode_with_len(it.second.c_str(), it.second.length(),
+          grpc_base64_decode_with_len(value_ref.data(), value_ref.size(),
                                       false),
           ::grpc::Slice::STEAL_REF);
       std::string binary_value(
           reinterpret_cast<const char *>(value_slice.begin()),
           value_slice.size());
-      context->AddMetadata(it.first, std::move(binary_value));
+      context->AddMetadata(key, std::move(binary_value));
     } else {
-      if (kHeadersToAddPrefix.find(it.first) != kHeadersToSkip.end()) {
-        context->AddMetadata("x-forwarded-" + it.first, it.second);
+      std::string value(value_ref.data(), value_ref.size());
+      if (kHeadersToAddPrefix.find(key) != kHeadersToSkip.end()) {
+        context->AddMetadata("x-forwarded-" + key, std::move(value));
       } else {
-        context->AddMetadata(it.first, it.second);
+        context->AddMetadata(key, std::move(value));
       }
     }
-  }
+  });
   return Status::OK;
 }
 
@@ -218,28 +251,54 @@ Status ProcessUpstreamHeaders(
 void ProxyFlow::Start(AsyncGrpcQueue *async_grpc_queue,
                       std::shared_ptr<ServerCall> server_call,
                       std::shared_ptr<::grpc::GenericStub> upstream_stub,
-                      const std::string &method,
-                      const std::multimap<std::string, std::string> &headers) {
+                      const std::string &method, bool unary,
+                      size_t write_queue_bytes) {
   auto flow = std::make_shared<ProxyFlow>(
-      async_grpc_queue, std::move(server_call), upstream_stub);
-  Status status = ProcessDownstreamHeaders(headers, &flow->upstream_context_);
-  if (status.ok()) {
-    ProxyFlow::StartUpstreamCall(flow, method);
-  } else {
+      async_grpc_queue, std::move(server_call), upstream_stub,
+      write_queue_bytes);
+  Status status = ProcessDownstreamHeaders(flow->server_call_.get(),
+                                           &flow->upstream_context_);
+  if (!status.ok()) {
     ProxyFlow::StartDownstreamFinish(flow, status);
+    return;
+  }
+  system_clock::time_point deadline = flow->server_call_->deadline();
+  if (deadline != system_clock::time_point::max()) {
+    if (deadline <= system_clock::now()) {
+      // The client's budget was used up by ESP's own processing; the
+      // backend could not possibly answer in time, so don't ask it to.
+      ProxyFlow::StartDownstreamFinish(
+          flow, Status(DEADLINE_EXCEEDED,
+                       std::string("deadline exceeded before the backend "
+                                   "call was started")));
+      return;
+    }
+    flow->upstream_context_.set_deadline(deadline);
+  }
+  if (unary) {
+    ProxyFlow::StartUnaryRequestRead(flow, method);
+  } else {
+    ProxyFlow::StartUpstreamCall(flow, method);
   }
 }
 
 ProxyFlow::ProxyFlow(AsyncGrpcQueue *async_grpc_queue,
                      std::shared_ptr<ServerCall> server_call,
-                     std::shared_ptr<::grpc::GenericStub> upstream_stub)
+                     std::shared_ptr<::grpc::GenericStub> upstream_stub,
+                     size_t write_queue_bytes)
     : sent_upstream_writes_done_(false),
       started_upstream_finish_(false),
+      upstream_reads_done_(false),
+      downstream_write_in_flight_(false),
+      upstream_read_paused_(false),
       sent_downstream_finish_(false),
+      unary_request_read_(false),
       async_grpc_queue_(async_grpc_queue),
       server_call_(std::move(server_call)),
       upstream_stub_(std::move(upstream_stub)),
-      status_from_esp_(Status::OK) {}
+      status_from_esp_(Status::OK),
+      upstream_to_downstream_queue_bytes_(0),
+      write_queue_max_bytes_(write_queue_bytes) {}
 
 Status ProxyFlow::StatusFromGRPCStatus(const ::grpc::Status &status) {
   // The GRPC error code space happens to match the protocol buffer
@@ -248,13 +307,14 @@ Status ProxyFlow::StatusFromGRPCStatus(const ::grpc::Status &status) {
   return Status(status.error_code(), status.error_message());
 }
 
-void ProxyFlow::StartUpstreamCall(std::shared_ptr<ProxyFlow> flow,
+void ProxyFlow::StartUpstreamCall(const std::shared_ptr<ProxyFlow> &flow,
                                   const std::string &method) {
   // Note: the lock must be held around the Call call, since it's
   // important that the callback not attempt to use
   // upstream_reader_writer_ until it's been initialized.
   // Fortunately, the callback completion function runs
   // asynchronously.
+  ESP_TRACE_PROBE(upstream_call_start, method.c_str());
   flow->start_time_ = system_clock::now();
   std::lock_guard<std::mutex> lock(flow->mu_);
   flow->upstream_reader_writer_ = flow->upstream_stub_->Call(
@@ -271,7 +331,8 @@ void ProxyFlow::StartUpstreamCall(std::shared_ptr<ProxyFlow> flow,
       }));
 }
 
-void ProxyFlow::StartDownstreamReadMessage(std::shared_ptr<ProxyFlow> flow) {
+void ProxyFlow::StartDownstreamReadMessage(
+    const std::shared_ptr<ProxyFlow> &flow) {
   {
     std::lock_guard<std::mutex> lock(flow->mu_);
     if (flow->sent_downstream_finish_) {
@@ -289,7 +350,7 @@ void ProxyFlow::StartDownstreamReadMessage(std::shared_ptr<ProxyFlow> flow) {
                            });
 }
 
-void ProxyFlow::StartUpstreamWritesDone(std::shared_ptr<ProxyFlow> flow,
+void ProxyFlow::StartUpstreamWritesDone(const std::shared_ptr<ProxyFlow> &flow,
                                         utils::Status status) {
   {
     std::lock_guard<std::mutex> lock(flow->mu_);
@@ -314,7 +375,8 @@ void ProxyFlow::StartUpstreamWritesDone(std::shared_ptr<ProxyFlow> flow,
       }));
 }
 
-void ProxyFlow::StartUpstreamWriteMessage(std::shared_ptr<ProxyFlow> flow,
+void ProxyFlow::StartUpstreamWriteMessage(
+    const std::shared_ptr<ProxyFlow> &flow,
                                           bool last) {
   ::grpc::WriteOptions options;
   if (last) {
@@ -345,7 +407,7 @@ void ProxyFlow::StartUpstreamWriteMessage(std::shared_ptr<ProxyFlow> flow,
 }
 
 void ProxyFlow::StartUpstreamReadInitialMetadata(
-    std::shared_ptr<ProxyFlow> flow) {
+    const std::shared_ptr<ProxyFlow> &flow) {
   {
     std::lock_guard<std::mutex> lock(flow->mu_);
     if (flow->sent_downstream_finish_) {
@@ -367,7 +429,7 @@ void ProxyFlow::StartUpstreamReadInitialMetadata(
 }
 
 void ProxyFlow::StartDownstreamWriteInitialMetadata(
-    std::shared_ptr<ProxyFlow> flow) {
+    const std::shared_ptr<ProxyFlow> &flow) {
   std::multimap<std::string, std::string> initial_metadata;
   {
     std::lock_guard<std::mutex> lock(flow->mu_);
@@ -386,7 +448,8 @@ void ProxyFlow::StartDownstreamWriteInitialMetadata(
   });
 }
 
-void ProxyFlow::StartUpstreamReadMessage(std::shared_ptr<ProxyFlow> flow) {
+void ProxyFlow::StartUpstreamReadMessage(
+    const std::shared_ptr<ProxyFlow> &flow) {
   {
     std::lock_guard<std::mutex> lock(flow->mu_);
     if (flow->sent_downstream_finish_) {
@@ -397,37 +460,106 @@ void ProxyFlow::StartUpstreamReadMessage(std::shared_ptr<ProxyFlow> flow) {
       &flow->upstream_to_downstream_buffer_,
       flow->async_grpc_queue_->MakeTag([flow](bool ok) {
         if (!ok) {
-          StartUpstreamFinish(flow);
+          bool queue_drained;
+          {
+            std::lock_guard<std::mutex> lock(flow->mu_);
+            flow->upstream_reads_done_ = true;
+            queue_drained = !flow->downstream_write_in_flight_ &&
+                            flow->upstream_to_downstream_queue_.empty();
+          }
+          // If messages are still queued for the downstream, the last
+          // write completion issues the upstream Finish instead.
+          if (queue_drained) {
+            StartUpstreamFinish(flow);
+          }
           return;
         }
-        StartDownstreamWriteMessage(flow);
+        bool start_next_read;
+        {
+          std::lock_guard<std::mutex> lock(flow->mu_);
+          flow->upstream_to_downstream_queue_.push_back(
+              flow->upstream_to_downstream_buffer_);
+          flow->upstream_to_downstream_queue_bytes_ +=
+              flow->upstream_to_downstream_buffer_.Length();
+          flow->upstream_to_downstream_buffer_.Clear();
+          // Keep reading ahead of the downstream writes until the queue
+          // budget is hit; the next completed write resumes the reads.
+          start_next_read =
+              flow->upstream_to_downstream_queue_.size() <
+                  kMaxWriteQueueMessages &&
+              flow->upstream_to_downstream_queue_bytes_ <
+                  flow->write_queue_max_bytes_;
+          flow->upstream_read_paused_ = !start_next_read;
+        }
+        if (start_next_read) {
+          StartUpstreamReadMessage(flow);
+        }
+        StartDownstreamWriteBatch(flow);
       }));
 }
 
-void ProxyFlow::StartDownstreamWriteMessage(std::shared_ptr<ProxyFlow> flow) {
+void ProxyFlow::StartDownstreamWriteBatch(
+    const std::shared_ptr<ProxyFlow> &flow) {
+  std::vector<::grpc::ByteBuffer> batch;
+  bool last = false;
   {
     std::lock_guard<std::mutex> lock(flow->mu_);
-    if (flow->sent_downstream_finish_) {
+    if (flow->sent_downstream_finish_ || flow->downstream_write_in_flight_ ||
+        flow->upstream_to_downstream_queue_.empty()) {
       return;
     }
+    while (!flow->upstream_to_downstream_queue_.empty()) {
+      ::grpc::ByteBuffer &msg = flow->upstream_to_downstream_queue_.front();
+      flow->upstream_to_downstream_queue_bytes_ -= msg.Length();
+      batch.push_back(msg);
+      flow->upstream_to_downstream_queue_.pop_front();
+    }
+    flow->downstream_write_in_flight_ = true;
+    // The queue is drained, so if the upstream reads are done this batch is
+    // the last one before the trailers; let the server call hold it back
+    // and send it together with the Finish().
+    last = flow->upstream_reads_done_;
   }
-  flow->server_call_->UpdateResponseMessageStat(
-      static_cast<int64_t>(flow->upstream_to_downstream_buffer_.Length()));
-  flow->server_call_->Write(
-      flow->upstream_to_downstream_buffer_, [flow](bool ok) {
-        if (!ok) {
-          StartDownstreamFinish(
-              flow,
-              Status(UNKNOWN,
-                     std::string(
-                         "failed to send a message to the downstream client")));
-          return;
-        }
-        StartUpstreamReadMessage(flow);
-      });
+  for (const auto &msg : batch) {
+    flow->server_call_->UpdateResponseMessageStat(
+        static_cast<int64_t>(msg.Length()));
+  }
+  flow->server_call_->WriteBatch(std::move(batch), last, [flow](bool ok) {
+    if (!ok) {
+      {
+        std::lock_guard<std::mutex> lock(flow->mu_);
+        flow->downstream_write_in_flight_ = false;
+      }
+      StartDownstreamFinish(
+          flow,
+          Status(UNKNOWN,
+                 std::string(
+                     "failed to send a message to the downstream client")));
+      return;
+    }
+    bool resume_read = false;
+    bool finish_upstream = false;
+    {
+      std::lock_guard<std::mutex> lock(flow->mu_);
+      flow->downstream_write_in_flight_ = false;
+      if (flow->upstream_read_paused_ && !flow->upstream_reads_done_) {
+        flow->upstream_read_paused_ = false;
+        resume_read = true;
+      }
+      finish_upstream = flow->upstream_reads_done_ &&
+                        flow->upstream_to_downstream_queue_.empty();
+    }
+    if (resume_read) {
+      StartUpstreamReadMessage(flow);
+    }
+    StartDownstreamWriteBatch(flow);
+    if (finish_upstream) {
+      StartUpstreamFinish(flow);
+    }
+  });
 }
 
-void ProxyFlow::StartUpstreamFinish(std::shared_ptr<ProxyFlow> flow) {
+void ProxyFlow::StartUpstreamFinish(const std::shared_ptr<ProxyFlow> &flow) {
   {
     std::lock_guard<std::mutex> lock(flow->mu_);
     if (flow->started_upstream_finish_) {
@@ -441,8 +573,11 @@ void ProxyFlow::StartUpstreamFinish(std::shared_ptr<ProxyFlow> flow) {
           [flow](bool ok) { StartDownstreamFinish(flow, Status::OK); }));
 }
 
-void ProxyFlow::StartDownstreamFinish(std::shared_ptr<ProxyFlow> flow,
-                                      Status status) {
+void ProxyFlow::StartDownstreamFinish(
+    const std::shared_ptr<ProxyFlow> &flow_ref, Status status) {
+  // Finishing the server call can release the closure that owns the
+  // caller's reference, so hold a reference of our own for the duration.
+  std::shared_ptr<ProxyFlow> flow(flow_ref);
   {
     std::lock_guard<std::mutex> lock(flow->mu_);
     if (flow->sent_downstream_finish_) {
@@ -470,7 +605,130 @@ void ProxyFlow::StartDownstreamFinish(std::shared_ptr<ProxyFlow> flow,
   flow->server_call_->Finish(status, std::move(response_trailers));
 }
 
-void ProxyFlow::RegisterGrpcUpstreamCancel(std::shared_ptr<ProxyFlow> flow) {
+void ProxyFlow::StartUnaryRequestRead(const std::shared_ptr<ProxyFlow> &flow,
+                                      const std::string &method) {
+  {
+    std::lock_guard<std::mutex> lock(flow->mu_);
+    if (flow->sent_downstream_finish_) {
+      return;
+    }
+  }
+  flow->server_call_->Read(
+      &flow->downstream_to_upstream_buffer_,
+      [flow, method](bool proceed, utils::Status status) {
+        if (!proceed) {
+          if (!status.ok()) {
+            StartDownstreamFinish(flow, status);
+            return;
+          }
+          // The downstream half-closed cleanly; the single request
+          // message must have been buffered by a previous read.
+          if (!flow->unary_request_read_) {
+            StartDownstreamFinish(
+                flow, Status(UNKNOWN,
+                             std::string("missing request message on a "
+                                         "non-streaming method")));
+            return;
+          }
+          StartUnaryCall(flow, method);
+          return;
+        }
+        if (flow->unary_request_read_) {
+          StartDownstreamFinish(
+              flow, Status(UNKNOWN,
+                           std::string("more than one request message on a "
+                                       "non-streaming method")));
+          return;
+        }
+        flow->unary_request_read_ = true;
+        if (status == Status::DONE) {
+          StartUnaryCall(flow, method);
+          return;
+        }
+        // The message is complete but the end-of-stream flag has not been
+        // seen yet; read again to observe it before issuing the call.
+        StartUnaryRequestRead(flow, method);
+      });
+}
+
+void ProxyFlow::StartUnaryCall(const std::shared_ptr<ProxyFlow> &flow,
+                               const std::string &method) {
+  ESP_TRACE_PROBE(upstream_call_start, method.c_str());
+  flow->start_time_ = system_clock::now();
+  flow->server_call_->UpdateRequestMessageStat(
+      static_cast<int64_t>(flow->downstream_to_upstream_buffer_.Length()));
+  flow->server_call_->SetGrpcUpstreamCancel([flow]() {
+    // Cancelling the context fails the pending Finish tag, which runs
+    // the downstream finish (a no-op once the downstream call is gone).
+    flow->upstream_context_.TryCancel();
+  });
+  // As in StartUpstreamCall, the lock is held so the callback cannot
+  // run before unary_response_reader_ has been initialized.
+  std::lock_guard<std::mutex> lock(flow->mu_);
+  flow->unary_response_reader_ = flow->upstream_stub_->PrepareUnaryCall(
+      &flow->upstream_context_, method, flow->downstream_to_upstream_buffer_,
+      flow->async_grpc_queue_->GetQueue());
+  flow->unary_response_reader_->StartCall();
+  // The whole upstream exchange completes with this one tag; the
+  // response message, the initial metadata and the trailers are all
+  // available once it's dequeued.
+  flow->unary_response_reader_->Finish(
+      &flow->upstream_to_downstream_buffer_, &flow->status_from_upstream_,
+      flow->async_grpc_queue_->MakeTag([flow](bool ok) {
+        if (!ok) {
+          StartDownstreamFinish(
+              flow,
+              Status(UNAVAILABLE, std::string("upstream backend unavailable")));
+          return;
+        }
+        StartDownstreamUnaryResponse(flow);
+      }));
+}
+
+void ProxyFlow::StartDownstreamUnaryResponse(
+    const std::shared_ptr<ProxyFlow> &flow) {
+  if (!flow->status_from_upstream_.ok()) {
+    // A failed call has no response message; send a trailers-only
+    // response downstream.
+    StartDownstreamFinish(flow, Status::OK);
+    return;
+  }
+  std::multimap<std::string, std::string> initial_metadata;
+  {
+    std::lock_guard<std::mutex> lock(flow->mu_);
+    if (flow->sent_downstream_finish_) {
+      return;
+    }
+    ProcessUpstreamHeaders(flow->upstream_context_.GetServerInitialMetadata(),
+                           &initial_metadata);
+  }
+  flow->server_call_->SendInitialMetadata(initial_metadata, [flow](bool ok) {
+    if (!ok) {
+      StartDownstreamFinish(
+          flow,
+          Status(UNKNOWN, std::string("failed to send initial metadata")));
+      return;
+    }
+    flow->server_call_->UpdateResponseMessageStat(
+        static_cast<int64_t>(flow->upstream_to_downstream_buffer_.Length()));
+    std::vector<::grpc::ByteBuffer> batch;
+    batch.push_back(flow->upstream_to_downstream_buffer_);
+    flow->server_call_->WriteBatch(std::move(batch), true, [flow](bool ok) {
+      if (!ok) {
+        StartDownstreamFinish(
+            flow,
+            Status(UNKNOWN,
+                   std::string(
+                       "failed to send a message to the downstream client")));
+        return;
+      }
+      StartDownstreamFinish(flow, Status::OK);
+    });
+  });
+}
+
+void ProxyFlow::RegisterGrpcUpstreamCancel(
+    const std::shared_ptr<ProxyFlow> &flow) {
   flow->server_call_->SetGrpcUpstreamCancel([flow]() {
     flow->upstream_context_.TryCancel();
     StartUpstreamFinish(flow);
@@ -26,8 +26,10 @@
 #ifndef GRPC_PROXY_FLOW_H_
 #define GRPC_PROXY_FLOW_H_
 
+#include <deque>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 #include "grpc++/generic/async_generic_service.h"
 #include "grpc++/generic/generic_stub.h"
@@ -44,15 +46,24 @@ class ProxyFlow {
   // Invoked when a call is accepted by the server.  This call
   // instantiates an asynchronous ProxyFlow object which handles
   // proxying the GRPC call to an upstream backend server.
+  // The downstream headers to propagate upstream are read directly from the
+  // server_call via ServerCall::ForEachHeader.
+  // When unary is set (the method is known to be non-streaming on both
+  // sides), the flow buffers the single request message and issues one
+  // unary upstream call instead of running the streaming state machine.
+  // write_queue_bytes bounds the response data buffered between upstream
+  // reads and downstream writes; upstream reads pause once the budget is
+  // hit.
   static void Start(AsyncGrpcQueue *async_grpc_queue,
                     std::shared_ptr<ServerCall> server_call,
                     std::shared_ptr<::grpc::GenericStub> upstream_stub,
-                    const std::string &method,
-                    const std::multimap<std::string, std::string> &headers);
+                    const std::string &method, bool unary,
+                    size_t write_queue_bytes);
 
   ProxyFlow(AsyncGrpcQueue *async_grpc_queue,
             std::shared_ptr<ServerCall> server_call,
-            std::shared_ptr<::grpc::GenericStub> upstream_stub);
+            std::shared_ptr<::grpc::GenericStub> upstream_stub,
+            size_t write_queue_bytes);
   ~ProxyFlow() {}
 
  private:
@@ -62,26 +73,36 @@ class ProxyFlow {
   // The state machine manipulators -- see proxy_flow.cc for details.
 
   // Common to both paths:
-  static void StartUpstreamCall(std::shared_ptr<ProxyFlow> flow,
+  static void StartUpstreamCall(const std::shared_ptr<ProxyFlow> &flow,
                                 const std::string &method);
 
   // The downstream->upstream functions:
-  static void StartDownstreamReadMessage(std::shared_ptr<ProxyFlow> flow);
-  static void StartUpstreamWritesDone(std::shared_ptr<ProxyFlow> flow,
+  static void StartDownstreamReadMessage(
+      const std::shared_ptr<ProxyFlow> &flow);
+  static void StartUpstreamWritesDone(const std::shared_ptr<ProxyFlow> &flow,
                                       utils::Status status);
-  static void StartUpstreamWriteMessage(std::shared_ptr<ProxyFlow> flow,
+  static void StartUpstreamWriteMessage(const std::shared_ptr<ProxyFlow> &flow,
                                         bool last);
 
   // The upstream->downstream functions:
-  static void StartUpstreamReadInitialMetadata(std::shared_ptr<ProxyFlow> flow);
+  static void StartUpstreamReadInitialMetadata(
+      const std::shared_ptr<ProxyFlow> &flow);
   static void StartDownstreamWriteInitialMetadata(
-      std::shared_ptr<ProxyFlow> flow);
-  static void StartUpstreamReadMessage(std::shared_ptr<ProxyFlow> flow);
-  static void StartDownstreamWriteMessage(std::shared_ptr<ProxyFlow> flow);
-  static void StartUpstreamFinish(std::shared_ptr<ProxyFlow> flow);
-  static void StartDownstreamFinish(std::shared_ptr<ProxyFlow> flow,
+      const std::shared_ptr<ProxyFlow> &flow);
+  static void StartUpstreamReadMessage(const std::shared_ptr<ProxyFlow> &flow);
+  static void StartDownstreamWriteBatch(const std::shared_ptr<ProxyFlow> &flow);
+  static void StartUpstreamFinish(const std::shared_ptr<ProxyFlow> &flow);
+  static void StartDownstreamFinish(const std::shared_ptr<ProxyFlow> &flow,
                                     utils::Status status);
 
+  // The unary fast-path functions:
+  static void StartUnaryRequestRead(const std::shared_ptr<ProxyFlow> &flow,
+                                    const std::string &method);
+  static void StartUnaryCall(const std::shared_ptr<ProxyFlow> &flow,
+                             const std::string &method);
+  static void StartDownstreamUnaryResponse(
+      const std::shared_ptr<ProxyFlow> &flow);
+
   // NOTE: For gRPC steaming, at this point client-side streaming is done, but
   // server-side streaming is not. There needs to be an additional mechanism
   // to detect RST_STREAM and finish upstream properly. This problem can arise
@@ -89,7 +110,8 @@ class ProxyFlow {
   // and multiple requests share a single HTTP connection.
   // This function must be called when `sent_upstream_writes_done_` is set to
   // true.
-  static void RegisterGrpcUpstreamCancel(std::shared_ptr<ProxyFlow> flow);
+  static void RegisterGrpcUpstreamCancel(
+      const std::shared_ptr<ProxyFlow> &flow);
 
   std::mutex mu_;
 
@@ -100,20 +122,47 @@ class ProxyFlow {
   // If true, the upstream backend is no longer sending data.
   bool started_upstream_finish_;
 
+  // If true, the last upstream read has completed with no more messages;
+  // the upstream Finish is issued once the write queue has drained.
+  bool upstream_reads_done_;
+
+  // If true, a coalesced write to the downstream client is outstanding.
+  bool downstream_write_in_flight_;
+
+  // If true, upstream reads are paused because the write queue has hit its
+  // budget; the next completed downstream write resumes them.
+  bool upstream_read_paused_;
+
   // If true, we've sent a final status to the downstream client.
   bool sent_downstream_finish_;
 
+  // If true, the unary fast path has buffered the single request message
+  // in downstream_to_upstream_buffer_.
+  bool unary_request_read_;
+
   AsyncGrpcQueue *async_grpc_queue_;
   std::shared_ptr<ServerCall> server_call_;
   std::shared_ptr<::grpc::GenericStub> upstream_stub_;
   ::grpc::ClientContext upstream_context_;
   std::unique_ptr<::grpc::GenericClientAsyncReaderWriter>
       upstream_reader_writer_;
+  std::unique_ptr<::grpc::GenericClientAsyncResponseReader>
+      unary_response_reader_;
   utils::Status status_from_esp_;
   ::grpc::Status status_from_upstream_;
   ::grpc::ByteBuffer downstream_to_upstream_buffer_;
   ::grpc::ByteBuffer upstream_to_downstream_buffer_;
 
+  // Messages read from the upstream backend but not yet submitted to the
+  // downstream client, and their total payload size. Bounded by
+  // kMaxWriteQueueMessages and write_queue_max_bytes_.
+  std::deque<::grpc::ByteBuffer> upstream_to_downstream_queue_;
+  size_t upstream_to_downstream_queue_bytes_;
+
+  // The byte budget of upstream_to_downstream_queue_, from the grpc_pass
+  // write_queue parameter.
+  size_t write_queue_max_bytes_;
+
   // The backend request start time.
   std::chrono::system_clock::time_point start_time_;
 };
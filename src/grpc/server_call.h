@@ -26,7 +26,9 @@
 #ifndef GRPC_SERVER_CALL_H_
 #define GRPC_SERVER_CALL_H_
 
+#include <chrono>
 #include <functional>
+#include <vector>
 
 #include <grpc++/grpc++.h>
 
@@ -42,6 +44,23 @@ class ServerCall {
  public:
   virtual ~ServerCall() {}
 
+  // Invokes the visitor once for each header of the downstream call, passing
+  // the lower-cased header name and the header value. This lets the proxy
+  // flow propagate request headers upstream without materializing a copy of
+  // the full header set.
+  virtual void ForEachHeader(
+      std::function<void(const ::grpc::string_ref &key,
+                         const ::grpc::string_ref &value)>
+          visitor) = 0;
+
+  // Returns the absolute deadline of the downstream call, derived from the
+  // client's grpc-timeout header at the time the call was accepted, or
+  // time_point::max() if the client did not set a timeout (or sent a
+  // malformed one). Since the deadline is absolute, any time the proxy
+  // spends on the call before contacting the backend is automatically
+  // charged against the client's budget.
+  virtual std::chrono::system_clock::time_point deadline() = 0;
+
   // GRPC protocol operations on the downstream GRPC call.
   virtual void SendInitialMetadata(
       std::multimap<std::string, std::string> initial_metadata,
@@ -54,6 +73,15 @@ class ServerCall {
 
   virtual void Write(const ::grpc::ByteBuffer &msg,
                      std::function<void(bool)> continuation) = 0;
+
+  // Writes a batch of messages, in order, invoking the continuation once
+  // all of them have been accepted (or one of them has failed).
+  // Implementations may coalesce the batch into a single downstream write.
+  // When last is set, no further messages will be written before Finish();
+  // implementations may leave the batch buffered so the final data goes
+  // downstream together with the trailers.
+  virtual void WriteBatch(std::vector<::grpc::ByteBuffer> msgs, bool last,
+                          std::function<void(bool)> continuation) = 0;
   virtual void Finish(
       const utils::Status &status,
       std::multimap<std::string, std::string> response_trailers) = 0;
@@ -0,0 +1,320 @@
+// Copyright (C) Extensible Service Proxy Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Microbenchmarks for the JSON <-> gRPC transcoding request path: per-call
+// transcoder construction with variable binding resolution, JSON request
+// body translation to proto and proto response translation to JSON, using
+// the bookstore service config from test/transcoding. Build and run with
+//
+//   bazel run -c opt //src/grpc/transcoding:transcoder_benchmark
+//
+// to compare the numbers between releases.
+
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "google/api/service.pb.h"
+#include "google/protobuf/stubs/strutil.h"
+#include "google/protobuf/text_format.h"
+#include "grpc_transcoding/transcoder.h"
+#include "include/api_manager/method.h"
+#include "include/api_manager/method_call_info.h"
+#include "src/grpc/transcoding/transcoder_factory.h"
+#include "test/test_common.h"
+#include "test/transcoding/bookstore.pb.h"
+
+namespace google {
+namespace api_manager {
+namespace transcoding {
+
+namespace {
+
+namespace pb = ::google::protobuf;
+namespace pbio = ::google::protobuf::io;
+
+using ::google::grpc::transcoding::Transcoder;
+using ::google::grpc::transcoding::testing::TestZeroCopyInputStream;
+
+const char kServiceConfigFile[] = "test/transcoding/service.pb.txt";
+
+const char kCreateBookRequestType[] =
+    "type.googleapis.com/endpoints.examples.bookstore.CreateBookRequest";
+const char kBookType[] =
+    "type.googleapis.com/endpoints.examples.bookstore.Book";
+
+// MethodInfo implementation with just enough behavior for the
+// TranscoderFactory; everything the transcoder does not consult returns an
+// empty value.
+class BenchmarkMethodInfo : public MethodInfo {
+ public:
+  BenchmarkMethodInfo(const std::string& request_type_url,
+                      const std::string& response_type_url,
+                      const std::string& body_field_path)
+      : request_type_url_(request_type_url),
+        response_type_url_(response_type_url),
+        body_field_path_(body_field_path) {}
+
+  // Methods that the transcoder does use.
+  const std::string& request_type_url() const { return request_type_url_; }
+  bool request_streaming() const { return false; }
+  const std::string& response_type_url() const { return response_type_url_; }
+  bool response_streaming() const { return false; }
+  const std::string& body_field_path() const { return body_field_path_; }
+
+  // Methods that the transcoder doesn't use.
+  const std::string& name() const { return empty_; }
+  const std::string& api_name() const { return empty_; }
+  const std::string& api_version() const { return empty_; }
+  const std::string& selector() const { return empty_; }
+  bool auth() const { return false; }
+  bool allow_unregistered_calls() const { return false; }
+  bool skip_service_control() const { return false; }
+  bool isIssuerAllowed(const std::string& issuer) const { return false; }
+  bool isAudienceAllowed(const std::string& issuer,
+                         const std::set<std::string>& jwt_audiences) const {
+    return false;
+  }
+  const std::vector<std::string>* http_header_parameters(
+      const std::string& name) const {
+    return nullptr;
+  }
+  const std::vector<std::string>* url_query_parameters(
+      const std::string& name) const {
+    return nullptr;
+  }
+  const std::vector<std::string>* api_key_http_headers() const {
+    return nullptr;
+  }
+  const std::vector<std::string>* api_key_url_query_parameters() const {
+    return nullptr;
+  }
+  const std::string& backend_address() const { return empty_; }
+  const std::string& backend_path() const { return empty_; }
+  const ::google::api::BackendRule_PathTranslation backend_path_translation()
+      const {
+    return ::google::api::
+        BackendRule_PathTranslation_PATH_TRANSLATION_UNSPECIFIED;
+  }
+  const std::string& backend_jwt_audience() const { return empty_; }
+  const std::string& rpc_method_full_name() const { return empty_; }
+  const std::set<std::string>& system_query_parameter_names() const {
+    static std::set<std::string> dummy;
+    return dummy;
+  }
+  bool keep_binding_escaped() const { return false; }
+  const std::vector<std::pair<std::string, int>>& metric_cost_vector() const {
+    static std::vector<std::pair<std::string, int>> dummy;
+    return dummy;
+  }
+  const std::string& authorization_url_by_issuer(
+      const std::string& issuer) const {
+    return empty_;
+  }
+  const std::string& first_authorization_url() const { return empty_; }
+
+ private:
+  std::string request_type_url_;
+  std::string response_type_url_;
+  std::string body_field_path_;
+  std::string empty_;
+};
+
+// Loads the bookstore service config and builds one factory shared by all
+// iterations, as one factory is shared by all requests of a config version
+// in production.
+TranscoderFactory* GetFactory() {
+  static TranscoderFactory* factory = []() {
+    std::ifstream input_file(kServiceConfigFile,
+                             std::ifstream::in | std::ifstream::binary);
+    std::string config_text((std::istreambuf_iterator<char>(input_file)),
+                            (std::istreambuf_iterator<char>()));
+    auto* service = new ::google::api::Service;
+    if (!pb::TextFormat::ParseFromString(config_text, service)) {
+      return static_cast<TranscoderFactory*>(nullptr);
+    }
+    return new TranscoderFactory(*service);
+  }();
+  return factory;
+}
+
+// Drains a ZeroCopyInputStream, returning the number of bytes read.
+int64_t Drain(pbio::ZeroCopyInputStream* stream) {
+  int64_t total = 0;
+  const void* data = nullptr;
+  int size = 0;
+  while (stream->Next(&data, &size) && 0 != size) {
+    total += size;
+  }
+  return total;
+}
+
+// Builds a JSON CreateBookRequest body of roughly the requested size; the
+// quotes carry escapes and multi-byte characters so the translator's string
+// scanning runs on realistic content, not just plain ASCII.
+std::string BuildCreateBookJson(size_t approximate_size) {
+  std::ostringstream body;
+  body << R"({"shelf": 99, "book": {"author": "Leo Tolstoy", )"
+       << R"("title": "War and Peace", "quotes": [)";
+  const char quote[] =
+      "\"We can know only that we know nothing \xE2\x80\x94 "
+      "\\\"nothing\\\" \\\\\"";
+  body << quote;
+  while (static_cast<size_t>(body.tellp()) < approximate_size) {
+    body << ", " << quote;
+  }
+  body << "]}}";
+  return body.str();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// JSON request body translation to proto
+////////////////////////////////////////////////////////////////////////////////
+
+void BM_TranscodeJsonRequest(benchmark::State& state) {
+  auto* factory = GetFactory();
+  if (factory == nullptr) {
+    state.SkipWithError("failed to load the bookstore service config");
+    return;
+  }
+  BenchmarkMethodInfo method_info(kCreateBookRequestType, kBookType, "");
+  const std::string json = BuildCreateBookJson(state.range(0));
+
+  for (auto _ : state) {
+    MethodCallInfo call_info;
+    call_info.method_info = &method_info;
+
+    std::unique_ptr<Transcoder> transcoder;
+    TestZeroCopyInputStream request_in, response_in;
+    auto status =
+        factory->Create(call_info, &request_in, &response_in, &transcoder);
+    if (!status.ok()) {
+      state.SkipWithError("failed to create the transcoder");
+      return;
+    }
+
+    request_in.AddChunk(json);
+    request_in.Finish();
+    benchmark::DoNotOptimize(Drain(transcoder->RequestOutput()));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          json.size());
+}
+BENCHMARK(BM_TranscodeJsonRequest)->Range(1 << 8, 1 << 16);
+
+////////////////////////////////////////////////////////////////////////////////
+// Proto response translation to JSON
+////////////////////////////////////////////////////////////////////////////////
+
+void BM_TranscodeProtoResponse(benchmark::State& state) {
+  auto* factory = GetFactory();
+  if (factory == nullptr) {
+    state.SkipWithError("failed to load the bookstore service config");
+    return;
+  }
+  BenchmarkMethodInfo method_info(kCreateBookRequestType, kBookType, "");
+
+  // A Book whose quotes force escaping in the JSON output.
+  ::endpoints::examples::bookstore::Book book;
+  book.set_id(1);
+  book.set_author("Leo Tolstoy");
+  book.set_title("War and Peace");
+  const std::string quote =
+      "We can know only that we know nothing \xE2\x80\x94 \"nothing\" \\";
+  while (book.ByteSizeLong() < static_cast<size_t>(state.range(0))) {
+    book.add_quotes(quote);
+  }
+
+  // Frame the serialized message the way a gRPC backend delivers it:
+  // a compression flag byte and a 4-byte big-endian length prefix.
+  std::string message = book.SerializeAsString();
+  std::string frame("\0", 1);
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    frame.push_back(static_cast<char>((message.size() >> shift) & 0xFF));
+  }
+  frame += message;
+
+  for (auto _ : state) {
+    MethodCallInfo call_info;
+    call_info.method_info = &method_info;
+
+    std::unique_ptr<Transcoder> transcoder;
+    TestZeroCopyInputStream request_in, response_in;
+    auto status =
+        factory->Create(call_info, &request_in, &response_in, &transcoder);
+    if (!status.ok()) {
+      state.SkipWithError("failed to create the transcoder");
+      return;
+    }
+
+    response_in.AddChunk(frame);
+    response_in.Finish();
+    benchmark::DoNotOptimize(Drain(transcoder->ResponseOutput()));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          frame.size());
+}
+BENCHMARK(BM_TranscodeProtoResponse)->Range(1 << 8, 1 << 16);
+
+////////////////////////////////////////////////////////////////////////////////
+// Transcoder construction with variable binding resolution
+////////////////////////////////////////////////////////////////////////////////
+
+// Arg 0 benchmarks plain ASCII binding values, arg 1 values with multi-byte
+// UTF-8 characters; the two together show what the ASCII fast path in the
+// factory's UTF-8 validation is worth.
+void BM_CreateTranscoderWithBindings(benchmark::State& state) {
+  auto* factory = GetFactory();
+  if (factory == nullptr) {
+    state.SkipWithError("failed to load the bookstore service config");
+    return;
+  }
+  BenchmarkMethodInfo method_info(kCreateBookRequestType, kBookType, "book");
+
+  const std::string author = state.range(0) == 0
+                                 ? "Lev Nikolayevich Tolstoy"
+                                 : "\xD0\x9B\xD0\xB5\xD0\xB2 Tolstoy";
+  for (auto _ : state) {
+    MethodCallInfo call_info;
+    call_info.method_info = &method_info;
+    call_info.body_field_path = "book";
+
+    VariableBinding binding;
+    std::vector<std::string> names =
+        pb::Split("book.author", ".", /*skip_empty*/ true);
+    binding.field_path.assign(names.begin(), names.end());
+    binding.value = author;
+    call_info.variable_bindings.emplace_back(std::move(binding));
+
+    std::unique_ptr<Transcoder> transcoder;
+    TestZeroCopyInputStream request_in, response_in;
+    auto status =
+        factory->Create(call_info, &request_in, &response_in, &transcoder);
+    benchmark::DoNotOptimize(&status);
+  }
+}
+BENCHMARK(BM_CreateTranscoderWithBindings)->Arg(0)->Arg(1);
+
+}  // namespace
+
+}  // namespace transcoding
+}  // namespace api_manager
+}  // namespace google
+
+BENCHMARK_MAIN();
@@ -16,8 +16,12 @@
 //
 #include "src/grpc/transcoding/transcoder_factory.h"
 
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "google/api/service.pb.h"
@@ -81,54 +85,6 @@ class TranscoderImpl : public Transcoder {
   std::unique_ptr<TranscoderInputStream> response_stream_;
 };
 
-// Converts MethodCallInfo into a RequestInfo structure needed by the
-// JsonRequestTranslator.
-pbutil::Status MethodCallInfoToRequestInfo(TypeHelper* type_helper,
-                                           const MethodCallInfo& call_info,
-                                           RequestInfo* request_info) {
-  // Try to resolve the request type
-  const auto& request_type_url = call_info.method_info->request_type_url();
-  request_info->message_type =
-      type_helper->Info()->GetTypeByTypeUrl(request_type_url);
-  if (nullptr == request_info->message_type) {
-    return pbutil::Status(pberr::NOT_FOUND,
-                          "Could not resolve the type \"" + request_type_url +
-                              "\". Invalid service configuration.");
-  }
-
-  // Copy the body field path
-  request_info->body_field_path = call_info.body_field_path;
-
-  // Resolve the field paths of the bindings and add to the request_info
-  for (const auto& unresolved_binding : call_info.variable_bindings) {
-    RequestWeaver::BindingInfo resolved_binding;
-
-    // Verify that the value is valid UTF8 before continuing
-    if (!pb::internal::IsStructurallyValidUTF8(
-            unresolved_binding.value.c_str(),
-            unresolved_binding.value.size())) {
-      return pbutil::Status(pberr::INVALID_ARGUMENT,
-                            "Encountered non UTF-8 code points.");
-    }
-
-    resolved_binding.value = unresolved_binding.value;
-
-    // Try to resolve the field path
-    auto status = type_helper->ResolveFieldPath(*request_info->message_type,
-                                                unresolved_binding.field_path,
-                                                &resolved_binding.field_path);
-    if (!status.ok()) {
-      // Field path could not be resolved (usually a config error) - return
-      // the error.
-      return status;
-    }
-
-    request_info->variable_bindings.emplace_back(std::move(resolved_binding));
-  }
-
-  return pbutil::Status::OK;
-}
-
 // This class combines two resolvers: if the first one could not find it,
 // try the second.
 class TwoTypeResolvers : public pbutil::TypeResolver {
@@ -160,24 +116,173 @@ class TwoTypeResolvers : public pbutil::TypeResolver {
   pbutil::TypeResolver* resolver2_;
 };
 
+// Returns a TypeHelper for the type universe of the given service config,
+// sharing a previously built instance when the serialized content of the
+// types and enums is identical. Service configs deployed side by side for
+// traffic splitting typically differ only outside their type information,
+// so each distinct universe is walked and held just once per worker.
+// Entries are weak, so a helper is freed once the last factory using it
+// goes away (e.g. after a rollout retires its config).
+std::shared_ptr<TypeHelper> GetOrCreateTypeHelper(
+    const ::google::api::Service& service) {
+  static std::mutex mu;
+  static auto* cache =
+      new std::unordered_map<std::string, std::weak_ptr<TypeHelper>>();
+
+  // The full serialized content is used as the key rather than a digest of
+  // it, so unrelated universes can never be conflated; the keys are small
+  // compared to the type information the helpers build from them.
+  std::string key;
+  for (const auto& type : service.types()) {
+    type.AppendToString(&key);
+  }
+  for (const auto& enum_type : service.enums()) {
+    enum_type.AppendToString(&key);
+  }
+
+  std::lock_guard<std::mutex> lock(mu);
+  auto it = cache->find(key);
+  if (it != cache->end()) {
+    auto helper = it->second.lock();
+    if (helper) {
+      return helper;
+    }
+  }
+  // Drop entries whose helpers have been freed before adding a new one.
+  for (auto expired = cache->begin(); expired != cache->end();) {
+    if (expired->second.expired()) {
+      expired = cache->erase(expired);
+    } else {
+      ++expired;
+    }
+  }
+  auto helper =
+      std::make_shared<TypeHelper>(service.types(), service.enums());
+  (*cache)[std::move(key)] = helper;
+  return helper;
+}
+
+// Returns true if value consists of 7-bit ASCII bytes only, checking eight
+// bytes per step. ASCII-only values — the overwhelming majority of path
+// variable bindings — are structurally valid UTF-8 by definition, so the
+// byte-by-byte validation can be skipped for them.
+bool IsAsciiOnly(const std::string& value) {
+  uint64_t acc = 0;
+  size_t i = 0;
+  for (; i + sizeof(acc) <= value.size(); i += sizeof(acc)) {
+    uint64_t chunk;
+    memcpy(&chunk, value.data() + i, sizeof(chunk));
+    acc |= chunk;
+  }
+  for (; i < value.size(); ++i) {
+    acc |= static_cast<unsigned char>(value[i]);
+  }
+  return (acc & 0x8080808080808080ULL) == 0;
+}
+
 }  // namespace
 
 TranscoderFactory::TranscoderFactory(
     const ::google::api::Service& service,
     const ::google::protobuf::util::JsonPrintOptions& json_print_options)
-    : type_helper_(service.types(), service.enums()),
+    : type_helper_(GetOrCreateTypeHelper(service)),
       json_print_options_(json_print_options),
-      status_resolver_(new TwoTypeResolvers(type_helper_.Resolver(),
+      status_resolver_(new TwoTypeResolvers(type_helper_->Resolver(),
                                             utils::GetTypeResolver())) {}
 
+pbutil::Status TranscoderFactory::MethodCallInfoToRequestInfo(
+    const MethodCallInfo& call_info, RequestInfo* request_info) {
+  // Try to resolve the request type through the per-method cache
+  const auto& request_type_url = call_info.method_info->request_type_url();
+  {
+    std::lock_guard<std::mutex> lock(cache_mu_);
+    auto cached_type = request_type_cache_.find(request_type_url);
+    if (cached_type != request_type_cache_.end()) {
+      request_info->message_type = cached_type->second;
+    } else {
+      request_info->message_type =
+          type_helper_->Info()->GetTypeByTypeUrl(request_type_url);
+      if (nullptr != request_info->message_type) {
+        request_type_cache_.emplace(request_type_url,
+                                    request_info->message_type);
+      }
+    }
+  }
+  if (nullptr == request_info->message_type) {
+    return pbutil::Status(pberr::NOT_FOUND,
+                          "Could not resolve the type \"" + request_type_url +
+                              "\". Invalid service configuration.");
+  }
+
+  // Copy the body field path
+  request_info->body_field_path = call_info.body_field_path;
+
+  // Resolve the field paths of the bindings and add to the request_info
+  for (const auto& unresolved_binding : call_info.variable_bindings) {
+    RequestWeaver::BindingInfo resolved_binding;
+
+    // Verify that the value is valid UTF8 before continuing
+    if (!IsAsciiOnly(unresolved_binding.value) &&
+        !pb::internal::IsStructurallyValidUTF8(
+            unresolved_binding.value.c_str(),
+            unresolved_binding.value.size())) {
+      return pbutil::Status(pberr::INVALID_ARGUMENT,
+                            "Encountered non UTF-8 code points.");
+    }
+
+    resolved_binding.value = unresolved_binding.value;
+
+    // The field paths come from the method's HTTP template, so the
+    // resolution result can be cached keyed by the type and the path.
+    std::string cache_key = request_type_url;
+    for (const auto& field_name : unresolved_binding.field_path) {
+      cache_key += '.';
+      cache_key += field_name;
+    }
+
+    bool cached = false;
+    {
+      std::lock_guard<std::mutex> lock(cache_mu_);
+      auto cached_path = field_path_cache_.find(cache_key);
+      if (cached_path != field_path_cache_.end()) {
+        resolved_binding.field_path = cached_path->second;
+        cached = true;
+      }
+    }
+
+    if (!cached) {
+      // Try to resolve the field path. The resolver takes the names as a
+      // std::vector; the copy out of the inline-storage path is only made
+      // on a cache miss.
+      auto status = type_helper_->ResolveFieldPath(
+          *request_info->message_type,
+          std::vector<std::string>(unresolved_binding.field_path.begin(),
+                                   unresolved_binding.field_path.end()),
+          &resolved_binding.field_path);
+      if (!status.ok()) {
+        // Field path could not be resolved (usually a config error) - return
+        // the error.
+        return status;
+      }
+
+      std::lock_guard<std::mutex> lock(cache_mu_);
+      field_path_cache_.emplace(std::move(cache_key),
+                                resolved_binding.field_path);
+    }
+
+    request_info->variable_bindings.emplace_back(std::move(resolved_binding));
+  }
+
+  return pbutil::Status::OK;
+}
+
 pbutil::Status TranscoderFactory::Create(
     const MethodCallInfo& call_info, pbio::ZeroCopyInputStream* request_input,
     TranscoderInputStream* response_input,
     std::unique_ptr<Transcoder>* transcoder) {
   // Convert MethodCallInfo into RequestInfo
   RequestInfo request_info;
-  auto status =
-      MethodCallInfoToRequestInfo(&type_helper_, call_info, &request_info);
+  auto status = MethodCallInfoToRequestInfo(call_info, &request_info);
   if (!status.ok()) {
     return status;
   }
@@ -186,14 +291,14 @@ pbutil::Status TranscoderFactory::Create(
 
   // Create a JsonRequestTranslator for translating the request
   std::unique_ptr<JsonRequestTranslator> request_translator(
-      new JsonRequestTranslator(type_helper_.Resolver(), request_input,
+      new JsonRequestTranslator(type_helper_->Resolver(), request_input,
                                 request_info,
                                 call_info.method_info->request_streaming(),
                                 /*output_delimiters*/ true));
 
   // Create a ResponseToJsonTranslator for translating the response
   std::unique_ptr<ResponseToJsonTranslator> response_translator(
-      new ResponseToJsonTranslator(type_helper_.Resolver(),
+      new ResponseToJsonTranslator(type_helper_->Resolver(),
                                    call_info.method_info->response_type_url(),
                                    call_info.method_info->response_streaming(),
                                    response_input, json_print_options_));
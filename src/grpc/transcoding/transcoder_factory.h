@@ -16,11 +16,17 @@
 #define GRPC_TRANSCODING_TRANSODER_FACTORY_H_
 
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "google/api/service.pb.h"
 #include "google/protobuf/io/zero_copy_stream.h"
 #include "google/protobuf/stubs/status.h"
+#include "google/protobuf/type.pb.h"
 #include "google/protobuf/util/json_util.h"
+#include "grpc_transcoding/request_message_translator.h"
 #include "grpc_transcoding/transcoder.h"
 #include "grpc_transcoding/transcoder_input_stream.h"
 #include "grpc_transcoding/type_helper.h"
@@ -85,9 +91,33 @@ class TranscoderFactory {
   }
 
  private:
-  ::google::grpc::transcoding::TypeHelper type_helper_;
+  // Converts MethodCallInfo into a RequestInfo structure needed by the
+  // JsonRequestTranslator, resolving the request type and the variable
+  // binding field paths through the caches below.
+  ::google::protobuf::util::Status MethodCallInfoToRequestInfo(
+      const MethodCallInfo& call_info,
+      ::google::grpc::transcoding::RequestInfo* request_info);
+
+  // The type helper is shared between factories built from identical type
+  // universes (see the cache in transcoder_factory.cc), so deploying several
+  // service configs with the same types - e.g. for traffic splitting - builds
+  // and holds the type information only once per worker.
+  std::shared_ptr<::google::grpc::transcoding::TypeHelper> type_helper_;
   ::google::protobuf::util::JsonPrintOptions json_print_options_;
   std::unique_ptr<::google::protobuf::util::TypeResolver> status_resolver_;
+
+  // Caches for the type and field path resolution results. The resolved
+  // objects are owned by type_helper_ and are valid for the lifetime of the
+  // factory. The request types and the binding field paths come from the
+  // service config, so the caches stay bounded by the number of configured
+  // methods. The field path cache is keyed by the request type URL followed
+  // by the dotted field path.
+  std::mutex cache_mu_;
+  std::unordered_map<std::string, const ::google::protobuf::Type*>
+      request_type_cache_;
+  std::unordered_map<std::string,
+                     std::vector<const ::google::protobuf::Field*>>
+      field_path_cache_;
 };
 
 }  // namespace transcoding
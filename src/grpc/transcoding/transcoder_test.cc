@@ -169,7 +169,9 @@ class TranscoderTest : public ::testing::Test {
   void AddVariableBinding(const std::string &field_path,
                           const std::string &value) {
     VariableBinding binding;
-    binding.field_path = pb::Split(field_path, ".", /*skip_empty*/ true);
+    std::vector<std::string> names =
+        pb::Split(field_path, ".", /*skip_empty*/ true);
+    binding.field_path.assign(names.begin(), names.end());
     binding.value = value;
     variable_bindings_.emplace_back(binding);
   }
@@ -191,7 +193,7 @@ class TranscoderTest : public ::testing::Test {
   std::unique_ptr<TranscoderFactory> transcoder_factory_;
 
   std::unique_ptr<TestMethodInfo> method_info_;
-  std::vector<VariableBinding> variable_bindings_;
+  VariableBindings variable_bindings_;
 };
 
 // A helper function that determines whether the ZeroCopyInputStream has
@@ -352,6 +354,64 @@ TEST_F(TranscoderTest, RequestBindingsAndPrefix) {
       << std::endl;
 }
 
+TEST_F(TranscoderTest, RepeatedRequestsReuseCachedResolution) {
+  ASSERT_TRUE(LoadService("bookstore_service.pb.txt"));
+  SetMethodInfo(/*request_type_url*/ "type.googleapis.com/CreateBookRequest",
+                /*response_type_url*/ "type.googleapis.com/Book",
+                /*request_streaming*/ false,
+                /*response_streaming*/ false,
+                /*body_field_path*/ "book");
+
+  auto json = R"({
+          "name" : "1",
+          "title" : "War and Peace"
+      }
+    )";
+
+  auto expected_proto_text =
+      R"(
+          shelf : 99
+          book {
+            name : "1"
+            title : "War and Peace"
+            author : "Leo Tolstoy"
+          }
+        )";
+
+  CreateBookRequest expected;
+  ASSERT_TRUE(pb::TextFormat::ParseFromString(expected_proto_text, &expected));
+
+  // Build a Transcoder for the same method twice. The second Create() is
+  // served from the factory's type & field path resolution cache and must
+  // produce the same translation.
+  for (int i = 0; i < 2; ++i) {
+    AddVariableBinding("shelf", "99");
+    AddVariableBinding("book.author", "Leo Tolstoy");
+
+    std::unique_ptr<Transcoder> t;
+    TestZeroCopyInputStream request_in, response_in;
+    auto status = Build(&request_in, &response_in, &t);
+    ASSERT_TRUE(status.ok()) << "Error building Transcoder - "
+                             << status.error_message() << std::endl;
+
+    request_in.AddChunk(json);
+
+    // Read the message
+    MessageReader reader(t->RequestOutput());
+    auto actual_proto = reader.NextMessage();
+    ASSERT_NE(nullptr, actual_proto.get());
+
+    // Parse & match
+    CreateBookRequest actual;
+    ASSERT_TRUE(actual.ParseFromZeroCopyStream(actual_proto.get()));
+    EXPECT_TRUE(pbutil::MessageDifferencer::Equivalent(expected, actual));
+
+    EXPECT_TRUE(t->RequestStatus().ok())
+        << "Error while translating - " << t->RequestStatus().error_message()
+        << std::endl;
+  }
+}
+
 TEST_F(TranscoderTest, StreamingRequestAndResponse) {
   ASSERT_TRUE(LoadService("bookstore_service.pb.txt"));
   SetMethodInfo(/*request_type_url*/ "type.googleapis.com/Shelf",
@@ -66,6 +66,10 @@ bool GrpcZeroCopyInputStream::Next(const void **data, int *size) {
 }
 
 void GrpcZeroCopyInputStream::BackUp(int count) {
+  // Message payloads are returned as single linear buffers (the serializer
+  // coalesces multi-slice payloads), so backing up is a pure position
+  // adjustment within the current buffer and never crosses a slice
+  // boundary.
   if (0 < count && static_cast<size_t>(count) <= position_) {
     position_ -= count;
     bytes_read_ -= count;
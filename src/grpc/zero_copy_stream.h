@@ -50,6 +50,14 @@ class GrpcZeroCopyInputStream
   // return false after all the existing messages are consumed.
   void Finish() { finished_ = true; }
 
+  // Messages whose payload is at least this many bytes are spilled to an
+  // unlinked temporary file when added and streamed back out in fixed-size
+  // chunks, so one oversized message does not hold its full payload in
+  // memory while it drains. 0 disables spilling.
+  void set_spill_threshold(size_t bytes) {
+    serializer_.set_spill_threshold(bytes);
+  }
+
   // ZeroCopyInputStream implementation
 
   bool Next(const void **data, int *size);
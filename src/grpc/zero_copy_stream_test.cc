@@ -92,12 +92,15 @@ TEST_F(GrpcZeroCopyInputStreamTest, SimpleRead) {
   std::string slice21 = "000000000000000000000This is\n";
   std::string slice22 = "000000000000000000000the second message\n";
 
+  std::string message1 = slice11 + slice12;
+  std::string message2 = slice21 + slice22;
+
   stream.AddMessage(CreateByteBuffer(SliceData{slice11, slice12}), true);
   stream.AddMessage(CreateByteBuffer(SliceData{slice21, slice22}), true);
   stream.Finish();
 
   // Test BytesAvailable() and ByteCount()
-  EXPECT_EQ(slice11.size() + slice12.size() + slice21.size() + slice22.size() +
+  EXPECT_EQ(message1.size() + message2.size() +
                 10,  // +10 bytes for two delimiters
             stream.BytesAvailable());
   EXPECT_EQ(0, stream.ByteCount());
@@ -105,66 +108,44 @@ TEST_F(GrpcZeroCopyInputStreamTest, SimpleRead) {
   // Test the message1 delimiter
   EXPECT_TRUE(stream.Next(&data, &size));
   EXPECT_EQ(kFrameSize, size);
-  EXPECT_EQ(slice11.size() + slice12.size(),
+  EXPECT_EQ(message1.size(),
             DelimiterToSize(reinterpret_cast<const unsigned char *>(data)));
 
   // Test BytesAvailable() and ByteCount()
-  EXPECT_EQ(slice11.size() + slice12.size() + slice21.size() + slice22.size() +
+  EXPECT_EQ(message1.size() + message2.size() +
                 kFrameSize,  // +kFrameSize bytes for one delimiter
             stream.BytesAvailable());
   EXPECT_EQ(kFrameSize, stream.ByteCount());
 
-  // Test the slices
+  // The multi-slice payload arrives as a single contiguous buffer
   EXPECT_TRUE(stream.Next(&data, &size));
-  //  EXPECT_EQ(slice11.size(), size);
-  EXPECT_EQ(slice11, std::string(reinterpret_cast<const char *>(data), size));
+  EXPECT_EQ(message1.size(), size);
+  EXPECT_EQ(message1, std::string(reinterpret_cast<const char *>(data), size));
 
   // Test BytesAvailable() and ByteCount()
-  EXPECT_EQ(slice12.size() + slice21.size() + slice22.size() +
+  EXPECT_EQ(message2.size() +
                 kFrameSize,  // +kFrameSize bytes for one delimiter
             stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize + slice11.size(), stream.ByteCount());
-
-  EXPECT_TRUE(stream.Next(&data, &size));
-  EXPECT_EQ(slice12.size(), size);
-  EXPECT_EQ(slice12, std::string(reinterpret_cast<const char *>(data), size));
-
-  // Test BytesAvailable() and ByteCount()
-  EXPECT_EQ(slice21.size() + slice22.size() +
-                kFrameSize,  // +kFrameSize bytes for one delimiter
-            stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize + slice11.size() + slice12.size(), stream.ByteCount());
+  EXPECT_EQ(kFrameSize + message1.size(), stream.ByteCount());
 
   // Test the message2 delimiter
   EXPECT_TRUE(stream.Next(&data, &size));
   EXPECT_EQ(kFrameSize, size);
-  EXPECT_EQ(slice21.size() + slice22.size(),
+  EXPECT_EQ(message2.size(),
             DelimiterToSize(reinterpret_cast<const unsigned char *>(data)));
 
   // Test BytesAvailable() and ByteCount()
-  EXPECT_EQ(slice21.size() + slice22.size(), stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize + slice11.size() + slice12.size() + kFrameSize,
-            stream.ByteCount());
+  EXPECT_EQ(message2.size(), stream.BytesAvailable());
+  EXPECT_EQ(kFrameSize + message1.size() + kFrameSize, stream.ByteCount());
 
-  // Test the slices
+  // Test the second payload
   EXPECT_TRUE(stream.Next(&data, &size));
-  EXPECT_EQ(slice21.size(), size);
-  EXPECT_EQ(slice21, std::string(reinterpret_cast<const char *>(data), size));
-
-  // Test BytesAvailable() and ByteCount()
-  EXPECT_EQ(slice22.size(), stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize + slice11.size() + slice12.size() + kFrameSize +
-                slice21.size(),
-            stream.ByteCount());
-
-  EXPECT_TRUE(stream.Next(&data, &size));
-  EXPECT_EQ(slice22.size(), size);
-  EXPECT_EQ(slice22, std::string(reinterpret_cast<const char *>(data), size));
+  EXPECT_EQ(message2.size(), size);
+  EXPECT_EQ(message2, std::string(reinterpret_cast<const char *>(data), size));
 
   // Test the end of the stream
   EXPECT_EQ(0, stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize + slice11.size() + slice12.size() + kFrameSize +
-                slice21.size() + slice22.size(),
+  EXPECT_EQ(kFrameSize + message1.size() + kFrameSize + message2.size(),
             stream.ByteCount());
   EXPECT_FALSE(stream.Next(&data, &size));
 }
@@ -176,6 +157,8 @@ TEST_F(GrpcZeroCopyInputStreamTest, Backups) {
   std::string slice1 = "This is the first slice of the message.";
   std::string slice2 = "This is the second slice of the message.";
 
+  std::string message = slice1 + slice2;
+
   stream.AddMessage(CreateByteBuffer(SliceData{slice1, slice2}), true);
   stream.Finish();
 
@@ -184,66 +167,54 @@ TEST_F(GrpcZeroCopyInputStreamTest, Backups) {
   int size = -1;
   EXPECT_TRUE(stream.Next(&data, &size));
   EXPECT_EQ(kFrameSize, size);
-  EXPECT_EQ(slice1.size() + slice2.size(),
+  EXPECT_EQ(message.size(),
             DelimiterToSize(reinterpret_cast<const unsigned char *>(data)));
 
   // Back up
   stream.BackUp(kFrameSize);
 
   // Test BytesAvailable() and ByteCount()
-  EXPECT_EQ(slice1.size() + slice2.size() +
+  EXPECT_EQ(message.size() +
                 kFrameSize,  // +kFrameSize bytes for the delimiter
             stream.BytesAvailable());
   EXPECT_EQ(0, stream.ByteCount());
 
-  // Test the slice again
+  // Test the delimiter again
   EXPECT_TRUE(stream.Next(&data, &size));
   EXPECT_EQ(kFrameSize, size);
-  EXPECT_EQ(slice1.size() + slice2.size(),
+  EXPECT_EQ(message.size(),
             DelimiterToSize(reinterpret_cast<const unsigned char *>(data)));
 
-  // Test the first slice
+  // Test the payload, delivered as one contiguous buffer
   EXPECT_TRUE(stream.Next(&data, &size));
-  EXPECT_EQ(slice1.size(), size);
-  EXPECT_EQ(slice1, std::string(reinterpret_cast<const char *>(data), size));
+  EXPECT_EQ(message.size(), size);
+  EXPECT_EQ(message, std::string(reinterpret_cast<const char *>(data), size));
 
   // Back up & test again
   stream.BackUp(size);
-  EXPECT_EQ(slice1.size() + slice2.size(), stream.BytesAvailable());
+  EXPECT_EQ(message.size(), stream.BytesAvailable());
   EXPECT_EQ(kFrameSize, stream.ByteCount());
   EXPECT_TRUE(stream.Next(&data, &size));
-  EXPECT_EQ(slice1.size(), size);
-  EXPECT_EQ(slice1, std::string(reinterpret_cast<const char *>(data), size));
+  EXPECT_EQ(message.size(), size);
+  EXPECT_EQ(message, std::string(reinterpret_cast<const char *>(data), size));
 
   // Now Back up 10 bytes & test again
   stream.BackUp(10);
-  EXPECT_EQ(10 + slice2.size(), stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize + slice1.size() - 10, stream.ByteCount());
+  EXPECT_EQ(10, stream.BytesAvailable());
+  EXPECT_EQ(kFrameSize + message.size() - 10, stream.ByteCount());
   EXPECT_TRUE(stream.Next(&data, &size));
   EXPECT_EQ(10, size);
-  EXPECT_EQ(slice1.substr(slice1.size() - 10),
+  EXPECT_EQ(message.substr(message.size() - 10),
             std::string(reinterpret_cast<const char *>(data), size));
 
-  // Test the second slice
-  EXPECT_TRUE(stream.Next(&data, &size));
-  EXPECT_EQ(slice2.size(), size);
-  EXPECT_EQ(slice2, std::string(reinterpret_cast<const char *>(data), size));
-
-  // Back up and test again
-  stream.BackUp(size);
-  EXPECT_EQ(slice2.size(), stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize + slice1.size(), stream.ByteCount());
-  EXPECT_TRUE(stream.Next(&data, &size));
-  EXPECT_EQ(slice2.size(), size);
-  EXPECT_EQ(slice2, std::string(reinterpret_cast<const char *>(data), size));
-
-  // Now Back up size - 1 bytes (all but 1) and check again
-  stream.BackUp(size - 1);
-  EXPECT_EQ(slice2.size() - 1, stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize + slice1.size() + 1, stream.ByteCount());
+  // Back up across what used to be a slice boundary and check that the
+  // bytes are still linear
+  stream.BackUp(slice2.size() + 5);
+  EXPECT_EQ(slice2.size() + 5, stream.BytesAvailable());
+  EXPECT_EQ(kFrameSize + slice1.size() - 5, stream.ByteCount());
   EXPECT_TRUE(stream.Next(&data, &size));
-  EXPECT_EQ(slice2.size() - 1, size);
-  EXPECT_EQ(slice2.substr(1),
+  EXPECT_EQ(slice2.size() + 5, size);
+  EXPECT_EQ(message.substr(slice1.size() - 5),
             std::string(reinterpret_cast<const char *>(data), size));
 
   // Check the end of the stream
@@ -259,6 +230,8 @@ TEST_F(GrpcZeroCopyInputStreamTest, Skips) {
   std::string slice3 = "This is the third slice of the message.";
   std::string slice4 = "This is the fourth slice of the message.";
 
+  std::string message = slice1 + slice2 + slice3 + slice4;
+
   stream.AddMessage(CreateByteBuffer(SliceData{slice1, slice2, slice3, slice4}),
                     true);
   stream.Finish();
@@ -270,8 +243,7 @@ TEST_F(GrpcZeroCopyInputStreamTest, Skips) {
   EXPECT_TRUE(stream.Skip(kFrameSize));
 
   // Test BytesAvailable() and ByteCount()
-  EXPECT_EQ(slice1.size() + slice2.size() + slice3.size() + slice4.size(),
-            stream.BytesAvailable());
+  EXPECT_EQ(message.size(), stream.BytesAvailable());
   EXPECT_EQ(kFrameSize, stream.ByteCount());
 
   // Skip backwards (impossible -- no effect)
@@ -280,33 +252,31 @@ TEST_F(GrpcZeroCopyInputStreamTest, Skips) {
   EXPECT_TRUE(stream.Skip(0));
 
   // Test BytesAvailable() and ByteCount()
-  EXPECT_EQ(slice1.size() + slice2.size() + slice3.size() + slice4.size(),
-            stream.BytesAvailable());
+  EXPECT_EQ(message.size(), stream.BytesAvailable());
   EXPECT_EQ(kFrameSize, stream.ByteCount());
 
-  // Read the first slice
+  // Read the payload; the four slices are coalesced into one buffer
   EXPECT_TRUE(stream.Next(&data, &size));
-  EXPECT_EQ(slice1.size(), size);
-  EXPECT_EQ(slice1, std::string(reinterpret_cast<const char *>(data), size));
+  EXPECT_EQ(message.size(), size);
+  EXPECT_EQ(message, std::string(reinterpret_cast<const char *>(data), size));
 
-  // Back up to the start of slice1 & skip forward some bytes
-  // Skip to the middle of slice1
+  // Back up to the start of the payload & skip into the middle of what
+  // used to be the first slice
   stream.BackUp(size);
   const int kSkip1 = slice1.size() - 10;
   EXPECT_TRUE(stream.Skip(kSkip1));
 
-  EXPECT_EQ(
-      slice1.size() - kSkip1 + slice2.size() + slice3.size() + slice4.size(),
-      stream.BytesAvailable());
+  EXPECT_EQ(message.size() - kSkip1, stream.BytesAvailable());
   EXPECT_EQ(kFrameSize + kSkip1, stream.ByteCount());
 
   EXPECT_TRUE(stream.Next(&data, &size));
-  EXPECT_EQ(slice1.size() - kSkip1, size);
-  EXPECT_EQ(slice1.substr(kSkip1),
+  EXPECT_EQ(message.size() - kSkip1, size);
+  EXPECT_EQ(message.substr(kSkip1),
             std::string(reinterpret_cast<const char *>(data), size));
 
-  // Back up some and skip even more, into slice
-  stream.BackUp(10);
+  // Back up to 10 bytes before the old first slice boundary and skip
+  // over that boundary
+  stream.BackUp(10 + slice2.size() + slice3.size() + slice4.size());
   const int kInSlice2 = 3;
   const int kSkip2 = 10 + kInSlice2;
   EXPECT_TRUE(stream.Skip(kSkip2));
@@ -316,38 +286,8 @@ TEST_F(GrpcZeroCopyInputStreamTest, Skips) {
   EXPECT_EQ(kFrameSize + slice1.size() + kInSlice2, stream.ByteCount());
 
   ASSERT_TRUE(stream.Next(&data, &size));
-  ASSERT_EQ(slice2.size() - kInSlice2, size);
-  EXPECT_EQ(slice2.substr(kInSlice2),
-            std::string(reinterpret_cast<const char *>(data), size));
-
-  // Back up 10 bytes in slice2 some and skip to end of slice2.
-  stream.BackUp(10);
-  ASSERT_TRUE(stream.Skip(10));
-  EXPECT_EQ(slice3.size() + slice4.size(), stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize + slice1.size() + slice2.size(), stream.ByteCount());
-
-  // Back up some and skip to last byte of second slice.
-  stream.BackUp(3);
-  EXPECT_TRUE(stream.Skip(2));
-  EXPECT_EQ(1 + slice3.size() + slice4.size(), stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize + slice1.size() + slice2.size() - 1, stream.ByteCount());
-
-  // Test the last byte of the second slice
-  EXPECT_TRUE(stream.Next(&data, &size));
-  EXPECT_EQ(1, size);
-  EXPECT_EQ(slice2.substr(slice2.size() - 1),
-            std::string(reinterpret_cast<const char *>(data), size));
-
-  // Back up and skip over all of slice 3 and then into slice 4
-  stream.BackUp(10);
-  EXPECT_TRUE(stream.Skip(10 + slice3.size() + 8));
-  EXPECT_EQ(slice4.size() - 8, stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize + slice1.size() + slice2.size() + slice3.size() + 8,
-            stream.ByteCount());
-
-  EXPECT_TRUE(stream.Next(&data, &size));
-  EXPECT_EQ(slice4.size() - 8, size);
-  EXPECT_EQ(slice4.substr(8),
+  ASSERT_EQ(slice2.size() - kInSlice2 + slice3.size() + slice4.size(), size);
+  EXPECT_EQ(message.substr(slice1.size() + kInSlice2),
             std::string(reinterpret_cast<const char *>(data), size));
 
   // Now Back up, skip exactly to end of stream and back up again
@@ -355,21 +295,17 @@ TEST_F(GrpcZeroCopyInputStreamTest, Skips) {
   EXPECT_TRUE(stream.Skip(4));
   stream.BackUp(4);
   EXPECT_EQ(4, stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize - 4 + slice1.size() + slice2.size() + slice3.size() +
-                slice4.size(),
-            stream.ByteCount());
+  EXPECT_EQ(kFrameSize - 4 + message.size(), stream.ByteCount());
 
   EXPECT_TRUE(stream.Next(&data, &size));
   EXPECT_EQ(4, size);
-  EXPECT_EQ(slice4.substr(slice4.size() - 4),
+  EXPECT_EQ(message.substr(message.size() - 4),
             std::string(reinterpret_cast<const char *>(data), size));
 
   // Skip past the end of the stream
   EXPECT_FALSE(stream.Skip(100));
   EXPECT_EQ(0, stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize + slice1.size() + slice2.size() + slice3.size() +
-                slice4.size(),
-            stream.ByteCount());
+  EXPECT_EQ(kFrameSize + message.size(), stream.ByteCount());
 
   // Check the end of the stream
   EXPECT_FALSE(stream.Next(&data, &size));
@@ -377,9 +313,61 @@ TEST_F(GrpcZeroCopyInputStreamTest, Skips) {
   // Skip even some more
   EXPECT_FALSE(stream.Skip(100));
   EXPECT_EQ(0, stream.BytesAvailable());
-  EXPECT_EQ(kFrameSize + slice1.size() + slice2.size() + slice3.size() +
-                slice4.size(),
-            stream.ByteCount());
+  EXPECT_EQ(kFrameSize + message.size(), stream.ByteCount());
+}
+
+TEST_F(GrpcZeroCopyInputStreamTest, SpilledMessages) {
+  GrpcZeroCopyInputStream stream;
+
+  // Force everything past the small message to spill, so the large message
+  // is served from the temporary file in multiple chunks (the chunk size
+  // is 64K).
+  stream.set_spill_threshold(1024);
+
+  std::string small = "000000000000000000000A small in-memory message\n";
+  std::string large(200 * 1024, 'x');
+  for (size_t i = 0; i < large.size(); ++i) {
+    large[i] = static_cast<char>('a' + i % 26);
+  }
+
+  stream.AddMessage(CreateByteBuffer(SliceData{large}), true);
+  stream.AddMessage(CreateByteBuffer(SliceData{small}), true);
+  stream.Finish();
+
+  // The byte accounting must not change because a message was spilled.
+  EXPECT_EQ(large.size() + small.size() + 2 * kFrameSize,
+            stream.BytesAvailable());
+
+  // Test the spilled message delimiter.
+  const void *data = nullptr;
+  int size = -1;
+  EXPECT_TRUE(stream.Next(&data, &size));
+  EXPECT_EQ(kFrameSize, size);
+  EXPECT_EQ(large.size(),
+            DelimiterToSize(reinterpret_cast<const unsigned char *>(data)));
+
+  // Reassemble the spilled payload from the chunks.
+  std::string actual;
+  while (actual.size() < large.size()) {
+    EXPECT_TRUE(stream.Next(&data, &size));
+    ASSERT_LT(0, size);
+    actual.append(reinterpret_cast<const char *>(data), size);
+  }
+  EXPECT_EQ(large, actual);
+
+  // The small message must still follow, served from memory.
+  EXPECT_TRUE(stream.Next(&data, &size));
+  EXPECT_EQ(kFrameSize, size);
+  EXPECT_EQ(small.size(),
+            DelimiterToSize(reinterpret_cast<const unsigned char *>(data)));
+
+  EXPECT_TRUE(stream.Next(&data, &size));
+  EXPECT_EQ(small.size(), size);
+  EXPECT_EQ(small, std::string(reinterpret_cast<const char *>(data), size));
+
+  // Test the end of the stream
+  EXPECT_EQ(0, stream.BytesAvailable());
+  EXPECT_FALSE(stream.Next(&data, &size));
 }
 
 TEST_F(GrpcZeroCopyInputStreamTest, NotOwnedMessages) {
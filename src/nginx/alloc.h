@@ -29,19 +29,26 @@
 // Nginx pool-aware allocator support.
 //
 // This header provides functions for constructing objects in nginx
-// pools (placement-new).
+// pools (placement-new). In allocation-stats builds the pool-backed
+// allocations made through these adapters are counted into the
+// calling thread's allocation counters; see alloc_stats.h.
 
 #include <string>
+#include <utility>
 
 extern "C" {
 #include "src/core/ngx_core.h"
 }
 
+#include "src/nginx/alloc_stats.h"
+
 inline void *operator new(std::size_t sz, ngx_pool_t *pool) {
+  ::google::api_manager::nginx::ngx_esp_count_pool_alloc(sz);
   return ngx_pcalloc(pool, sz);
 }
 
 inline void *operator new[](std::size_t sz, ngx_pool_t *pool) {
+  ::google::api_manager::nginx::ngx_esp_count_pool_alloc(sz);
   return ngx_pcalloc(pool, sz);
 }
 
@@ -70,6 +77,7 @@ class PoolAllocator {
   PoolAllocator() : pool_(nullptr) {}  // Required by libg++
 
   T *allocate(std::size_t count) {
+    ngx_esp_count_pool_alloc(count * sizeof(T));
     return static_cast<T *>(ngx_pcalloc(pool_, count * sizeof(T)));
   }
 
@@ -163,6 +171,16 @@ T *RegisterPoolCleanup(ngx_pool_t *pool, T *it) {
   return it;
 }
 
+// Constructs a T from the pool with the given arguments and registers a
+// cleanup handler so that the destructor runs when the pool is destroyed.
+// The object must not be referenced after the pool is destroyed.
+//
+// Returns nullptr if the pool is out of memory.
+template <typename T, typename... Args>
+T *NewPoolObject(ngx_pool_t *pool, Args &&... args) {
+  return RegisterPoolCleanup(pool, new (pool) T(std::forward<Args>(args)...));
+}
+
 }  // namespace nginx
 }  // namespace api_manager
 }  // namespace google
@@ -0,0 +1,207 @@
+// Copyright (C) Extensible Service Proxy Authors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/nginx/alloc_stats.h"
+
+#ifdef ESP_ALLOC_STATS
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "src/nginx/module.h"
+#include "src/nginx/profiler.h"
+#include "src/nginx/status.h"
+
+namespace google {
+namespace api_manager {
+namespace nginx {
+
+// Counts every C++ heap allocation made by this thread; see the operator
+// new replacements below.
+thread_local ngx_esp_alloc_counters_t tls_counters = {0, 0, 0};
+
+// Live heap bytes of this thread and their peak since the current scope
+// started. Frees of blocks allocated before tracking began (or on
+// another thread) can push live below zero, hence signed.
+thread_local int64_t tls_live = 0;
+thread_local int64_t tls_live_peak = 0;
+
+// Pool-backed bytes counted by ngx_esp_count_pool_alloc. Pool memory is
+// only returned when the owning pool is destroyed, so within a scope it
+// counts toward the high-water mark in full.
+thread_local uint64_t tls_pool_bytes = 0;
+
+void *counted_alloc(size_t sz) {
+  ++tls_counters.count;
+  tls_counters.bytes += sz;
+  // Feeds the on-demand heap profiler; one relaxed load while idle.
+  ngx_esp_profiler_count_alloc(sz);
+  void *ptr = malloc(sz);
+  if (ptr != nullptr) {
+    // Track the block's usable size, so the matching free (which only
+    // sees the pointer) subtracts exactly what was added.
+    tls_live += malloc_usable_size(ptr);
+    if (tls_live > tls_live_peak) {
+      tls_live_peak = tls_live;
+    }
+  }
+  return ptr;
+}
+
+void counted_free(void *ptr) {
+  if (ptr != nullptr) {
+    tls_live -= malloc_usable_size(ptr);
+  }
+  free(ptr);
+}
+
+ngx_esp_alloc_counters_t ngx_esp_thread_alloc_counters() {
+  return tls_counters;
+}
+
+void ngx_esp_count_pool_alloc(size_t sz) {
+  ++tls_counters.count;
+  tls_counters.bytes += sz;
+  tls_pool_bytes += sz;
+}
+
+AllocStatsScope::AllocStatsScope(ngx_esp_alloc_counters_t *target)
+    : target_(target), base_(tls_counters) {
+  base_live_ = tls_live;
+  base_pool_bytes_ = tls_pool_bytes;
+  tls_live_peak = tls_live;
+}
+
+AllocStatsScope::~AllocStatsScope() {
+  target_->count += tls_counters.count - base_.count;
+  target_->bytes += tls_counters.bytes - base_.bytes;
+
+  // The scope's peak: how far live heap bytes rose above the level at
+  // entry, plus the pool bytes the scope acquired. The request's mark is
+  // the maximum over its scopes, so it is dominated by the most
+  // expensive phase; bytes still live across phase boundaries are not
+  // carried over.
+  uint64_t peak = tls_pool_bytes - base_pool_bytes_;
+  if (tls_live_peak > base_live_) {
+    peak += tls_live_peak - base_live_;
+  }
+  if (peak > target_->high_water) {
+    target_->high_water = peak;
+  }
+}
+
+void ngx_esp_record_method_alloc_stats(
+    ngx_http_request_t *r, const char *selector,
+    const ngx_esp_alloc_counters_t &counters) {
+  auto *mc = reinterpret_cast<ngx_esp_main_conf_t *>(
+      ngx_http_get_module_main_conf(r, ngx_esp_module));
+  if (mc == nullptr || mc->stats_zone == nullptr) {
+    return;
+  }
+  auto *process_stats =
+      reinterpret_cast<ngx_esp_process_stats_t *>(mc->stats_zone->data);
+  auto &stats = process_stats[ngx_worker];
+
+  // Bucket the request's high-water mark into the worker histogram:
+  // bucket i covers marks below kAllocHighWaterFirstBucketBytes << i,
+  // the last bucket everything beyond.
+  int bucket = 0;
+  while (bucket < kAllocHighWaterBuckets - 1 &&
+         counters.high_water >=
+             (uint64_t(kAllocHighWaterFirstBucketBytes) << bucket)) {
+    ++bucket;
+  }
+  ++stats.alloc_high_water_histogram[bucket];
+
+  auto *rows = stats.method_alloc_stats;
+  for (int i = 0; i < kMaxAllocStatsMethods; ++i) {
+    if (rows[i].selector[0] == '\0') {
+      strncpy(rows[i].selector, selector, kMaxMethodSelectorSize - 1);
+      rows[i].selector[kMaxMethodSelectorSize - 1] = '\0';
+    }
+    if (strncmp(rows[i].selector, selector, kMaxMethodSelectorSize - 1) == 0) {
+      ++rows[i].requests;
+      rows[i].alloc_count += counters.count;
+      rows[i].alloc_bytes += counters.bytes;
+      if (counters.high_water > rows[i].high_water_max) {
+        rows[i].high_water_max = counters.high_water;
+      }
+      return;
+    }
+  }
+  // Table full: the request is not attributed per method.
+}
+
+}  // namespace nginx
+}  // namespace api_manager
+}  // namespace google
+
+// Replace the global allocation functions so every C++ allocation in the
+// worker is counted, and the deallocation functions so live bytes can be
+// tracked for the high-water mark.
+void *operator new(size_t sz) {
+  void *ptr = ::google::api_manager::nginx::counted_alloc(sz);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void *operator new[](size_t sz) {
+  void *ptr = ::google::api_manager::nginx::counted_alloc(sz);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void *operator new(size_t sz, const std::nothrow_t &) noexcept {
+  return ::google::api_manager::nginx::counted_alloc(sz);
+}
+
+void *operator new[](size_t sz, const std::nothrow_t &) noexcept {
+  return ::google::api_manager::nginx::counted_alloc(sz);
+}
+
+void operator delete(void *ptr) noexcept {
+  ::google::api_manager::nginx::counted_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+  ::google::api_manager::nginx::counted_free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  ::google::api_manager::nginx::counted_free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  ::google::api_manager::nginx::counted_free(ptr);
+}
+
+#endif  // ESP_ALLOC_STATS
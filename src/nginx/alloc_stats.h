@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) Extensible Service Proxy Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef NGINX_NGX_ESP_ALLOC_STATS_H_
+#define NGINX_NGX_ESP_ALLOC_STATS_H_
+
+// Opt-in per-request allocation accounting.
+//
+// When ESP is built with --define=alloc_stats=1, the worker's C++ heap
+// allocations (global operator new) are counted into thread-local
+// counters. An AllocStatsScope attributes the allocations made while it
+// is live to a per-request accumulator, and
+// ngx_esp_record_method_alloc_stats() aggregates completed requests per
+// method selector into the worker's stats block, which
+// /endpoints_status renders as method_alloc_stats.
+//
+// Only the synchronously executed portions of request processing are
+// wrapped in a scope (request handler creation, the Check call, the
+// Report call); allocations made by asynchronous continuations such as
+// token fetch responses are not attributed. In regular builds everything
+// here compiles to nothing.
+//
+// Besides the churn counters, each scope tracks a memory high-water
+// mark: the peak of live heap bytes over the scope (frees are observed
+// through the operator delete replacements) plus the pool-backed bytes
+// the scope acquired, which stay live until the request is torn down.
+// The per-request mark is the maximum over the request's scopes; it is
+// recorded per method in the worker stats, bucketed into a worker-wide
+// histogram, and reported as the memory_high_water_mark_in_bytes log
+// field, so RSS growth can be attributed to request classes.
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern "C" {
+#include "src/http/ngx_http.h"
+}
+
+namespace google {
+namespace api_manager {
+namespace nginx {
+
+// Allocation counters; one of these is embedded in each request
+// context as its accumulator.
+struct ngx_esp_alloc_counters_t {
+  uint64_t count;
+  uint64_t bytes;
+  // Peak bytes live at one time on behalf of the request; see above.
+  uint64_t high_water;
+};
+
+#ifdef ESP_ALLOC_STATS
+
+// Returns a snapshot of the calling thread's allocation counters.
+ngx_esp_alloc_counters_t ngx_esp_thread_alloc_counters();
+
+// Counts one pool-backed allocation (nginx pool placement-new, the
+// PoolAllocator, grpc/transcoding buffer acquisition) into the calling
+// thread's counters, so the live AllocStatsScope attributes it.
+void ngx_esp_count_pool_alloc(size_t sz);
+
+// Attributes the allocations made on this thread during the scope's
+// lifetime to the target accumulator. Scopes must not be nested: the
+// inner scope's allocations would be counted twice.
+class AllocStatsScope {
+ public:
+  explicit AllocStatsScope(ngx_esp_alloc_counters_t *target);
+  ~AllocStatsScope();
+
+ private:
+  ngx_esp_alloc_counters_t *target_;
+  ngx_esp_alloc_counters_t base_;
+  // Live heap and pool byte levels at scope entry; see alloc_stats.cc.
+  int64_t base_live_;
+  uint64_t base_pool_bytes_;
+};
+
+// Adds one completed request's accumulated counters to the per-method
+// table in this worker's stats block. Requests beyond the table capacity
+// (kMaxAllocStatsMethods distinct selectors) are dropped.
+void ngx_esp_record_method_alloc_stats(
+    ngx_http_request_t *r, const char *selector,
+    const ngx_esp_alloc_counters_t &counters);
+
+#else
+
+inline ngx_esp_alloc_counters_t ngx_esp_thread_alloc_counters() {
+  return ngx_esp_alloc_counters_t{0, 0, 0};
+}
+
+inline void ngx_esp_count_pool_alloc(size_t) {}
+
+class AllocStatsScope {
+ public:
+  explicit AllocStatsScope(ngx_esp_alloc_counters_t *) {}
+};
+
+inline void ngx_esp_record_method_alloc_stats(
+    ngx_http_request_t *, const char *, const ngx_esp_alloc_counters_t &) {}
+
+#endif  // ESP_ALLOC_STATS
+
+}  // namespace nginx
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // NGINX_NGX_ESP_ALLOC_STATS_H_
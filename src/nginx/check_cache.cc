@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) Extensible Service Proxy Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "src/nginx/check_cache.h"
+
+#include "src/nginx/module.h"
+
+namespace google {
+namespace api_manager {
+namespace nginx {
+
+namespace {
+
+ngx_str_t shm_name = ngx_string("esp_check_cache");
+
+// The number of slots in the cache table.
+const ngx_uint_t kCheckCacheSlots = 4096;
+
+// Slot sizing. Keys or responses that do not fit are simply not cached.
+const size_t kMaxKeySize = 128;
+const size_t kMaxResponseSize = 376;
+
+// A fixed-size cache slot. The shared memory is zero-initialized, so a
+// never-written slot has expires == 0 and misses.
+struct ngx_esp_check_cache_slot_t {
+  time_t expires;
+  uint16_t key_len;
+  uint16_t response_len;
+  u_char key[kMaxKeySize];
+  u_char response[kMaxResponseSize];
+};
+
+ngx_int_t ngx_esp_check_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data) {
+  if (data) {  // nginx is being reloaded, propagate the data
+    shm_zone->data = data;
+    return NGX_OK;
+  }
+
+  // nginx will initialize a slab pool in shared memory; only its mutex is
+  // used, the slot table lives behind the pool header.
+  shm_zone->data = shm_zone->shm.addr + sizeof(ngx_slab_pool_t);
+
+  return NGX_OK;
+}
+
+ngx_esp_check_cache_slot_t *find_slot(ngx_shm_zone_t *zone,
+                                      const std::string &key) {
+  auto *slots = reinterpret_cast<ngx_esp_check_cache_slot_t *>(zone->data);
+  uint32_t hash = ngx_crc32_long(
+      reinterpret_cast<u_char *>(const_cast<char *>(key.data())), key.size());
+  return &slots[hash % kCheckCacheSlots];
+}
+
+}  // namespace
+
+bool NgxEspSharedCheckCache::Lookup(const std::string &key,
+                                    std::string *response) {
+  if (zone_ == nullptr || zone_->data == nullptr || key.size() > kMaxKeySize) {
+    return false;
+  }
+
+  auto *shpool = reinterpret_cast<ngx_slab_pool_t *>(zone_->shm.addr);
+  auto *slot = find_slot(zone_, key);
+
+  bool hit = false;
+  ngx_shmtx_lock(&shpool->mutex);
+  if (slot->expires > ngx_time() && slot->key_len == key.size() &&
+      ngx_memcmp(slot->key, key.data(), key.size()) == 0) {
+    response->assign(reinterpret_cast<const char *>(slot->response),
+                     slot->response_len);
+    hit = true;
+  }
+  ngx_shmtx_unlock(&shpool->mutex);
+
+  return hit;
+}
+
+void NgxEspSharedCheckCache::Insert(const std::string &key,
+                                    const std::string &response,
+                                    int expiration_ms) {
+  if (zone_ == nullptr || zone_->data == nullptr || key.size() > kMaxKeySize ||
+      response.size() > kMaxResponseSize || expiration_ms <= 0) {
+    return;
+  }
+
+  auto *shpool = reinterpret_cast<ngx_slab_pool_t *>(zone_->shm.addr);
+  auto *slot = find_slot(zone_, key);
+  time_t expires = ngx_time() + (expiration_ms + 999) / 1000;
+
+  ngx_shmtx_lock(&shpool->mutex);
+  slot->expires = expires;
+  slot->key_len = key.size();
+  slot->response_len = response.size();
+  ngx_memcpy(slot->key, key.data(), key.size());
+  ngx_memcpy(slot->response, response.data(), response.size());
+  ngx_shmtx_unlock(&shpool->mutex);
+}
+
+ngx_int_t ngx_esp_add_check_cache_shared_memory(ngx_conf_t *cf) {
+  // nginx will initialize a slab pool in shared memory; the slot table is
+  // placed behind the pool header.
+  size_t shm_size = sizeof(ngx_slab_pool_t) +
+                    sizeof(ngx_esp_check_cache_slot_t) * kCheckCacheSlots;
+
+  auto *shm = ngx_shared_memory_add(cf, &shm_name, shm_size, &ngx_esp_module);
+
+  if (shm == nullptr) {
+    ngx_log_error(NGX_LOG_ERR, cf->log, 0,
+                  "Failed to add shared memory for the check cache");
+    return NGX_ERROR;
+  }
+
+  shm->init = ngx_esp_check_cache_init_zone;
+
+  ngx_esp_main_conf_t *mc = reinterpret_cast<ngx_esp_main_conf_t *>(
+      ngx_http_conf_get_module_main_conf(cf, ngx_esp_module));
+
+  mc->check_cache_zone = shm;
+
+  return NGX_OK;
+}
+
+}  // namespace nginx
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) Extensible Service Proxy Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef NGINX_NGX_ESP_CHECK_CACHE_H_
+#define NGINX_NGX_ESP_CHECK_CACHE_H_
+
+#include <string>
+
+#include "include/api_manager/shared_check_cache.h"
+
+extern "C" {
+#include "src/http/ngx_http.h"
+}
+
+namespace google {
+namespace api_manager {
+namespace nginx {
+
+// The nginx implementation of SharedCheckCache, backed by a shared memory
+// zone so that all worker processes see the same check responses. The zone
+// holds a direct-mapped table of fixed-size slots; a key hashes to exactly
+// one slot and an insert overwrites whatever the slot held. The slab pool
+// mutex of the zone guards cross-worker access.
+class NgxEspSharedCheckCache : public SharedCheckCache {
+ public:
+  // zone may be nullptr, in which case every lookup misses and inserts are
+  // dropped.
+  explicit NgxEspSharedCheckCache(ngx_shm_zone_t *zone) : zone_(zone) {}
+
+  virtual bool Lookup(const std::string &key, std::string *response);
+
+  virtual void Insert(const std::string &key, const std::string &response,
+                      int expiration_ms);
+
+  bool enabled() const { return zone_ != nullptr; }
+
+ private:
+  // The shared memory zone backing the cache. Not owned.
+  ngx_shm_zone_t *zone_;
+};
+
+// Adds shared memory for the cross-worker check cache
+ngx_int_t ngx_esp_add_check_cache_shared_memory(ngx_conf_t *cf);
+
+}  // namespace nginx
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // NGINX_NGX_ESP_CHECK_CACHE_H_
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) Extensible Service Proxy Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "src/nginx/circuit_breaker.h"
+
+#include "src/nginx/module.h"
+
+namespace google {
+namespace api_manager {
+namespace nginx {
+
+namespace {
+
+ngx_str_t shm_name = ngx_string("esp_circuit_breaker");
+
+// The number of slots in the breaker table. ESP only calls a handful of
+// distinct endpoints, so this bound is generous.
+const ngx_uint_t kBreakerSlots = 64;
+
+// Destinations longer than a slot key are not tracked.
+const size_t kMaxDestinationSize = 96;
+
+// Consecutive transport failures that open the breaker.
+const uint32_t kBreakerFailureThreshold = 5;
+
+// How long an open breaker rejects calls before admitting a half-open
+// probe.
+const time_t kBreakerOpenSeconds = 5;
+
+// How long an admitted probe keeps other calls out. If the probe result
+// has not come back by then, another probe is admitted.
+const time_t kBreakerProbeSeconds = 10;
+
+// A fixed-size breaker slot. The shared memory is zero-initialized, so a
+// never-written slot has failures == 0 and allows every call.
+struct ngx_esp_breaker_slot_t {
+  // While in the future, the breaker is open and calls are rejected.
+  time_t open_until;
+  // While in the future, a half-open probe is in flight and further
+  // calls are rejected.
+  time_t probe_until;
+  // Consecutive transport failures; reset by any success.
+  uint32_t failures;
+  uint16_t key_len;
+  u_char key[kMaxDestinationSize];
+};
+
+ngx_int_t ngx_esp_breaker_init_zone(ngx_shm_zone_t *shm_zone, void *data) {
+  if (data) {  // nginx is being reloaded, propagate the data
+    shm_zone->data = data;
+    return NGX_OK;
+  }
+
+  // nginx will initialize a slab pool in shared memory; only its mutex is
+  // used, the slot table lives behind the pool header.
+  shm_zone->data = shm_zone->shm.addr + sizeof(ngx_slab_pool_t);
+
+  return NGX_OK;
+}
+
+ngx_esp_breaker_slot_t *find_slot(ngx_shm_zone_t *zone,
+                                  const std::string &key) {
+  auto *slots = reinterpret_cast<ngx_esp_breaker_slot_t *>(zone->data);
+  uint32_t hash = ngx_crc32_long(
+      reinterpret_cast<u_char *>(const_cast<char *>(key.data())), key.size());
+  return &slots[hash % kBreakerSlots];
+}
+
+bool slot_matches(const ngx_esp_breaker_slot_t *slot, const std::string &key) {
+  return slot->key_len == key.size() &&
+         ngx_memcmp(slot->key, key.data(), key.size()) == 0;
+}
+
+}  // namespace
+
+bool ngx_esp_breaker_allow_call(ngx_shm_zone_t *zone,
+                                const std::string &destination) {
+  if (zone == nullptr || zone->data == nullptr ||
+      destination.size() > kMaxDestinationSize) {
+    return true;
+  }
+
+  auto *shpool = reinterpret_cast<ngx_slab_pool_t *>(zone->shm.addr);
+  auto *slot = find_slot(zone, destination);
+  time_t now = ngx_time();
+
+  bool allow = true;
+  ngx_shmtx_lock(&shpool->mutex);
+  if (slot_matches(slot, destination) &&
+      slot->failures >= kBreakerFailureThreshold) {
+    if (now < slot->open_until || now < slot->probe_until) {
+      allow = false;
+    } else {
+      // Half-open: admit this call as the probe and keep the rest out
+      // until its result comes back.
+      slot->probe_until = now + kBreakerProbeSeconds;
+    }
+  }
+  ngx_shmtx_unlock(&shpool->mutex);
+
+  return allow;
+}
+
+void ngx_esp_breaker_record_result(ngx_shm_zone_t *zone,
+                                   const std::string &destination,
+                                   bool success) {
+  if (zone == nullptr || zone->data == nullptr || destination.empty() ||
+      destination.size() > kMaxDestinationSize) {
+    return;
+  }
+
+  auto *shpool = reinterpret_cast<ngx_slab_pool_t *>(zone->shm.addr);
+  auto *slot = find_slot(zone, destination);
+
+  ngx_shmtx_lock(&shpool->mutex);
+  if (success) {
+    // A success of a colliding destination must not close another
+    // destination's breaker, so mismatched slots are left alone.
+    if (slot_matches(slot, destination)) {
+      slot->failures = 0;
+      slot->open_until = 0;
+      slot->probe_until = 0;
+    }
+  } else {
+    if (!slot_matches(slot, destination)) {
+      // Claim the slot, overwriting whatever it held.
+      slot->key_len = destination.size();
+      ngx_memcpy(slot->key, destination.data(), destination.size());
+      slot->failures = 0;
+      slot->open_until = 0;
+    }
+    slot->failures++;
+    slot->probe_until = 0;
+    if (slot->failures >= kBreakerFailureThreshold) {
+      slot->open_until = ngx_time() + kBreakerOpenSeconds;
+    }
+  }
+  ngx_shmtx_unlock(&shpool->mutex);
+}
+
+ngx_int_t ngx_esp_add_breaker_shared_memory(ngx_conf_t *cf) {
+  // nginx will initialize a slab pool in shared memory; the slot table is
+  // placed behind the pool header.
+  size_t shm_size = sizeof(ngx_slab_pool_t) +
+                    sizeof(ngx_esp_breaker_slot_t) * kBreakerSlots;
+
+  auto *shm = ngx_shared_memory_add(cf, &shm_name, shm_size, &ngx_esp_module);
+
+  if (shm == nullptr) {
+    ngx_log_error(NGX_LOG_ERR, cf->log, 0,
+                  "Failed to add shared memory for the circuit breaker");
+    return NGX_ERROR;
+  }
+
+  shm->init = ngx_esp_breaker_init_zone;
+
+  ngx_esp_main_conf_t *mc = reinterpret_cast<ngx_esp_main_conf_t *>(
+      ngx_http_conf_get_module_main_conf(cf, ngx_esp_module));
+
+  mc->breaker_zone = shm;
+
+  return NGX_OK;
+}
+
+}  // namespace nginx
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) Extensible Service Proxy Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef NGINX_NGX_ESP_CIRCUIT_BREAKER_H_
+#define NGINX_NGX_ESP_CIRCUIT_BREAKER_H_
+
+#include <string>
+
+extern "C" {
+#include "src/http/ngx_http.h"
+}
+
+namespace google {
+namespace api_manager {
+namespace nginx {
+
+// A per-destination circuit breaker for the outbound HTTPRequest calls
+// made through http.cc (service control, metadata server, JWKS
+// endpoints). The state is kept in a shared memory zone so all workers
+// share one view of a dead endpoint: once it opens, a single half-open
+// probe is admitted per probe interval instead of every worker hammering
+// the endpoint with its own connect timeouts.
+//
+// The destination key is the authority part of the URL (host with an
+// optional port). The slab pool mutex of the zone guards cross-worker
+// access.
+
+// Adds the shared memory zone backing the breaker.
+ngx_int_t ngx_esp_add_breaker_shared_memory(ngx_conf_t *cf);
+
+// Returns whether a call to the destination may go out. While the
+// breaker for the destination is open, only the half-open probe call is
+// admitted; everything else is rejected without a connection attempt.
+bool ngx_esp_breaker_allow_call(ngx_shm_zone_t *zone,
+                                const std::string &destination);
+
+// Records the transport result of a completed call. Consecutive
+// transport failures open the breaker; any success closes it.
+void ngx_esp_breaker_record_result(ngx_shm_zone_t *zone,
+                                   const std::string &destination,
+                                   bool success);
+
+}  // namespace nginx
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // NGINX_NGX_ESP_CIRCUIT_BREAKER_H_
@@ -36,6 +36,7 @@
 #include "src/api_manager/proto/server_config.pb.h"
 #include "src/api_manager/rewrite_rule.h"
 #include "src/nginx/module.h"
+#include "src/nginx/profiler.h"
 #include "src/nginx/status.h"
 #include "src/nginx/util.h"
 
@@ -444,6 +445,73 @@ char *ngx_esp_configure_status_handler(ngx_conf_t *cf, ngx_command_t *cmd,
   return NGX_CONF_OK;
 }
 
+char *ngx_esp_configure_metrics_handler(ngx_conf_t *cf, ngx_command_t *cmd,
+                                        void *conf) {
+  ngx_int_t rc = ngx_esp_add_stats_shared_memory(cf);
+  if (rc != NGX_OK) {
+    return reinterpret_cast<char *>(NGX_CONF_ERROR);
+  }
+
+  auto *clcf = reinterpret_cast<ngx_http_core_loc_conf_t *>(
+      ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module));
+
+  clcf->handler = ngx_esp_metrics_handler;
+
+  return NGX_CONF_OK;
+}
+
+char *ngx_esp_configure_server_config_reload_handler(ngx_conf_t *cf,
+                                                     ngx_command_t *cmd,
+                                                     void *conf) {
+  auto *clcf = reinterpret_cast<ngx_http_core_loc_conf_t *>(
+      ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module));
+
+  clcf->handler = ngx_esp_server_config_reload_handler;
+
+  return NGX_CONF_OK;
+}
+
+char *ngx_esp_configure_access_events_handler(ngx_conf_t *cf,
+                                              ngx_command_t *cmd, void *conf) {
+  auto *clcf = reinterpret_cast<ngx_http_core_loc_conf_t *>(
+      ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module));
+
+  clcf->handler = ngx_esp_access_events_handler;
+
+  return NGX_CONF_OK;
+}
+
+char *ngx_esp_configure_profile_handler(ngx_conf_t *cf, ngx_command_t *cmd,
+                                        void *conf) {
+  auto *clcf = reinterpret_cast<ngx_http_core_loc_conf_t *>(
+      ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module));
+
+  clcf->handler = ngx_esp_profile_handler;
+
+  return NGX_CONF_OK;
+}
+
+char *ngx_esp_configure_strip_backend_headers(ngx_conf_t *cf,
+                                              ngx_command_t *cmd, void *conf) {
+  auto *lc = reinterpret_cast<ngx_esp_loc_conf_t *>(conf);
+  ngx_str_t *args = reinterpret_cast<ngx_str_t *>(cf->args->elts);
+
+  for (ngx_uint_t i = 1; i < cf->args->nelts; ++i) {
+    ngx_esp_header_match_t match;
+    match.lowcase_name.len = args[i].len;
+    match.lowcase_name.data =
+        reinterpret_cast<u_char *>(ngx_pnalloc(cf->pool, args[i].len));
+    if (match.lowcase_name.data == nullptr) {
+      return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+    match.hash =
+        ngx_hash_strlow(match.lowcase_name.data, args[i].data, args[i].len);
+    lc->strip_backend_headers.push_back(match);
+  }
+
+  return NGX_CONF_OK;
+}
+
 ngx_int_t ngx_esp_read_file(const char *filename, ngx_pool_t *pool,
                             ngx_str_t *data) {
   return ngx_esp_read_file_impl(filename, pool, data, 0);
@@ -508,6 +576,10 @@ bool ngx_esp_read_server_config_from_string(const std::string &str,
   return ::google::protobuf::TextFormat::ParseFromString(str, config);
 }
 
+// How many TLS sessions are kept for resumption of backend channels when
+// tls_session_cache_size is left at 0.
+const ngx_uint_t kDefaultTlsSessionCacheSize = 16;
+
 ngx_int_t ngx_esp_read_grpc_backend_ssl(ngx_conf_t *cf, ngx_esp_loc_conf_t *lc,
                                         const GrpcSslCredentials &grpc_ssl) {
   if (!grpc_ssl.use_ssl()) {
@@ -524,6 +596,17 @@ ngx_int_t ngx_esp_read_grpc_backend_ssl(ngx_conf_t *cf, ngx_esp_loc_conf_t *lc,
   // copy the grpc backend ssl credentials.
   ngx_ssl->use_google_default = grpc_ssl.use_google_default();
 
+  // Resolve the TLS session cache size: 0 keeps the default so backend
+  // reconnects resume by default; a negative value disables resumption.
+  if (grpc_ssl.tls_session_cache_size() < 0) {
+    ngx_ssl->session_cache_size = 0;
+  } else if (grpc_ssl.tls_session_cache_size() == 0) {
+    ngx_ssl->session_cache_size = kDefaultTlsSessionCacheSize;
+  } else {
+    ngx_ssl->session_cache_size =
+        static_cast<ngx_uint_t>(grpc_ssl.tls_session_cache_size());
+  }
+
   // read root_certs file
   if (!grpc_ssl.root_certs_file().empty() &&
       ngx_esp_read_file(grpc_ssl.root_certs_file().c_str(), cf->pool,
@@ -45,6 +45,29 @@ char *ngx_http_endpoints_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 char *ngx_esp_configure_status_handler(ngx_conf_t *cf, ngx_command_t *cmd,
                                        void *conf);
 
+// Sets endpoints Prometheus metrics handler.
+char *ngx_esp_configure_metrics_handler(ngx_conf_t *cf, ngx_command_t *cmd,
+                                        void *conf);
+
+// Sets the server config reload admin handler.
+char *ngx_esp_configure_server_config_reload_handler(ngx_conf_t *cf,
+                                                     ngx_command_t *cmd,
+                                                     void *conf);
+
+// Sets the access event drain handler.
+char *ngx_esp_configure_access_events_handler(ngx_conf_t *cf,
+                                              ngx_command_t *cmd, void *conf);
+
+// Sets the on-demand profiling admin handler.
+char *ngx_esp_configure_profile_handler(ngx_conf_t *cf, ngx_command_t *cmd,
+                                        void *conf);
+
+// Compiles the endpoints_strip_backend_headers list: each header name is
+// lower-cased and hashed at parse time so the forwarding pass matches by
+// hash instead of case-insensitive string compare.
+char *ngx_esp_configure_strip_backend_headers(ngx_conf_t *cf,
+                                              ngx_command_t *cmd, void *conf);
+
 // Config loading utility functions.
 
 // Reads the whole file into a memory block allocated from the pool.
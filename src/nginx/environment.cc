@@ -26,10 +26,15 @@
 //
 #include "src/nginx/environment.h"
 
+#include "src/api_manager/utils/clock.h"
 #include "src/nginx/http.h"
 #include "src/nginx/util.h"
 
+#include <map>
 #include <stdexcept>
+#include <vector>
+
+#include <grpc++/generic/generic_stub.h>
 
 namespace google {
 namespace api_manager {
@@ -44,6 +49,9 @@ void NgxEspEnv::Log(LogLevel level, const char *message) {
     case INFO:
       ngx_level = NGX_LOG_INFO;
       break;
+    case NOTICE:
+      ngx_level = NGX_LOG_NOTICE;
+      break;
     case WARNING:
       ngx_level = NGX_LOG_WARN;
       break;
@@ -58,10 +66,56 @@ void NgxEspEnv::Log(LogLevel level, const char *message) {
   ngx_esp_log(log_, ngx_level, msg);
 }
 
+namespace {
+
+// Coarse time source backed by nginx's cached time, which the event loop
+// refreshes (once per iteration, or at the configured timer_resolution).
+// ngx_timeofday() reads through a slot ring with memory barriers, so
+// reads off the nginx thread see a consistent, if slightly stale, value.
+std::chrono::system_clock::time_point NgxCachedTimeNow() {
+  ngx_time_t *tp = ngx_timeofday();
+  return std::chrono::system_clock::time_point(
+      std::chrono::seconds(tp->sec) + std::chrono::milliseconds(tp->msec));
+}
+
+// ngx_current_msec is nginx's cached monotonic millisecond counter,
+// refreshed by the same ngx_time_update() that refreshes ngx_timeofday().
+std::chrono::steady_clock::time_point NgxCachedSteadyNow() {
+  return std::chrono::steady_clock::time_point(
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::milliseconds(ngx_current_msec)));
+}
+
+}  // namespace
+
+void NgxEspEnv::InstallCoarseClock() {
+  utils::SetCoarseTimeSource(&NgxCachedTimeNow);
+  utils::SetCoarseSteadyTimeSource(&NgxCachedSteadyNow);
+}
+
+namespace {
+
+// Wheel geometry. Timers with an interval of at least one tick share the
+// wheel's single nginx timer; rounding the millisecond drain timers up to
+// a tick would add visible latency, so they keep a dedicated timer. The
+// 512 buckets cover 25.6s per rotation; longer intervals simply stay in
+// their bucket across rotations.
+const ngx_msec_t kWheelTickMs = 50;
+const size_t kWheelBuckets = 512;
+
+}  // namespace
+
 NgxEspTimer::NgxEspTimer(std::chrono::milliseconds interval,
                          std::function<void()> callback, ngx_log_t *log)
-    : stopped_(false), interval_(interval), callback_(callback), log_(log) {
-  AddTimer();
+    : stopped_(false), interval_(interval), callback_(callback), log_(log),
+      linked_(false) {
+  ngx_memzero(&ev_, sizeof(ev_));
+  on_wheel_ = interval_.count() >= static_cast<int64_t>(kWheelTickMs);
+  if (on_wheel_) {
+    NgxEspTimerWheel::Instance(log_)->Add(this);
+  } else {
+    AddTimer();
+  }
 }
 
 NgxEspTimer::~NgxEspTimer() {
@@ -72,7 +126,9 @@ NgxEspTimer::~NgxEspTimer() {
 }
 
 void NgxEspTimer::Stop() {
-  if (ev_.timer_set) {
+  if (on_wheel_) {
+    NgxEspTimerWheel::Instance(log_)->Remove(this);
+  } else if (ev_.timer_set) {
     ngx_del_timer(&ev_);
   }
   stopped_ = true;
@@ -100,6 +156,107 @@ void NgxEspTimer::OnExpiration(ngx_event_t *ev) {
   }
 }
 
+NgxEspTimerWheel *NgxEspTimerWheel::Instance(ngx_log_t *log) {
+  // One wheel per worker process; nginx workers are single-threaded.
+  static NgxEspTimerWheel *wheel = new NgxEspTimerWheel(log);
+  return wheel;
+}
+
+NgxEspTimerWheel::NgxEspTimerWheel(ngx_log_t *log)
+    : current_tick_(0),
+      wheel_msec_(ngx_current_msec),
+      advancing_(false),
+      count_(0),
+      buckets_(kWheelBuckets) {
+  ngx_memzero(&tick_ev_, sizeof(tick_ev_));
+  tick_ev_.data = reinterpret_cast<void *>(this);
+  tick_ev_.handler = &NgxEspTimerWheel::OnTick;
+  tick_ev_.log = log;
+  tick_ev_.cancelable = 1;
+}
+
+void NgxEspTimerWheel::Add(NgxEspTimer *timer) {
+  // Round the interval up to whole ticks; an entry never fires early.
+  uint64_t ticks =
+      (timer->interval_.count() + kWheelTickMs - 1) / kWheelTickMs;
+  timer->expire_tick_ = current_tick_ + (ticks > 0 ? ticks : 1);
+  timer->bucket_ = static_cast<size_t>(timer->expire_tick_ % kWheelBuckets);
+  std::list<NgxEspTimer *> &bucket = buckets_[timer->bucket_];
+  bucket.push_front(timer);
+  timer->bucket_link_ = bucket.begin();
+  timer->linked_ = true;
+  ++count_;
+  if (!tick_ev_.timer_set && !advancing_) {
+    // Waking from idle; restart the tick accounting from now so the
+    // idle period is not replayed as missed ticks.
+    wheel_msec_ = ngx_current_msec;
+    ngx_add_timer(&tick_ev_, kWheelTickMs);
+  }
+}
+
+void NgxEspTimerWheel::Remove(NgxEspTimer *timer) {
+  if (!timer->linked_) {
+    return;
+  }
+  buckets_[timer->bucket_].erase(timer->bucket_link_);
+  timer->linked_ = false;
+  --count_;
+}
+
+void NgxEspTimerWheel::Advance() {
+  // Catch up one tick at a time in case the event loop fell behind.
+  // Entries fired along the way re-arm for a future tick, so the loop
+  // terminates.
+  while (static_cast<ngx_msec_int_t>(ngx_current_msec - wheel_msec_) >=
+         static_cast<ngx_msec_int_t>(kWheelTickMs)) {
+    wheel_msec_ += kWheelTickMs;
+    ++current_tick_;
+    FireBucket(static_cast<size_t>(current_tick_ % kWheelBuckets));
+  }
+}
+
+void NgxEspTimerWheel::FireBucket(size_t index) {
+  std::list<NgxEspTimer *> &bucket = buckets_[index];
+  bool fired = true;
+  while (fired) {
+    fired = false;
+    for (auto it = bucket.begin(); it != bucket.end(); ++it) {
+      NgxEspTimer *timer = *it;
+      if (timer->expire_tick_ > current_tick_) {
+        // Due on a later rotation; leave it in place.
+        continue;
+      }
+      bucket.erase(it);
+      timer->linked_ = false;
+      --count_;
+      timer->callback_();
+      // Warning: the timer object should not be freed in the above
+      // callback function. Otherwise the next line will use freed memory.
+      if (!timer->stopped_) {
+        Add(timer);
+      }
+      // The callback may have stopped arbitrary timers in this bucket,
+      // invalidating the iterator; rescan from the start. A re-added
+      // entry expires on a later tick, so it is skipped above.
+      fired = true;
+      break;
+    }
+  }
+}
+
+void NgxEspTimerWheel::OnTick(ngx_event_t *ev) {
+  if (ev->timer_set || !ev->timedout) {
+    return;
+  }
+  NgxEspTimerWheel *wheel = reinterpret_cast<NgxEspTimerWheel *>(ev->data);
+  wheel->advancing_ = true;
+  wheel->Advance();
+  wheel->advancing_ = false;
+  if (wheel->count_ > 0) {
+    ngx_add_timer(&wheel->tick_ev_, kWheelTickMs);
+  }
+}
+
 std::unique_ptr<PeriodicTimer> NgxEspEnv::StartPeriodicTimer(
     std::chrono::milliseconds interval, std::function<void()> continuation) {
   return std::unique_ptr<PeriodicTimer>(
@@ -110,7 +267,135 @@ void NgxEspEnv::RunHTTPRequest(std::unique_ptr<HTTPRequest> request) {
   ngx_esp_send_http_request(std::move(request));
 }
 
-void NgxEspEnv::RunGRPCRequest(std::unique_ptr<GRPCRequest> request) {}
+void NgxEspEnv::PreresolveUrl(const std::string &url) {
+  ngx_esp_preresolve_url(url);
+}
+
+namespace {
+
+// Strips the URL scheme from a server address and picks the matching
+// channel credentials: http is insecure, https (or a bare address) uses
+// SSL with the default roots.
+std::shared_ptr<::grpc::Channel> CreateGrpcChannel(const std::string &server) {
+  const char kHttp[] = "http://";
+  const char kHttps[] = "https://";
+  std::string address = server;
+  std::shared_ptr<::grpc::ChannelCredentials> credentials;
+  if (address.compare(0, sizeof(kHttp) - 1, kHttp) == 0) {
+    address = address.substr(sizeof(kHttp) - 1);
+    credentials = ::grpc::InsecureChannelCredentials();
+  } else {
+    if (address.compare(0, sizeof(kHttps) - 1, kHttps) == 0) {
+      address = address.substr(sizeof(kHttps) - 1);
+    }
+    credentials = ::grpc::SslCredentials(::grpc::SslCredentialsOptions());
+  }
+  return ::grpc::CreateChannel(address, credentials);
+}
+
+// Returns the generic stub for a server, creating it on first use. One
+// persistent channel per server is shared by every call the worker
+// issues; GRPC multiplexes the concurrent calls over the channel's
+// HTTP/2 connection, so no call pays connection setup once the channel
+// is warm. Only called from the main nginx thread.
+std::shared_ptr<::grpc::GenericStub> GetGrpcStub(const std::string &server) {
+  static auto *stubs =
+      new std::map<std::string, std::shared_ptr<::grpc::GenericStub>>();
+  auto it = stubs->find(server);
+  if (it == stubs->end()) {
+    it = stubs
+             ->emplace(server, std::make_shared<::grpc::GenericStub>(
+                                   CreateGrpcChannel(server)))
+             .first;
+  }
+  return it->second;
+}
+
+// The in-flight state of one generic unary call. Kept alive by the
+// completion tag until the call finishes.
+struct NgxEspGrpcCall {
+  NgxEspGrpcCall(std::unique_ptr<GRPCRequest> request,
+                 std::shared_ptr<::grpc::GenericStub> stub)
+      : request(std::move(request)), stub(std::move(stub)) {}
+
+  std::unique_ptr<GRPCRequest> request;
+  std::shared_ptr<::grpc::GenericStub> stub;
+  ::grpc::ClientContext context;
+  ::grpc::ByteBuffer response_buffer;
+  ::grpc::Status status;
+  std::unique_ptr<::grpc::GenericClientAsyncResponseReader> response_reader;
+};
+
+}  // namespace
+
+void NgxEspEnv::RunGRPCRequest(std::unique_ptr<GRPCRequest> request) {
+  std::shared_ptr<NgxEspGrpcQueue> queue = NgxEspGrpcQueue::TryInstance();
+  if (!queue) {
+    request->OnComplete(
+        utils::Status(NGX_ERROR, "GRPC support is not initialized"),
+        std::string());
+    return;
+  }
+
+  std::shared_ptr<::grpc::GenericStub> stub = GetGrpcStub(request->server());
+  auto call =
+      std::make_shared<NgxEspGrpcCall>(std::move(request), std::move(stub));
+
+  if (!call->request->auth_token().empty()) {
+    call->context.AddMetadata("authorization",
+                              "Bearer " + call->request->auth_token());
+  }
+  if (call->request->timeout_ms() > 0) {
+    call->context.set_deadline(
+        std::chrono::system_clock::now() +
+        std::chrono::milliseconds(call->request->timeout_ms()));
+  }
+
+  ::grpc::Slice body_slice(
+      grpc_slice_from_copied_buffer(call->request->body().data(),
+                                    call->request->body().size()),
+      ::grpc::Slice::STEAL_REF);
+  ::grpc::ByteBuffer request_buffer(&body_slice, 1);
+  std::string method =
+      "/" + call->request->service() + "/" + call->request->method();
+
+  // The callbacks run on the main nginx thread; the queue spreads the
+  // completion-queue polling across its dispatch threads.
+  AsyncGrpcQueue *async_queue = queue->SelectQueue();
+  call->response_reader = call->stub->PrepareUnaryCall(
+      &call->context, method, request_buffer, async_queue->GetQueue());
+  call->response_reader->StartCall();
+  call->response_reader->Finish(
+      &call->response_buffer, &call->status,
+      async_queue->MakeTag([call, queue](bool ok) {
+        if (!ok) {
+          call->request->OnComplete(
+              utils::Status(NGX_ERROR, "GRPC call could not be started"),
+              std::string());
+          return;
+        }
+        if (!call->status.ok()) {
+          call->request->OnComplete(
+              utils::Status(call->status.error_code(),
+                            call->status.error_message()),
+              std::string());
+          return;
+        }
+        std::vector<::grpc::Slice> slices;
+        if (!call->response_buffer.Dump(&slices).ok()) {
+          call->request->OnComplete(
+              utils::Status(NGX_ERROR, "Failed to read GRPC response"),
+              std::string());
+          return;
+        }
+        std::string body;
+        for (const auto &slice : slices) {
+          body.append(reinterpret_cast<const char *>(slice.begin()),
+                      slice.size());
+        }
+        call->request->OnComplete(utils::Status::OK, std::move(body));
+      }));
+}
 
 }  // namespace nginx
 }  // namespace api_manager
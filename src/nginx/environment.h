@@ -26,6 +26,9 @@
 #ifndef NGINX_NGX_ESP_ENV_H_
 #define NGINX_NGX_ESP_ENV_H_
 
+#include <list>
+#include <vector>
+
 #include "include/api_manager/api_manager.h"
 
 extern "C" {
@@ -33,7 +36,9 @@ extern "C" {
 #include "src/http/ngx_http.h"
 }
 
+#include "src/nginx/check_cache.h"
 #include "src/nginx/grpc_queue.h"
+#include "src/nginx/token_cache.h"
 
 namespace google {
 namespace api_manager {
@@ -42,10 +47,21 @@ namespace nginx {
 // The nginx implementation of ApiManagerEnvInterface.
 class NgxEspEnv : public ApiManagerEnvInterface {
  public:
-  NgxEspEnv(ngx_log_t *log) : log_(log) {}
+  NgxEspEnv(ngx_log_t *log, ngx_shm_zone_t *check_cache_zone,
+            ngx_shm_zone_t *token_cache_zone)
+      : log_(log),
+        shared_check_cache_(check_cache_zone),
+        shared_token_cache_(token_cache_zone) {
+    InstallCoarseClock();
+  }
 
   virtual ~NgxEspEnv() {}
 
+  // Points the api_manager coarse clock (utils::CoarseNow) at nginx's
+  // cached time, so coarse reads are a memory load instead of a clock
+  // syscall. Idempotent; called from the constructor.
+  static void InstallCoarseClock();
+
   virtual void Log(LogLevel level, const char *message);
 
   virtual std::unique_ptr<PeriodicTimer> StartPeriodicTimer(
@@ -55,11 +71,27 @@ class NgxEspEnv : public ApiManagerEnvInterface {
 
   virtual void RunGRPCRequest(std::unique_ptr<GRPCRequest> request);
 
+  virtual void PreresolveUrl(const std::string &url);
+
+  virtual SharedCheckCache *shared_check_cache() {
+    return shared_check_cache_.enabled() ? &shared_check_cache_ : nullptr;
+  }
+
+  virtual SharedTokenCache *shared_token_cache() {
+    return shared_token_cache_.enabled() ? &shared_token_cache_ : nullptr;
+  }
+
  private:
   ngx_log_t *log_;
+  NgxEspSharedCheckCache shared_check_cache_;
+  NgxEspSharedTokenCache shared_token_cache_;
 };
 
 // The nginx implementation of PeriodicTimer.
+//
+// Timers with an interval of at least one wheel tick are multiplexed onto
+// the per-worker NgxEspTimerWheel below; only sub-tick timers (the
+// millisecond drain timers) arm a dedicated nginx timer of their own.
 class NgxEspTimer : public PeriodicTimer {
  public:
   NgxEspTimer(std::chrono::milliseconds interval,
@@ -72,15 +104,68 @@ class NgxEspTimer : public PeriodicTimer {
   bool IsStopped() const override { return stopped_; }
 
  private:
+  friend class NgxEspTimerWheel;
+
   void AddTimer();
 
   static void OnExpiration(ngx_event_t *ev);
 
+  // Only used when the interval is below one wheel tick.
   ngx_event_t ev_;
   bool stopped_;
+  // True when the timer is multiplexed onto the wheel.
+  bool on_wheel_;
   std::chrono::milliseconds interval_;
   std::function<void()> callback_;
   ngx_log_t *log_;
+
+  // Wheel linkage; maintained by NgxEspTimerWheel. The entry lives in
+  // buckets_[bucket_] at bucket_link_ until tick expire_tick_.
+  bool linked_;
+  uint64_t expire_tick_;
+  size_t bucket_;
+  std::list<NgxEspTimer *>::iterator bucket_link_;
+};
+
+// A hashed timer wheel multiplexing all coarse ESP periodic work onto a
+// single underlying nginx timer per worker. Entries hash into buckets by
+// expiration tick, so arming and cancelling are O(1) list operations and
+// each tick scans one bucket; without it, every streaming request arming
+// an intermediate-report timer costs an rbtree insertion in nginx's event
+// timer tree.
+class NgxEspTimerWheel {
+ public:
+  // Returns the per-worker wheel, creating it on first use.
+  static NgxEspTimerWheel *Instance(ngx_log_t *log);
+
+  // Links the timer to fire one rounded-up interval from now. The wheel
+  // tick event is armed whenever any entry is linked.
+  void Add(NgxEspTimer *timer);
+
+  // Unlinks the timer if it is linked.
+  void Remove(NgxEspTimer *timer);
+
+ private:
+  explicit NgxEspTimerWheel(ngx_log_t *log);
+
+  // Fires every bucket whose tick has passed since the last advance.
+  void Advance();
+  void FireBucket(size_t index);
+
+  static void OnTick(ngx_event_t *ev);
+
+  ngx_event_t tick_ev_;
+  // The tick the wheel has advanced to, and the wall time it corresponds
+  // to; their difference against ngx_current_msec drives catch-up after a
+  // busy event loop.
+  uint64_t current_tick_;
+  ngx_msec_t wheel_msec_;
+  // True while Advance is running; suppresses re-arming from Add so the
+  // catch-up accounting is not reset mid-advance.
+  bool advancing_;
+  // Number of linked entries across all buckets.
+  size_t count_;
+  std::vector<std::list<NgxEspTimer *>> buckets_;
 };
 
 }  // namespace nginx
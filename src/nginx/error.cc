@@ -29,6 +29,11 @@
 //
 
 #include "src/nginx/error.h"
+
+#include <map>
+#include <tuple>
+
+#include "src/api_manager/utils/format_util.h"
 #include "src/api_manager/utils/marshalling.h"
 #include "src/nginx/grpc_finish.h"
 #include "src/nginx/module.h"
@@ -49,6 +54,8 @@ ngx_str_t www_authenticate = ngx_string("WWW-Authenticate");
 const u_char www_authenticate_lowcase[] = "www-authenticate";
 ngx_str_t kLocation = ngx_string("Location");
 const u_char kLocationLowcase[] = "location";
+ngx_str_t kLatencyHeader = ngx_string("X-Endpoint-Latency");
+const u_char kLatencyHeaderLowcase[] = "x-endpoint-latency";
 ngx_str_t missing_credential = ngx_string("Bearer");
 ngx_str_t invalid_token = ngx_string("Bearer, error=\"invalid_token\"");
 
@@ -60,6 +67,36 @@ const char *kExpiredAuthToken =
 ngx_http_output_header_filter_pt ngx_http_next_header_filter;
 ngx_http_output_body_filter_pt ngx_http_next_body_filter;
 
+// Rendered JSON bodies for statuses carrying canonical messages, keyed
+// by (code, error cause, interned message). During upstream brownouts
+// the same error body is served tens of thousands of times per second;
+// rendering it through the protobuf JSON printer every time dominated
+// the error path. Restricting the cache to canonical messages keeps it
+// bounded. The error filters run on the single worker thread, so the
+// map needs no locking.
+std::map<std::tuple<int, int, const std::string *>, std::string>
+    rendered_error_bodies;
+
+// Returns the cached JSON body for status if its message is canonical,
+// rendering and inserting it on first use. Otherwise renders into
+// *dynamic_json and returns nullptr. Cache entries live for the
+// worker's lifetime, so returned pointers stay valid.
+const std::string *RenderedErrorJson(const Status &status,
+                                     std::string *dynamic_json) {
+  if (!status.has_canonical_message()) {
+    *dynamic_json = status.ToJson();
+    return nullptr;
+  }
+  std::tuple<int, int, const std::string *> key(
+      status.code(), status.error_cause(), &status.message());
+  auto it = rendered_error_bodies.find(key);
+  if (it == rendered_error_bodies.end()) {
+    it = rendered_error_bodies.insert(std::make_pair(key, status.ToJson()))
+             .first;
+  }
+  return &it->second;
+}
+
 /**
  * Note:
  * We rely on 'err_status' field to detect error responses
@@ -142,10 +179,62 @@ ngx_int_t ngx_esp_handle_authorization_url(ngx_http_request_t *r,
   return NGX_OK;
 }
 
+// Attaches the opt-in X-Endpoint-Latency response header carrying the
+// per-phase breakdown the check workflow accumulated, plus the upstream
+// time as nginx measured it. GetLatencyAttribution() returns an empty
+// string unless the client sent the header on the request, so the
+// common path pays one empty-string check.
+void ngx_esp_add_latency_attribution(ngx_http_request_t *r,
+                                     ngx_esp_request_ctx_t *ctx) {
+  if (ctx == nullptr || !ctx->request_handler) {
+    return;
+  }
+  std::string attribution = ctx->request_handler->GetLatencyAttribution();
+  if (attribution.empty()) {
+    return;
+  }
+
+  // Mirrors NgxEspResponse::GetLatencyInfo; millisecond granularity is
+  // all nginx has for the upstream call.
+  int64_t upstream_ms = -1;
+  if (r->upstream_states != nullptr) {
+    upstream_ms = 0;
+    ngx_http_upstream_state_t *states =
+        reinterpret_cast<ngx_http_upstream_state_t *>(
+            r->upstream_states->elts);
+    for (ngx_uint_t i = 0; i < r->upstream_states->nelts; ++i) {
+      upstream_ms += states[i].response_time;
+    }
+  } else if (ctx->backend_time >= 0) {
+    upstream_ms = ctx->backend_time;
+  }
+  if (upstream_ms >= 0) {
+    attribution += ";upstream_ms=";
+    attribution += utils::Int64ToString(upstream_ms);
+  }
+
+  ngx_table_elt_t *h = reinterpret_cast<ngx_table_elt_t *>(
+      ngx_list_push(&r->headers_out.headers));
+  if (h == nullptr) {
+    return;
+  }
+  h->key = kLatencyHeader;
+  h->lowcase_key = const_cast<u_char *>(kLatencyHeaderLowcase);
+  h->hash = ngx_hash_key(const_cast<u_char *>(kLatencyHeaderLowcase),
+                         sizeof(kLatencyHeaderLowcase) - 1);
+  if (ngx_str_copy_from_std(r->pool, attribution, &h->value) != NGX_OK) {
+    // Without a value the header must not go out; a zero hash makes
+    // nginx skip the entry.
+    h->hash = 0;
+  }
+}
+
 ngx_int_t ngx_esp_error_header_filter(ngx_http_request_t *r) {
   ngx_esp_request_ctx_t *ctx = reinterpret_cast<ngx_esp_request_ctx_t *>(
       ngx_http_get_module_ctx(r, ngx_esp_module));
 
+  ngx_esp_add_latency_attribution(r, ctx);
+
   if (ngx_esp_is_error_response(r, ctx)) {
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "ESP error header code: %d", r->err_status);
@@ -203,31 +292,44 @@ ngx_int_t ngx_esp_error_body_filter(ngx_http_request_t *r, ngx_chain_t *in) {
 
     if (!r->header_only) {
       if (!IsGrpcRequest(r)) {
-        // Serialize error as JSON
-        std::string status_in_json;
+        // Serialize error as JSON. Canonical error bodies are served from
+        // the per-worker cache; only parameterized messages and gRPC
+        // status details are rendered here.
+        std::string dynamic_json;
+        const std::string *cached_json = nullptr;
         if (ctx->transcoder_factory && !ctx->grpc_status_details.empty()) {
-          status_in_json = utils::BinStatusToJson(
+          dynamic_json = utils::BinStatusToJson(
               ctx->transcoder_factory->GetStatusResolver(),
               ctx->grpc_status_details);
         } else {
-          status_in_json = ctx->status.ToJson();
+          cached_json = RenderedErrorJson(ctx->status, &dynamic_json);
         }
 
-        ngx_buf_t *body = nullptr;
-        ngx_str_t json_error;
-        if (ngx_str_copy_from_std(r->pool, status_in_json, &json_error) !=
-            NGX_OK) {
-          return NGX_ERROR;
-        }
-        // Create temporary buffer to hold data, discard "in"
-        body = reinterpret_cast<ngx_buf_t *>(ngx_calloc_buf(r->pool));
+        // Create buffer to hold data, discard "in"
+        ngx_buf_t *body =
+            reinterpret_cast<ngx_buf_t *>(ngx_calloc_buf(r->pool));
         if (body == nullptr) {
           return NGX_ERROR;
         }
 
+        ngx_str_t json_error;
+        if (cached_json != nullptr) {
+          // The cached body outlives the request, so the buf references
+          // it directly instead of copying it into the request pool.
+          json_error.data = reinterpret_cast<u_char *>(
+              const_cast<char *>(cached_json->data()));
+          json_error.len = cached_json->size();
+          body->memory = 1;
+        } else {
+          if (ngx_str_copy_from_std(r->pool, dynamic_json, &json_error) !=
+              NGX_OK) {
+            return NGX_ERROR;
+          }
+          body->temporary = 1;
+        }
+
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "send error response: %v", &json_error);
-        body->temporary = 1;
         body->pos = json_error.data;
         body->last = json_error.data + json_error.len;
         body->last_in_chain = 1;
@@ -26,6 +26,10 @@
 //
 #include "src/nginx/grpc.h"
 
+#include <chrono>
+#include <grpc/grpc_security.h>
+#include <string>
+
 #include "src/grpc/proxy_flow.h"
 #include "src/nginx/environment.h"
 #include "src/nginx/error.h"
@@ -47,15 +51,114 @@ const ngx_str_t kContentTypeApplicationGrpc = ngx_string("application/grpc");
 const ngx_str_t kContentTypeApplicationGrpcProto =
     ngx_string("application/grpc+proto");
 
+// Channel argument carrying the index of a channel within its backend pool.
+// Its only purpose is to make the channel arguments of pool members differ.
+const char kGrpcChannelPoolIndexArg[] = "grpc.esp_channel_pool_index";
+
+// Keepalive settings applied to pre-warmed channels: an HTTP/2 ping every
+// 30s (allowed with no calls in flight) keeps the connection established
+// and detects a dead backend within the 10s ping timeout, so the channel
+// is reconnected before the next request instead of by it.
+const int kPrewarmKeepaliveTimeMs = 30000;
+const int kPrewarmKeepaliveTimeoutMs = 10000;
+
+// How long a pre-warmed channel may take to become READY before the
+// connectivity watch gives up and logs a warning.
+const int kPrewarmConnectTimeoutSec = 60;
+
+// Worker-local channel setup statistics, fed by the connectivity watch
+// below: how many watched channels became ready and how long their setup
+// (connect plus TLS handshake) took in total. Logged with every setup so
+// the cost of backend reconnects shows up next to the event causing it.
+// Only watched (pre-warmed) channels are observed.
+ngx_uint_t grpc_channel_setups = 0;
+ngx_uint_t grpc_channel_setup_ms_total = 0;
+
+// Watches a pre-warmed channel until it becomes READY (logging success
+// and the setup latency), the deadline passes, or the queue shuts down.
+// Intermediate state changes (e.g. IDLE -> CONNECTING) re-arm the watch.
+void WatchPrewarmedChannel(
+    const std::string &address, std::shared_ptr<::grpc::Channel> channel,
+    std::chrono::system_clock::time_point start,
+    std::chrono::system_clock::time_point deadline) {
+  auto queue = NgxEspGrpcQueue::TryInstance();
+  if (!queue) {
+    return;
+  }
+  grpc_connectivity_state state = channel->GetState(true);
+  if (state == GRPC_CHANNEL_READY) {
+    ngx_int_t elapsed_ms = static_cast<ngx_int_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now() - start)
+            .count());
+    ++grpc_channel_setups;
+    grpc_channel_setup_ms_total += elapsed_ms;
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                  "Pre-warmed gRPC channel to backend=%s is ready after "
+                  "%i ms (%ui setups, %ui ms in setups so far)",
+                  address.c_str(), elapsed_ms, grpc_channel_setups,
+                  grpc_channel_setup_ms_total);
+    return;
+  }
+  if (std::chrono::system_clock::now() >= deadline) {
+    ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                  "Pre-warmed gRPC channel to backend=%s did not become "
+                  "ready; the first request will pay the connection setup",
+                  address.c_str());
+    return;
+  }
+  channel->NotifyOnStateChange(
+      state, deadline, queue->GetQueue(),
+      NgxEspGrpcQueue::AllocTag(
+          // The flag is false when the deadline expired without a state
+          // change; re-entering then reports the timeout.
+          [address, channel, start, deadline](bool) {
+            WatchPrewarmedChannel(address, channel, start, deadline);
+          }));
+}
+
+// Kicks off connection establishment for a freshly created channel and
+// watches it until it is ready.
+void PrewarmChannel(const std::string &address,
+                    std::shared_ptr<::grpc::Channel> channel) {
+  std::chrono::system_clock::time_point start =
+      std::chrono::system_clock::now();
+  WatchPrewarmedChannel(
+      address, channel, start,
+      start + std::chrono::seconds(kPrewarmConnectTimeoutSec));
+}
+
+// The worker-index placeholder in configured gRPC backend addresses.
+// "backend-$worker:80" gives worker N affinity to its local backend N
+// (DaemonSet-style deployments), keeping NUMA and conntrack locality.
+// Expansion happens before the grpc_stubs lookup, so each worker keys
+// its own channel pool by its own expanded address. The usual ordering
+// keeps a safety net: template the override and leave the fallback (or
+// the service config backend) untemplated so a worker without a local
+// shard still has somewhere to send traffic.
+const char kWorkerIndexToken[] = "$worker";
+
+std::string GrpcExpandBackendAddress(const std::string &address) {
+  std::string expanded = address;
+  const std::string worker = std::to_string(ngx_worker);
+  size_t pos = 0;
+  while ((pos = expanded.find(kWorkerIndexToken, pos)) != std::string::npos) {
+    expanded.replace(pos, sizeof(kWorkerIndexToken) - 1, worker);
+    pos += worker.size();
+  }
+  return expanded;
+}
+
 std::pair<Status, std::string> GrpcGetBackendAddress(
     ngx_log_t *log, ngx_esp_loc_conf_t *espcf, ngx_esp_request_ctx_t *ctx) {
   if (espcf->grpc_backend_address_override.data &&
       espcf->grpc_backend_address_override.len > 0) {
+    std::string address = GrpcExpandBackendAddress(
+        ngx_str_to_std(espcf->grpc_backend_address_override));
     ngx_log_error(NGX_LOG_DEBUG, log, 0,
-                  "GrpcGetBackendAddress: using override address \"%V\"",
-                  &espcf->grpc_backend_address_override);
-    return std::make_pair(Status::OK,
-                          ngx_str_to_std(espcf->grpc_backend_address_override));
+                  "GrpcGetBackendAddress: using override address \"%s\"",
+                  address.c_str());
+    return std::make_pair(Status::OK, std::move(address));
   }
   std::string backend_address = ctx->request_handler->GetBackendAddress();
   if (!backend_address.empty()) {
@@ -66,37 +169,38 @@ std::pair<Status, std::string> GrpcGetBackendAddress(
   }
   if (espcf->grpc_backend_address_fallback.data &&
       espcf->grpc_backend_address_fallback.len > 0) {
+    std::string address = GrpcExpandBackendAddress(
+        ngx_str_to_std(espcf->grpc_backend_address_fallback));
     ngx_log_error(NGX_LOG_DEBUG, log, 0,
-                  "GrpcGetBackendAddress: using fallback address \"%V\"",
-                  &espcf->grpc_backend_address_fallback);
-    return std::make_pair(Status::OK,
-                          ngx_str_to_std(espcf->grpc_backend_address_fallback));
+                  "GrpcGetBackendAddress: using fallback address \"%s\"",
+                  address.c_str());
+    return std::make_pair(Status::OK, std::move(address));
   }
   return std::make_pair(
       Status(NGX_DECLINED, "No GRPC backend address specified"), std::string());
 }
 
 std::shared_ptr<::grpc::ChannelCredentials> CreateChannelCredentials(
-    ngx_http_request_t *r, ngx_esp_loc_conf_t *espcf) {
+    ngx_log_t *log, ngx_esp_loc_conf_t *espcf) {
   if (espcf->grpc_backend_ssl == nullptr) {
-    ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+    ngx_log_error(NGX_LOG_INFO, log, 0,
                   "GrpcGetStub: Use insecure channel credentials");
     return ::grpc::InsecureChannelCredentials();
   }
 
   if (espcf->grpc_backend_ssl->use_google_default) {
-    ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+    ngx_log_error(NGX_LOG_INFO, log, 0,
                   "GrpcGetStub: Use Google default channel credentials");
     return ::grpc::GoogleDefaultCredentials();
   }
 
   auto ssl = ::grpc::SslCredentialsOptions();
-  ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+  ngx_log_error(NGX_LOG_INFO, log, 0,
                 "GrpcGetStub: Use SSL channel credentials");
 
   if (espcf->grpc_backend_ssl->root_certs.data != nullptr) {
     // we have custom roots
-    ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+    ngx_log_error(NGX_LOG_INFO, log, 0,
                   "GrpcGetStub: found custom grpc roots");
     ssl.pem_root_certs = ngx_str_to_std(espcf->grpc_backend_ssl->root_certs);
   }
@@ -104,7 +208,7 @@ std::shared_ptr<::grpc::ChannelCredentials> CreateChannelCredentials(
   // Load key and cert if the user has specified them
   if (espcf->grpc_backend_ssl->private_key.data != nullptr &&
       espcf->grpc_backend_ssl->cert_chain.data != nullptr) {
-    ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+    ngx_log_error(NGX_LOG_INFO, log, 0,
                   "GrpcGetStub: found TLS client key and cert data");
     ssl.pem_private_key = ngx_str_to_std(espcf->grpc_backend_ssl->private_key);
     ssl.pem_cert_chain = ngx_str_to_std(espcf->grpc_backend_ssl->cert_chain);
@@ -112,6 +216,73 @@ std::shared_ptr<::grpc::ChannelCredentials> CreateChannelCredentials(
   return ::grpc::SslCredentials(ssl);
 }
 
+// Creates the channel pool for |address| in espcf->grpc_stubs and returns
+// an iterator to it; returns espcf->grpc_stubs.end() on failure. When the
+// location is configured with prewarm, each channel is asked to connect
+// right away and is watched until ready.
+ngx_esp_grpc_stub_map_t::iterator GrpcCreateStubPool(
+    ngx_log_t *log, ngx_esp_loc_conf_t *espcf, const std::string &address) {
+  ngx_uint_t pool_size =
+      espcf->grpc_channel_pool_size > 0 ? espcf->grpc_channel_pool_size : 1;
+  std::vector<ngx_esp_grpc_backend_channel_t> pool;
+  pool.reserve(pool_size);
+
+  for (ngx_uint_t i = 0; i < pool_size; ++i) {
+    ::grpc::ChannelArguments channel_arguments;
+
+    channel_arguments.SetMaxReceiveMessageSize(INT_MAX);
+    channel_arguments.SetMaxSendMessageSize(INT_MAX);
+    channel_arguments.SetInt(GRPC_ARG_MAX_METADATA_SIZE, INT_MAX);
+    // GRPC shares subchannels (and hence connections) between channels
+    // with identical arguments. Tag each channel with its pool index so
+    // every stub gets an HTTP/2 connection of its own.
+    if (pool_size > 1) {
+      channel_arguments.SetInt(kGrpcChannelPoolIndexArg,
+                               static_cast<int>(i));
+    }
+    if (espcf->grpc_prewarm) {
+      // Keepalive pings keep a pre-warmed connection from going idle
+      // between requests; see kPrewarmKeepaliveTimeMs.
+      channel_arguments.SetInt(GRPC_ARG_KEEPALIVE_TIME_MS,
+                               kPrewarmKeepaliveTimeMs);
+      channel_arguments.SetInt(GRPC_ARG_KEEPALIVE_TIMEOUT_MS,
+                               kPrewarmKeepaliveTimeoutMs);
+      channel_arguments.SetInt(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+      channel_arguments.SetInt(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, 0);
+    }
+    // Cache TLS sessions so a channel re-established after an idle close
+    // resumes the previous session in one round trip instead of a full
+    // handshake. The cache is shared by every channel of the location.
+    if (espcf->grpc_backend_ssl != nullptr &&
+        espcf->grpc_backend_ssl->session_cache_size > 0) {
+      if (espcf->grpc_backend_ssl->session_cache == nullptr) {
+        espcf->grpc_backend_ssl->session_cache =
+            grpc_ssl_session_cache_create_lru(
+                espcf->grpc_backend_ssl->session_cache_size);
+      }
+      channel_arguments.SetPointerWithVtable(
+          GRPC_SSL_SESSION_CACHE_ARG,
+          espcf->grpc_backend_ssl->session_cache,
+          grpc_ssl_session_cache_arg_vtable());
+    }
+
+    std::shared_ptr<::grpc::Channel> channel = ::grpc::CreateCustomChannel(
+        address, CreateChannelCredentials(log, espcf), channel_arguments);
+    if (!channel) {
+      return espcf->grpc_stubs.end();
+    }
+    if (espcf->grpc_prewarm) {
+      PrewarmChannel(address, channel);
+    }
+    ngx_esp_grpc_backend_channel_t entry;
+    entry.channel = channel;
+    entry.stub = std::make_shared<::grpc::GenericStub>(std::move(channel));
+    pool.push_back(std::move(entry));
+  }
+
+  return espcf->grpc_stubs.emplace(address, std::move(pool)).first;
+}
+
 std::pair<Status, std::shared_ptr<::grpc::GenericStub>> GrpcGetStub(
     ngx_http_request_t *r, ngx_esp_loc_conf_t *espcf,
     ngx_esp_request_ctx_t *ctx) {
@@ -126,39 +297,26 @@ std::pair<Status, std::shared_ptr<::grpc::GenericStub>> GrpcGetStub(
                 "GrpcGetStub: connecting to backend=%s", address.c_str());
 
   auto it = espcf->grpc_stubs.find(address);
-  if (it != espcf->grpc_stubs.end()) {
-    return std::make_pair(Status::OK, it->second);
-  }
-
-  ::grpc::ChannelArguments channel_arguments;
-
-  channel_arguments.SetMaxReceiveMessageSize(INT_MAX);
-  channel_arguments.SetMaxSendMessageSize(INT_MAX);
-  channel_arguments.SetInt(GRPC_ARG_MAX_METADATA_SIZE, INT_MAX);
-
-  auto result =
-      std::make_shared<::grpc::GenericStub>(::grpc::CreateCustomChannel(
-          address, CreateChannelCredentials(r, espcf), channel_arguments));
-
-  if (result) {
-    espcf->grpc_stubs.emplace(address, result);
-    return std::make_pair(Status::OK, result);
+  if (it == espcf->grpc_stubs.end()) {
+    it = GrpcCreateStubPool(r->connection->log, espcf, address);
+    if (it == espcf->grpc_stubs.end()) {
+      return std::make_pair(
+          Status(NGX_HTTP_INTERNAL_SERVER_ERROR,
+                 "Unable to create channel to GRPC backend"),
+          std::shared_ptr<::grpc::GenericStub>());
+    }
   }
 
-  return std::make_pair(Status(NGX_HTTP_INTERNAL_SERVER_ERROR,
-                               "Unable to create channel to GRPC backend"),
-                        std::shared_ptr<::grpc::GenericStub>());
-}
-
-std::multimap<std::string, std::string> ExtractMetadata(ngx_http_request_t *r) {
-  std::multimap<std::string, std::string> metadata;
-
-  for (auto &h : r->headers_in) {
-    metadata.emplace(ngx_str_to_std({h.key.len, h.lowcase_key}),
-                     ngx_str_to_std(h.value));
+  // Pick the least-loaded stub of the pool: each active proxy flow holds a
+  // reference to the stub it uses, so the use count of an entry tracks the
+  // number of streams currently on its channel.
+  std::shared_ptr<::grpc::GenericStub> *best = &it->second[0].stub;
+  for (auto &entry : it->second) {
+    if (entry.stub.use_count() < best->use_count()) {
+      best = &entry.stub;
+    }
   }
-
-  return metadata;
+  return std::make_pair(Status::OK, *best);
 }
 
 bool IsGrpcWeb(ngx_http_request_t *r) {
@@ -174,6 +332,15 @@ bool IsGrpcWeb(ngx_http_request_t *r) {
   return false;
 }
 
+bool IsUnaryMethod(ngx_esp_request_ctx_t *ctx) {
+  // The unary fast path in ProxyFlow is only taken when the method the
+  // request resolved to is known to be non-streaming on both sides;
+  // unknown methods keep the general streaming path.
+  return ctx->request_handler && ctx->request_handler->method() &&
+         !ctx->request_handler->method()->request_streaming() &&
+         !ctx->request_handler->method()->response_streaming();
+}
+
 bool CanBeTranscoded(ngx_esp_request_ctx_t *ctx) {
   // Verify that all the necessary pieces exist and the method has RPC info
   // configured
@@ -208,8 +375,6 @@ ngx_int_t GrpcBackendHandler(ngx_http_request_t *r) {
 
     if (status.ok()) {
       // We have a stub for this backend; proxy the call via libgrpc.
-      const std::multimap<std::string, std::string> &headers =
-          ExtractMetadata(r);
       std::shared_ptr<NgxEspGrpcPassThroughServerCall> server_call;
       status = NgxEspGrpcPassThroughServerCall::Create(r, &server_call);
 
@@ -220,8 +385,10 @@ ngx_int_t GrpcBackendHandler(ngx_http_request_t *r) {
                        "GrpcBackendHandler: gRPC pass-through - method %s",
                        method.c_str());
 
-        grpc::ProxyFlow::Start(espmf->grpc_queue.get(), std::move(server_call),
-                               std::move(stub), method, headers);
+        grpc::ProxyFlow::Start(espmf->grpc_queue->SelectQueue(),
+                               std::move(server_call), std::move(stub), method,
+                               IsUnaryMethod(ctx),
+                               espcf->grpc_write_queue_size);
         return NGX_DONE;
       }
     }
@@ -233,8 +400,6 @@ ngx_int_t GrpcBackendHandler(ngx_http_request_t *r) {
 
     if (status.ok()) {
       // We have a stub for this backend; proxy the call via libgrpc.
-      const std::multimap<std::string, std::string> &headers =
-          ExtractMetadata(r);
       std::shared_ptr<NgxEspGrpcWebServerCall> server_call;
       status = NgxEspGrpcWebServerCall::Create(r, &server_call);
 
@@ -245,8 +410,10 @@ ngx_int_t GrpcBackendHandler(ngx_http_request_t *r) {
                        "GrpcBackendHandler: gRPC-Web - method %s",
                        method.c_str());
 
-        grpc::ProxyFlow::Start(espmf->grpc_queue.get(), std::move(server_call),
-                               std::move(stub), method, headers);
+        grpc::ProxyFlow::Start(espmf->grpc_queue->SelectQueue(),
+                               std::move(server_call), std::move(stub), method,
+                               IsUnaryMethod(ctx),
+                               espcf->grpc_write_queue_size);
         return NGX_DONE;
       }
     }
@@ -269,10 +436,10 @@ ngx_int_t GrpcBackendHandler(ngx_http_request_t *r) {
                        "GrpcBackendHandler: transcoding - method %s",
                        method.c_str());
 
-        const std::multimap<std::string, std::string> &headers =
-            ExtractMetadata(r);
-        grpc::ProxyFlow::Start(espmf->grpc_queue.get(), std::move(server_call),
-                               std::move(stub), method, headers);
+        grpc::ProxyFlow::Start(espmf->grpc_queue->SelectQueue(),
+                               std::move(server_call), std::move(stub), method,
+                               IsUnaryMethod(ctx),
+                               espcf->grpc_write_queue_size);
         return NGX_DONE;
       }
     }
@@ -291,6 +458,61 @@ ngx_int_t GrpcBackendHandler(ngx_http_request_t *r) {
 
 }  // namespace
 
+void GrpcPrewarmBackendChannels(ngx_cycle_t *cycle, void *conf) {
+  ngx_esp_loc_conf_t *espcf = reinterpret_cast<ngx_esp_loc_conf_t *>(conf);
+  if (!espcf->grpc_prewarm) {
+    return;
+  }
+  // Only a statically configured address can be warmed before traffic
+  // arrives; per-method backend addresses are resolved per request.
+  ngx_str_t address = espcf->grpc_backend_address_override.len > 0
+                          ? espcf->grpc_backend_address_override
+                          : espcf->grpc_backend_address_fallback;
+  if (address.len == 0) {
+    ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                  "grpc_pass prewarm requires a backend address; "
+                  "channels will be established on first use");
+    return;
+  }
+  GrpcCreateStubPool(cycle->log, espcf,
+                     GrpcExpandBackendAddress(ngx_str_to_std(address)));
+}
+
+void GrpcSpeculativeConnect(ngx_http_request_t *r) {
+  ngx_esp_loc_conf_t *espcf = reinterpret_cast<ngx_esp_loc_conf_t *>(
+      ngx_http_get_module_loc_conf(r, ngx_esp_module));
+  if (!espcf->grpc_pass || !IsGrpcRequest(r)) {
+    return;
+  }
+  ngx_esp_request_ctx_t *ctx = ngx_http_esp_get_module_ctx(r);
+  if (ctx == nullptr || !ctx->request_handler) {
+    return;
+  }
+  Status status = Status::OK;
+  std::string address;
+  std::tie(status, address) =
+      GrpcGetBackendAddress(r->connection->log, espcf, ctx);
+  if (!status.ok()) {
+    return;
+  }
+  auto it = espcf->grpc_stubs.find(address);
+  if (it == espcf->grpc_stubs.end()) {
+    it = GrpcCreateStubPool(r->connection->log, espcf, address);
+    if (it == espcf->grpc_stubs.end()) {
+      // The content handler will report the failure if the request gets
+      // that far.
+      return;
+    }
+  }
+  // GetState(true) nudges an IDLE channel into connecting and leaves
+  // READY or CONNECTING channels alone. Channels are pooled and shared
+  // between requests, so there is nothing to abort when the check
+  // fails - at worst the pool is left with a warm connection.
+  for (auto &entry : it->second) {
+    entry.channel->GetState(true);
+  }
+}
+
 bool IsGrpcRequest(ngx_http_request_t *r) {
   ngx_table_elt_t *ct = r->headers_in.content_type;
   return (ct &&
@@ -316,24 +538,70 @@ char *ConfigureGrpcBackendHandler(ngx_conf_t *cf, ngx_command_t *cmd,
       ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module));
   clcf->handler = GrpcBackendHandler;
 
-  if (cf->args->nelts > 1) {
-    ngx_str_t *argv = reinterpret_cast<ngx_str_t *>(cf->args->elts);
-    // if "override" is specified, argv[1] is the override address; otherwise
-    // it's the fallback address.
-    if (cf->args->nelts == 3) {
-      if (!ngx_string_equal(argv[2], ngx_string("override"))) {
+  ngx_str_t *argv = reinterpret_cast<ngx_str_t *>(cf->args->elts);
+  ngx_str_t address = ngx_null_string;
+  bool override_address = false;
+
+  for (ngx_uint_t i = 1; i < cf->args->nelts; ++i) {
+    if (argv[i].len > sizeof("channels=") - 1 &&
+        ngx_strncmp(argv[i].data, "channels=", sizeof("channels=") - 1) == 0) {
+      ngx_int_t channels =
+          ngx_atoi(argv[i].data + sizeof("channels=") - 1,
+                   argv[i].len - (sizeof("channels=") - 1));
+      if (channels == NGX_ERROR || channels < 1) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "Invalid channels parameter for grpc_pass: '%V'. "
+                           "Expected a positive number.",
+                           &argv[i]);
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+      }
+      espcf->grpc_channel_pool_size = channels;
+    } else if (argv[i].len > sizeof("write_queue=") - 1 &&
+               ngx_strncmp(argv[i].data, "write_queue=",
+                           sizeof("write_queue=") - 1) == 0) {
+      ngx_str_t size_str = {argv[i].len - (sizeof("write_queue=") - 1),
+                            argv[i].data + sizeof("write_queue=") - 1};
+      ssize_t size = ngx_parse_size(&size_str);
+      if (size == NGX_ERROR || size < 1) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "Invalid write_queue parameter for grpc_pass: "
+                           "'%V'. Expected a size.",
+                           &argv[i]);
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+      }
+      espcf->grpc_write_queue_size = size;
+    } else if (ngx_string_equal(argv[i], ngx_string("prewarm"))) {
+      espcf->grpc_prewarm = 1;
+    } else if (ngx_string_equal(argv[i], ngx_string("override"))) {
+      if (address.len == 0) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "Invalid second parameter for grpc_pass: '%V'. "
-                           "Expected 'override'.",
-                           &argv[2]);
+                           "'override' parameter for grpc_pass requires a "
+                           "backend address.");
         return reinterpret_cast<char *>(NGX_CONF_ERROR);
       }
-      espcf->grpc_backend_address_override = argv[1];
+      override_address = true;
+    } else if (address.len == 0) {
+      address = argv[i];
+    } else {
+      ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                         "Invalid parameter for grpc_pass: '%V'. "
+                         "Expected 'override', 'prewarm', 'channels=N' or "
+                         "'write_queue=SIZE'.",
+                         &argv[i]);
+      return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+  }
+
+  // if "override" is specified, the address is the override address;
+  // otherwise it's the fallback address.
+  if (address.len > 0) {
+    if (override_address) {
+      espcf->grpc_backend_address_override = address;
       ngx_log_debug1(NGX_LOG_DEBUG, cf->log, 0,
                      "ConfigureGrpcBackendHandler: override address %V",
                      espcf->grpc_backend_address_override);
     } else {
-      espcf->grpc_backend_address_fallback = argv[1];
+      espcf->grpc_backend_address_fallback = address;
       ngx_log_debug1(NGX_LOG_DEBUG, cf->log, 0,
                      "ConfigureGrpcBackendHandler: fallback address %V",
                      espcf->grpc_backend_address_fallback);
@@ -45,6 +45,20 @@ char *ConfigureGrpcBackendHandler(ngx_conf_t *ct, ngx_command_t *cmd,
 // Checks content type to see if it is a Grpc request.
 bool IsGrpcRequest(ngx_http_request_t *r);
 
+// Establishes the gRPC backend channels of a location (conf is its
+// ngx_esp_loc_conf_t) configured with the prewarm parameter of grpc_pass.
+// Called at worker start, after the gRPC queue has been initialized;
+// no-op for locations without prewarm or without a static backend
+// address.
+void GrpcPrewarmBackendChannels(ngx_cycle_t *cycle, void *conf);
+
+// Nudges the gRPC backend channels of the request's location into
+// connecting, so the connection setup overlaps the check workflow
+// instead of following it. Called when the check is initiated; no-op for
+// non-gRPC locations and requests. Channels are pooled and shared, so a
+// failed check simply leaves the pool with an established connection.
+void GrpcSpeculativeConnect(ngx_http_request_t *r);
+
 }  // namespace nginx
 }  // namespace api_manager
 }  // namespace google
@@ -46,17 +46,11 @@ namespace nginx {
 namespace {
 const ngx_str_t kContentTypeApplicationGrpc = ngx_string("application/grpc");
 
-// Deletes GRPC objects.
-//
-// This is used (instead of specializing std::default_deleter<>) in
-// order to explicitly verify that the deleter's in scope.  Otherwise,
-// it'd be entirely too easy for sources to include grpc.h without
-// pulling in the corresponding deleter definitions.
-struct GrpcDeleter {
-  void operator()(grpc_byte_buffer *byte_buffer) {
-    grpc_byte_buffer_destroy(byte_buffer);
-  }
-};
+// Response messages at least this large are sent by wrapping their slices
+// as ngx bufs directly instead of copying them into a pool buffer. For
+// small messages the copy into a recycled buf is cheaper than the extra
+// chain links and slice bookkeeping.
+const size_t kZeroCopyMinMessageSize = 1024;
 }  // namespace
 
 NgxEspGrpcPassThroughServerCall::NgxEspGrpcPassThroughServerCall(
@@ -109,6 +103,14 @@ bool NgxEspGrpcPassThroughServerCall::ConvertRequestBody(
   while (body->bufs) {
     ngx_chain_t *cl = body->bufs;
     body->bufs = cl->next;
+    grpc_slice pinned;
+    if (TryPinBodyBuffer(cl, &pinned)) {
+      // Large in-memory bufs go upstream pointing directly at the nginx
+      // buffer; the buf (and its link) stay pinned until the gRPC
+      // library is done with the slice.
+      out->push_back(pinned);
+      continue;
+    }
     out->push_back(GrpcSliceFromNginxBuffer(cl->buf));
     cl->next = body->free;
     body->free = cl;
@@ -118,21 +120,27 @@ bool NgxEspGrpcPassThroughServerCall::ConvertRequestBody(
 
 bool NgxEspGrpcPassThroughServerCall::ConvertResponseMessage(
     const ::grpc::ByteBuffer &msg, ngx_chain_t **out) {
-  grpc_byte_buffer *grpc_msg = ConvertByteBuffer(msg);
-  if (!grpc_msg) {
+  // Dump the message slices directly instead of rebuilding a
+  // grpc_byte_buffer around them: the frame header below is written into
+  // the same buffer the payload is copied into, so a message costs one
+  // buffer and at most one copy end to end - no intermediate byte buffer
+  // allocation and no extra reference churn per message.
+  slice_scratch_.clear();
+  if (!msg.Dump(&slice_scratch_).ok()) {
     return false;
   }
-  std::unique_ptr<grpc_byte_buffer, GrpcDeleter> msg_deleter(grpc_msg);
 
-  // Since there's no good way to reuse the underlying grpc_slice for
-  // the nginx buffer, we need to allocate an nginx buffer and copy
-  // the data into it.
   size_t buflen = 5;  // Compressed flag + four bytes of length.
 
-  // Get the length of the actual message.  N.B. This is the
-  // *compressed* length.
-  size_t msglen = grpc_byte_buffer_length(grpc_msg);
-  buflen += msglen;
+  // Get the length of the actual message.
+  size_t msglen = msg.Length();
+
+  // For large messages the underlying grpc_slices are wrapped directly as
+  // ngx bufs, so only the 5-byte delimiter goes into the allocated buffer.
+  bool zero_copy = msglen >= kZeroCopyMinMessageSize;
+  if (!zero_copy) {
+    buflen += msglen;
+  }
 
   // Allocate the chain link and buffer.
   ngx_chain_t *cl = AllocNgxBufChain(buflen);
@@ -144,11 +152,11 @@ bool NgxEspGrpcPassThroughServerCall::ConvertResponseMessage(
   }
   *out = cl;
   ngx_buf_t *buf = cl->buf;
-  buf->last_in_chain = 1;
-  buf->flush = 1;
 
-  // Write the 'compressed' flag.
-  *buf->last++ = (grpc_msg->data.raw.compression == GRPC_COMPRESS_NONE ? 0 : 1);
+  // Write the 'compressed' flag. Dumped slices carry no compression
+  // metadata; the raw byte buffer previously rebuilt here was always
+  // created uncompressed, so the flag stays 0.
+  *buf->last++ = 0;
 
   // Write the message length: four bytes, big-endian.
   // TODO: We should fail if asked to forward a message with length > uint32_max
@@ -161,13 +169,40 @@ bool NgxEspGrpcPassThroughServerCall::ConvertResponseMessage(
   buf->last[0] = msglen & 0xFF;
   buf->last += 4;
 
-  // Fill in the message.
-  for (size_t sln = 0; sln < grpc_msg->data.raw.slice_buffer.count; sln++) {
-    grpc_slice *slice = grpc_msg->data.raw.slice_buffer.slices + sln;
-    ngx_memcpy(buf->last, GRPC_SLICE_START_PTR(*slice),
-               GRPC_SLICE_LENGTH(*slice));
-    buf->last += GRPC_SLICE_LENGTH(*slice);
+  if (!zero_copy) {
+    // Fill in the message.
+    for (const auto &slice : slice_scratch_) {
+      ngx_memcpy(buf->last, slice.begin(), slice.size());
+      buf->last += slice.size();
+    }
+    buf->last_in_chain = 1;
+    buf->flush = 1;
+    return true;
+  }
+
+  // Append a buf per slice pointing directly at the refcounted slice
+  // memory; the payload is never copied. WrapGrpcSliceChain takes its
+  // own reference, so the c_slice reference is dropped right away.
+  ngx_chain_t **next = &cl->next;
+  for (const auto &slice : slice_scratch_) {
+    if (slice.size() == 0) {
+      continue;
+    }
+    grpc_slice c_slice = slice.c_slice();
+    ngx_chain_t *slice_cl = WrapGrpcSliceChain(c_slice);
+    grpc_slice_unref(c_slice);
+    if (!slice_cl) {
+      ngx_log_error(
+          NGX_LOG_ERR, r_->connection->log, 0,
+          "Failed to allocate slice buffer for GRPC response message.");
+      return false;
+    }
+    *next = slice_cl;
+    next = &slice_cl->next;
+    cl = slice_cl;
   }
+  cl->buf->last_in_chain = 1;
+  cl->buf->flush = 1;
 
   return true;
 }
@@ -26,10 +26,17 @@
 //
 #include "src/nginx/grpc_queue.h"
 
+#include <algorithm>
+#include <chrono>
+
 extern "C" {
 #include "ngx_event.h"
 }
 
+#if (NGX_HAVE_SCHED_SETAFFINITY)
+#include <sched.h>
+#endif
+
 namespace google {
 namespace api_manager {
 namespace nginx {
@@ -94,6 +101,73 @@ namespace nginx {
 // performance problem, it will likely be solved by working with the
 // GRPC team to create an API for integrating libgrpc into arbitrary
 // event loops.
+//
+// To keep a single dispatch thread from becoming a bottleneck under
+// heavy proxy load, the singleton runs several completion queues, each
+// drained by its own dispatch thread pinned to one of the CPUs the
+// worker process may run on.  Calls are spread across the queues
+// round-robin (see SelectQueue()).  The completed tags are still
+// funneled through the one pending_ queue and the one ngx_notify()
+// wakeup, so everything downstream of the dispatch threads continues
+// to run on the main nginx thread.
+
+namespace {
+
+// The upper bound on completion queues (and dispatch threads) per
+// worker process.  The callbacks are serialized onto the main nginx
+// thread anyway, so past a handful of queues additional threads only
+// add context switches.
+const size_t kMaxCompletionQueues = 4;
+
+// Bounds on the number of completed tags drained per event-loop
+// iteration.  The batch size starts at the maximum and is adapted by
+// DrainPending() within these bounds.
+const size_t kMinDrainBatch = 64;
+const size_t kMaxDrainBatch = 1024;
+
+// The time budget of one drain batch.  Batches that run longer shrink
+// the batch size; batches that fill up well under the budget grow it.
+const int64_t kDrainBudgetUs = 2000;
+
+size_t NumCompletionQueues() {
+  size_t n = (ngx_ncpu > 0) ? static_cast<size_t>(ngx_ncpu) : 1;
+  return (n < kMaxCompletionQueues) ? n : kMaxCompletionQueues;
+}
+
+#if (NGX_HAVE_SCHED_SETAFFINITY)
+// Pins the calling thread to the index-th CPU (modulo the number of
+// CPUs) the process is allowed to run on, so each dispatch thread keeps
+// its cache-hot state on one core instead of bouncing between them.
+// Failures are ignored: affinity is an optimization, not a correctness
+// requirement.
+void PinThreadToCpu(unsigned index) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) {
+    return;
+  }
+  unsigned allowed_count = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      allowed_count++;
+    }
+  }
+  if (allowed_count == 0) {
+    return;
+  }
+  unsigned target = index % allowed_count;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &allowed) && target-- == 0) {
+      cpu_set_t mask;
+      CPU_ZERO(&mask);
+      CPU_SET(cpu, &mask);
+      sched_setaffinity(0, sizeof(cpu_set_t), &mask);
+      return;
+    }
+  }
+}
+#endif
+
+}  // namespace
 
 std::weak_ptr<NgxEspGrpcQueue> NgxEspGrpcQueue::instance;
 
@@ -122,10 +196,15 @@ void NgxEspGrpcQueue::NginxTagHandler(ngx_event_t *) {
   }
 }
 
-void NgxEspGrpcQueue::WorkerThread(NgxEspGrpcQueue *queue) {
+void NgxEspGrpcQueue::WorkerThread(NgxEspGrpcQueue *queue,
+                                   ::grpc::CompletionQueue *cq,
+                                   unsigned index) {
+#if (NGX_HAVE_SCHED_SETAFFINITY)
+  PinThreadToCpu(index);
+#endif
   void *tag;
   bool ok;
-  while (queue->cq_->Next(&tag, &ok)) {
+  while (cq->Next(&tag, &ok)) {
     std::unique_ptr<Tag> cb(static_cast<Tag *>(tag));
     if (cb) {
       bool notify_nginx = false;
@@ -146,9 +225,43 @@ void NgxEspGrpcQueue::WorkerThread(NgxEspGrpcQueue *queue) {
 
 void NgxEspGrpcQueue::Deleter(NgxEspGrpcQueue *lib) { delete lib; }
 
+NgxEspGrpcQueue::SubQueue::SubQueue(NgxEspGrpcQueue *owner, unsigned index)
+    : cq_(new ::grpc::CompletionQueue()) {
+  worker_thread_ =
+      std::thread(&NgxEspGrpcQueue::WorkerThread, owner, cq_.get(), index);
+}
+
+void NgxEspGrpcQueue::Post(TagFunction callback) {
+  // Same handoff the dispatch threads use for completed tags: append to
+  // pending_ under the lock and wake the nginx main thread at most once
+  // per drain.
+  std::unique_ptr<Tag> cb(static_cast<Tag *>(AllocTag(std::move(callback))));
+  bool notify_nginx = false;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    pending_.emplace_back(Finalizer{std::move(cb), true});
+    if (!notified_) {
+      notify_nginx = true;
+      notified_ = true;
+    }
+  }
+  if (notify_nginx) {
+    ngx_notify(&notify_);
+  }
+}
+
+AsyncGrpcQueue *NgxEspGrpcQueue::SelectQueue() {
+  AsyncGrpcQueue *result = queues_[next_queue_].get();
+  next_queue_ = (next_queue_ + 1) % queues_.size();
+  return result;
+}
+
 NgxEspGrpcQueue::NgxEspGrpcQueue()
-    : cq_(new ::grpc::CompletionQueue()), notified_(false) {
-  worker_thread_ = std::thread(&NgxEspGrpcQueue::WorkerThread, this);
+    : notified_(false), drain_batch_(kMaxDrainBatch), next_queue_(0) {
+  size_t num_queues = NumCompletionQueues();
+  for (size_t i = 0; i < num_queues; i++) {
+    queues_.emplace_back(new SubQueue(this, static_cast<unsigned>(i)));
+  }
 }
 
 NgxEspGrpcQueue::~NgxEspGrpcQueue() {
@@ -165,32 +278,68 @@ NgxEspGrpcQueue::~NgxEspGrpcQueue() {
   //
   // If this happens, this code handles them correctly, by:
   //
-  //   * Shutting down the queue
+  //   * Shutting down the queues
   //
-  //   * Waiting for the queue to drain (i.e. waiting for the event
-  //     worker thread to dequeue all pending tags and exit)
+  //   * Waiting for the queues to drain (i.e. waiting for the
+  //     dispatch threads to dequeue all pending tags and exit)
   //
   //   * Ignoring the outstanding events as they may try to enqueue
-  //     new events, which is dangerous as the completion queue
-  //     has been shut down.
+  //     new events, which is dangerous as the completion queues
+  //     have been shut down.
 
-  cq_->Shutdown();
+  for (auto &queue : queues_) {
+    queue->Shutdown();
+  }
 
-  // N.B. Joining on the worker thread is essential, as that thread
-  // maintains a raw pointer to this datastructure.
-  worker_thread_.join();
+  // N.B. Joining on the dispatch threads is essential, as those
+  // threads maintain a raw pointer to this datastructure.
+  for (auto &queue : queues_) {
+    queue->Join();
+  }
 }
 
 void NgxEspGrpcQueue::DrainPending() {
-  std::deque<Finalizer> pending;
+  auto start = std::chrono::steady_clock::now();
+
+  std::deque<Finalizer> batch;
+  bool more = false;
   {
     std::lock_guard<std::mutex> lock(mu_);
-    pending.swap(pending_);
-    notified_ = false;
+    if (pending_.size() <= drain_batch_) {
+      batch.swap(pending_);
+      notified_ = false;
+    } else {
+      // Take only one batch; notified_ stays set so the dispatch threads
+      // don't signal again while the leftovers are still queued.
+      auto split = pending_.begin() + drain_batch_;
+      batch.assign(std::make_move_iterator(pending_.begin()),
+                   std::make_move_iterator(split));
+      pending_.erase(pending_.begin(), split);
+      more = true;
+    }
   }
-  for (auto &it : pending) {
+
+  for (auto &it : batch) {
     (*it.callback)(it.success);
   }
+
+  // Adapt the batch size to the observed callback cost, so that a burst of
+  // cheap callbacks is drained in few wakeups while expensive ones don't
+  // starve nginx timers.
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  if (elapsed > kDrainBudgetUs) {
+    drain_batch_ = std::max(drain_batch_ / 2, kMinDrainBatch);
+  } else if (batch.size() == drain_batch_ && elapsed < kDrainBudgetUs / 4) {
+    drain_batch_ = std::min(drain_batch_ * 2, kMaxDrainBatch);
+  }
+
+  if (more) {
+    // Schedule the next batch for a later event-loop iteration, after
+    // nginx has had a chance to run timers and handle other events.
+    ngx_notify(&notify_);
+  }
 }
 
 }  // namespace nginx
@@ -29,6 +29,7 @@
 #include <deque>
 #include <memory>
 #include <thread>
+#include <vector>
 
 #include <grpc++/grpc++.h>
 
@@ -65,14 +66,30 @@ class NgxEspGrpcQueue : public AsyncGrpcQueue {
     return static_cast<void *>(new TypedTag<T>(std::move(callback)));
   }
 
-  // Constructs a tag for use with the NgxEspGrpcQueue's completion queue.
-  virtual void *MakeTag(std::function<void(bool)> callback) {
+  // Constructs a tag for use with the NgxEspGrpcQueue's completion queues.
+  virtual void *MakeTag(TagFunction callback) {
     return AllocTag(std::move(callback));
   }
 
-  // The completion queue processed by the library.  Tags queued to
-  // this queue must be created by MakeTag or AllocTag.
-  virtual ::grpc::CompletionQueue *GetQueue() { return cq_.get(); }
+  // The first of the completion queues processed by the library.  Tags
+  // queued to this queue must be created by MakeTag or AllocTag.
+  virtual ::grpc::CompletionQueue *GetQueue() {
+    return queues_.front()->GetQueue();
+  }
+
+  // Queues a callback to run on the main nginx thread.  Unlike the
+  // rest of this interface, Post may be called from any thread; it is
+  // how code running on a foreign thread (e.g. a grpc slice destroy
+  // callback) gets back onto the nginx event loop.  The callback is
+  // invoked with ok == true, or dropped during queue shutdown.
+  void Post(TagFunction callback);
+
+  // Returns a queue facade bound to one of the completion queues,
+  // chosen round-robin so that concurrent calls are spread across the
+  // dispatch threads.  Like Instance(), this call must be externally
+  // synchronized.  The returned pointer remains valid for the lifetime
+  // of the NgxEspGrpcQueue.
+  AsyncGrpcQueue *SelectQueue();
 
   void Init(ngx_cycle_t *cycle);
 
@@ -108,19 +125,42 @@ class NgxEspGrpcQueue : public AsyncGrpcQueue {
     bool success;
   };
 
+  // A single completion queue with its own dispatch thread.  Completed
+  // tags are funneled into the owning NgxEspGrpcQueue's pending queue,
+  // so the callbacks run on the main nginx thread no matter which
+  // sub-queue a call was bound to.
+  class SubQueue : public AsyncGrpcQueue {
+   public:
+    SubQueue(NgxEspGrpcQueue *owner, unsigned index);
+    virtual ~SubQueue() {}
+
+    virtual void *MakeTag(TagFunction callback) {
+      return AllocTag(std::move(callback));
+    }
+    virtual ::grpc::CompletionQueue *GetQueue() { return cq_.get(); }
+
+    void Shutdown() { cq_->Shutdown(); }
+    void Join() { worker_thread_.join(); }
+
+   private:
+    std::unique_ptr<::grpc::CompletionQueue> cq_;
+    std::thread worker_thread_;
+  };
+
   // Runs GRPC callbacks on the main nginx thread.
   static void NginxTagHandler(ngx_event_t *);
 
-  // The GRPC worker thread main routine.  This shuttles events from
-  // the GRPC completion queue to the nginx event queue, getting them
-  // onto the main nginx thread.
+  // The GRPC dispatch thread main routine.  This shuttles events from
+  // one of the GRPC completion queues to the nginx event queue, getting
+  // them onto the main nginx thread.  The index identifies the thread
+  // for CPU-affinity purposes.
   //
-  // Note that the worker thread's lifetime is strictly contained
-  // within the lifetime of its associated NgxEspGrpcQueue (the
-  // NgxEspGrpcQueue destructor joins on the thread).  This makes it
-  // possible to pass the queue to the worker thread via a raw
-  // pointer.
-  static void WorkerThread(NgxEspGrpcQueue *queue);
+  // Note that the dispatch threads' lifetimes are strictly contained
+  // within the lifetime of their associated NgxEspGrpcQueue (the
+  // NgxEspGrpcQueue destructor joins on them).  This makes it possible
+  // to pass the queue to the dispatch threads via a raw pointer.
+  static void WorkerThread(NgxEspGrpcQueue *queue, ::grpc::CompletionQueue *cq,
+                           unsigned index);
 
   // Deletes the NgxEspGrpcQueue.  (This lets us avoid making the
   // constructor and destructor public, which is a little overly
@@ -130,16 +170,24 @@ class NgxEspGrpcQueue : public AsyncGrpcQueue {
   NgxEspGrpcQueue();
   virtual ~NgxEspGrpcQueue();
 
-  // Drains the contents of the pending_ queue.
+  // Drains the pending_ queue in bounded batches.  If callbacks remain
+  // after a batch, another wakeup is scheduled so nginx gets to process
+  // its timers and other IO between batches.
   void DrainPending();
 
   std::mutex mu_;
   ngx_event_t notify_;
-  std::unique_ptr<::grpc::CompletionQueue> cq_;
   std::deque<Finalizer> pending_;
   bool notified_;
 
-  std::thread worker_thread_;
+  // The number of callbacks run per event-loop iteration, adapted by
+  // DrainPending() to keep each batch within its time budget.
+  size_t drain_batch_;
+
+  // The completion queues and their dispatch threads, plus the
+  // round-robin cursor used by SelectQueue().
+  std::vector<std::unique_ptr<SubQueue>> queues_;
+  size_t next_queue_;
 };
 
 }  // namespace nginx
@@ -27,7 +27,9 @@
 #include "src/nginx/grpc_server_call.h"
 
 #include <grpc/impl/codegen/gpr_types.h>
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <memory>
 #include <utility>
 
@@ -37,6 +39,7 @@
 #include "src/core/lib/compression/message_compress.h"
 #include "src/nginx/error.h"
 #include "src/nginx/grpc_finish.h"
+#include "src/nginx/grpc_queue.h"
 #include "src/nginx/module.h"
 #include "src/nginx/util.h"
 
@@ -150,6 +153,64 @@ grpc_message_compression_algorithm GetCompressionAlgorithm(
   return algorithm;
 }
 
+// Pool cleanup handler dropping the reference of a wrapped gRPC slice.
+void UnrefSliceCleanup(void *data) {
+  grpc_slice_unref(*reinterpret_cast<grpc_slice *>(data));
+}
+
+// Request body bufs at least this large are pinned and handed to the
+// gRPC library as slices pointing directly at the nginx buffer memory;
+// smaller bufs are cheaper to copy than to track. Mirrors the
+// response-direction kZeroCopyMinMessageSize threshold.
+const size_t kPinnedBodyBufMinSize = 1024;
+
+u_char kGrpcTimeout[] = "grpc-timeout";
+
+// Timeouts longer than a year are no practical deadline; treating them
+// as unset also keeps the deadline arithmetic below clear of overflow.
+const int64_t kMaxGrpcTimeoutMillis = 365LL * 24 * 3600 * 1000;
+
+// Parses a grpc-timeout header value -- one to eight ASCII digits
+// followed by a unit ('H'our, 'M'inute, 'S'econd, 'm'illi-, 'u'- or
+// 'n'anosecond) -- into milliseconds, rounding sub-millisecond values
+// up so a positive client timeout never becomes an already-expired
+// deadline. Returns false if the value is malformed.
+bool ParseGrpcTimeout(const ngx_str_t &value, int64_t *timeout_ms) {
+  if (value.len < 2 || value.len > 9) {
+    return false;
+  }
+  int64_t ticks = 0;
+  for (size_t i = 0; i < value.len - 1; ++i) {
+    if (value.data[i] < '0' || value.data[i] > '9') {
+      return false;
+    }
+    ticks = ticks * 10 + (value.data[i] - '0');
+  }
+  switch (value.data[value.len - 1]) {
+    case 'H':
+      *timeout_ms = ticks * 3600 * 1000;
+      break;
+    case 'M':
+      *timeout_ms = ticks * 60 * 1000;
+      break;
+    case 'S':
+      *timeout_ms = ticks * 1000;
+      break;
+    case 'm':
+      *timeout_ms = ticks;
+      break;
+    case 'u':
+      *timeout_ms = (ticks + 999) / 1000;
+      break;
+    case 'n':
+      *timeout_ms = (ticks + 999999) / 1000000;
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
 }  // namespace
 
 NgxEspGrpcServerCall::NgxEspGrpcServerCall(ngx_http_request_t *r,
@@ -158,10 +219,27 @@ NgxEspGrpcServerCall::NgxEspGrpcServerCall(ngx_http_request_t *r,
       buf_free_(nullptr),
       buf_busy_(nullptr),
       buf_tag_(ngx_buf_tag_t(&ConvertByteBuffer)),
+      slice_buf_tag_(ngx_buf_tag_t(&Cleanup)),
       add_header_failed_(false),
       reading_(false),
       read_msg_(nullptr),
+      downstream_buffered_bytes_(0),
+      deadline_(std::chrono::system_clock::time_point::max()),
       delay_downstream_headers_(delay_downstream_headers) {
+  // Capture the client's deadline now, before the check workflow and any
+  // transcoding run, so the time ESP spends on the call is charged
+  // against the client's budget rather than added on top of it.
+  auto timeout_header =
+      ngx_esp_find_headers_in(r, kGrpcTimeout, sizeof(kGrpcTimeout) - 1);
+  if (timeout_header != nullptr) {
+    int64_t timeout_ms;
+    if (ParseGrpcTimeout(timeout_header->value, &timeout_ms) &&
+        timeout_ms <= kMaxGrpcTimeoutMillis) {
+      deadline_ = std::chrono::system_clock::now() +
+                  std::chrono::milliseconds(timeout_ms);
+    }
+  }
+
   // Add the cleanup handler.  This unlinks the NgxEspGrpcServerCall
   // from the request when the underlying nginx request is terminated,
   // since the NgxEspGrpcServerCall may outlive the request.
@@ -203,24 +281,87 @@ NgxEspGrpcServerCall::~NgxEspGrpcServerCall() {
     }
     ngx_esp_request_ctx_t *ctx = ngx_http_esp_ensure_module_ctx(r_);
     ctx->grpc_server_call = nullptr;
+
+    // The request outlives this call and its output chain may still point
+    // at the wrapped slices. Hand the remaining references over to the
+    // request pool, which is destroyed after the output is done with them.
+    ReleaseSentSlices();
+    for (auto &slice_buf : pending_slices_) {
+      ngx_pool_cleanup_t *pool_cln =
+          ngx_pool_cleanup_add(r_->pool, sizeof(grpc_slice));
+      if (pool_cln) {
+        *reinterpret_cast<grpc_slice *>(pool_cln->data) = slice_buf.second;
+        pool_cln->handler = &UnrefSliceCleanup;
+      }
+    }
+    pending_slices_.clear();
+  } else {
+    ReleaseAllSlices();
   }
+  // Outstanding pins outlive the call; their releases only drop their
+  // request references from here on.
+  OrphanPinnedBodyBuffers();
   for (auto &slice : downstream_slices_) {
     grpc_slice_unref(slice);
   }
   downstream_slices_.clear();
+  downstream_buffered_bytes_ = 0;
+}
+
+bool NgxEspGrpcServerCall::ReadDownstreamRequestBody() {
+  const size_t converted = downstream_slices_.size();
+  if (!ConvertRequestBody(&downstream_slices_)) {
+    return false;
+  }
+  for (size_t i = converted; i < downstream_slices_.size(); ++i) {
+    downstream_buffered_bytes_ += GRPC_SLICE_LENGTH(downstream_slices_[i]);
+  }
+  return true;
+}
+
+void NgxEspGrpcServerCall::ForEachHeader(
+    std::function<void(const ::grpc::string_ref &key,
+                       const ::grpc::string_ref &value)>
+        visitor) {
+  if (!cln_.data) {
+    return;
+  }
+  ngx_esp_loc_conf_t *lc = reinterpret_cast<ngx_esp_loc_conf_t *>(
+      ngx_http_get_module_loc_conf(r_, ngx_esp_module));
+  // Visit the headers in place on the native nginx header list; nginx
+  // already keeps a lower-cased copy of each header name. Headers on the
+  // location's compiled strip list (endpoints_strip_backend_headers) are
+  // skipped here, so they are never copied into backend metadata.
+  for (auto &h : r_->headers_in) {
+    if (ngx_esp_header_stripped(lc->strip_backend_headers, h.hash,
+                                h.lowcase_key, h.key.len)) {
+      continue;
+    }
+    visitor(::grpc::string_ref(reinterpret_cast<const char *>(h.lowcase_key),
+                               h.key.len),
+            ::grpc::string_ref(reinterpret_cast<const char *>(h.value.data),
+                               h.value.len));
+  }
+}
+
+std::chrono::system_clock::time_point NgxEspGrpcServerCall::deadline() {
+  return deadline_;
 }
 
 void NgxEspGrpcServerCall::UpdateRequestMessageStat(int64_t size) {
   ngx_esp_request_ctx_t *ctx = ngx_http_esp_ensure_module_ctx(r_);
   ctx->grpc_request_bytes += size;
   ++ctx->grpc_request_message_counts;
-  ctx->request_handler->AttemptIntermediateReport();
+  // Intermediate reports ride on the worker's scan timer instead of a
+  // per-message interval check; just make sure the stream is on the
+  // scan list (an O(1) no-op after the first message).
+  ngx_esp_report_scan_add(ctx);
 }
 void NgxEspGrpcServerCall::UpdateResponseMessageStat(int64_t size) {
   ngx_esp_request_ctx_t *ctx = ngx_http_esp_ensure_module_ctx(r_);
   ctx->grpc_response_bytes += size;
   ++ctx->grpc_response_message_counts;
-  ctx->request_handler->AttemptIntermediateReport();
+  ngx_esp_report_scan_add(ctx);
 }
 
 void NgxEspGrpcServerCall::SetGrpcUpstreamCancel(
@@ -229,8 +370,8 @@ void NgxEspGrpcServerCall::SetGrpcUpstreamCancel(
     return;
   }
   ngx_esp_request_ctx_t *ctx = ngx_http_esp_ensure_module_ctx(r_);
-  ctx->grpc_upstream_cancel =
-      std::unique_ptr<std::function<void()>>(new auto(grpc_upstream_cancel));
+  ctx->grpc_upstream_cancel = NewPoolObject<std::function<void()>>(
+      r_->pool, std::move(grpc_upstream_cancel));
 }
 
 void NgxEspGrpcServerCall::AddInitialMetadata(const std::string &key,
@@ -345,6 +486,9 @@ void NgxEspGrpcServerCall::OnDownstreamWriteable(ngx_http_request_t *r) {
     return;
   }
 
+  // Drop the references of zero-copy slices that have been sent.
+  server_call->ReleaseSentSlices();
+
   std::function<void(bool)> continuation;
   std::swap(continuation, server_call->write_continuation_);
 
@@ -368,9 +512,11 @@ void NgxEspGrpcServerCall::OnHttpBlockReading(ngx_http_request_t *r) {
 
     ngx_esp_request_ctx_t *ctx = ngx_http_esp_ensure_module_ctx(r);
     if (ctx->grpc_upstream_cancel) {
-      std::unique_ptr<std::function<void()>> cancel_func_ptr;
-      std::swap(ctx->grpc_upstream_cancel, cancel_func_ptr);
-      (*cancel_func_ptr)();
+      // The pool cleanup destroys the function object; just make the
+      // cancel one-shot.
+      std::function<void()> *cancel_func = ctx->grpc_upstream_cancel;
+      ctx->grpc_upstream_cancel = nullptr;
+      (*cancel_func)();
     }
   }
 
@@ -391,7 +537,7 @@ void NgxEspGrpcServerCall::OnDownstreamPreread(ngx_http_request_t *r) {
                  "NgxEspGrpcServerCall::OnDownstreamPreread");
 
   // Convert the preread request body and store in downstream_slices_
-  if (!server_call->ConvertRequestBody(&server_call->downstream_slices_)) {
+  if (!server_call->ReadDownstreamRequestBody()) {
     // Error occurred, ConvertRequestBody() has finalized the request, nothing
     // to do anymore.
     ngx_log_error(
@@ -475,7 +621,7 @@ void NgxEspGrpcServerCall::RunPendingRead() {
 
   while (read_continuation_) {
     // Read and convert the request body
-    if (!ConvertRequestBody(&downstream_slices_)) {
+    if (!ReadDownstreamRequestBody()) {
       // Error occurred, ConvertRequestBody() has finalized the request and
       // Cleanup() has called the pending read continuation with ok=false.
       // Nothing to do anymore. Can't even log as the request has been freed.
@@ -564,51 +710,84 @@ void NgxEspGrpcServerCall::RunPendingRead() {
   }
 }
 
+bool NgxEspGrpcServerCall::ContainsCompleteMessage(
+    const std::vector<grpc_slice> &slices) {
+  size_t buflen = 0;
+  for (const auto &it : slices) {
+    buflen += GRPC_SLICE_LENGTH(it);
+  }
+  if (buflen < 5) {
+    return false;
+  }
+
+  // Decode the length.  Note that this is in network byte order.
+  uint32_t msglen = 0;
+  msglen |= GetByte(slices, 1);
+  msglen <<= 8;
+  msglen |= GetByte(slices, 2);
+  msglen <<= 8;
+  msglen |= GetByte(slices, 3);
+  msglen <<= 8;
+  msglen |= GetByte(slices, 4);
+
+  return buflen >= msglen + 5;
+}
+
 bool NgxEspGrpcServerCall::TryReadDownstreamMessage() {
   // From http://www.grpc.io/docs/guides/wire.html, a GRPC message is:
   // * A one-byte compressed-flag
   // * A four-byte message length
   // * The message body (length octets)
 
-  size_t buflen = 0;
-  for (auto it : downstream_slices_) {
-    buflen += GRPC_SLICE_LENGTH(it);
-  }
+  // The buffered byte count is maintained as slices are appended and
+  // consumed, so the boundary checks here are pure length accounting; no
+  // rescan of the buffered slices per frame.
   ngx_log_debug1(
       NGX_LOG_DEBUG_HTTP, r_->connection->log, 0,
       "NgxEspGrpcServerCall::TryReadDownstreamMessage: buffered length=%z",
-      buflen);
+      downstream_buffered_bytes_);
 
-  if (buflen < 5) {
+  if (downstream_buffered_bytes_ < 5) {
     // There's not even enough data to figure out how long the message
     // is.
     return false;
   }
 
-  uint8_t compressed_flag = GetByte(downstream_slices_, 0);
-
-  // Decode the length.  Note that this is in network byte order.
-  uint32_t msglen = 0;
-  msglen |= GetByte(downstream_slices_, 1);
-  msglen <<= 8;
-  msglen |= GetByte(downstream_slices_, 2);
-  msglen <<= 8;
-  msglen |= GetByte(downstream_slices_, 3);
-  msglen <<= 8;
-  msglen |= GetByte(downstream_slices_, 4);
+  uint8_t compressed_flag;
+  uint32_t msglen;  // Note that this is in network byte order.
+  const grpc_slice &head = downstream_slices_.front();
+  if (GRPC_SLICE_LENGTH(head) >= 5) {
+    // The usual case: the whole delimiter is in the first slice, so it is
+    // decoded from contiguous memory.
+    const uint8_t *p = GRPC_SLICE_START_PTR(head);
+    compressed_flag = p[0];
+    msglen = (uint32_t(p[1]) << 24) | (uint32_t(p[2]) << 16) |
+             (uint32_t(p[3]) << 8) | uint32_t(p[4]);
+  } else {
+    compressed_flag = GetByte(downstream_slices_, 0);
+    msglen = 0;
+    msglen |= GetByte(downstream_slices_, 1);
+    msglen <<= 8;
+    msglen |= GetByte(downstream_slices_, 2);
+    msglen <<= 8;
+    msglen |= GetByte(downstream_slices_, 3);
+    msglen <<= 8;
+    msglen |= GetByte(downstream_slices_, 4);
+  }
 
   ngx_log_debug1(
       NGX_LOG_DEBUG_HTTP, r_->connection->log, 0,
       "NgxEspGrpcServerCall::TryReadDownstreamMessage: message length=%z",
       msglen);
 
-  if ((buflen - 5) < msglen) {
+  if ((downstream_buffered_bytes_ - 5) < msglen) {
     // We're still waiting for the rest of the message.
     return false;
   }
 
   // Okay, we can return a message.
   TrimFront(&downstream_slices_, 5);
+  downstream_buffered_bytes_ -= 5 + msglen;
 
   // Get an iterator pointing into the downstream_slices_ vector to the slice
   // containing the byte just pass the message length (which could be
@@ -707,6 +886,7 @@ ngx_chain_t *NgxEspGrpcServerCall::AllocNgxBufChain(size_t buflen) {
 
   if (buflen > size_t(buf->end - buf->start)) {
     // Abandon the small buf, allocate a bigger one.
+    ngx_esp_count_pool_alloc(buflen);
     buf = ngx_create_temp_buf(r_->pool, buflen);
     if (!buf) {
       return nullptr;
@@ -728,12 +908,159 @@ ngx_chain_t *NgxEspGrpcServerCall::AllocNgxBufChain(size_t buflen) {
   return cl;
 }
 
+ngx_chain_t *NgxEspGrpcServerCall::WrapGrpcSliceChain(grpc_slice slice) {
+  ngx_chain_t *cl = ngx_alloc_chain_link(r_->pool);
+  if (!cl) {
+    return nullptr;
+  }
+  ngx_buf_t *buf = reinterpret_cast<ngx_buf_t *>(ngx_calloc_buf(r_->pool));
+  if (!buf) {
+    return nullptr;
+  }
+
+  buf->start = buf->pos = GRPC_SLICE_START_PTR(slice);
+  buf->end = buf->last = buf->pos + GRPC_SLICE_LENGTH(slice);
+  // The slice memory is shared with the gRPC library and must not be
+  // modified by the output filters.
+  buf->memory = 1;
+  buf->tag = slice_buf_tag_;
+
+  cl->buf = buf;
+  cl->next = nullptr;
+
+  // Hold a reference on the slice until the buf has been consumed.
+  pending_slices_.emplace_back(buf, grpc_slice_ref(slice));
+  return cl;
+}
+
+void NgxEspGrpcServerCall::ReleaseSentSlices() {
+  auto it = pending_slices_.begin();
+  while (it != pending_slices_.end()) {
+    ngx_buf_t *buf = it->first;
+    // The output filters advance pos as the buf is consumed; once it
+    // reaches last, the data has been sent (or copied) downstream.
+    if (buf->pos == buf->last) {
+      grpc_slice_unref(it->second);
+      it = pending_slices_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void NgxEspGrpcServerCall::ReleaseAllSlices() {
+  for (auto &slice_buf : pending_slices_) {
+    grpc_slice_unref(slice_buf.second);
+  }
+  pending_slices_.clear();
+}
+
+bool NgxEspGrpcServerCall::TryPinBodyBuffer(ngx_chain_t *cl, grpc_slice *out) {
+  ngx_buf_t *buf = cl->buf;
+
+  // Only HTTP/2 bodies can be pinned. The HTTP/1 unbuffered reader
+  // passes its one body buffer itself down the body filter chain, so
+  // deferring the pos advance would make the next read pass deliver the
+  // same bytes again. HTTP/2 snapshots each data region into its own
+  // buf, and neither reuses the buffer memory nor reopens the stream's
+  // flow-control window until pos catches up with last.
+  if (r_->stream == nullptr) {
+    return false;
+  }
+
+  if (!ngx_buf_in_memory(buf) ||
+      static_cast<size_t>(buf->last - buf->pos) < kPinnedBodyBufMinSize) {
+    return false;
+  }
+
+  // The release has to be posted back to the nginx thread; without the
+  // queue (e.g. during shutdown) fall back to copying.
+  std::shared_ptr<NgxEspGrpcQueue> queue = NgxEspGrpcQueue::TryInstance();
+  if (!queue) {
+    return false;
+  }
+
+  PinnedBodyBuffer *pin = new PinnedBodyBuffer();
+  pin->call = this;
+  pin->request = r_->main;
+  pin->body = r_->request_body;
+  pin->cl = cl;
+  pin->queue = std::move(queue);
+  pinned_body_buffers_.push_back(pin);
+
+  // Hold a reference on the request so the buffer memory stays alive for
+  // as long as the gRPC library references the slice, even if the
+  // request finishes first.
+  r_->main->count++;
+
+  *out = grpc_slice_new_with_user_data(
+      buf->pos, buf->last - buf->pos,
+      &NgxEspGrpcServerCall::OnPinnedSliceReleased, pin);
+  return true;
+}
+
+void NgxEspGrpcServerCall::OnPinnedSliceReleased(void *pin_ptr) {
+  // Runs on whichever thread dropped the last slice reference, usually a
+  // gRPC dispatch thread. Nothing here may touch nginx state; hop back
+  // onto the nginx thread for the actual release.
+  PinnedBodyBuffer *pin = reinterpret_cast<PinnedBodyBuffer *>(pin_ptr);
+  NgxEspGrpcQueue *queue = pin->queue.get();
+  queue->Post([pin](bool) { ReclaimPinnedBodyBuffer(pin); });
+}
+
+void NgxEspGrpcServerCall::ReclaimPinnedBodyBuffer(PinnedBodyBuffer *pin) {
+  NgxEspGrpcServerCall *call = pin->call;
+  if (call) {
+    auto &pins = call->pinned_body_buffers_;
+    pins.erase(std::remove(pins.begin(), pins.end(), pin), pins.end());
+
+    // Consume the buf: advancing pos is what tells nginx the data has
+    // been handled, letting it recycle the buffer space and reopen the
+    // stream's flow-control window.
+    pin->cl->buf->pos = pin->cl->buf->last;
+    pin->cl->next = pin->body->free;
+    pin->body->free = pin->cl;
+
+    // If a read is pending, nudge the read loop so nginx actually asks
+    // the client for more data now that the buffer space is free again.
+    if (call->read_continuation_ && !call->reading_) {
+      call->RunPendingRead();
+    }
+  }
+
+  // Release the request reference taken when the buf was pinned. This
+  // may be the last reference, freeing the request and the buffer.
+  ngx_http_finalize_request(pin->request, NGX_DONE);
+  delete pin;
+}
+
+void NgxEspGrpcServerCall::OrphanPinnedBodyBuffers() {
+  // The releases may still land after the call is gone; leave each pin
+  // to just drop its request reference when it arrives.
+  for (auto &pin : pinned_body_buffers_) {
+    pin->call = nullptr;
+  }
+  pinned_body_buffers_.clear();
+}
+
 void NgxEspGrpcServerCall::Write(const ::grpc::ByteBuffer &msg,
                                  std::function<void(bool)> continuation) {
+  std::vector<::grpc::ByteBuffer> msgs;
+  msgs.push_back(msg);
+  WriteBatch(std::move(msgs), false, continuation);
+}
+
+void NgxEspGrpcServerCall::WriteBatch(std::vector<::grpc::ByteBuffer> msgs,
+                                      bool last,
+                                      std::function<void(bool)> continuation) {
   if (!cln_.data) {
     continuation(false);
     return;
   }
+  if (msgs.empty()) {
+    continuation(true);
+    return;
+  }
 
   // Make sure the headers have been sent
   if (!r_->header_sent) {
@@ -747,17 +1074,39 @@ void NgxEspGrpcServerCall::Write(const ::grpc::ByteBuffer &msg,
   }
 
   ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r_->connection->log, 0,
-                 "NgxEspGrpcServerCall::Write: Writing %z bytes", msg.Length());
+                 "NgxEspGrpcServerCall::WriteBatch: Writing %z messages",
+                 msgs.size());
 
+  // Convert each message and link the resulting chains so the whole batch
+  // goes through the output filters in a single call.
   ngx_chain_t *out = nullptr;
-  if (!ConvertResponseMessage(msg, &out)) {
-    // Converting the response message failed. ConvertResponseMessage() has
-    // finalized the request, call the continuation with false to abort the
-    // call.
-    ngx_log_error(NGX_LOG_DEBUG, r_->connection->log, 0,
-                  "Failed to convert a gRPC response message.");
-    continuation(false);
-    return;
+  ngx_chain_t **next = &out;
+  for (const auto &msg : msgs) {
+    ngx_chain_t *cl = nullptr;
+    if (!ConvertResponseMessage(msg, &cl)) {
+      // Converting the response message failed. ConvertResponseMessage() has
+      // finalized the request, call the continuation with false to abort the
+      // call.
+      ngx_log_error(NGX_LOG_DEBUG, r_->connection->log, 0,
+                    "Failed to convert a gRPC response message.");
+      continuation(false);
+      return;
+    }
+    *next = cl;
+    while (*next) {
+      next = &(*next)->next;
+    }
+  }
+
+  // Only the final buf of the batch ends the chain. When no more messages
+  // will follow, suppress the flush as well: the batch stays buffered in the
+  // output filters and goes to the wire together with the trailers and
+  // last_buf submitted by Finish(), in one downstream write.
+  for (ngx_chain_t *cl = out; cl; cl = cl->next) {
+    cl->buf->last_in_chain = (cl->next == nullptr);
+    if (last) {
+      cl->buf->flush = 0;
+    }
   }
 
   ngx_int_t rc = ngx_esp_write_output(
@@ -766,11 +1115,13 @@ void NgxEspGrpcServerCall::Write(const ::grpc::ByteBuffer &msg,
   // re-used by AllocNgxBufChain(). They could be used by next respond
   // messages for passthrough grpc.
   ngx_chain_update_chains(r_->pool, &buf_free_, &buf_busy_, &out, buf_tag_);
+  // Drop the references of zero-copy slices that have been sent.
+  ReleaseSentSlices();
 
   if (rc == NGX_OK) {
     // We were immediately able to send the message downstream.
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r_->connection->log, 0,
-                   "NgxEspGrpcServerCall::Write: completed synchronously");
+                   "NgxEspGrpcServerCall::WriteBatch: completed synchronously");
     continuation(true);
     return;
   }
@@ -778,7 +1129,7 @@ void NgxEspGrpcServerCall::Write(const ::grpc::ByteBuffer &msg,
   if (rc != NGX_AGAIN) {
     // We failed to send the message downstream.
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r_->connection->log, 0,
-                   "NgxEspGrpcServerCall::Write: failed synchronously");
+                   "NgxEspGrpcServerCall::WriteBatch: failed synchronously");
     continuation(false);
     return;
   }
@@ -786,7 +1137,7 @@ void NgxEspGrpcServerCall::Write(const ::grpc::ByteBuffer &msg,
   // Otherwise: the message is in the outgoing queue.
   write_continuation_ = continuation;
   ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r_->connection->log, 0,
-                 "NgxEspGrpcServerCall::Write: blocked");
+                 "NgxEspGrpcServerCall::WriteBatch: blocked");
 }
 
 void NgxEspGrpcServerCall::RecordBackendTime(int64_t backend_time) {
@@ -807,22 +1158,32 @@ void NgxEspGrpcServerCall::Cleanup(void *server_call_ptr) {
   if (server_call->read_continuation_) {
     server_call->CompletePendingRead(false, utils::Status::OK);
   }
+  // The request memory is going away; drop the slice references without
+  // looking at the bufs pointing at them.
+  server_call->ReleaseAllSlices();
+  // Pinned body bufs keep their own request references; detach them so
+  // their releases don't touch the terminated request's body chains.
+  server_call->OrphanPinnedBodyBuffers();
   server_call->cln_.data = nullptr;
 }
 
 grpc_byte_buffer *NgxEspGrpcServerCall::ConvertByteBuffer(
-    const ::grpc::ByteBuffer &msg) {
-  std::vector<::grpc::Slice> slices;
-  if (!msg.Dump(&slices).ok()) {
+    const ::grpc::ByteBuffer &msg, std::vector<::grpc::Slice> *slices,
+    std::vector<grpc_slice> *grpc_slices) {
+  slices->clear();
+  if (!msg.Dump(slices).ok()) {
     return nullptr;
   }
-  std::vector<grpc_slice> grpc_slices(slices.size());
-  for (unsigned int i = 0; i < slices.size(); ++i) {
-    grpc_slices[i] = slices[i].c_slice();
+  grpc_slices->resize(slices->size());
+  for (unsigned int i = 0; i < slices->size(); ++i) {
+    (*grpc_slices)[i] = (*slices)[i].c_slice();
     // s.c_slice() add_ref, need to un_ref it.
-    grpc_slice_unref(grpc_slices[i]);
+    grpc_slice_unref((*grpc_slices)[i]);
   }
-  return grpc_raw_byte_buffer_create(grpc_slices.data(), grpc_slices.size());
+  // grpc_raw_byte_buffer_create takes its own references on the slices, so
+  // the scratch vectors can be reused for the next message.
+  return grpc_raw_byte_buffer_create(grpc_slices->data(),
+                                     grpc_slices->size());
 }
 
 }  // namespace nginx
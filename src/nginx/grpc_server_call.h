@@ -30,12 +30,20 @@ extern "C" {
 #include "src/http/ngx_http.h"
 }
 
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "grpc++/support/byte_buffer.h"
 #include "src/grpc/server_call.h"
 
 namespace google {
 namespace api_manager {
 namespace nginx {
 
+class NgxEspGrpcQueue;
+
 // A common base class for implementing the grpc::ServerCall interface in a way
 // that wraps a downstream connection that's managed by an Nginx HTTP server. It
 // implements the common functionality shared between by gRPC pass-through and
@@ -65,6 +73,11 @@ class NgxEspGrpcServerCall : public grpc::ServerCall {
   virtual ~NgxEspGrpcServerCall();
 
   // ServerCall methods.
+  virtual void ForEachHeader(
+      std::function<void(const ::grpc::string_ref& key,
+                         const ::grpc::string_ref& value)>
+          visitor);
+  virtual std::chrono::system_clock::time_point deadline();
   virtual void SendInitialMetadata(
       std::multimap<std::string, std::string> initial_metadata,
       std::function<void(bool)> continuation);
@@ -72,6 +85,8 @@ class NgxEspGrpcServerCall : public grpc::ServerCall {
                     std::function<void(bool, utils::Status)> continuation);
   virtual void Write(const ::grpc::ByteBuffer& msg,
                      std::function<void(bool)> continuation);
+  virtual void WriteBatch(std::vector<::grpc::ByteBuffer> msgs, bool last,
+                          std::function<void(bool)> continuation);
   virtual void RecordBackendTime(int64_t backend_time);
 
   virtual void UpdateRequestMessageStat(int64_t size);
@@ -110,12 +125,76 @@ class NgxEspGrpcServerCall : public grpc::ServerCall {
 
   ngx_http_cleanup_t cln_;
 
-  static grpc_byte_buffer* ConvertByteBuffer(const ::grpc::ByteBuffer& msg);
+  // Serializes msg into a grpc_byte_buffer. The scratch vectors are only
+  // used within the call; passing the same vectors for every message of a
+  // call avoids reallocating them per message.
+  static grpc_byte_buffer* ConvertByteBuffer(
+      const ::grpc::ByteBuffer& msg, std::vector<::grpc::Slice>* slices,
+      std::vector<grpc_slice>* grpc_slices);
+
+  // Scratch space for ConvertByteBuffer(), reused across the messages of
+  // the call.
+  std::vector<::grpc::Slice> slice_scratch_;
+  std::vector<grpc_slice> grpc_slice_scratch_;
+
+  // Returns true if the slices hold at least one complete gRPC message
+  // (the five byte header plus the message body).
+  static bool ContainsCompleteMessage(const std::vector<grpc_slice>& slices);
 
   // Allocate a ngx buf chain and its buf from re-cycled free list.
   ngx_chain_t* AllocNgxBufChain(size_t buflen);
 
+  // Wraps a gRPC slice as a ngx buf chain pointing directly at the slice
+  // memory, taking a reference on the slice. The reference is dropped by
+  // ReleaseSentSlices() once nginx has consumed the buf, so the payload is
+  // sent downstream without being copied.
+  ngx_chain_t* WrapGrpcSliceChain(grpc_slice slice);
+
+  // Drops the references of the wrapped slices whose bufs have been fully
+  // consumed by the output filter chain.
+  void ReleaseSentSlices();
+
+  // The request-direction counterpart of WrapGrpcSliceChain: wraps an
+  // in-memory request body buf as a gRPC slice pointing directly at the
+  // buffer memory, so the body is handed upstream without being copied.
+  // The buf is consumed only once the gRPC library drops its last
+  // reference on the slice. Returns false when the buf cannot be pinned
+  // (not in memory, too small to be worth tracking, not an HTTP/2
+  // request, or the gRPC queue is gone); the caller then copies the buf
+  // as before. On success the chain link is owned by the pin and must
+  // not be recycled by the caller.
+  bool TryPinBodyBuffer(ngx_chain_t* cl, grpc_slice* out);
+
  private:
+  // A request body buf pinned by TryPinBodyBuffer(). The buf is consumed
+  // (pos advanced, link recycled) only after the gRPC library has dropped
+  // the last reference on the wrapping slice, which may happen on a gRPC
+  // dispatch thread; the release is posted back to the nginx thread
+  // through the gRPC queue. A reference on the request keeps the buffer
+  // memory alive until then. call is cleared if the NgxEspGrpcServerCall
+  // goes away first, leaving the pin to just drop the request reference.
+  struct PinnedBodyBuffer {
+    NgxEspGrpcServerCall* call;
+    ngx_http_request_t* request;
+    ngx_http_request_body_t* body;
+    ngx_chain_t* cl;
+    // Keeps the queue (and its Post()) alive until the release lands.
+    std::shared_ptr<NgxEspGrpcQueue> queue;
+  };
+
+  // The grpc slice destroy callback for pinned body bufs. May run on any
+  // thread; hops back to the nginx thread via NgxEspGrpcQueue::Post().
+  static void OnPinnedSliceReleased(void* pin_ptr);
+
+  // Consumes a pinned buf on the nginx thread and releases the request
+  // reference taken when it was pinned.
+  static void ReclaimPinnedBodyBuffer(PinnedBodyBuffer* pin);
+
+  // Detaches the outstanding pins from this call so their releases only
+  // drop the request references. Used when the call or the request goes
+  // away while the gRPC library still references the pinned slices.
+  void OrphanPinnedBodyBuffers();
+
   static void OnDownstreamPreread(ngx_http_request_t* r);
   static void OnDownstreamReadable(ngx_http_request_t* r);
   static void OnDownstreamWriteable(ngx_http_request_t* r);
@@ -136,11 +215,35 @@ class NgxEspGrpcServerCall : public grpc::ServerCall {
   // completed with 'false'.
   static void Cleanup(void* server_call_ptr);
 
+  // Drops the references of all wrapped slices without touching their bufs.
+  // Used on cleanup paths where the request memory may be gone already.
+  void ReleaseAllSlices();
+
   // re cycled buffer chains
   ngx_chain_t* buf_free_;
   ngx_chain_t* buf_busy_;
   ngx_buf_tag_t buf_tag_;
 
+  // Tag for bufs wrapping gRPC slice memory. Kept distinct from buf_tag_ so
+  // ngx_chain_update_chains() never recycles them into the free list while
+  // they point at slice memory.
+  ngx_buf_tag_t slice_buf_tag_;
+
+  // The wrapped slices whose references are still held, with the bufs that
+  // point at them.
+  std::vector<std::pair<ngx_buf_t*, grpc_slice>> pending_slices_;
+
+  // The request body bufs still pinned by the gRPC library. The pins own
+  // themselves; this vector only exists so they can be orphaned if the
+  // call goes away first.
+  std::vector<PinnedBodyBuffer*> pinned_body_buffers_;
+
+  // Converts newly arrived request body bufs into downstream_slices_ and
+  // keeps downstream_buffered_bytes_ in step. All appends to
+  // downstream_slices_ go through here so the per-frame boundary checks
+  // are pure length accounting instead of rescanning the slice vector.
+  bool ReadDownstreamRequestBody();
+
   bool add_header_failed_;
   bool reading_;
   std::function<void(bool)> write_continuation_;
@@ -148,6 +251,15 @@ class NgxEspGrpcServerCall : public grpc::ServerCall {
   ::grpc::ByteBuffer* read_msg_;
   ::std::vector<grpc_slice> downstream_slices_;
 
+  // The total bytes buffered in downstream_slices_; see
+  // ReadDownstreamRequestBody().
+  size_t downstream_buffered_bytes_;
+
+  // The absolute deadline parsed from the client's grpc-timeout header
+  // when the call was constructed; time_point::max() if the client did
+  // not set a timeout.
+  std::chrono::system_clock::time_point deadline_;
+
   // If true, sending of the headers will be delayed.
   bool delay_downstream_headers_;
 };
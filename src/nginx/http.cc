@@ -27,10 +27,13 @@
 #include "src/nginx/http.h"
 
 #include <core/ngx_string.h>
+#include <map>
 #include <memory>
+#include <string>
 
 #include "include/api_manager/http_request.h"
 #include "src/nginx/alloc.h"
+#include "src/nginx/circuit_breaker.h"
 #include "src/nginx/module.h"
 #include "src/nginx/util.h"
 
@@ -64,6 +67,329 @@ ngx_str_t https = ngx_string("https://");
 ngx_int_t ngx_esp_upstream_process_status_line(ngx_http_request_t *r);
 ngx_int_t ngx_esp_upstream_process_header(ngx_http_request_t *r);
 
+// A cached address resolution for an outbound host.
+//
+// Each outbound call runs on a fake connection whose pools are destroyed on
+// completion, so the upstream connection itself cannot be kept alive across
+// calls. What can be reused is the DNS resolution: the addresses of the
+// hosts ESP talks to (service control, metadata server, JWKS endpoints) are
+// cached here so that repeat calls skip the resolver round trip.
+struct ngx_esp_resolved_address {
+  sockaddr_storage addr;
+  socklen_t socklen;
+  time_t expires;
+
+  // True for a cached resolution failure. Negative entries only suppress
+  // background refreshes; the request path still falls back to the normal
+  // resolver so a recovered host is picked up immediately.
+  bool negative;
+
+  // True while a background re-resolution of this host is in flight.
+  bool refresh_in_flight;
+};
+
+// Cached DNS results are reused for this long when the resolver response
+// carries no usable TTL.
+const time_t kDnsCacheTtlSeconds = 300;
+
+// Cached resolution failures are remembered for this long.
+const time_t kDnsNegativeCacheTtlSeconds = 5;
+
+// A background re-resolution is started when a cache hit is served and the
+// entry expires within this window, so steady-state traffic never waits for
+// the resolver.
+const time_t kDnsRefreshAheadSeconds = 60;
+
+// The cap on distinct hosts kept in the cache. ESP only calls a handful of
+// endpoints, so this bound is generous.
+const size_t kDnsCacheMaxHosts = 64;
+
+std::map<std::string, ngx_esp_resolved_address> &resolved_address_cache() {
+  static std::map<std::string, ngx_esp_resolved_address> *cache =
+      new std::map<std::string, ngx_esp_resolved_address>;
+  return *cache;
+}
+
+std::string resolved_cache_key(const ngx_str_t &host, in_port_t port) {
+  return ngx_str_to_std(host) + ":" + std::to_string(port);
+}
+
+// The context of a background re-resolution. ctx->name points at the host
+// string, so the structure must outlive the resolution; it is deleted by
+// the resolver handler.
+struct ngx_esp_dns_refresh {
+  std::string host;
+  std::string key;
+  in_port_t port;
+  // When the resolution started, for the pre-resolution latency log.
+  ngx_msec_t start_msec;
+};
+
+// Turns a completed resolver query into a cache entry under refresh->key:
+// the fresh address (honoring the TTL reported by the resolver), or a
+// negative entry remembering the failure briefly so we don't hammer the
+// resolver. The request path is unaffected by negative entries and still
+// resolves normally. Returns whether the resolution succeeded.
+bool store_resolver_result(ngx_resolver_ctx_t *ctx,
+                           ngx_esp_dns_refresh *refresh) {
+  auto &cache = resolved_address_cache();
+  auto it = cache.find(refresh->key);
+  if (it != cache.end()) {
+    it->second.refresh_in_flight = false;
+  }
+
+  ngx_esp_resolved_address entry;
+  ngx_memzero(&entry.addr, sizeof(entry.addr));
+  entry.socklen = 0;
+  entry.refresh_in_flight = false;
+
+  bool resolved = ctx->state == NGX_OK && ctx->naddrs > 0 &&
+                  ctx->addrs[0].socklen <= sizeof(sockaddr_storage);
+  if (!resolved) {
+    entry.negative = true;
+    entry.expires = ngx_time() + kDnsNegativeCacheTtlSeconds;
+  } else {
+    ngx_memcpy(&entry.addr, ctx->addrs[0].sockaddr, ctx->addrs[0].socklen);
+    ngx_inet_set_port(reinterpret_cast<sockaddr *>(&entry.addr),
+                      refresh->port);
+    entry.socklen = ctx->addrs[0].socklen;
+    entry.negative = false;
+    entry.expires = (ctx->valid > ngx_time())
+                        ? ctx->valid
+                        : ngx_time() + kDnsCacheTtlSeconds;
+  }
+
+  if (it != cache.end()) {
+    it->second = entry;
+  } else if (cache.size() < kDnsCacheMaxHosts) {
+    cache[refresh->key] = entry;
+  }
+  return resolved;
+}
+
+// The resolver handler of a background re-resolution. Runs on the main
+// nginx thread.
+void dns_refresh_handler(ngx_resolver_ctx_t *ctx) {
+  std::unique_ptr<ngx_esp_dns_refresh> refresh(
+      reinterpret_cast<ngx_esp_dns_refresh *>(ctx->data));
+  store_resolver_result(ctx, refresh.get());
+  ngx_resolve_name_done(ctx);
+}
+
+// The resolver handler of a startup pre-resolution. Same cache update as
+// a background refresh, plus the resolution latency log that makes the
+// cost of the pinned endpoints visible next to the other startup phases.
+void dns_preresolve_handler(ngx_resolver_ctx_t *ctx) {
+  std::unique_ptr<ngx_esp_dns_refresh> refresh(
+      reinterpret_cast<ngx_esp_dns_refresh *>(ctx->data));
+  bool resolved = store_resolver_result(ctx, refresh.get());
+  ngx_msec_int_t elapsed_ms =
+      static_cast<ngx_msec_int_t>(ngx_current_msec - refresh->start_msec);
+  if (resolved) {
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                  "esp: preresolved control-plane host %s in %M ms",
+                  refresh->host.c_str(), elapsed_ms);
+  } else {
+    ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                  "esp: failed to preresolve control-plane host %s "
+                  "after %M ms; the first call will resolve it",
+                  refresh->host.c_str(), elapsed_ms);
+  }
+  ngx_resolve_name_done(ctx);
+}
+
+// Starts a background re-resolution of the entry's host if it is about to
+// expire, so that steady-state lookups keep hitting a fresh cache instead
+// of waiting on the resolver.
+void maybe_refresh_resolved_address(ngx_http_request_t *r,
+                                    const ngx_str_t &host, in_port_t port,
+                                    const std::string &key,
+                                    ngx_esp_resolved_address *entry) {
+  if (entry->refresh_in_flight ||
+      entry->expires - ngx_time() > kDnsRefreshAheadSeconds) {
+    return;
+  }
+
+  auto clcf = reinterpret_cast<ngx_http_core_loc_conf_t *>(
+      ngx_http_get_module_loc_conf(r, ngx_http_core_module));
+  if (clcf == nullptr || clcf->resolver == nullptr) {
+    return;
+  }
+
+  std::unique_ptr<ngx_esp_dns_refresh> refresh(new ngx_esp_dns_refresh);
+  refresh->host.assign(reinterpret_cast<const char *>(host.data), host.len);
+  refresh->key = key;
+  refresh->port = port;
+  refresh->start_msec = ngx_current_msec;
+
+  ngx_resolver_ctx_t *ctx = ngx_resolve_start(clcf->resolver, nullptr);
+  if (ctx == nullptr ||
+      ctx == reinterpret_cast<ngx_resolver_ctx_t *>(NGX_NO_RESOLVER)) {
+    return;
+  }
+
+  ctx->name.len = refresh->host.size();
+  ctx->name.data =
+      reinterpret_cast<u_char *>(const_cast<char *>(refresh->host.data()));
+  ctx->handler = dns_refresh_handler;
+  ctx->data = refresh.get();
+  ctx->timeout = clcf->resolver_timeout;
+
+  if (ngx_resolve_name(ctx) != NGX_OK) {
+    return;
+  }
+
+  // The handler now owns the refresh context.
+  refresh.release();
+  entry->refresh_in_flight = true;
+}
+
+// Fills upstream->resolved with a cached address of the host, if a fresh one
+// is available, so that ngx_http_upstream_init() can skip the resolver.
+void lookup_resolved_address(ngx_http_request_t *r, ngx_pool_t *pool,
+                             ngx_http_upstream_resolved_t *resolved) {
+  auto &cache = resolved_address_cache();
+  std::string key = resolved_cache_key(resolved->host, resolved->port);
+  auto it = cache.find(key);
+  if (it == cache.end()) {
+    return;
+  }
+  if (ngx_time() >= it->second.expires) {
+    cache.erase(it);
+    return;
+  }
+  if (it->second.negative) {
+    // A recent resolution failure; let the request path resolve normally.
+    return;
+  }
+
+  sockaddr *addr =
+      reinterpret_cast<sockaddr *>(ngx_palloc(pool, it->second.socklen));
+  if (addr == nullptr) {
+    return;
+  }
+  ngx_memcpy(addr, &it->second.addr, it->second.socklen);
+
+  resolved->sockaddr = addr;
+  resolved->socklen = it->second.socklen;
+  resolved->naddrs = 1;
+
+  ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                 "esp: resolved %V from the DNS cache", &resolved->host);
+
+  maybe_refresh_resolved_address(r, resolved->host, resolved->port, key,
+                                 &it->second);
+}
+
+// Remembers the address a successful call resolved to. Entries are only
+// inserted when missing or expired, so an address served from the cache
+// cannot keep refreshing its own TTL and go permanently stale.
+void store_resolved_address(const ngx_http_upstream_resolved_t *resolved) {
+  if (resolved == nullptr || resolved->sockaddr == nullptr ||
+      resolved->host.len == 0 ||
+      resolved->socklen > sizeof(sockaddr_storage)) {
+    return;
+  }
+
+  auto &cache = resolved_address_cache();
+  std::string key = resolved_cache_key(resolved->host, resolved->port);
+  auto it = cache.find(key);
+  if (it != cache.end() && ngx_time() < it->second.expires) {
+    return;
+  }
+
+  if (it == cache.end() && cache.size() >= kDnsCacheMaxHosts) {
+    // Evict the expired entries; if none have expired, don't grow the cache.
+    for (auto entry = cache.begin(); entry != cache.end();) {
+      if (ngx_time() >= entry->second.expires) {
+        entry = cache.erase(entry);
+      } else {
+        ++entry;
+      }
+    }
+    if (cache.size() >= kDnsCacheMaxHosts) {
+      return;
+    }
+  }
+
+  ngx_esp_resolved_address entry;
+  ngx_memzero(&entry.addr, sizeof(entry.addr));
+  ngx_memcpy(&entry.addr, resolved->sockaddr, resolved->socklen);
+  entry.socklen = resolved->socklen;
+  entry.expires = ngx_time() + kDnsCacheTtlSeconds;
+  entry.negative = false;
+  entry.refresh_in_flight = false;
+  cache[key] = entry;
+}
+
+// The circuit breaker key of a URL: the authority (host and optional
+// port) between the scheme and the path. Empty when the URL has no
+// scheme; such calls are not tracked.
+std::string breaker_destination(const std::string &url) {
+  size_t start = url.find("://");
+  if (start == std::string::npos) {
+    return std::string();
+  }
+  start += sizeof("://") - 1;
+  size_t end = url.find('/', start);
+  if (end == std::string::npos) {
+    return url.substr(start);
+  }
+  return url.substr(start, end - start);
+}
+
+// The shared memory zone backing the circuit breaker, or nullptr when
+// the module is not configured.
+ngx_shm_zone_t *esp_breaker_zone() {
+  auto http_cctx = reinterpret_cast<ngx_http_conf_ctx_t *>(
+      ngx_get_conf(ngx_cycle->conf_ctx, ngx_http_module));
+  if (http_cctx == nullptr) {
+    return nullptr;
+  }
+  auto mc = reinterpret_cast<ngx_esp_main_conf_t *>(
+      http_cctx->main_conf[ngx_esp_module.ctx_index]);
+  return mc != nullptr ? mc->breaker_zone : nullptr;
+}
+
+// The global retry budget: over each window, retries may not exceed this
+// fraction of the dispatched calls, plus a small floor so a failed call
+// can still retry when traffic is low. Without the budget every caller
+// retries independently and an upstream outage multiplies the outbound
+// traffic by the per-call retry count.
+const time_t kRetryBudgetWindowSeconds = 10;
+const double kRetryBudgetRatio = 0.2;
+const long kRetryBudgetMinRetries = 3;
+
+// Worker-local counters; the budget bounds each worker's own retries.
+// Retried dispatches count into the base as well, which loosens the
+// effective fraction slightly; the bound stays linear in base traffic.
+time_t retry_budget_window_start = 0;
+long retry_budget_calls = 0;
+long retry_budget_retries = 0;
+
+void roll_retry_budget_window() {
+  if (ngx_time() - retry_budget_window_start >= kRetryBudgetWindowSeconds) {
+    retry_budget_window_start = ngx_time();
+    retry_budget_calls = 0;
+    retry_budget_retries = 0;
+  }
+}
+
+void count_dispatched_call() {
+  roll_retry_budget_window();
+  retry_budget_calls++;
+}
+
+bool acquire_retry_budget() {
+  roll_retry_budget_window();
+  if (retry_budget_retries >=
+      retry_budget_calls * kRetryBudgetRatio + kRetryBudgetMinRetries) {
+    return false;
+  }
+  retry_budget_retries++;
+  return true;
+}
+
 // Alternatively, we could inherit both ngx_esp_http_connection and
 // ngx_esp_request_ctx_s from a common base and store the base pointer
 // in the per-request module context.
@@ -470,6 +796,85 @@ void ngx_esp_upstream_abort_request(ngx_http_request_t *r) {
                 "endpoints request aborted");
 }
 
+//
+// Recycling of completed connections.
+//
+// Control-plane requests have near-constant shapes, so the pools grown
+// by one call are exactly what the next call needs. Instead of
+// destroying the pool triple of a completed call, we run its cleanups,
+// reset the pools (which keeps their grown block chains) and park the
+// connection object on an intrusive free list; a recycled call then
+// sets up without any heap allocation.
+//
+
+// Head and size of the per-worker free list, chained through
+// recycle_next.
+ngx_esp_http_connection *http_connection_free_list = nullptr;
+size_t http_connection_free_count = 0;
+
+// The cap on parked connections. Outbound calls are low-concurrency
+// control-plane traffic; beyond the cap completed connections are
+// destroyed as before.
+const size_t kHttpConnectionFreeListMax = 8;
+
+// Runs and unlinks the pool's cleanup handlers, exactly as
+// ngx_destroy_pool would before freeing the memory. Must precede
+// ngx_reset_pool, which reclaims the memory holding the cleanup list.
+void run_pool_cleanups(ngx_pool_t *pool) {
+  for (ngx_pool_cleanup_t *c = pool->cleanup; c != nullptr; c = c->next) {
+    if (c->handler) {
+      c->handler(c->data);
+    }
+  }
+  pool->cleanup = nullptr;
+}
+
+// Returns the connection object to its freshly-constructed state. The
+// plain nginx structures are zeroed field by field; the C++ members in
+// between are cleared instead so they keep their grown capacity.
+void reset_http_connection_state(ngx_esp_http_connection *http_connection) {
+  ngx_memzero(&http_connection->connection,
+              sizeof(http_connection->connection));
+  ngx_memzero(&http_connection->read_event,
+              sizeof(http_connection->read_event));
+  ngx_memzero(&http_connection->write_event,
+              sizeof(http_connection->write_event));
+  ngx_memzero(&http_connection->local_sockaddr,
+              sizeof(http_connection->local_sockaddr));
+  ngx_memzero(&http_connection->log, sizeof(http_connection->log));
+  ngx_memzero(&http_connection->log_ctx, sizeof(http_connection->log_ctx));
+  ngx_memzero(&http_connection->upstream_conf,
+              sizeof(http_connection->upstream_conf));
+  http_connection->request = nullptr;
+  ngx_str_null(&http_connection->url_path);
+  ngx_str_null(&http_connection->host_header);
+  http_connection->cache_resolved_address = false;
+  http_connection->esp_request.reset();
+  ngx_memzero(&http_connection->response_status,
+              sizeof(http_connection->response_status));
+  http_connection->response_body.clear();
+  http_connection->response_headers.clear();
+  ngx_memzero(&http_connection->wakeup_event,
+              sizeof(http_connection->wakeup_event));
+}
+
+// Pops a recycled connection off the free list, or returns nullptr when
+// the list is empty. The parked pools are left on the connection's pool
+// fields for the caller to reclaim.
+ngx_esp_http_connection *reuse_http_connection(ngx_log_t *log) {
+  ngx_esp_http_connection *http_connection = http_connection_free_list;
+  if (http_connection == nullptr) {
+    return nullptr;
+  }
+  http_connection_free_list = http_connection->recycle_next;
+  http_connection_free_count--;
+  http_connection->recycle_next = nullptr;
+
+  ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                 "esp: reusing recycled http_connection %p", http_connection);
+  return http_connection;
+}
+
 //
 // Wakeup handler.
 //
@@ -498,6 +903,29 @@ void wakeup_event_handler(ngx_event_t *ev) {
   ngx_pool_t *cp = http_connection->connection_pool_reset.pool;
   ngx_pool_t *rp = http_connection->request_pool_reset.pool;
 
+  if (cp != nullptr && rp != nullptr &&
+      http_connection_free_count < kHttpConnectionFreeListMax) {
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "esp: recycling pools ep=%p, cp=%p, rp=%p", ep, cp, rp);
+
+    // Park the connection for reuse instead of destroying it. The pool
+    // cleanups run by hand at the same point where ngx_destroy_pool
+    // would have run them; resetting then keeps the pools' grown block
+    // chains for the next call.
+    run_pool_cleanups(cp);
+    ngx_reset_pool(cp);
+    run_pool_cleanups(rp);
+    ngx_reset_pool(rp);
+    reset_http_connection_state(http_connection);
+    http_connection->connection_pool_reset.pool = cp;
+    http_connection->request_pool_reset.pool = rp;
+
+    http_connection->recycle_next = http_connection_free_list;
+    http_connection_free_list = http_connection;
+    http_connection_free_count++;
+    return;
+  }
+
   ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ev->log, 0,
                  "esp: destroying pools ep=%p, cp=%p, rp=%p", ep, cp, rp);
 
@@ -527,6 +955,23 @@ void ngx_esp_upstream_finalize_request(ngx_http_request_t *r, ngx_int_t rc) {
                  "ngx_esp_upstream_finalize_request called: %V%V",
                  &http_connection->host_header, &http_connection->url_path);
 
+  // On success, remember the address the host resolved to so that the next
+  // call to the same host can skip the resolver.
+  if (rc == NGX_OK && http_connection->cache_resolved_address &&
+      r->upstream != nullptr) {
+    store_resolved_address(r->upstream->resolved);
+  }
+
+  // Feed the transport result to the circuit breaker while rc still
+  // carries the transport status. HTTP error responses mean the endpoint
+  // is alive; only failed transmissions count against it.
+  if (http_connection->esp_request) {
+    ngx_esp_breaker_record_result(
+        esp_breaker_zone(),
+        breaker_destination(http_connection->esp_request->url()),
+        rc == NGX_OK);
+  }
+
   std::string message;
   if (rc == NGX_OK) {
     // If the overall transmission succeeded (rc == NGX_OK), use the HTTP
@@ -553,8 +998,16 @@ void ngx_esp_upstream_finalize_request(ngx_http_request_t *r, ngx_int_t rc) {
     std::unique_ptr<HTTPRequest> request;
     request.swap(http_connection->esp_request);
 
-    // Retry if an error and retry budget left
-    if (rc == NGX_ERROR && request->max_retries() > 0) {
+    // Retry if an error and retry budget left. The per-call retries
+    // share the global retry budget, so retries stay a bounded fraction
+    // of base traffic during an upstream outage.
+    bool retry = rc == NGX_ERROR && request->max_retries() > 0;
+    if (retry && !acquire_retry_budget()) {
+      ngx_log_debug0(NGX_LOG_DEBUG_HTTP, &http_connection->log, 0,
+                     "esp: retry denied by the global retry budget");
+      retry = false;
+    }
+    if (retry) {
       // increase timeout
       request->set_max_retries(request->max_retries() - 1);
       request->set_timeout_ms(request->timeout_ms() *
@@ -568,7 +1021,7 @@ void ngx_esp_upstream_finalize_request(ngx_http_request_t *r, ngx_int_t rc) {
       ngx_esp_send_http_request(std::move(request));
     } else {
       // Extract accumulated response body to a string.
-      std::string body = http_connection->response_body.str();
+      std::string body = std::move(http_connection->response_body);
 
       Status status(rc, message);
 
@@ -666,7 +1119,7 @@ ngx_int_t ngx_esp_upstream_input_filter(void *data, ssize_t bytes) {
                  "endpoints received %d bytes: %V", (int)bytes, &body);
 #endif
 
-  http_connection->response_body.write(
+  http_connection->response_body.append(
       reinterpret_cast<char *>(r->upstream->buffer.last), bytes);
 
   return NGX_OK;
@@ -708,8 +1161,8 @@ static ngx_int_t ngx_esp_upstream_pipe_input_filter(ngx_event_pipe_t *p,
                  "http_connection=%p)",
                  r, bytes, http_connection);
 
-  http_connection->response_body.write(reinterpret_cast<char *>(buf->pos),
-                                       bytes);
+  http_connection->response_body.append(reinterpret_cast<char *>(buf->pos),
+                                        bytes);
   return NGX_OK;
 }
 
@@ -1014,6 +1467,13 @@ Status initialize_upstream_request(ngx_log_t *log, HTTPRequest *request,
     return status;
   }
 
+  // If the URL carries a host name rather than a literal IP address, try to
+  // satisfy the resolution from the DNS cache; cache the result otherwise.
+  if (upstream->resolved->sockaddr == nullptr) {
+    http_connection->cache_resolved_address = true;
+    lookup_resolved_address(r, request_pool, upstream->resolved);
+  }
+
   // Set timeout, defaulting to 60 seconds.
   //
   // NGINX has very fine-grained timeouts. We may want to further evolve
@@ -1106,20 +1566,35 @@ Status ngx_esp_create_http_request(
   std::unique_ptr<ngx_pool_t, ngx_pool_t_deleter> connection_pool;
   std::unique_ptr<ngx_pool_t, ngx_pool_t_deleter> request_pool;
 
-  Status status = allocate_pools(log, esp_pool, connection_pool, request_pool);
-  if (!status.ok()) {
-    return status;
-  }
+  // Prefer a recycled connection; its pools already hold the memory the
+  // previous call needed, so the setup below allocates nothing new.
+  ngx_esp_http_connection *http_connection = reuse_http_connection(log);
+  if (http_connection != nullptr) {
+    // Reclaim ownership of the parked pools; should a step below fail,
+    // the smart pointers tear everything down, including the connection
+    // object whose cleanup is registered on the esp pool.
+    esp_pool.reset(http_connection->esp_pool);
+    connection_pool.reset(http_connection->connection_pool_reset.pool);
+    request_pool.reset(http_connection->request_pool_reset.pool);
+    http_connection->connection_pool_reset.pool = nullptr;
+    http_connection->request_pool_reset.pool = nullptr;
+  } else {
+    Status status =
+        allocate_pools(log, esp_pool, connection_pool, request_pool);
+    if (!status.ok()) {
+      return status;
+    }
 
-  // Allocate the HTTP connection state in one go.
-  // Because we custom-fit the pool size to match this one allocation, the
-  // alloction will not fail.
-  ngx_esp_http_connection *http_connection = RegisterPoolCleanup(
-      esp_pool.get(), new (esp_pool.get()) ngx_esp_http_connection());
-  ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
-                 "esp: allocated http_connection %p", http_connection);
-  if (http_connection == nullptr) {
-    return Status(NGX_ERROR, "Out of memory");
+    // Allocate the HTTP connection state in one go.
+    // Because we custom-fit the pool size to match this one allocation, the
+    // alloction will not fail.
+    http_connection = RegisterPoolCleanup(
+        esp_pool.get(), new (esp_pool.get()) ngx_esp_http_connection());
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "esp: allocated http_connection %p", http_connection);
+    if (http_connection == nullptr) {
+      return Status(NGX_ERROR, "Out of memory");
+    }
   }
 
   // Allocate and initialize an ngx_http_request_t.
@@ -1133,7 +1608,7 @@ Status ngx_esp_create_http_request(
   }
 
   // Initialize event and log structures.
-  status = initialize_events_and_logs(http_connection);
+  Status status = initialize_events_and_logs(http_connection);
   if (!status.ok()) {
     return status;
   }
@@ -1189,6 +1664,123 @@ Status ngx_esp_create_http_request(
 
 }  // namespace
 
+void ngx_esp_drain_http_connection_pool() {
+  while (http_connection_free_list != nullptr) {
+    ngx_esp_http_connection *http_connection = http_connection_free_list;
+    http_connection_free_list = http_connection->recycle_next;
+
+    ngx_pool_t *cp = http_connection->connection_pool_reset.pool;
+    ngx_pool_t *rp = http_connection->request_pool_reset.pool;
+    if (cp != nullptr) {
+      ngx_destroy_pool(cp);
+    }
+    if (rp != nullptr) {
+      ngx_destroy_pool(rp);
+    }
+    // Runs the connection object's destructor through the registered
+    // pool cleanup.
+    ngx_destroy_pool(http_connection->esp_pool);
+  }
+  http_connection_free_count = 0;
+}
+
+void ngx_esp_preresolve_url(const std::string &url) {
+  // Recognize the URL scheme and its default port; URLs we cannot call
+  // are not worth resolving.
+  in_port_t default_port;
+  std::string rest;
+  if (url.compare(0, sizeof("http://") - 1, "http://") == 0) {
+    default_port = 80;
+    rest = url.substr(sizeof("http://") - 1);
+  } else if (url.compare(0, sizeof("https://") - 1, "https://") == 0) {
+    default_port = 443;
+    rest = url.substr(sizeof("https://") - 1);
+  } else {
+    return;
+  }
+
+  // Extract the host and optional port from the authority.
+  size_t path = rest.find('/');
+  std::string authority =
+      (path == std::string::npos) ? rest : rest.substr(0, path);
+  in_port_t port = default_port;
+  size_t colon = authority.rfind(':');
+  if (colon != std::string::npos) {
+    int parsed = ngx_atoi(
+        reinterpret_cast<u_char *>(const_cast<char *>(authority.data())) +
+            colon + 1,
+        authority.size() - colon - 1);
+    if (parsed <= 0 || parsed > 65535) {
+      return;
+    }
+    port = static_cast<in_port_t>(parsed);
+    authority = authority.substr(0, colon);
+  }
+  if (authority.empty()) {
+    return;
+  }
+
+  // IP literals (e.g. the metadata server) need no resolution.
+  ngx_str_t host;
+  host.len = authority.size();
+  host.data =
+      reinterpret_cast<u_char *>(const_cast<char *>(authority.data()));
+  in_addr_t addr = ngx_inet_addr(host.data, host.len);
+  if (addr != INADDR_NONE) {
+    return;
+  }
+
+  // Skip hosts that already have a fresh cache entry; a just-started
+  // worker never does, but a reload inherits nothing either way since
+  // the cache is per process.
+  auto &cache = resolved_address_cache();
+  std::string key = resolved_cache_key(host, port);
+  auto it = cache.find(key);
+  if (it != cache.end() && ngx_time() < it->second.expires) {
+    return;
+  }
+
+  // Pre-resolution runs before any request exists, so fetch the resolver
+  // from the http core configuration directly, like esp_breaker_zone()
+  // does for the module configuration.
+  auto http_cctx = reinterpret_cast<ngx_http_conf_ctx_t *>(
+      ngx_get_conf(ngx_cycle->conf_ctx, ngx_http_module));
+  if (http_cctx == nullptr) {
+    return;
+  }
+  auto clcf = reinterpret_cast<ngx_http_core_loc_conf_t *>(
+      http_cctx->loc_conf[ngx_http_core_module.ctx_index]);
+  if (clcf == nullptr || clcf->resolver == nullptr) {
+    return;
+  }
+
+  std::unique_ptr<ngx_esp_dns_refresh> refresh(new ngx_esp_dns_refresh);
+  refresh->host = authority;
+  refresh->key = key;
+  refresh->port = port;
+  refresh->start_msec = ngx_current_msec;
+
+  ngx_resolver_ctx_t *ctx = ngx_resolve_start(clcf->resolver, nullptr);
+  if (ctx == nullptr ||
+      ctx == reinterpret_cast<ngx_resolver_ctx_t *>(NGX_NO_RESOLVER)) {
+    return;
+  }
+
+  ctx->name.len = refresh->host.size();
+  ctx->name.data =
+      reinterpret_cast<u_char *>(const_cast<char *>(refresh->host.data()));
+  ctx->handler = dns_preresolve_handler;
+  ctx->data = refresh.get();
+  ctx->timeout = clcf->resolver_timeout;
+
+  if (ngx_resolve_name(ctx) != NGX_OK) {
+    return;
+  }
+
+  // The handler now owns the refresh context.
+  refresh.release();
+}
+
 void ngx_esp_send_http_request(std::unique_ptr<HTTPRequest> request) {
   ngx_esp_http_connection *http_connection(nullptr);
 
@@ -1199,6 +1791,20 @@ void ngx_esp_send_http_request(std::unique_ptr<HTTPRequest> request) {
                  request->method().c_str(), request->url().c_str(),
                  request->body().size());
 
+  // While the breaker for the destination is open, fail fast instead of
+  // burning a connect timeout; half-open probes pass through here.
+  std::string destination = breaker_destination(request->url());
+  if (!ngx_esp_breaker_allow_call(esp_breaker_zone(), destination)) {
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "esp: circuit breaker open for %s, failing the call",
+                   destination.c_str());
+    request->OnComplete(
+        Status(NGX_ERROR, "Circuit breaker open for " + destination),
+        std::map<std::string, std::string>(), "");
+    return;
+  }
+  count_dispatched_call();
+
   // Create the HTTP request data structures.
   Status status =
       ngx_esp_create_http_request(log, request.get(), &http_connection);
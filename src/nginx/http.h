@@ -28,7 +28,7 @@
 #define NGINX_NGX_ESP_HTTP_H_
 
 #include <memory>
-#include <sstream>
+#include <string>
 
 #include "include/api_manager/http_request.h"
 #include "include/api_manager/utils/status.h"
@@ -55,6 +55,11 @@ struct NgxPoolReset {
 // data structure so that they can be allocated in one go. The pool size
 // is calculated exactly to fit any NGINX pool structures, this struct,
 // and pool cleanup callback (which will call the destructor).
+//
+// Completed connections are not destroyed but parked on a per-worker
+// intrusive free list (chained through recycle_next below) together
+// with their reset pools, so outbound call setup in steady state reuses
+// an existing connection instead of allocating a fresh one.
 struct ngx_esp_http_connection {
   // The pool owns this data structure.
   ngx_pool_t* esp_pool;
@@ -97,6 +102,11 @@ struct ngx_esp_http_connection {
   ngx_str_t url_path;
   ngx_str_t host_header;
 
+  // True if the target host needed DNS resolution (the URL did not carry a
+  // literal IP address). Successful resolutions of such hosts are kept in
+  // the per-worker resolved-address cache.
+  bool cache_resolved_address{};
+
   // A unique pointer to the HTTP request object created by the caller
   // (contains headers, body, HTTP verb, URL, timeout, and completion
   // continuation).
@@ -107,9 +117,10 @@ struct ngx_esp_http_connection {
   // Parsed HTTP response status.
   ngx_http_status_t response_status;
 
-  // Stream in which we accumulate response body as it is streamed to us
-  // by the NGINX upstream module.
-  std::ostringstream response_body;
+  // Buffer in which we accumulate response body as it is streamed to us
+  // by the NGINX upstream module. A std::string rather than a stream so
+  // that a recycled connection keeps the grown capacity.
+  std::string response_body;
 
   // Response headers captured in a map.
   std::map<std::string, std::string> response_headers;
@@ -126,6 +137,10 @@ struct ngx_esp_http_connection {
   //
   // see wakeup_event_handler for details.
   ngx_event_t wakeup_event;
+
+  // Link in the per-worker free list of recycled connections; only
+  // meaningful while the connection is parked.
+  ngx_esp_http_connection *recycle_next{};
 };
 
 // Sends an HTTP request and, upon completion (or error), calls the
@@ -135,6 +150,16 @@ struct ngx_esp_http_connection {
 // an error, for example on connection failure, timeout etc.)
 void ngx_esp_send_http_request(std::unique_ptr<HTTPRequest> request);
 
+// Resolves the host of the URL in the background and pins the result in
+// the outbound DNS cache, so the first call to the host skips the
+// resolver round trip. No-op for IP literals, for hosts with a fresh
+// cache entry, and when no resolver is configured.
+void ngx_esp_preresolve_url(const std::string &url);
+
+// Destroys the connections parked on the free list of recycled outbound
+// connections. Called at worker exit.
+void ngx_esp_drain_http_connection_pool();
+
 }  // namespace nginx
 }  // namespace api_manager
 }  // namespace google
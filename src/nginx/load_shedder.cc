@@ -0,0 +1,169 @@
+// Copyright (C) Extensible Service Proxy Authors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/nginx/load_shedder.h"
+
+#include "src/nginx/util.h"
+
+namespace google {
+namespace api_manager {
+namespace nginx {
+
+namespace {
+
+// The probe interval. Short enough that a saturated loop is noticed
+// within a few hundred milliseconds; long enough that an idle worker
+// pays one timer wakeup per interval and nothing else.
+const ngx_msec_t kProbeIntervalMs = 100;
+
+// The probe keeps a dedicated nginx timer rather than joining the shared
+// timer wheel: the wheel rounds intervals to ticks and replays missed
+// ticks during catch-up, so a wheel entry's scheduled-vs-actual delta
+// measures the wheel, not the loop.
+
+// EWMA weight of each new lag sample. At one sample per probe interval
+// this reacts within a few probes while riding out a single slow event.
+const double kLagEwmaAlpha = 0.3;
+
+// The shed fraction never exceeds this, so even past the ceiling some
+// non-critical traffic is still served rather than blackholed.
+const double kMaxShedFraction = 0.9;
+
+// Default lag band when the directive does not set one: shedding starts
+// once the smoothed lag reaches 50ms and ramps to the maximum fraction
+// at 500ms.
+const ngx_uint_t kDefaultTargetMs = 50;
+const ngx_uint_t kDefaultCeilingMs = 500;
+
+// Requests carrying this header with value "critical" or "high" are
+// never shed; callers use it to mark traffic that must ride out a
+// brownout (health probes, user-facing writes).
+u_char kPriorityHeader[] = "x-endpoints-priority";
+u_char kPriorityCritical[] = "critical";
+u_char kPriorityHigh[] = "high";
+
+NgxEspLoadShedder *shedder_instance = nullptr;
+
+}  // namespace
+
+void NgxEspLoadShedder::Init(ngx_log_t *log, ngx_uint_t target_ms,
+                             ngx_uint_t ceiling_ms) {
+  if (shedder_instance != nullptr) {
+    return;
+  }
+  // One shedder per worker process, alive until the worker exits.
+  shedder_instance = new NgxEspLoadShedder(log, target_ms, ceiling_ms);
+}
+
+NgxEspLoadShedder *NgxEspLoadShedder::TryInstance() {
+  return shedder_instance;
+}
+
+NgxEspLoadShedder::NgxEspLoadShedder(ngx_log_t *log, ngx_uint_t target_ms,
+                                     ngx_uint_t ceiling_ms)
+    : log_(log),
+      target_ms_(target_ms > 0 ? target_ms : kDefaultTargetMs),
+      ceiling_ms_(ceiling_ms > 0 ? ceiling_ms : kDefaultCeilingMs),
+      lag_ewma_ms_(0.0),
+      shed_fraction_(0.0),
+      shedding_(false) {
+  if (ceiling_ms_ <= target_ms_) {
+    ceiling_ms_ = target_ms_ + 1;
+  }
+  ngx_memzero(&probe_ev_, sizeof(probe_ev_));
+  probe_ev_.data = reinterpret_cast<void *>(this);
+  probe_ev_.handler = &NgxEspLoadShedder::OnProbe;
+  probe_ev_.log = log_;
+  probe_ev_.cancelable = 1;
+  AddProbeTimer();
+}
+
+void NgxEspLoadShedder::AddProbeTimer() {
+  expected_msec_ = ngx_current_msec + kProbeIntervalMs;
+  ngx_add_timer(&probe_ev_, kProbeIntervalMs);
+}
+
+void NgxEspLoadShedder::OnProbe(ngx_event_t *ev) {
+  if (ev->timer_set || !ev->timedout) {
+    return;
+  }
+  NgxEspLoadShedder *shedder = reinterpret_cast<NgxEspLoadShedder *>(ev->data);
+
+  // How long past its due time the probe actually ran. ngx_current_msec
+  // is refreshed by the event loop before timers are expired, so this is
+  // the time the expired probe spent waiting behind the loop's backlog.
+  ngx_msec_int_t lag = static_cast<ngx_msec_int_t>(ngx_current_msec -
+                                                   shedder->expected_msec_);
+  if (lag < 0) {
+    lag = 0;
+  }
+
+  shedder->lag_ewma_ms_ +=
+      kLagEwmaAlpha * (static_cast<double>(lag) - shedder->lag_ewma_ms_);
+
+  if (shedder->lag_ewma_ms_ <= shedder->target_ms_) {
+    shedder->shed_fraction_ = 0.0;
+  } else {
+    double ramp = (shedder->lag_ewma_ms_ - shedder->target_ms_) /
+                  (shedder->ceiling_ms_ - shedder->target_ms_);
+    shedder->shed_fraction_ =
+        ramp < 1.0 ? ramp * kMaxShedFraction : kMaxShedFraction;
+  }
+
+  bool shedding = shedder->shed_fraction_ > 0.0;
+  if (shedding != shedder->shedding_) {
+    shedder->shedding_ = shedding;
+    if (shedding) {
+      ngx_log_error(NGX_LOG_WARN, shedder->log_, 0,
+                    "esp: event loop lag %dms; shedding load", lag);
+    } else {
+      ngx_log_error(NGX_LOG_NOTICE, shedder->log_, 0,
+                    "esp: event loop caught up; load shedding off");
+    }
+  }
+
+  shedder->AddProbeTimer();
+}
+
+bool NgxEspLoadShedder::ShouldShed(ngx_http_request_t *r) {
+  if (shed_fraction_ <= 0.0) {
+    return false;
+  }
+
+  auto priority = ngx_esp_find_headers_in(r, kPriorityHeader,
+                                          sizeof(kPriorityHeader) - 1);
+  if (priority != nullptr &&
+      (ngx_strcasecmp(priority->value.data, kPriorityCritical) == 0 ||
+       ngx_strcasecmp(priority->value.data, kPriorityHigh) == 0)) {
+    return false;
+  }
+
+  return static_cast<double>(ngx_random() % 10000) < shed_fraction_ * 10000.0;
+}
+
+}  // namespace nginx
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) Extensible Service Proxy Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef NGINX_NGX_ESP_LOAD_SHEDDER_H_
+#define NGINX_NGX_ESP_LOAD_SHEDDER_H_
+
+extern "C" {
+#include "ngx_core.h"
+#include "ngx_event.h"
+#include "src/http/ngx_http.h"
+}
+
+namespace google {
+namespace api_manager {
+namespace nginx {
+
+// Sheds a fraction of Endpoints requests when the worker is saturated.
+//
+// The saturation signal is event-loop lag: a periodic probe timer records
+// when it should fire and compares that against when it actually fired.
+// When the loop keeps up the delta is near zero; when the worker is
+// saturated, every queued event (including the probe) waits behind the
+// backlog, so the delta grows with the backlog. The lag is smoothed with
+// an EWMA and mapped to a shed fraction that ramps from zero at target_ms
+// to its maximum at ceiling_ms.
+//
+// Shed requests are rejected before any per-request state or the check
+// workflow is set up, so a shed request costs almost nothing -- which is
+// the point: rejecting cheaply at the door keeps the worker responsive
+// for the requests it does accept, instead of degrading all of them
+// together.
+//
+// Like the rest of the nginx glue, all methods run on the main nginx
+// thread of one worker; each worker sheds on its own loop's lag.
+class NgxEspLoadShedder {
+ public:
+  // Starts the per-worker lag probe. target_ms is the smoothed lag at
+  // which shedding starts, ceiling_ms the lag at which the shed fraction
+  // reaches its maximum; zero selects the default for either. Called
+  // once from worker process init when load shedding is configured.
+  static void Init(ngx_log_t *log, ngx_uint_t target_ms,
+                   ngx_uint_t ceiling_ms);
+
+  // Returns the per-worker instance, or nullptr when load shedding is
+  // not configured.
+  static NgxEspLoadShedder *TryInstance();
+
+  // Returns true if the request should be rejected under the current
+  // shed fraction. Requests marked critical by the priority header are
+  // never shed.
+  bool ShouldShed(ngx_http_request_t *r);
+
+  // The current shed fraction, in [0, 1].
+  double shed_fraction() const { return shed_fraction_; }
+
+ private:
+  NgxEspLoadShedder(ngx_log_t *log, ngx_uint_t target_ms,
+                    ngx_uint_t ceiling_ms);
+
+  // Arms the probe timer and records when it is due.
+  void AddProbeTimer();
+
+  // The probe timer handler; folds the observed lag into the EWMA and
+  // recomputes the shed fraction.
+  static void OnProbe(ngx_event_t *ev);
+
+  ngx_event_t probe_ev_;
+  ngx_log_t *log_;
+
+  // When the armed probe is due, in ngx_current_msec terms.
+  ngx_msec_t expected_msec_;
+
+  double target_ms_;
+  double ceiling_ms_;
+  double lag_ewma_ms_;
+  double shed_fraction_;
+
+  // Tracks shedding state so transitions are logged once, not per
+  // request.
+  bool shedding_;
+};
+
+}  // namespace nginx
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // NGINX_NGX_ESP_LOAD_SHEDDER_H_
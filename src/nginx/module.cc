@@ -31,14 +31,20 @@
 
 #include <core/ngx_string.h>
 #include <memory>
+#include <set>
 
 #include "include/api_manager/utils/version.h"
 #include "module.h"
+#include "src/nginx/check_cache.h"
+#include "src/nginx/circuit_breaker.h"
 #include "src/nginx/config.h"
 #include "src/nginx/environment.h"
 #include "src/nginx/error.h"
+#include "src/nginx/http.h"
+#include "src/nginx/load_shedder.h"
 #include "src/nginx/response.h"
 #include "src/nginx/status.h"
+#include "src/nginx/token_cache.h"
 #include "src/nginx/util.h"
 #include "src/nginx/version.h"
 
@@ -140,28 +146,113 @@ void ngx_esp_override_backend_path(ngx_http_request_t *r,
   }
 }
 
+// Builds a transcoder factory for one deployed config version, applying the
+// location's JSON printing options.
+std::shared_ptr<transcoding::TranscoderFactory> ngx_esp_new_transcoder_factory(
+    ngx_esp_loc_conf_t *lc, const std::string &config_id) {
+  ::google::protobuf::util::JsonPrintOptions json_print_options =
+      ::google::protobuf::util::JsonPrintOptions();
+  if (lc->esp->get_always_print_primitive_fields()) {
+    json_print_options.always_print_primitive_fields = true;
+  }
+  if (lc->esp->get_preserve_proto_field_names()) {
+    json_print_options.preserve_proto_field_names = true;
+  }
+  return std::make_shared<transcoding::TranscoderFactory>(
+      lc->esp->service(config_id), json_print_options);
+}
+
 }  // namespace
 
+// A small cancellation cell shared between the request context and the
+// pending Check continuation. The continuation only dereferences the
+// request through the cell, and the request context destructor nulls the
+// pointers, so a continuation arriving after the request went away is a
+// no-op. All references are taken and dropped on the nginx worker
+// thread, so a plain counter suffices.
 struct wakeup_context_s {
- public:
-  wakeup_context_s(ngx_http_request_t *r, ngx_esp_request_ctx_t *ctx)
-      : request(r), request_context(ctx) {}
-
   ngx_http_request_t *request;
   ngx_esp_request_ctx_t *request_context;
+  // The number of owners: the request context plus the continuation
+  // closures still holding the cell.
+  int refs;
+  // Free list linkage; only used while the cell is not handed out.
+  wakeup_context_t *next;
+};
+
+namespace {
+
+// Worker-local free list of wakeup contexts. A cell must outlive the
+// request whose continuation it guards, so it cannot come from the
+// request pool; recycling the cells caps the allocations at the peak
+// number of in-flight checks instead of one per request.
+wakeup_context_t *free_wakeup_contexts = nullptr;
+
+wakeup_context_t *ngx_esp_get_wakeup_context(ngx_http_request_t *r,
+                                             ngx_esp_request_ctx_t *ctx) {
+  wakeup_context_t *cell = free_wakeup_contexts;
+  if (cell != nullptr) {
+    free_wakeup_contexts = cell->next;
+  } else {
+    cell = new wakeup_context_t;
+  }
+  cell->request = r;
+  cell->request_context = ctx;
+  cell->refs = 1;
+  cell->next = nullptr;
+  return cell;
+}
+
+void ngx_esp_release_wakeup_context(wakeup_context_t *cell) {
+  if (cell != nullptr && --cell->refs == 0) {
+    cell->next = free_wakeup_contexts;
+    free_wakeup_contexts = cell;
+  }
+}
+
+// Copyable reference to a wakeup context for capturing in the Check
+// continuation. The reference is dropped when the closure is destroyed,
+// whether or not the continuation ever ran.
+class WakeupContextRef {
+ public:
+  explicit WakeupContextRef(wakeup_context_t *cell) : cell_(cell) {
+    if (cell_ != nullptr) {
+      ++cell_->refs;
+    }
+  }
+  WakeupContextRef(const WakeupContextRef &other) : cell_(other.cell_) {
+    if (cell_ != nullptr) {
+      ++cell_->refs;
+    }
+  }
+  WakeupContextRef &operator=(const WakeupContextRef &) = delete;
+  ~WakeupContextRef() { ngx_esp_release_wakeup_context(cell_); }
+
+  wakeup_context_t *get() const { return cell_; }
+
+ private:
+  wakeup_context_t *cell_;
 };
 
+}  // namespace
+
 ngx_esp_request_ctx_s::ngx_esp_request_ctx_s(ngx_http_request_t *r,
                                              ngx_esp_loc_conf_t *lc)
     : current_access_handler(nullptr),
+      wakeup_context(nullptr),
       status(NGX_OK, ""),
       auth_token(ngx_null_string),
       grpc_server_call(nullptr),
+      grpc_upstream_cancel(nullptr),
       grpc_pass_through(IsGrpcRequest(r)),
       grpc_backend(false),
-      backend_time(-1) {
+      backend_time(-1),
+      alloc_stats{0, 0, 0},
+      report_scan_prev(nullptr),
+      report_scan_next(nullptr) {
   ngx_memzero(&wakeup_event, sizeof(wakeup_event));
   if (lc && lc->esp) {
+    AllocStatsScope alloc_scope(&alloc_stats);
     ngx_esp_rewrite_uri(r, lc);
 
     request_handler = lc->esp->CreateRequestHandler(
@@ -172,32 +263,103 @@ ngx_esp_request_ctx_s::ngx_esp_request_ctx_s(ngx_http_request_t *r,
     if (it != lc->transcoder_factory_map.end()) {
       transcoder_factory = it->second;
     } else {
-      ::google::protobuf::util::JsonPrintOptions json_print_options =
-          ::google::protobuf::util::JsonPrintOptions();
-      if (lc->esp->get_always_print_primitive_fields()) {
-        json_print_options.always_print_primitive_fields = true;
-      }
-      if (lc->esp->get_preserve_proto_field_names()) {
-        json_print_options.preserve_proto_field_names = true;
-      }
-      transcoder_factory = std::make_shared<transcoding::TranscoderFactory>(
-          lc->esp->service(config_id), json_print_options);
+      // Only reached for config versions deployed after startup (managed
+      // rollouts); the versions known at configuration time got their
+      // factory in ngx_esp_postconfiguration, before the workers forked.
+      transcoder_factory = ngx_esp_new_transcoder_factory(lc, config_id);
       lc->transcoder_factory_map[config_id] = transcoder_factory;
     }
   }
 }
 
 ngx_esp_request_ctx_s::~ngx_esp_request_ctx_s() {
+  ngx_esp_report_scan_remove(this);
   // The client request may be going away before it was woken up
   // by Check continuation. Cancel the wake-up call.
   if (wakeup_context) {
     wakeup_context->request = nullptr;
     wakeup_context->request_context = nullptr;
+    ngx_esp_release_wakeup_context(wakeup_context);
+    wakeup_context = nullptr;
   }
 }
 
 namespace {
 
+// The worker's intermediate-report scan list: an intrusive list of the
+// active streaming contexts, walked by one periodic timer. Per-entry
+// work is a single elapsed-time compare inside
+// AttemptIntermediateReport, so a tick over tens of thousands of idle
+// streams stays cheap, and the nginx timer tree holds one event for the
+// whole worker.
+ngx_esp_request_ctx_t *report_scan_head = nullptr;
+ngx_esp_request_ctx_t *report_scan_tail = nullptr;
+ngx_event_t report_scan_event;
+const ngx_msec_t kReportScanIntervalMs = 1000;
+
+void ngx_esp_report_scan_tick(ngx_event_t *ev) {
+  if (ev->timer_set || !ev->timedout) {
+    return;
+  }
+  ngx_esp_request_ctx_t *ctx = report_scan_head;
+  while (ctx != nullptr) {
+    // The report attempt never tears the request down, but fetch the
+    // link first anyway in case a continuation unlinks the context.
+    ngx_esp_request_ctx_t *next = ctx->report_scan_next;
+    if (ctx->request_handler) {
+      ctx->request_handler->AttemptIntermediateReport();
+    }
+    ctx = next;
+  }
+  if (report_scan_head != nullptr) {
+    ngx_add_timer(&report_scan_event, kReportScanIntervalMs);
+  }
+}
+
+}  // namespace
+
+void ngx_esp_report_scan_add(ngx_esp_request_ctx_t *ctx) {
+  if (ctx->report_scan_prev != nullptr || report_scan_head == ctx) {
+    return;
+  }
+  ctx->report_scan_prev = report_scan_tail;
+  ctx->report_scan_next = nullptr;
+  if (report_scan_tail != nullptr) {
+    report_scan_tail->report_scan_next = ctx;
+  } else {
+    report_scan_head = ctx;
+  }
+  report_scan_tail = ctx;
+  if (!report_scan_event.timer_set) {
+    if (report_scan_event.handler == nullptr) {
+      report_scan_event.handler = ngx_esp_report_scan_tick;
+      report_scan_event.log = ngx_cycle->log;
+      report_scan_event.cancelable = 1;
+    }
+    ngx_add_timer(&report_scan_event, kReportScanIntervalMs);
+  }
+}
+
+void ngx_esp_report_scan_remove(ngx_esp_request_ctx_t *ctx) {
+  if (ctx->report_scan_prev == nullptr && report_scan_head != ctx) {
+    return;
+  }
+  if (ctx->report_scan_prev != nullptr) {
+    ctx->report_scan_prev->report_scan_next = ctx->report_scan_next;
+  } else {
+    report_scan_head = ctx->report_scan_next;
+  }
+  if (ctx->report_scan_next != nullptr) {
+    ctx->report_scan_next->report_scan_prev = ctx->report_scan_prev;
+  } else {
+    report_scan_tail = ctx->report_scan_prev;
+  }
+  ctx->report_scan_prev = nullptr;
+  ctx->report_scan_next = nullptr;
+}
+
+namespace {
+
 // Time in seconds to wait for all active connections to close
 // During process exiting.
 const int kWaitCloseTime = 3;
@@ -242,6 +404,54 @@ Status ngx_http_esp_access_check_done(ngx_http_request_t *r,
 // The ESP log handler.
 ngx_int_t ngx_http_esp_log_handler(ngx_http_request_t *r);
 
+// Parses the endpoints_load_shedding directive. The optional target=MS
+// and ceiling=MS parameters bound the event-loop lag band over which the
+// shed fraction ramps up; see load_shedder.h.
+char *ngx_esp_configure_load_shedding(ngx_conf_t *cf, ngx_command_t *cmd,
+                                      void *conf) {
+  ngx_esp_main_conf_t *mc = reinterpret_cast<ngx_esp_main_conf_t *>(conf);
+  ngx_str_t *argv = reinterpret_cast<ngx_str_t *>(cf->args->elts);
+
+  mc->load_shedding = 1;
+
+  for (ngx_uint_t i = 1; i < cf->args->nelts; ++i) {
+    ngx_int_t value = NGX_ERROR;
+    if (argv[i].len > sizeof("target=") - 1 &&
+        ngx_strncmp(argv[i].data, "target=", sizeof("target=") - 1) == 0) {
+      value = ngx_atoi(argv[i].data + sizeof("target=") - 1,
+                       argv[i].len - (sizeof("target=") - 1));
+      if (value > 0) {
+        mc->load_shed_target_ms = value;
+        continue;
+      }
+    } else if (argv[i].len > sizeof("ceiling=") - 1 &&
+               ngx_strncmp(argv[i].data, "ceiling=",
+                           sizeof("ceiling=") - 1) == 0) {
+      value = ngx_atoi(argv[i].data + sizeof("ceiling=") - 1,
+                       argv[i].len - (sizeof("ceiling=") - 1));
+      if (value > 0) {
+        mc->load_shed_ceiling_ms = value;
+        continue;
+      }
+    }
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid endpoints_load_shedding parameter: \"%V\"; "
+                       "expected target=MS or ceiling=MS",
+                       &argv[i]);
+    return reinterpret_cast<char *>(NGX_CONF_ERROR);
+  }
+
+  if (mc->load_shed_target_ms > 0 && mc->load_shed_ceiling_ms > 0 &&
+      mc->load_shed_ceiling_ms <= mc->load_shed_target_ms) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "endpoints_load_shedding ceiling must be greater "
+                       "than target");
+    return reinterpret_cast<char *>(NGX_CONF_ERROR);
+  }
+
+  return NGX_CONF_OK;
+}
+
 //
 // The module commands contain list of configurable properties for this module.
 //
@@ -264,14 +474,27 @@ ngx_command_t ngx_esp_commands[] = {
         // configured in service config. If "override" is specified as the
         // second parameter, it is used always regardless of the backend
         // configuration in service config.
+        // The "channels=N" parameter sets the number of channels (HTTP/2
+        // connections) opened per backend; streams go to the least-loaded
+        // channel. Defaults to a single channel.
+        // The "write_queue=SIZE" parameter sets the byte budget of the
+        // per-stream queue between upstream reads and downstream writes;
+        // upstream reads pause once this much response data is buffered
+        // for a slow downstream client. Defaults to 64k.
+        // A "$worker" token in the backend address is replaced with the
+        // worker index when the channel is created, giving each worker
+        // affinity to its local backend shard. Template the override and
+        // keep an untemplated fallback so workers without a local shard
+        // still have a target.
         //
         // Usage:
         //   location / {
-        //     grpc_pass [<backend_address> [override]];
+        //     grpc_pass [<backend_address> [override]] [channels=N]
+        //               [write_queue=SIZE];
         //   }
         //
         ngx_string("grpc_pass"),
-        NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS | NGX_CONF_TAKE12,
+        NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS | NGX_CONF_TAKE1234,
         ConfigureGrpcBackendHandler,
         NGX_HTTP_LOC_CONF_OFFSET,
         0,
@@ -285,6 +508,104 @@ ngx_command_t ngx_esp_commands[] = {
         0,
         nullptr,
     },
+    {
+        ngx_string("endpoints_metrics"),
+        NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS,
+        ngx_esp_configure_metrics_handler,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        0,
+        nullptr,
+    },
+    {
+        // Applies tunable server config fields POSTed to the location at
+        // runtime, without a worker restart. The location should be
+        // restricted to admin access, e.g.:
+        //
+        //   location /endpoints_server_config {
+        //     allow 127.0.0.1;
+        //     deny all;
+        //     endpoints_server_config_reload;
+        //   }
+        ngx_string("endpoints_server_config_reload"),
+        NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS,
+        ngx_esp_configure_server_config_reload_handler,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        0,
+        nullptr,
+    },
+    {
+        // Drains the worker's binary access event ring buffer (filled
+        // when the server config enables access_event_config). The
+        // location should be restricted to the ingesting agent, e.g.:
+        //
+        //   location /endpoints_access_events {
+        //     allow 127.0.0.1;
+        //     deny all;
+        //     endpoints_access_events;
+        //   }
+        ngx_string("endpoints_access_events"),
+        NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS,
+        ngx_esp_configure_access_events_handler,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        0,
+        nullptr,
+    },
+    {
+        // Sheds a fraction of Endpoints requests with a 503 before the
+        // check workflow runs when the worker's event loop lags behind
+        // its timers, i.e. when the worker is saturated. Requests with
+        // an x-endpoints-priority header of "critical" or "high" are
+        // never shed. See load_shedder.h for the lag measurement.
+        //
+        // Usage:
+        //   endpoints_load_shedding [target=MS] [ceiling=MS];
+        ngx_string("endpoints_load_shedding"),
+        NGX_HTTP_MAIN_CONF | NGX_CONF_NOARGS | NGX_CONF_TAKE12,
+        ngx_esp_configure_load_shedding,
+        NGX_HTTP_MAIN_CONF_OFFSET,
+        0,
+        nullptr,
+    },
+    {
+        // Serves on-demand worker profiles: GET with type=cpu (default)
+        // or type=heap and seconds=N starts a bounded-duration sampling
+        // profile and answers 202; fetching the endpoint again after the
+        // duration returns a pprof-compatible profile. Heap profiling
+        // requires a --define=alloc_stats=1 build. The location should
+        // be restricted to admin access, e.g.:
+        //
+        //   location /endpoints_profile {
+        //     allow 127.0.0.1;
+        //     deny all;
+        //     endpoints_profile;
+        //   }
+        ngx_string("endpoints_profile"),
+        NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS,
+        ngx_esp_configure_profile_handler,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        0,
+        nullptr,
+    },
+    {
+        // Headers that are not forwarded to the backend. ESP-consumed
+        // headers (api key, authorization) are typically stripped by the
+        // backend anyway; dropping them here in the forwarding pass saves
+        // both the copy and the backend-side processing. The list is
+        // compiled to hashed lower-case names at config parse. Applies to
+        // the gRPC forwarding path, where ESP copies the headers itself;
+        // for HTTP backends use nginx's own proxy_set_header <name> "".
+        //
+        // Usage:
+        //   location / {
+        //     endpoints_strip_backend_headers x-api-key authorization;
+        //   }
+        ngx_string("endpoints_strip_backend_headers"),
+        NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
+        ngx_esp_configure_strip_backend_headers,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        0,
+        nullptr,
+    },
     {
         ngx_string("endpoints_resolver"),
         NGX_HTTP_MAIN_CONF | NGX_CONF_TAKE1,
@@ -334,17 +655,25 @@ ngx_int_t ngx_esp_endpoints_variable(ngx_http_request_t *r,
   ctx = reinterpret_cast<ngx_esp_request_ctx_t *>(
       ngx_http_get_module_ctx(r, ngx_esp_module));
   if (ctx == nullptr) {
+    // Not found yet: keep the result non-cacheable so the handler runs
+    // again once the request context (and with it the value) exists.
     v->not_found = 1;
+    v->no_cacheable = 1;
     return NGX_OK;
   }
   ngx_str_t *value =
       ngx_esp_request_ctx_variable(ctx, static_cast<EspVariableType>(data));
   if (value == nullptr || value->len <= 0) {
     v->not_found = 1;
+    v->no_cacheable = 1;
     return NGX_OK;
   }
+  // The context values are fixed once set ($backend_url is chosen in the
+  // access phase and never changes afterwards), so later evaluations of
+  // the same request - proxy_pass, the access log - are served from the
+  // per-request variable cache instead of re-running this handler.
   v->valid = 1;
-  v->no_cacheable = 1;
+  v->no_cacheable = 0;
   v->not_found = 0;
   v->len = value->len;
   v->data = value->data;
@@ -428,7 +757,11 @@ void *ngx_esp_create_loc_conf(ngx_conf_t *cf) {
   ngx_str_null(&lc->service_controller_url);
   ngx_str_null(&lc->cloud_trace_api_url);
 
+  lc->grpc_channel_pool_size = NGX_CONF_UNSET_UINT;
+  lc->grpc_write_queue_size = NGX_CONF_UNSET_SIZE;
+
   lc->endpoints_api = NGX_CONF_UNSET;
+  lc->esp_active = 0;
   lc->metadata_server = NGX_CONF_UNSET;
   lc->service_control = NGX_CONF_UNSET;
   lc->cloud_tracing = NGX_CONF_UNSET;
@@ -494,6 +827,12 @@ char *ngx_esp_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
   ngx_conf_merge_str_value(conf->grpc_backend_address_fallback,
                            prev->grpc_backend_address_fallback, nullptr);
 
+  ngx_conf_merge_uint_value(conf->grpc_channel_pool_size,
+                            prev->grpc_channel_pool_size, 1);
+
+  ngx_conf_merge_size_value(conf->grpc_write_queue_size,
+                            prev->grpc_write_queue_size, 64 * 1024);
+
   if (conf->metadata_server == NGX_CONF_UNSET) {
     conf->metadata_server = prev->metadata_server;
     conf->metadata_server_url = prev->metadata_server_url;
@@ -513,6 +852,10 @@ char *ngx_esp_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
     conf->api_authentication = prev->api_authentication;
   }
 
+  if (conf->strip_backend_headers.empty()) {
+    conf->strip_backend_headers = prev->strip_backend_headers;
+  }
+
   return reinterpret_cast<char *>(NGX_CONF_OK);
 }
 
@@ -523,6 +866,7 @@ static void handle_endpoints_config_error(ngx_conf_t *cf,
 
   // Disable endpoints
   lc->endpoints_api = 0;
+  lc->esp_active = 0;
   lc->esp.reset();
 }
 
@@ -577,6 +921,14 @@ ngx_int_t ngx_esp_postconfiguration(ngx_conf_t *cf) {
 
   bool endpoints_enabled = false;
 
+  // Locations whose merged server configs are byte-identical share one
+  // ApiManager instead of each duplicating the whole service state.
+  // Per-location overrides are already folded into the serialized config
+  // by ngx_esp_build_server_config, so a matching string implies
+  // matching behavior; truly per-location state (gRPC stubs, backend
+  // overrides) stays in the location conf.
+  std::map<std::string, ngx_esp_loc_conf_t *> loc_conf_by_server_config;
+
   ngx_esp_loc_conf_t **endpoints =
       reinterpret_cast<ngx_esp_loc_conf_t **>(mc->endpoints.elts);
   for (ngx_uint_t i = 0, napis = mc->endpoints.nelts; i < napis; i++) {
@@ -605,8 +957,47 @@ ngx_int_t ngx_esp_postconfiguration(ngx_conf_t *cf) {
         return NGX_ERROR;
       }
 
+      // Reuse the ApiManager of an earlier location with the same merged
+      // server config, along with the transcoder factories built from it.
+      auto shared = loc_conf_by_server_config.find(server_config);
+      if (shared != loc_conf_by_server_config.end()) {
+        lc->esp = shared->second->esp;
+        lc->transcoder_factory_map = shared->second->transcoder_factory_map;
+        lc->esp_active = 1;
+        endpoints_enabled = endpoints_enabled || lc->esp->Enabled();
+        continue;
+      }
+
+      // Add the shared memory zone the workers use to share check results.
+      // Whether a service actually uses it is controlled by the server
+      // config; an unused zone costs nothing but its mapping.
+      if (mc->check_cache_zone == nullptr &&
+          ngx_esp_add_check_cache_shared_memory(cf) != NGX_OK) {
+        handle_endpoints_config_error(cf, lc);
+        return NGX_ERROR;
+      }
+
+      // Add the shared memory zone the workers use to share metadata server
+      // tokens. The zone survives configuration reloads, so the next worker
+      // generation starts with the tokens of the previous one.
+      if (mc->token_cache_zone == nullptr &&
+          ngx_esp_add_token_cache_shared_memory(cf) != NGX_OK) {
+        handle_endpoints_config_error(cf, lc);
+        return NGX_ERROR;
+      }
+
+      // Add the shared memory zone the workers use to share the outbound
+      // circuit breaker state, so a dead endpoint is probed by one worker
+      // instead of being hammered by all of them.
+      if (mc->breaker_zone == nullptr &&
+          ngx_esp_add_breaker_shared_memory(cf) != NGX_OK) {
+        handle_endpoints_config_error(cf, lc);
+        return NGX_ERROR;
+      }
+
       lc->esp = mc->esp_factory.CreateApiManager(
-          std::unique_ptr<ApiManagerEnvInterface>(new NgxEspEnv(log)),
+          std::unique_ptr<ApiManagerEnvInterface>(
+              new NgxEspEnv(log, mc->check_cache_zone, mc->token_cache_zone)),
           server_config);
 
       if (!lc->esp) {
@@ -633,6 +1024,27 @@ ngx_int_t ngx_esp_postconfiguration(ngx_conf_t *cf) {
         return NGX_ERROR;
       }
 
+      // Build the transcoder factories for the config versions deployed at
+      // startup now, while still in the master process: the type universe
+      // a factory walks the Service proto for is read-only once built, so
+      // the workers forked from here share its pages copy-on-write instead
+      // of each building an identical copy on their first request. Config
+      // versions deployed later (managed rollouts) still get a factory
+      // lazily in the request context constructor.
+      ServiceConfigRolloutsInfo rollouts;
+      if (lc->esp->GetServiceConfigRollouts(&rollouts).ok()) {
+        for (const auto &rollout : rollouts.percentages) {
+          lc->transcoder_factory_map[rollout.first] =
+              ngx_esp_new_transcoder_factory(lc, rollout.first);
+        }
+      }
+
+      // The location passed all checks; let the request-phase handlers
+      // see it, and let later locations with the same server config share
+      // its ApiManager.
+      lc->esp_active = 1;
+      loc_conf_by_server_config[server_config] = lc;
+
       endpoints_enabled = endpoints_enabled || lc->esp->Enabled();
     }
   }
@@ -702,6 +1114,109 @@ void wakeup_client_request(ngx_http_request_t *r, ngx_esp_request_ctx_t *ctx) {
   ngx_post_event(&ctx->wakeup_event, &ngx_posted_events);
 }
 
+u_char kOriginHeader[] = "origin";
+u_char kAccessControlRequestMethodHeader[] = "access-control-request-method";
+
+// Adds a response header whose value points at memory owned by the
+// ApiManager (or the request), both of which outlive the response.
+ngx_int_t ngx_esp_add_preflight_header(ngx_http_request_t *r, const char *key,
+                                       size_t key_len, const u_char *value,
+                                       size_t value_len) {
+  ngx_table_elt_t *h =
+      reinterpret_cast<ngx_table_elt_t *>(ngx_list_push(&r->headers_out.headers));
+  if (h == nullptr) {
+    return NGX_ERROR;
+  }
+  h->hash = 1;
+  h->key.len = key_len;
+  h->key.data = reinterpret_cast<u_char *>(const_cast<char *>(key));
+  h->value.len = value_len;
+  h->value.data = const_cast<u_char *>(value);
+  return NGX_OK;
+}
+
+// Answers a CORS preflight request from the precompiled decision table built
+// from the server config, without running the check workflow. Returns
+// NGX_DECLINED when the request is not a preflight, no preset is configured
+// or the origin is not allowed, in which case normal processing continues.
+ngx_int_t ngx_esp_answer_cors_preflight(ngx_http_request_t *r) {
+  ngx_esp_loc_conf_t *lc = reinterpret_cast<ngx_esp_loc_conf_t *>(
+      ngx_http_get_module_loc_conf(r, ngx_esp_module));
+  if (!lc->esp_active) {
+    return NGX_DECLINED;
+  }
+  const CorsPreflightResponse *cors = lc->esp->cors_preflight_response();
+  if (cors == nullptr) {
+    return NGX_DECLINED;
+  }
+
+  // A preflight carries both an Origin and an Access-Control-Request-Method
+  // header; anything else keeps the normal OPTIONS behavior.
+  ngx_table_elt_t *origin =
+      ngx_esp_find_headers_in(r, kOriginHeader, sizeof(kOriginHeader) - 1);
+  if (origin == nullptr || origin->value.len == 0 ||
+      ngx_esp_find_headers_in(r, kAccessControlRequestMethodHeader,
+                              sizeof(kAccessControlRequestMethodHeader) - 1) ==
+          nullptr) {
+    return NGX_DECLINED;
+  }
+
+  bool allowed = false;
+  for (const auto &allowed_origin : cors->allowed_origins) {
+    if (allowed_origin == "*" ||
+        (allowed_origin.size() == origin->value.len &&
+         ngx_strncmp(allowed_origin.data(), origin->value.data,
+                     origin->value.len) == 0)) {
+      allowed = true;
+      break;
+    }
+  }
+  if (!allowed) {
+    return NGX_DECLINED;
+  }
+
+  ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                 "esp: answering CORS preflight from preset, r=%p", r);
+
+  // Echo the request origin; the remaining header values point directly at
+  // the precompiled strings owned by the ApiManager.
+  if (ngx_esp_add_preflight_header(
+          r, "Access-Control-Allow-Origin",
+          sizeof("Access-Control-Allow-Origin") - 1, origin->value.data,
+          origin->value.len) != NGX_OK) {
+    return NGX_DECLINED;
+  }
+  if (!cors->allowed_methods.empty() &&
+      ngx_esp_add_preflight_header(
+          r, "Access-Control-Allow-Methods",
+          sizeof("Access-Control-Allow-Methods") - 1,
+          reinterpret_cast<const u_char *>(cors->allowed_methods.data()),
+          cors->allowed_methods.size()) != NGX_OK) {
+    return NGX_DECLINED;
+  }
+  if (!cors->allowed_headers.empty() &&
+      ngx_esp_add_preflight_header(
+          r, "Access-Control-Allow-Headers",
+          sizeof("Access-Control-Allow-Headers") - 1,
+          reinterpret_cast<const u_char *>(cors->allowed_headers.data()),
+          cors->allowed_headers.size()) != NGX_OK) {
+    return NGX_DECLINED;
+  }
+  if (!cors->max_age.empty() &&
+      ngx_esp_add_preflight_header(
+          r, "Access-Control-Max-Age", sizeof("Access-Control-Max-Age") - 1,
+          reinterpret_cast<const u_char *>(cors->max_age.data()),
+          cors->max_age.size()) != NGX_OK) {
+    return NGX_DECLINED;
+  }
+
+  r->headers_out.status = NGX_HTTP_NO_CONTENT;
+  r->headers_out.content_length_n = 0;
+
+  ngx_http_finalize_request(r, ngx_http_send_header(r));
+  return NGX_DONE;
+}
+
 Status ngx_http_esp_access_handler(ngx_http_request_t *r) {
   ngx_esp_loc_conf_t *lc = reinterpret_cast<ngx_esp_loc_conf_t *>(
       ngx_http_get_module_loc_conf(r, ngx_esp_module));
@@ -710,7 +1225,7 @@ Status ngx_http_esp_access_handler(ngx_http_request_t *r) {
                  "esp: access handler r=%p, endpoints=%d, esp=%p", r,
                  lc->endpoints_api, lc->esp.get());
 
-  if (!lc->endpoints_api || !lc->esp) {
+  if (!lc->esp_active) {
     return Status(NGX_DECLINED, "Endpoints not configured.");
   }
 
@@ -739,14 +1254,22 @@ Status ngx_http_esp_access_handler(ngx_http_request_t *r) {
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "esp: initiating check, r=%p", r);
 
-    std::shared_ptr<wakeup_context_t> wakeup_context(
-        new wakeup_context_t(r, ctx));
+    // Attributes the synchronous part of the Check call (including the
+    // continuation when it runs inline) to this request.
+    AllocStatsScope alloc_scope(&ctx->alloc_stats);
+
     ctx->status = Status(NGX_AGAIN, "Calling check");
-    ctx->wakeup_context = wakeup_context;
+    ctx->wakeup_context = ngx_esp_get_wakeup_context(r, ctx);
+    WakeupContextRef wakeup_context(ctx->wakeup_context);
+
+    // Start establishing the backend connection before the check is
+    // issued, so for gRPC locations the connection setup runs in
+    // parallel with the check workflow instead of after it.
+    GrpcSpeculativeConnect(r);
 
     ctx->request_handler->Check([wakeup_context](Status status) {
-      ngx_http_request_t *r = wakeup_context->request;
-      ngx_esp_request_ctx_t *ctx = wakeup_context->request_context;
+      ngx_http_request_t *r = wakeup_context.get()->request;
+      ngx_esp_request_ctx_t *ctx = wakeup_context.get()->request_context;
 
       // The client request is still around, i.e. it did not timeout.
       if (r != nullptr && ctx != nullptr) {
@@ -788,8 +1311,36 @@ Status ngx_http_esp_access_check_done(ngx_http_request_t *r,
 }
 
 ngx_int_t ngx_http_esp_access_wrapper(ngx_http_request_t *r) {
+  ngx_esp_loc_conf_t *lc = reinterpret_cast<ngx_esp_loc_conf_t *>(
+      ngx_http_get_module_loc_conf(r, ngx_esp_module));
+  if (!lc->esp_active) {
+    // Not an Endpoints location; stay off its request path entirely.
+    return NGX_DECLINED;
+  }
+
   ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                  "esp: access wrapper r=%p", r);
+
+  // Answer CORS preflights directly when a preset is configured, before any
+  // per-request context or check workflow is set up.
+  if (r->method == NGX_HTTP_OPTIONS) {
+    ngx_int_t rc = ngx_esp_answer_cors_preflight(r);
+    if (rc != NGX_DECLINED) {
+      return rc;
+    }
+  }
+
+  // Shed load before the per-request context and the check workflow are
+  // set up, while the request is still cheap to reject. Returning the
+  // code from the access phase serves nginx's precomputed 503 page;
+  // gRPC clients map HTTP 503 to UNAVAILABLE.
+  NgxEspLoadShedder *shedder = NgxEspLoadShedder::TryInstance();
+  if (shedder != nullptr && shedder->ShouldShed(r)) {
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "esp: shedding request r=%p under event loop lag", r);
+    return NGX_HTTP_SERVICE_UNAVAILABLE;
+  }
+
   Status status = ngx_http_esp_access_handler(r);
   if (!status.ok()) {
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -830,7 +1381,7 @@ ngx_int_t ngx_http_esp_log_handler(ngx_http_request_t *r) {
 
   ngx_esp_loc_conf_t *lc = reinterpret_cast<ngx_esp_loc_conf_t *>(
       ngx_http_get_module_loc_conf(r, ngx_esp_module));
-  if (lc == nullptr || !lc->endpoints_api || lc->esp == nullptr) {
+  if (lc == nullptr || !lc->esp_active) {
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "esp: skip r=%p (not endpoints)", r);
     // Not an Endpoints API.
@@ -844,8 +1395,17 @@ ngx_int_t ngx_http_esp_log_handler(ngx_http_request_t *r) {
   }
 
   if (ctx->request_handler) {
-    ctx->request_handler->Report(
-        std::unique_ptr<Response>(new NgxEspResponse(r)), []() {});
+    {
+      AllocStatsScope alloc_scope(&ctx->alloc_stats);
+      ctx->request_handler->Report(
+          std::unique_ptr<Response>(new NgxEspResponse(r)), []() {});
+    }
+    ngx_esp_record_method_alloc_stats(
+        r,
+        ctx->request_handler->method()
+            ? ctx->request_handler->method()->selector().c_str()
+            : "<Unknown Operation Name>",
+        ctx->alloc_stats);
   }
   return NGX_OK;
 }
@@ -997,6 +1557,7 @@ ngx_int_t ngx_esp_create_http_configuration(ngx_conf_t *cf,
   auto lc = reinterpret_cast<ngx_esp_loc_conf_t *>(
       location_configs[ngx_esp_module.ctx_index]);
   lc->endpoints_api = 0;
+  lc->esp_active = 0;
   lc->endpoints_config = ngx_null_string;
   lc->esp.reset();
 
@@ -1137,12 +1698,15 @@ bool ngx_esp_attempt_shutdown(ngx_cycle_t *cycle) {
     return true;
   }
 
-  // Closes ESP service control to flush out its cached items.
+  // Closes ESP service control to flush out its cached items. Locations
+  // may share one ApiManager; close each instance once.
+  std::set<ApiManager *> closed;
   ngx_esp_loc_conf_t **endpoints =
       reinterpret_cast<ngx_esp_loc_conf_t **>(mc->endpoints.elts);
   for (ngx_uint_t i = 0, napis = mc->endpoints.nelts; i < napis; i++) {
     ngx_esp_loc_conf_t *lc = endpoints[i];
-    if (lc->endpoints_api == 1 && lc->esp) {
+    if (lc->endpoints_api == 1 && lc->esp &&
+        closed.insert(lc->esp.get()).second) {
       lc->esp->Close();
     }
   }
@@ -1202,19 +1766,28 @@ ngx_int_t ngx_esp_init_process(ngx_cycle_t *cycle) {
     return NGX_OK;
   }
   bool has_esp = false;
+  // Locations may share one ApiManager; initialize each instance once.
+  std::set<ApiManager *> initialized;
   ngx_esp_loc_conf_t **endpoints =
       reinterpret_cast<ngx_esp_loc_conf_t **>(mc->endpoints.elts);
   for (ngx_uint_t i = 0, napis = mc->endpoints.nelts; i < napis; i++) {
     ngx_esp_loc_conf_t *lc = endpoints[i];
 
     if (lc->endpoints_api == 1 && lc->esp) {
-      lc->esp->Init();
+      if (initialized.insert(lc->esp.get()).second) {
+        lc->esp->Init();
+      }
       has_esp = true;
     }
     if (lc->grpc_pass && !mc->grpc_queue) {
       mc->grpc_queue = NgxEspGrpcQueue::Instance();
       mc->grpc_queue->Init(cycle);
     }
+    if (lc->grpc_pass && mc->grpc_queue) {
+      // Establish the backend channels of prewarm locations now, so the
+      // first request does not pay the connection handshake.
+      GrpcPrewarmBackendChannels(cycle, lc);
+    }
   }
 
   if (mc->stats_zone != nullptr) {
@@ -1224,6 +1797,11 @@ ngx_int_t ngx_esp_init_process(ngx_cycle_t *cycle) {
     }
   }
 
+  if (has_esp && mc->load_shedding) {
+    NgxEspLoadShedder::Init(cycle->log, mc->load_shed_target_ms,
+                            mc->load_shed_ceiling_ms);
+  }
+
   // Only if Endpoints is enabled.
   if (has_esp) {
     // Registers an event with a very long timeout in order to detect when NGINX
@@ -1242,6 +1820,9 @@ ngx_int_t ngx_esp_init_process(ngx_cycle_t *cycle) {
 void ngx_esp_exit_process(ngx_cycle_t *cycle) {
   ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cycle->log, 0, "ngx_esp_exit_process");
 
+  // Release the outbound connections parked for reuse.
+  ngx_esp_drain_http_connection_pool();
+
   ngx_esp_main_conf_t *mc = reinterpret_cast<ngx_esp_main_conf_t *>(
       ngx_http_cycle_get_module_main_conf(cycle, ngx_esp_module));
   if (!mc) {
@@ -1253,6 +1834,14 @@ void ngx_esp_exit_process(ngx_cycle_t *cycle) {
   for (ngx_uint_t i = 0, napis = mc->endpoints.nelts; i < napis; i++) {
     ngx_esp_loc_conf_t *lc = endpoints[i];
 
+    // Drop our reference on the TLS session cache; channels holding
+    // references of their own are released by the destructor below.
+    if (lc->grpc_backend_ssl != nullptr &&
+        lc->grpc_backend_ssl->session_cache != nullptr) {
+      grpc_ssl_session_cache_destroy(lc->grpc_backend_ssl->session_cache);
+      lc->grpc_backend_ssl->session_cache = nullptr;
+    }
+
     lc->~ngx_esp_loc_conf_t();
   }
 }
@@ -1267,8 +1856,7 @@ ngx_esp_request_ctx_t *ngx_http_esp_ensure_module_ctx(ngx_http_request_t *r) {
       ngx_http_get_module_loc_conf(r, ngx_esp_module));
 
   if (ctx == nullptr) {
-    ctx = RegisterPoolCleanup(r->pool,
-                              new (r->pool) ngx_esp_request_ctx_t(r, lc));
+    ctx = NewPoolObject<ngx_esp_request_ctx_t>(r->pool, r, lc);
     if (ctx != nullptr) {
       ngx_http_set_ctx(r, ctx, ngx_esp_module);
     }
@@ -30,6 +30,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 extern "C" {
 #include "src/http/ngx_http.h"
@@ -37,11 +38,13 @@ extern "C" {
 
 #include <grpc++/generic/generic_stub.h>
 #include <grpc++/grpc++.h>
+#include <grpc/grpc_security.h>
 
 #include "include/api_manager/api_manager.h"
 #include "include/api_manager/utils/status.h"
 #include "src/grpc/transcoding/transcoder_factory.h"
 #include "src/nginx/alloc.h"
+#include "src/nginx/alloc_stats.h"
 #include "src/nginx/grpc.h"
 #include "src/nginx/grpc_queue.h"
 #include "src/nginx/grpc_server_call.h"
@@ -76,6 +79,15 @@ typedef struct {
   // Shared memory zone for stats per process
   ngx_shm_zone_t *stats_zone;
 
+  // Shared memory zone for the cross-worker check cache
+  ngx_shm_zone_t *check_cache_zone;
+
+  // Shared memory zone for the cross-worker token cache
+  ngx_shm_zone_t *token_cache_zone;
+
+  // Shared memory zone for the cross-worker upstream circuit breaker
+  ngx_shm_zone_t *breaker_zone;
+
   // Timer to update process stats
   std::unique_ptr<PeriodicTimer> stats_timer;
 
@@ -97,6 +109,14 @@ typedef struct {
   // Address of the http.cc upstream DNS resolver
   ngx_str_t upstream_resolver;
 
+  // Load shedding under event-loop lag (see load_shedder.h), configured
+  // with the endpoints_load_shedding directive. The thresholds are the
+  // smoothed lag at which shedding starts and at which the shed fraction
+  // reaches its maximum; zero means the built-in default.
+  ngx_flag_t load_shedding;
+  ngx_uint_t load_shed_target_ms;
+  ngx_uint_t load_shed_ceiling_ms;
+
   // HTTP module configuration context pointers used for the HTTP implementation
   // based on NGINX upstream module. Only used in the HTTP subrequest path.
   ngx_http_conf_ctx_t http_module_conf_ctx;
@@ -108,15 +128,59 @@ typedef struct {
 
 } ngx_esp_main_conf_t;
 
-typedef std::map<std::string, std::shared_ptr<::grpc::GenericStub>>
+// One pooled connection to a GRPC backend: the stub calls are issued on
+// and its channel, kept so connection establishment can be nudged ahead
+// of use (see GrpcSpeculativeConnect).
+struct ngx_esp_grpc_backend_channel_t {
+  std::shared_ptr<::grpc::Channel> channel;
+  std::shared_ptr<::grpc::GenericStub> stub;
+};
+
+// The channel pools to the GRPC backends, keyed by backend address. Each
+// entry in a pool owns its own channel, so concurrent streams can be
+// spread over several HTTP/2 connections instead of sharing a single
+// connection's flow-control window.
+typedef std::map<std::string, std::vector<ngx_esp_grpc_backend_channel_t>>
     ngx_esp_grpc_stub_map_t;
 
+// One compiled strip-list entry: the lower-cased header name and its
+// nginx header hash, resolved once at config parse so request-time
+// matching is a hash compare followed by a single memcmp.
+struct ngx_esp_header_match_t {
+  ngx_uint_t hash;
+  ngx_str_t lowcase_name;
+};
+
+// Returns true if a header (nginx header hash plus lower-cased key)
+// matches an entry of a compiled strip list.
+inline bool ngx_esp_header_stripped(
+    const std::vector<ngx_esp_header_match_t> &strip, ngx_uint_t hash,
+    const u_char *lowcase_key, size_t len) {
+  for (const auto &m : strip) {
+    if (hash == m.hash && len == m.lowcase_name.len &&
+        ngx_memcmp(lowcase_key, m.lowcase_name.data, len) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
 // similar to GrpcSslCredentials but using ngx_str_t
 struct ngx_esp_ssl_credentials {
   bool use_google_default;
   ngx_str_t root_certs;
   ngx_str_t private_key;
   ngx_str_t cert_chain;
+
+  // The capacity of the TLS session cache; 0 disables resumption and
+  // every backend reconnect pays the full handshake.
+  ngx_uint_t session_cache_size;
+
+  // LRU cache of TLS sessions, created with the first backend channel and
+  // shared by all channels of the location, so a reconnect after an idle
+  // close resumes the previous session instead of redoing the key
+  // exchange. Released in ngx_esp_exit_process.
+  grpc_ssl_session_cache *session_cache;
 };
 
 //
@@ -129,7 +193,9 @@ typedef struct {
   ngx_str_t endpoints_config;  // API Configuration file name.
   ngx_flag_t endpoints_api;    // Does this location host an Endpoints API?
 
-  // Extensible Service Proxy library interface.
+  // Extensible Service Proxy library interface. Shared with every other
+  // location whose merged server config is identical, so a server with
+  // many locations for one service holds the service state once.
   std::shared_ptr<ApiManager> esp;
 
   // Transcoder factory map.
@@ -139,6 +205,19 @@ typedef struct {
   unsigned endpoints_block : 1;  // location has `endpoints` block
   unsigned grpc_pass : 1;        // location has `grpc_pass` directive
 
+  // Pre-establish the gRPC backend channels at worker start and keep them
+  // warm with HTTP/2 keepalive pings, so the first request does not pay
+  // the connection handshake. Configured with the prewarm parameter of
+  // grpc_pass; only effective with a static backend address.
+  unsigned grpc_prewarm : 1;
+
+  // Precompiled at postconfiguration: set only when this location hosts an
+  // Endpoints API and its ApiManager was created successfully. The global
+  // request-phase handlers test this single bit before doing any work, so
+  // locations without endpoints (e.g. static assets sharing the server
+  // block) skip ESP processing entirely.
+  unsigned esp_active : 1;
+
   // Whether Google Compute Engine metadata server should be used or not.
   ngx_flag_t metadata_server;
 
@@ -172,6 +251,8 @@ typedef struct {
   // The GRPC backend address override.  If this is a non-zero-length
   // string, this is where all GRPC API traffic will be sent,
   // regardless of the contents of the service config.
+  // A "$worker" token in the address is replaced with the worker index
+  // at stub creation; see GrpcExpandBackendAddress in grpc.cc.
   ngx_str_t grpc_backend_address_override;
 
   // The GRPC backend address fallback.  If this is a non-zero-length
@@ -181,8 +262,25 @@ typedef struct {
   // configuration.
   ngx_str_t grpc_backend_address_fallback;
 
+  // The number of GRPC channels (HTTP/2 connections) opened per backend.
+  // Streams are assigned to the least-loaded channel of the pool.
+  // Configured with the channels=N parameter of grpc_pass; defaults to 1.
+  ngx_uint_t grpc_channel_pool_size;
+
+  // The byte budget of the per-stream queue buffered between upstream
+  // reads and downstream writes; upstream reads pause once this much
+  // response data is queued for a slow downstream client. Configured with
+  // the write_queue=SIZE parameter of grpc_pass; defaults to 64k.
+  size_t grpc_write_queue_size;
+
   // Grpc backend ssl credentials  from server_config.
   ngx_esp_ssl_credentials *grpc_backend_ssl;
+
+  // Headers not forwarded to the backend, compiled from the
+  // endpoints_strip_backend_headers directive. Consulted in the header
+  // forwarding pass, so stripped headers are never copied. Empty when
+  // the directive is absent.
+  std::vector<ngx_esp_header_match_t> strip_backend_headers;
 } ngx_esp_loc_conf_t;
 
 // **************************************************
@@ -216,15 +314,18 @@ struct ngx_esp_request_ctx_s {
   // is not automatic and we do it explicitly.
   ngx_event_t wakeup_event;
 
-  // The wakeup context pointer is shared between the request context (here)
+  // The wakeup context is shared between the request context (here)
   // and the continuation which is going to wake this request up after
   // Check call completes. If, however, the parent request goes out of scope
   // before Check call calls the continuation, it would end up waking up
   // deallocated request.
-  // Therefore, ir the destructor of ngx_esp_request_ctx_s we mark the
+  // Therefore, in the destructor of ngx_esp_request_ctx_s we mark the
   // wakeup context as "wake up cancelled" and the continuation will
   // not attempt the wakeup.
-  std::shared_ptr<wakeup_context_t> wakeup_context;
+  // The context is reference counted intrusively and recycled through a
+  // worker-local free list, so steady-state check traffic does not
+  // allocate for the bridge back onto the request's event cycle.
+  wakeup_context_t *wakeup_context;
 
   // Status of the request check/application backend upstream connection
   ::google::api_manager::utils::Status status;
@@ -234,8 +335,10 @@ struct ngx_esp_request_ctx_s {
 
   // GRPC Proxying support.
   NgxEspGrpcServerCall *grpc_server_call;
-  // For canceling grpc upstream.
-  std::unique_ptr<std::function<void()>> grpc_upstream_cancel;
+  // For canceling grpc upstream. Allocated from the request pool; the
+  // pool cleanup runs its destructor, so clearing this pointer does not
+  // leak.
+  std::function<void()> *grpc_upstream_cancel;
 
   // Mark if this request is grpc pass through.
   bool grpc_pass_through;
@@ -265,6 +368,16 @@ struct ngx_esp_request_ctx_s {
 
   // Stores base64 decoded response header "grpc-status-details-bin".
   std::string grpc_status_details;
+
+  // Allocation counters attributed to this request; only updated in
+  // allocation-stats builds. See alloc_stats.h.
+  ngx_esp_alloc_counters_t alloc_stats;
+
+  // Links in the worker's intermediate-report scan list. Non-null only
+  // while the context is registered as an active streaming call; see
+  // ngx_esp_report_scan_add.
+  ngx_esp_request_ctx_s *report_scan_prev;
+  ngx_esp_request_ctx_s *report_scan_next;
 };
 
 static_assert(std::is_standard_layout<ngx_esp_request_ctx_t>::value,
@@ -276,6 +389,18 @@ ngx_esp_request_ctx_t *ngx_http_esp_ensure_module_ctx(ngx_http_request_t *r);
 // Get the ESP per-request context.
 ngx_esp_request_ctx_t *ngx_http_esp_get_module_ctx(ngx_http_request_t *r);
 
+// Registers a streaming call's context on the worker's intermediate-
+// report scan list. One per-worker timer walks the list once a second
+// and lets each due stream attempt its intermediate report, instead of
+// every stream checking the report interval on every message (or each
+// arming its own timer, which would bloat the timer tree at tens of
+// thousands of concurrent streams). Idempotent; contexts are unlinked
+// automatically on destruction.
+void ngx_esp_report_scan_add(ngx_esp_request_ctx_t *ctx);
+
+// Removes a context from the scan list; no-op if it is not linked.
+void ngx_esp_report_scan_remove(ngx_esp_request_ctx_t *ctx);
+
 }  // namespace nginx
 }  // namespace api_manager
 }  // namespace google
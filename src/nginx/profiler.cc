@@ -0,0 +1,487 @@
+// Copyright (C) Extensible Service Proxy Authors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "src/nginx/profiler.h"
+
+#include <execinfo.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <mutex>
+#include <string>
+
+namespace google {
+namespace api_manager {
+namespace nginx {
+
+std::atomic<bool> ngx_esp_heap_profiling_active(false);
+
+namespace {
+
+ngx_str_t application_octet_stream = ngx_string("application/octet-stream");
+ngx_str_t text_plain = ngx_string("text/plain");
+
+// CPU sampling rate and bounds. 100Hz matches the gperftools default;
+// at 60 seconds the sample buffer tops out at a few megabytes.
+const int kCpuSampleHz = 100;
+const int kMaxFrames = 64;
+const int kDefaultProfileSeconds = 10;
+const int kMaxProfileSeconds = 60;
+
+// Heap sampling: one allocation in kHeapSampleInterval is recorded;
+// emitted counts and bytes are scaled back up. The table aggregates by
+// call stack, capped at kMaxHeapStacks distinct stacks.
+const unsigned kHeapSampleInterval = 64;
+const int kHeapFrames = 32;
+const size_t kMaxHeapStacks = 1024;
+
+enum ProfileState {
+  PROFILE_IDLE = 0,
+  PROFILE_CPU_RUNNING,
+  PROFILE_HEAP_RUNNING,
+  PROFILE_READY,
+};
+
+// All profiler state is worker-local; the endpoint profiles the worker
+// that happens to serve the request. State transitions run on the event
+// loop; only the SIGPROF handler and the allocation hook run outside it.
+ProfileState profile_state = PROFILE_IDLE;
+std::string ready_profile;
+ngx_event_t profile_stop_event;
+
+// CPU samples as a flat word buffer of [nframes, pc...] records,
+// written by the SIGPROF handler. Preallocated at start so the handler
+// never allocates. SIGPROF is process-directed and the helper threads
+// (CQ dispatch, report flush, JWT verify pool, gRPC internals) do not
+// block it, so two handler instances can run concurrently: each one
+// reserves its whole record with a single fetch_add on the cursor and
+// backs the reservation out when it falls past the capacity. The stop
+// path pulls the capacity to zero before freeing the buffer, so a
+// handler instance still in flight fails that check and bails instead
+// of indexing into freed storage.
+uintptr_t *cpu_buffer = nullptr;
+std::atomic<size_t> cpu_buffer_capacity(0);
+std::atomic<size_t> cpu_buffer_pos(0);
+
+// One aggregated heap profile stack.
+struct HeapStack {
+  uintptr_t hash;
+  int nframes;
+  uintptr_t pcs[kHeapFrames];
+  uint64_t count;
+  uint64_t bytes;
+};
+
+HeapStack *heap_table = nullptr;
+size_t heap_table_used = 0;
+uint64_t heap_dropped_stacks = 0;
+std::mutex heap_table_mutex;
+thread_local bool in_heap_sampler = false;
+thread_local unsigned heap_alloc_tick = 0;
+
+// SIGPROF handler: one backtrace into the preallocated buffer. The
+// unwinder is warmed up with a backtrace call before the timer is
+// armed, so no allocation happens in signal context.
+void CpuSampleHandler(int, siginfo_t *, void *) {
+  void *frames[kMaxFrames];
+  int n = ::backtrace(frames, kMaxFrames);
+  if (n <= 0) {
+    return;
+  }
+  const size_t needed = static_cast<size_t>(n) + 1;
+  const size_t pos =
+      cpu_buffer_pos.fetch_add(needed, std::memory_order_relaxed);
+  if (pos + needed > cpu_buffer_capacity.load(std::memory_order_acquire)) {
+    // Buffer full - or the stop path zeroed the capacity and the buffer
+    // is gone. Back out the reservation and drop the sample.
+    cpu_buffer_pos.fetch_sub(needed, std::memory_order_relaxed);
+    return;
+  }
+  cpu_buffer[pos] = static_cast<uintptr_t>(n);
+  for (int i = 0; i < n; ++i) {
+    cpu_buffer[pos + 1 + i] = reinterpret_cast<uintptr_t>(frames[i]);
+  }
+}
+
+void AppendWord(std::string *out, uintptr_t word) {
+  out->append(reinterpret_cast<const char *>(&word), sizeof(word));
+}
+
+// Appends /proc/self/maps, which pprof needs to symbolize the PCs.
+void AppendSelfMaps(std::string *out) {
+  FILE *f = fopen("/proc/self/maps", "r");
+  if (f == nullptr) {
+    return;
+  }
+  char chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    out->append(chunk, n);
+  }
+  fclose(f);
+}
+
+// Serializes the sample buffer into the legacy gperftools CPU profile
+// format: a word header, [count, nframes, pc...] sample records, a
+// trailer, and the address space map.
+std::string SerializeCpuProfile() {
+  std::string out;
+  AppendWord(&out, 0);  // header count
+  AppendWord(&out, 3);  // header words
+  AppendWord(&out, 0);  // format version
+  AppendWord(&out, 1000000 / kCpuSampleHz);  // sampling period, usec
+  AppendWord(&out, 0);  // padding
+  // The cursor can sit past the capacity while an overflowing handler
+  // reservation is being backed out; only the words inside the buffer
+  // are valid.
+  size_t end = cpu_buffer_pos.load(std::memory_order_relaxed);
+  const size_t capacity = cpu_buffer_capacity.load(std::memory_order_relaxed);
+  if (end > capacity) {
+    end = capacity;
+  }
+  size_t i = 0;
+  while (i < end) {
+    const uintptr_t nframes = cpu_buffer[i];
+    if (nframes == 0 || nframes > static_cast<uintptr_t>(kMaxFrames) ||
+        nframes > end - i - 1) {
+      // A record a handler reserved but had not finished writing when
+      // collection stopped; nothing after it is trustworthy either, so
+      // drop the tail.
+      break;
+    }
+    AppendWord(&out, 1);  // sample count
+    AppendWord(&out, nframes);
+    for (uintptr_t f = 0; f < nframes; ++f) {
+      AppendWord(&out, cpu_buffer[i + 1 + f]);
+    }
+    i += 1 + nframes;
+  }
+  AppendWord(&out, 0);  // trailer
+  AppendWord(&out, 1);
+  AppendWord(&out, 0);
+  AppendSelfMaps(&out);
+  return out;
+}
+
+// Serializes the aggregated heap table into the legacy text heap
+// profile format. Sampled counts and bytes are scaled back up by the
+// sampling interval.
+std::string SerializeHeapProfile() {
+  uint64_t total_count = 0;
+  uint64_t total_bytes = 0;
+  for (size_t i = 0; i < heap_table_used; ++i) {
+    total_count += heap_table[i].count * kHeapSampleInterval;
+    total_bytes += heap_table[i].bytes * kHeapSampleInterval;
+  }
+  char line[256];
+  std::string out;
+  snprintf(line, sizeof(line),
+           "heap profile: %6llu: %8llu [%6llu: %8llu] @ heapprofile\n",
+           static_cast<unsigned long long>(total_count),
+           static_cast<unsigned long long>(total_bytes),
+           static_cast<unsigned long long>(total_count),
+           static_cast<unsigned long long>(total_bytes));
+  out += line;
+  for (size_t i = 0; i < heap_table_used; ++i) {
+    const HeapStack &stack = heap_table[i];
+    const unsigned long long count = stack.count * kHeapSampleInterval;
+    const unsigned long long bytes = stack.bytes * kHeapSampleInterval;
+    snprintf(line, sizeof(line), "%6llu: %8llu [%6llu: %8llu] @", count,
+             bytes, count, bytes);
+    out += line;
+    for (int f = 0; f < stack.nframes; ++f) {
+      snprintf(line, sizeof(line), " 0x%08llx",
+               static_cast<unsigned long long>(stack.pcs[f]));
+      out += line;
+    }
+    out += '\n';
+  }
+  out += "\nMAPPED_LIBRARIES:\n";
+  AppendSelfMaps(&out);
+  return out;
+}
+
+// Timer handler: stops collection and serializes the profile.
+void ProfileStopHandler(ngx_event_t *ev) {
+  if (profile_state == PROFILE_CPU_RUNNING) {
+    struct itimerval off;
+    memset(&off, 0, sizeof(off));
+    setitimer(ITIMER_PROF, &off, nullptr);
+    signal(SIGPROF, SIG_IGN);
+    ready_profile = SerializeCpuProfile();
+    // Zero the capacity before freeing: disarming the timer does not
+    // wait for a handler instance already running on another thread,
+    // and the zero capacity makes it fail its reservation check rather
+    // than index into the freed buffer.
+    cpu_buffer_capacity.store(0, std::memory_order_release);
+    delete[] cpu_buffer;
+    cpu_buffer = nullptr;
+  } else if (profile_state == PROFILE_HEAP_RUNNING) {
+    ngx_esp_heap_profiling_active.store(false, std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(heap_table_mutex);
+      ready_profile = SerializeHeapProfile();
+      delete[] heap_table;
+      heap_table = nullptr;
+      heap_table_used = 0;
+    }
+    if (heap_dropped_stacks > 0) {
+      // The request that started collection is long gone by now, so log
+      // through the cycle log like the stop event itself.
+      ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                    "heap profile dropped %uL distinct stacks",
+                    heap_dropped_stacks);
+    }
+  }
+  profile_state = PROFILE_READY;
+}
+
+void ArmStopTimer(int seconds) {
+  memset(&profile_stop_event, 0, sizeof(profile_stop_event));
+  profile_stop_event.handler = ProfileStopHandler;
+  profile_stop_event.log = ngx_cycle->log;
+  ngx_add_timer(&profile_stop_event, seconds * 1000);
+}
+
+void StartCpuProfile(int seconds) {
+  const size_t capacity =
+      static_cast<size_t>(kCpuSampleHz) * seconds * (kMaxFrames + 1);
+  cpu_buffer = new uintptr_t[capacity]();
+  cpu_buffer_pos.store(0, std::memory_order_relaxed);
+  cpu_buffer_capacity.store(capacity, std::memory_order_release);
+
+  // The first backtrace call initializes the unwinder, which may
+  // allocate; force that outside the signal handler.
+  void *warmup[kMaxFrames];
+  ::backtrace(warmup, kMaxFrames);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = CpuSampleHandler;
+  sa.sa_flags = SA_RESTART | SA_SIGINFO;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, nullptr);
+
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = 1000000 / kCpuSampleHz;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, nullptr);
+
+  profile_state = PROFILE_CPU_RUNNING;
+  ArmStopTimer(seconds);
+}
+
+void StartHeapProfile(int seconds) {
+  {
+    std::lock_guard<std::mutex> lock(heap_table_mutex);
+    heap_table = new HeapStack[kMaxHeapStacks]();
+    heap_table_used = 0;
+    heap_dropped_stacks = 0;
+  }
+  void *warmup[kHeapFrames];
+  ::backtrace(warmup, kHeapFrames);
+  profile_state = PROFILE_HEAP_RUNNING;
+  ngx_esp_heap_profiling_active.store(true, std::memory_order_relaxed);
+  ArmStopTimer(seconds);
+}
+
+// Sends a fixed text response; used for everything but a ready profile.
+ngx_int_t SendPlainText(ngx_http_request_t *r, ngx_uint_t status,
+                        const char *msg) {
+  size_t len = strlen(msg);
+  ngx_buf_t *buf = ngx_create_temp_buf(r->pool, len);
+  if (buf == nullptr) {
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+  buf->last = ngx_cpymem(buf->last, msg, len);
+  buf->temporary = 1;
+  buf->last_buf = (r == r->main) ? 1 : 0;
+  buf->last_in_chain = 1;
+
+  ngx_chain_t out;
+  out.next = nullptr;
+  out.buf = buf;
+
+  r->headers_out.status = status;
+  r->headers_out.content_length_n = len;
+  r->headers_out.content_type_len = text_plain.len;
+  r->headers_out.content_type = text_plain;
+  r->headers_out.content_type_lowcase = nullptr;
+
+  ngx_int_t rc = ngx_http_send_header(r);
+  if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+    return rc;
+  }
+  return ngx_http_output_filter(r, &out);
+}
+
+// Sends the completed profile and resets the profiler to idle.
+ngx_int_t SendReadyProfile(ngx_http_request_t *r) {
+  ngx_buf_t *buf = ngx_create_temp_buf(r->pool, ready_profile.size());
+  if (buf == nullptr) {
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+  buf->last =
+      ngx_cpymem(buf->last, ready_profile.data(), ready_profile.size());
+  buf->temporary = 1;
+  buf->last_buf = (r == r->main) ? 1 : 0;
+  buf->last_in_chain = 1;
+
+  ngx_chain_t out;
+  out.next = nullptr;
+  out.buf = buf;
+
+  r->headers_out.status = NGX_HTTP_OK;
+  r->headers_out.content_length_n = ready_profile.size();
+  r->headers_out.content_type_len = application_octet_stream.len;
+  r->headers_out.content_type = application_octet_stream;
+  r->headers_out.content_type_lowcase = nullptr;
+
+  ready_profile.clear();
+  ready_profile.shrink_to_fit();
+  profile_state = PROFILE_IDLE;
+
+  ngx_int_t rc = ngx_http_send_header(r);
+  if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+    return rc;
+  }
+  return ngx_http_output_filter(r, &out);
+}
+
+}  // namespace
+
+void ngx_esp_profiler_record_alloc(size_t sz) {
+  // The sampler itself allocates (backtrace init aside, the table walk
+  // does not, but the lock path may); never sample recursively.
+  if (in_heap_sampler) {
+    return;
+  }
+  if (++heap_alloc_tick % kHeapSampleInterval != 0) {
+    return;
+  }
+  in_heap_sampler = true;
+  void *frames[kHeapFrames];
+  int n = ::backtrace(frames, kHeapFrames);
+  if (n > 0) {
+    uintptr_t hash = 1469598103934665603ull;  // FNV offset basis
+    for (int i = 0; i < n; ++i) {
+      hash = (hash ^ reinterpret_cast<uintptr_t>(frames[i])) *
+             1099511628211ull;
+    }
+    std::lock_guard<std::mutex> lock(heap_table_mutex);
+    if (heap_table != nullptr) {
+      size_t i = 0;
+      for (; i < heap_table_used; ++i) {
+        if (heap_table[i].hash == hash && heap_table[i].nframes == n) {
+          break;
+        }
+      }
+      if (i < heap_table_used) {
+        ++heap_table[i].count;
+        heap_table[i].bytes += sz;
+      } else if (heap_table_used < kMaxHeapStacks) {
+        HeapStack &stack = heap_table[heap_table_used++];
+        stack.hash = hash;
+        stack.nframes = n;
+        for (int f = 0; f < n; ++f) {
+          stack.pcs[f] = reinterpret_cast<uintptr_t>(frames[f]);
+        }
+        stack.count = 1;
+        stack.bytes = sz;
+      } else {
+        ++heap_dropped_stacks;
+      }
+    }
+  }
+  in_heap_sampler = false;
+}
+
+ngx_int_t ngx_esp_profile_handler(ngx_http_request_t *r) {
+  if (!(r->method & (NGX_HTTP_GET | NGX_HTTP_HEAD))) {
+    return NGX_HTTP_NOT_ALLOWED;
+  }
+  ngx_int_t rc = ngx_http_discard_request_body(r);
+  if (rc != NGX_OK) {
+    return rc;
+  }
+
+  switch (profile_state) {
+    case PROFILE_READY:
+      return SendReadyProfile(r);
+
+    case PROFILE_CPU_RUNNING:
+    case PROFILE_HEAP_RUNNING:
+      return SendPlainText(r, NGX_HTTP_SERVICE_UNAVAILABLE,
+                           "profile collection in progress; retry once the "
+                           "requested duration has elapsed\n");
+
+    case PROFILE_IDLE:
+    default:
+      break;
+  }
+
+  int seconds = kDefaultProfileSeconds;
+  ngx_str_t arg = ngx_null_string;
+  if (ngx_http_arg(r, (u_char *)"seconds", sizeof("seconds") - 1, &arg) ==
+      NGX_OK) {
+    ngx_int_t parsed = ngx_atoi(arg.data, arg.len);
+    if (parsed == NGX_ERROR || parsed < 1 || parsed > kMaxProfileSeconds) {
+      return SendPlainText(r, NGX_HTTP_BAD_REQUEST,
+                           "seconds must be between 1 and 60\n");
+    }
+    seconds = static_cast<int>(parsed);
+  }
+
+  ngx_str_null(&arg);
+  ngx_http_arg(r, (u_char *)"type", sizeof("type") - 1, &arg);
+  if (arg.len == sizeof("heap") - 1 &&
+      ngx_strncmp(arg.data, "heap", arg.len) == 0) {
+#ifdef ESP_ALLOC_STATS
+    StartHeapProfile(seconds);
+#else
+    return SendPlainText(r, NGX_HTTP_NOT_IMPLEMENTED,
+                         "heap profiling requires a --define=alloc_stats=1 "
+                         "build\n");
+#endif
+  } else if (arg.len == 0 || (arg.len == sizeof("cpu") - 1 &&
+                              ngx_strncmp(arg.data, "cpu", arg.len) == 0)) {
+    StartCpuProfile(seconds);
+  } else {
+    return SendPlainText(r, NGX_HTTP_BAD_REQUEST,
+                         "type must be cpu or heap\n");
+  }
+
+  return SendPlainText(r, NGX_HTTP_ACCEPTED,
+                       "profile collection started; fetch this endpoint "
+                       "again once the duration has elapsed\n");
+}
+
+}  // namespace nginx
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) Extensible Service Proxy Authors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef NGINX_NGX_ESP_PROFILER_H_
+#define NGINX_NGX_ESP_PROFILER_H_
+
+// On-demand in-process profiling for the endpoints_profile admin
+// endpoint (see the directive in module.cc).
+//
+// A GET with type=cpu starts a bounded-duration CPU sampling profile
+// (SIGPROF timer, 100Hz) and answers 202; fetching the endpoint again
+// after the duration returns the collected profile in the legacy
+// gperftools CPU profile format, which pprof reads directly. type=heap
+// samples the worker's C++ heap allocations through the alloc_stats
+// hooks and returns the legacy text heap profile; it requires a
+// --define=alloc_stats=1 build, since only those builds intercept
+// operator new.
+
+#include <stddef.h>
+#include <atomic>
+
+extern "C" {
+#include "src/http/ngx_http.h"
+}
+
+namespace google {
+namespace api_manager {
+namespace nginx {
+
+// Serves the endpoints_profile endpoint.
+ngx_int_t ngx_esp_profile_handler(ngx_http_request_t *r);
+
+// True while a heap profile is being collected. Checked inline in the
+// allocation path, so an idle profiler costs one relaxed load per
+// allocation.
+extern std::atomic<bool> ngx_esp_heap_profiling_active;
+
+// Slow path: samples one heap allocation into the profile table. Only
+// called through ngx_esp_profiler_count_alloc.
+void ngx_esp_profiler_record_alloc(size_t sz);
+
+// Counts a heap allocation toward the running heap profile. No-op
+// while no profile is being collected.
+inline void ngx_esp_profiler_count_alloc(size_t sz) {
+  if (ngx_esp_heap_profiling_active.load(std::memory_order_relaxed)) {
+    ngx_esp_profiler_record_alloc(sz);
+  }
+}
+
+}  // namespace nginx
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // NGINX_NGX_ESP_PROFILER_H_
@@ -34,7 +34,62 @@ namespace google {
 namespace api_manager {
 namespace nginx {
 
-NgxEspRequest::NgxEspRequest(ngx_http_request_t *r) : r_(r) {}
+namespace {
+
+// The well-known headers ESP probes on the request path, in slot order.
+// All lower case; header names compare case insensitively. Headers whose
+// names are only known at runtime (configured api key headers, logged
+// headers) are not captured and take the scanning path in FindHeader.
+const ngx_str_t kCapturedHeaderNames[] = {
+    ngx_string("authorization"),
+    ngx_string("x-goog-iap-jwt-assertion"),
+    ngx_string("x-api-key"),
+    ngx_string("referer"),
+    ngx_string("grpc-trace-bin"),
+    ngx_string("traceparent"),
+    ngx_string("x-cloud-trace-context"),
+    ngx_string("x-http-method-override"),
+    ngx_string("x-android-package"),
+    ngx_string("x-android-cert"),
+    ngx_string("x-ios-bundle-identifier"),
+};
+
+// Returns the capture slot of a header name, or -1 if it is not one of
+// the captured headers.
+int CapturedHeaderSlot(const u_char *name, size_t len) {
+  for (size_t i = 0;
+       i < sizeof(kCapturedHeaderNames) / sizeof(kCapturedHeaderNames[0]);
+       ++i) {
+    if (len == kCapturedHeaderNames[i].len &&
+        ngx_strncasecmp(kCapturedHeaderNames[i].data,
+                        const_cast<u_char *>(name), len) == 0) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+}  // namespace
+
+NgxEspRequest::NgxEspRequest(ngx_http_request_t *r) : r_(r) {
+  static_assert(
+      sizeof(kCapturedHeaderNames) / sizeof(kCapturedHeaderNames[0]) ==
+          kNumCapturedHeaders,
+      "capture slot count and name table out of sync");
+  // One pass over the header list captures every well-known header, so
+  // the later sequential probes (auth token, api key, trace context, ...)
+  // do not each rescan it. The first occurrence wins, matching
+  // ngx_esp_find_headers_in.
+  for (size_t i = 0; i < kNumCapturedHeaders; ++i) {
+    ngx_str_null(&captured_headers_[i]);
+  }
+  for (auto &h : r_->headers_in) {
+    const int slot = CapturedHeaderSlot(h.key.data, h.key.len);
+    if (slot >= 0 && captured_headers_[slot].len == 0) {
+      captured_headers_[slot] = h.value;
+    }
+  }
+}
 
 NgxEspRequest::~NgxEspRequest() {
   // TODO: Propagate any changes to the headers back to the request.
@@ -130,6 +185,19 @@ bool NgxEspRequest::FindQuery(const std::string &name, std::string *query) {
 }
 
 bool NgxEspRequest::FindHeader(const std::string &name, std::string *header) {
+  // The well-known headers were captured by one pass over the header
+  // list in the constructor; serve those from their slots. A matching
+  // slot is authoritative, so an absent captured header is a miss
+  // without scanning.
+  const int slot = CapturedHeaderSlot(
+      reinterpret_cast<const u_char *>(name.data()), name.size());
+  if (slot >= 0) {
+    if (captured_headers_[slot].len > 0) {
+      *header = ngx_str_to_std(captured_headers_[slot]);
+      return true;
+    }
+    return false;
+  }
   auto h = ngx_esp_find_headers_in(
       r_, reinterpret_cast<u_char *>(const_cast<char *>(name.data())),
       name.size());
@@ -178,6 +246,13 @@ utils::Status NgxEspRequest::AddHeaderToBackend(const std::string &key,
       ngx_str_copy_from_std(r_->pool, value, &h->value) != NGX_OK) {
     return utils::Status(Code::INTERNAL, "Out of memory");
   }
+  // Keep the capture slot of a well-known header in sync with the
+  // rewritten value, so later FindHeader calls do not see a stale copy.
+  const int slot = CapturedHeaderSlot(
+      reinterpret_cast<const u_char *>(key.data()), key.size());
+  if (slot >= 0) {
+    captured_headers_[slot] = h->value;
+  }
   ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r_->connection->log, 0,
                  "updates header to backend: \"%V: %V\"", &h->key, &h->value);
   return utils::Status::OK;
@@ -62,7 +62,20 @@ class NgxEspRequest : public Request {
   virtual bool FindHeader(const std::string &name, std::string *header);
 
  private:
+  // The number of well-known header slots captured by the constructor;
+  // must match the name table in request.cc.
+  static const size_t kNumCapturedHeaders = 11;
+
   ngx_http_request_t *r_;
+
+  // The values of the well-known headers ESP probes during request
+  // processing (auth tokens, api key, trace context, ...), captured by a
+  // single walk over the nginx header list in the constructor.
+  // FindHeader serves these names from their slots; other names fall
+  // back to scanning the header list. The values point into the request
+  // headers (or, after AddHeaderToBackend, into the request pool), so
+  // they stay valid for the lifetime of the request.
+  ngx_str_t captured_headers_[kNumCapturedHeaders];
 };
 
 }  // namespace nginx
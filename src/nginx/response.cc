@@ -60,6 +60,16 @@ Status NgxEspResponse::GetResponseStatus() {
 
 std::size_t NgxEspResponse::GetRequestSize() { return r_->request_length; }
 
+int64_t NgxEspResponse::GetMemoryHighWaterMark() {
+  // Only populated in allocation-stats builds; a zero mark means the
+  // request was not tracked.
+  ngx_esp_request_ctx_t *ctx = ngx_http_esp_ensure_module_ctx(r_);
+  if (ctx == nullptr || ctx->alloc_stats.high_water == 0) {
+    return -1;
+  }
+  return ctx->alloc_stats.high_water;
+}
+
 std::size_t NgxEspResponse::GetResponseSize() { return r_->connection->sent; }
 
 Status NgxEspResponse::GetLatencyInfo(service_control::LatencyInfo *info) {
@@ -46,6 +46,7 @@ class NgxEspResponse : public Response {
   virtual std::size_t GetRequestSize();
   virtual std::size_t GetResponseSize();
   virtual utils::Status GetLatencyInfo(service_control::LatencyInfo *info);
+  virtual int64_t GetMemoryHighWaterMark();
   virtual bool FindHeader(const std::string &name, std::string *header) const;
 
  private:
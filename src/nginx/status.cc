@@ -31,11 +31,13 @@
 
 #include "google/protobuf/util/message_differencer.h"
 #include "include/api_manager/api_manager.h"
+#include "src/api_manager/access_event.h"
 #include "src/api_manager/utils/marshalling.h"
 #include "src/nginx/environment.h"
 #include "src/nginx/module.h"
 #include "src/nginx/proto/status.pb.h"
 #include "src/nginx/version.h"
+#include "src/nginx/zero_copy_stream.h"
 
 extern "C" {
 #include "src/core/ngx_string.h"
@@ -55,6 +57,13 @@ using std::chrono::system_clock;
 using utils::Status;
 using ServiceControlStatisticsProto =
     ::google::api_manager::proto::ServiceControlStatistics;
+using JwtCacheStatisticsProto =
+    ::google::api_manager::proto::JwtCacheStatistics;
+using AuthzCacheStatisticsProto =
+    ::google::api_manager::proto::AuthzCacheStatistics;
+using LatencyHistogramProto = ::google::api_manager::proto::LatencyHistogram;
+using CheckLatencyStatisticsProto =
+    ::google::api_manager::proto::CheckLatencyStatistics;
 using ServiceConfigRolloutsProto =
     ::google::api_manager::proto::ServiceConfigRollouts;
 
@@ -65,6 +74,8 @@ const size_t kMemoryUnit = 1024;
 #endif
 
 ngx_str_t application_json = ngx_string("application/json");
+ngx_str_t prometheus_text = ngx_string("text/plain; version=0.0.4");
+ngx_str_t application_octet_stream = ngx_string("application/octet-stream");
 ngx_str_t shm_name = ngx_string("esp_stats");
 const std::chrono::milliseconds kRefreshInterval(1000);
 const std::chrono::milliseconds kLogStatusInterval(60000);
@@ -75,8 +86,11 @@ ngx_int_t ngx_esp_stats_init_zone(ngx_shm_zone_t *shm_zone, void *data) {
     return NGX_OK;
   }
 
-  // nginx will initialize a slab pool in shared memory but we don't need it
-  shm_zone->data = shm_zone->shm.addr + sizeof(ngx_slab_pool_t);
+  // nginx will initialize a slab pool in shared memory but we don't need
+  // it. Round the stats array up to the next page so the page-aligned
+  // per-worker blocks (see status.h) actually start on page boundaries.
+  shm_zone->data = ngx_align_ptr(
+      shm_zone->shm.addr + sizeof(ngx_slab_pool_t), kPageSize);
 
   return NGX_OK;
 }
@@ -110,6 +124,53 @@ void fill_service_control_statistics(const Statistics &stat,
   pb->set_send_reports_in_flight(stat.send_reports_in_flight);
   pb->set_send_report_operations(stat.send_report_operations);
   pb->set_max_report_size(stat.max_report_size);
+  pb->set_negative_check_cache_hits(stat.negative_check_cache_hits);
+  pb->set_negative_check_cache_misses(stat.negative_check_cache_misses);
+  pb->set_check_verdict_cache_hits(stat.check_verdict_cache_hits);
+  pb->set_check_verdict_cache_misses(stat.check_verdict_cache_misses);
+  pb->set_shared_check_cache_hits(stat.shared_check_cache_hits);
+  pb->set_shared_check_cache_misses(stat.shared_check_cache_misses);
+  pb->set_deduped_in_flight_checks(stat.deduped_in_flight_checks);
+}
+
+void fill_jwt_cache_statistics(const JwtCacheStatistics &stat,
+                               JwtCacheStatisticsProto *pb) {
+  pb->set_hits(stat.hits);
+  pb->set_misses(stat.misses);
+  pb->set_evictions(stat.evictions);
+  pb->set_resident_bytes(stat.resident_bytes);
+}
+
+void fill_authz_cache_statistics(const AuthzCacheStatistics &stat,
+                                 AuthzCacheStatisticsProto *pb) {
+  pb->set_hits(stat.hits);
+  pb->set_misses(stat.misses);
+  pb->set_evictions(stat.evictions);
+  pb->set_resident_bytes(stat.resident_bytes);
+}
+
+void fill_latency_histogram(const LatencyHistogram &stat,
+                            LatencyHistogramProto *pb) {
+  pb->set_count(stat.count);
+  pb->set_total_micros(stat.total_micros);
+  // Trailing empty buckets are omitted to keep the output short.
+  int num_buckets = LatencyHistogram::kNumBuckets;
+  while (num_buckets > 0 && stat.buckets[num_buckets - 1] == 0) {
+    --num_buckets;
+  }
+  for (int i = 0; i < num_buckets; ++i) {
+    pb->add_buckets(stat.buckets[i]);
+  }
+}
+
+void fill_check_latency_statistics(const CheckLatencyStatistics &stat,
+                                   CheckLatencyStatisticsProto *pb) {
+  fill_latency_histogram(stat.fetch_token, pb->mutable_fetch_token());
+  fill_latency_histogram(stat.auth, pb->mutable_auth());
+  fill_latency_histogram(stat.security_rules, pb->mutable_security_rules());
+  fill_latency_histogram(stat.service_control, pb->mutable_service_control());
+  fill_latency_histogram(stat.quota, pb->mutable_quota());
+  fill_latency_histogram(stat.total, pb->mutable_total());
 }
 
 void fill_process_stats(const ngx_esp_process_stats_t &stat,
@@ -129,12 +190,53 @@ void fill_process_stats(const ngx_esp_process_stats_t &stat,
     fill_service_control_statistics(
         stat.esp_stats[j].statistics.service_control_statistics,
         esp_status_proto->mutable_service_control_statistics());
+    fill_jwt_cache_statistics(
+        stat.esp_stats[j].statistics.jwt_cache_statistics,
+        esp_status_proto->mutable_jwt_cache_statistics());
+    fill_authz_cache_statistics(
+        stat.esp_stats[j].statistics.authz_cache_statistics,
+        esp_status_proto->mutable_authz_cache_statistics());
+    // Histograms show up only once something was recorded, so the status
+    // output is unchanged when the latency timers are disabled.
+    if (stat.esp_stats[j].statistics.check_latency_statistics.total.count > 0) {
+      fill_check_latency_statistics(
+          stat.esp_stats[j].statistics.check_latency_statistics,
+          esp_status_proto->mutable_check_latency_statistics());
+    }
     esp_status_proto->mutable_service_config_rollouts()->ParseFromArray(
         stat.esp_stats[j].rollouts, stat.esp_stats[j].rollouts_length);
   }
+
+  // Only populated in allocation-stats builds; see alloc_stats.h.
+  for (int j = 0; j < kMaxAllocStatsMethods; ++j) {
+    const auto &row = stat.method_alloc_stats[j];
+    if (row.selector[0] == '\0') {
+      break;
+    }
+    auto *row_proto = process_status->add_method_alloc_stats();
+    row_proto->set_selector(row.selector);
+    row_proto->set_requests(row.requests);
+    row_proto->set_alloc_count(row.alloc_count);
+    row_proto->set_alloc_bytes(row.alloc_bytes);
+    row_proto->set_high_water_max(row.high_water_max);
+  }
+
+  // The high-water histogram shows up only once something was recorded,
+  // keeping the status output unchanged in regular builds.
+  uint64_t high_water_requests = 0;
+  for (int j = 0; j < kAllocHighWaterBuckets; ++j) {
+    high_water_requests += stat.alloc_high_water_histogram[j];
+  }
+  if (high_water_requests > 0) {
+    for (int j = 0; j < kAllocHighWaterBuckets; ++j) {
+      process_status->add_alloc_high_water_histogram(
+          stat.alloc_high_water_histogram[j]);
+    }
+  }
 }
 
-Status create_status_json(ngx_http_request_t *r, std::string *json) {
+Status create_status_json(ngx_http_request_t *r,
+                          ::google::protobuf::io::ZeroCopyOutputStream *json) {
   nginx::proto::Status status;
 
   fill_server_status_proto(status.mutable_server());
@@ -159,6 +261,85 @@ Status create_status_json(ngx_http_request_t *r, std::string *json) {
       utils::JsonOptions::PRETTY_PRINT | utils::JsonOptions::OUTPUT_DEFAULTS);
 }
 
+// A Prometheus metric rendered from a service control statistics field.
+struct EspServiceControlMetric {
+  const char *name;
+  const char *type;
+  uint64_t Statistics::*field;
+};
+
+const EspServiceControlMetric esp_service_control_metrics[] = {
+    {"esp_service_control_checks_total", "counter",
+     &Statistics::total_called_checks},
+    {"esp_service_control_checks_sent_by_flush_total", "counter",
+     &Statistics::send_checks_by_flush},
+    {"esp_service_control_checks_sent_in_flight_total", "counter",
+     &Statistics::send_checks_in_flight},
+    {"esp_service_control_reports_total", "counter",
+     &Statistics::total_called_reports},
+    {"esp_service_control_reports_sent_by_flush_total", "counter",
+     &Statistics::send_reports_by_flush},
+    {"esp_service_control_reports_sent_in_flight_total", "counter",
+     &Statistics::send_reports_in_flight},
+    {"esp_service_control_report_operations_sent_total", "counter",
+     &Statistics::send_report_operations},
+    {"esp_service_control_max_report_size_bytes", "gauge",
+     &Statistics::max_report_size},
+    {"esp_negative_check_cache_hits_total", "counter",
+     &Statistics::negative_check_cache_hits},
+    {"esp_negative_check_cache_misses_total", "counter",
+     &Statistics::negative_check_cache_misses},
+    {"esp_check_verdict_cache_hits_total", "counter",
+     &Statistics::check_verdict_cache_hits},
+    {"esp_check_verdict_cache_misses_total", "counter",
+     &Statistics::check_verdict_cache_misses},
+    {"esp_shared_check_cache_hits_total", "counter",
+     &Statistics::shared_check_cache_hits},
+    {"esp_shared_check_cache_misses_total", "counter",
+     &Statistics::shared_check_cache_misses},
+    {"esp_deduped_in_flight_checks_total", "counter",
+     &Statistics::deduped_in_flight_checks},
+};
+
+// A Prometheus metric rendered from a jwt cache statistics field.
+struct EspJwtCacheMetric {
+  const char *name;
+  const char *type;
+  uint64_t JwtCacheStatistics::*field;
+};
+
+const EspJwtCacheMetric esp_jwt_cache_metrics[] = {
+    {"esp_jwt_cache_hits_total", "counter", &JwtCacheStatistics::hits},
+    {"esp_jwt_cache_misses_total", "counter", &JwtCacheStatistics::misses},
+    {"esp_jwt_cache_evictions_total", "counter",
+     &JwtCacheStatistics::evictions},
+};
+
+// A Prometheus metric rendered from an authz cache statistics field.
+struct EspAuthzCacheMetric {
+  const char *name;
+  const char *type;
+  uint64_t AuthzCacheStatistics::*field;
+};
+
+const EspAuthzCacheMetric esp_authz_cache_metrics[] = {
+    {"esp_authz_cache_hits_total", "counter", &AuthzCacheStatistics::hits},
+    {"esp_authz_cache_misses_total", "counter", &AuthzCacheStatistics::misses},
+    {"esp_authz_cache_evictions_total", "counter",
+     &AuthzCacheStatistics::evictions},
+};
+
+const int kNumEspServiceControlMetrics =
+    sizeof(esp_service_control_metrics) / sizeof(EspServiceControlMetric);
+const int kNumEspJwtCacheMetrics =
+    sizeof(esp_jwt_cache_metrics) / sizeof(EspJwtCacheMetric);
+const int kNumEspAuthzCacheMetrics =
+    sizeof(esp_authz_cache_metrics) / sizeof(EspAuthzCacheMetric);
+
+// Upper bound of one rendered line: the metric name and type, the service
+// label and a 64 bit decimal value.
+const size_t kMetricsLineSize = kMaxServiceNameSize + 128;
+
 void get_current_memory_usage(long *virtual_size, long *current_rss) {
   // Initialize with -1 to indicate an empty value
   *virtual_size = -1;
@@ -173,6 +354,20 @@ void get_current_memory_usage(long *virtual_size, long *current_rss) {
 #endif
 }
 
+// Locations with identical server configs share one ApiManager (see
+// ngx_http_esp_postconfiguration); true when an earlier location in the
+// array already holds the ApiManager of endpoints[i], so per-instance
+// work is done once.
+bool ngx_esp_shares_earlier_esp(ngx_esp_loc_conf_t **endpoints,
+                                ngx_uint_t i) {
+  for (ngx_uint_t j = 0; j < i; j++) {
+    if (endpoints[j]->esp == endpoints[i]->esp) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace
 
 ngx_int_t ngx_esp_status_handler(ngx_http_request_t *r) {
@@ -202,31 +397,222 @@ ngx_int_t ngx_esp_status_handler(ngx_http_request_t *r) {
     }
   }
 
-  std::string status_json;
-  Status status = create_status_json(r, &status_json);
+  // Serialize the status JSON directly into pool-allocated output buffers to
+  // avoid materializing the full payload in an intermediate string.
+  NgxChainZeroCopyOutputStream json_stream(r->pool);
+  Status status = create_status_json(r, &json_stream);
   if (!status.ok()) {
     return NGX_HTTP_INTERNAL_SERVER_ERROR;
   };
 
+  ngx_chain_t *out = json_stream.Finalize(r == r->main);
+  if (out == nullptr) {
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+
+  r->headers_out.status = NGX_HTTP_OK;
+  r->headers_out.content_length_n = json_stream.ByteCount();
+
+  rc = ngx_http_send_header(r);
+  if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+    return rc;
+  }
+
+  return ngx_http_output_filter(r, out);
+}
+
+ngx_int_t ngx_esp_metrics_handler(ngx_http_request_t *r) {
+  ngx_int_t rc;
+
+  if (!(r->method & (NGX_HTTP_GET | NGX_HTTP_HEAD))) {
+    return NGX_HTTP_NOT_ALLOWED;
+  }
+
+  rc = ngx_http_discard_request_body(r);
+
+  if (rc != NGX_OK) {
+    return rc;
+  }
+
+  r->headers_out.content_type_len = prometheus_text.len;
+  r->headers_out.content_type = prometheus_text;
+  r->headers_out.content_type_lowcase = nullptr;
+
+  if (r->method == NGX_HTTP_HEAD) {
+    r->headers_out.status = NGX_HTTP_OK;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+      return rc;
+    }
+  }
+
+  auto *ccf = reinterpret_cast<ngx_core_conf_t *>(
+      ngx_get_conf(ngx_cycle->conf_ctx, ngx_core_module));
+
+  ngx_int_t worker_processes = ccf->worker_processes;
+
+  auto *mc = reinterpret_cast<ngx_esp_main_conf_t *>(
+      ngx_http_get_module_main_conf(r, ngx_esp_module));
+
+  auto *process_stats =
+      reinterpret_cast<ngx_esp_process_stats_t *>(mc->stats_zone->data);
+
+  // Sum each service's counters across the worker blocks.
+  const char *service_names[kMaxEspNum];
+  ApiManagerStatistics totals[kMaxEspNum];
+  int num_services = 0;
+  ngx_memzero(totals, sizeof(totals));
+
+  for (int i = 0; i < worker_processes; ++i) {
+    const ngx_esp_process_stats_t &process_stat = process_stats[i];
+    for (int j = 0; j < process_stat.num_esp; ++j) {
+      const char *service_name = process_stat.esp_stats[j].service_name;
+      int s = 0;
+      while (s < num_services &&
+             ngx_strcmp(service_names[s], service_name) != 0) {
+        ++s;
+      }
+      if (s == num_services) {
+        if (num_services == kMaxEspNum) continue;
+        service_names[num_services++] = service_name;
+      }
+      totals[s].service_control_statistics.Merge(
+          process_stat.esp_stats[j].statistics.service_control_statistics);
+      totals[s].jwt_cache_statistics.Merge(
+          process_stat.esp_stats[j].statistics.jwt_cache_statistics);
+      totals[s].authz_cache_statistics.Merge(
+          process_stat.esp_stats[j].statistics.authz_cache_statistics);
+    }
+  }
+
+  // Render straight into one response buffer: a TYPE line per metric plus
+  // one sample line per service, each bounded by kMetricsLineSize.
+  size_t size = (kNumEspServiceControlMetrics + kNumEspJwtCacheMetrics +
+                 kNumEspAuthzCacheMetrics) *
+                (num_services + 1) * kMetricsLineSize;
+  ngx_buf_t *buf = ngx_create_temp_buf(r->pool, size);
+  if (buf == nullptr) {
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+
+  u_char *p = buf->last;
+  u_char *end = buf->end;
+  for (int m = 0; m < kNumEspServiceControlMetrics; ++m) {
+    const EspServiceControlMetric &metric = esp_service_control_metrics[m];
+    p = ngx_slprintf(p, end, "# TYPE %s %s\n", metric.name, metric.type);
+    for (int s = 0; s < num_services; ++s) {
+      p = ngx_slprintf(p, end, "%s{service=\"%s\"} %uL\n", metric.name,
+                       service_names[s],
+                       totals[s].service_control_statistics.*metric.field);
+    }
+  }
+  for (int m = 0; m < kNumEspJwtCacheMetrics; ++m) {
+    const EspJwtCacheMetric &metric = esp_jwt_cache_metrics[m];
+    p = ngx_slprintf(p, end, "# TYPE %s %s\n", metric.name, metric.type);
+    for (int s = 0; s < num_services; ++s) {
+      p = ngx_slprintf(p, end, "%s{service=\"%s\"} %uL\n", metric.name,
+                       service_names[s],
+                       totals[s].jwt_cache_statistics.*metric.field);
+    }
+  }
+  for (int m = 0; m < kNumEspAuthzCacheMetrics; ++m) {
+    const EspAuthzCacheMetric &metric = esp_authz_cache_metrics[m];
+    p = ngx_slprintf(p, end, "# TYPE %s %s\n", metric.name, metric.type);
+    for (int s = 0; s < num_services; ++s) {
+      p = ngx_slprintf(p, end, "%s{service=\"%s\"} %uL\n", metric.name,
+                       service_names[s],
+                       totals[s].authz_cache_statistics.*metric.field);
+    }
+  }
+  buf->last = p;
+
+  buf->temporary = 1;
+  buf->last_buf = (r == r->main) ? 1 : 0;
+  buf->last_in_chain = 1;
+
   ngx_chain_t out;
   out.next = nullptr;
+  out.buf = buf;
+
+  r->headers_out.status = NGX_HTTP_OK;
+  r->headers_out.content_length_n = buf->last - buf->pos;
+
+  rc = ngx_http_send_header(r);
+  if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+    return rc;
+  }
+
+  return ngx_http_output_filter(r, &out);
+}
+
+ngx_int_t ngx_esp_access_events_handler(ngx_http_request_t *r) {
+  ngx_int_t rc;
+
+  if (!(r->method & (NGX_HTTP_GET | NGX_HTTP_HEAD))) {
+    return NGX_HTTP_NOT_ALLOWED;
+  }
+
+  rc = ngx_http_discard_request_body(r);
 
-  off_t content_length = status_json.size();
-  ngx_buf_t *buf = ngx_create_temp_buf(r->pool, content_length);
+  if (rc != NGX_OK) {
+    return rc;
+  }
+
+  r->headers_out.content_type_len = application_octet_stream.len;
+  r->headers_out.content_type = application_octet_stream;
+  r->headers_out.content_type_lowcase = nullptr;
+
+  if (r->method == NGX_HTTP_HEAD) {
+    // Answer HEAD without draining, so probing the endpoint does not
+    // consume records.
+    r->headers_out.status = NGX_HTTP_OK;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+      return rc;
+    }
+  }
+
+  std::vector<AccessEventRecord> records;
+  uint64_t dropped = AccessEventBuffer::Instance(0)->Drain(&records);
+
+  // The response is the wire format itself: the fixed drain header
+  // followed by the raw fixed-layout records.
+  AccessEventDrainHeader header;
+  header.magic = kAccessEventMagic;
+  header.version = kAccessEventLayoutVersion;
+  header.record_size = sizeof(AccessEventRecord);
+  header.record_count = records.size();
+  header.dropped = dropped;
+  header.pid = ngx_pid;
+
+  size_t size = sizeof(header) + records.size() * sizeof(AccessEventRecord);
+  ngx_buf_t *buf = ngx_create_temp_buf(r->pool, size);
   if (buf == nullptr) {
     return NGX_HTTP_INTERNAL_SERVER_ERROR;
   }
 
+  ngx_memcpy(buf->last, &header, sizeof(header));
+  buf->last += sizeof(header);
+  if (!records.empty()) {
+    ngx_memcpy(buf->last, records.data(),
+               records.size() * sizeof(AccessEventRecord));
+    buf->last += records.size() * sizeof(AccessEventRecord);
+  }
+
   buf->temporary = 1;
   buf->last_buf = (r == r->main) ? 1 : 0;
   buf->last_in_chain = 1;
 
-  ngx_memcpy(buf->last, status_json.c_str(), content_length);
-  buf->last += content_length;
+  ngx_chain_t out;
+  out.next = nullptr;
   out.buf = buf;
 
   r->headers_out.status = NGX_HTTP_OK;
-  r->headers_out.content_length_n = content_length;
+  r->headers_out.content_length_n = buf->last - buf->pos;
 
   rc = ngx_http_send_header(r);
   if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
@@ -236,6 +622,72 @@ ngx_int_t ngx_esp_status_handler(ngx_http_request_t *r) {
   return ngx_http_output_filter(r, &out);
 }
 
+namespace {
+
+// Applies the posted server config to every configured ESP instance of
+// this worker. Runs once the request body has been read.
+void ngx_esp_server_config_reload_body_handler(ngx_http_request_t *r) {
+  if (r->request_body == nullptr || r->request_body->bufs == nullptr) {
+    ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
+    return;
+  }
+
+  std::string server_config;
+  for (ngx_chain_t *cl = r->request_body->bufs; cl; cl = cl->next) {
+    ngx_buf_t *b = cl->buf;
+    if (b->in_file) {
+      // Server configs are small; require client_body_buffer_size to
+      // cover the posted config instead of reading it back from disk.
+      ngx_http_finalize_request(r, NGX_HTTP_REQUEST_ENTITY_TOO_LARGE);
+      return;
+    }
+    server_config.append(reinterpret_cast<char *>(b->pos), b->last - b->pos);
+  }
+
+  auto *mc = reinterpret_cast<ngx_esp_main_conf_t *>(
+      ngx_http_get_module_main_conf(r, ngx_esp_module));
+  ngx_esp_loc_conf_t **endpoints =
+      reinterpret_cast<ngx_esp_loc_conf_t **>(mc->endpoints.elts);
+  Status status = Status::OK;
+  for (ngx_uint_t i = 0, napis = mc->endpoints.nelts; i < napis; i++) {
+    ngx_esp_loc_conf_t *lc = endpoints[i];
+    if (lc->esp && !ngx_esp_shares_earlier_esp(endpoints, i)) {
+      status = lc->esp->ReloadServerConfig(server_config);
+      if (!status.ok()) break;
+    }
+  }
+
+  if (!status.ok()) {
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "Failed to apply server config: %s",
+                  status.message().c_str());
+    ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
+    return;
+  }
+
+  r->headers_out.status = NGX_HTTP_NO_CONTENT;
+  r->headers_out.content_length_n = 0;
+  r->header_only = 1;
+  ngx_http_finalize_request(r, ngx_http_send_header(r));
+}
+
+}  // namespace
+
+ngx_int_t ngx_esp_server_config_reload_handler(ngx_http_request_t *r) {
+  if (!(r->method & NGX_HTTP_POST)) {
+    return NGX_HTTP_NOT_ALLOWED;
+  }
+
+  r->request_body_in_single_buf = 1;
+
+  ngx_int_t rc = ngx_http_read_client_request_body(
+      r, ngx_esp_server_config_reload_body_handler);
+  if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+    return rc;
+  }
+  return NGX_DONE;
+}
+
 ngx_int_t ngx_esp_add_stats_shared_memory(ngx_conf_t *cf) {
   auto *ccf = reinterpret_cast<ngx_core_conf_t *>(
       ngx_get_conf(cf->cycle->conf_ctx, ngx_core_module));
@@ -245,8 +697,9 @@ ngx_int_t ngx_esp_add_stats_shared_memory(ngx_conf_t *cf) {
     worker_process = NGX_MAX_PROCESSES;
   }
 
-  // nginx will initialize a slab pool in shared memory but we don't need it
-  size_t shm_size = sizeof(ngx_slab_pool_t) +
+  // nginx will initialize a slab pool in shared memory but we don't need
+  // it; kPageSize covers rounding the stats array up to a page boundary.
+  size_t shm_size = sizeof(ngx_slab_pool_t) + kPageSize +
                     sizeof(ngx_esp_process_stats_t) * worker_process;
 
   auto *shm = ngx_shared_memory_add(cf, &shm_name, shm_size, &ngx_esp_module);
@@ -344,7 +797,7 @@ ngx_int_t ngx_esp_init_process_stats(ngx_cycle_t *cycle) {
   int log_disabled_esp = 0;
   for (ngx_uint_t i = 0, napis = mc->endpoints.nelts; i < napis; i++) {
     ngx_esp_loc_conf_t *lc = endpoints[i];
-    if (lc->esp) {
+    if (lc->esp && !ngx_esp_shares_earlier_esp(endpoints, i)) {
       ngx_esp_update_rollout(lc->esp, process_stat, process_stat->num_esp);
 
       if (lc->esp->get_logging_status_disabled()) ++log_disabled_esp;
@@ -376,7 +829,7 @@ ngx_int_t ngx_esp_init_process_stats(ngx_cycle_t *cycle) {
         reinterpret_cast<ngx_esp_loc_conf_t **>(mc->endpoints.elts);
     for (ngx_uint_t i = 0, napis = mc->endpoints.nelts; i < napis; i++) {
       ngx_esp_loc_conf_t *lc = endpoints[i];
-      if (lc->esp) {
+      if (lc->esp && !ngx_esp_shares_earlier_esp(endpoints, i)) {
         ngx_esp_update_rollout(lc->esp, process_stat, esp_idx);
 
         lc->esp->GetStatistics(&process_stat->esp_stats[esp_idx].statistics);
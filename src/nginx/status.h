@@ -43,7 +43,27 @@ const int kMaxEspNum = 10;
 const int kMaxServiceNameSize = 256;
 const int kMaxServiceRolloutsInfoSize = 4096;
 
-typedef struct {
+// Capacity of the per-method allocation table; see alloc_stats.h.
+const int kMaxAllocStatsMethods = 32;
+const int kMaxMethodSelectorSize = 128;
+
+// The per-request memory high-water histogram: bucket i counts requests
+// whose mark was below kAllocHighWaterFirstBucketBytes << i; the last
+// bucket counts everything beyond (128MB with these values).
+const int kAllocHighWaterBuckets = 16;
+const int kAllocHighWaterFirstBucketBytes = 4096;
+
+// Process stats live in an array of per-worker blocks in shared memory;
+// each worker only ever writes its own block and the status handler sums
+// the blocks at scrape time. Pad the block to the page, not just the
+// cache line: each worker first-touches its own block (the ngx_memzero
+// in ngx_esp_init_process_stats), so with page-granular blocks the
+// kernel's first-touch policy places every worker's pages on that
+// worker's NUMA node and steady-state stat writes stay node-local on
+// multi-socket machines.
+const int kPageSize = 4096;
+
+typedef struct alignas(kPageSize) {
   // process ID
   ngx_pid_t pid;
 
@@ -77,6 +97,23 @@ typedef struct {
   };
   EspData esp_stats[kMaxEspNum];
 
+  // Per-method allocation counters; only populated in allocation-stats
+  // builds (--define=alloc_stats=1), empty selectors otherwise. See
+  // alloc_stats.h.
+  struct MethodAllocStats {
+    char selector[kMaxMethodSelectorSize];
+    uint64_t requests;
+    uint64_t alloc_count;
+    uint64_t alloc_bytes;
+    uint64_t high_water_max;
+  };
+  MethodAllocStats method_alloc_stats[kMaxAllocStatsMethods];
+
+  // Histogram of per-request memory high-water marks; see
+  // kAllocHighWaterBuckets above. Only populated in allocation-stats
+  // builds.
+  uint64_t alloc_high_water_histogram[kAllocHighWaterBuckets];
+
 } ngx_esp_process_stats_t;
 
 // Adds shared memory for process stats
@@ -88,6 +125,21 @@ ngx_int_t ngx_esp_init_process_stats(ngx_cycle_t *cycle);
 // Endpoints status content handler
 ngx_int_t ngx_esp_status_handler(ngx_http_request_t *r);
 
+// Endpoints Prometheus metrics content handler
+ngx_int_t ngx_esp_metrics_handler(ngx_http_request_t *r);
+
+// Admin handler applying tunable server config fields posted to it.
+// The reload applies to the worker process serving the POST; with
+// multiple workers, POST once per worker or run a dedicated
+// single-worker admin instance.
+ngx_int_t ngx_esp_server_config_reload_handler(ngx_http_request_t *r);
+
+// Drain handler for binary access event records (see
+// src/api_manager/access_event.h). Each GET empties the ring buffer of
+// the worker process serving it; with multiple workers, poll until all
+// buffers are drained or run a dedicated single-worker admin instance.
+ngx_int_t ngx_esp_access_events_handler(ngx_http_request_t *r);
+
 }  // namespace nginx
 }  // namespace api_manager
 }  // namespace google
@@ -26,8 +26,11 @@
 
 #include "src/nginx/transcoded_grpc_server_call.h"
 
+#include <algorithm>
+#include <cstring>
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "grpc++/support/byte_buffer.h"
@@ -49,17 +52,70 @@ namespace {
 const ngx_str_t kContentTypeApplicationJson = ngx_string("application/json");
 
 const std::string kGrpcStatusDetailsBin = "grpc-status-details-bin";
+
+// The cap on the translated request bytes buffered ahead of the upstream
+// writes. Once the cap is reached (and a complete message is available) the
+// transcoder is not pulled anymore, which leaves the request body chain
+// unconsumed and lets nginx apply read backpressure to the client instead
+// of buffering the whole translated body in memory.
+const size_t kMaxBufferedTranslatedBytes = 64 * 1024;
+
+// The floor of the pre-sized translation slice, used for methods without
+// an estimate yet.
+const size_t kMinTranslationSliceBytes = 1024;
+
+// Worker-local rolling estimates of the translated request bytes per
+// method, keyed by the method selector so estimates survive config
+// rollouts. Message sizes of a given method are highly stable, so
+// ConvertRequestBody() sizes its output slice from the estimate instead
+// of accumulating many chunk-sized slices per message. Bounded by the
+// number of configured methods.
+std::unordered_map<std::string, size_t> translated_request_size_estimates;
+
+// The slice size to pre-allocate for a method, clamped to the buffering
+// cap since ConvertRequestBody() never holds more than that.
+size_t TranslationSliceBytes(const std::string &method_selector) {
+  size_t estimate = kMinTranslationSliceBytes;
+  auto it = translated_request_size_estimates.find(method_selector);
+  if (it != translated_request_size_estimates.end()) {
+    estimate = std::max(estimate, it->second);
+  }
+  return std::min(estimate, kMaxBufferedTranslatedBytes);
+}
+
+// Moves the estimate toward the observed size: jumps up to cover a larger
+// request immediately, decays slowly after smaller ones so a one-off
+// outlier does not pin the allocation size forever.
+void UpdateTranslationSizeEstimate(const std::string &method_selector,
+                                   size_t bytes) {
+  size_t &estimate = translated_request_size_estimates[method_selector];
+  if (bytes > estimate) {
+    estimate = bytes;
+  } else {
+    estimate -= (estimate - bytes) / 8;
+  }
+}
 }  // namespace
 
 NgxEspTranscodedGrpcServerCall::NgxEspTranscodedGrpcServerCall(
     ngx_http_request_t *r,
     std::unique_ptr<NgxRequestZeroCopyInputStream> nginx_request_stream,
     std::unique_ptr<grpc::GrpcZeroCopyInputStream> grpc_response_stream,
-    std::unique_ptr<::google::grpc::transcoding::Transcoder> transcoder)
+    std::unique_ptr<::google::grpc::transcoding::Transcoder> transcoder,
+    const std::string &method_selector)
     : NgxEspGrpcServerCall(r, true),
       nginx_request_stream_(std::move(nginx_request_stream)),
       grpc_response_stream_(std::move(grpc_response_stream)),
-      transcoder_(std::move(transcoder)) {}
+      transcoder_(std::move(transcoder)),
+      method_selector_(method_selector),
+      translated_request_bytes_(0) {}
+
+NgxEspTranscodedGrpcServerCall::~NgxEspTranscodedGrpcServerCall() {
+  if (translated_request_bytes_ > 0 && !method_selector_.empty()) {
+    UpdateTranslationSizeEstimate(method_selector_,
+                                  translated_request_bytes_);
+  }
+}
 
 utils::Status NgxEspTranscodedGrpcServerCall::Create(
     ngx_http_request_t *r,
@@ -90,10 +146,15 @@ utils::Status NgxEspTranscodedGrpcServerCall::Create(
   }
 
   // Create the NgxEspTranscodedGrpcServerCall instance
+  const MethodCallInfo *method_call = ctx->request_handler->method_call();
+  std::string method_selector;
+  if (method_call && method_call->method_info) {
+    method_selector = method_call->method_info->selector();
+  }
   std::shared_ptr<NgxEspTranscodedGrpcServerCall> call(
-      new NgxEspTranscodedGrpcServerCall(r, std::move(nginx_request_stream),
-                                         std::move(grpc_response_stream),
-                                         std::move(transcoder)));
+      new NgxEspTranscodedGrpcServerCall(
+          r, std::move(nginx_request_stream), std::move(grpc_response_stream),
+          std::move(transcoder), method_selector));
   auto status = call->ProcessPrereadRequestBody();
   if (!status.ok()) {
     return status;
@@ -150,9 +211,13 @@ void NgxEspTranscodedGrpcServerCall::Finish(
   if (!ReadTranslatedResponse(&out)) {
     return;
   }
-  // Mark this as the last buffer in the request
+  // Mark the final buffer of the chain as the last buffer in the request
   if (out) {
-    out->buf->last_buf = 1;
+    ngx_chain_t *cl = out;
+    while (cl->next) {
+      cl = cl->next;
+    }
+    cl->buf->last_buf = 1;
   }
 
   // Send the final buffer and finalize the request
@@ -173,13 +238,57 @@ void NgxEspTranscodedGrpcServerCall::Finish(
 
 bool NgxEspTranscodedGrpcServerCall::ConvertRequestBody(
     std::vector<grpc_slice> *out) {
+  size_t buffered = 0;
+  for (const auto &slice : *out) {
+    buffered += GRPC_SLICE_LENGTH(slice);
+  }
   const void *buffer = nullptr;
   int size = 0;
-  // Get the next translated buffer from the Transcoder & add a slice to the
-  // output.
-  while (transcoder_->RequestOutput()->Next(&buffer, &size) && size > 0) {
-    out->push_back(grpc_slice_from_copied_buffer(
-        reinterpret_cast<const char *>(buffer), size));
+  // Get the translated buffers from the Transcoder and coalesce them into
+  // a slice pre-sized from the rolling per-method estimate, so a large
+  // message fills one allocation instead of accumulating a slice per
+  // chunk. Stop pulling once the buffered translated data exceeds the
+  // cap, but never leave a message incomplete - the read loop cannot make
+  // progress without a complete message.
+  grpc_slice current = grpc_empty_slice();
+  size_t filled = 0;
+  while ((buffered < kMaxBufferedTranslatedBytes ||
+          !ContainsCompleteMessage(*out)) &&
+         transcoder_->RequestOutput()->Next(&buffer, &size) && size > 0) {
+    size_t remaining = size;
+    const char *data = reinterpret_cast<const char *>(buffer);
+    while (remaining > 0) {
+      if (filled == GRPC_SLICE_LENGTH(current)) {
+        if (filled > 0) {
+          out->push_back(current);
+        } else {
+          grpc_slice_unref(current);
+        }
+        current = grpc_slice_malloc(
+            std::max(TranslationSliceBytes(method_selector_), remaining));
+        filled = 0;
+      }
+      size_t n = std::min(remaining, GRPC_SLICE_LENGTH(current) - filled);
+      memcpy(GRPC_SLICE_START_PTR(current) + filled, data, n);
+      filled += n;
+      data += n;
+      remaining -= n;
+    }
+    buffered += size;
+    translated_request_bytes_ += size;
+    // The completeness check above only sees *out; once the cap is
+    // reached, trim and flush the open slice so the check covers all
+    // buffered bytes and the loop actually stops.
+    if (buffered >= kMaxBufferedTranslatedBytes && filled > 0) {
+      out->push_back(grpc_slice_sub_no_ref(current, 0, filled));
+      current = grpc_empty_slice();
+      filled = 0;
+    }
+  }
+  if (filled > 0) {
+    out->push_back(grpc_slice_sub_no_ref(current, 0, filled));
+  } else {
+    grpc_slice_unref(current);
   }
   // Check the status
   if (!transcoder_->RequestStatus().ok()) {
@@ -196,7 +305,8 @@ bool NgxEspTranscodedGrpcServerCall::ConvertRequestBody(
 bool NgxEspTranscodedGrpcServerCall::ConvertResponseMessage(
     const ::grpc::ByteBuffer &msg, ngx_chain_t **out) {
   // Serialize ::grpc::ByteBuffer into grpc_byte_buffer
-  grpc_byte_buffer *grpc_msg = ConvertByteBuffer(msg);
+  grpc_byte_buffer *grpc_msg =
+      ConvertByteBuffer(msg, &slice_scratch_, &grpc_slice_scratch_);
   if (!grpc_msg) {
     HandleError(utils::Status(
         NGX_HTTP_INTERNAL_SERVER_ERROR,
@@ -211,44 +321,70 @@ bool NgxEspTranscodedGrpcServerCall::ConvertResponseMessage(
 }
 
 bool NgxEspTranscodedGrpcServerCall::ReadTranslatedResponse(ngx_chain_t **out) {
-  // Allocate an ngx_buf.
-  ngx_buf_t *buf = reinterpret_cast<ngx_buf_t *>(ngx_calloc_buf(r_->pool));
-  ngx_chain_t *cl = reinterpret_cast<ngx_chain_t *>(
-      ngx_palloc(r_->pool, sizeof(ngx_chain_t)));
-  if (!buf || !cl) {
-    ngx_log_error(NGX_LOG_ERR, r_->connection->log, 0,
-                  "Failed to allocate response buffer header for GRPC "
-                  "response message.");
-    return false;
-  }
-  cl->buf = buf;
-  *out = cl;
-  cl->next = nullptr;
-
-  // Read the translated response into an ngx_buf.
+  // Drain every translated fragment the transcoder has ready and link them
+  // into a single chain, so one upstream message costs one pass through
+  // the output filters and nginx can writev the fragments together instead
+  // of traversing the filter chain per fragment.
+  //
+  // The chain links and bufs come from the re-cycled free list: the bufs
+  // of the messages already sent come back through
+  // ngx_chain_update_chains() in WriteBatch(), so a streaming response
+  // reuses the same links and bufs instead of allocating new ones per
+  // message. The buf's own memory (if any) is not used - each buf is
+  // pointed at the translated data owned by the transcoder below.
+  ngx_chain_t *head = nullptr;
+  ngx_chain_t **next = &head;
   const void *buffer = nullptr;
   int size = 0;
-  if (transcoder_->ResponseOutput()->Next(&buffer, &size) && size > 0) {
+  while (transcoder_->ResponseOutput()->Next(&buffer, &size) && size > 0) {
     ngx_log_debug1(
         NGX_LOG_DEBUG_HTTP, r_->connection->log, 0,
         "NgxEspTranscodedGrpcServerCall: Write => %s",
         std::string(reinterpret_cast<const char *>(buffer), size).c_str());
 
+    ngx_chain_t *cl = AllocNgxBufChain(0);
+    if (!cl) {
+      ngx_log_error(NGX_LOG_ERR, r_->connection->log, 0,
+                    "Failed to allocate response buffer header for GRPC "
+                    "response message.");
+      return false;
+    }
+    cl->next = nullptr;
+    ngx_buf_t *buf = cl->buf;
     buf->start = reinterpret_cast<u_char *>(const_cast<void *>(buffer));
     buf->end = buf->start + size;
     buf->pos = buf->start;
     buf->last = buf->pos + size;
-    buf->temporary = 1;
 
-  } else if (!transcoder_->ResponseStatus().ok()) {
+    *next = cl;
+    next = &cl->next;
+  }
+
+  if (!transcoder_->ResponseStatus().ok()) {
     HandleError(utils::Status::FromProto(transcoder_->ResponseStatus()));
     return false;
   }
 
-  // If the transcoder doesn't return any data, we will return an empty ngx_buf
-  buf->last_in_chain = 1;
-  buf->flush = 1;
+  // If the transcoder doesn't return any data, we will return an empty
+  // ngx_buf so the caller still has a chain to mark up.
+  if (head == nullptr) {
+    head = AllocNgxBufChain(0);
+    if (!head) {
+      ngx_log_error(NGX_LOG_ERR, r_->connection->log, 0,
+                    "Failed to allocate response buffer header for GRPC "
+                    "response message.");
+      return false;
+    }
+    head->next = nullptr;
+  }
+
+  // Only the final buf of the chain ends it and asks for a flush.
+  for (ngx_chain_t *cl = head; cl; cl = cl->next) {
+    cl->buf->last_in_chain = (cl->next == nullptr);
+    cl->buf->flush = cl->buf->last_in_chain;
+  }
 
+  *out = head;
   return true;
 }
 
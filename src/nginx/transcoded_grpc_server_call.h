@@ -78,7 +78,12 @@ class NgxEspTranscodedGrpcServerCall : public NgxEspGrpcServerCall {
       ngx_http_request_t* r,
       std::unique_ptr<NgxRequestZeroCopyInputStream> nginx_request_stream,
       std::unique_ptr<grpc::GrpcZeroCopyInputStream> grpc_response_stream,
-      std::unique_ptr<::google::grpc::transcoding::Transcoder> transcoder);
+      std::unique_ptr<::google::grpc::transcoding::Transcoder> transcoder,
+      const std::string& method_selector);
+
+  // Feeds the translated request size of this call into the per-method
+  // size estimate (see transcoded_grpc_server_call.cc).
+  virtual ~NgxEspTranscodedGrpcServerCall();
 
   // Read the translated response message from the transcoder into an
   // ngx_chain_t.
@@ -97,6 +102,12 @@ class NgxEspTranscodedGrpcServerCall : public NgxEspGrpcServerCall {
 
   // The transcoder that does the actual translation
   std::unique_ptr<::google::grpc::transcoding::Transcoder> transcoder_;
+
+  // The selector of the called method; keys the per-method size estimate.
+  std::string method_selector_;
+
+  // Translated request bytes produced by this call so far.
+  size_t translated_request_bytes_;
 };
 
 }  // namespace nginx
@@ -30,34 +30,21 @@ extern "C" {
 #include "src/http/ngx_http.h"
 }
 
+#include "src/nginx/alloc_stats.h"
+
 namespace google {
 namespace api_manager {
 namespace nginx {
 
 namespace {
 
-// Read a file-based ngx_buf_t into a memory-based ngx_buf_t
-ngx_buf_t* ReadFileBuffer(ngx_pool_t* pool, ngx_buf_t* file_buf) {
-  // TODO: If the file is too large, read it in chunks.
-  auto file_size = ngx_buf_size(file_buf);
-  auto buf = ngx_create_temp_buf(pool, file_size);
-  if (!buf) {
-    // Failed to allocate a buffer, return nullptr to indicate an error.
-    return nullptr;
-  }
-
-  // If the buffer's not in memory, we need to read the contents.
-  if (NGX_ERROR == ngx_read_file(file_buf->file, buf->pos,
-                                 ngx_buf_size(file_buf), file_buf->file_pos)) {
-    // Error could not read the file.
-    return nullptr;
-  }
+// The maximum number of bytes of a file-based ngx_buf_t read into memory at
+// a time. Reading in chunks keeps the memory usage bounded even when nginx
+// has spilled a large request body to disk.
+const off_t kFileReadChunkSize = 64 * 1024;
 
-  // Set the size correctly
-  buf->last = buf->pos + file_size;
-
-  return buf;
-}
+// The size of the buffers allocated by NgxChainZeroCopyOutputStream.
+const size_t kOutputBufferSize = 8 * 1024;
 
 bool IsEmptyBuffer(ngx_buf_t* buf) { return !buf || 0 == ngx_buf_size(buf); }
 
@@ -73,7 +60,42 @@ ngx_chain_t* FindNonEmptyChainLink(ngx_chain_t* cl) {
 
 NgxRequestZeroCopyInputStream::NgxRequestZeroCopyInputStream(
     ngx_http_request_t* r)
-    : r_(r), cl_(nullptr), buf_(nullptr), status_(utils::Status::OK) {}
+    : r_(r),
+      cl_(nullptr),
+      buf_(nullptr),
+      file_read_buf_(nullptr),
+      status_(utils::Status::OK) {}
+
+bool NgxRequestZeroCopyInputStream::ReadFileChunk(ngx_buf_t* file_buf) {
+  auto chunk_size = ngx_buf_size(file_buf);
+  if (chunk_size > kFileReadChunkSize) {
+    chunk_size = kFileReadChunkSize;
+  }
+
+  if (!file_read_buf_) {
+    // Allocate the scratch buffer at the full chunk size once; subsequent
+    // chunks reuse it.
+    ngx_esp_count_pool_alloc(kFileReadChunkSize);
+    file_read_buf_ = ngx_create_temp_buf(r_->pool, kFileReadChunkSize);
+    if (!file_read_buf_) {
+      return false;
+    }
+  }
+  file_read_buf_->pos = file_read_buf_->start;
+
+  if (NGX_ERROR == ngx_read_file(file_buf->file, file_read_buf_->pos,
+                                 chunk_size, file_buf->file_pos)) {
+    // Error could not read the file.
+    return false;
+  }
+
+  // Mark the chunk as consumed and set the size correctly
+  file_buf->file_pos += chunk_size;
+  file_read_buf_->last = file_read_buf_->pos + chunk_size;
+
+  buf_ = file_read_buf_;
+  return true;
+}
 
 bool NgxRequestZeroCopyInputStream::Next(const void** data, int* size) {
   if (!status_.ok()) {
@@ -124,6 +146,11 @@ void NgxRequestZeroCopyInputStream::BackUp(int count) {
   // Bytes left in the current buffer
   auto total = buf_ ? (buf_->last - buf_->pos) : 0;
 
+  // Unread file chunks left in the current chain link
+  if (cl_ && cl_->buf && !ngx_buf_in_memory(cl_->buf)) {
+    total += ngx_buf_size(cl_->buf);
+  }
+
   // Bytes left in the subsequent buffers
   auto cl = cl_ ? cl_->next : nullptr;
   while (cl) {
@@ -135,26 +162,20 @@ void NgxRequestZeroCopyInputStream::BackUp(int count) {
 }
 
 bool NgxRequestZeroCopyInputStream::NextBuffer() {
-  // Free the current buffer before moving on to the next one
-  if (cl_ && cl_->buf && !ngx_buf_in_memory(cl_->buf)) {
-    // This was our temp buffer, so free it.
-    ngx_pfree(r_->pool, buf_->start);
-    // Also, mark the file as consumed.
-    cl_->buf->file_pos = cl_->buf->file_last;
-  }
-
-  // Find the next non-empty buffer. If this is the first buffer, start with
+  // Stay on the current chain link while it has unread file data; otherwise
+  // find the next non-empty buffer. If this is the first buffer, start with
   // r_->request_body->bufs.
-  cl_ = FindNonEmptyChainLink(cl_ ? cl_->next : r_->request_body->bufs);
+  if (!cl_ || IsEmptyBuffer(cl_->buf)) {
+    cl_ = FindNonEmptyChainLink(cl_ ? cl_->next : r_->request_body->bufs);
+  }
   if (!cl_) {
     // No data available
     return false;
   }
 
   if (!ngx_buf_in_memory(cl_->buf)) {
-    // A file buffer - read it into memory.
-    buf_ = ReadFileBuffer(r_->pool, cl_->buf);
-    if (!buf_) {
+    // A file buffer - read the next chunk into the scratch buffer.
+    if (!ReadFileChunk(cl_->buf)) {
       ngx_log_error(NGX_LOG_ERR, r_->connection->log, 0,
                     "Failed to read the file buffer.");
       status_ = utils::Status(NGX_HTTP_INTERNAL_SERVER_ERROR,
@@ -171,6 +192,59 @@ bool NgxRequestZeroCopyInputStream::NextBuffer() {
   return true;
 }
 
+NgxChainZeroCopyOutputStream::NgxChainZeroCopyOutputStream(ngx_pool_t* pool)
+    : pool_(pool), head_(nullptr), tail_(nullptr), byte_count_(0) {}
+
+bool NgxChainZeroCopyOutputStream::Next(void** data, int* size) {
+  ngx_buf_t* buf = tail_ ? tail_->buf : nullptr;
+  if (!buf || buf->last >= buf->end) {
+    // The current buffer is full (or there is none yet) - append a new one.
+    ngx_esp_count_pool_alloc(kOutputBufferSize);
+    buf = ngx_create_temp_buf(pool_, kOutputBufferSize);
+    if (!buf) {
+      return false;
+    }
+    ngx_chain_t* cl = ngx_alloc_chain_link(pool_);
+    if (!cl) {
+      return false;
+    }
+    cl->buf = buf;
+    cl->next = nullptr;
+    if (tail_) {
+      tail_->next = cl;
+    } else {
+      head_ = cl;
+    }
+    tail_ = cl;
+  }
+
+  *data = buf->last;
+  *size = static_cast<int>(buf->end - buf->last);
+
+  // Hand out the rest of the buffer; BackUp() returns what goes unused.
+  byte_count_ += *size;
+  buf->last = buf->end;
+
+  return true;
+}
+
+void NgxChainZeroCopyOutputStream::BackUp(int count) {
+  ngx_buf_t* buf = tail_ ? tail_->buf : nullptr;
+  if (buf && 0 < count && count <= buf->last - buf->pos) {
+    buf->last -= count;
+    byte_count_ -= count;
+  }
+}
+
+ngx_chain_t* NgxChainZeroCopyOutputStream::Finalize(bool last_buf) {
+  if (!head_) {
+    return nullptr;
+  }
+  tail_->buf->last_in_chain = 1;
+  tail_->buf->last_buf = last_buf ? 1 : 0;
+  return head_;
+}
+
 }  // namespace nginx
 }  // namespace api_manager
 }  // namespace google
@@ -66,6 +66,11 @@ class NgxRequestZeroCopyInputStream
   // false (if no buffer is available or if an error occurred).
   bool NextBuffer();
 
+  // Reads the next chunk of the file-based file_buf into the reusable
+  // scratch buffer (allocating it on first use) and makes it current.
+  // Returns false on allocation or read errors.
+  bool ReadFileChunk(ngx_buf_t* file_buf);
+
   // The request
   ngx_http_request_t* r_;
 
@@ -76,9 +81,44 @@ class NgxRequestZeroCopyInputStream
   // file-based)
   ngx_buf_t* buf_;
 
+  // The scratch buffer file-based buffers are read into. Allocated once and
+  // reused for every chunk, so draining a disk-spilled body does not
+  // allocate per chunk.
+  ngx_buf_t* file_read_buf_;
+
   utils::Status status_;
 };
 
+// ::google::protobuf::io::ZeroCopyOutputStream implementation that collects
+// the written bytes into a chain of pool-allocated NGINX buffers. It lets
+// serialization code write directly into the buffers handed to the NGINX
+// output filters, avoiding an intermediate std::string copy of the payload.
+class NgxChainZeroCopyOutputStream
+    : public ::google::protobuf::io::ZeroCopyOutputStream {
+ public:
+  NgxChainZeroCopyOutputStream(ngx_pool_t* pool);
+
+  // ZeroCopyOutputStream implementation
+  bool Next(void** data, int* size);
+  void BackUp(int count);
+  ::google::protobuf::int64 ByteCount() const { return byte_count_; }
+
+  // Returns the chain of buffers written so far, marking the final buffer as
+  // the last one of the response when last_buf is set. Returns nullptr if
+  // nothing was written.
+  ngx_chain_t* Finalize(bool last_buf);
+
+ private:
+  // The pool the buffers and chain links are allocated from
+  ngx_pool_t* pool_;
+
+  // Head and tail of the chain built up by Next()
+  ngx_chain_t* head_;
+  ngx_chain_t* tail_;
+
+  ::google::protobuf::int64 byte_count_;
+};
+
 }  // namespace nginx
 }  // namespace api_manager
 }  // namespace google
@@ -0,0 +1,268 @@
+// Copyright (C) Extensible Service Proxy Authors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Offline service config validation and cost estimation. Loads a service
+// config the way ESP does at startup, builds the method dispatch and the
+// transcoder type information, and prints their size and an estimated
+// per-request overhead class per method - so pathological configs (for
+// example 10k-template services) are caught before deploy.
+//
+// Usage: esp_config_stats service_config_file
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/api_manager/config.h"
+#include "src/api_manager/http_template.h"
+#include "src/grpc/transcoding/transcoder_factory.h"
+
+namespace {
+
+using ::google::api_manager::Config;
+using ::google::api_manager::HttpTemplate;
+
+// A minimal environment for offline config loading: config parsing only
+// logs; no timers or outcalls are ever started.
+class CliEnv : public ::google::api_manager::ApiManagerEnvInterface {
+ public:
+  void Log(LogLevel level, const char *message) override {
+    std::cerr << message << std::endl;
+  }
+  std::unique_ptr<::google::api_manager::PeriodicTimer> StartPeriodicTimer(
+      std::chrono::milliseconds interval,
+      std::function<void()> continuation) override {
+    return nullptr;
+  }
+  void RunHTTPRequest(std::unique_ptr<::google::api_manager::HTTPRequest>
+                          request) override {}
+  void RunGRPCRequest(std::unique_ptr<::google::api_manager::GRPCRequest>
+                          request) override {}
+};
+
+// The structural shadow of the dispatch trie, built from the same
+// templates Config registers with its PathMatcher. PathMatcher keeps its
+// nodes private, so the tool mirrors the segment tree to measure it.
+struct TrieStats {
+  std::map<std::string, TrieStats> children;
+};
+
+void InsertTemplate(TrieStats *node, const std::vector<std::string> &segments) {
+  for (const auto &segment : segments) {
+    node = &node->children[segment];
+  }
+}
+
+void MeasureTrie(const TrieStats &node, size_t depth, size_t *nodes,
+                 size_t *max_depth, size_t *key_bytes) {
+  ++*nodes;
+  if (depth > *max_depth) {
+    *max_depth = depth;
+  }
+  for (const auto &child : node.children) {
+    *key_bytes += child.first.size();
+    MeasureTrie(child.second, depth + 1, nodes, max_depth, key_bytes);
+  }
+}
+
+// Extracts (http method, path template) from an http rule. Returns false
+// for rules with no pattern.
+bool GetRulePattern(const ::google::api::HttpRule &rule, std::string *method,
+                    const std::string **path) {
+  switch (rule.pattern_case()) {
+    case ::google::api::HttpRule::kGet:
+      *method = "GET";
+      *path = &rule.get();
+      return true;
+    case ::google::api::HttpRule::kPut:
+      *method = "PUT";
+      *path = &rule.put();
+      return true;
+    case ::google::api::HttpRule::kPost:
+      *method = "POST";
+      *path = &rule.post();
+      return true;
+    case ::google::api::HttpRule::kDelete:
+      *method = "DELETE";
+      *path = &rule.delete_();
+      return true;
+    case ::google::api::HttpRule::kPatch:
+      *method = "PATCH";
+      *path = &rule.patch();
+      return true;
+    case ::google::api::HttpRule::kCustom:
+      *method = rule.custom().kind();
+      *path = &rule.custom().path();
+      return true;
+    default:
+      return false;
+  }
+}
+
+// The per-request service control work a method triggers, in increasing
+// cost: report only, check + report, or check + quota + report.
+const char *OverheadClass(const ::google::api_manager::MethodInfo &method) {
+  if (method.skip_service_control()) {
+    return "none";
+  }
+  if (!method.metric_cost_vector().empty()) {
+    return "check+quota+report";
+  }
+  if (method.auth() || !method.allow_unregistered_calls()) {
+    return "check+report";
+  }
+  return "report";
+}
+
+int64_t ElapsedMs(const std::chrono::steady_clock::time_point &start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " service_config_file" << std::endl;
+    return 1;
+  }
+
+  std::ifstream src(argv[1], std::ifstream::in | std::ifstream::binary);
+  if (!src) {
+    std::cerr << "ERROR: Cannot open " << argv[1] << std::endl;
+    return 1;
+  }
+  std::string contents((std::istreambuf_iterator<char>(src)),
+                       (std::istreambuf_iterator<char>()));
+
+  // Load the config exactly the way ESP does at startup, and time it:
+  // this is the per-worker config reload cost.
+  CliEnv env;
+  auto config_start = std::chrono::steady_clock::now();
+  std::unique_ptr<Config> config = Config::Create(&env, contents);
+  if (!config) {
+    std::cerr << "ERROR: Cannot load service config from " << argv[1]
+              << std::endl;
+    return 1;
+  }
+  int64_t config_ms = ElapsedMs(config_start);
+  const ::google::api::Service &service = config->service();
+
+  std::cout << "service: " << service.name() << std::endl;
+  std::cout << "config load: " << config_ms << " ms" << std::endl;
+
+  // Dispatch trie: mirror the templates Config registered and measure
+  // the tree. The memory estimate uses the node/entry footprint of the
+  // unordered_map based PathMatcherNode trie; it is approximate.
+  TrieStats root;
+  size_t templates = 0;
+  size_t invalid_templates = 0;
+  for (const auto &rule : service.http().rules()) {
+    std::string http_method;
+    const std::string *path;
+    if (!GetRulePattern(rule, &http_method, &path)) {
+      continue;
+    }
+    ++templates;
+    std::unique_ptr<HttpTemplate> ht = HttpTemplate::Parse(*path);
+    if (!ht) {
+      ++invalid_templates;
+      std::cerr << "WARNING: invalid http template: " << *path << std::endl;
+      continue;
+    }
+    InsertTemplate(&root, ht->segments());
+  }
+  // RPC methods without an http rule are served on /<api>/<method>.
+  size_t rpc_only_methods = 0;
+  for (const auto &api : service.apis()) {
+    for (const auto &method : api.methods()) {
+      if (config->GetMethodInfo("POST",
+                                "/" + api.name() + "/" + method.name())) {
+        ++rpc_only_methods;
+        std::vector<std::string> segments{api.name(), method.name()};
+        InsertTemplate(&root, segments);
+      }
+    }
+  }
+
+  size_t nodes = 0, max_depth = 0, key_bytes = 0;
+  MeasureTrie(root, 0, &nodes, &max_depth, &key_bytes);
+  // ~168 bytes of node plus ~64 bytes per hash table entry, from the
+  // PathMatcherNode result map, child map and entry footprints.
+  size_t est_bytes = nodes * 168 + (nodes - 1) * 64 + key_bytes;
+  std::cout << "matcher: " << templates << " http templates, "
+            << rpc_only_methods << " rpc-only methods, " << invalid_templates
+            << " invalid" << std::endl;
+  std::cout << "matcher trie: " << nodes << " nodes, depth " << max_depth
+            << ", ~" << est_bytes / 1024 << " KB" << std::endl;
+
+  // Type universe: what the transcoder's TypeHelper has to index. Time
+  // the factory build; it is the dominant startup cost of large configs.
+  size_t fields = 0;
+  for (const auto &type : service.types()) {
+    fields += type.fields_size();
+  }
+  std::cout << "type universe: " << service.types_size() << " types, "
+            << service.enums_size() << " enums, " << fields << " fields"
+            << std::endl;
+  if (service.apis_size() > 0) {
+    auto factory_start = std::chrono::steady_clock::now();
+    ::google::api_manager::transcoding::TranscoderFactory factory(service);
+    std::cout << "transcoder factory build: " << ElapsedMs(factory_start)
+              << " ms" << std::endl;
+  }
+
+  // Per-method check mask and overhead class.
+  std::cout << std::endl << "methods:" << std::endl;
+  for (const auto &method : config->method_map()) {
+    const ::google::api_manager::MethodInfoImpl &mi = *method.second;
+    std::cout << "  " << method.first << ": "
+              << (mi.auth() ? "auth" : "no-auth") << ", "
+              << (mi.allow_unregistered_calls() ? "key-optional"
+                                                : "key-required")
+              << ", overhead " << OverheadClass(mi) << std::endl;
+  }
+
+  if (nodes > 10000) {
+    std::cerr << "WARNING: " << nodes << " matcher nodes; lookups and "
+              << "config reloads will be expensive" << std::endl;
+  }
+  if (max_depth > 32) {
+    std::cerr << "WARNING: matcher depth " << max_depth
+              << "; deep templates slow every lookup" << std::endl;
+  }
+  if (service.types_size() > 1000) {
+    std::cerr << "WARNING: " << service.types_size()
+              << " types; transcoder type resolution will be slow"
+              << std::endl;
+  }
+  return invalid_templates == 0 ? 0 : 1;
+}
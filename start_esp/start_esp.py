@@ -146,6 +146,7 @@ def write_nginx_conf(ingress, nginx_conf, args):
             underscores_in_headers=args.underscores_in_headers,
             allow_invalid_headers=args.allow_invalid_headers,
             enable_websocket=args.enable_websocket,
+            streaming_request_body=args.enable_streaming_request_body,
             enable_debug=args.enable_debug,
             enable_backend_routing=args.enable_backend_routing,
             client_max_body_size=args.client_max_body_size,
@@ -605,6 +606,14 @@ config file.'''.format(
         help='''Enable nginx WebSocket support.
         ''')
 
+    parser.add_argument('--enable_streaming_request_body', action='store_true',
+        help='''Stream the client request body to the HTTP backend as it
+        arrives by adding the "proxy_request_buffering off;" directive,
+        instead of buffering the whole body before opening the upstream
+        connection. The request size reported to service control is not
+        affected; it is taken from the completed request.
+        ''')
+
     parser.add_argument('--enable_strict_transport_security', action='store_true',
         help='''Enable HSTS (HTTP Strict Transport Security).
         ''')
@@ -1005,6 +1014,8 @@ def enforce_conflict_args(args):
             return "Flag --enable_backend_routing cannot be used together with --enable_strict_transport_security."
         if args.enable_websocket:
             return "Flag --enable_backend_routing cannot be used together with --enable_websocket."
+        if args.enable_streaming_request_body:
+            return "Flag --enable_backend_routing cannot be used together with --enable_streaming_request_body."
         if args.allow_invalid_headers:
             return "Flag --enable_backend_routing cannot be used together with --allow_invalid_headers."
         if args.underscores_in_headers:
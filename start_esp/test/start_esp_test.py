@@ -128,6 +128,11 @@ class TestStartEsp(unittest.TestCase):
         config_generator = self.basic_config_generator + " --enable_websocket"
         self.run_test_with_expectation(expected_config_file, self.generated_nginx_config_file, config_generator)
 
+    def test_enable_streaming_request_body_arg_output_is_as_expected(self):
+        expected_config_file = "./start_esp/test/testdata/expected_enable_streaming_request_body_nginx.conf"
+        config_generator = self.basic_config_generator + " --enable_streaming_request_body"
+        self.run_test_with_expectation(expected_config_file, self.generated_nginx_config_file, config_generator)
+
     def test_enable_debug_arg_output_is_as_expected(self):
         expected_config_file = "./start_esp/test/testdata/expected_enable_debug_nginx.conf"
         config_generator = self.basic_config_generator + " --enable_debug"
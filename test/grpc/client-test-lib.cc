@@ -26,6 +26,7 @@
 //
 #include "test/grpc/client-test-lib.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <cstdlib>
@@ -35,6 +36,7 @@
 #include <random>
 #include <string>
 #include <type_traits>
+#include <vector>
 
 #include <grpc++/alarm.h>
 #include <grpc++/grpc++.h>
@@ -566,6 +568,21 @@ class Parallel {
       stats->set_mean_latency_micros(mean_latency);
       stats->set_stddev_latency_micros(stddev_latency);
 
+      // Percentiles over a sorted copy of the latency samples.
+      std::vector<std::int64_t> sorted_latencies;
+      sorted_latencies.reserve(num_latencies);
+      for (const auto &latency : it.latencies) {
+        sorted_latencies.push_back(latency.count());
+      }
+      std::sort(sorted_latencies.begin(), sorted_latencies.end());
+      auto percentile = [&sorted_latencies](double p) {
+        size_t index = static_cast<size_t>(p * (sorted_latencies.size() - 1));
+        return sorted_latencies[index];
+      };
+      stats->set_p50_latency_micros(percentile(0.50));
+      stats->set_p99_latency_micros(percentile(0.99));
+      stats->set_p999_latency_micros(percentile(0.999));
+
       for (const auto &f : it.failures) {
         f.second.Fill(stats->add_failures());
       }
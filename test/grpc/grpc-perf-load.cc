@@ -0,0 +1,254 @@
+// Copyright (C) Extensible Service Proxy Authors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// A load harness for the GRPC pass-through proxy path.  It drives unary
+// (Echo) and bidi streaming (EchoStream) calls through ESP at a
+// configurable concurrency and message size, and reports messages/sec
+// plus p50/p99/p999 call latency.  When a direct backend address is
+// supplied, the same load is run against the backend without ESP and the
+// per-call latency added by the proxy is reported alongside.
+//
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "test/grpc/client-test-lib.h"
+#include "test/grpc/grpc-test.grpc.pb.h"
+
+namespace test {
+namespace grpc {
+namespace {
+
+struct Options {
+  std::string esp_addr;
+  std::string direct_addr;
+  std::int32_t concurrency = 64;
+  std::int32_t call_count = 2000;
+  std::int32_t payload_size = 1024;
+  std::int32_t stream_call_count = 50;
+  std::int32_t stream_message_count = 100;
+  std::string api_key;
+  std::string auth_token;
+};
+
+// The per-pattern outcome of one run against one server.
+struct Measurement {
+  double messages_per_sec = 0;
+  std::int64_t p50_micros = 0;
+  std::int64_t p99_micros = 0;
+  std::int64_t p999_micros = 0;
+  std::int32_t failed_count = 0;
+};
+
+void FillCallConfig(const Options &opt, CallConfig *config) {
+  if (!opt.api_key.empty()) {
+    config->set_api_key(opt.api_key);
+  }
+  if (!opt.auth_token.empty()) {
+    config->set_auth_token(opt.auth_token);
+  }
+}
+
+void AddUnaryRun(const Options &opt, TestPlans *plans) {
+  auto parallel = plans->add_plans()->mutable_parallel();
+  parallel->set_parallel_limit(opt.concurrency);
+  parallel->set_test_count(opt.call_count);
+  parallel->set_allowed_failure_rate(1.0);
+  auto subtest = parallel->add_subtests();
+  subtest->set_weight(1);
+  auto echo = subtest->mutable_echo();
+  echo->mutable_request()->set_space_payload_size(opt.payload_size);
+  FillCallConfig(opt, echo->mutable_call_config());
+}
+
+void AddStreamRun(const Options &opt, TestPlans *plans) {
+  auto parallel = plans->add_plans()->mutable_parallel();
+  parallel->set_parallel_limit(opt.concurrency);
+  parallel->set_test_count(opt.stream_call_count);
+  parallel->set_allowed_failure_rate(1.0);
+  auto subtest = parallel->add_subtests();
+  subtest->set_weight(1);
+  auto echo_stream = subtest->mutable_echo_stream();
+  echo_stream->add_request()->set_space_payload_size(opt.payload_size);
+  echo_stream->set_count(opt.stream_message_count);
+  FillCallConfig(opt, echo_stream->mutable_call_config());
+}
+
+// Extracts a Measurement from a parallel run result;
+// messages_per_call is 1 for unary runs and the ping-pong count for
+// streaming runs.
+Measurement ExtractMeasurement(const ParallelResult &parallel,
+                               std::int32_t messages_per_call) {
+  const auto &stats = parallel.stats(0);
+  Measurement m;
+  double seconds = static_cast<double>(parallel.total_time_micros()) / 1000000;
+  m.messages_per_sec =
+      static_cast<double>(stats.succeeded_count()) * messages_per_call /
+      seconds;
+  m.p50_micros = stats.p50_latency_micros();
+  m.p99_micros = stats.p99_latency_micros();
+  m.p999_micros = stats.p999_latency_micros();
+  m.failed_count = stats.failed_count();
+  return m;
+}
+
+// Runs the warmup, unary and streaming plans against one server and
+// returns the unary and streaming measurements.
+void MeasureServer(const std::string &server_addr, const Options &opt,
+                   Measurement *unary, Measurement *stream) {
+  TestPlans plans;
+  TestResults results;
+
+  plans.set_server_addr(server_addr);
+
+  // Warmup.
+  auto parallel = plans.add_plans()->mutable_parallel();
+  parallel->set_parallel_limit(10);
+  parallel->set_test_count(100);
+  parallel->set_allowed_failure_rate(1.0);
+  auto subtest = parallel->add_subtests();
+  subtest->set_weight(1);
+  auto echo = subtest->mutable_echo();
+  echo->mutable_request()->set_text("warmup");
+  FillCallConfig(opt, echo->mutable_call_config());
+
+  AddUnaryRun(opt, &plans);
+  AddStreamRun(opt, &plans);
+
+  RunTestPlans(plans, &results);
+
+  // Results: 0 = warmup, 1 = unary, 2 = stream.
+  *unary = ExtractMeasurement(results.results(1).parallel(), 1);
+  *stream = ExtractMeasurement(results.results(2).parallel(),
+                               opt.stream_message_count);
+}
+
+void PrintMeasurement(const char *pattern, const char *path,
+                      const Measurement &m) {
+  std::cout << pattern << " " << path << ": " << m.messages_per_sec
+            << " msgs/sec, latency p50=" << m.p50_micros
+            << "us p99=" << m.p99_micros << "us p999=" << m.p999_micros
+            << "us, " << m.failed_count << " failed" << std::endl;
+}
+
+void PrintAddedLatency(const char *pattern, const Measurement &esp,
+                       const Measurement &direct) {
+  std::cout << pattern << " added latency: p50="
+            << (esp.p50_micros - direct.p50_micros)
+            << "us p99=" << (esp.p99_micros - direct.p99_micros)
+            << "us p999=" << (esp.p999_micros - direct.p999_micros) << "us"
+            << std::endl;
+}
+
+void RunLoad(const Options &opt) {
+  Measurement esp_unary, esp_stream;
+  MeasureServer(opt.esp_addr, opt, &esp_unary, &esp_stream);
+  PrintMeasurement("unary", "via ESP", esp_unary);
+  PrintMeasurement("streaming", "via ESP", esp_stream);
+
+  if (!opt.direct_addr.empty()) {
+    Measurement direct_unary, direct_stream;
+    MeasureServer(opt.direct_addr, opt, &direct_unary, &direct_stream);
+    PrintMeasurement("unary", "direct", direct_unary);
+    PrintMeasurement("streaming", "direct", direct_stream);
+    PrintAddedLatency("unary", esp_unary, direct_unary);
+    PrintAddedLatency("streaming", esp_stream, direct_stream);
+  }
+}
+
+bool ParseFlag(const char *arg, const char *name, std::string *value) {
+  size_t name_len = strlen(name);
+  if (strncmp(arg, name, name_len) != 0 || arg[name_len] != '=') {
+    return false;
+  }
+  *value = arg + name_len + 1;
+  return true;
+}
+
+bool ParseFlag(const char *arg, const char *name, std::int32_t *value) {
+  std::string str;
+  if (!ParseFlag(arg, name, &str)) {
+    return false;
+  }
+  *value = atoi(str.c_str());
+  return true;
+}
+
+void Usage(const char *program) {
+  std::cerr
+      << "Usage: " << program << " <ESP server address> [options]\n"
+      << "  --direct=<addr>        backend address for the no-proxy baseline\n"
+      << "  --concurrency=<n>      calls in flight (default 64)\n"
+      << "  --calls=<n>            unary calls per run (default 2000)\n"
+      << "  --payload=<n>          request payload size in bytes "
+         "(default 1024)\n"
+      << "  --streams=<n>          streaming calls per run (default 50)\n"
+      << "  --stream-count=<n>     messages ping-ponged per streaming call "
+         "(default 100)\n"
+      << "  --api-key=<key>        API key to send with each call\n"
+      << "  --auth-token=<token>   Authorization bearer token to send with "
+         "each call"
+      << std::endl;
+}
+
+bool ParseOptions(int argc, char **argv, Options *opt) {
+  if (argc < 2) {
+    return false;
+  }
+  opt->esp_addr = argv[1];
+  for (int i = 2; i < argc; i++) {
+    if (!ParseFlag(argv[i], "--direct", &opt->direct_addr) &&
+        !ParseFlag(argv[i], "--concurrency", &opt->concurrency) &&
+        !ParseFlag(argv[i], "--calls", &opt->call_count) &&
+        !ParseFlag(argv[i], "--payload", &opt->payload_size) &&
+        !ParseFlag(argv[i], "--streams", &opt->stream_call_count) &&
+        !ParseFlag(argv[i], "--stream-count", &opt->stream_message_count) &&
+        !ParseFlag(argv[i], "--api-key", &opt->api_key) &&
+        !ParseFlag(argv[i], "--auth-token", &opt->auth_token)) {
+      std::cerr << "Unknown option: " << argv[i] << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+}  // namespace grpc
+}  // namespace test
+
+int main(int argc, char **argv) {
+  ::test::grpc::Options options;
+  if (!::test::grpc::ParseOptions(argc, argv, &options)) {
+    ::test::grpc::Usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  ::test::grpc::RunLoad(options);
+
+  return EXIT_SUCCESS;
+}
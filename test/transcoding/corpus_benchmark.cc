@@ -0,0 +1,415 @@
+// Copyright (C) Extensible Service Proxy Authors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+// OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Matcher and transcoder stress benchmarks over a synthesized corpus.
+//
+// Unlike the microbenchmarks next to the code under test, these scale the
+// *configuration*: a generator synthesizes service configs of parameterized
+// size (N methods, M of them with variable path templates, K message types,
+// modeled on test/transcoding/bookstore.proto and the
+// src/api_manager/testdata configs), and a driver replays a skewed URL
+// distribution - a few hot methods, a long cold tail, the shape recorded
+// traces have - against PathMatcher and TranscoderFactory. Build and run
+// with
+//
+//   bazel run -c opt //test/transcoding:corpus_benchmark
+//
+// to estimate routing/transcoding cost at a deployment's config size before
+// rolling it out.
+
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "google/api/service.pb.h"
+#include "google/protobuf/type.pb.h"
+#include "grpc_transcoding/transcoder.h"
+#include "include/api_manager/method.h"
+#include "include/api_manager/method_call_info.h"
+#include "src/api_manager/path_matcher.h"
+#include "src/grpc/transcoding/transcoder_factory.h"
+#include "test/test_common.h"
+
+namespace google {
+namespace api_manager {
+
+namespace {
+
+namespace pb = ::google::protobuf;
+namespace pbio = ::google::protobuf::io;
+
+using ::google::grpc::transcoding::Transcoder;
+using ::google::grpc::transcoding::testing::TestZeroCopyInputStream;
+using transcoding::TranscoderFactory;
+
+// How many distinct URLs a replay trace holds. Large enough that the
+// branch predictor cannot memorize the trace, small enough to stay in
+// cache so the trace itself does not dominate the measurement.
+const int kTraceLength = 1024;
+
+////////////////////////////////////////////////////////////////////////////////
+// Corpus generator
+////////////////////////////////////////////////////////////////////////////////
+
+// Dimensions of a synthesized service config.
+struct CorpusOptions {
+  // Total number of methods (one http rule each).
+  int methods;
+  // How many of the methods use variable path templates; the rest use
+  // literal paths. Capped at |methods|.
+  int variable_templates;
+  // Number of distinct message types the methods are spread over.
+  int types;
+};
+
+// Path template of method |i|: the first |variable_templates| methods get a
+// two-variable template, the rest a literal path, each under its own API
+// prefix the way a multi-API config lays them out.
+std::string MethodPathTemplate(const CorpusOptions& opts, int i) {
+  if (i < opts.variable_templates) {
+    return "/v1/corpus" + std::to_string(i) + "/items/{item}/versions/{ver}";
+  }
+  return "/v1/corpus" + std::to_string(i) + "/items";
+}
+
+std::string TypeName(int k) {
+  return "endpoints.benchmark.Resource" + std::to_string(k);
+}
+
+std::string TypeUrl(int k) {
+  return "type.googleapis.com/" + TypeName(k);
+}
+
+void AddStringField(pb::Type* type, int number, const std::string& name) {
+  pb::Field* field = type->add_fields();
+  field->set_kind(pb::Field::TYPE_STRING);
+  field->set_cardinality(pb::Field::CARDINALITY_OPTIONAL);
+  field->set_number(number);
+  field->set_name(name);
+  field->set_json_name(name);
+}
+
+// Synthesizes a service config of the requested size: K resource types in
+// the bookstore mold (a name, a payload string, repeated notes), N methods
+// spread round-robin over the types, and one http rule per method.
+::google::api::Service SynthesizeService(const CorpusOptions& opts) {
+  ::google::api::Service service;
+  service.set_name("corpus.endpoints.benchmark.cloud.goog");
+
+  for (int k = 0; k < opts.types; ++k) {
+    pb::Type* type = service.add_types();
+    type->set_name(TypeName(k));
+    type->set_syntax(pb::SYNTAX_PROTO3);
+    AddStringField(type, 1, "name");
+    AddStringField(type, 2, "payload");
+    pb::Field* notes = type->add_fields();
+    notes->set_kind(pb::Field::TYPE_STRING);
+    notes->set_cardinality(pb::Field::CARDINALITY_REPEATED);
+    notes->set_number(3);
+    notes->set_name("notes");
+    notes->set_json_name("notes");
+  }
+
+  ::google::protobuf::Api* api = service.add_apis();
+  api->set_name("endpoints.benchmark.Corpus");
+  for (int i = 0; i < opts.methods; ++i) {
+    const std::string method_name = "Method" + std::to_string(i);
+    pb::Method* method = api->add_methods();
+    method->set_name(method_name);
+    method->set_request_type_url(TypeUrl(i % opts.types));
+    method->set_response_type_url(TypeUrl(i % opts.types));
+
+    ::google::api::HttpRule* rule = service.mutable_http()->add_rules();
+    rule->set_selector(api->name() + "." + method_name);
+    rule->set_post(MethodPathTemplate(opts, i));
+    rule->set_body("*");
+  }
+  return service;
+}
+
+// A skewed sequence of method indices: a few hot methods take most of the
+// traffic and the tail is long and cold, weighting method of rank r with
+// 1/(r+1) the way recorded production URL distributions fall off.
+std::vector<int> SynthesizeTrace(int methods) {
+  std::vector<double> weights;
+  for (int i = 0; i < methods; ++i) {
+    weights.push_back(1.0 / (i + 1));
+  }
+  std::mt19937 gen(42);
+  std::discrete_distribution<int> pick(weights.begin(), weights.end());
+  std::vector<int> trace(kTraceLength);
+  for (auto& index : trace) {
+    index = pick(gen);
+  }
+  return trace;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// PathMatcher replay
+////////////////////////////////////////////////////////////////////////////////
+
+// A minimal method type for the matcher; Lookup() only consults the two
+// accessors below.
+class CorpusMethod {
+ public:
+  const std::set<std::string>& system_query_parameter_names() const {
+    return system_query_parameter_names_;
+  }
+  bool keep_binding_escaped() const { return false; }
+
+ private:
+  std::set<std::string> system_query_parameter_names_;
+};
+
+// VariableBinding as expected by PathMatcher::Lookup.
+struct CorpusBinding {
+  std::vector<std::string> field_path;
+  std::string value;
+};
+
+PathMatcherPtr<CorpusMethod*> BuildCorpusMatcher(
+    const ::google::api::Service& service,
+    std::vector<CorpusMethod>* methods) {
+  PathMatcherBuilder<CorpusMethod*> builder;
+  methods->resize(service.http().rules_size());
+  for (int i = 0; i < service.http().rules_size(); ++i) {
+    builder.Register("POST", service.http().rules(i).post(), std::string(),
+                     &(*methods)[i]);
+  }
+  return builder.Build();
+}
+
+// Replays the skewed URL trace against a matcher built from a synthesized
+// config of state.range(0) methods, half of them with variable templates.
+void BM_CorpusPathMatcherReplay(benchmark::State& state) {
+  CorpusOptions opts;
+  opts.methods = state.range(0);
+  opts.variable_templates = opts.methods / 2;
+  opts.types = 8;
+  ::google::api::Service service = SynthesizeService(opts);
+
+  std::vector<CorpusMethod> methods;
+  auto matcher = BuildCorpusMatcher(service, &methods);
+
+  std::vector<std::string> urls;
+  for (int index : SynthesizeTrace(opts.methods)) {
+    std::string url = MethodPathTemplate(opts, index);
+    if (index < opts.variable_templates) {
+      url = "/v1/corpus" + std::to_string(index) + "/items/42/versions/7";
+    }
+    urls.push_back(url);
+  }
+
+  const std::string http_method = "POST";
+  const std::string query_params;
+  int64_t bytes = 0;
+  size_t i = 0;
+  for (auto _ : state) {
+    const std::string& url = urls[i++ % urls.size()];
+    std::vector<CorpusBinding> bindings;
+    std::string body_field_path;
+    CorpusMethod* method = matcher->Lookup(http_method, url, query_params,
+                                           &bindings, &body_field_path);
+    benchmark::DoNotOptimize(method);
+    bytes += url.size();
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_CorpusPathMatcherReplay)->Arg(16)->Arg(256)->Arg(4096);
+
+////////////////////////////////////////////////////////////////////////////////
+// TranscoderFactory replay
+////////////////////////////////////////////////////////////////////////////////
+
+// MethodInfo implementation with just enough behavior for the
+// TranscoderFactory; everything the transcoder does not consult returns an
+// empty value.
+class CorpusMethodInfo : public MethodInfo {
+ public:
+  CorpusMethodInfo() {}
+  void set_type_url(const std::string& type_url) {
+    request_type_url_ = type_url;
+    response_type_url_ = type_url;
+  }
+
+  // Methods that the transcoder does use.
+  const std::string& request_type_url() const { return request_type_url_; }
+  bool request_streaming() const { return false; }
+  const std::string& response_type_url() const { return response_type_url_; }
+  bool response_streaming() const { return false; }
+  const std::string& body_field_path() const { return body_field_path_; }
+
+  // Methods that the transcoder doesn't use.
+  const std::string& name() const { return empty_; }
+  const std::string& api_name() const { return empty_; }
+  const std::string& api_version() const { return empty_; }
+  const std::string& selector() const { return empty_; }
+  bool auth() const { return false; }
+  bool allow_unregistered_calls() const { return false; }
+  bool skip_service_control() const { return false; }
+  bool isIssuerAllowed(const std::string& issuer) const { return false; }
+  bool isAudienceAllowed(const std::string& issuer,
+                         const std::set<std::string>& jwt_audiences) const {
+    return false;
+  }
+  const std::vector<std::string>* http_header_parameters(
+      const std::string& name) const {
+    return nullptr;
+  }
+  const std::vector<std::string>* url_query_parameters(
+      const std::string& name) const {
+    return nullptr;
+  }
+  const std::vector<std::string>* api_key_http_headers() const {
+    return nullptr;
+  }
+  const std::vector<std::string>* api_key_url_query_parameters() const {
+    return nullptr;
+  }
+  const std::string& backend_address() const { return empty_; }
+  const std::string& backend_path() const { return empty_; }
+  const ::google::api::BackendRule_PathTranslation backend_path_translation()
+      const {
+    return ::google::api::
+        BackendRule_PathTranslation_PATH_TRANSLATION_UNSPECIFIED;
+  }
+  const std::string& backend_jwt_audience() const { return empty_; }
+  const std::string& rpc_method_full_name() const { return empty_; }
+  const std::set<std::string>& system_query_parameter_names() const {
+    static std::set<std::string> dummy;
+    return dummy;
+  }
+  bool keep_binding_escaped() const { return false; }
+  const std::vector<std::pair<std::string, int>>& metric_cost_vector() const {
+    static std::vector<std::pair<std::string, int>> dummy;
+    return dummy;
+  }
+  const std::string& authorization_url_by_issuer(
+      const std::string& issuer) const {
+    return empty_;
+  }
+  const std::string& first_authorization_url() const { return empty_; }
+
+ private:
+  std::string request_type_url_;
+  std::string response_type_url_;
+  std::string body_field_path_;
+  std::string empty_;
+};
+
+// Drains a ZeroCopyInputStream, returning the number of bytes read.
+int64_t Drain(pbio::ZeroCopyInputStream* stream) {
+  int64_t total = 0;
+  const void* data = nullptr;
+  int size = 0;
+  while (stream->Next(&data, &size) && 0 != size) {
+    total += size;
+  }
+  return total;
+}
+
+// A JSON request body for the synthesized resource types.
+std::string BuildRequestJson() {
+  std::ostringstream body;
+  body << R"({"name": "items/42/versions/7", "payload": ")"
+       << std::string(256, 'x') << R"(", "notes": ["first", "second"]})";
+  return body.str();
+}
+
+// Measures TranscoderFactory construction as the number of types in the
+// config grows - the cost a config rollout pays up front.
+void BM_CorpusFactoryConstruction(benchmark::State& state) {
+  CorpusOptions opts;
+  opts.methods = 64;
+  opts.variable_templates = 32;
+  opts.types = state.range(0);
+  ::google::api::Service service = SynthesizeService(opts);
+
+  for (auto _ : state) {
+    TranscoderFactory factory(service);
+    benchmark::DoNotOptimize(&factory);
+  }
+}
+BENCHMARK(BM_CorpusFactoryConstruction)->Arg(8)->Arg(128)->Arg(1024);
+
+// Replays the skewed trace against one factory: per request, resolve a
+// binding, create a transcoder for the method's type and translate a JSON
+// request body - the per-call transcoding work - with the number of types
+// the methods are spread over as the parameter.
+void BM_CorpusTranscodeReplay(benchmark::State& state) {
+  CorpusOptions opts;
+  opts.methods = 64;
+  opts.variable_templates = 32;
+  opts.types = state.range(0);
+  ::google::api::Service service = SynthesizeService(opts);
+  TranscoderFactory factory(service);
+
+  std::vector<CorpusMethodInfo> method_infos(opts.methods);
+  for (int i = 0; i < opts.methods; ++i) {
+    method_infos[i].set_type_url(TypeUrl(i % opts.types));
+  }
+  std::vector<int> trace = SynthesizeTrace(opts.methods);
+  const std::string json = BuildRequestJson();
+
+  int64_t bytes = 0;
+  size_t i = 0;
+  for (auto _ : state) {
+    MethodCallInfo call_info;
+    call_info.method_info = &method_infos[trace[i++ % trace.size()]];
+
+    VariableBinding binding;
+    binding.field_path.push_back("name");
+    binding.value = "items/42/versions/7";
+    call_info.variable_bindings.emplace_back(std::move(binding));
+
+    std::unique_ptr<Transcoder> transcoder;
+    TestZeroCopyInputStream request_in, response_in;
+    auto status =
+        factory.Create(call_info, &request_in, &response_in, &transcoder);
+    if (!status.ok()) {
+      state.SkipWithError("failed to create the transcoder");
+      return;
+    }
+
+    request_in.AddChunk(json);
+    request_in.Finish();
+    benchmark::DoNotOptimize(Drain(transcoder->RequestOutput()));
+    bytes += json.size();
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_CorpusTranscodeReplay)->Arg(4)->Arg(64);
+
+}  // namespace
+
+}  // namespace api_manager
+}  // namespace google
+
+BENCHMARK_MAIN();